@@ -85,6 +85,18 @@ struct ind_cfg_ops {
      * for this entry.
      */
     const char *filename;
+
+    /**
+     * Config paths read by this module
+     *
+     * Optional NULL-terminated list of period delimited paths, like
+     * "logging.connection" or "controllers". If set, a reload of the
+     * default configuration file skips this module's stage and commit
+     * when nothing under any of these paths changed since the last
+     * configuration was committed. If NULL the module is always
+     * reconfigured.
+     */
+    const char * const *paths;
 };
 
 /* If entry's filename is NULL or empty string, use default config */
@@ -106,6 +118,30 @@ extern void ind_cfg_register(const struct ind_cfg_ops *ops);
  */
 extern indigo_error_t ind_cfg_load(void);
 
+/**
+ * Load a new configuration without blocking the event loop
+ *
+ * The configuration files are read and parsed on a helper thread. The
+ * stage and commit callbacks are then called, in the same order as
+ * ind_cfg_load, from a task on the calling thread's event loop that
+ * yields between modules.
+ *
+ * Returns INDIGO_ERROR_PENDING once the load is started. If a load is
+ * already in progress another one is started when it finishes.
+ */
+extern indigo_error_t ind_cfg_load_async(void);
+
+/**
+ * Check whether part of the configuration changed
+ * @param path Period delimited path, as for ind_cfg_lookup
+ *
+ * Compares the configuration being loaded with the one last committed
+ * from the default configuration file. Only meaningful from the stage and
+ * commit callbacks of ind_cfg_load; returns true at other times, for the
+ * non-default configuration files, and for the first load.
+ */
+extern int ind_cfg_changed(const char *path);
+
 extern indigo_error_t ind_cfg_install_sighup_handler(void);
 
 extern indigo_error_t ind_cfg_filename_set(char *filename);
@@ -22,6 +22,8 @@
 #include "configuration_log.h"
 #include <cjson/cJSON.h>
 #include <BigList/biglist.h>
+#include <SocketManager/socketmanager.h>
+#include <pthread.h>
 
 /* List of struct ind_cfg_ops pointers */
 static biglist_t *cfg_registration_list;
@@ -29,6 +31,21 @@ static biglist_t *cfg_registration_list;
 /* Filename that current_cfg was read from. */
 static char *current_filename;
 
+/* Last committed configuration from current_filename */
+static cJSON *committed_root;
+
+/* Configuration being loaded, during ind_cfg_load */
+static cJSON *staged_root;
+
+/* Load being applied; no other may start until it finishes */
+static struct cfg_load *active_load;
+
+/* Another ind_cfg_load_async was requested while active_load ran */
+static int reload_requested;
+
+/* A module registered during active_load; forget the diff base after it */
+static int forget_committed;
+
 
 indigo_error_t
 ind_cfg_filename_set(char *filename)
@@ -76,6 +93,14 @@ ind_cfg_register(const struct ind_cfg_ops *ops)
         AIM_LOG_INFO("Registering cfg client for %s", ops->filename);
     }
     cfg_registration_list = biglist_append(cfg_registration_list, (void *)ops);
+
+    /* The new module hasn't seen the committed configuration */
+    if (active_load != NULL) {
+        forget_committed = 1;
+    } else {
+        cJSON_Delete(committed_root);
+        committed_root = NULL;
+    }
 }
 
 /*
@@ -162,35 +187,339 @@ parse_json_file(const char *filename)
 }
 
 /*
- * Iterate thru the registered users and process any entries which
- * use a non-default configuration file
+ * Structural comparison of two cJSON trees
+ *
+ * Object members may be in any order; array elements may not.
  */
+static int
+json_equal(const cJSON *a, const cJSON *b)
+{
+    const cJSON *child, *other;
+    int count_a = 0, count_b = 0;
 
-static void
-update_nondefault_config(void)
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+
+    if ((a->type & 0xff) != (b->type & 0xff)) {
+        return 0;
+    }
+
+    switch (a->type & 0xff) {
+    case cJSON_Number:
+        return a->valuedouble == b->valuedouble;
+    case cJSON_String:
+        return !strcmp(a->valuestring, b->valuestring);
+    case cJSON_Array:
+        for (child = a->child, other = b->child; child && other;
+             child = child->next, other = other->next) {
+            if (!json_equal(child, other)) {
+                return 0;
+            }
+        }
+        return child == NULL && other == NULL;
+    case cJSON_Object:
+        for (child = a->child; child; child = child->next) {
+            count_a++;
+            other = cJSON_GetObjectItem((cJSON *)b, child->string);
+            if (!json_equal(child, other)) {
+                return 0;
+            }
+        }
+        for (other = b->child; other; other = other->next) {
+            count_b++;
+        }
+        return count_a == count_b;
+    default:
+        return 1;
+    }
+}
+
+int
+ind_cfg_changed(const char *path)
 {
-    cJSON *root;
+    cJSON *old_node, *new_node;
+
+    if (committed_root == NULL || staged_root == NULL) {
+        return 1;
+    }
+
+    (void) ind_cfg_lookup(committed_root, path, &old_node);
+    (void) ind_cfg_lookup(staged_root, path, &new_node);
+
+    return !json_equal(old_node, new_node);
+}
+
+/*
+ * Whether a module must be staged and committed for this load
+ */
+static int
+ops_changed(const struct ind_cfg_ops *ops)
+{
+    const char * const *path;
+
+    if (ops->paths == NULL) {
+        return 1;
+    }
+
+    for (path = ops->paths; *path; path++) {
+        if (ind_cfg_changed(*path)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * A configuration load in progress
+ *
+ * The files are parsed first, possibly on a helper thread, then
+ * cfg_load_step applies them one module at a time on the event loop.
+ */
+
+enum cfg_load_phase {
+    CFG_LOAD_NONDEFAULT,
+    CFG_LOAD_STAGE,
+    CFG_LOAD_COMMIT,
+    CFG_LOAD_DONE,
+};
+
+struct cfg_nondefault {
+    const struct ind_cfg_ops *ops;
+    cJSON *root;                /* NULL if the file could not be parsed */
+};
+
+struct cfg_load {
+    char *filename;             /* Copy of current_filename, or NULL */
+    cJSON *root;                /* NULL if filename could not be parsed */
+    int num_nondefault;
+    struct cfg_nondefault *nondefault;
+    ind_soc_loop_t *loop;       /* Runs the stage and commit phases */
+    enum cfg_load_phase phase;
+    int next_nondefault;
+    biglist_t *next_ops;
+    int failed;
+    int skipped;
+    indigo_error_t rv;
+    int orphaned;               /* Set by the helper thread if it could not
+                                   post the load; see cfg_load_reclaim */
+};
+
+static struct cfg_load *
+cfg_load_create(void)
+{
+    struct cfg_load *load;
     biglist_t *el;
 
+    if ((load = calloc(1, sizeof(*load))) == NULL) {
+        return NULL;
+    }
+
+    if (current_filename != NULL &&
+            (load->filename = strdup(current_filename)) == NULL) {
+        free(load);
+        return NULL;
+    }
+
+    BIGLIST_FOREACH(el, cfg_registration_list) {
+        struct ind_cfg_ops *ops = el->data;
+        if (!IND_CFG_ENTRY_USES_DEFAULT(ops)) {
+            load->num_nondefault++;
+        }
+    }
+
+    load->nondefault = calloc(load->num_nondefault + 1,
+                              sizeof(*load->nondefault));
+    if (load->nondefault == NULL) {
+        free(load->filename);
+        free(load);
+        return NULL;
+    }
+
+    load->num_nondefault = 0;
     BIGLIST_FOREACH(el, cfg_registration_list) {
         struct ind_cfg_ops *ops = el->data;
         if (!IND_CFG_ENTRY_USES_DEFAULT(ops)) {
-            AIM_LOG_VERBOSE("Loading non-default cfg file %s", ops->filename);
-            root = parse_json_file(ops->filename);
-            if (root == NULL) {
+            load->nondefault[load->num_nondefault++].ops = ops;
+        }
+    }
+
+    return load;
+}
+
+static void
+cfg_load_destroy(struct cfg_load *load)
+{
+    int i;
+
+    for (i = 0; i < load->num_nondefault; i++) {
+        cJSON_Delete(load->nondefault[i].root);
+    }
+    cJSON_Delete(load->root);
+    free(load->nondefault);
+    free(load->filename);
+    free(load);
+}
+
+/*
+ * Read and parse every file of a load
+ *
+ * Touches nothing but the load, so it may run on any thread.
+ */
+static void
+cfg_load_parse(struct cfg_load *load)
+{
+    int i;
+
+    for (i = 0; i < load->num_nondefault; i++) {
+        struct cfg_nondefault *nondefault = &load->nondefault[i];
+        AIM_LOG_VERBOSE("Loading non-default cfg file %s",
+                        nondefault->ops->filename);
+        nondefault->root = parse_json_file(nondefault->ops->filename);
+    }
+
+    if (load->filename != NULL) {
+        load->root = parse_json_file(load->filename);
+    }
+}
+
+/*
+ * Apply the next module's configuration
+ *
+ * Non-default configuration files are staged and committed one at a
+ * time, then every module using the default file is staged, and, if all
+ * stages succeeded, committed. Returns nonzero once the load is done,
+ * with the result in load->rv.
+ */
+static int
+cfg_load_step(struct cfg_load *load)
+{
+    const struct ind_cfg_ops *ops;
+
+    switch (load->phase) {
+    case CFG_LOAD_NONDEFAULT:
+        if (load->next_nondefault < load->num_nondefault) {
+            struct cfg_nondefault *nondefault =
+                &load->nondefault[load->next_nondefault++];
+            ops = nondefault->ops;
+            if (nondefault->root == NULL) {
                 /* parse_json_file() logged a detailed message. */
                 AIM_LOG_ERROR("Could not load non-default cfg file %s",
                               ops->filename);
+            } else if (ops->stage(nondefault->root) < 0) {
+                AIM_LOG_ERROR("Failed to stage non-default cfg file %s",
+                              ops->filename);
             } else {
-                if (ops->stage(root) < 0) {
-                    AIM_LOG_ERROR("Failed to stage non-default cfg file %s",
-                                  ops->filename);
-                } else {
-                    ops->commit();
+                ops->commit();
+            }
+            return 0;
+        }
+
+        if (load->filename == NULL) {
+            AIM_LOG_WARN("received SIGHUP but not using a config file");
+            load->rv = INDIGO_ERROR_NONE;
+            load->phase = CFG_LOAD_DONE;
+            return 1;
+        }
+
+        if (load->root == NULL) {
+            /* parse_json_file() logged a detailed message. */
+            AIM_LOG_ERROR("Configuration unchanged; could not load %s.",
+                          load->filename);
+            load->rv = INDIGO_ERROR_PARSE;
+            load->phase = CFG_LOAD_DONE;
+            return 1;
+        }
+
+        AIM_LOG_INFO("Staging new configuration");
+        staged_root = load->root;
+        load->next_ops = cfg_registration_list;
+        load->phase = CFG_LOAD_STAGE;
+        return 0;
+
+    case CFG_LOAD_STAGE:
+        if (load->next_ops != NULL) {
+            ops = load->next_ops->data;
+            load->next_ops = load->next_ops->next;
+            if (IND_CFG_ENTRY_USES_DEFAULT(ops)) {
+                if (!ops_changed(ops)) {
+                    load->skipped++;
+                } else if (ops->stage(load->root) < 0) {
+                    load->failed = 1;
                 }
-                cJSON_Delete(root);
             }
+            return 0;
         }
+
+        if (load->failed) {
+            staged_root = NULL;
+            AIM_LOG_WARN("Reconfiguration failed, new configuration not applied");
+            load->rv = INDIGO_ERROR_UNKNOWN;
+            load->phase = CFG_LOAD_DONE;
+            return 1;
+        }
+
+        AIM_LOG_INFO("Committing new configuration");
+        load->next_ops = cfg_registration_list;
+        load->phase = CFG_LOAD_COMMIT;
+        return 0;
+
+    case CFG_LOAD_COMMIT:
+        if (load->next_ops != NULL) {
+            ops = load->next_ops->data;
+            load->next_ops = load->next_ops->next;
+            if (IND_CFG_ENTRY_USES_DEFAULT(ops) && ops_changed(ops)) {
+                ops->commit();
+            }
+            return 0;
+        }
+
+        staged_root = NULL;
+        cJSON_Delete(committed_root);
+        committed_root = load->root;
+        load->root = NULL;
+
+        AIM_LOG_INFO("Finished reconfiguration, %d unchanged modules skipped",
+                     load->skipped);
+        load->rv = INDIGO_ERROR_NONE;
+        load->phase = CFG_LOAD_DONE;
+        return 1;
+
+    default:
+        return 1;
+    }
+}
+
+static void
+cfg_load_finish(struct cfg_load *load)
+{
+    active_load = NULL;
+
+    if (forget_committed) {
+        cJSON_Delete(committed_root);
+        committed_root = NULL;
+        forget_committed = 0;
+    }
+
+    cfg_load_destroy(load);
+}
+
+/*
+ * Drop an async load the parser thread could not hand to the loop
+ *
+ * The parser thread cannot touch active_load, so it only marks the load
+ * orphaned and the next caller on the loop frees it here.
+ */
+static void
+cfg_load_reclaim(void)
+{
+    if (active_load != NULL &&
+            __atomic_load_n(&active_load->orphaned, __ATOMIC_ACQUIRE)) {
+        AIM_LOG_WARN("Discarding configuration load that never reached "
+                     "the event loop");
+        reload_requested = 0;
+        cfg_load_finish(active_load);
     }
 }
 
@@ -205,55 +534,104 @@ update_nondefault_config(void)
 indigo_error_t
 ind_cfg_load(void)
 {
-    cJSON *root;
-    biglist_t *el;
-    int failed = 0;
+    struct cfg_load *load;
+    indigo_error_t rv;
 
-    /* Update any entries that use a non-default config file */
-    update_nondefault_config();
+    cfg_load_reclaim();
 
-    if (current_filename == NULL) {
-        AIM_LOG_WARN("received SIGHUP but not using a config file");
-        return INDIGO_ERROR_NONE;
+    if (active_load != NULL) {
+        AIM_LOG_WARN("Configuration load already in progress");
+        return INDIGO_ERROR_NOT_READY;
     }
 
-    root = parse_json_file(current_filename);
-    if (root == NULL) {
-        /* parse_json_file() logged a detailed message. */
-        AIM_LOG_ERROR("Configuration unchanged; could not load %s.",
-                      current_filename);
-        return INDIGO_ERROR_PARSE;
+    if ((load = cfg_load_create()) == NULL) {
+        AIM_LOG_ERROR("Failed to allocate configuration load");
+        return INDIGO_ERROR_RESOURCE;
     }
 
-    AIM_LOG_INFO("Staging new configuration");
+    active_load = load;
+    cfg_load_parse(load);
+    while (!cfg_load_step(load));
 
-    BIGLIST_FOREACH(el, cfg_registration_list) {
-        struct ind_cfg_ops *ops = el->data;
-        if (IND_CFG_ENTRY_USES_DEFAULT(ops)) {
-            if (ops->stage(root) < 0) {
-                failed = 1;
+    rv = load->rv;
+    cfg_load_finish(load);
+
+    return rv;
+}
+
+static ind_soc_task_status_t
+cfg_load_task(void *cookie)
+{
+    struct cfg_load *load = cookie;
+
+    do {
+        if (cfg_load_step(load)) {
+            cfg_load_finish(load);
+            if (reload_requested) {
+                reload_requested = 0;
+                (void) ind_cfg_load_async();
             }
+            return IND_SOC_TASK_FINISHED;
         }
+    } while (!ind_soc_should_yield());
+
+    return IND_SOC_TASK_CONTINUE;
+}
+
+static void *
+cfg_load_thread(void *arg)
+{
+    struct cfg_load *load = arg;
+
+    cfg_load_parse(load);
+
+    if (ind_soc_loop_task_post(load->loop, cfg_load_task, load,
+                               IND_SOC_DEFAULT_PRIORITY) < 0) {
+        /* Leave the cleanup to the loop; see cfg_load_reclaim */
+        AIM_LOG_ERROR("Failed to post configuration load to the event loop");
+        __atomic_store_n(&load->orphaned, 1, __ATOMIC_RELEASE);
     }
 
-    cJSON_Delete(root);
+    return NULL;
+}
 
-    if (failed == 0) {
-        AIM_LOG_INFO("Committing new configuration");
+indigo_error_t
+ind_cfg_load_async(void)
+{
+    struct cfg_load *load;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rv;
 
-        BIGLIST_FOREACH(el, cfg_registration_list) {
-            struct ind_cfg_ops *ops = el->data;
-            if (IND_CFG_ENTRY_USES_DEFAULT(ops)) {
-                ops->commit();
-            }
-        }
+    cfg_load_reclaim();
 
-        AIM_LOG_INFO("Finished reconfiguration");
-        return INDIGO_ERROR_NONE;
-    } else {
-        AIM_LOG_WARN("Reconfiguration failed, new configuration not applied");
-        return INDIGO_ERROR_UNKNOWN;
+    if (active_load != NULL) {
+        AIM_LOG_VERBOSE("Configuration load in progress, reloading after it");
+        reload_requested = 1;
+        return INDIGO_ERROR_PENDING;
+    }
+
+    if ((load = cfg_load_create()) == NULL) {
+        AIM_LOG_ERROR("Failed to allocate configuration load");
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    load->loop = ind_soc_loop_current();
+    active_load = load;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rv = pthread_create(&thread, &attr, cfg_load_thread, load);
+    pthread_attr_destroy(&attr);
+
+    if (rv != 0) {
+        AIM_LOG_ERROR("Failed to start configuration parser thread: %s",
+                      strerror(rv));
+        cfg_load_finish(load);
+        return INDIGO_ERROR_RESOURCE;
     }
+
+    return INDIGO_ERROR_PENDING;
 }
 
 indigo_error_t
@@ -45,7 +45,7 @@ sighup_callback(int socket_id, void *cookie,
         /* silence warn_unused_result */
     }
     AIM_LOG_MSG("received SIGHUP");
-    ind_cfg_load();
+    (void) ind_cfg_load_async();
 }
 
 /* Set up the SIGHUP handler to load the new configuration. */
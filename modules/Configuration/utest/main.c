@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include <indigo/assert.h>
 #include <cjson/cJSON.h>
+#include <SocketManager/socketmanager.h>
 
 #include "configuration_log.h"
 
@@ -355,9 +356,156 @@ test_non_dflt_reconfiguration(void)
     unlink(filename_non_dflt);
 }
 
+/* Incremental reload; ops3 reads only "int" */
+
+static int stage3_count;
+static int commit3_count;
+static int stage3_logging_changed;
+
+static indigo_error_t
+stage3(cJSON *cjson)
+{
+    stage3_count++;
+    stage3_logging_changed = ind_cfg_changed("logging");
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+commit3(void)
+{
+    commit3_count++;
+}
+
+static const char * const paths3[] = { "int", NULL };
+
+static const struct ind_cfg_ops ops3 = {
+    .stage = stage3,
+    .commit = commit3,
+    .paths = paths3,
+};
+
+static void
+write_config(const char *filename, const char *json)
+{
+    FILE *file = fopen(filename, "w");
+    fwrite(json, strlen(json), 1, file);
+    fclose(file);
+}
+
+static void
+load_config(void)
+{
+    stage1_retval = stage2_retval = INDIGO_ERROR_NONE;
+    stage1_count = commit1_count = 0;
+    stage2_count = commit2_count = 0;
+    stage3_count = commit3_count = 0;
+    stage_non_dflt_count = commit_non_dflt_count = 0;
+    INDIGO_ASSERT(ind_cfg_load() == INDIGO_ERROR_NONE);
+}
+
+static void
+test_incremental_reconfiguration(void)
+{
+    char filename[] = "tmpXXXXXX";
+
+    close(mkstemp(filename));
+    write_config(filename, sample_json);
+    ind_cfg_filename_set(filename);
+    ind_cfg_register(&ops3);
+
+    /* First load after registering stages everything */
+    load_config();
+    INDIGO_ASSERT(stage3_count == 1);
+    INDIGO_ASSERT(commit3_count == 1);
+    INDIGO_ASSERT(stage3_logging_changed);
+
+    /* Nothing changed; modules without paths are still reconfigured */
+    load_config();
+    INDIGO_ASSERT(stage3_count == 0);
+    INDIGO_ASSERT(commit3_count == 0);
+    INDIGO_ASSERT(commit1_count == 1);
+
+    /* A path ops3 doesn't read */
+    write_config(filename,
+        "{ \"logging\": { \"dataplane\": \"verbose\" }, \"int\": 5 }");
+    load_config();
+    INDIGO_ASSERT(stage3_count == 0);
+
+    /* Member order doesn't matter */
+    write_config(filename,
+        "{ \"int\": 5, \"logging\": { \"dataplane\": \"verbose\" } }");
+    load_config();
+    INDIGO_ASSERT(stage3_count == 0);
+
+    /* A path ops3 reads */
+    write_config(filename,
+        "{ \"int\": 6, \"logging\": { \"dataplane\": \"verbose\" } }");
+    load_config();
+    INDIGO_ASSERT(stage3_count == 1);
+    INDIGO_ASSERT(commit3_count == 1);
+    INDIGO_ASSERT(!stage3_logging_changed);
+
+    /* Removing it is a change too */
+    write_config(filename,
+        "{ \"logging\": { \"dataplane\": \"verbose\" } }");
+    load_config();
+    INDIGO_ASSERT(stage3_count == 1);
+
+    unlink(filename);
+}
+
+/* Run the event loop until the async loads have committed ops1 */
+static void
+wait_async_load(int commits)
+{
+    int i;
+
+    for (i = 0; i < 100 && commit1_count < commits; i++) {
+        INDIGO_ASSERT(ind_soc_select_and_run(100) == INDIGO_ERROR_NONE);
+    }
+    INDIGO_ASSERT(commit1_count == commits);
+}
+
+static void
+test_async_reconfiguration(void)
+{
+    char filename[] = "tmpXXXXXX";
+
+    close(mkstemp(filename));
+    write_config(filename, sample_json);
+    ind_cfg_filename_set(filename);
+
+    stage1_retval = stage2_retval = INDIGO_ERROR_NONE;
+    stage1_count = commit1_count = 0;
+
+    /* Stages and commits run from the event loop */
+    INDIGO_ASSERT(ind_cfg_load_async() == INDIGO_ERROR_PENDING);
+    INDIGO_ASSERT(stage1_count == 0);
+
+    /* A synchronous load must wait for it */
+    INDIGO_ASSERT(ind_cfg_load() == INDIGO_ERROR_NOT_READY);
+
+    wait_async_load(1);
+    INDIGO_ASSERT(stage1_count == 1);
+
+    /* A second request while one runs is queued behind it */
+    INDIGO_ASSERT(ind_cfg_load_async() == INDIGO_ERROR_PENDING);
+    INDIGO_ASSERT(ind_cfg_load_async() == INDIGO_ERROR_PENDING);
+    wait_async_load(3);
+    INDIGO_ASSERT(stage1_count == 3);
+
+    /* No further load was left behind */
+    INDIGO_ASSERT(ind_soc_select_and_run(0) == INDIGO_ERROR_NONE);
+    INDIGO_ASSERT(commit1_count == 3);
+    INDIGO_ASSERT(ind_cfg_load() == INDIGO_ERROR_NONE);
+
+    unlink(filename);
+}
+
 int main(int argc, char* argv[])
 {
     char filename[256];
+    ind_soc_config_t soc_config;
 
     INDIGO_ASSERT(ind_cfg_filename_get(filename, sizeof(filename)) == INDIGO_ERROR_INIT);
 
@@ -365,6 +513,12 @@ int main(int argc, char* argv[])
     test_json_parse_failure();
     test_reconfiguration(1);
     test_non_dflt_reconfiguration();
+    test_incremental_reconfiguration();
+
+    memset(&soc_config, 0, sizeof(soc_config));
+    INDIGO_ASSERT(ind_soc_init(&soc_config) == INDIGO_ERROR_NONE);
+    test_async_reconfiguration();
+    INDIGO_ASSERT(ind_soc_finish() == INDIGO_ERROR_NONE);
 
     return 0;
 }
@@ -114,6 +114,37 @@ ind_cxn_message_track_setup(indigo_cxn_id_t cxn_id, of_object_t *obj);
 extern indigo_error_t
 ind_cxn_message_trace(indigo_cxn_id_t cxn_id, aim_pvs_t* pvs);
 
+/**
+ * Enable or disable the binary message trace ring
+ *
+ * @param slots Number of messages kept, or 0 to disable
+ * @param snaplen Bytes kept from each message
+ *
+ * Raw messages to and from every connection are recorded with a
+ * timestamp and direction, without formatting them. Enabling again
+ * discards the recorded messages. A disabled ring can still be exported.
+ */
+extern indigo_error_t
+ind_cxn_trace_ring_enable(int slots, int snaplen);
+
+/**
+ * Write the trace ring to a pcap file
+ *
+ * @param filename The file to write
+ * @param count Set to the number of messages written; may be NULL
+ *
+ * Messages are framed as TCP over IPv4 between the switch and the
+ * controller address, so OpenFlow dissectors decode them.
+ */
+extern indigo_error_t
+ind_cxn_trace_ring_export(const char *filename, int *count);
+
+/**
+ * Show the trace ring state
+ */
+extern void
+ind_cxn_trace_ring_show(aim_pvs_t *pvs);
+
 /**
  * Value to indicate to cxn_reset to reset all active connections
  */
@@ -119,6 +119,46 @@
 #define OFCONNECTIONMANAGER_CONFIG_ECHO_OPTIMIZATION 0
 #endif
 
+/**
+ * OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE
+ *
+ * Coalesce controller writes. Queued messages are flushed once at the end of each event loop pass, or sooner when WRITE_COALESCE_BYTES are queued, instead of whenever the socket is writable. */
+
+
+#ifndef OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE
+#define OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE 0
+#endif
+
+/**
+ * OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES
+ *
+ * Queued bytes at which a coalescing connection is flushed without waiting for the end of the pass. */
+
+
+#ifndef OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES
+#define OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES (64 * 1024)
+#endif
+
+/**
+ * OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE
+ *
+ * Number of pooled packet-in buffers the datapath can write frames into directly. */
+
+
+#ifndef OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE
+#define OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE 256
+#endif
+
+/**
+ * OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE
+ *
+ * Number of pooled buffers in each size class for messages the connection manager builds or copies itself. */
+
+
+#ifndef OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE
+#define OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE 64
+#endif
+
 /**
  * OFCONNECTIONMANAGER_CONFIG_OF_VERSION
  *
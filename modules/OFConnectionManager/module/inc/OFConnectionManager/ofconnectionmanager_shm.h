@@ -0,0 +1,96 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Shared memory transport for co-located applications
+ *
+ * A connection added with INDIGO_CXN_PROTO_SHM_OVER_UNIX listens on a
+ * Unix stream socket. For each client that connects the switch creates
+ * a shared memory region holding two byte rings, one per direction, and
+ * sends the client one ind_cxn_shm_hello_t along with these descriptors
+ * (SCM_RIGHTS, in order):
+ *
+ *   IND_CXN_SHM_FD_REGION       The region, to be mapped shared
+ *   IND_CXN_SHM_FD_CLIENT_WAKE  Signaled when from_switch has new data or
+ *                               to_switch has space the client waited for
+ *   IND_CXN_SHM_FD_SWITCH_DATA  Signal after producing into to_switch
+ *                               while the ring was empty
+ *   IND_CXN_SHM_FD_SWITCH_SPACE Signal after consuming from from_switch
+ *                               if its producer_waiting is set
+ *
+ * The descriptors are eventfds; signal one by writing a nonzero 64 bit
+ * value. The rings then carry the usual OpenFlow message stream,
+ * starting with the hello exchange. Closing the Unix socket ends the
+ * connection.
+ *
+ * head and tail are free running byte counts; the data at count n is at
+ * data[n & (ring_size - 1)]. A producer writes data and then head, a
+ * consumer reads data and then writes tail. To avoid lost wakeups each
+ * side issues a full memory barrier between publishing its own counter
+ * and reading the other side's.
+ */
+
+#ifndef __OFCONNECTIONMANAGER_SHM_H__
+#define __OFCONNECTIONMANAGER_SHM_H__
+
+#include <stdint.h>
+
+#define IND_CXN_SHM_MAGIC 0x494e5348 /* "INSH" */
+#define IND_CXN_SHM_VERSION 1
+
+/* Bytes in each ring; a power of two */
+#define IND_CXN_SHM_RING_SIZE (1 << 20)
+
+enum {
+    IND_CXN_SHM_FD_REGION,
+    IND_CXN_SHM_FD_CLIENT_WAKE,
+    IND_CXN_SHM_FD_SWITCH_DATA,
+    IND_CXN_SHM_FD_SWITCH_SPACE,
+    IND_CXN_SHM_FDS
+};
+
+/* Counters are kept on separate cache lines */
+typedef struct ind_cxn_shm_ring_s {
+    uint32_t head;              /* Written by the producer only */
+    uint8_t pad0[60];
+    uint32_t tail;              /* Written by the consumer only */
+    uint8_t pad1[60];
+    uint32_t producer_waiting;  /* Set by a producer short of space */
+    uint8_t pad2[60];
+    uint8_t data[IND_CXN_SHM_RING_SIZE];
+} ind_cxn_shm_ring_t;
+
+typedef struct ind_cxn_shm_region_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;
+    uint8_t pad[52];
+    ind_cxn_shm_ring_t to_switch;
+    ind_cxn_shm_ring_t from_switch;
+} ind_cxn_shm_region_t;
+
+/* Sent with the descriptors */
+typedef struct ind_cxn_shm_hello_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t region_size;
+} ind_cxn_shm_hello_t;
+
+#endif /* __OFCONNECTIONMANAGER_SHM_H__ */
@@ -26,10 +26,13 @@
 #include "ofconnectionmanager_log.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
 
 #include "cxn_instance.h"
+#include "cxn_trace.h"
 #include "ofconnectionmanager_int.h"
 
 #include <SocketManager/socketmanager.h>
@@ -37,11 +40,13 @@
 
 #include <indigo/memory.h>
 #include <indigo/assert.h>
+#include <indigo/binlog.h>
 
 #include <loci/loci_dump.h>
 #include <loci/loci_show.h>
 
 #include <netinet/in.h>
+#include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -62,6 +67,13 @@
 #define NO_CXN_LOG_VERBOSE(fmt, ...)                                    \
     AIM_LOG_VERBOSE(fmt, ##__VA_ARGS__)
 
+/*
+ * Per message events are recorded as deferred binary logs, see
+ * indigo/binlog.h; %s arguments must be static strings.
+ */
+#define LOG_MSG(cxn, fmt, ...)                                          \
+    INDIGO_BINLOG("cxn %d: " fmt, (cxn)->cxn_id, ##__VA_ARGS__)
+
 #define STATE_INFO_INIT(s, t) { .name = #s, .timeout = t }
 state_info_t state_info[INDIGO_CXN_S_COUNT] = {
     STATE_INFO_INIT(DISCONNECTED, 0),
@@ -120,10 +132,40 @@ cxn_data_hexdump(unsigned char *buf, int bytes)
  *
  ****************************************************************/
 
-static void periodic_keepalive(void *cookie);
+static void keepalive_send(connection_t *cxn);
+static void read_resume(connection_t *cxn);
+static void rx_segment_unref(cxn_rx_segment_t *seg);
+
+static void output_msg_free(cxn_output_msg_t *msg);
+static void output_waiters_wake(connection_t *cxn);
+static indigo_error_t raw_reply_send(connection_t *cxn, uint8_t type,
+                                     of_object_id_t object_id, uint32_t xid,
+                                     const uint8_t *body, int body_len);
+
+/* The idx'th oldest message in a write queue */
+#define CXN_OUTPUT_MSG(queue, idx) \
+    (&(queue)->ring[((queue)->head + (idx)) & ((queue)->size - 1)])
+
+const int ind_cxn_output_bytes_max[CXN_OUTPUT_CLASS_COUNT] = {
+    [CXN_OUTPUT_CLASS_CONTROL] = CXN_OUTPUT_CONTROL_BYTES_MAX,
+    [CXN_OUTPUT_CLASS_ASYNC] = CXN_OUTPUT_ASYNC_BYTES_MAX,
+    [CXN_OUTPUT_CLASS_BULK] = CXN_OUTPUT_BULK_BYTES_MAX,
+};
 
 #define VERSION_IS_SET(cxn) ((cxn)->status.negotiated_version > 0)
 
+/* Input is held for a pending barrier or a backed up output queue */
+#define CXN_INPUT_PAUSED(cxn) ((cxn)->barrier.pendingf || (cxn)->output_blocked)
+
+/* Message types answered from the raw header, see process_message_fast */
+#define CXN_OF_HEADER_LENGTH 8
+#define CXN_OFPT_ECHO_REQUEST 2
+#define CXN_OFPT_ECHO_REPLY 3
+#define CXN_OFPT_BARRIER_REQUEST(version) \
+    ((version) == OF_VERSION_1_0 ? 18 : 20)
+#define CXN_OFPT_BARRIER_REPLY(version) \
+    ((version) == OF_VERSION_1_0 ? 19 : 21)
+
 /**
  * Disconnect and clean up
  *
@@ -132,11 +174,17 @@ static void periodic_keepalive(void *cookie);
 static void
 cleanup_disconnect(connection_t *cxn)
 {
-    uint8_t *data;
-    biglist_t *ble;
+    cxn_output_queue_t *queue;
+    cxn_output_msg_t *msg;
+    int cls, i;
 
     cxn->status.disconnect_count++;
 
+    if (cxn->shm != NULL) {
+        ind_cxn_shm_destroy(cxn->shm);
+        cxn->shm = NULL;
+    }
+
     /* Close this socket. */
     if (cxn->sd >= 0) {
         ind_soc_socket_unregister(cxn->sd);
@@ -148,19 +196,34 @@ cleanup_disconnect(connection_t *cxn)
 
     /* @fixme Is it possible there's a message that should be processed? */
     LOG_VERBOSE(cxn, "Closing connection, current read buf has %d bytes",
-                cxn->read_bytes);
+                cxn->read_bytes - cxn->read_offset);
+    cxn->read_offset = 0;
     cxn->read_bytes = 0;
-    /* Clear write queue */
-    BIGLIST_FOREACH_DATA(ble, cxn->output_list, uint8_t *, data) {
-        LOG_TRACE(cxn, "Freeing outgoing msg %p", data);
-        INDIGO_MEM_FREE(data);
+    if (cxn->read_segment != NULL) {
+        rx_segment_unref(cxn->read_segment);
+        cxn->read_segment = NULL;
+        cxn->read_buffer = NULL;
+    }
+    /* Clear write queues */
+    for (cls = 0; cls < CXN_OUTPUT_CLASS_COUNT; cls++) {
+        queue = &cxn->output[cls];
+        for (i = 0; i < queue->pkts; i++) {
+            msg = CXN_OUTPUT_MSG(queue, i);
+            LOG_TRACE(cxn, "Freeing outgoing msg %p", msg->data);
+            output_msg_free(msg);
+        }
+        INDIGO_MEM_FREE(queue->ring);
+        INDIGO_MEM_CLEAR(queue, sizeof(*queue));
     }
-    biglist_free(cxn->output_list);
-    cxn->output_list = NULL;
 
     cxn->bytes_enqueued = 0;
     cxn->pkts_enqueued = 0;
     cxn->output_head_offset = 0;
+    cxn->flush_pending = 0;
+
+    /* Let suspended producers run to completion */
+    cxn->output_blocked = 0;
+    output_waiters_wake(cxn);
 }
 
 
@@ -362,8 +425,13 @@ cxn_state_set(connection_t *cxn, indigo_cxn_state_t new_state)
         if (cxn->flags & CXN_TO_BE_REMOVED) {
             LOG_VERBOSE(cxn, "Completing cxn removal");
             cxn->active = 0;
-        } else if (CXN_LOCAL(cxn)) {
+            ind_cxn_instance_release(cxn);
+        } else if (CXN_LOCAL(cxn) ||
+                   cxn->protocol_params.header.protocol ==
+                   INDIGO_CXN_PROTO_SHM_OVER_UNIX) {
+            /* Accepted clients do not reconnect */
             cxn->active = 0;
+            ind_cxn_instance_release(cxn);
         } else {
             /* Disconnected but still active - start connecting again */
             ind_soc_timer_event_register_with_priority(
@@ -390,19 +458,16 @@ cxn_state_set(connection_t *cxn, indigo_cxn_state_t new_state)
         break;
 
     case INDIGO_CXN_S_CLOSING:
-        ind_soc_timer_event_unregister(periodic_keepalive, (void *)cxn);
         ind_soc_timer_event_register_with_priority(
             cxn_closing_timeout, (void *)cxn,
             CXN_STATE_TIMEOUT(new_state), IND_CXN_EVENT_PRIORITY);
         cleanup_disconnect(cxn);
         break;
     case INDIGO_CXN_S_HANDSHAKE_COMPLETE:
-        if (cxn->keepalive.period_ms > 0) {
-            /* Set up periodic echo request */
-            ind_soc_timer_event_register_with_priority(
-                periodic_keepalive, (void *)cxn,
-                cxn->keepalive.period_ms, IND_CXN_EVENT_PRIORITY);
-        }
+        /* The shared keepalive timer sends the first echo a period from now */
+        cxn->keepalive.last_rx = ind_soc_loop_now_us();
+        cxn->keepalive.next_echo = cxn->keepalive.last_rx +
+            (indigo_time_us_t)cxn->keepalive.period_ms * 1000;
 
         break;
 
@@ -452,24 +517,25 @@ check_for_hello(connection_t *cxn, of_object_t *obj)
 }
 
 /**
- * Timer handler to send an echo request on a given connection and
- * to check if too many echo requests have been lost.
+ * Send an echo request on a given connection and check if too many
+ * echo requests have been lost.
  *
  * Note that we rely on getting the echo replies before the next
  * echo request goes out due to XID tracking.
  *
- * Any time a message is received from the controller, the timer for
- * this function should be reset and the outstanding count set to 0.
+ * Any time a message is received from the controller, the outstanding
+ * count is set to 0 (and with ECHO_OPTIMIZATION the next echo is put
+ * off, see ind_cxn_keepalive_check).
  */
 
 static void
-periodic_keepalive(void *cookie)
+keepalive_send(connection_t *cxn)
 {
     of_echo_request_t *echo;
     uint32_t xid = ind_cxn_xid_get();
-    connection_t *cxn;
 
-    cxn = (connection_t *)cookie;
+    cxn->keepalive.next_echo = ind_soc_loop_now_us() +
+        (indigo_time_us_t)cxn->keepalive.period_ms * 1000;
 
     LOG_TRACE(cxn, "Periodic echo request");
     if (CONNECTION_STATE(cxn) != INDIGO_CXN_S_HANDSHAKE_COMPLETE) {
@@ -497,6 +563,39 @@ periodic_keepalive(void *cookie)
     cxn->keepalive.outstanding_echo_cnt++;
 }
 
+/**
+ * Send an echo request if the connection's keepalive is due
+ *
+ * @param now Current time
+ *
+ * Called for every connection by the shared keepalive timer, so a
+ * received message only has to record its arrival time.
+ */
+
+void
+ind_cxn_keepalive_check(connection_t *cxn, indigo_time_us_t now)
+{
+    indigo_time_us_t due = cxn->keepalive.next_echo;
+
+    if (cxn->keepalive.period_ms == 0 ||
+        CONNECTION_STATE(cxn) != INDIGO_CXN_S_HANDSHAKE_COMPLETE) {
+        return;
+    }
+
+#if OFCONNECTIONMANAGER_CONFIG_ECHO_OPTIMIZATION == 1
+    /* Controller activity puts off the echo request */
+    if (cxn->keepalive.last_rx +
+        (indigo_time_us_t)cxn->keepalive.period_ms * 1000 > due) {
+        due = cxn->keepalive.last_rx +
+            (indigo_time_us_t)cxn->keepalive.period_ms * 1000;
+    }
+#endif
+
+    if (now >= due) {
+        keepalive_send(cxn);
+    }
+}
+
 /**
  * Generate a barrier reply and send it to the controller
  */
@@ -506,13 +605,21 @@ send_barrier_reply(connection_t *cxn)
 {
    of_barrier_reply_t *obj = 0;
 
+   /* Built on the wire unless the connection is traced */
+   if (cxn->trace_pvs == NULL) {
+      of_version_t version = cxn->status.negotiated_version;
+      LOG_MSG(cxn, "Responding to barrier request xid %u", cxn->barrier.xid);
+      return raw_reply_send(cxn, CXN_OFPT_BARRIER_REPLY(version),
+                            OF_BARRIER_REPLY, cxn->barrier.xid, NULL, 0);
+   }
+
    if ((obj = of_barrier_reply_new(cxn->status.negotiated_version)) == 0) {
       LOG_ERROR(cxn, "Failed to allocate barrier reply");
       return INDIGO_ERROR_UNKNOWN;
    }
 
    of_barrier_reply_xid_set(obj, cxn->barrier.xid);
-   LOG_TRACE(cxn, "Responding to barrier request xid %u", cxn->barrier.xid);
+   LOG_MSG(cxn, "Responding to barrier request xid %u", cxn->barrier.xid);
 
    indigo_cxn_send_controller_message(cxn->cxn_id, obj);
    return INDIGO_ERROR_NONE;
@@ -585,6 +692,8 @@ echo_reply_handle(connection_t *cxn, of_object_t *_obj)
     return rv;
 }
 
+static indigo_error_t barrier_request_start(connection_t *cxn, uint32_t xid);
+
 /**
  * Handle a barrier request message
  */
@@ -593,17 +702,29 @@ static indigo_error_t
 barrier_request_handle(connection_t *cxn, of_object_t *_obj)
 {
     of_barrier_request_t *obj = _obj;
+    uint32_t xid;
 
-    of_barrier_request_xid_get(obj, &cxn->barrier.xid);
-    LOG_TRACE(cxn, "Got barrier req with xid %u", cxn->barrier.xid);
-
+    of_barrier_request_xid_get(obj, &xid);
     of_barrier_request_delete(obj);
 
+    return barrier_request_start(cxn, xid);
+}
+
+/**
+ * Reply to a barrier request once outstanding operations are done
+ */
+
+static indigo_error_t
+barrier_request_start(connection_t *cxn, uint32_t xid)
+{
+    cxn->barrier.xid = xid;
+    LOG_MSG(cxn, "Got barrier req with xid %u", cxn->barrier.xid);
+
     /* No outstanding operations; send reply immediately */
     if (cxn->outstanding_op_cnt == 0)  {
         return (send_barrier_reply(cxn));
     }
-    LOG_TRACE(cxn, "Outstanding op count %d", cxn->outstanding_op_cnt);
+    LOG_MSG(cxn, "Outstanding op count %d", cxn->outstanding_op_cnt);
 
     /* Pause the socket and mark a barrier is pending */
     if (ind_soc_data_in_pause(cxn->sd) < 0) {
@@ -682,7 +803,7 @@ nicira_controller_role_request_handle(connection_t *cxn, of_object_t *_obj)
             ind_cxn_change_master(cxn->cxn_id);
         } else {
             LOG_INFO(cxn, "Setting role to %s", role_to_string(role));
-            cxn->status.role = role;
+            ind_cxn_role_set(cxn, role);
         }
     }
 
@@ -729,6 +850,17 @@ role_request_handle(connection_t *cxn, of_object_t *_obj)
     indigo_cxn_role_t role;
     uint64_t generation_id;
 
+    /* The role is set on the main connection only */
+    if (CXN_AUX(cxn)) {
+        LOG_VERBOSE(cxn, "Failed role request (auxiliary connection)");
+        indigo_cxn_send_error_reply(
+            cxn->cxn_id, _obj,
+            OF_ERROR_TYPE_ROLE_REQUEST_FAILED,
+            OF_ROLE_REQUEST_FAILED_UNSUP);
+        of_object_delete(_obj);
+        return;
+    }
+
     if ((reply = of_role_reply_new(_obj->version)) == NULL) {
         of_object_delete(_obj);
         return;
@@ -773,7 +905,7 @@ role_request_handle(connection_t *cxn, of_object_t *_obj)
                 ind_cxn_change_master(cxn->cxn_id);
             } else {
                 LOG_INFO(cxn, "Setting role to %s", role_to_string(role));
-                cxn->status.role = role;
+                ind_cxn_role_set(cxn, role);
             }
         }
     }
@@ -788,6 +920,179 @@ role_request_handle(connection_t *cxn, of_object_t *_obj)
     indigo_cxn_send_controller_message(cxn->cxn_id, reply);
 }
 
+/*
+ * Set one socket option, warning if the kernel refuses it
+ */
+static void
+socket_option_set(connection_t *cxn, int level, int name, const char *desc,
+                  int value)
+{
+    if (setsockopt(cxn->sd, level, name, &value, sizeof(value)) < 0) {
+        LOG_WARN(cxn, "Failed to set %s to %d: %s",
+                 desc, value, strerror(errno));
+    }
+}
+
+/**
+ * Apply the configured socket options to the connection's socket
+ *
+ * By default only TCP_NODELAY is set, since OpenFlow messages are small
+ * and latency sensitive.
+ */
+
+void
+ind_cxn_socket_options_set(connection_t *cxn)
+{
+    const indigo_cxn_socket_params_t *params = &cxn->config_params.socket;
+
+    if (!params->nagle) {
+        socket_option_set(cxn, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 1);
+    }
+
+    if (params->sndbuf > 0) {
+        socket_option_set(cxn, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF",
+                          params->sndbuf);
+    }
+
+    if (params->rcvbuf > 0) {
+        socket_option_set(cxn, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF",
+                          params->rcvbuf);
+    }
+
+    if (params->notsent_lowat > 0) {
+#ifdef TCP_NOTSENT_LOWAT
+        socket_option_set(cxn, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                          "TCP_NOTSENT_LOWAT", params->notsent_lowat);
+#else
+        LOG_WARN(cxn, "TCP_NOTSENT_LOWAT not supported");
+#endif
+    }
+
+    if (params->busy_poll_us > 0) {
+#ifdef SO_BUSY_POLL
+        socket_option_set(cxn, SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL",
+                          params->busy_poll_us);
+#else
+        LOG_WARN(cxn, "SO_BUSY_POLL not supported");
+#endif
+    }
+
+    if (params->dscp > 0) {
+        socket_option_set(cxn, IPPROTO_IP, IP_TOS, "IP_TOS",
+                          params->dscp << 2);
+    }
+}
+
+/**
+ * Restore the async configuration a new connection starts with
+ *
+ * Master and equal connections get everything; slaves get port status
+ * messages only.
+ */
+
+void
+ind_cxn_async_config_reset(connection_t *cxn)
+{
+    int type;
+
+    for (type = 0; type < CXN_ASYNC_TYPES; type++) {
+        cxn->async_config[CXN_ASYNC_ROLE_MASTER][type] = 0xffffffff;
+        cxn->async_config[CXN_ASYNC_ROLE_SLAVE][type] = 0;
+    }
+    cxn->async_config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_PORT_STATUS] = 0xffffffff;
+}
+
+/**
+ * Handle an OpenFlow 1.3 set_async message
+ */
+
+static void
+async_set_handle(connection_t *cxn, of_object_t *_obj)
+{
+    of_async_set_t *obj = _obj;
+    uint32_t (*config)[CXN_ASYNC_TYPES] = cxn->async_config;
+
+    /* Auxiliary connections follow their main connection */
+    if (CXN_AUX(cxn)) {
+        LOG_VERBOSE(cxn, "Failed set_async (auxiliary connection)");
+        indigo_cxn_send_error_reply(
+            cxn->cxn_id, _obj,
+            OF_ERROR_TYPE_BAD_REQUEST, OF_REQUEST_FAILED_EPERM);
+        of_object_delete(_obj);
+        return;
+    }
+
+    of_async_set_packet_in_mask_equal_master_get(
+        obj, &config[CXN_ASYNC_ROLE_MASTER][CXN_ASYNC_PACKET_IN]);
+    of_async_set_packet_in_mask_slave_get(
+        obj, &config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_PACKET_IN]);
+    of_async_set_port_status_mask_equal_master_get(
+        obj, &config[CXN_ASYNC_ROLE_MASTER][CXN_ASYNC_PORT_STATUS]);
+    of_async_set_port_status_mask_slave_get(
+        obj, &config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_PORT_STATUS]);
+    of_async_set_flow_removed_mask_equal_master_get(
+        obj, &config[CXN_ASYNC_ROLE_MASTER][CXN_ASYNC_FLOW_REMOVED]);
+    of_async_set_flow_removed_mask_slave_get(
+        obj, &config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_FLOW_REMOVED]);
+
+    LOG_VERBOSE(cxn, "Async config: packet_in 0x%x/0x%x, "
+                "port_status 0x%x/0x%x, flow_removed 0x%x/0x%x",
+                config[0][CXN_ASYNC_PACKET_IN], config[1][CXN_ASYNC_PACKET_IN],
+                config[0][CXN_ASYNC_PORT_STATUS], config[1][CXN_ASYNC_PORT_STATUS],
+                config[0][CXN_ASYNC_FLOW_REMOVED], config[1][CXN_ASYNC_FLOW_REMOVED]);
+
+    of_object_delete(obj);
+}
+
+/**
+ * Handle an OpenFlow 1.3 get_async request
+ */
+
+static void
+async_get_request_handle(connection_t *cxn, of_object_t *_obj)
+{
+    of_async_get_request_t *request = _obj;
+    of_async_get_reply_t *reply;
+    uint32_t (*config)[CXN_ASYNC_TYPES] = cxn->async_config;
+    uint32_t xid;
+
+    if (CXN_AUX(cxn)) {
+        LOG_VERBOSE(cxn, "Failed get_async (auxiliary connection)");
+        indigo_cxn_send_error_reply(
+            cxn->cxn_id, _obj,
+            OF_ERROR_TYPE_BAD_REQUEST, OF_REQUEST_FAILED_EPERM);
+        of_object_delete(_obj);
+        return;
+    }
+
+    of_async_get_request_xid_get(request, &xid);
+
+    reply = of_async_get_reply_new(request->version);
+    if (reply == NULL) {
+        LOG_ERROR(cxn, "Failed to allocate of_async_get_reply");
+        of_object_delete(request);
+        return;
+    }
+
+    of_async_get_reply_xid_set(reply, xid);
+    of_async_get_reply_packet_in_mask_equal_master_set(
+        reply, config[CXN_ASYNC_ROLE_MASTER][CXN_ASYNC_PACKET_IN]);
+    of_async_get_reply_packet_in_mask_slave_set(
+        reply, config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_PACKET_IN]);
+    of_async_get_reply_port_status_mask_equal_master_set(
+        reply, config[CXN_ASYNC_ROLE_MASTER][CXN_ASYNC_PORT_STATUS]);
+    of_async_get_reply_port_status_mask_slave_set(
+        reply, config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_PORT_STATUS]);
+    of_async_get_reply_flow_removed_mask_equal_master_set(
+        reply, config[CXN_ASYNC_ROLE_MASTER][CXN_ASYNC_FLOW_REMOVED]);
+    of_async_get_reply_flow_removed_mask_slave_set(
+        reply, config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_FLOW_REMOVED]);
+
+    of_object_delete(request);
+
+    indigo_cxn_send_controller_message(cxn->cxn_id, reply);
+}
+
 /**
  * Handle a BSN time request
  */
@@ -851,6 +1156,140 @@ bsn_controller_connections_request_handle(connection_t *cxn, of_object_t *_obj)
     indigo_cxn_send_controller_message(cxn->cxn_id, reply);
 }
 
+/* Name of the BSN generic stats holding cxn_msg_latency_t */
+#define CXN_LATENCY_STATS_NAME "cxn_latency"
+
+static int
+latency_values_append(of_list_uint64_t *values,
+                      const ind_soc_histogram_t *hist)
+{
+    uint64_t v[4] = {
+        hist->count,
+        ind_soc_histogram_percentile(hist, 50),
+        ind_soc_histogram_percentile(hist, 99),
+        hist->max_us,
+    };
+    of_uint64_t elem;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        of_uint64_init(&elem, values->version, -1, 1);
+        if (of_list_uint64_append_bind(values, &elem) < 0) {
+            return INDIGO_ERROR_RESOURCE;
+        }
+        of_uint64_value_set(&elem, v[i]);
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+static int
+latency_stats_entry_append(of_list_bsn_generic_stats_entry_t *entries,
+                           of_object_id_t object_id,
+                           const cxn_msg_latency_t *latency)
+{
+    of_bsn_generic_stats_entry_t *entry;
+    of_list_bsn_tlv_t tlvs;
+    of_list_uint64_t values;
+    of_object_t *name = NULL, *list = NULL;
+    of_octets_t octets;
+    int rv = INDIGO_ERROR_RESOURCE;
+
+    if ((entry = of_bsn_generic_stats_entry_new(entries->version)) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+    of_bsn_generic_stats_entry_tlvs_bind(entry, &tlvs);
+
+    octets.data = (uint8_t *)of_object_id_str[object_id];
+    octets.bytes = strlen(of_object_id_str[object_id]);
+    if ((name = of_bsn_tlv_name_new(entries->version)) == NULL ||
+        of_bsn_tlv_name_value_set(name, &octets) < 0 ||
+        of_list_append(&tlvs, name) < 0) {
+        goto done;
+    }
+
+    if ((list = of_bsn_tlv_uint64_list_new(entries->version)) == NULL) {
+        goto done;
+    }
+    of_bsn_tlv_uint64_list_value_bind(list, &values);
+    if (latency_values_append(&values, &latency->processing_us) < 0 ||
+        latency_values_append(&values, &latency->reply_us) < 0 ||
+        of_list_append(&tlvs, list) < 0) {
+        goto done;
+    }
+
+    rv = of_list_append(entries, entry) < 0 ?
+        INDIGO_ERROR_RESOURCE : INDIGO_ERROR_NONE;
+
+done:
+    if (name != NULL) {
+        of_object_delete(name);
+    }
+    if (list != NULL) {
+        of_object_delete(list);
+    }
+    of_object_delete(entry);
+    return rv;
+}
+
+/**
+ * Handle a BSN generic stats request for this connection's latencies
+ *
+ * Each entry holds a name TLV with the message type and a uint64 list
+ * TLV with the processing latency count, p50, p99 and max, followed by
+ * the same four for the reply latency.
+ *
+ * @returns 0 if the request names other stats and was not consumed
+ */
+
+static int
+bsn_latency_stats_request_handle(connection_t *cxn, of_object_t *_obj)
+{
+    of_bsn_generic_stats_request_t *request = _obj;
+    of_bsn_generic_stats_reply_t *reply;
+    of_list_bsn_generic_stats_entry_t entries;
+    of_str64_t name;
+    uint32_t xid;
+    int idx;
+
+    of_bsn_generic_stats_request_name_get(request, &name);
+    if (strncmp(name, CXN_LATENCY_STATS_NAME, sizeof(name)) != 0) {
+        return 0;
+    }
+
+    of_bsn_generic_stats_request_xid_get(request, &xid);
+
+    reply = of_bsn_generic_stats_reply_new(request->version);
+    if (reply == NULL) {
+        LOG_ERROR(cxn, "Failed to allocate of_bsn_generic_stats_reply");
+        of_object_delete(request);
+        return 1;
+    }
+
+    of_bsn_generic_stats_reply_xid_set(reply, xid);
+
+    of_object_delete(request);
+
+    of_bsn_generic_stats_reply_entries_bind(reply, &entries);
+
+    for (idx = 0; cxn->counters != NULL && idx < OF_MESSAGE_OBJECT_COUNT;
+         idx++) {
+        if (cxn->counters->latency[idx] == NULL) {
+            continue;
+        }
+        if (latency_stats_entry_append(&entries, idx,
+                                       cxn->counters->latency[idx]) < 0) {
+            LOG_ERROR(cxn, "Could not add latency stats for %s, truncating",
+                      of_object_id_str[idx]);
+            break;
+        }
+    }
+
+    indigo_cxn_send_controller_message(cxn->cxn_id, reply);
+
+    return 1;
+}
+
 /**
  * Callback routine for message object delete
  *
@@ -870,13 +1309,13 @@ cxn_object_delete_cb(of_object_t *obj)
         return;
     }
 
-    LOG_TRACE(cxn, "Delete message object %p of type %s",
-              obj, of_object_id_str[obj->object_id]);
+    LOG_MSG(cxn, "Delete message object %p of type %s",
+            obj, of_object_id_str[obj->object_id]);
 
     INDIGO_ASSERT(cxn->outstanding_op_cnt > 0);
     cxn->outstanding_op_cnt -= 1;
 
-    LOG_TRACE(cxn, "Op count %d", cxn->outstanding_op_cnt);
+    LOG_MSG(cxn, "Op count %d", cxn->outstanding_op_cnt);
 
     /* Check if outstanding ops is now 0 and clean up if needed */
     if (cxn->outstanding_op_cnt == 0) {
@@ -884,10 +1323,10 @@ cxn_object_delete_cb(of_object_t *obj)
             LOG_TRACE(cxn, "Op count 0, disconnecting");
             cxn_state_set(cxn, INDIGO_CXN_S_DISCONNECTED);
         } else if (cxn->barrier.pendingf) {
-            LOG_TRACE(cxn, "Op count 0, sending barrier reply");
+            LOG_MSG(cxn, "Op count 0, sending barrier reply");
             send_barrier_reply(cxn);
             cxn->barrier.pendingf = 0;
-            (void)ind_soc_data_in_resume(cxn->sd);
+            read_resume(cxn);
         }
     }
 }
@@ -949,10 +1388,31 @@ of_msg_process(connection_t *cxn, of_object_t *obj)
         bsn_time_request_handle(cxn, obj);
         return;
 
+    /* Later versions carry the masks as properties */
+    case OF_ASYNC_SET:
+        if (obj->version == OF_VERSION_1_3) {
+            async_set_handle(cxn, obj);
+            return;
+        }
+        break;
+
+    case OF_ASYNC_GET_REQUEST:
+        if (obj->version == OF_VERSION_1_3) {
+            async_get_request_handle(cxn, obj);
+            return;
+        }
+        break;
+
     case OF_BSN_CONTROLLER_CONNECTIONS_REQUEST:
         bsn_controller_connections_request_handle(cxn, obj);
         return;
 
+    case OF_BSN_GENERIC_STATS_REQUEST:
+        if (bsn_latency_stats_request_handle(cxn, obj)) {
+            return;
+        }
+        break;
+
     /* Check permissions and fall through */
     case OF_FLOW_ADD:
     case OF_FLOW_DELETE:
@@ -966,7 +1426,10 @@ of_msg_process(connection_t *cxn, of_object_t *obj)
     case OF_BSN_SET_MIRRORING:
     case OF_BSN_SET_PKTIN_SUPPRESSION_REQUEST:
     case OF_GROUP_MOD:
-        if (cxn->status.role == INDIGO_CXN_R_SLAVE) {
+    case OF_BUNDLE_CTRL_MSG:
+    case OF_BUNDLE_ADD_MSG:
+        /* Auxiliary connections act with their main connection's role */
+        if (ind_cxn_main(cxn)->status.role == INDIGO_CXN_R_SLAVE) {
             uint16_t code = cxn->status.negotiated_version < OF_VERSION_1_2 ?
                 OF_REQUEST_FAILED_EPERM : OF_REQUEST_FAILED_IS_SLAVE;
             LOG_VERBOSE(cxn, "Rejecting %s from slave connection",
@@ -987,157 +1450,543 @@ of_msg_process(connection_t *cxn, of_object_t *obj)
     OF_MSG_CALLBACK(cxn, obj);
 }
 
+/* Unreferenced segments kept for reuse, see CXN_RX_SEGMENT_CACHE_MAX */
+static cxn_rx_segment_t *rx_segment_cache[CXN_RX_SEGMENT_CACHE_MAX];
+static int rx_segment_cache_count;
+
 /**
- * Extract bytes from the read buffer
- * @param cxn The connection instance
- * @param len The number of bytes to extract from the read buffer
+ * Allocate a receive segment holding a single reference
  *
- * Returns a pointer to a new buffer containing a copy of the initial
- * segment of the read buffer through len.  The read buffer is then
- * updated so the remainder of the buffer starts at 0.
+ * Segments are aligned to CXN_RX_SEGMENT_SIZE, so they come from
+ * posix_memalign rather than INDIGO_MEM_ALLOC.
  */
-static inline uint8_t *
-extract_read_buffer(connection_t *cxn)
+static cxn_rx_segment_t *
+rx_segment_alloc(void)
 {
-    uint8_t *new_buf;
-    int len;
+    void *mem;
 
-    /* Allocate new buffer; copy data into it; remove from read buffer */
-    len = cxn->read_bytes;
-    if ((new_buf = INDIGO_MEM_ALLOC(len)) == NULL) {
-        LOG_ERROR(cxn, "Could not allocate new buffer to process read buffer");
+    if (rx_segment_cache_count > 0) {
+        mem = rx_segment_cache[--rx_segment_cache_count];
+    } else if (posix_memalign(&mem, CXN_RX_SEGMENT_SIZE,
+                              CXN_RX_SEGMENT_SIZE) != 0) {
         return NULL;
+    } else {
+        indigo_mem_tag_note_alloc(INDIGO_MEM_TAG_CXN_BUFFER,
+                                  CXN_RX_SEGMENT_SIZE);
     }
 
-    INDIGO_MEM_COPY(new_buf, cxn->read_buffer, len);
+    ((cxn_rx_segment_t *)mem)->refcount = 1;
 
-    return new_buf;
+    return mem;
+}
+
+static void
+rx_segment_unref(cxn_rx_segment_t *seg)
+{
+    INDIGO_ASSERT(seg->refcount > 0);
+    if (--seg->refcount == 0) {
+        if (rx_segment_cache_count < CXN_RX_SEGMENT_CACHE_MAX) {
+            rx_segment_cache[rx_segment_cache_count++] = seg;
+        } else {
+            indigo_mem_tag_note_free(INDIGO_MEM_TAG_CXN_BUFFER,
+                                     CXN_RX_SEGMENT_SIZE);
+            free(seg);
+        }
+    }
 }
 
 /**
- * Is object a message?  Should be if we're sending it
+ * Give up the read segment once all of its data has been processed
+ *
+ * Objects parsed from it keep it alive until they are deleted.
  */
-#define IS_MSG_OBJ(obj) \
-    ((obj)->object_id >= 0 && (obj)->object_id < OF_MESSAGE_OBJECT_COUNT)
+static void
+read_buffer_release_idle(connection_t *cxn)
+{
+    if (cxn->read_segment == NULL || cxn->read_offset != cxn->read_bytes) {
+        return;
+    }
 
-#define READING_HEADER(cxn) (((cxn)->read_bytes) < OF_MESSAGE_HEADER_LENGTH)
+    rx_segment_unref(cxn->read_segment);
+    cxn->read_segment = NULL;
+    cxn->read_buffer = NULL;
+    cxn->read_offset = 0;
+    cxn->read_bytes = 0;
+}
 
 /**
- * Read from the cxn, up to cxn->bytes_needed bytes; update bytes needed
+ * Wire buffer free function for objects parsed in place
  *
- * Return number of bytes read if no error
- * Return < 0, error number, if error.
+ * @param buf The start of the message, somewhere in a segment's data
+ */
+static void
+rx_segment_buffer_free(void *buf)
+{
+    rx_segment_unref((cxn_rx_segment_t *)
+                     ((uintptr_t)buf & ~((uintptr_t)CXN_RX_SEGMENT_SIZE - 1)));
+}
+
+/*
+ * Packet-in buffer pool
  *
- * Read returning 0 is always an error.
- * Note that EAGAIN, EWOULDBLOCK are not considered errors
- * when read returns < 0.
+ * One slab of fixed size slots, allocated on first use.  Each slot has
+ * INDIGO_CXN_PACKET_IN_HEADROOM bytes for the packet-in header in front
+ * of the frame, so the datapath writes the frame once and the message is
+ * queued from the slot.  A slot returns to the free stack when its write
+ * queue entry is released.
  */
 
-static int
-read_from_cxn(connection_t *cxn)
-{
-    ssize_t bytes_in;
-    uint8_t *inbuf_start;
+#define PKTIN_POOL_SLOTS OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE
+#define PKTIN_SLOT_SIZE \
+    (INDIGO_CXN_PACKET_IN_HEADROOM + INDIGO_CXN_PACKET_IN_FRAME_MAX)
 
-    inbuf_start = &cxn->read_buffer[cxn->read_bytes];
-    bytes_in = read(cxn->sd, inbuf_start, cxn->bytes_needed);
+static uint8_t *pktin_pool;
+static int pktin_free_slots[PKTIN_POOL_SLOTS];
+static int pktin_free_count;
 
-    /*
-     * Reading 0 bytes indicates connection has closed, although we allow
-     * for EAGAIN and EWOULDBLOCK
-     */
+static inline int
+pktin_pool_contains(const uint8_t *ptr)
+{
+    return pktin_pool != NULL && ptr >= pktin_pool &&
+        ptr < pktin_pool + PKTIN_POOL_SLOTS * PKTIN_SLOT_SIZE;
+}
 
-    if (bytes_in <= 0) {
-        if (bytes_in == 0) { /* Socket is closed */
-            LOG_INFO(cxn, "Connection closed by remote host");
-            return INDIGO_ERROR_CONNECTION;
+/**
+ * Take a slot from the packet-in pool
+ *
+ * @returns The start of the slot's frame area, or NULL if the pool is
+ * exhausted
+ */
+uint8_t *
+ind_cxn_pktin_frame_alloc(void)
+{
+    int i;
+
+    if (pktin_pool == NULL) {
+        if ((pktin_pool = indigo_mem_tag_alloc(INDIGO_MEM_TAG_CXN_BUFFER,
+                                               PKTIN_POOL_SLOTS *
+                                               PKTIN_SLOT_SIZE)) == NULL) {
+            AIM_LOG_ERROR("Could not allocate packet-in pool");
+            return NULL;
         }
-
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            LOG_TRACE(cxn, "Error reading from socket: %s", strerror(errno));
-            return 0;
+        for (i = 0; i < PKTIN_POOL_SLOTS; i++) {
+            pktin_free_slots[i] = PKTIN_POOL_SLOTS - 1 - i;
         }
+        pktin_free_count = PKTIN_POOL_SLOTS;
+    }
 
-        LOG_ERROR(cxn, "Error reading from socket: %s", strerror(errno));
-        ++ind_cxn_internal_errors;
-        return INDIGO_ERROR_CONNECTION;
+    if (pktin_free_count == 0) {
+        return NULL;
     }
 
-    cxn->status.bytes_in += bytes_in;
-#if defined(DUMP_OBJECTS_AND_DATA)
-    cxn_data_hexdump(&cxn->read_buffer[cxn->read_bytes], bytes_in);
-#endif
-
-    INDIGO_ASSERT((int)bytes_in <= cxn->bytes_needed);
-    cxn->read_bytes += bytes_in;
-    cxn->bytes_needed -= bytes_in;
+    i = pktin_free_slots[--pktin_free_count];
+    return pktin_pool + i * PKTIN_SLOT_SIZE + INDIGO_CXN_PACKET_IN_HEADROOM;
+}
 
-    return bytes_in;
+/**
+ * Check whether a frame was allocated from the packet-in pool
+ */
+int
+ind_cxn_pktin_frame_valid(const uint8_t *frame)
+{
+    return pktin_pool_contains(frame) &&
+        (frame - pktin_pool) % PKTIN_SLOT_SIZE ==
+        INDIGO_CXN_PACKET_IN_HEADROOM;
 }
 
 /**
- * Try to read a full message from the connnection
+ * Return a packet-in pool slot
  *
- * @returns INDIGO_ERROR_NONE if message is ready
- * @returns INDIGO_ERROR_PENDING if message is not ready
- * @returns INDIGO_ERROR_CONNECTION if a read error has occurred
- * @returns INDIGO_ERROR_PROTOCOL if the data stream has illegal values
+ * @param buf Any address within the slot
+ */
+static void
+pktin_slot_free(uint8_t *buf)
+{
+    INDIGO_ASSERT(pktin_free_count < PKTIN_POOL_SLOTS);
+    pktin_free_slots[pktin_free_count++] = (buf - pktin_pool) / PKTIN_SLOT_SIZE;
+}
+
+/*
+ * Message buffer pool
  *
- * If INDIGO_ERROR_NONE is returned, a message is ready to be processed
- * in the connection's read buffer.
+ * Size classes of fixed size slots for the messages the connection
+ * manager builds or copies out itself, such as echo and barrier replies,
+ * so they do not allocate once the pool is warm.  Each class is one slab
+ * allocated on first use, like the packet-in pool, and a slot returns to
+ * its class's free stack when its write queue entry is released.
  */
 
+#define MSG_POOL_SLOTS OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE
+#define MSG_POOL_CLASSES 4
+
+static const int msg_pool_slot_size[MSG_POOL_CLASSES] = {
+    128, 512, 4096, 16384
+};
+
+typedef struct msg_pool_class_s {
+    uint8_t *slab;
+    int free_slots[MSG_POOL_SLOTS];
+    int free_count;
+} msg_pool_class_t;
+
+static msg_pool_class_t msg_pool[MSG_POOL_CLASSES];
+
+/* Class whose slab holds ptr, or -1 */
 static inline int
-read_message(connection_t *cxn)
+msg_pool_class_of(const uint8_t *ptr)
 {
-    of_message_t msg = NULL;
-    int msg_bytes;
-    int rv = INDIGO_ERROR_NONE;
+    int i;
 
-    /* No bytes needed; must be stuck. */
-    if (cxn->bytes_needed == 0) {
-        LOG_TRACE(cxn, "Processing appears to be blocked");
-        return INDIGO_ERROR_PENDING;
+    for (i = 0; i < MSG_POOL_CLASSES; i++) {
+        if (msg_pool[i].slab != NULL && ptr >= msg_pool[i].slab &&
+            ptr < msg_pool[i].slab + MSG_POOL_SLOTS * msg_pool_slot_size[i]) {
+            return i;
+        }
     }
 
-    if (READING_HEADER(cxn)) {
-        INDIGO_ASSERT(cxn->bytes_needed + cxn->read_bytes ==
-                      OF_MESSAGE_HEADER_LENGTH);
-        if ((rv = read_from_cxn(cxn)) < 0) {
-            return rv;
+    return -1;
+}
+
+/**
+ * Take a slot from the smallest class that fits len and has one free
+ *
+ * @returns NULL if no class can hold the message
+ */
+static uint8_t *
+msg_pool_alloc(int len)
+{
+    msg_pool_class_t *pc;
+    int i, j;
+
+    for (i = 0; i < MSG_POOL_CLASSES; i++) {
+        if (len > msg_pool_slot_size[i]) {
+            continue;
         }
 
-        if (cxn->bytes_needed != 0) {
-            LOG_TRACE(cxn, "Still need %d bytes for msg hdr",
-                      cxn->bytes_needed);
-            return INDIGO_ERROR_PENDING;
+        pc = &msg_pool[i];
+        if (pc->slab == NULL) {
+            pc->slab = indigo_mem_tag_alloc(INDIGO_MEM_TAG_CXN_BUFFER,
+                                               MSG_POOL_SLOTS *
+                                               msg_pool_slot_size[i]);
+            if (pc->slab == NULL) {
+                continue;
+            }
+            for (j = 0; j < MSG_POOL_SLOTS; j++) {
+                pc->free_slots[j] = MSG_POOL_SLOTS - 1 - j;
+            }
+            pc->free_count = MSG_POOL_SLOTS;
         }
 
-        msg = (of_message_t)(cxn->read_buffer);
-        msg_bytes = of_message_length_get(msg);
-        if (msg_bytes < OF_MESSAGE_HEADER_LENGTH) {
-            LOG_TRACE(cxn, "Illegal msg length %d. Framing error?", msg_bytes);
-            ++ind_cxn_internal_errors;
-            return INDIGO_ERROR_PROTOCOL;
+        if (pc->free_count > 0) {
+            j = pc->free_slots[--pc->free_count];
+            return pc->slab + j * msg_pool_slot_size[i];
         }
-        cxn->bytes_needed = msg_bytes - OF_MESSAGE_HEADER_LENGTH;
     }
 
-    /* Check if the message only needed the header */
-    if (cxn->bytes_needed == 0) {
+    return NULL;
+}
+
+static void
+msg_pool_slot_free(int i, uint8_t *buf)
+{
+    msg_pool_class_t *pc = &msg_pool[i];
+
+    INDIGO_ASSERT(pc->free_count < MSG_POOL_SLOTS);
+    pc->free_slots[pc->free_count++] =
+        (buf - pc->slab) / msg_pool_slot_size[i];
+}
+
+/**
+ * Free the message buffer pool
+ *
+ * A class's slab is kept if any of its slots is still referenced.
+ */
+void
+ind_cxn_msg_pool_finish(void)
+{
+    msg_pool_class_t *pc;
+    int i;
+
+    for (i = 0; i < MSG_POOL_CLASSES; i++) {
+        pc = &msg_pool[i];
+        if (pc->slab == NULL) {
+            continue;
+        }
+
+        if (pc->free_count != MSG_POOL_SLOTS) {
+            NO_CXN_LOG_VERBOSE("%d %d byte message buffers outstanding at finish",
+                               MSG_POOL_SLOTS - pc->free_count,
+                               msg_pool_slot_size[i]);
+            continue;
+        }
+
+        indigo_mem_tag_free(INDIGO_MEM_TAG_CXN_BUFFER, pc->slab,
+                            MSG_POOL_SLOTS * msg_pool_slot_size[i]);
+        pc->slab = NULL;
+        pc->free_count = 0;
+    }
+}
+
+/**
+ * Allocate a buffer for a message built directly on the wire
+ *
+ * @returns A buffer to free with ind_cxn_msg_data_free
+ *
+ * Messages take a message pool slot, or a packet-in pool slot, while
+ * any that fit are free.
+ */
+uint8_t *
+ind_cxn_msg_buffer_alloc(int len)
+{
+    uint8_t *frame;
+
+    if ((frame = msg_pool_alloc(len)) != NULL) {
+        return frame;
+    }
+
+    if (len <= PKTIN_SLOT_SIZE &&
+        (frame = ind_cxn_pktin_frame_alloc()) != NULL) {
+        return frame - INDIGO_CXN_PACKET_IN_HEADROOM;
+    }
+
+    return INDIGO_MEM_ALLOC(len);
+}
+
+/**
+ * Wire buffer free function for packet-ins built in a pool slot
+ */
+void
+ind_cxn_pktin_buffer_free(void *buf)
+{
+    pktin_slot_free(buf);
+}
+
+/**
+ * Free the packet-in pool
+ *
+ * The slab is kept if any slot is still referenced.
+ */
+void
+ind_cxn_pktin_pool_finish(void)
+{
+    if (pktin_pool == NULL) {
+        return;
+    }
+
+    if (pktin_free_count != PKTIN_POOL_SLOTS) {
+        NO_CXN_LOG_VERBOSE("%d packet-in buffers outstanding at finish",
+                           PKTIN_POOL_SLOTS - pktin_free_count);
+        return;
+    }
+
+    indigo_mem_tag_free(INDIGO_MEM_TAG_CXN_BUFFER, pktin_pool,
+                        PKTIN_POOL_SLOTS * PKTIN_SLOT_SIZE);
+    pktin_pool = NULL;
+    pktin_free_count = 0;
+}
+
+/**
+ * Free message data taken with ind_cxn_wire_buffer_steal
+ */
+void
+ind_cxn_msg_data_free(uint8_t *data)
+{
+    int class;
+
+    if ((class = msg_pool_class_of(data)) >= 0) {
+        msg_pool_slot_free(class, data);
+    } else if (pktin_pool_contains(data)) {
+        pktin_slot_free(data);
+    } else {
+        INDIGO_MEM_FREE(data);
+    }
+}
+
+/**
+ * Take ownership of an object's wire buffer
+ *
+ * @param obj The object; its buffer is no longer valid on success
+ * @param data Set to a buffer the caller must free with
+ * ind_cxn_msg_data_free
+ *
+ * Objects parsed in place share their receive segment, so their message
+ * is copied out, into a message pool slot if one fits, rather than
+ * stolen.  Packet-ins built in a pool slot are stolen along with the
+ * slot.
+ */
+indigo_error_t
+ind_cxn_wire_buffer_steal(of_object_t *obj, uint8_t **data)
+{
+    if (OF_OBJECT_TO_WBUF(obj)->free != rx_segment_buffer_free) {
+        of_object_wire_buffer_steal(obj, data);
         return INDIGO_ERROR_NONE;
     }
 
-    /* Read the rest of the message; return if error */
-    if ((rv = read_from_cxn(cxn)) < 0) {
-        return rv;
+    if ((*data = ind_cxn_msg_buffer_alloc(obj->length)) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
     }
-    if (cxn->bytes_needed == 0) { /* Read full message, return ready */
+
+    INDIGO_MEM_COPY(*data, OF_OBJECT_BUFFER_INDEX(obj, 0), obj->length);
+
+    return INDIGO_ERROR_NONE;
+}
+
+/**
+ * Make room at the end of the read buffer
+ *
+ * Once less than READ_BUFFER_MIN_FREE bytes remain, the unprocessed
+ * data is moved to the front.  If objects still reference the current
+ * segment it is copied to a new one instead.
+ */
+static indigo_error_t
+read_buffer_prepare(connection_t *cxn)
+{
+    cxn_rx_segment_t *seg;
+    int remain;
+
+    if (cxn->read_segment != NULL &&
+        READ_BUFFER_SIZE - cxn->read_bytes >= READ_BUFFER_MIN_FREE) {
         return INDIGO_ERROR_NONE;
     }
 
-    /* Still need more bytes; return pending */
-    return INDIGO_ERROR_PENDING;
+    remain = cxn->read_bytes - cxn->read_offset;
+
+    if (cxn->read_segment != NULL && cxn->read_segment->refcount == 1) {
+        memmove(cxn->read_buffer, &cxn->read_buffer[cxn->read_offset],
+                remain);
+    } else {
+        if ((seg = rx_segment_alloc()) == NULL) {
+            LOG_ERROR(cxn, "Could not allocate receive segment");
+            return INDIGO_ERROR_RESOURCE;
+        }
+
+        if (cxn->read_segment != NULL) {
+            INDIGO_MEM_COPY(seg->data, &cxn->read_buffer[cxn->read_offset],
+                            remain);
+            rx_segment_unref(cxn->read_segment);
+        }
+
+        cxn->read_segment = seg;
+        cxn->read_buffer = seg->data;
+    }
+
+    cxn->read_offset = 0;
+    cxn->read_bytes = remain;
+
+    return INDIGO_ERROR_NONE;
+}
+
+/**
+ * Is object a message?  Should be if we're sending it
+ */
+#define IS_MSG_OBJ(obj) \
+    ((obj)->object_id >= 0 && (obj)->object_id < OF_MESSAGE_OBJECT_COUNT)
+
+/**
+ * Read from the cxn into the free space of the read buffer
+ *
+ * Return number of bytes read if no error
+ * Return < 0, error number, if error.
+ *
+ * Read returning 0 is always an error.
+ * Note that EAGAIN, EWOULDBLOCK are not considered errors
+ * when read returns < 0.
+ */
+
+static int
+read_from_cxn(connection_t *cxn)
+{
+    ssize_t bytes_in;
+    uint8_t *inbuf_start;
+    int rv;
+
+    if ((rv = read_buffer_prepare(cxn)) < 0) {
+        return rv;
+    }
+
+    if (cxn->read_bytes == READ_BUFFER_SIZE) {
+        LOG_TRACE(cxn, "Read buffer full");
+        return 0;
+    }
+
+    inbuf_start = &cxn->read_buffer[cxn->read_bytes];
+    if (cxn->shm != NULL) {
+        /* Closes are seen on the client socket instead */
+        bytes_in = ind_cxn_shm_read(cxn, inbuf_start,
+                                    READ_BUFFER_SIZE - cxn->read_bytes);
+        if (bytes_in == 0) {
+            return 0;
+        }
+    } else {
+        bytes_in = read(cxn->sd, inbuf_start,
+                        READ_BUFFER_SIZE - cxn->read_bytes);
+    }
+
+    /*
+     * Reading 0 bytes indicates connection has closed, although we allow
+     * for EAGAIN and EWOULDBLOCK
+     */
+
+    if (bytes_in <= 0) {
+        if (bytes_in == 0) { /* Socket is closed */
+            LOG_INFO(cxn, "Connection closed by remote host");
+            return INDIGO_ERROR_CONNECTION;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            LOG_TRACE(cxn, "Error reading from socket: %s", strerror(errno));
+            return 0;
+        }
+
+        LOG_ERROR(cxn, "Error reading from socket: %s", strerror(errno));
+        ++ind_cxn_internal_errors;
+        return INDIGO_ERROR_CONNECTION;
+    }
+
+    cxn->status.bytes_in += bytes_in;
+    cxn->read_time_us = INDIGO_CURRENT_TIME_us;
+#if defined(DUMP_OBJECTS_AND_DATA)
+    cxn_data_hexdump(inbuf_start, bytes_in);
+#endif
+
+    cxn->read_bytes += bytes_in;
+
+    return bytes_in;
+}
+
+/**
+ * Frame the next message in the read buffer
+ *
+ * @returns The length of the message at read_offset if it is complete
+ * @returns 0 if more data is needed
+ * @returns INDIGO_ERROR_PROTOCOL if the data stream has illegal values
+ */
+
+static inline int
+next_message(connection_t *cxn)
+{
+    of_message_t msg;
+    int avail = cxn->read_bytes - cxn->read_offset;
+    int msg_bytes;
+
+    if (avail < OF_MESSAGE_HEADER_LENGTH) {
+        return 0;
+    }
+
+    msg = (of_message_t)(&cxn->read_buffer[cxn->read_offset]);
+    msg_bytes = of_message_length_get(msg);
+    if (msg_bytes < OF_MESSAGE_HEADER_LENGTH) {
+        LOG_TRACE(cxn, "Illegal msg length %d. Framing error?", msg_bytes);
+        ++ind_cxn_internal_errors;
+        return INDIGO_ERROR_PROTOCOL;
+    }
+
+    if (msg_bytes > avail) {
+        LOG_MSG(cxn, "Still need %d bytes for msg", msg_bytes - avail);
+        return 0;
+    }
+
+    return msg_bytes;
 }
 
 /**
@@ -1178,117 +2027,569 @@ send_parse_error_message(connection_t *cxn, uint8_t *buf, int len)
         return;
     }
 
-    of_bad_request_error_msg_xid_set(error_msg, xid);
-    of_bad_request_error_msg_code_set(error_msg, code);
-
-    if (of_bad_request_error_msg_data_set(error_msg, &payload) < 0) {
-        LOG_WARN(cxn, "Failed to append original request to error message");
+    of_bad_request_error_msg_xid_set(error_msg, xid);
+    of_bad_request_error_msg_code_set(error_msg, code);
+
+    if (of_bad_request_error_msg_data_set(error_msg, &payload) < 0) {
+        LOG_WARN(cxn, "Failed to append original request to error message");
+    }
+
+    indigo_cxn_send_controller_message(cxn->cxn_id, error_msg);
+}
+
+/**
+ * Queue a reply built directly on the wire
+ *
+ * @param type OpenFlow message type of the reply
+ * @param object_id The matching LOCI object id, for the output counters
+ * @param xid Transaction id
+ * @param body Message body, or NULL if body_len is 0
+ * @param body_len Bytes of body following the header
+ *
+ * Used for keepalive and barrier replies so they need no LOCI object.
+ * Bypasses message tracing; traced connections use the LOCI path.
+ */
+
+/****************************************************************
+ *
+ * Message latency, see cxn_msg_latency_t
+ *
+ ****************************************************************/
+
+/* Multipart replies with the more flag are continued by another message */
+#define CXN_OFPT_STATS_REPLY(version) \
+    ((version) == OF_VERSION_1_0 ? 17 : 19)
+#define CXN_STATS_REPLY_FLAGS_OFFSET 10
+#define CXN_STATS_REPLY_FLAG_MORE 0x1
+
+/**
+ * Is a message type answered with a reply?
+ *
+ * Every type named *_request is taken to be; the few that are not only
+ * hold a pending reply slot until it is reused.
+ */
+
+static int
+latency_request_type(of_object_id_t object_id)
+{
+    /* 0 until looked up, then 1 plus whether a reply is expected */
+    static uint8_t request_types[OF_MESSAGE_OBJECT_COUNT];
+
+    if (request_types[object_id] == 0) {
+        const char *name = of_object_id_str[object_id];
+        int len = strlen(name);
+        request_types[object_id] = 1 +
+            (len > 8 && strcmp(name + len - 8, "_request") == 0);
+    }
+
+    return request_types[object_id] - 1;
+}
+
+/* The latencies of a message type; NULL if the cxn has no counters */
+static cxn_msg_latency_t *
+latency_get(connection_t *cxn, of_object_id_t object_id)
+{
+    cxn_msg_counters_t *counters = cxn->counters;
+
+    if (counters == NULL) {
+        return NULL;
+    }
+
+    if (counters->latency[object_id] == NULL) {
+        counters->latency[object_id] =
+            INDIGO_MEM_ALLOC(sizeof(*counters->latency[object_id]));
+        if (counters->latency[object_id] != NULL) {
+            INDIGO_MEM_CLEAR(counters->latency[object_id],
+                             sizeof(*counters->latency[object_id]));
+        }
+    }
+
+    return counters->latency[object_id];
+}
+
+/**
+ * A request is about to be handled; wait for its reply
+ *
+ * Called before the handler, which may write the reply itself.  Async
+ * messages carry xid 0, so requests with xid 0 are not tracked.
+ */
+
+static void
+latency_reply_expect(connection_t *cxn, of_object_id_t object_id,
+                     uint32_t xid)
+{
+    cxn_pending_reply_t *pending;
+
+    if (cxn->read_time_us == 0 || xid == 0 ||
+        !latency_request_type(object_id)) {
+        return;
+    }
+
+    pending = &cxn->pending_replies[cxn->pending_reply_next];
+    cxn->pending_reply_next =
+        (cxn->pending_reply_next + 1) % CXN_PENDING_REPLIES;
+    if (pending->read_time_us == 0) {
+        cxn->pending_reply_count++;
+    }
+
+    pending->xid = xid;
+    pending->object_id = object_id;
+    pending->read_time_us = cxn->read_time_us;
+}
+
+/**
+ * A message's handler has returned; record its processing latency
+ *
+ * The handler may have released the counters, so they are not
+ * reallocated here.
+ */
+
+static void
+latency_processed(connection_t *cxn, of_object_id_t object_id)
+{
+    cxn_msg_latency_t *latency;
+
+    if (cxn->read_time_us == 0 ||
+        (latency = latency_get(cxn, object_id)) == NULL) {
+        return;
+    }
+
+    ind_soc_histogram_add(&latency->processing_us,
+                          INDIGO_CURRENT_TIME_us - cxn->read_time_us);
+}
+
+/**
+ * A message has been written; if it completes the reply to a pending
+ * request, record the request's reply latency
+ */
+
+static void
+latency_reply_written(connection_t *cxn, uint8_t *data, int len)
+{
+    of_message_t msg = OF_BUFFER_TO_MESSAGE(data);
+    cxn_pending_reply_t *pending;
+    cxn_msg_latency_t *latency;
+    uint32_t xid;
+    int i;
+
+    if (len < CXN_OF_HEADER_LENGTH) {
+        return;
+    }
+
+    if (of_message_type_get(msg) ==
+            CXN_OFPT_STATS_REPLY(of_message_version_get(msg)) &&
+        len >= CXN_STATS_REPLY_FLAGS_OFFSET + 2 &&
+        (data[CXN_STATS_REPLY_FLAGS_OFFSET + 1] & CXN_STATS_REPLY_FLAG_MORE)) {
+        return;
+    }
+
+    xid = of_message_xid_get(msg);
+
+    for (i = 0; i < CXN_PENDING_REPLIES; i++) {
+        pending = &cxn->pending_replies[i];
+        if (pending->read_time_us == 0 || pending->xid != xid) {
+            continue;
+        }
+
+        if ((latency = latency_get(cxn, pending->object_id)) != NULL) {
+            ind_soc_histogram_add(&latency->reply_us,
+                                  INDIGO_CURRENT_TIME_us -
+                                  pending->read_time_us);
+        }
+        pending->read_time_us = 0;
+        cxn->pending_reply_count--;
+        return;
+    }
+}
+
+static indigo_error_t
+raw_reply_send(connection_t *cxn, uint8_t type, of_object_id_t object_id,
+               uint32_t xid, const uint8_t *body, int body_len)
+{
+    cxn_msg_counters_t *counters;
+    of_message_t msg;
+    uint8_t *data;
+    int len = CXN_OF_HEADER_LENGTH + body_len;
+
+    if (!CXN_TCP_CONNECTED(cxn)) {
+        LOG_ERROR(cxn, "Connection id %d is not connected", cxn->cxn_id);
+        return INDIGO_ERROR_CONNECTION;
+    }
+
+    if ((data = ind_cxn_msg_buffer_alloc(len)) == NULL) {
+        LOG_ERROR(cxn, "Could not allocate %s", of_object_id_str[object_id]);
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    msg = OF_BUFFER_TO_MESSAGE(data);
+    of_message_version_set(msg, cxn->status.negotiated_version);
+    of_message_type_set(msg, type);
+    of_message_length_set(msg, len);
+    of_message_xid_set(msg, xid);
+    if (body_len > 0) {
+        INDIGO_MEM_COPY(data + CXN_OF_HEADER_LENGTH, body, body_len);
+    }
+
+    LOG_MSG(cxn, "Sending %s message xid %u",
+            of_object_id_str[object_id], xid);
+
+    if ((counters = ind_cxn_msg_counters(cxn)) != NULL) {
+        counters->out_by_type[object_id]++;
+    }
+
+    if (ind_cxn_instance_enqueue(cxn,
+                                 CXN_OUTPUT_PRIORITY_MSG(object_id) ?
+                                 CXN_OUTPUT_CLASS_CONTROL :
+                                 CXN_OUTPUT_CLASS_BULK,
+                                 data, len) < 0) {
+        LOG_ERROR(cxn, "Could not enqueue message data, disconnecting");
+        ind_cxn_msg_data_free(data);
+        ind_cxn_disconnect(cxn);
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+/**
+ * A message arrived from the controller; reset the keepalive timeout
+ */
+
+static void
+rx_keepalive_reset(connection_t *cxn)
+{
+    cxn->keepalive.outstanding_echo_cnt = 0;
+
+#if OFCONNECTIONMANAGER_CONFIG_ECHO_OPTIMIZATION == 1
+    cxn->keepalive.last_rx = ind_soc_loop_now_us();
+#endif
+}
+
+/**
+ * Handle echo and barrier requests straight from the read buffer
+ *
+ * @param buf A complete message in the read buffer
+ * @param len The length of the message
+ *
+ * @returns 1 if the message was handled
+ * @returns 0 if it must be parsed and processed as an object
+ *
+ * Keepalives are answered by rewriting the header into a pooled buffer,
+ * without parsing the request or allocating a reply object, so they stay
+ * cheap when the event loop is busy.
+ */
+
+static int
+process_message_fast(connection_t *cxn, uint8_t *buf, int len)
+{
+    of_message_t msg = OF_BUFFER_TO_MESSAGE(buf);
+    of_version_t version = cxn->status.negotiated_version;
+    cxn_msg_counters_t *counters;
+    of_object_id_t object_id;
+    uint8_t type;
+    uint32_t xid;
+
+    if (!CXN_HANDSHAKE_COMPLETE(cxn) || cxn->trace_pvs != NULL ||
+        of_message_version_get(msg) != version) {
+        return 0;
+    }
+
+    type = of_message_type_get(msg);
+    if (type == CXN_OFPT_ECHO_REQUEST) {
+        object_id = OF_ECHO_REQUEST;
+    } else if (type == CXN_OFPT_ECHO_REPLY) {
+        object_id = OF_ECHO_REPLY;
+    } else if (type == CXN_OFPT_BARRIER_REQUEST(version) &&
+               len == CXN_OF_HEADER_LENGTH) {
+        object_id = OF_BARRIER_REQUEST;
+    } else {
+        return 0;
+    }
+
+    xid = of_message_xid_get(msg);
+    rx_keepalive_reset(cxn);
+
+    LOG_MSG(cxn, "Received %s message xid %u",
+            of_object_id_str[object_id], xid);
+    if ((counters = ind_cxn_msg_counters(cxn)) != NULL) {
+        counters->in_by_type[object_id]++;
+    }
+    cxn->status.messages_in++;
+
+    latency_reply_expect(cxn, object_id, xid);
+
+    switch (object_id) {
+    case OF_ECHO_REQUEST:
+        LOG_MSG(cxn, "Responding to echo with xid %u", xid);
+        (void)raw_reply_send(cxn, CXN_OFPT_ECHO_REPLY, OF_ECHO_REPLY, xid,
+                             buf + CXN_OF_HEADER_LENGTH,
+                             len - CXN_OF_HEADER_LENGTH);
+        break;
+    case OF_ECHO_REPLY:
+        if (xid != cxn->keepalive.xid) {
+            LOG_VERBOSE(cxn, "Received unexpected echo reply with xid %u, "
+                        "expected xid %u", xid, cxn->keepalive.xid);
+        }
+        break;
+    default:
+        (void)barrier_request_start(cxn, xid);
+        break;
+    }
+
+    latency_processed(cxn, object_id);
+
+    return 1;
+}
+
+/**
+ * Process a message from the read buffer
+ *
+ * @param buf A complete message in the read buffer
+ * @param len The length of the message
+ *
+ * The object is parsed in place and holds a reference on the read
+ * segment until it is deleted.  Its buffer must not be grown or stolen
+ * with of_object_wire_buffer_steal; use ind_cxn_wire_buffer_steal.
+ */
+
+static inline void
+process_message(connection_t *cxn, uint8_t *buf, int len)
+{
+    of_object_t *obj;
+    of_object_id_t object_id;
+    int msg_obj;
+    int rv;
+
+    CXN_TRACE_RING_RECORD(cxn, CXN_TRACE_RX, buf, len);
+
+    if (process_message_fast(cxn, buf, len)) {
+        return;
+    }
+
+    obj = of_object_new_from_message(OF_BUFFER_TO_MESSAGE(buf), len);
+    if (obj == NULL) {
+        LOG_ERROR(cxn, "Could not parse msg to OF object, len %d", len);
+        send_parse_error_message(cxn, buf, len);
+        return;
+    }
+
+    OF_OBJECT_TO_WBUF(obj)->free = rx_segment_buffer_free;
+    cxn->read_segment->refcount++;
+
+    if(cxn->trace_pvs) {
+        aim_printf(cxn->trace_pvs, "** of_msg_trace: received from cxn %s\n",
+                   cxn_ip_string(cxn));
+        of_object_dump((loci_writer_f)aim_printf, cxn->trace_pvs, obj);
+        aim_printf(cxn->trace_pvs, "**\n\n");
+    }
+
+    if (CXN_HANDSHAKE_COMPLETE(cxn)) {
+        rx_keepalive_reset(cxn);
+    }
+
+    {       /***** Debug info about message *****/
+        LOG_MSG(cxn, "Received %s message xid %u",
+                of_object_id_str[obj->object_id],
+                of_message_xid_get(OF_BUFFER_TO_MESSAGE(buf)));
+        LOG_OBJECT(obj);
+
+        cxn_msg_counters_t *counters = ind_cxn_msg_counters(cxn);
+
+        if (IS_MSG_OBJ(obj)) {
+            if (counters != NULL) {
+                counters->in_by_type[obj->object_id]++;
+            }
+        } else {
+            LOG_ERROR(cxn, "Received unknown msg obj id: %d", obj->object_id);
+            if (counters != NULL) {
+                counters->in_unknown++;
+            }
+        }
+        cxn->status.messages_in++;
+    }
+
+    /* FIXME:  Needs to be generalized to "handshake" state */
+    if (!VERSION_IS_SET(cxn)) {/* Get version from initial hello message */
+        if ((rv = check_for_hello(cxn, obj)) < 0) {
+            LOG_ERROR(cxn, "Failed to check for hello", indigo_strerror(rv));
+            /* @fixme Should state be updated for some return codes? */
+            return;
+        }
+    } else {
+        object_id = obj->object_id;
+        msg_obj = IS_MSG_OBJ(obj);
+        if (msg_obj) {
+            latency_reply_expect(cxn, object_id,
+                                 of_message_xid_get(OF_BUFFER_TO_MESSAGE(buf)));
+        }
+
+        /* Process received message (object); handler owns obj */
+        of_msg_process(cxn, obj);
+
+        if (msg_obj) {
+            latency_processed(cxn, object_id);
+        }
+    }
+}
+
+/**
+ * Process the complete messages in the read buffer
+ *
+ * Stops early if a barrier or the output queue pauses input, the
+ * connection is torn down by a handler, or the socket manager asks us
+ * to yield.
+ *
+ * @returns 1 if complete messages remain to be processed by the read task
+ * @returns 0 if not
+ * @returns INDIGO_ERROR_PROTOCOL if the data stream has illegal values
+ */
+
+static int
+process_messages(connection_t *cxn)
+{
+    uint32_t generation_id = cxn->generation_id;
+    uint8_t *buf;
+    int msg_bytes;
+
+    while (!CXN_INPUT_PAUSED(cxn)) {
+        if ((msg_bytes = next_message(cxn)) <= 0) {
+            return msg_bytes;
+        }
+
+        buf = &cxn->read_buffer[cxn->read_offset];
+        cxn->read_offset += msg_bytes;
+        process_message(cxn, buf, msg_bytes);
+
+        if (cxn->generation_id != generation_id || !CXN_TCP_CONNECTED(cxn)) {
+            return 0;
+        }
+
+        if (ind_soc_should_yield()) {
+            break;
+        }
+    }
+
+    /* A pending barrier or blocked output resumes through read_resume */
+    if (CXN_INPUT_PAUSED(cxn)) {
+        return 0;
     }
 
-    indigo_cxn_send_controller_message(cxn->cxn_id, error_msg);
+    return next_message(cxn) > 0;
 }
 
 /**
- * Process a message from the read buffer
- *
- * The read buffer must have a valid message in it to be processed
+ * Continue processing buffered messages after a yield
  */
 
-static inline void
-process_message(connection_t *cxn)
+static ind_soc_task_status_t
+cxn_read_task(void *cookie)
 {
-    uint8_t *new_buf;
-    of_object_t *obj;
-    int len;
+    connection_t *cxn = cookie;
     int rv;
 
-    /* Message is ready to be processed */
-    new_buf = extract_read_buffer(cxn);
-    if (new_buf == NULL) {
-        LOG_ERROR(cxn, "Could not alloc buffer to handle message; will block");
-        return;
+    if (!CXN_TCP_CONNECTED(cxn)) {
+        cxn->read_task_pending = 0;
+        return IND_SOC_TASK_FINISHED;
     }
 
-    /* Clear read buffer for next read, even if above failed */
-    len = cxn->read_bytes;
-    cxn->read_bytes = 0;
-    cxn->bytes_needed = OF_MESSAGE_HEADER_LENGTH;
+    if ((rv = process_messages(cxn)) < 0) {
+        cxn->read_task_pending = 0;
+        ind_cxn_disconnect(cxn);
+        return IND_SOC_TASK_FINISHED;
+    }
 
-    obj = of_object_new_from_message(OF_BUFFER_TO_MESSAGE(new_buf), len);
-    if (obj == NULL) {
-        LOG_ERROR(cxn, "Could not parse msg to OF object, len %d", len);
-        send_parse_error_message(cxn, new_buf, len);
-        INDIGO_MEM_FREE(new_buf);
-        return;
+    if (rv > 0) {
+        return IND_SOC_TASK_CONTINUE;
     }
 
-    if(cxn->trace_pvs) {
-        aim_printf(cxn->trace_pvs, "** of_msg_trace: received from cxn %s\n",
-                   cxn_ip_string(cxn));
-        of_object_dump((loci_writer_f)aim_printf, cxn->trace_pvs, obj);
-        aim_printf(cxn->trace_pvs, "**\n\n");
+    cxn->read_task_pending = 0;
+    read_buffer_release_idle(cxn);
+    if (CXN_TCP_CONNECTED(cxn) && !CXN_INPUT_PAUSED(cxn)) {
+        (void)ind_soc_data_in_resume(cxn->sd);
     }
 
-    if (CXN_HANDSHAKE_COMPLETE(cxn)) {
-        /* We have a message from the controller.  Reset keepalive timeout */
-        cxn->keepalive.outstanding_echo_cnt = 0;
+    return IND_SOC_TASK_FINISHED;
+}
 
-#if OFCONNECTIONMANAGER_CONFIG_ECHO_OPTIMIZATION == 1
-        if (cxn->keepalive.period_ms > 0) {
-            ind_soc_timer_event_register_with_priority(
-                periodic_keepalive, (void *)cxn,
-                cxn->keepalive.period_ms, IND_CXN_EVENT_PRIORITY);
-        }
-#endif
+/**
+ * Hand buffered messages off to the read task
+ *
+ * Socket input stays paused until the task has drained the buffer, so
+ * messages are processed in order and a close is not seen early.
+ */
 
+static void
+read_task_start(connection_t *cxn)
+{
+    if (cxn->read_task_pending) {
+        return;
     }
 
-    {       /***** Debug info about message *****/
-        uint32_t xid = of_message_xid_get(OF_BUFFER_TO_MESSAGE(
-            OF_OBJECT_BUFFER_INDEX(obj, 0)));
-        LOG_VERBOSE(cxn, "Received %s message xid %u",
-                    of_object_id_str[obj->object_id], xid);
-        LOG_OBJECT(obj);
+    if (ind_soc_data_in_pause(cxn->sd) < 0) {
+        LOG_ERROR(cxn, "Error pausing soc read for buffered messages");
+    }
 
-        if (IS_MSG_OBJ(obj)) {
-            cxn->messages_in_by_type[obj->object_id]++;
-        } else {
-            LOG_ERROR(cxn, "Received unknown msg obj id: %d", obj->object_id);
-            cxn->messages_in_unknown++;
-        }
-        cxn->status.messages_in++;
+    if (ind_soc_task_start(&cxn->read_task, cxn_read_task, cxn,
+                           IND_CXN_EVENT_PRIORITY) < 0) {
+        LOG_ERROR(cxn, "Failed to start read task");
+        (void)ind_soc_data_in_resume(cxn->sd);
+        return;
     }
 
-    /* FIXME:  Needs to be generalized to "handshake" state */
-    if (!VERSION_IS_SET(cxn)) {/* Get version from initial hello message */
-        if ((rv = check_for_hello(cxn, obj)) < 0) {
-            LOG_ERROR(cxn, "Failed to check for hello", indigo_strerror(rv));
-            /* @fixme Should state be updated for some return codes? */
-            return;
-        }
+    cxn->read_task_pending = 1;
+}
+
+/**
+ * Resume socket input after a barrier completes or the output drains
+ *
+ * Messages buffered meanwhile are processed first.
+ */
+
+static void
+read_resume(connection_t *cxn)
+{
+    if (cxn->read_task_pending || CXN_INPUT_PAUSED(cxn)) {
+        return;
+    }
+
+    if (next_message(cxn) > 0) {
+        read_task_start(cxn);
     } else {
-        /* Process received message (object); handler owns obj */
-        of_msg_process(cxn, obj);
+        (void)ind_soc_data_in_resume(cxn->sd);
     }
 }
 
 /**
  * Process the connection socket for reading
  *
+ * Reads as much as is available and processes every complete message
+ * in the read buffer, within the socket manager's yield budget.
+ *
  * @returns INDIGO_ERROR_NONE if no socket error
  * @returns INDIGO_ERROR_CONNECTION if socket error
+ * @returns INDIGO_ERROR_PROTOCOL if the data stream has illegal values
  */
 
 int
 ind_cxn_process_read_buffer(connection_t *cxn)
 {
-    int rv = INDIGO_ERROR_NONE;
+    int rv;
+
+    if ((rv = read_from_cxn(cxn)) < 0) {
+        return rv;
+    }
+
+    if ((rv = process_messages(cxn)) < 0) {
+        return rv;
+    }
 
-    if ((rv = read_message(cxn)) == INDIGO_ERROR_NONE) {
-        process_message(cxn);
+    if (rv > 0) {
+        read_task_start(cxn);
+    } else {
+        read_buffer_release_idle(cxn);
     }
 
-    return rv;
+    return INDIGO_ERROR_NONE;
 }
 
 /**
@@ -1337,13 +2638,98 @@ write_chunk(connection_t *cxn, uint8_t *start, ssize_t bytes)
     } else if (bytes_out < 0) {
         return INDIGO_ERROR_UNKNOWN;
     }
-    LOG_TRACE(cxn, "Wrote %d of %d", bytes_out, (int)bytes);
+    LOG_MSG(cxn, "Wrote %d of %d", bytes_out, (int)bytes);
 
     cxn->status.bytes_out += bytes_out;
 
     return bytes_out;
 }
 
+/****************************************************************
+ *
+ * Output queue backpressure
+ *
+ ****************************************************************/
+
+/**
+ * Stop taking more work from a connection whose output is backed up
+ */
+
+static void
+output_block(connection_t *cxn)
+{
+    LOG_VERBOSE(cxn, "Output queue above high watermark (%d bytes), "
+                "pausing input", cxn->bytes_enqueued);
+
+    cxn->output_blocked = 1;
+    cxn->output_blocked_count++;
+
+    if (ind_soc_data_in_pause(cxn->sd) < 0) {
+        LOG_ERROR(cxn, "Error pausing soc read on output backpressure");
+    }
+}
+
+/**
+ * Resume input and suspended producers once the output has drained
+ */
+
+static void
+output_unblock(connection_t *cxn)
+{
+    LOG_VERBOSE(cxn, "Output queue below low watermark (%d bytes), "
+                "resuming input", cxn->bytes_enqueued);
+
+    cxn->output_blocked = 0;
+    output_waiters_wake(cxn);
+    read_resume(cxn);
+}
+
+/**
+ * Call and release every output waiter
+ *
+ * Waiters only restart their tasks, so none are added meanwhile.
+ */
+
+static void
+output_waiters_wake(connection_t *cxn)
+{
+    list_links_t *cur;
+
+    while ((cur = list_pop(&cxn->output_waiters)) != NULL) {
+        cxn_output_waiter_t *waiter =
+            container_of(cur, links, cxn_output_waiter_t);
+        waiter->callback(waiter->cookie);
+        INDIGO_MEM_FREE(waiter);
+    }
+}
+
+/**
+ * Register a callback for when a blocked output queue drains
+ *
+ * @returns INDIGO_ERROR_NOT_FOUND if the queue is not blocked
+ */
+
+int
+ind_cxn_output_waiter_add(connection_t *cxn,
+                          indigo_cxn_output_ready_f callback, void *cookie)
+{
+    cxn_output_waiter_t *waiter;
+
+    if (!cxn->output_blocked) {
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    if ((waiter = INDIGO_MEM_ALLOC(sizeof(*waiter))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    waiter->callback = callback;
+    waiter->cookie = cookie;
+    list_push(&cxn->output_waiters, &waiter->links);
+
+    return INDIGO_ERROR_NONE;
+}
+
 /**
  * Process messages waiting to be sent to a connection socket
  *
@@ -1356,25 +2742,49 @@ ind_cxn_process_write_buffer(connection_t *cxn)
     int written, left;
     int num_iovecs = 0;
     struct iovec iovecs[MAX_WRITE_MSGS];
-    biglist_t *cur_node;
+    uint8_t iov_class[MAX_WRITE_MSGS];
+    int taken[CXN_OUTPUT_CLASS_COUNT] = { 0 };
+    cxn_output_queue_t *queue;
+    cxn_output_msg_t *msg;
     struct iovec *iov;
+    int cls;
 
-    /* Iterate over cxn->output_list adding buffers to iovecs */
-    cur_node = cxn->output_list;
-    while (cur_node != NULL && num_iovecs < MAX_WRITE_MSGS) {
+    /* A partially written message must be finished first */
+    if (cxn->output_head_offset > 0) {
+        cls = cxn->output_head_class;
+        msg = CXN_OUTPUT_MSG(&cxn->output[cls], 0);
         iov = &iovecs[num_iovecs];
-        iov->iov_base = BIGLIST_CAST(void *, cur_node);
-        iov->iov_len = of_message_length_get(iov->iov_base);
-        if (num_iovecs == 0) {
-            /* First buffer may be partially written */
-            iov->iov_base += cxn->output_head_offset;
-            iov->iov_len -= cxn->output_head_offset;
+        iov->iov_base = msg->data + cxn->output_head_offset;
+        iov->iov_len = msg->len - cxn->output_head_offset;
+        iov_class[num_iovecs++] = cls;
+        taken[cls]++;
+    }
+
+    /* Then fill iovecs from each class in priority order */
+    for (cls = 0; cls < CXN_OUTPUT_CLASS_COUNT; cls++) {
+        queue = &cxn->output[cls];
+        while (taken[cls] < queue->pkts && num_iovecs < MAX_WRITE_MSGS) {
+            msg = CXN_OUTPUT_MSG(queue, taken[cls]);
+            iov = &iovecs[num_iovecs];
+            iov->iov_base = msg->data;
+            iov->iov_len = msg->len;
+            iov_class[num_iovecs++] = cls;
+            taken[cls]++;
         }
-        num_iovecs++;
-        cur_node = biglist_next(cur_node);
     }
 
-    written = writev(cxn->sd, iovecs, num_iovecs);
+    if (cxn->shm != NULL) {
+        written = ind_cxn_shm_writev(cxn, iovecs, num_iovecs);
+    } else {
+        written = writev(cxn->sd, iovecs, num_iovecs);
+    }
+
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        /* Only seen when flushing before the socket is writable */
+        LOG_TRACE(cxn, "Socket not ready for write");
+        CXN_WRITE_READY(cxn->sd);
+        return 0;
+    }
 
     if (written < 0) {
         /* Error writing to connection socket */
@@ -1383,14 +2793,15 @@ ind_cxn_process_write_buffer(connection_t *cxn)
     }
 
     /*
-     * Iterate over cxn->output_list and iovecs together, freeing completely
+     * Iterate over the write queue and iovecs together, freeing completely
      * sent messages.
      */
     left = written;
     iov = iovecs;
     while (left > 0) {
         int to_write, bytes_out;
-        cur_node = cxn->output_list;
+        queue = &cxn->output[iov_class[iov - iovecs]];
+        msg = CXN_OUTPUT_MSG(queue, 0);
 
         /* Number of bytes we attempted to send in this message */
         to_write = iov->iov_len;
@@ -1398,17 +2809,22 @@ ind_cxn_process_write_buffer(connection_t *cxn)
         /* Number of bytes we actually sent in this message */
         bytes_out = aim_imin(left, to_write);
         cxn->bytes_enqueued -= bytes_out;
+        queue->bytes -= bytes_out;
 
         if (bytes_out == to_write) { /* Completed this message */
-            INDIGO_MEM_FREE(BIGLIST_CAST(void *, cur_node));
-            cur_node = cxn->output_list =
-                biglist_remove_link_free(cxn->output_list, cur_node);
+            if (cxn->pending_reply_count > 0) {
+                latency_reply_written(cxn, msg->data, msg->len);
+            }
+            output_msg_free(msg);
+            queue->head = (queue->head + 1) & (queue->size - 1);
+            queue->pkts--;
             cxn->pkts_enqueued--;
             cxn->status.messages_out++;
             cxn->output_head_offset = 0;
         } else {
             /* Partial write */
             INDIGO_ASSERT(bytes_out < to_write);
+            cxn->output_head_class = iov_class[iov - iovecs];
             cxn->output_head_offset += bytes_out;
             break;
         }
@@ -1417,8 +2833,13 @@ ind_cxn_process_write_buffer(connection_t *cxn)
         iov++;
     }
 
-    if (cxn->output_list == NULL) { /* Nothing (more) to send */
-        LOG_TRACE(cxn, "No more data to write");
+    if (cxn->output_blocked &&
+        cxn->bytes_enqueued < CXN_OUTPUT_LOW_WATERMARK) {
+        output_unblock(cxn);
+    }
+
+    if (cxn->pkts_enqueued == 0) { /* Nothing (more) to send */
+        LOG_MSG(cxn, "No more data to write");
         INDIGO_ASSERT(cxn->bytes_enqueued == 0);
         INDIGO_ASSERT(cxn->pkts_enqueued == 0);
         CXN_WRITE_CLEAR(cxn->sd);
@@ -1428,28 +2849,101 @@ ind_cxn_process_write_buffer(connection_t *cxn)
 }
 
 /**
- * Enqueue data into the write buffer for transmission to a controller
- *
- * @param cxn The connection handle
- * @param data Pointer to a message to be sent
- * @param len Number of bytes to be sent out
+ * Create a shared message buffer holding a single reference
  *
- * @returns Error code
+ * @param data Message data; ownership passes to the shared buffer
+ * @param len Length of the message
+ */
+
+cxn_shared_msg_t *
+ind_cxn_shared_msg_new(uint8_t *data, int len)
+{
+    cxn_shared_msg_t *shared;
+
+    if ((shared = INDIGO_MEM_ALLOC(sizeof(*shared))) == NULL) {
+        return NULL;
+    }
+
+    shared->refcount = 1;
+    shared->len = len;
+    shared->data = data;
+
+    return shared;
+}
+
+void
+ind_cxn_shared_msg_unref(cxn_shared_msg_t *shared)
+{
+    INDIGO_ASSERT(shared->refcount > 0);
+    if (--shared->refcount == 0) {
+        ind_cxn_msg_data_free(shared->data);
+        INDIGO_MEM_FREE(shared);
+    }
+}
+
+/**
+ * Release a write queue entry's data
+ */
+
+static void
+output_msg_free(cxn_output_msg_t *msg)
+{
+    if (msg->shared != NULL) {
+        ind_cxn_shared_msg_unref(msg->shared);
+    } else {
+        ind_cxn_msg_data_free(msg->data);
+    }
+}
+
+/**
+ * Double the size of the write queue ring
  *
- * Takes ownership of data unless an error is returned.
+ * Queued messages are unwrapped to the start of the new ring.
  */
 
-int
-ind_cxn_instance_enqueue(connection_t *cxn, uint8_t *data, int len)
+static indigo_error_t
+output_ring_grow(cxn_output_queue_t *queue)
+{
+    cxn_output_msg_t *ring;
+    int size;
+    int i;
+
+    size = queue->size ? queue->size * 2 : CXN_OUTPUT_RING_INIT_SIZE;
+    if ((ring = INDIGO_MEM_ALLOC(size * sizeof(*ring))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    for (i = 0; i < queue->pkts; i++) {
+        ring[i] = *CXN_OUTPUT_MSG(queue, i);
+    }
+
+    INDIGO_MEM_FREE(queue->ring);
+    queue->ring = ring;
+    queue->size = size;
+    queue->head = 0;
+
+    return INDIGO_ERROR_NONE;
+}
+
+/**
+ * Append a message to the write queue
+ */
+
+static int
+output_enqueue(connection_t *cxn, cxn_output_class_t cls,
+               uint8_t *data, int len, cxn_shared_msg_t *shared)
 {
+    cxn_output_queue_t *queue = &cxn->output[cls];
+    cxn_output_msg_t *msg;
     int msg_len;
 
-    LOG_TRACE(cxn, "Enqueuing %d bytes", len);
-    LOG_TRACE(cxn, "Cur len %d bytes, %d pkts",
-              cxn->bytes_enqueued, cxn->pkts_enqueued);
+    LOG_MSG(cxn, "Enqueuing %d bytes in class %d", len, cls);
+    LOG_MSG(cxn, "Cur len %d bytes, %d pkts; class %d bytes, %d pkts",
+            cxn->bytes_enqueued, cxn->pkts_enqueued,
+            queue->bytes, queue->pkts);
 
     /* See notes about WRITE_BUFFER_SIZE in cxn_instance.h */
-    if (len > CXN_WRITE_BYTES_AVAIL(cxn)) {
+    if (len > CXN_WRITE_BYTES_AVAIL(cxn, cls)) {
         return INDIGO_ERROR_RESOURCE;
     }
 
@@ -1460,18 +2954,91 @@ ind_cxn_instance_enqueue(connection_t *cxn, uint8_t *data, int len)
                   len, msg_len);
         return INDIGO_ERROR_UNKNOWN;
     }
-    cxn->output_list = biglist_append(cxn->output_list, (void *)data);
+
+    if (queue->pkts == queue->size && output_ring_grow(queue) < 0) {
+        LOG_ERROR(cxn, "Could not grow write queue");
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    CXN_TRACE_RING_RECORD(cxn, CXN_TRACE_TX, data, len);
+
+    msg = CXN_OUTPUT_MSG(queue, queue->pkts);
+    msg->data = data;
+    msg->len = len;
+    msg->shared = shared;
+    queue->bytes += len;
+    queue->pkts += 1;
     cxn->bytes_enqueued += len;
     cxn->pkts_enqueued += 1;
 
-    /* Indicate data is ready to the socket manager */
     INDIGO_ASSERT(cxn->bytes_enqueued > 0);
     INDIGO_ASSERT(cxn->pkts_enqueued > 0);
+
+    if (!cxn->output_blocked &&
+        cxn->bytes_enqueued >= CXN_OUTPUT_HIGH_WATERMARK) {
+        output_block(cxn);
+    }
+
+#if OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE == 1
+    /* Leave small amounts of data for ind_cxn_flush_pending */
+    if (cxn->bytes_enqueued < OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES) {
+        cxn->flush_pending = 1;
+        return INDIGO_ERROR_NONE;
+    }
+#endif
+
+    /* Indicate data is ready to the socket manager */
     CXN_WRITE_READY(cxn->sd);
 
     return INDIGO_ERROR_NONE;
 }
 
+/**
+ * Enqueue data into the write buffer for transmission to a controller
+ *
+ * @param cxn The connection handle
+ * @param cls The output class to queue the message in
+ * @param data Pointer to a message to be sent
+ * @param len Number of bytes to be sent out
+ *
+ * @returns Error code
+ *
+ * Takes ownership of data unless an error is returned.
+ */
+
+int
+ind_cxn_instance_enqueue(connection_t *cxn, cxn_output_class_t cls,
+                         uint8_t *data, int len)
+{
+    return output_enqueue(cxn, cls, data, len, NULL);
+}
+
+/**
+ * Enqueue a shared message for transmission to a controller
+ *
+ * @param cxn The connection handle
+ * @param cls The output class to queue the message in
+ * @param shared The message; the write queue takes its own reference
+ *
+ * @returns Error code
+ */
+
+int
+ind_cxn_instance_enqueue_shared(connection_t *cxn, cxn_output_class_t cls,
+                                cxn_shared_msg_t *shared)
+{
+    int rv;
+
+    if ((rv = output_enqueue(cxn, cls, shared->data, shared->len,
+                             shared)) < 0) {
+        return rv;
+    }
+
+    shared->refcount++;
+
+    return INDIGO_ERROR_NONE;
+}
+
 /**
  * Send a hello message to the given connection
  */
@@ -1543,12 +3110,7 @@ ind_cxn_try_to_connect(connection_t *cxn)
             return -1;
         }
 
-        /* Disable Nagle's algorithm */
-        {
-            int flag = 1;
-            (void) setsockopt(cxn->sd, IPPROTO_TCP, TCP_NODELAY,
-                              (char *) &flag, sizeof(int));
-        }
+        ind_cxn_socket_options_set(cxn);
     }
 
     LOG_TRACE(cxn, "Attempting to connect");
@@ -1598,20 +3160,64 @@ ind_cxn_disconnected_init(connection_t *cxn)
 {
     cxn->status.state = INDIGO_CXN_S_DISCONNECTED;
     cxn->status.role = INDIGO_CXN_R_EQUAL;
+    ind_cxn_async_config_reset(cxn);
     cxn->status.negotiated_version = OF_VERSION_UNKNOWN;
-    cxn->bytes_needed = OF_MESSAGE_HEADER_LENGTH;
+    cxn->read_offset = 0;
+    cxn->read_bytes = 0;
     cxn->flags = 0;
     cxn->outstanding_op_cnt = 0;
     cxn->barrier.pendingf = 0;
+    cxn->output_blocked = 0;
+    list_init(&cxn->output_waiters);
     cxn->keepalive.outstanding_echo_cnt = 0;
     cxn->status.bytes_in = 0;
     cxn->status.bytes_out = 0;
     cxn->status.messages_in = 0;
     cxn->status.messages_out = 0;
+    INDIGO_MEM_CLEAR(&cxn->meters, sizeof(cxn->meters));
+    cxn->read_time_us = 0;
+    INDIGO_MEM_CLEAR(cxn->pending_replies, sizeof(cxn->pending_replies));
+    cxn->pending_reply_next = 0;
+    cxn->pending_reply_count = 0;
     cxn->fail_count = 0;
     cxn->hello_time = 0;
 }
 
+/**
+ * Get the message counters of a connection, allocating them if needed
+ *
+ * @returns NULL if they could not be allocated; the message is not counted
+ */
+cxn_msg_counters_t *
+ind_cxn_msg_counters(connection_t *cxn)
+{
+    if (cxn->counters == NULL) {
+        cxn->counters = INDIGO_MEM_ALLOC(sizeof(*cxn->counters));
+        if (cxn->counters != NULL) {
+            INDIGO_MEM_CLEAR(cxn->counters, sizeof(*cxn->counters));
+        }
+    }
+
+    return cxn->counters;
+}
+
+/**
+ * Release per-slot memory of a connection that is being deactivated
+ */
+void
+ind_cxn_instance_release(connection_t *cxn)
+{
+    int idx;
+
+    if (cxn->counters != NULL) {
+        for (idx = 0; idx < OF_MESSAGE_OBJECT_COUNT; idx++) {
+            INDIGO_MEM_FREE(cxn->counters->latency[idx]);
+        }
+    }
+    INDIGO_MEM_FREE(cxn->counters);
+    cxn->counters = NULL;
+}
+
 /**
  * @brief Calculate timeout between connection attempts.
  *
@@ -30,9 +30,44 @@
 
 #include <loci/loci.h>
 #include <OFConnectionManager/ofconnectionmanager.h>
-#include <BigList/biglist.h>
+#include <SocketManager/socketmanager.h>
+#include <stddef.h>
+#include "cxn_shm.h"
 
-#define READ_BUFFER_SIZE (64 * 1024)
+/**
+ * Receive segment
+ *
+ * Incoming messages are parsed in place: each object created from the
+ * read buffer points into the segment holding it and keeps a reference
+ * on it.  Segments are allocated aligned to their size so the owning
+ * segment can be found from any pointer into its data.
+ */
+#define CXN_RX_SEGMENT_SIZE (128 * 1024)
+
+typedef struct cxn_rx_segment_s {
+    int refcount;
+    uint8_t data[];
+} cxn_rx_segment_t;
+
+#define READ_BUFFER_SIZE \
+    ((int)(CXN_RX_SEGMENT_SIZE - offsetof(cxn_rx_segment_t, data)))
+
+/**
+ * Once less than this much space remains at the end of the read buffer,
+ * the unprocessed data is moved to the front (or to a fresh segment if
+ * objects still reference the current one).  A message always fits in
+ * this much space.
+ */
+#define READ_BUFFER_MIN_FREE (64 * 1024)
+
+/**
+ * A connection only holds a segment while it has unprocessed data; once
+ * the read buffer drains the segment is released.  Up to this many
+ * unreferenced segments are cached for the next read instead of being
+ * freed, so idle connections cost no buffer memory and busy ones do not
+ * go back to the allocator on every read.
+ */
+#define CXN_RX_SEGMENT_CACHE_MAX 4
 
 /**
  * The write buffer size is artificial in that the original data
@@ -49,6 +84,228 @@
  */
 #define WRITE_BUFFER_SIZE (16 * 1024 * 1024)
 
+/**
+ * Output classes
+ *
+ * Each connection queues outgoing messages per class and sends them in
+ * strict priority order, so a large stats reply cannot hold up echo or
+ * role replies.  Classes only switch between messages.
+ *
+ * Only messages matched by CXN_OUTPUT_PRIORITY_MSG go ahead of earlier
+ * output.  Barrier, error and all other replies share the bulk class
+ * with stats replies, so a barrier reply is never sent before the
+ * replies to the requests preceding it.
+ */
+typedef enum cxn_output_class_e {
+    CXN_OUTPUT_CLASS_CONTROL, /* Hello, echo and role; sent first */
+    CXN_OUTPUT_CLASS_ASYNC,   /* Packet-in, flow-removed, port-status */
+    CXN_OUTPUT_CLASS_BULK,    /* Every other reply, in order */
+    CXN_OUTPUT_CLASS_COUNT
+} cxn_output_class_t;
+
+#define CXN_OUTPUT_PRIORITY_MSG(object_id)                      \
+    ((object_id) == OF_HELLO ||                                 \
+     (object_id) == OF_ECHO_REQUEST ||                          \
+     (object_id) == OF_ECHO_REPLY ||                            \
+     (object_id) == OF_ROLE_REPLY ||                            \
+     (object_id) == OF_NICIRA_CONTROLLER_ROLE_REPLY)
+
+/**
+ * Bytes each class may queue before enqueue fails.  Bulk gets the full
+ * WRITE_BUFFER_SIZE; the others are kept well clear of it.  Async
+ * messages are also dropped early by CXN_DROP_PACKET_IN and friends.
+ */
+#define CXN_OUTPUT_CONTROL_BYTES_MAX (1024 * 1024)
+#define CXN_OUTPUT_ASYNC_BYTES_MAX (1024 * 1024)
+#define CXN_OUTPUT_BULK_BYTES_MAX WRITE_BUFFER_SIZE
+
+/**
+ * Output queue watermarks
+ *
+ * Once a connection has more than the high watermark queued, input from
+ * it is paused and stats iterators feeding it are suspended.  Both are
+ * resumed when the queue drains below the low watermark.  This makes a
+ * slow controller slow us down instead of overflowing the queue.
+ */
+#define CXN_OUTPUT_HIGH_WATERMARK (WRITE_BUFFER_SIZE / 2)
+#define CXN_OUTPUT_LOW_WATERMARK (WRITE_BUFFER_SIZE / 8)
+
+/**
+ * Waiter for the output queue to drop below the low watermark
+ */
+typedef struct cxn_output_waiter_s {
+    list_links_t links;
+    indigo_cxn_output_ready_f callback;
+    void *cookie;
+} cxn_output_waiter_t;
+
+/**
+ * Message buffer referenced by several connections' write queues
+ *
+ * Used to fan out async messages without copying them.  The data is
+ * freed with the last reference, once every connection has written it.
+ */
+typedef struct cxn_shared_msg_s {
+    int refcount;
+    int len;
+    uint8_t *data;
+} cxn_shared_msg_t;
+
+/**
+ * Write queue entry
+ *
+ * The queue owns data, or holds a reference on shared if it is set.
+ */
+typedef struct cxn_output_msg_s {
+    uint8_t *data;
+    int len;
+    cxn_shared_msg_t *shared;
+} cxn_output_msg_t;
+
+/* Initial number of write queue entries; must be a power of 2 */
+#define CXN_OUTPUT_RING_INIT_SIZE 64
+
+/**
+ * Write queue for one output class
+ *
+ * A ring of outgoing messages, doubled in size when full, so enqueue is
+ * O(1) and the oldest messages are contiguous (modulo wrap) for writev.
+ */
+typedef struct cxn_output_queue_s {
+    cxn_output_msg_t *ring;
+    int size;               /* Number of entries; zero or a power of 2 */
+    int head;               /* Index of the oldest queued message */
+    int bytes;              /* Bytes queued */
+    int pkts;               /* Messages queued; entries in use */
+} cxn_output_queue_t;
+
+/**
+ * Async message rate limits
+ *
+ * Token bucket meters, one set per connection, applied to packet-ins
+ * and flow-removeds before they are queued.  A packet-in must pass the
+ * aggregate meter, the meter for its reason and the meter for its
+ * ingress port.  Configured with the "rate_limits" controller config.
+ */
+typedef struct ind_cxn_meter_config_s {
+    uint32_t rate;  /* Messages per second; 0 disables the meter */
+    uint32_t burst; /* Bucket depth in messages */
+} ind_cxn_meter_config_t;
+
+/* Packet-in reasons with their own meter; larger reasons share the last */
+#define CXN_PACKET_IN_REASON_METERS 8
+
+/**
+ * Packet-in fair queuing
+ *
+ * While async output is backed up, packet-ins wait in one queue per
+ * reason and hashed ingress port instead of being dropped by the first
+ * full connection.  The queues are drained by deficit round robin as
+ * output frees, each getting a share in proportion to its reason's
+ * weight, so a storm from one port cannot starve the others.
+ */
+typedef struct ind_cxn_fair_queue_config_s {
+    uint32_t depth;   /* Messages per queue; 0 disables fair queuing */
+    uint32_t reason_weights[CXN_PACKET_IN_REASON_METERS]; /* 0 means 1 */
+} ind_cxn_fair_queue_config_t;
+
+typedef struct ind_cxn_rate_limits_s {
+    ind_cxn_meter_config_t packet_in;
+    ind_cxn_meter_config_t packet_in_reason; /* Each reason separately */
+    ind_cxn_meter_config_t packet_in_port;   /* Each ingress port */
+    ind_cxn_meter_config_t flow_removed;
+    ind_cxn_fair_queue_config_t packet_in_fair_queue;
+} ind_cxn_rate_limits_t;
+
+typedef struct cxn_meter_s {
+    uint64_t tokens;         /* Scaled by 1000000 */
+    indigo_time_us_t last;   /* Last refill; 0 if the bucket is new */
+} cxn_meter_t;
+
+/* Port meters are hashed by port number; colliding ports share one */
+#define CXN_PACKET_IN_PORT_METERS 64
+
+/**
+ * Auxiliary connections
+ *
+ * An OpenFlow 1.3 main connection may open up to CXN_AUX_MAX auxiliary
+ * connections to the same controller, identified by a nonzero
+ * auxiliary_id in their features reply.  Packet-ins and flow-removeds
+ * for the main connection are spread over its auxiliary connections;
+ * everything else, including role, stays with the main connection.
+ */
+#define CXN_AUX_MAX 4
+
+#define CXN_AUX(cxn) ((cxn)->auxiliary_id != 0)
+
+/**
+ * Async message configuration, see the OpenFlow 1.3 set_async message
+ *
+ * For each filtered async message type, a bitmap of the reasons a
+ * connection wants, one for the master and equal roles and one for
+ * slave. Bit n stands for reason n; higher reasons share bit 31. Kept
+ * on main connections only.
+ */
+typedef enum cxn_async_type_e {
+    CXN_ASYNC_PACKET_IN,
+    CXN_ASYNC_PORT_STATUS,
+    CXN_ASYNC_FLOW_REMOVED,
+    CXN_ASYNC_TYPES             /* Also: not filtered by reason */
+} cxn_async_type_t;
+
+#define CXN_ASYNC_ROLE_MASTER 0     /* Master and equal */
+#define CXN_ASYNC_ROLE_SLAVE 1
+#define CXN_ASYNC_ROLES 2
+
+#define CXN_ASYNC_ROLE(cxn) \
+    ((cxn)->status.role == INDIGO_CXN_R_SLAVE ? \
+     CXN_ASYNC_ROLE_SLAVE : CXN_ASYNC_ROLE_MASTER)
+
+#define CXN_ASYNC_REASON_BIT(reason) \
+    ((uint32_t)1 << ((reason) < 31 ? (reason) : 31))
+
+/**
+ * Per message type latencies, in microseconds
+ *
+ * processing_us runs from the socket read that completed a message to
+ * the return of its handler.  For request types, reply_us runs from the
+ * same read until the last message of the reply, matched by xid, has
+ * been written to the socket.
+ */
+typedef struct cxn_msg_latency_s {
+    ind_soc_histogram_t processing_us;
+    ind_soc_histogram_t reply_us;
+} cxn_msg_latency_t;
+
+/**
+ * Per message type counters
+ *
+ * Cumulative over the life of the connection slot.  Allocated when the
+ * first message is counted, so idle and listening slots do not carry them.
+ * Latencies are allocated per type when the type is first received.
+ */
+typedef struct cxn_msg_counters_s {
+    uint64_t in_by_type[OF_MESSAGE_OBJECT_COUNT];
+    uint64_t out_by_type[OF_MESSAGE_OBJECT_COUNT];
+    uint64_t in_unknown;
+    uint64_t out_unknown;
+    cxn_msg_latency_t *latency[OF_MESSAGE_OBJECT_COUNT];
+} cxn_msg_counters_t;
+
+/**
+ * Requests whose reply has not been written yet
+ *
+ * The oldest is overwritten when the table is full, so requests that
+ * are never answered do not hold a slot for long.
+ */
+#define CXN_PENDING_REPLIES 16
+
+typedef struct cxn_pending_reply_s {
+    uint32_t xid;
+    of_object_id_t object_id;
+    indigo_time_us_t read_time_us; /* 0 if the slot is free */
+} cxn_pending_reply_t;
+
 /**
  * Connection flag, connection is to be removed pending op completion
  */
@@ -66,33 +323,68 @@ typedef struct connection_s {
     int fail_count; /* How may failed connection tries */
     indigo_cxn_id_t cxn_id; /* For back tracking */
 
+    /* Auxiliary connections, see CXN_AUX_MAX */
+    uint8_t auxiliary_id; /* Nonzero for an auxiliary connection */
+    indigo_cxn_id_t main_cxn_id; /* If auxiliary, its main connection */
+    int num_aux; /* If main, the auxiliary connections opened */
+    indigo_cxn_id_t aux_cxn_ids[CXN_AUX_MAX];
+
     int sd; /* The socket descriptor */
+    cxn_shm_t *shm; /* Shared memory transport, or NULL for TCP */
+
+    /*
+     * The read buffer holds data read from the socket that has not yet
+     * been processed.  Each read takes as much as the socket has
+     * available, up to the free space in the buffer, and every complete
+     * message between read_offset and read_bytes is then framed and
+     * processed.  The buffer is the data of read_segment, which is
+     * taken on demand by a read and released once the buffer drains.
+     */
+    cxn_rx_segment_t *read_segment;
+    uint8_t *read_buffer;
+    int read_offset; /* Start of the first unprocessed message */
+    int read_bytes; /* End of the data in the read buffer */
 
     /*
-     * The read buffer is used to buffer a single message.  There
-     * are two steps to the operation: Read the header, then use that
-     * to determine the number of bytes remaining in the message.
-     * Once a message is read in, it is processed and the read buffer
-     * is cleared.
+     * If processing yields with complete messages still buffered, socket
+     * input is paused and this task finishes them off.
      */
-    uint8_t read_buffer[READ_BUFFER_SIZE];
-    int read_bytes; /* Number of bytes currently in read buffer */
-    int bytes_needed; /* Num bytes needed for next process step */
+    ind_soc_task_t read_task;
+    int read_task_pending;
 
-    /* Write queue */
-    biglist_t *output_list; /* List of outgoing messages */
-    int output_head_offset; /* Bytes already sent out from head of output_list */
+    /* Write queues, one per cxn_output_class_t */
+    cxn_output_queue_t output[CXN_OUTPUT_CLASS_COUNT];
+    int output_head_offset; /* Bytes already sent out from a head message */
+    int output_head_class;  /* Class of that message, if offset > 0 */
     int bytes_enqueued;     /* Total bytes queued */
     int pkts_enqueued;      /* Total pkts queued */
+    int flush_pending;      /* Coalesced write waiting for the pass end */
+    int output_blocked;     /* Above the high watermark */
+    uint64_t output_blocked_count;
+    list_head_t output_waiters; /* cxn_output_waiter_t */
+
+    /* Additional debug info; NULL until a message is counted */
+    cxn_msg_counters_t *counters;
 
-    /* Additional debug info */
-    uint64_t messages_in_by_type[OF_MESSAGE_OBJECT_COUNT];
-    uint64_t messages_out_by_type[OF_MESSAGE_OBJECT_COUNT];
-    uint64_t messages_in_unknown;
-    uint64_t messages_out_unknown;
+    /* Message latencies, see cxn_msg_latency_t */
+    indigo_time_us_t read_time_us; /* Completion of the last socket read */
+    cxn_pending_reply_t pending_replies[CXN_PENDING_REPLIES];
+    int pending_reply_next;  /* Slot taken by the next request */
+    int pending_reply_count; /* Slots in use */
 
     uint64_t packet_ins;
 
+    /* Wanted async reasons, see cxn_async_type_t */
+    uint32_t async_config[CXN_ASYNC_ROLES][CXN_ASYNC_TYPES];
+
+    /* Async rate limit buckets, see ind_cxn_rate_limits_t */
+    struct {
+        cxn_meter_t packet_in;
+        cxn_meter_t packet_in_reason[CXN_PACKET_IN_REASON_METERS];
+        cxn_meter_t packet_in_port[CXN_PACKET_IN_PORT_METERS];
+        cxn_meter_t flow_removed;
+    } meters;
+
     int outstanding_op_cnt; /* Number of outstanding operations */
     struct {
         unsigned char pendingf;           /* Barrier reply pending flag */
@@ -105,11 +397,14 @@ typedef struct connection_s {
         uint32_t threshold;  /* value above which connection is declared dead */
         uint32_t period_ms;     /* keepalive period in milliseconds */
         uint32_t xid;   /* xid of last outstanding echo reply */
+        indigo_time_us_t next_echo; /* when the next echo request is due */
+        indigo_time_us_t last_rx;   /* last message, with ECHO_OPTIMIZATION */
     } keepalive;
 
 
     /* Message Tracing */
     aim_pvs_t* trace_pvs;
+    uint32_t trace_ipv4;    /* Controller address for the trace ring */
 
     /* To detect object staleness */
     uint32_t generation_id;
@@ -125,23 +420,24 @@ typedef struct connection_s {
  * @TODO This may need tuning
  */
 #define PACKET_IN_DROP_QUEUE_MAX 64
-#define CXN_DROP_PACKET_IN(cxn, obj)                    \
-    ((cxn)->pkts_enqueued > PACKET_IN_DROP_QUEUE_MAX)
+#define CXN_DROP_PACKET_IN(cxn, obj)                                    \
+    ((cxn)->output[CXN_OUTPUT_CLASS_ASYNC].pkts > PACKET_IN_DROP_QUEUE_MAX)
 
 /**
  * Should a flow removed message be dropped based on connection state?
  * @TODO This may need tuning
  */
 #define FLOW_REMOVED_DROP_QUEUE_MAX 64
-#define CXN_DROP_FLOW_REMOVED(cxn, obj)                \
-    ((cxn)->pkts_enqueued > FLOW_REMOVED_DROP_QUEUE_MAX)
+#define CXN_DROP_FLOW_REMOVED(cxn, obj)                                 \
+    ((cxn)->output[CXN_OUTPUT_CLASS_ASYNC].pkts > FLOW_REMOVED_DROP_QUEUE_MAX)
 
 /**
- * How many bytes in buffer are free
+ * How many bytes a class may still queue
  * See notes above about WRITE_BUFFER_SIZE.
  */
-#define CXN_WRITE_BYTES_AVAIL(cxn) \
-    (WRITE_BUFFER_SIZE - ((cxn)->bytes_enqueued))
+extern const int ind_cxn_output_bytes_max[CXN_OUTPUT_CLASS_COUNT];
+#define CXN_WRITE_BYTES_AVAIL(cxn, cls) \
+    (ind_cxn_output_bytes_max[cls] - (cxn)->output[cls].bytes)
 
 /**
  * Is a connection active (in any state)?
@@ -191,7 +487,37 @@ extern state_info_t state_info[INDIGO_CXN_S_COUNT];
     (CXN_ACTIVE(cxn) &&                                                 \
      (CONNECTION_STATE(cxn) == INDIGO_CXN_S_HANDSHAKE_COMPLETE))
 
-extern int ind_cxn_instance_enqueue(connection_t *cxn, uint8_t *data, int len);
+extern int ind_cxn_output_waiter_add(connection_t *cxn,
+                                     indigo_cxn_output_ready_f callback,
+                                     void *cookie);
+
+extern int ind_cxn_instance_enqueue(connection_t *cxn, cxn_output_class_t cls,
+                                    uint8_t *data, int len);
+
+extern int ind_cxn_instance_enqueue_shared(connection_t *cxn,
+                                           cxn_output_class_t cls,
+                                           cxn_shared_msg_t *shared);
+
+extern cxn_shared_msg_t *ind_cxn_shared_msg_new(uint8_t *data, int len);
+
+extern void ind_cxn_shared_msg_unref(cxn_shared_msg_t *shared);
+
+extern indigo_error_t ind_cxn_wire_buffer_steal(of_object_t *obj,
+                                                uint8_t **data);
+
+extern void ind_cxn_msg_data_free(uint8_t *data);
+
+extern uint8_t *ind_cxn_msg_buffer_alloc(int len);
+
+extern void ind_cxn_msg_pool_finish(void);
+
+extern uint8_t *ind_cxn_pktin_frame_alloc(void);
+
+extern int ind_cxn_pktin_frame_valid(const uint8_t *frame);
+
+extern void ind_cxn_pktin_buffer_free(void *buf);
+
+extern void ind_cxn_pktin_pool_finish(void);
 
 extern int ind_cxn_send_hello(connection_t *cxn);
 
@@ -205,8 +531,28 @@ extern void ind_cxn_disconnect(connection_t *cxn);
 
 extern void ind_cxn_disconnected_init(connection_t *cxn);
 
+extern void ind_cxn_async_config_reset(connection_t *cxn);
+
+extern void ind_cxn_socket_options_set(connection_t *cxn);
+
+extern int ind_cxn_accepts_async_message(const connection_t *cxn,
+                                         const of_object_t *obj);
+
+extern cxn_msg_counters_t *ind_cxn_msg_counters(connection_t *cxn);
+
+extern void ind_cxn_instance_release(connection_t *cxn);
+
 extern void ind_cxn_state_set(connection_t *cxn, indigo_cxn_state_t new_state);
 
+extern void ind_cxn_rate_limits_set(const ind_cxn_rate_limits_t *limits);
+
+extern int ind_cxn_packet_in_meter(connection_t *cxn, of_packet_in_t *obj);
+
+/* Interval of the shared timer that sends due keepalives */
+#define CXN_KEEPALIVE_TICK_MS 100
+
+extern void ind_cxn_keepalive_check(connection_t *cxn, indigo_time_us_t now);
+
 
 /****************************************************************
  * Debug and logging routines
@@ -220,6 +566,12 @@ proto_ip_string(indigo_cxn_protocol_params_t *params)
 {
     int port;
 
+    if (params->header.protocol == INDIGO_CXN_PROTO_SHM_OVER_UNIX) {
+        snprintf(ip_print_buf, sizeof(ip_print_buf), "unix:%s",
+                 params->shm_over_unix.path);
+        return ip_print_buf;
+    }
+
     port = params->tcp_over_ipv4.controller_port;
 
     sprintf(ip_print_buf, "%s:%d", params->tcp_over_ipv4.controller_ip, port);
@@ -0,0 +1,388 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Shared memory transport for co-located applications
+ */
+
+#define _GNU_SOURCE /* memfd_create */
+
+#include "ofconnectionmanager_log.h"
+#include "ofconnectionmanager_int.h"
+#include "cxn_instance.h"
+#include "cxn_shm.h"
+
+#include <SocketManager/socketmanager.h>
+#include <indigo/memory.h>
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+struct cxn_shm_s {
+    int sock;                   /* Client's Unix socket */
+    int client_wake_fd;
+    int space_fd;               /* Client signals after freeing space */
+    ind_cxn_shm_region_t *region;
+};
+
+#define RING_MASK (IND_CXN_SHM_RING_SIZE - 1)
+
+/* Signal an eventfd; it only fails if the counter would overflow */
+static void
+shm_signal(int fd)
+{
+    uint64_t one = 1;
+    (void)write(fd, &one, sizeof(one));
+}
+
+/* Reset an eventfd's counter so it stops polling readable */
+static void
+shm_drain(int fd)
+{
+    uint64_t count;
+    (void)read(fd, &count, sizeof(count));
+}
+
+int
+ind_cxn_shm_ring_put(ind_cxn_shm_ring_t *ring, const struct iovec *iov,
+                     int iovcnt, int *was_empty)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t space = IND_CXN_SHM_RING_SIZE - (head - tail);
+    int total = 0;
+    int i;
+
+    for (i = 0; i < iovcnt && space > 0; i++) {
+        const uint8_t *src = iov[i].iov_base;
+        uint32_t len = iov[i].iov_len < space ? iov[i].iov_len : space;
+        uint32_t offset = head & RING_MASK;
+        uint32_t first = IND_CXN_SHM_RING_SIZE - offset;
+
+        if (first > len) {
+            first = len;
+        }
+        memcpy(&ring->data[offset], src, first);
+        memcpy(ring->data, src + first, len - first);
+
+        head += len;
+        space -= len;
+        total += len;
+    }
+
+    if (total > 0) {
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+
+    /* Pairs with the consumer's barrier between its tail and head */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    *was_empty = total > 0 &&
+        __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head - total;
+
+    return total;
+}
+
+int
+ind_cxn_shm_ring_get(ind_cxn_shm_ring_t *ring, uint8_t *buf, int len)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t avail = head - tail;
+    uint32_t offset = tail & RING_MASK;
+    uint32_t first;
+
+    if ((uint32_t)len > avail) {
+        len = avail;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    first = IND_CXN_SHM_RING_SIZE - offset;
+    if (first > (uint32_t)len) {
+        first = len;
+    }
+    memcpy(buf, &ring->data[offset], first);
+    memcpy(buf + first, ring->data, len - first);
+
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+/* Close the descriptors sent to the client */
+static void
+shm_fds_close(int *fds)
+{
+    int i;
+
+    for (i = 0; i < IND_CXN_SHM_FDS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+}
+
+/* Send the hello and the descriptors to the client */
+static indigo_error_t
+shm_hello_send(int sock, int *fds)
+{
+    ind_cxn_shm_hello_t hello;
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(int) * IND_CXN_SHM_FDS)];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    hello.magic = IND_CXN_SHM_MAGIC;
+    hello.version = IND_CXN_SHM_VERSION;
+    hello.region_size = sizeof(ind_cxn_shm_region_t);
+
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+
+    INDIGO_MEM_CLEAR(&msg, sizeof(msg));
+    INDIGO_MEM_CLEAR(&control, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * IND_CXN_SHM_FDS);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * IND_CXN_SHM_FDS);
+
+    /* The socket buffer is empty, so this does not block */
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(hello)) {
+        AIM_LOG_ERROR("Failed to send shared memory hello: %s",
+                      strerror(errno));
+        return INDIGO_ERROR_CONNECTION;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_cxn_shm_accept(int sock, cxn_shm_t **shm_out, int *data_fd)
+{
+    int fds[IND_CXN_SHM_FDS] = { -1, -1, -1, -1 };
+    ind_cxn_shm_region_t *region = MAP_FAILED;
+    cxn_shm_t *shm;
+    indigo_error_t rv;
+
+    if ((shm = INDIGO_MEM_ALLOC(sizeof(*shm))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    fds[IND_CXN_SHM_FD_REGION] = memfd_create("indigo-cxn-shm", MFD_CLOEXEC);
+    if (fds[IND_CXN_SHM_FD_REGION] < 0 ||
+        ftruncate(fds[IND_CXN_SHM_FD_REGION], sizeof(*region)) < 0 ||
+        (region = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fds[IND_CXN_SHM_FD_REGION], 0)) ==
+        MAP_FAILED) {
+        AIM_LOG_ERROR("Failed to create shared memory region: %s",
+                      strerror(errno));
+        rv = INDIGO_ERROR_RESOURCE;
+        goto error;
+    }
+
+    fds[IND_CXN_SHM_FD_CLIENT_WAKE] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[IND_CXN_SHM_FD_SWITCH_DATA] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds[IND_CXN_SHM_FD_SWITCH_SPACE] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[IND_CXN_SHM_FD_CLIENT_WAKE] < 0 ||
+        fds[IND_CXN_SHM_FD_SWITCH_DATA] < 0 ||
+        fds[IND_CXN_SHM_FD_SWITCH_SPACE] < 0) {
+        AIM_LOG_ERROR("Failed to create shared memory eventfds: %s",
+                      strerror(errno));
+        rv = INDIGO_ERROR_RESOURCE;
+        goto error;
+    }
+
+    /* A new memfd is zeroed, so only the header needs setting */
+    region->magic = IND_CXN_SHM_MAGIC;
+    region->version = IND_CXN_SHM_VERSION;
+    region->ring_size = IND_CXN_SHM_RING_SIZE;
+
+    if ((rv = shm_hello_send(sock, fds)) < 0) {
+        goto error;
+    }
+
+    /* The mapping and the client's copy keep the region alive */
+    close(fds[IND_CXN_SHM_FD_REGION]);
+
+    shm->sock = sock;
+    shm->client_wake_fd = fds[IND_CXN_SHM_FD_CLIENT_WAKE];
+    shm->space_fd = fds[IND_CXN_SHM_FD_SWITCH_SPACE];
+    shm->region = region;
+
+    *shm_out = shm;
+    *data_fd = fds[IND_CXN_SHM_FD_SWITCH_DATA];
+
+    return INDIGO_ERROR_NONE;
+
+ error:
+    if (region != MAP_FAILED) {
+        munmap(region, sizeof(*region));
+    }
+    shm_fds_close(fds);
+    INDIGO_MEM_FREE(shm);
+    return rv;
+}
+
+/*
+ * The client socket carries nothing after the hello; readable means the
+ * client closed it or sent something it should not have
+ */
+static void
+shm_sock_ready(int socket_id, void *cookie, int read_ready, int write_ready,
+               int error_seen)
+{
+    connection_t *cxn = cookie;
+    uint8_t buf[64];
+    ssize_t rv;
+
+    rv = recv(socket_id, buf, sizeof(buf), MSG_DONTWAIT);
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !error_seen) {
+        return;
+    }
+
+    AIM_LOG_INFO("Shared memory client %s went away", cxn_ip_string(cxn));
+    ind_soc_socket_unregister(socket_id);
+    ind_cxn_disconnect(cxn);
+}
+
+/* The client freed space in from_switch; resume output */
+static void
+shm_space_ready(int socket_id, void *cookie, int read_ready, int write_ready,
+                int error_seen)
+{
+    connection_t *cxn = cookie;
+
+    shm_drain(socket_id);
+    if (cxn->pkts_enqueued > 0) {
+        CXN_WRITE_READY(cxn->sd);
+    }
+}
+
+indigo_error_t
+ind_cxn_shm_register(connection_t *cxn)
+{
+    cxn_shm_t *shm = cxn->shm;
+    indigo_error_t rv;
+
+    if ((rv = ind_soc_socket_register_with_priority(
+             shm->sock, shm_sock_ready, cxn, IND_CXN_EVENT_PRIORITY)) < 0) {
+        return rv;
+    }
+
+    if ((rv = ind_soc_socket_register_with_priority(
+             shm->space_fd, shm_space_ready, cxn,
+             IND_CXN_EVENT_PRIORITY)) < 0) {
+        ind_soc_socket_unregister(shm->sock);
+        return rv;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_cxn_shm_destroy(cxn_shm_t *shm)
+{
+    /* Unregistering a socket that is not registered is harmless */
+    ind_soc_socket_unregister(shm->sock);
+    ind_soc_socket_unregister(shm->space_fd);
+    close(shm->sock);
+    close(shm->space_fd);
+    close(shm->client_wake_fd);
+    munmap(shm->region, sizeof(*shm->region));
+    INDIGO_MEM_FREE(shm);
+}
+
+int
+ind_cxn_shm_read(connection_t *cxn, uint8_t *buf, int len)
+{
+    ind_cxn_shm_ring_t *ring = &cxn->shm->region->to_switch;
+    int bytes;
+
+    /* Drain first, so data the client signals from now on is not missed */
+    shm_drain(cxn->sd);
+
+    bytes = ind_cxn_shm_ring_get(ring, buf, len);
+
+    /* Pairs with the client's barrier between its head and tail */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_RELAXED);
+        shm_signal(cxn->shm->client_wake_fd);
+    }
+
+    /*
+     * If the buffer filled up first, the client will not signal again
+     * for the data left behind
+     */
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) {
+        shm_signal(cxn->sd);
+    }
+
+    return bytes;
+}
+
+int
+ind_cxn_shm_writev(connection_t *cxn, const struct iovec *iov, int iovcnt)
+{
+    ind_cxn_shm_ring_t *ring = &cxn->shm->region->from_switch;
+    int total = 0, written, was_empty;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    written = ind_cxn_shm_ring_put(ring, iov, iovcnt, &was_empty);
+    if (was_empty) {
+        shm_signal(cxn->shm->client_wake_fd);
+    }
+
+    if (written < total) {
+        /*
+         * Wait for shm_space_ready rather than polling the eventfd, which
+         * is always writable, unless the client made room meanwhile
+         */
+        __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head -
+            IND_CXN_SHM_RING_SIZE) {
+            CXN_WRITE_CLEAR(cxn->sd);
+        } else {
+            CXN_WRITE_READY(cxn->sd);
+        }
+    }
+
+    return written;
+}
@@ -0,0 +1,85 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Switch side of the shared memory transport
+ *
+ * See OFConnectionManager/ofconnectionmanager_shm.h for the layout and
+ * handshake. An accepted client's connection_t uses the switch data
+ * eventfd as its sd, so pausing input and the read task work unchanged;
+ * read_from_cxn and the write path copy to and from the rings instead
+ * of calling read and writev. The Unix socket and the space eventfd are
+ * registered separately, to notice the client going away and to resume
+ * output that did not fit.
+ */
+
+#ifndef _OFCONNECTIONMANAGER_CXN_SHM_H_
+#define _OFCONNECTIONMANAGER_CXN_SHM_H_
+
+#include <OFConnectionManager/ofconnectionmanager_shm.h>
+#include <indigo/error.h>
+#include <sys/uio.h>
+
+struct connection_s;
+
+typedef struct cxn_shm_s cxn_shm_t;
+
+/**
+ * Set up the transport for a client accepted on a Unix socket
+ * @param sock The accepted socket; owned by the transport on success
+ * @param shm Set to the new transport
+ * @param data_fd Set to the eventfd to use as the connection's sd
+ */
+indigo_error_t ind_cxn_shm_accept(int sock, cxn_shm_t **shm, int *data_fd);
+
+/**
+ * Start watching the client socket and space eventfd
+ */
+indigo_error_t ind_cxn_shm_register(struct connection_s *cxn);
+
+/**
+ * Unregister and free the transport, leaving the connection's sd alone
+ */
+void ind_cxn_shm_destroy(cxn_shm_t *shm);
+
+/**
+ * Copy up to len bytes from the client into buf
+ * @returns The number of bytes copied, possibly 0
+ */
+int ind_cxn_shm_read(struct connection_s *cxn, uint8_t *buf, int len);
+
+/**
+ * Copy as much of iov as fits to the client
+ * @returns The number of bytes copied; if short, output resumes once
+ * the client frees space
+ */
+int ind_cxn_shm_writev(struct connection_s *cxn, const struct iovec *iov,
+                       int iovcnt);
+
+/**
+ * Ring primitives, also used by the unit test
+ * @param was_empty Set if the consumer had caught up before the put
+ */
+int ind_cxn_shm_ring_put(ind_cxn_shm_ring_t *ring, const struct iovec *iov,
+                         int iovcnt, int *was_empty);
+
+int ind_cxn_shm_ring_get(ind_cxn_shm_ring_t *ring, uint8_t *buf, int len);
+
+#endif /* _OFCONNECTIONMANAGER_CXN_SHM_H_ */
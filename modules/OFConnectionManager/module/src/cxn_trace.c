@@ -0,0 +1,350 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Binary message trace ring and pcap export
+ */
+
+#include "ofconnectionmanager_log.h"
+#include "cxn_trace.h"
+
+#include <OFConnectionManager/ofconnectionmanager.h>
+#include <indigo/memory.h>
+#include <indigo/assert.h>
+#include <indigo/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+/* Largest snap length; an OpenFlow message is at most this long */
+#define TRACE_SNAPLEN_MAX 65535
+
+/* Used when the controller port is unknown */
+#define TRACE_DEFAULT_PORT 6653
+
+/* Switch side ports are synthesized from the connection id */
+#define TRACE_SWITCH_PORT_BASE 32768
+
+/* Connections with their own TCP sequence numbers in an export */
+#define TRACE_SEQ_CXNS 64
+
+#define ETH_HEADER_LEN 14
+#define IPV4_HEADER_LEN 20
+#define TCP_HEADER_LEN 20
+#define FRAME_HEADER_LEN (ETH_HEADER_LEN + IPV4_HEADER_LEN + TCP_HEADER_LEN)
+
+typedef struct trace_slot_s {
+    /* Index + 1 once written, 0 while a writer owns the slot */
+    volatile uint64_t seq;
+    indigo_time_us_t time_us;
+    uint32_t ipv4;
+    uint32_t orig_len;
+    uint16_t cap_len;
+    uint16_t port;
+    indigo_cxn_id_t cxn_id;
+    uint8_t dir;
+    uint8_t data[];
+} trace_slot_t;
+
+int ind_cxn_trace_ring_active;
+
+static uint8_t *ring;
+static uint32_t ring_slots;
+static uint32_t ring_snaplen;
+static uint32_t ring_stride;
+static volatile uint64_t ring_head;
+
+/* Wall clock at a monotonic instant, for pcap timestamps */
+static indigo_time_us_t ring_mono_base;
+static uint64_t ring_wall_base;
+
+static inline trace_slot_t *
+ring_slot(uint64_t idx)
+{
+    return (trace_slot_t *)(ring + (idx % ring_slots) * ring_stride);
+}
+
+void
+ind_cxn_trace_ring_record(indigo_cxn_id_t cxn_id, uint32_t ipv4,
+                          uint16_t port, int dir,
+                          const uint8_t *data, int len)
+{
+    trace_slot_t *slot;
+    uint64_t idx;
+    int cap_len;
+
+    if (!ind_cxn_trace_ring_active) {
+        return;
+    }
+
+    idx = __sync_fetch_and_add(&ring_head, 1);
+    slot = ring_slot(idx);
+
+    slot->seq = 0;
+    __sync_synchronize();
+
+    cap_len = len < (int)ring_snaplen ? len : (int)ring_snaplen;
+    slot->time_us = INDIGO_CURRENT_TIME_us;
+    slot->ipv4 = ipv4;
+    slot->port = port;
+    slot->cxn_id = cxn_id;
+    slot->dir = dir;
+    slot->orig_len = len;
+    slot->cap_len = cap_len;
+    INDIGO_MEM_COPY(slot->data, data, cap_len);
+
+    __sync_synchronize();
+    slot->seq = idx + 1;
+}
+
+indigo_error_t
+ind_cxn_trace_ring_enable(int slots, int snaplen)
+{
+    struct timeval tv;
+
+    ind_cxn_trace_ring_active = 0;
+
+    if (slots == 0) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if (slots < 0 || snaplen <= 0 || snaplen > TRACE_SNAPLEN_MAX) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    INDIGO_MEM_FREE(ring);
+    ring_stride = (sizeof(trace_slot_t) + snaplen + 7) & ~7;
+    if ((ring = INDIGO_MEM_ALLOC((size_t)slots * ring_stride)) == NULL) {
+        AIM_LOG_ERROR("Could not allocate %d trace ring slots", slots);
+        ring_slots = 0;
+        return INDIGO_ERROR_RESOURCE;
+    }
+    INDIGO_MEM_CLEAR(ring, (size_t)slots * ring_stride);
+
+    ring_slots = slots;
+    ring_snaplen = snaplen;
+    ring_head = 0;
+
+    gettimeofday(&tv, NULL);
+    ring_mono_base = INDIGO_CURRENT_TIME_us;
+    ring_wall_base = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+
+    __sync_synchronize();
+    ind_cxn_trace_ring_active = 1;
+
+    AIM_LOG_VERBOSE("Trace ring enabled with %d slots of %d bytes",
+                    slots, snaplen);
+
+    return INDIGO_ERROR_NONE;
+}
+
+static inline void
+put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void
+put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint16_t
+ipv4_checksum(const uint8_t *hdr)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < IPV4_HEADER_LEN; i += 2) {
+        sum += (hdr[i] << 8) | hdr[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return ~sum;
+}
+
+/**
+ * Build the Ethernet, IPv4 and TCP headers for a traced message
+ *
+ * The switch is 10.0.0.1 unless the controller address is unknown, in
+ * which case the controller is 127.0.0.1 and the switch 127.0.0.2.
+ */
+static void
+frame_header_build(uint8_t *hdr, const trace_slot_t *slot, uint32_t tcp_seq)
+{
+    static const uint8_t switch_mac[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+    static const uint8_t controller_mac[6] = { 0x02, 0, 0, 0, 0, 0x02 };
+    uint32_t controller_ip = slot->ipv4 ? slot->ipv4 : 0x7f000001;
+    uint32_t switch_ip = slot->ipv4 ? 0x0a000001 : 0x7f000002;
+    uint16_t controller_port = slot->port ? slot->port : TRACE_DEFAULT_PORT;
+    uint16_t switch_port = TRACE_SWITCH_PORT_BASE + slot->cxn_id;
+    uint32_t ip_len = IPV4_HEADER_LEN + TCP_HEADER_LEN + slot->orig_len;
+    int tx = slot->dir == CXN_TRACE_TX;
+    uint8_t *ip = hdr + ETH_HEADER_LEN;
+    uint8_t *tcp = ip + IPV4_HEADER_LEN;
+
+    INDIGO_MEM_CLEAR(hdr, FRAME_HEADER_LEN);
+
+    INDIGO_MEM_COPY(hdr, tx ? controller_mac : switch_mac, 6);
+    INDIGO_MEM_COPY(hdr + 6, tx ? switch_mac : controller_mac, 6);
+    put16(hdr + 12, 0x0800);
+
+    ip[0] = 0x45;
+    put16(ip + 2, ip_len > 0xffff ? 0xffff : ip_len);
+    put16(ip + 4, tcp_seq);
+    put16(ip + 6, 0x4000);  /* DF */
+    ip[8] = 64;
+    ip[9] = 6;              /* TCP */
+    put32(ip + 12, tx ? switch_ip : controller_ip);
+    put32(ip + 16, tx ? controller_ip : switch_ip);
+    put16(ip + 10, ipv4_checksum(ip));
+
+    put16(tcp, tx ? switch_port : controller_port);
+    put16(tcp + 2, tx ? controller_port : switch_port);
+    put32(tcp + 4, tcp_seq);
+    tcp[12] = (TCP_HEADER_LEN / 4) << 4;
+    tcp[13] = 0x18;         /* PSH, ACK */
+    put16(tcp + 14, 0xffff);
+}
+
+/* pcap record header */
+struct pcap_rec {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+indigo_error_t
+ind_cxn_trace_ring_export(const char *filename, int *count)
+{
+    static const struct {
+        uint32_t magic;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t thiszone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t network;
+    } pcap_hdr = { 0xa1b2c3d4, 2, 4, 0, 0,
+                   FRAME_HEADER_LEN + TRACE_SNAPLEN_MAX, 1 /* Ethernet */ };
+    /* Next TCP sequence number by connection and direction */
+    static uint32_t tcp_seqs[TRACE_SEQ_CXNS][2];
+    uint8_t header[FRAME_HEADER_LEN];
+    trace_slot_t *copy;
+    uint64_t head, idx;
+    int exported = 0;
+    FILE *f;
+
+    if (ring == NULL) {
+        return INDIGO_ERROR_NOT_READY;
+    }
+
+    if ((f = fopen(filename, "w")) == NULL) {
+        AIM_LOG_ERROR("Could not open %s: %s", filename, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    if ((copy = INDIGO_MEM_ALLOC(ring_stride)) == NULL) {
+        fclose(f);
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    INDIGO_MEM_CLEAR(tcp_seqs, sizeof(tcp_seqs));
+    fwrite(&pcap_hdr, sizeof(pcap_hdr), 1, f);
+
+    head = ring_head;
+    idx = head > ring_slots ? head - ring_slots : 0;
+
+    for (; idx < head; idx++) {
+        trace_slot_t *slot = ring_slot(idx);
+        struct pcap_rec rec;
+        uint64_t ts;
+        uint32_t *tcp_seq;
+
+        if (slot->seq != idx + 1) {
+            continue;
+        }
+        __sync_synchronize();
+        INDIGO_MEM_COPY(copy, slot, ring_stride);
+        __sync_synchronize();
+        if (slot->seq != idx + 1 || copy->cap_len > ring_snaplen) {
+            /* Overwritten while copying */
+            continue;
+        }
+
+        tcp_seq = &tcp_seqs[(uint32_t)copy->cxn_id % TRACE_SEQ_CXNS][copy->dir];
+
+        frame_header_build(header, copy, *tcp_seq + 1);
+        *tcp_seq += copy->orig_len;
+
+        ts = ring_wall_base + (copy->time_us - ring_mono_base);
+        rec.ts_sec = ts / 1000000;
+        rec.ts_usec = ts % 1000000;
+        rec.incl_len = FRAME_HEADER_LEN + copy->cap_len;
+        rec.orig_len = FRAME_HEADER_LEN + copy->orig_len;
+
+        fwrite(&rec, sizeof(rec), 1, f);
+        fwrite(header, sizeof(header), 1, f);
+        fwrite(copy->data, copy->cap_len, 1, f);
+        exported++;
+    }
+
+    INDIGO_MEM_FREE(copy);
+
+    if (fclose(f) != 0) {
+        AIM_LOG_ERROR("Could not write %s: %s", filename, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    if (count != NULL) {
+        *count = exported;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_cxn_trace_ring_show(aim_pvs_t *pvs)
+{
+    uint64_t head = ring_head;
+
+    if (!ind_cxn_trace_ring_active) {
+        aim_printf(pvs, "Trace ring disabled\n");
+        if (ring == NULL) {
+            return;
+        }
+    }
+
+    aim_printf(pvs, "Trace ring: %u slots, snap length %u\n",
+               ring_slots, ring_snaplen);
+    aim_printf(pvs, "Recorded: %"PRIu64", held: %"PRIu64"\n",
+               head, head < ring_slots ? head : ring_slots);
+}
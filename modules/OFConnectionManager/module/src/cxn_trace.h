@@ -0,0 +1,76 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Binary message trace ring
+ *
+ * Raw OpenFlow messages are copied, truncated to the snap length, into
+ * a ring of fixed size slots along with a timestamp, direction and the
+ * controller address. Writers claim a slot with an atomic increment and
+ * publish it by writing its sequence number last, so recording takes no
+ * lock and does not format anything. The ring can be exported as a
+ * pcap file with synthesized Ethernet/IPv4/TCP headers while messages
+ * are being recorded; slots overwritten during the export are skipped.
+ * Enabling, disabling and exporting belong to the connection manager's
+ * thread.
+ *
+ * Unlike the per-connection trace pvs this does not disable the wire
+ * fast paths.
+ */
+
+#ifndef _OFCONNECTIONMANAGER_CXN_TRACE_H_
+#define _OFCONNECTIONMANAGER_CXN_TRACE_H_
+
+#include <indigo/of_connection_manager.h>
+#include <stdint.h>
+
+#define CXN_TRACE_RX 0
+#define CXN_TRACE_TX 1
+
+/* Set while the ring is enabled */
+extern int ind_cxn_trace_ring_active;
+
+/**
+ * Record a message in the trace ring
+ *
+ * @param cxn_id The connection the message was received on or sent to
+ * @param ipv4 Controller address in host order, or 0 if unknown
+ * @param port Controller TCP port, or 0 for the default
+ * @param dir CXN_TRACE_RX or CXN_TRACE_TX
+ * @param data The message
+ * @param len Length of the message
+ */
+void ind_cxn_trace_ring_record(indigo_cxn_id_t cxn_id, uint32_t ipv4,
+                               uint16_t port, int dir,
+                               const uint8_t *data, int len);
+
+/**
+ * Record a message to or from a connection if the ring is enabled
+ */
+#define CXN_TRACE_RING_RECORD(cxn, dir, data, len)                      \
+    do {                                                                \
+        if (ind_cxn_trace_ring_active) {                                \
+            ind_cxn_trace_ring_record((cxn)->cxn_id, (cxn)->trace_ipv4, \
+                (cxn)->protocol_params.tcp_over_ipv4.controller_port,   \
+                (dir), (data), (len));                                  \
+        }                                                               \
+    } while (0)
+
+#endif /* _OFCONNECTIONMANAGER_CXN_TRACE_H_ */
@@ -33,6 +33,7 @@
 #include <indigo/of_state_manager.h>
 #include <indigo/memory.h>
 #include <indigo/assert.h>
+#include <indigo/binlog.h>
 
 #include <loci/loci_dump.h>
 #include <loci/loci_show.h>
@@ -40,6 +41,7 @@
 #include <cjson/cJSON.h>
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -92,6 +94,39 @@ static ind_cxn_config_t cxn_config;
  */
 static connection_t connection[MAX_CONTROLLER_CONNECTIONS];
 
+/**
+ * Async message rate limits shared by all connections
+ */
+static ind_cxn_rate_limits_t rate_limits;
+
+/* Ingress ports hash into this many queues for each reason */
+#define CXN_PKTIN_FQ_PORT_CLASSES 16
+#define CXN_PKTIN_FQ_CLASSES \
+    (CXN_PACKET_IN_REASON_METERS * CXN_PKTIN_FQ_PORT_CLASSES)
+
+/* Bytes of credit per unit of weight each round */
+#define CXN_PKTIN_FQ_QUANTUM 1500
+
+typedef struct cxn_pktin_fq_class_s {
+    list_links_t links;     /* In pktin_fq_active while non-empty */
+    of_object_t **ring;     /* Allocated on first use, depth entries */
+    int head;
+    int count;
+    int in_service;         /* Credited for the current visit */
+    uint32_t deficit;
+    uint64_t sent;
+    uint64_t drops;
+} cxn_pktin_fq_class_t;
+
+/**
+ * Packet-in fair queues shared by all connections
+ */
+static cxn_pktin_fq_class_t pktin_fq[CXN_PKTIN_FQ_CLASSES];
+static list_head_t pktin_fq_active;
+static int pktin_fq_queued;
+
+static void pktin_fq_clear(void);
+
 #define CXN_ID_ACTIVE(cxn_id) CXN_ACTIVE(&connection[cxn_id])
 #define CXN_ID_TCP_CONNECTED(cxn_id) CXN_TCP_CONNECTED(&connection[cxn_id])
 
@@ -135,22 +170,28 @@ static int preferred_cxn_id = -1;
          ++cxn_id, cxn = &connection[cxn_id])                           \
         if (CXN_ACTIVE(cxn))
 
-/* Only remote connections */
+/* Only remote main connections */
 #define FOREACH_REMOTE_ACTIVE_CXN(cxn_id, cxn)                          \
     for (cxn_id = 0, cxn = &connection[0];                              \
          cxn_id < MAX_CONTROLLER_CONNECTIONS;                           \
          ++cxn_id, cxn = &connection[cxn_id])                           \
-        if (CXN_ACTIVE(cxn) && !((cxn)->config_params.local))
+        if (CXN_ACTIVE(cxn) && !((cxn)->config_params.local) &&         \
+            !CXN_AUX(cxn))
 
-/* All remote connections which completed hand-shake and with requested role */
+/* All remote main connections which completed hand-shake and with requested role */
 #define FOREACH_HS_COMPLETE_CXN_WITH_ROLE(cxn_id, cxn, cxn_role)        \
     for (cxn_id = 0, cxn = &connection[0];                              \
          cxn_id < MAX_CONTROLLER_CONNECTIONS;                           \
          ++cxn_id, cxn = &connection[cxn_id])                           \
         if (CXN_ACTIVE(cxn) && !(cxn->config_params.local) &&           \
+            !CXN_AUX(cxn) &&                                            \
             (cxn->status.role == cxn_role) &&                           \
             (cxn->status.state == INDIGO_CXN_S_HANDSHAKE_COMPLETE))
 
+/* The main connection of an auxiliary connection, or cxn itself */
+#define CXN_MAIN(cxn)                                                   \
+    (CXN_AUX(cxn) ? &connection[(cxn)->main_cxn_id] : (cxn))
+
 /**
  * Convert connection ID to pointer to cxn block
  */
@@ -336,6 +377,9 @@ static status_change_t status_change[MAX_STATUS_CHANGE_CALLBACKS];
  * to this function
  */
 
+static void aux_connections_start(connection_t *cxn);
+static void aux_connections_stop(connection_t *cxn);
+
 void
 ind_cxn_status_change(connection_t *cxn)
 {
@@ -343,6 +387,22 @@ ind_cxn_status_change(connection_t *cxn)
     int idx;
     indigo_cxn_status_change_f callback;
 
+    /*
+     * Auxiliary connections are private to their main connection, so
+     * they are not reported or counted as controller connections.
+     */
+    if (CXN_AUX(cxn)) {
+        LOG_TRACE("Aux cxn %d of %d status change",
+                  cxn->auxiliary_id, cxn->main_cxn_id);
+        return;
+    }
+
+    if (CONNECTION_STATE(cxn) == INDIGO_CXN_S_HANDSHAKE_COMPLETE) {
+        aux_connections_start(cxn);
+    } else if (CONNECTION_STATE(cxn) == INDIGO_CXN_S_CLOSING) {
+        aux_connections_stop(cxn);
+    }
+
     /* Notify registered callbacks */
     FOREACH_STATUS_CALLBACK(idx, callback, cookie) {
         callback(cxn->cxn_id,
@@ -398,6 +458,8 @@ module_init(void)
         connection[idx].cxn_id = (indigo_cxn_id_t)idx;
     }
 
+    list_init(&pktin_fq_active);
+
     ind_cfg_register(&ind_cxn_cfg_ops);
 
     ind_cxn_generation_id = 0;
@@ -422,6 +484,35 @@ find_free_connection(void) {
 /* @fixme What should the cxn backlog be? */
 #define LOCAL_CXN_BACKLOG 5
 
+/**
+ * Bind a shared memory connection's Unix socket, replacing a stale one
+ */
+static int
+listen_unix_bind(connection_t *cxn)
+{
+    struct sockaddr_un cxn_addr;
+    indigo_cxn_params_shm_over_unix_t *params;
+
+    params = &cxn->protocol_params.shm_over_unix;
+
+    memset(&cxn_addr, 0, sizeof(cxn_addr));
+    cxn_addr.sun_family = AF_UNIX;
+    if (strlen(params->path) >= sizeof(cxn_addr.sun_path)) {
+        LOG_ERROR("Unix socket path too long: %s", params->path);
+        return INDIGO_ERROR_PARAM;
+    }
+    strcpy(cxn_addr.sun_path, params->path);
+
+    (void) unlink(params->path);
+
+    if (bind(cxn->sd, (struct sockaddr *) &cxn_addr, sizeof(cxn_addr)) == -1) {
+        LOG_ERROR("Could not bind to %s: %s", params->path, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
 /**
  * Initialize a local connection instance
  */
@@ -434,21 +525,32 @@ listen_cxn_init(connection_t *cxn)
 
     LOG_VERBOSE("Initializing listening socket");
 
-    params = &cxn->protocol_params.tcp_over_ipv4;
-
-    /* complete the socket structure */
-    memset(&cxn_addr, 0, sizeof(cxn_addr));
-    cxn_addr.sin_family = AF_INET;
-    if (inet_pton(AF_INET, params->controller_ip, &cxn_addr.sin_addr) != 1) {
-        LOG_ERROR("Could not convert %s to inet address", params->controller_ip);
-        return INDIGO_ERROR_UNKNOWN;
-    }
-    cxn_addr.sin_port = htons(params->controller_port);
-
-    /* bind the socket to the port number */
-    if (bind(cxn->sd, (struct sockaddr *) &cxn_addr, sizeof(cxn_addr)) == -1) {
-        LOG_ERROR("Could not bind to socket for local cxn: %s", strerror(errno));
-        return INDIGO_ERROR_UNKNOWN;
+    if (cxn->protocol_params.header.protocol ==
+        INDIGO_CXN_PROTO_SHM_OVER_UNIX) {
+        if ((rv = listen_unix_bind(cxn)) < 0) {
+            return rv;
+        }
+    } else {
+        params = &cxn->protocol_params.tcp_over_ipv4;
+
+        /* complete the socket structure */
+        memset(&cxn_addr, 0, sizeof(cxn_addr));
+        cxn_addr.sin_family = AF_INET;
+        if (inet_pton(AF_INET, params->controller_ip,
+                      &cxn_addr.sin_addr) != 1) {
+            LOG_ERROR("Could not convert %s to inet address",
+                      params->controller_ip);
+            return INDIGO_ERROR_UNKNOWN;
+        }
+        cxn_addr.sin_port = htons(params->controller_port);
+
+        /* bind the socket to the port number */
+        if (bind(cxn->sd, (struct sockaddr *) &cxn_addr,
+                 sizeof(cxn_addr)) == -1) {
+            LOG_ERROR("Could not bind to socket for local cxn: %s",
+                      strerror(errno));
+            return INDIGO_ERROR_UNKNOWN;
+        }
     }
 
     /* show that we are willing to listen */
@@ -476,6 +578,8 @@ listen_cxn_init(connection_t *cxn)
 /**
  * Set up a connection instance.
  * @param sd If >=0, use this socket id; otherwise call socket().
+ * @param shm For a shared memory client, its transport; sd is then its
+ * data eventfd. Both are owned by the connection, even on failure.
  *
  * Typically, sd is >= 0 when this comes from an accept call.
  */
@@ -484,7 +588,7 @@ static connection_t *
 connection_socket_setup(indigo_cxn_protocol_params_t *protocol_params,
                         indigo_cxn_config_params_t *config_params,
                         indigo_cxn_id_t *cxn_id,
-                        int sd)
+                        int sd, cxn_shm_t *shm)
 {
     int soc_flags;
     connection_t *cxn;
@@ -492,6 +596,10 @@ connection_socket_setup(indigo_cxn_protocol_params_t *protocol_params,
     *cxn_id = find_free_connection();
     if (INDIGO_CXN_INVALID(*cxn_id)) {
         LOG_ERROR("Could not allocate space for connection");
+        if (shm != NULL) {
+            ind_cxn_shm_destroy(shm);
+            close(sd);
+        }
         return NULL;
     }
 
@@ -500,9 +608,19 @@ connection_socket_setup(indigo_cxn_protocol_params_t *protocol_params,
     /* Initialize connection structure */
     INDIGO_MEM_COPY(&cxn->protocol_params, protocol_params,
                     sizeof(*protocol_params));
+    cxn->trace_ipv4 = 0;
+    if (protocol_params->header.protocol == INDIGO_CXN_PROTO_TCP_OVER_IPV4) {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, protocol_params->tcp_over_ipv4.controller_ip,
+                      &addr) == 1) {
+            cxn->trace_ipv4 = ntohl(addr.s_addr);
+        }
+    }
     INDIGO_MEM_COPY(&cxn->config_params, config_params,
                     sizeof(*config_params));
     INDIGO_MEM_CLEAR(&cxn->status, sizeof(cxn->status));
+    cxn->auxiliary_id = 0;
+    cxn->num_aux = 0;
 
     if (!CXN_LOCAL(cxn)) {
         cxn->keepalive.period_ms = config_params->periodic_echo_ms;
@@ -516,7 +634,9 @@ connection_socket_setup(indigo_cxn_protocol_params_t *protocol_params,
 
     if (sd < 0) {
         /* Attempt to create the socket */
-        cxn->sd = socket(AF_INET, SOCK_STREAM, 0);
+        cxn->sd = socket(protocol_params->header.protocol ==
+                         INDIGO_CXN_PROTO_SHM_OVER_UNIX ? AF_UNIX : AF_INET,
+                         SOCK_STREAM, 0);
         if (cxn->sd < 0) {
             LOG_ERROR("Failed to create controller connection socket: %s", strerror(errno));
             return NULL;
@@ -525,19 +645,30 @@ connection_socket_setup(indigo_cxn_protocol_params_t *protocol_params,
         cxn->sd = sd;
     }
 
-    soc_flags = fcntl(cxn->sd, F_GETFL, 0);
-    if (soc_flags == -1 || fcntl(cxn->sd, F_SETFL,
-                                 soc_flags | O_NONBLOCK) == -1) {
-        LOG_ERROR("Failed to set non-blocking flag for socket: %s", strerror(errno));
-        close(cxn->sd);
-        return NULL;
-    }
+    cxn->shm = shm;
+    if (shm != NULL) {
+        /* The eventfd is already non-blocking and takes no options */
+        if (ind_cxn_shm_register(cxn) < 0) {
+            LOG_ERROR("Could not register shared memory client");
+            ind_cxn_shm_destroy(shm);
+            cxn->shm = NULL;
+            close(cxn->sd);
+            return NULL;
+        }
+    } else {
+        soc_flags = fcntl(cxn->sd, F_GETFL, 0);
+        if (soc_flags == -1 || fcntl(cxn->sd, F_SETFL,
+                                     soc_flags | O_NONBLOCK) == -1) {
+            LOG_ERROR("Failed to set non-blocking flag for socket: %s",
+                      strerror(errno));
+            close(cxn->sd);
+            return NULL;
+        }
 
-    /* Disable Nagle's algorithm */
-    {
-        int flag = 1;
-        (void) setsockopt(cxn->sd, IPPROTO_TCP, TCP_NODELAY,
-                          (char *) &flag, sizeof(int));
+        if (protocol_params->header.protocol ==
+            INDIGO_CXN_PROTO_TCP_OVER_IPV4) {
+            ind_cxn_socket_options_set(cxn);
+        }
     }
 
     LOG_VERBOSE("Created non-blocking socket %d for %s",
@@ -585,6 +716,22 @@ indigo_cxn_connection_add(indigo_cxn_protocol_params_t *protocol_params,
         return INDIGO_ERROR_PARAM;
     }
 
+    if (config_params->num_aux < 0 || config_params->num_aux > CXN_AUX_MAX ||
+        (config_params->num_aux > 0 &&
+         (config_params->local || config_params->listen))) {
+        LOG_ERROR("Invalid auxiliary connection count %d on cxn add",
+                  config_params->num_aux);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (config_params->socket.sndbuf < 0 || config_params->socket.rcvbuf < 0 ||
+        config_params->socket.notsent_lowat < 0 ||
+        config_params->socket.busy_poll_us < 0 ||
+        config_params->socket.dscp < 0 || config_params->socket.dscp > 63) {
+        LOG_ERROR("Invalid socket options on cxn add");
+        return INDIGO_ERROR_PARAM;
+    }
+
     LOG_TRACE("Connection add: %s", proto_ip_string(protocol_params));
 
     if (cxn_id == NULL) {
@@ -592,13 +739,21 @@ indigo_cxn_connection_add(indigo_cxn_protocol_params_t *protocol_params,
         return INDIGO_ERROR_PARAM;
     }
 
-    if (protocol_params->header.protocol != INDIGO_CXN_PROTO_TCP_OVER_IPV4) {
+    if (protocol_params->header.protocol == INDIGO_CXN_PROTO_SHM_OVER_UNIX) {
+        /* Clients connect to us; there is nothing to connect out to */
+        if (!config_params->listen) {
+            LOG_ERROR("Shared memory connections must listen");
+            return INDIGO_ERROR_PARAM;
+        }
+    } else if (protocol_params->header.protocol !=
+               INDIGO_CXN_PROTO_TCP_OVER_IPV4) {
         LOG_ERROR("Unsupported protocol for connection add: %d",
                      protocol_params->header.protocol);
         return INDIGO_ERROR_NOT_SUPPORTED;
     }
 
-    cxn = connection_socket_setup(protocol_params, config_params, cxn_id, -1);
+    cxn = connection_socket_setup(protocol_params, config_params, cxn_id, -1,
+                                  NULL);
 
     if (cxn == NULL) {
         LOG_ERROR("Could not set up connection");
@@ -609,6 +764,7 @@ indigo_cxn_connection_add(indigo_cxn_protocol_params_t *protocol_params,
             if (rv != INDIGO_ERROR_NONE) {
                 /* @fixme clean up connection? */
                 cxn->active = 0;
+                ind_cxn_instance_release(cxn);
             }
         } else {
             LOG_INFO("Added remote connection: %s", cxn_ip_string(cxn));
@@ -637,6 +793,7 @@ indigo_cxn_connection_remove(indigo_cxn_id_t cxn_id)
         ind_soc_timer_event_unregister(ind_cxn_connection_retry_timer,
                                        &connection[cxn_id]);
         connection[cxn_id].active = 0;
+        ind_cxn_instance_release(&connection[cxn_id]);
     }
 
     /* @fixme If no connections active, turn off periodic timeout */
@@ -644,6 +801,66 @@ indigo_cxn_connection_remove(indigo_cxn_id_t cxn_id)
     return INDIGO_ERROR_NONE;
 }
 
+/**
+ * Open the auxiliary connections of a main connection
+ *
+ * Called when the main connection's handshake completes.  Auxiliary
+ * connections need OpenFlow 1.3 and connect to the same controller.
+ */
+static void
+aux_connections_start(connection_t *cxn)
+{
+    indigo_cxn_config_params_t config;
+    connection_t *aux;
+    indigo_cxn_id_t aux_id;
+
+    if (cxn->config_params.num_aux == 0 || cxn->num_aux > 0) {
+        return;
+    }
+
+    if (cxn->status.negotiated_version < OF_VERSION_1_3) {
+        LOG_VERBOSE("Not opening auxiliary connections to %s: version %d",
+                    cxn_ip_string(cxn), cxn->status.negotiated_version);
+        return;
+    }
+
+    config = cxn->config_params;
+    config.version = cxn->status.negotiated_version;
+    config.num_aux = 0;
+
+    while (cxn->num_aux < cxn->config_params.num_aux) {
+        aux = connection_socket_setup(&cxn->protocol_params, &config,
+                                      &aux_id, -1, NULL);
+        if (aux == NULL) {
+            LOG_ERROR("Could not set up auxiliary connection %d to %s",
+                      cxn->num_aux + 1, cxn_ip_string(cxn));
+            break;
+        }
+
+        aux->auxiliary_id = cxn->num_aux + 1;
+        aux->main_cxn_id = cxn->cxn_id;
+        aux->status.role = cxn->status.role;
+        cxn->aux_cxn_ids[cxn->num_aux++] = aux_id;
+        LOG_INFO("Added auxiliary connection %d: %s",
+                 aux->auxiliary_id, cxn_ip_string(aux));
+    }
+}
+
+/**
+ * Remove the auxiliary connections of a closing main connection
+ */
+static void
+aux_connections_stop(connection_t *cxn)
+{
+    int i;
+
+    for (i = 0; i < cxn->num_aux; i++) {
+        (void) indigo_cxn_connection_remove(cxn->aux_cxn_ids[i]);
+    }
+
+    cxn->num_aux = 0;
+}
+
 /* Return the config of a specific connection */
 indigo_error_t
 indigo_cxn_connection_config_get(
@@ -710,6 +927,23 @@ ind_cxn_send_role_status(connection_t *cxn, int reason)
  *
  * Downgrades the current master, if any, to a slave.
  */
+void
+ind_cxn_role_set(connection_t *cxn, indigo_cxn_role_t role)
+{
+    int i;
+
+    cxn->status.role = role;
+    for (i = 0; i < cxn->num_aux; i++) {
+        CXN_ID_TO_CONNECTION(cxn->aux_cxn_ids[i])->status.role = role;
+    }
+}
+
+connection_t *
+ind_cxn_main(connection_t *cxn)
+{
+    return CXN_MAIN(cxn);
+}
+
 void
 ind_cxn_change_master(indigo_cxn_id_t master_id)
 {
@@ -718,10 +952,10 @@ ind_cxn_change_master(indigo_cxn_id_t master_id)
     FOREACH_REMOTE_ACTIVE_CXN(cxn_id, cxn) {
         if (cxn->cxn_id == master_id) {
             LOG_INFO("Upgrading cxn %s to master", cxn_id_ip_string(cxn_id));
-            cxn->status.role = INDIGO_CXN_R_MASTER;
+            ind_cxn_role_set(cxn, INDIGO_CXN_R_MASTER);
         } else if (cxn->status.role == INDIGO_CXN_R_MASTER) {
             LOG_INFO("Downgrading cxn %s to slave", cxn_id_ip_string(cxn_id));
-            cxn->status.role = INDIGO_CXN_R_SLAVE;
+            ind_cxn_role_set(cxn, INDIGO_CXN_R_SLAVE);
             ind_cxn_send_role_status(
                 cxn, OFP_BSN_CONTROLLER_ROLE_REASON_MASTER_REQUEST);
         }
@@ -775,6 +1009,10 @@ ind_cxn_populate_connection_list(of_list_bsn_controller_connection_t *list)
                 &cxn->protocol_params.tcp_over_ipv4;
             snprintf(uri, sizeof(uri), "tcp://%s:%d",
                 proto->controller_ip, proto->controller_port);
+        } else if (cxn->protocol_params.header.protocol ==
+                   INDIGO_CXN_PROTO_SHM_OVER_UNIX) {
+            snprintf(uri, sizeof(uri), "unix://%s",
+                     cxn->protocol_params.shm_over_unix.path);
         }
 
         of_bsn_controller_connection_uri_set(&entry, uri);
@@ -793,35 +1031,232 @@ ind_cxn_populate_connection_list(of_list_bsn_controller_connection_t *list)
                            ((obj)->object_id == OF_PORT_STATUS) ||  \
                            ((obj)->object_id == OF_FLOW_REMOVED))
 
-/* Send an OpenFlow message to a controller connection
+/*
+ * Choose the output class for a message
+ */
+static cxn_output_class_t
+cxn_output_class(of_object_t *obj)
+{
+    if (IS_ASYNC_MSG(obj)) {
+        return CXN_OUTPUT_CLASS_ASYNC;
+    } else if (CXN_OUTPUT_PRIORITY_MSG(obj->object_id)) {
+        return CXN_OUTPUT_CLASS_CONTROL;
+    } else {
+        return CXN_OUTPUT_CLASS_BULK;
+    }
+}
+
+/*
+ * Refill a rate limit bucket up to now
  *
- * This routine takes ownership of the object.
+ * @returns 1 if a token is available (or the meter is disabled)
+ * @returns 0 if a message would be dropped
+ */
+static int
+cxn_meter_refill(cxn_meter_t *meter, const ind_cxn_meter_config_t *config,
+                 indigo_time_us_t now)
+{
+    uint64_t depth = (uint64_t)config->burst * 1000000;
+
+    if (config->rate == 0) {
+        return 1;
+    }
+
+    if (meter->last == 0) {
+        meter->tokens = depth;
+    } else if (now > meter->last) {
+        meter->tokens += (uint64_t)(now - meter->last) * config->rate;
+        if (meter->tokens > depth) {
+            meter->tokens = depth;
+        }
+    }
+    meter->last = now;
+
+    return meter->tokens >= 1000000;
+}
+
+/*
+ * Spend a token checked for with cxn_meter_refill
+ */
+static void
+cxn_meter_debit(cxn_meter_t *meter, const ind_cxn_meter_config_t *config)
+{
+    if (config->rate != 0) {
+        meter->tokens -= 1000000;
+    }
+}
+
+/*
+ * Take a token from a rate limit bucket
  *
- * In some cases the message may be dropped.
+ * @returns 1 if the message conforms (or the meter is disabled)
+ * @returns 0 if it should be dropped
+ */
+static int
+cxn_meter_take(cxn_meter_t *meter, const ind_cxn_meter_config_t *config,
+               indigo_time_us_t now)
+{
+    if (!cxn_meter_refill(meter, config, now)) {
+        return 0;
+    }
+
+    cxn_meter_debit(meter, config);
+    return 1;
+}
+
+/*
+ * Ingress port of a packet-in, or OF_PORT_DEST_NONE if unknown
+ */
+static of_port_no_t
+packet_in_port(of_packet_in_t *obj)
+{
+    of_port_no_t port = OF_PORT_DEST_NONE;
+    of_match_t match;
+
+    if (obj->version == OF_VERSION_1_0) {
+        of_packet_in_in_port_get(obj, &port);
+    } else if (of_packet_in_match_get(obj, &match) == 0) {
+        port = match.fields.in_port;
+    }
+
+    return port;
+}
+
+/**
+ * Apply the packet-in rate limits
+ *
+ * A packet-in must conform to the aggregate, per-reason and per-port
+ * meters.  Tokens are only taken once all of them admit it, so packets
+ * dropped by one meter do not drain the others.
+ *
+ * @returns 1 if the packet-in should be sent, 0 if it is dropped
+ */
+int
+ind_cxn_packet_in_meter(connection_t *cxn, of_packet_in_t *obj)
+{
+    indigo_time_us_t now = ind_soc_loop_now_us();
+    cxn_meter_t *reason_meter = NULL, *port_meter = NULL;
+    uint8_t reason = 0;
+    int ok;
+
+    if (rate_limits.packet_in_reason.rate != 0) {
+        of_packet_in_reason_get(obj, &reason);
+        if (reason >= CXN_PACKET_IN_REASON_METERS) {
+            reason = CXN_PACKET_IN_REASON_METERS - 1;
+        }
+        reason_meter = &cxn->meters.packet_in_reason[reason];
+    }
+
+    if (rate_limits.packet_in_port.rate != 0) {
+        of_port_no_t port = packet_in_port(obj);
+        port_meter =
+            &cxn->meters.packet_in_port[port % CXN_PACKET_IN_PORT_METERS];
+    }
+
+    /* Refill every bucket before deciding */
+    ok = cxn_meter_refill(&cxn->meters.packet_in, &rate_limits.packet_in, now);
+    if (reason_meter != NULL) {
+        ok &= cxn_meter_refill(reason_meter, &rate_limits.packet_in_reason,
+                               now);
+    }
+    if (port_meter != NULL) {
+        ok &= cxn_meter_refill(port_meter, &rate_limits.packet_in_port, now);
+    }
+
+    if (!ok) {
+        return 0;
+    }
+
+    cxn_meter_debit(&cxn->meters.packet_in, &rate_limits.packet_in);
+    if (reason_meter != NULL) {
+        cxn_meter_debit(reason_meter, &rate_limits.packet_in_reason);
+    }
+    if (port_meter != NULL) {
+        cxn_meter_debit(port_meter, &rate_limits.packet_in_port);
+    }
+
+    return 1;
+}
+
+/**
+ * Set the async message rate limits
+ *
+ * Applies to all connections.  Buckets start full after a change.
  */
 void
-indigo_cxn_send_controller_message(indigo_cxn_id_t cxn_id, of_object_t *obj)
+ind_cxn_rate_limits_set(const ind_cxn_rate_limits_t *limits)
 {
-    uint8_t *data = NULL;
-    int len;
-    connection_t *cxn;
-    uint32_t xid;
+    int idx;
 
-    if (INDIGO_CXN_INVALID(cxn_id)) {
-        LOG_ERROR("Invalid or no active connection: %d", cxn_id);
-        goto done;
+    pktin_fq_clear();
+    rate_limits = *limits;
+
+    for (idx = 0; idx < MAX_CONTROLLER_CONNECTIONS; ++idx) {
+        INDIGO_MEM_CLEAR(&connection[idx].meters,
+                         sizeof(connection[idx].meters));
     }
+}
 
-    cxn = CXN_ID_TO_CONNECTION(cxn_id);
-    if (!CXN_TCP_CONNECTED(cxn)) {
-        LOG_ERROR("Connection id %d is not connected", cxn_id);
-        goto done;
+/**
+ * Choose the connection to carry an async message for a main connection
+ *
+ * Packet-ins are spread over the handshaken auxiliary connections by
+ * ingress port and flow-removeds by cookie, so messages about the same
+ * traffic stay in order.  Everything else goes on the main connection.
+ */
+static connection_t *
+cxn_async_channel(connection_t *cxn, of_object_t *obj)
+{
+    connection_t *ready[CXN_AUX_MAX];
+    int num_ready = 0;
+    uint64_t key;
+    int i;
+
+    if (obj->object_id == OF_PACKET_IN) {
+        key = packet_in_port(obj);
+    } else if (obj->object_id == OF_FLOW_REMOVED) {
+        of_flow_removed_cookie_get(obj, &key);
+    } else {
+        return cxn;
+    }
+
+    for (i = 0; i < cxn->num_aux; i++) {
+        connection_t *aux = CXN_ID_TO_CONNECTION(cxn->aux_cxn_ids[i]);
+        if (CXN_HANDSHAKE_COMPLETE(aux)) {
+            ready[num_ready++] = aux;
+        }
     }
 
-    xid = of_message_xid_get(OF_BUFFER_TO_MESSAGE(OF_OBJECT_BUFFER_INDEX(obj, 0)));
+    if (num_ready == 0) {
+        return cxn;
+    }
+
+    return ready[key % num_ready];
+}
+
+/*
+ * Prepare to send an OpenFlow message to a controller connection
+ *
+ * Applies the per-connection tracing, handshake and throttling rules and
+ * updates the output counters.
+ *
+ * @returns 1 if the message should be enqueued on the connection
+ * @returns 0 if it should be dropped
+ */
+static int
+cxn_message_send_check(connection_t *cxn, of_object_t *obj)
+{
+    cxn_msg_counters_t *counters;
+
+    if (!CXN_TCP_CONNECTED(cxn)) {
+        LOG_ERROR("Connection id %d is not connected", cxn->cxn_id);
+        return 0;
+    }
 
-    LOG_VERBOSE("cxn %s: Sending %s message xid %u",
-                cxn_ip_string(cxn), of_object_id_str[obj->object_id], xid);
+    INDIGO_BINLOG("cxn %d: Sending %s message xid %u",
+                  cxn->cxn_id, of_object_id_str[obj->object_id],
+                  of_message_xid_get(OF_BUFFER_TO_MESSAGE(
+                      OF_OBJECT_BUFFER_INDEX(obj, 0))));
 
     if(cxn->trace_pvs) {
         aim_printf(cxn->trace_pvs, "** of_msg_trace: send to cxn=%d\n", cxn->cxn_id);
@@ -831,6 +1266,9 @@ indigo_cxn_send_controller_message(indigo_cxn_id_t cxn_id, of_object_t *obj)
 
 
     if (obj->object_id == OF_FEATURES_REPLY) {
+        if (obj->version >= OF_VERSION_1_3) {
+            of_features_reply_auxiliary_id_set(obj, cxn->auxiliary_id);
+        }
         if (CONNECTION_STATE(cxn) == INDIGO_CXN_S_CONNECTING) {
             ++successful_handshakes;
             ind_cxn_state_set(cxn, INDIGO_CXN_S_HANDSHAKE_COMPLETE);
@@ -841,111 +1279,655 @@ indigo_cxn_send_controller_message(indigo_cxn_id_t cxn_id, of_object_t *obj)
         if (IS_ASYNC_MSG(obj)) {
             LOG_TRACE("Handshake not complete; drop async msg %s",
                       of_object_id_str[obj->object_id]);
-            goto done;
+            return 0;
         }
     }
 
-    /* async message throttling */
+    /*
+     * async message throttling
+     *
+     * The rate limits and their counters belong to the main connection,
+     * whichever of its channels carries the message.
+     */
     if (obj->object_id == OF_PACKET_IN) {
-        cxn->packet_ins++;
+        CXN_MAIN(cxn)->packet_ins++;
+        if (!ind_cxn_packet_in_meter(CXN_MAIN(cxn), obj)) {
+            LOG_TRACE("Rate limiting packetIn");
+            CXN_MAIN(cxn)->status.packet_in_meter_drop++;
+            return 0;
+        }
         if (CXN_DROP_PACKET_IN(cxn, obj)) {
             LOG_TRACE("Dropping packetIn");
             cxn->status.packet_in_drop++;
-            goto done;
+            return 0;
         }
     } else if (obj->object_id == OF_FLOW_REMOVED) {
+        if (!cxn_meter_take(&CXN_MAIN(cxn)->meters.flow_removed,
+                            &rate_limits.flow_removed,
+                            ind_soc_loop_now_us())) {
+            LOG_TRACE("Rate limiting flowRemoved");
+            CXN_MAIN(cxn)->status.flow_removed_meter_drop++;
+            return 0;
+        }
         if (CXN_DROP_FLOW_REMOVED(cxn, obj)) {
             LOG_TRACE("Dropping flowRemoved");
             cxn->status.flow_removed_drop++;
-            goto done;
+            return 0;
         }
     }
 
-    /* Steal the buffer and enqueue the data */
-    LOG_OBJECT(obj);
+    /* Async messages are dropped rather than overflowing their class */
+    if (IS_ASYNC_MSG(obj) &&
+        obj->length > CXN_WRITE_BYTES_AVAIL(cxn, CXN_OUTPUT_CLASS_ASYNC)) {
+        LOG_TRACE("Async output full; dropping %s",
+                  of_object_id_str[obj->object_id]);
+        return 0;
+    }
 
-    of_object_wire_buffer_steal((of_object_t *)obj, &data);
-    len = obj->length;
+    LOG_OBJECT(obj);
 
+    counters = ind_cxn_msg_counters(cxn);
     if (IS_MSG_OBJ(obj)) {
-        cxn->messages_out_by_type[obj->object_id]++;
+        if (counters != NULL) {
+            counters->out_by_type[obj->object_id]++;
+        }
     } else {
         LOG_ERROR("Enqueue unknown msg obj id: %d", obj->object_id);
-        cxn->messages_out_unknown++;
-    }
-
-    if (ind_cxn_instance_enqueue(cxn, data, len) < 0) {
-        LOG_ERROR("Could not enqueue message data, disconnecting");
-        INDIGO_MEM_FREE(data);
-        ind_cxn_disconnect(cxn);
+        if (counters != NULL) {
+            counters->out_unknown++;
+        }
     }
 
- done:
-    of_object_delete(obj);
+    return 1;
 }
 
-/**
- * Check whether the given connection is interested in the message.
+/* Send an OpenFlow message to a controller connection
+ *
+ * This routine takes ownership of the object.
+ *
+ * In some cases the message may be dropped.
  */
-int
-ind_cxn_accepts_async_message(const connection_t *cxn, const of_object_t *obj)
+void
+indigo_cxn_send_controller_message(indigo_cxn_id_t cxn_id, of_object_t *obj)
 {
-    if (CONNECTION_STATE(cxn) != INDIGO_CXN_S_HANDSHAKE_COMPLETE) {
-        return 0;
-    }
+    uint8_t *data = NULL;
+    int len;
+    connection_t *cxn;
+    cxn_output_class_t cls;
+
+    if (INDIGO_CXN_INVALID(cxn_id)) {
+        LOG_ERROR("Invalid or no active connection: %d", cxn_id);
+        goto done;
+    }
+
+    cxn = CXN_ID_TO_CONNECTION(cxn_id);
+    if (!cxn_message_send_check(cxn, obj)) {
+        goto done;
+    }
+
+    /* Steal the buffer and enqueue the data */
+    cls = cxn_output_class(obj);
+    if (ind_cxn_wire_buffer_steal((of_object_t *)obj, &data) < 0) {
+        LOG_ERROR("Could not take message data for enqueue");
+        goto done;
+    }
+    len = obj->length;
+
+    if (ind_cxn_instance_enqueue(cxn, cls, data, len) < 0) {
+        LOG_ERROR("Could not enqueue message data, disconnecting");
+        ind_cxn_msg_data_free(data);
+        ind_cxn_disconnect(cxn);
+    }
+
+ done:
+    of_object_delete(obj);
+}
+
+/*
+ * Find the async config type of a message and the bit of its reason
+ *
+ * Returns CXN_ASYNC_TYPES for messages not filtered by reason.
+ */
+static cxn_async_type_t
+cxn_async_key(const of_object_t *obj, uint32_t *bit)
+{
+    uint8_t reason;
+
+    switch (obj->object_id) {
+    case OF_PACKET_IN:
+        of_packet_in_reason_get((of_packet_in_t *)obj, &reason);
+        *bit = CXN_ASYNC_REASON_BIT(reason);
+        return CXN_ASYNC_PACKET_IN;
+    case OF_PORT_STATUS:
+        of_port_status_reason_get((of_port_status_t *)obj, &reason);
+        *bit = CXN_ASYNC_REASON_BIT(reason);
+        return CXN_ASYNC_PORT_STATUS;
+    case OF_FLOW_REMOVED:
+        of_flow_removed_reason_get((of_flow_removed_t *)obj, &reason);
+        *bit = CXN_ASYNC_REASON_BIT(reason);
+        return CXN_ASYNC_FLOW_REMOVED;
+    default:
+        *bit = 0;
+        return CXN_ASYNC_TYPES;
+    }
+}
+
+/*
+ * Check whether a connection wants an async message, given its key
+ */
+static int
+cxn_accepts_async(const connection_t *cxn, cxn_async_type_t type,
+                  uint32_t bit)
+{
+    if (CONNECTION_STATE(cxn) != INDIGO_CXN_S_HANDSHAKE_COMPLETE) {
+        return 0;
+    }
 
     if (cxn->config_params.local) {
         return 0;
     }
 
-    if (cxn->status.role == INDIGO_CXN_R_SLAVE) {
-        if ((obj->object_id == OF_PACKET_IN) ||
-            (obj->object_id == OF_FLOW_REMOVED)) {
-            return 0;
+    /* Auxiliary connections carry async messages for their main one */
+    if (CXN_AUX(cxn)) {
+        return 0;
+    }
+
+    if (type == CXN_ASYNC_TYPES) {
+        return 1;
+    }
+
+    return (cxn->async_config[CXN_ASYNC_ROLE(cxn)][type] & bit) != 0;
+}
+
+/**
+ * Check whether the given connection is interested in the message.
+ */
+int
+ind_cxn_accepts_async_message(const connection_t *cxn, const of_object_t *obj)
+{
+    cxn_async_type_t type;
+    uint32_t bit;
+
+    type = cxn_async_key(obj, &bit);
+    return cxn_accepts_async(cxn, type, bit);
+}
+
+/****************************************************************
+ * Packet-in fair queuing, see ind_cxn_fair_queue_config_t
+ ****************************************************************/
+
+static void cxn_async_message_send(of_object_t *obj);
+
+/*
+ * Queue for a packet-in: its reason, then its hashed ingress port
+ */
+static cxn_pktin_fq_class_t *
+pktin_fq_class(of_packet_in_t *obj, uint8_t *reason_out)
+{
+    uint8_t reason;
+
+    of_packet_in_reason_get(obj, &reason);
+    if (reason >= CXN_PACKET_IN_REASON_METERS) {
+        reason = CXN_PACKET_IN_REASON_METERS - 1;
+    }
+    *reason_out = reason;
+
+    return &pktin_fq[reason * CXN_PKTIN_FQ_PORT_CLASSES +
+                     packet_in_port(obj) % CXN_PKTIN_FQ_PORT_CLASSES];
+}
+
+/*
+ * Check whether every connection taking a packet-in has room for it
+ */
+static int
+pktin_fq_ready(of_object_t *obj)
+{
+    indigo_cxn_id_t cxn_id;
+    connection_t *cxn;
+    cxn_async_type_t type;
+    uint32_t bit;
+
+    type = cxn_async_key(obj, &bit);
+
+    FOREACH_ACTIVE_CXN(cxn_id, cxn) {
+        if (cxn_accepts_async(cxn, type, bit) &&
+            (cxn->status.negotiated_version == obj->version)) {
+            connection_t *channel = cxn_async_channel(cxn, obj);
+            if (CXN_TCP_CONNECTED(channel) &&
+                obj->length > CXN_WRITE_BYTES_AVAIL(channel,
+                                                    CXN_OUTPUT_CLASS_ASYNC)) {
+                return 0;
+            }
         }
     }
 
     return 1;
 }
 
+/*
+ * Send queued packet-ins in deficit round robin order
+ *
+ * Stops at the first packet-in that does not fit; the visit resumes
+ * with the same credit once output frees.
+ */
+static void
+pktin_fq_drain(void)
+{
+    const ind_cxn_fair_queue_config_t *config =
+        &rate_limits.packet_in_fair_queue;
+
+    while (!list_empty(&pktin_fq_active)) {
+        cxn_pktin_fq_class_t *class = container_of(
+            list_first(&pktin_fq_active), links, cxn_pktin_fq_class_t);
+        int reason = (class - pktin_fq) / CXN_PKTIN_FQ_PORT_CLASSES;
+
+        if (!class->in_service) {
+            uint32_t weight = config->reason_weights[reason];
+            class->deficit += CXN_PKTIN_FQ_QUANTUM * (weight ? weight : 1);
+            class->in_service = 1;
+        }
+
+        while (class->count > 0) {
+            of_object_t *obj = class->ring[class->head];
+            if (obj->length > class->deficit) {
+                break;
+            }
+            if (!pktin_fq_ready(obj)) {
+                return;
+            }
+            class->deficit -= obj->length;
+            class->head = (class->head + 1) % config->depth;
+            class->count--;
+            class->sent++;
+            pktin_fq_queued--;
+            cxn_async_message_send(obj);
+        }
+
+        class->in_service = 0;
+        list_remove(&class->links);
+        if (class->count > 0) {
+            list_push(&pktin_fq_active, &class->links);
+        } else {
+            class->deficit = 0;
+        }
+    }
+}
+
+/*
+ * Queue a packet-in behind the others of its class
+ *
+ * Takes ownership of obj; drops it if the class is full.
+ */
+static void
+pktin_fq_enqueue(of_packet_in_t *obj)
+{
+    const ind_cxn_fair_queue_config_t *config =
+        &rate_limits.packet_in_fair_queue;
+    cxn_pktin_fq_class_t *class;
+    uint8_t reason;
+
+    class = pktin_fq_class(obj, &reason);
+
+    if (class->ring == NULL) {
+        class->ring = INDIGO_MEM_ALLOC(config->depth * sizeof(*class->ring));
+        if (class->ring == NULL) {
+            LOG_ERROR("Could not allocate packet-in fair queue");
+            class->drops++;
+            of_object_delete(obj);
+            return;
+        }
+    }
+
+    if (class->count == config->depth) {
+        LOG_TRACE("Packet-in fair queue full for reason %d; dropping", reason);
+        class->drops++;
+        of_object_delete(obj);
+        return;
+    }
+
+    class->ring[(class->head + class->count) % config->depth] = obj;
+    if (class->count++ == 0) {
+        list_push(&pktin_fq_active, &class->links);
+    }
+    pktin_fq_queued++;
+}
+
+/*
+ * Drop every queued packet-in and free the queues
+ */
+static void
+pktin_fq_clear(void)
+{
+    uint32_t depth = rate_limits.packet_in_fair_queue.depth;
+    int i;
+
+    for (i = 0; i < CXN_PKTIN_FQ_CLASSES; i++) {
+        cxn_pktin_fq_class_t *class = &pktin_fq[i];
+        while (class->count > 0) {
+            of_object_delete(class->ring[class->head]);
+            class->head = (class->head + 1) % depth;
+            class->count--;
+        }
+        INDIGO_MEM_FREE(class->ring);
+    }
+
+    INDIGO_MEM_CLEAR(pktin_fq, sizeof(pktin_fq));
+    list_init(&pktin_fq_active);
+    pktin_fq_queued = 0;
+}
+
+/*
+ * Socket manager pass end callback; retries the drain each pass
+ */
+static void
+pktin_fq_pass_end(void *cookie)
+{
+    if (pktin_fq_queued > 0) {
+        pktin_fq_drain();
+    }
+}
+
 /**
  * Send an async message to all interested connections.
+ *
+ * Packet-ins go through the fair queue while it is enabled and either
+ * holds messages or some connection has no room for this one.
  */
 void
 indigo_cxn_send_async_message(of_object_t *obj)
+{
+    if (obj->object_id == OF_PACKET_IN &&
+        rate_limits.packet_in_fair_queue.depth > 0 &&
+        (pktin_fq_queued > 0 || !pktin_fq_ready(obj))) {
+        pktin_fq_enqueue(obj);
+        pktin_fq_drain();
+        return;
+    }
+
+    cxn_async_message_send(obj);
+}
+
+/*
+ * Send an async message to all interested connections now
+ */
+static void
+cxn_async_message_send(of_object_t *obj)
 {
     indigo_cxn_id_t cxn_id;
     connection_t *cxn;
+    connection_t *targets[MAX_CONTROLLER_CONNECTIONS];
+    int num_targets = 0;
+    cxn_shared_msg_t *shared;
+    uint8_t *data;
+    int i;
+    cxn_async_type_t type;
+    uint32_t bit;
 
-    /*
-     * The connection that will end up sending the original 'obj',
-     * rather than a duplicate. indigo_cxn_send_controller_message
-     * consumes the LOCI object so we need to call it on the
-     * original last.
-     */
-    indigo_cxn_id_t first_cxn_id = INDIGO_CXN_ID_UNSPECIFIED;
+    /* Decode the reason once rather than per connection */
+    type = cxn_async_key(obj, &bit);
 
     FOREACH_ACTIVE_CXN(cxn_id, cxn) {
-        if (ind_cxn_accepts_async_message(cxn, obj) &&
+        if (cxn_accepts_async(cxn, type, bit) &&
             (cxn->status.negotiated_version == obj->version)) {
-            if (first_cxn_id == INDIGO_CXN_ID_UNSPECIFIED) {
-                first_cxn_id = cxn->cxn_id;
-            } else {
-                of_object_t *dup = of_object_dup(obj);
-                if (dup != NULL) {
-                    indigo_cxn_send_controller_message(cxn->cxn_id, dup);
-                }
+            connection_t *channel = cxn_async_channel(cxn, obj);
+            if (cxn_message_send_check(channel, obj)) {
+                targets[num_targets++] = channel;
             }
         }
     }
 
-    if (first_cxn_id != INDIGO_CXN_ID_UNSPECIFIED) {
-        indigo_cxn_send_controller_message(first_cxn_id, obj);
-    } else {
+    if (num_targets == 0) {
         LOG_VERBOSE("Dropping async %s message, no interested connections",
                     of_object_id_str[obj->object_id]);
         of_object_delete(obj);
+        return;
+    }
+
+    if (ind_cxn_wire_buffer_steal(obj, &data) < 0) {
+        LOG_ERROR("Could not take async message data for enqueue");
+        of_object_delete(obj);
+        return;
+    }
+
+    /*
+     * Every connection's write queue references the same buffer, which
+     * is freed once the last of them has written it.
+     */
+    if ((shared = ind_cxn_shared_msg_new(data, obj->length)) == NULL) {
+        LOG_ERROR("Could not allocate shared async message");
+        ind_cxn_msg_data_free(data);
+        of_object_delete(obj);
+        return;
+    }
+
+    for (i = 0; i < num_targets; i++) {
+        if (ind_cxn_instance_enqueue_shared(targets[i], CXN_OUTPUT_CLASS_ASYNC,
+                                            shared) < 0) {
+            LOG_ERROR("Could not enqueue message data, disconnecting");
+            ind_cxn_disconnect(targets[i]);
+        }
+    }
+
+    ind_cxn_shared_msg_unref(shared);
+    of_object_delete(obj);
+}
+
+/*
+ * Send the messages of a run that a connection accepts
+ *
+ * Each channel of the connection gets the messages routed to it copied
+ * back to back into one buffer, which is queued as a single message.
+ */
+static void
+cxn_async_run_send(connection_t *cxn, of_object_t **objs, int num_objs,
+                   connection_t **targets)
+{
+    int i, j;
+
+    for (i = 0; i < num_objs; i++) {
+        targets[i] = NULL;
+        if (ind_cxn_accepts_async_message(cxn, objs[i]) &&
+            (cxn->status.negotiated_version == objs[i]->version)) {
+            connection_t *channel = cxn_async_channel(cxn, objs[i]);
+            if (cxn_message_send_check(channel, objs[i])) {
+                targets[i] = channel;
+            }
+        }
+    }
+
+    for (i = 0; i < num_objs; i++) {
+        connection_t *channel = targets[i];
+        cxn_shared_msg_t *shared;
+        uint8_t *data;
+        int avail, len = 0;
+
+        if (channel == NULL) {
+            continue;
+        }
+
+        /* Take every message for this channel that fits */
+        avail = CXN_WRITE_BYTES_AVAIL(channel, CXN_OUTPUT_CLASS_ASYNC);
+        for (j = i; j < num_objs; j++) {
+            if (targets[j] == channel) {
+                if (len + objs[j]->length > avail) {
+                    LOG_TRACE("Async output full; dropping %s",
+                              of_object_id_str[objs[j]->object_id]);
+                    targets[j] = NULL;
+                } else {
+                    len += objs[j]->length;
+                }
+            }
+        }
+
+        if (len == 0) {
+            continue;
+        }
+
+        if ((data = INDIGO_MEM_ALLOC(len)) == NULL) {
+            LOG_ERROR("Could not allocate async message run");
+            return;
+        }
+
+        len = 0;
+        for (j = i; j < num_objs; j++) {
+            if (targets[j] == channel) {
+                INDIGO_MEM_COPY(data + len, OF_OBJECT_BUFFER_INDEX(objs[j], 0),
+                                objs[j]->length);
+                len += objs[j]->length;
+                targets[j] = NULL;
+            }
+        }
+
+        if ((shared = ind_cxn_shared_msg_new(data, len)) == NULL) {
+            LOG_ERROR("Could not allocate shared async message");
+            INDIGO_MEM_FREE(data);
+            return;
+        }
+
+        if (ind_cxn_instance_enqueue_shared(channel, CXN_OUTPUT_CLASS_ASYNC,
+                                            shared) < 0) {
+            LOG_ERROR("Could not enqueue message data, disconnecting");
+            ind_cxn_disconnect(channel);
+        }
+
+        ind_cxn_shared_msg_unref(shared);
+    }
+}
+
+/**
+ * Send a run of async messages to all interested connections.
+ */
+void
+indigo_cxn_send_async_messages(of_object_t **objs, int num_objs)
+{
+    indigo_cxn_id_t cxn_id;
+    connection_t *cxn;
+    connection_t **targets;
+    int i;
+
+    if (rate_limits.packet_in_fair_queue.depth > 0) {
+        for (i = 0; i < num_objs; i++) {
+            if (objs[i]->object_id == OF_PACKET_IN &&
+                (pktin_fq_queued > 0 || !pktin_fq_ready(objs[i]))) {
+                break;
+            }
+        }
+        if (i < num_objs) {
+            /* Backed up; queue the run message by message */
+            for (i = 0; i < num_objs; i++) {
+                indigo_cxn_send_async_message(objs[i]);
+            }
+            return;
+        }
+    }
+
+    if ((targets = INDIGO_MEM_ALLOC(num_objs * sizeof(*targets))) == NULL) {
+        LOG_ERROR("Could not allocate async message run");
+    } else {
+        FOREACH_ACTIVE_CXN(cxn_id, cxn) {
+            cxn_async_run_send(cxn, objs, num_objs, targets);
+        }
+        INDIGO_MEM_FREE(targets);
+    }
+
+    for (i = 0; i < num_objs; i++) {
+        of_object_delete(objs[i]);
+    }
+}
+
+/**
+ * Allocate a pooled packet-in frame buffer
+ */
+uint8_t *
+indigo_cxn_packet_in_frame_alloc(void)
+{
+    return ind_cxn_pktin_frame_alloc();
+}
+
+/**
+ * Release a pooled packet-in frame buffer without sending it
+ */
+void
+indigo_cxn_packet_in_frame_free(uint8_t *frame)
+{
+    INDIGO_ASSERT(ind_cxn_pktin_frame_valid(frame));
+    ind_cxn_pktin_buffer_free(frame);
+}
+
+/**
+ * Build a packet-in around a pooled frame
+ *
+ * The header is written into the headroom directly in front of the
+ * frame with its length fixed up, and the message is parsed in place.
+ */
+of_packet_in_t *
+indigo_cxn_packet_in_build(of_packet_in_t *header, uint8_t *frame,
+                           int frame_len)
+{
+    of_object_t *obj;
+    uint8_t *msg;
+    int len;
+
+    if (!ind_cxn_pktin_frame_valid(frame)) {
+        LOG_ERROR("Packet-in frame not from the pool");
+        return NULL;
+    }
+
+    if (header->object_id != OF_PACKET_IN ||
+        header->length > INDIGO_CXN_PACKET_IN_HEADROOM ||
+        frame_len < 0 || frame_len > INDIGO_CXN_PACKET_IN_FRAME_MAX) {
+        LOG_ERROR("Bad packet-in header or frame length %d", frame_len);
+        ind_cxn_pktin_buffer_free(frame);
+        return NULL;
+    }
+
+    len = header->length + frame_len;
+    msg = frame - header->length;
+    INDIGO_MEM_COPY(msg, OF_OBJECT_BUFFER_INDEX(header, 0), header->length);
+    msg[2] = len >> 8;
+    msg[3] = len & 0xff;
+
+    obj = of_object_new_from_message(OF_BUFFER_TO_MESSAGE(msg), len);
+    if (obj == NULL) {
+        LOG_ERROR("Could not parse pooled packet-in");
+        ind_cxn_pktin_buffer_free(frame);
+        return NULL;
+    }
+    OF_OBJECT_TO_WBUF(obj)->free = ind_cxn_pktin_buffer_free;
+
+    return obj;
+}
+
+/**
+ * Check whether a connection's output queue is above its high watermark
+ */
+int
+indigo_cxn_output_blocked(indigo_cxn_id_t cxn_id)
+{
+    if (!ACTIVE_ENTRY(cxn_id)) {
+        return 0;
     }
+
+    return CXN_ID_TO_CONNECTION(cxn_id)->output_blocked;
+}
+
+/**
+ * Call back once a blocked connection's output queue drains
+ */
+indigo_error_t
+indigo_cxn_output_wait(indigo_cxn_id_t cxn_id,
+                       indigo_cxn_output_ready_f callback, void *cookie)
+{
+    if (callback == NULL) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (!ACTIVE_ENTRY(cxn_id)) {
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    return ind_cxn_output_waiter_add(CXN_ID_TO_CONNECTION(cxn_id),
+                                     callback, cookie);
 }
 
 /**
@@ -1079,6 +2061,57 @@ ind_cxn_init(ind_cxn_config_t *config)
     return INDIGO_ERROR_NONE;
 }
 
+#if OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE == 1
+/**
+ * Flush the write queues filled during an event loop pass
+ *
+ * Registered as a socket manager pass end callback, so each connection
+ * writes everything the pass queued for it with one writev.  Anything
+ * the socket does not take is left for the write ready callback.
+ */
+static void
+ind_cxn_flush_pending(void *cookie)
+{
+    int cxn_id;
+    connection_t *cxn;
+
+    FOREACH_ACTIVE_CXN(cxn_id, cxn) {
+        if (!cxn->flush_pending) {
+            continue;
+        }
+        cxn->flush_pending = 0;
+
+        if (!CXN_TCP_CONNECTED(cxn)) {
+            continue;
+        }
+
+        if (ind_cxn_process_write_buffer(cxn) < 0) {
+            LOG_ERROR("Error flushing write buffer, resetting");
+            ind_cxn_disconnect(cxn);
+            ++ind_cxn_internal_errors;
+        } else if (cxn->pkts_enqueued > 0 && cxn->shm == NULL) {
+            /* Shared memory output sets up its own resumption */
+            CXN_WRITE_READY(cxn->sd);
+        }
+    }
+}
+#endif
+
+/**
+ * Shared keepalive timer; sends the echo requests that are due
+ */
+static void
+ind_cxn_keepalive_timer(void *cookie)
+{
+    indigo_time_us_t now = ind_soc_loop_now_us();
+    indigo_cxn_id_t cxn_id;
+    connection_t *cxn;
+
+    FOREACH_ACTIVE_CXN(cxn_id, cxn) {
+        ind_cxn_keepalive_check(cxn, now);
+    }
+}
+
 /**
  * Enable the connection manager
  */
@@ -1093,6 +2126,22 @@ ind_cxn_enable_set(int enable)
 
     if (enable && !module_enabled) {
         LOG_INFO("Enabling OF connection mgr");
+#if OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE == 1
+        if (ind_soc_pass_end_register(ind_cxn_flush_pending, NULL) < 0) {
+            LOG_ERROR("Could not register write flush");
+            return INDIGO_ERROR_RESOURCE;
+        }
+#endif
+        if (ind_soc_pass_end_register(pktin_fq_pass_end, NULL) < 0) {
+            LOG_ERROR("Could not register packet-in fair queue drain");
+            return INDIGO_ERROR_RESOURCE;
+        }
+        if (ind_soc_timer_event_register_with_priority(
+                ind_cxn_keepalive_timer, NULL, CXN_KEEPALIVE_TICK_MS,
+                IND_CXN_EVENT_PRIORITY) < 0) {
+            LOG_ERROR("Could not register keepalive timer");
+            return INDIGO_ERROR_RESOURCE;
+        }
         module_enabled = 1;
     } else if (!enable && module_enabled) {
         int cxn_id;
@@ -1103,6 +2152,12 @@ ind_cxn_enable_set(int enable)
             ind_cxn_disconnect(cxn);
         }
         module_enabled = 0;
+#if OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE == 1
+        (void)ind_soc_pass_end_unregister(ind_cxn_flush_pending, NULL);
+#endif
+        (void)ind_soc_pass_end_unregister(pktin_fq_pass_end, NULL);
+        (void)ind_soc_timer_event_unregister(ind_cxn_keepalive_timer, NULL);
+        pktin_fq_clear();
         /* @todo Anything need to be done here? */
     } else {
         LOG_VERBOSE("Redundant enable call.  Currently %s",
@@ -1134,6 +2189,8 @@ ind_cxn_finish(void)
 {
     LOG_TRACE("Indigo connection manager fini");
     ind_cxn_enable_set(0);
+    ind_cxn_pktin_pool_finish();
+    ind_cxn_msg_pool_finish();
     return INDIGO_ERROR_NONE;
 }
 
@@ -1220,6 +2277,7 @@ ind_cxn_listen_socket_ready(int socket_id, void *cookie, int read_ready,
     socklen_t addrlen;
     struct sockaddr_in cxn_addr;
     int new_sd;
+    cxn_shm_t *shm = NULL;
     connection_t *cxn;
 
     listen_cxn = (connection_t *)cookie;
@@ -1269,13 +2327,26 @@ ind_cxn_listen_socket_ready(int socket_id, void *cookie, int read_ready,
         ++ind_cxn_internal_errors;
         return;
     }
-    LOG_VERBOSE("New cxn instance, port %d", ntohs(cxn_addr.sin_port));
+
+    if (listen_cxn->protocol_params.header.protocol ==
+        INDIGO_CXN_PROTO_SHM_OVER_UNIX) {
+        /* The connection runs over the rings; new_sd only sees the close */
+        if (ind_cxn_shm_accept(new_sd, &shm, &new_sd) < 0) {
+            LOG_ERROR("Could not set up shared memory client");
+            close(new_sd);
+            ++ind_cxn_internal_errors;
+            return;
+        }
+        LOG_VERBOSE("New shared memory cxn instance");
+    } else {
+        LOG_VERBOSE("New cxn instance, port %d", ntohs(cxn_addr.sin_port));
+    }
 
     /* Okay, add the new connection with the socket */
     cxn = connection_socket_setup(&listen_cxn->protocol_params,
                                   &listen_cxn->config_params,
                                   /* @fixme Should track this for remove */
-                                  &cxn_id, new_sd);
+                                  &cxn_id, new_sd, shm);
 
     if (cxn == NULL) {
         LOG_ERROR("Could not set up accepted connection");
@@ -1353,6 +2424,41 @@ ind_cxn_reset(indigo_cxn_id_t cxn_id)
     }
 }
 
+static void
+latency_hist_show(aim_pvs_t *pvs, const char *name,
+                  const ind_soc_histogram_t *hist)
+{
+    aim_printf(pvs, " %s %"PRIu64"/%"PRIu64"/%"PRIu64" (%"PRIu64")",
+               name, ind_soc_histogram_percentile(hist, 50),
+               ind_soc_histogram_percentile(hist, 99),
+               hist->max_us, hist->count);
+}
+
+/* Print the p50/p99/max latencies of each message type received */
+static void
+latency_show(aim_pvs_t *pvs, const cxn_msg_counters_t *counters)
+{
+    const cxn_msg_latency_t *latency;
+    int idx;
+    int header = 0;
+
+    for (idx = 0; idx < OF_MESSAGE_OBJECT_COUNT; idx++) {
+        if ((latency = counters->latency[idx]) == NULL) {
+            continue;
+        }
+        if (!header) {
+            aim_printf(pvs, "    Latency, p50/p99/max us (count):\n");
+            header = 1;
+        }
+        aim_printf(pvs, "        %s:", of_object_id_str[idx]);
+        latency_hist_show(pvs, "processing", &latency->processing_us);
+        if (latency->reply_us.count > 0) {
+            latency_hist_show(pvs, "reply", &latency->reply_us);
+        }
+        aim_printf(pvs, "\n");
+    }
+}
+
 /**
  * Show the stats for each connection.  If details
  * is true, show per-message data
@@ -1366,6 +2472,8 @@ ind_cxn_stats_show(aim_pvs_t *pvs, int details)
     int idx;
     int cxn_count = 0;
     uint64_t counter;
+    static const cxn_msg_counters_t no_counters;
+    const cxn_msg_counters_t *counters;
 
     aim_printf(pvs, "Connection statistics report\n");
     aim_printf(pvs, "    Number of successful connections: %d\n",
@@ -1384,58 +2492,90 @@ ind_cxn_stats_show(aim_pvs_t *pvs, int details)
                    CXN_LISTEN(cxn) ? " listening" : "",
                    cxn_ip_string(cxn));
         aim_printf(pvs, "    Id: %d.\n", cxn_id);
+        if (CXN_AUX(cxn)) {
+            aim_printf(pvs, "    Auxiliary id %d of connection %d.\n",
+                       cxn->auxiliary_id, cxn->main_cxn_id);
+        }
         aim_printf(pvs, "    State: %s.\n", CXN_HANDSHAKE_COMPLETE(cxn) ?
                    "Connected" : "Not connected");
         aim_printf(pvs, "    Packet ins: %"PRIu64"\n",
                    cxn->packet_ins);
         aim_printf(pvs, "    Packet in drops: %"PRIu64"\n",
                    cxn->status.packet_in_drop);
-
+        aim_printf(pvs, "    Packet in rate limit drops: %"PRIu64"\n",
+                   cxn->status.packet_in_meter_drop);
+        aim_printf(pvs, "    Flow removed drops: %"PRIu64"\n",
+                   cxn->status.flow_removed_drop);
+        aim_printf(pvs, "    Flow removed rate limit drops: %"PRIu64"\n",
+                   cxn->status.flow_removed_meter_drop);
+        aim_printf(pvs, "    Output blocked: %s (%"PRIu64" times)\n",
+                   cxn->output_blocked ? "yes" : "no",
+                   cxn->output_blocked_count);
+
+        counters = cxn->counters != NULL ? cxn->counters : &no_counters;
         aim_printf(pvs, "    Messages in, current connection: %"PRIu64"\n",
                    cxn->status.messages_in);
         counter = 0;
         for (idx = 0; idx < OF_MESSAGE_OBJECT_COUNT; idx++) {
-            counter += cxn->messages_in_by_type[idx];
+            counter += counters->in_by_type[idx];
         }
         aim_printf(pvs, "    Cumulative messages in: %"PRIu64"\n", counter);
         if (details) {
             for (idx = 0; idx < OF_MESSAGE_OBJECT_COUNT; idx++) {
-                if (cxn->messages_in_by_type[idx]) {
+                if (counters->in_by_type[idx]) {
                     aim_printf(pvs, "        %s: %"PRIu64"\n",
                                of_object_id_str[idx],
-                               cxn->messages_in_by_type[idx]);
+                               counters->in_by_type[idx]);
                 }
             }
         }
-        if (cxn->messages_in_unknown) {
+        if (counters->in_unknown) {
             aim_printf(pvs, "        Unknown type: %"PRIu64"\n",
-                       cxn->messages_in_unknown);
+                       counters->in_unknown);
         }
 
         aim_printf(pvs, "    Messages out, current connection: %"PRIu64"\n",
                    cxn->status.messages_out);
         counter = 0;
         for (idx = 0; idx < OF_MESSAGE_OBJECT_COUNT; idx++) {
-            counter += cxn->messages_out_by_type[idx];
+            counter += counters->out_by_type[idx];
         }
         aim_printf(pvs, "    Cumulative messages out: %"PRIu64"\n", counter);
         if (details) {
             for (idx = 0; idx < OF_MESSAGE_OBJECT_COUNT; idx++) {
-                if (cxn->messages_out_by_type[idx]) {
+                if (counters->out_by_type[idx]) {
                     aim_printf(pvs, "        %s: %"PRIu64"\n",
                                of_object_id_str[idx],
-                               cxn->messages_out_by_type[idx]);
+                               counters->out_by_type[idx]);
                 }
             }
         }
-        if (cxn->messages_out_unknown) {
+        if (counters->out_unknown) {
             aim_printf(pvs, "        Unknown type: %"PRIu64"\n",
-                       cxn->messages_out_unknown);
+                       counters->out_unknown);
+        }
+
+        if (details) {
+            latency_show(pvs, counters);
         }
     }
     if (!cxn_count) {
         aim_printf(pvs, "No active connections\n");
     }
+
+    if (rate_limits.packet_in_fair_queue.depth > 0) {
+        aim_printf(pvs, "Packet in fair queue: %d queued\n", pktin_fq_queued);
+        for (idx = 0; idx < CXN_PKTIN_FQ_CLASSES; idx++) {
+            const cxn_pktin_fq_class_t *class = &pktin_fq[idx];
+            if (class->sent || class->drops || class->count) {
+                aim_printf(pvs, "    Reason %d port class %d: queued %d, "
+                           "sent %"PRIu64", drops %"PRIu64"\n",
+                           idx / CXN_PKTIN_FQ_PORT_CLASSES,
+                           idx % CXN_PKTIN_FQ_PORT_CLASSES,
+                           class->count, class->sent, class->drops);
+            }
+        }
+    }
 }
 
 /**
@@ -33,6 +33,8 @@
 #include "ofconnectionmanager_int.h"
 #include "ofconnectionmanager_log.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <cjson/cJSON.h>
 #include <Configuration/configuration.h>
 
@@ -81,6 +83,26 @@ ofconnectionmanager_config_settings_t ofconnectionmanager_config_settings[] =
 #else
 { OFCONNECTIONMANAGER_CONFIG_ECHO_OPTIMIZATION(__ofconnectionmanager_config_STRINGIFY_NAME), "__undefined__" },
 #endif
+#ifdef OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE
+    { __ofconnectionmanager_config_STRINGIFY_NAME(OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE), __ofconnectionmanager_config_STRINGIFY_VALUE(OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE) },
+#else
+{ OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE(__ofconnectionmanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES
+    { __ofconnectionmanager_config_STRINGIFY_NAME(OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES), __ofconnectionmanager_config_STRINGIFY_VALUE(OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES) },
+#else
+{ OFCONNECTIONMANAGER_CONFIG_WRITE_COALESCE_BYTES(__ofconnectionmanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE
+    { __ofconnectionmanager_config_STRINGIFY_NAME(OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE), __ofconnectionmanager_config_STRINGIFY_VALUE(OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE) },
+#else
+{ OFCONNECTIONMANAGER_CONFIG_PACKET_IN_POOL_SIZE(__ofconnectionmanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE
+    { __ofconnectionmanager_config_STRINGIFY_NAME(OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE), __ofconnectionmanager_config_STRINGIFY_VALUE(OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE) },
+#else
+{ OFCONNECTIONMANAGER_CONFIG_MSG_BUFFER_POOL_SIZE(__ofconnectionmanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
 #ifdef OFCONNECTIONMANAGER_CONFIG_OF_VERSION
     { __ofconnectionmanager_config_STRINGIFY_NAME(OFCONNECTIONMANAGER_CONFIG_OF_VERSION), __ofconnectionmanager_config_STRINGIFY_VALUE(OFCONNECTIONMANAGER_CONFIG_OF_VERSION) },
 #else
@@ -126,10 +148,110 @@ struct controller {
 static struct config {
     uint32_t log_flags;
     int keepalive_period_ms;
+    ind_cxn_rate_limits_t rate_limits;
     int num_controllers;
     struct controller controllers[MAX_CONTROLLERS];
 } staged_config, current_config;
 
+/* Parse an optional non-negative integer; 0 if absent. */
+static indigo_error_t
+parse_socket_int(cJSON *root, const char *name, int max, int *value)
+{
+    char path[64];
+    indigo_error_t err;
+
+    snprintf(path, sizeof(path), "socket.%s", name);
+    err = ind_cfg_lookup_int(root, path, value);
+    if (err == INDIGO_ERROR_NOT_FOUND) {
+        *value = 0;
+        return INDIGO_ERROR_NONE;
+    } else if (err < 0 || *value < 0 || *value > max) {
+        AIM_LOG_ERROR("Config: '%s' must be an integer from 0 to %d",
+                      path, max);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+/*
+ * Parse the optional socket options of a controller like
+ * {"tcp_nodelay": false, "sndbuf": 1048576, "dscp": 46}.
+ */
+static indigo_error_t
+parse_socket_params(cJSON *root, indigo_cxn_socket_params_t *params)
+{
+    int nodelay;
+    indigo_error_t err;
+
+    memset(params, 0, sizeof(*params));
+
+    err = ind_cfg_lookup_bool(root, "socket.tcp_nodelay", &nodelay);
+    if (err == INDIGO_ERROR_NOT_FOUND) {
+        nodelay = 1;
+    } else if (err < 0) {
+        AIM_LOG_ERROR("Config: 'socket.tcp_nodelay' must be a boolean");
+        return INDIGO_ERROR_PARAM;
+    }
+    params->nagle = !nodelay;
+
+    if ((err = parse_socket_int(root, "sndbuf", 0x7fffffff,
+                                &params->sndbuf)) < 0 ||
+        (err = parse_socket_int(root, "rcvbuf", 0x7fffffff,
+                                &params->rcvbuf)) < 0 ||
+        (err = parse_socket_int(root, "notsent_lowat", 0x7fffffff,
+                                &params->notsent_lowat)) < 0 ||
+        (err = parse_socket_int(root, "busy_poll_us", 0x7fffffff,
+                                &params->busy_poll_us)) < 0 ||
+        (err = parse_socket_int(root, "dscp", 63, &params->dscp)) < 0) {
+        return err;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+/*
+ * Parse a shared memory listener like {"protocol": "shm",
+ * "path": "/var/run/indigo.sock", "listen": true}.
+ */
+static indigo_error_t
+parse_shm_controller(struct controller *controller, cJSON *root)
+{
+    indigo_cxn_params_shm_over_unix_t *proto;
+    char *path;
+    int listen;
+    indigo_error_t err;
+
+    err = ind_cfg_lookup_string(root, "path", &path);
+    if (err < 0) {
+        AIM_LOG_ERROR("Config: shm controllers need a 'path' string");
+        return err;
+    }
+
+    if (strlen(path) >= sizeof(proto->path)) {
+        AIM_LOG_ERROR("Config: shm path too long: %s", path);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    err = ind_cfg_lookup_bool(root, "listen", &listen);
+    if (err < 0 || !listen) {
+        AIM_LOG_ERROR("Config: shm controllers must set 'listen'");
+        return INDIGO_ERROR_PARAM;
+    }
+
+    proto = &controller->proto.shm_over_unix;
+    proto->protocol = INDIGO_CXN_PROTO_SHM_OVER_UNIX;
+    strncpy(proto->path, path, sizeof(proto->path));
+    controller->config.listen = 1;
+    controller->config.cxn_priority = 0;
+    controller->config.local = 0;
+    controller->config.num_aux = 0;
+    controller->config.version = OFCONNECTIONMANAGER_CONFIG_OF_VERSION;
+    memset(&controller->config.socket, 0, sizeof(controller->config.socket));
+
+    return INDIGO_ERROR_NONE;
+}
+
 /* Parse a controller string like "tcp:127.0.0.1:6633". */
 static indigo_error_t
 parse_controller(struct controller *controller, cJSON *root)
@@ -139,8 +261,17 @@ parse_controller(struct controller *controller, cJSON *root)
     int port;
     int listen;
     int prio;
+    int num_aux;
     indigo_error_t err;
 
+    /* find_controller compares the whole union */
+    memset(controller, 0, sizeof(*controller));
+
+    if (ind_cfg_lookup_string(root, "protocol", &proto_str) == 0 &&
+        !strcmp(proto_str, "shm")) {
+        return parse_shm_controller(controller, root);
+    }
+
     err = ind_cfg_lookup_string(root, "ip_addr", &ip);
     if (err < 0) {
         if (err == INDIGO_ERROR_PARAM) {
@@ -204,6 +335,26 @@ parse_controller(struct controller *controller, cJSON *root)
         return err;
     }
 
+    err = ind_cfg_lookup_int(root, "auxiliary_connections", &num_aux);
+    if (err == INDIGO_ERROR_NOT_FOUND) {
+        num_aux = 0;
+    } else if (err < 0) {
+        if (err == INDIGO_ERROR_PARAM) {
+            AIM_LOG_ERROR("Config: 'auxiliary_connections' must be an integer");
+        }
+        return err;
+    }
+
+    if (num_aux < 0 || num_aux > CXN_AUX_MAX || (num_aux > 0 && listen)) {
+        AIM_LOG_ERROR("Config: Invalid auxiliary connection count: %d", num_aux);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    err = parse_socket_params(root, &controller->config.socket);
+    if (err < 0) {
+        return err;
+    }
+
     /* TODO validate IP */
 
     proto = &controller->proto.tcp_over_ipv4;
@@ -213,6 +364,7 @@ parse_controller(struct controller *controller, cJSON *root)
     controller->config.listen = listen;
     controller->config.cxn_priority = prio;
     controller->config.local = 0;
+    controller->config.num_aux = num_aux;
     controller->config.version = OFCONNECTIONMANAGER_CONFIG_OF_VERSION;
 
     return INDIGO_ERROR_NONE;
@@ -262,6 +414,115 @@ parse_controllers(cJSON *root)
     return INDIGO_ERROR_NONE;
 }
 
+/* Parse an optional rate limit like {"rate": 1000, "burst": 100}. */
+static indigo_error_t
+parse_meter(cJSON *root, const char *name, ind_cxn_meter_config_t *meter)
+{
+    char path[64];
+    int rate, burst;
+    indigo_error_t err;
+
+    snprintf(path, sizeof(path), "rate_limits.%s.rate", name);
+    err = ind_cfg_lookup_int(root, path, &rate);
+    if (err == INDIGO_ERROR_NOT_FOUND) {
+        meter->rate = meter->burst = 0;
+        return INDIGO_ERROR_NONE;
+    } else if (err < 0 || rate < 0) {
+        AIM_LOG_ERROR("Config: '%s' must be a non-negative integer", path);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    snprintf(path, sizeof(path), "rate_limits.%s.burst", name);
+    err = ind_cfg_lookup_int(root, path, &burst);
+    if (err == INDIGO_ERROR_NOT_FOUND) {
+        /* Default to one second's worth */
+        burst = rate;
+    } else if (err < 0 || burst < 1) {
+        AIM_LOG_ERROR("Config: '%s' must be a positive integer", path);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    meter->rate = rate;
+    meter->burst = burst;
+
+    return INDIGO_ERROR_NONE;
+}
+
+/*
+ * Parse the optional packet-in fair queue like
+ * {"depth": 32, "reason_weights": [1, 4]}.
+ */
+static indigo_error_t
+parse_fair_queue(cJSON *root, ind_cxn_fair_queue_config_t *fq)
+{
+    cJSON *weights, *weight;
+    int depth;
+    int i;
+    indigo_error_t err;
+
+    memset(fq, 0, sizeof(*fq));
+
+    err = ind_cfg_lookup_int(root, "rate_limits.packet_in_fair_queue.depth",
+                             &depth);
+    if (err == INDIGO_ERROR_NOT_FOUND) {
+        return INDIGO_ERROR_NONE;
+    } else if (err < 0 || depth < 0) {
+        AIM_LOG_ERROR("Config: 'rate_limits.packet_in_fair_queue.depth' "
+                      "must be a non-negative integer");
+        return INDIGO_ERROR_PARAM;
+    }
+    fq->depth = depth;
+
+    err = ind_cfg_lookup(root, "rate_limits.packet_in_fair_queue.reason_weights",
+                         &weights);
+    if (err == INDIGO_ERROR_NOT_FOUND) {
+        return INDIGO_ERROR_NONE;
+    } else if (err < 0 || weights->type != cJSON_Array) {
+        AIM_LOG_ERROR("Config: expected 'rate_limits.packet_in_fair_queue."
+                      "reason_weights' to be an array");
+        return INDIGO_ERROR_PARAM;
+    }
+
+    for (i = 0, weight = weights->child; weight; ++i, weight = weight->next) {
+        if (i >= CXN_PACKET_IN_REASON_METERS) {
+            AIM_LOG_ERROR("Config: More than %d packet-in reason weights",
+                          CXN_PACKET_IN_REASON_METERS);
+            return INDIGO_ERROR_PARAM;
+        }
+
+        if (weight->type != cJSON_Number || weight->valueint < 0) {
+            AIM_LOG_ERROR("Config: packet-in reason weights must be "
+                          "non-negative integers");
+            return INDIGO_ERROR_PARAM;
+        }
+        fq->reason_weights[i] = weight->valueint;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Parse the optional 'rate_limits' object. */
+static indigo_error_t
+parse_rate_limits(cJSON *root)
+{
+    ind_cxn_rate_limits_t *limits = &staged_config.rate_limits;
+    indigo_error_t err;
+
+    if ((err = parse_meter(root, "packet_in",
+                           &limits->packet_in)) < 0 ||
+        (err = parse_meter(root, "packet_in_reason",
+                           &limits->packet_in_reason)) < 0 ||
+        (err = parse_meter(root, "packet_in_port",
+                           &limits->packet_in_port)) < 0 ||
+        (err = parse_meter(root, "flow_removed",
+                           &limits->flow_removed)) < 0 ||
+        (err = parse_fair_queue(root, &limits->packet_in_fair_queue)) < 0) {
+        return err;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
 /* Match on the protocol params. */
 static const struct controller *
 find_controller(const struct config *config,
@@ -312,6 +573,11 @@ ind_cxn_cfg_stage(cJSON *config)
         return err;
     }
 
+    err = parse_rate_limits(config);
+    if (err != INDIGO_ERROR_NONE) {
+        return err;
+    }
+
     for (i = 0; i < staged_config.num_controllers; i++) {
         /* @FIXME local? listen? priority? */
         staged_config.controllers[i].config.periodic_echo_ms = staged_config.keepalive_period_ms;
@@ -321,18 +587,12 @@ ind_cxn_cfg_stage(cJSON *config)
     return INDIGO_ERROR_NONE;
 }
 
+/* Add and remove connections to match the staged controllers. */
 static void
-ind_cxn_cfg_commit(void)
+commit_controllers(void)
 {
-    aim_log_t *lobj;
     int i;
 
-    if ((lobj = aim_log_find("ofconnectionmanager")) == NULL) {
-        AIM_LOG_WARN("Could not find log module");
-    } else {
-        lobj->common_flags = staged_config.log_flags;
-    }
-
     for (i = 0; i < staged_config.num_controllers; i++) {
         struct controller *c = &staged_config.controllers[i];
         const struct controller *old_controller;
@@ -362,12 +622,47 @@ ind_cxn_cfg_commit(void)
             (void) indigo_cxn_connection_remove(c->cxn_id);
         }
     }
+}
+
+static void
+ind_cxn_cfg_commit(void)
+{
+    aim_log_t *lobj;
+
+    if ((lobj = aim_log_find("ofconnectionmanager")) == NULL) {
+        AIM_LOG_WARN("Could not find log module");
+    } else {
+        lobj->common_flags = staged_config.log_flags;
+    }
+
+    if (memcmp(&staged_config.rate_limits, &current_config.rate_limits,
+               sizeof(staged_config.rate_limits))) {
+        ind_cxn_rate_limits_set(&staged_config.rate_limits);
+    }
+
+    if (ind_cfg_changed("controllers") ||
+            ind_cfg_changed("keepalive_period_ms")) {
+        commit_controllers();
+    } else {
+        /* Same controllers as before, keep their connection ids */
+        memcpy(staged_config.controllers, current_config.controllers,
+               sizeof(staged_config.controllers));
+    }
 
     /* Save config so we can diff the controllers next time */
     current_config = staged_config;
 }
 
+static const char * const cfg_paths[] = {
+    "logging.connection",
+    "keepalive_period_ms",
+    "controllers",
+    "rate_limits",
+    NULL
+};
+
 const struct ind_cfg_ops ind_cxn_cfg_ops = {
     .stage = ind_cxn_cfg_stage,
     .commit = ind_cxn_cfg_commit,
+    .paths = cfg_paths,
 };
@@ -99,6 +99,18 @@ extern void cxn_message_track_setup(connection_t *cxn, of_object_t *obj);
 
 void ind_cxn_change_master(indigo_cxn_id_t master_id);
 
+/**
+ * Set a main connection's role, mirroring it onto its auxiliary connections
+ */
+void ind_cxn_role_set(connection_t *cxn, indigo_cxn_role_t role);
+
+/**
+ * The main connection of an auxiliary connection, or cxn itself
+ *
+ * Roles are kept on the main connection; check permissions against it.
+ */
+connection_t *ind_cxn_main(connection_t *cxn);
+
 void ind_cxn_populate_connection_list(of_list_bsn_controller_connection_t *list);
 
 /**
@@ -72,6 +72,58 @@ ofconnectionmanager_ucli_ucli__stats__(ucli_context_t *uc)
     return UCLI_STATUS_OK;
 }
 
+static ucli_status_t
+ofconnectionmanager_ucli_ucli__trace_ring__(ucli_context_t *uc)
+{
+    char *str, *filename;
+    int slots = 4096, snaplen = 256;
+    int count;
+    indigo_error_t rv;
+
+    UCLI_COMMAND_INFO(uc,
+                      "trace_ring", -1,
+                      "$summary#Show the message trace ring, enable [slots snaplen], "
+                      "disable it, or export <file> as pcap.");
+    if (uc->pargs->count == 0) {
+        ind_cxn_trace_ring_show(&uc->pvs);
+        return UCLI_STATUS_OK;
+    }
+
+    if (uc->pargs->count == 2) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "ss", &str, &filename);
+        if (strcmp(str, "export")) {
+            return UCLI_STATUS_E_ARG;
+        }
+        if ((rv = ind_cxn_trace_ring_export(filename, &count)) < 0) {
+            ucli_printf(uc, "Export failed: %s\n", indigo_strerror(rv));
+            return UCLI_STATUS_E_ERROR;
+        }
+        ucli_printf(uc, "Wrote %d messages to %s\n", count, filename);
+        return UCLI_STATUS_OK;
+    }
+
+    if (uc->pargs->count == 3) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "sii", &str, &slots, &snaplen);
+    } else if (uc->pargs->count == 1) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "s", &str);
+    } else {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    if (!strcmp(str, "disable") && uc->pargs->count == 1) {
+        slots = 0;
+    } else if (strcmp(str, "enable")) {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    if ((rv = ind_cxn_trace_ring_enable(slots, snaplen)) < 0) {
+        ucli_printf(uc, "Could not set trace ring: %s\n", indigo_strerror(rv));
+        return UCLI_STATUS_E_ERROR;
+    }
+
+    return UCLI_STATUS_OK;
+}
+
 
 /* <auto.ucli.handlers.start> */
 /******************************************************************************
@@ -84,6 +136,7 @@ static ucli_command_handler_f ofconnectionmanager_ucli_ucli_handlers__[] =
 {
     ofconnectionmanager_ucli_ucli__config__,
     ofconnectionmanager_ucli_ucli__stats__,
+    ofconnectionmanager_ucli_ucli__trace_ring__,
     NULL
 };
 /******************************************************************************/
@@ -40,6 +40,16 @@
 #include <SocketManager/socketmanager.h>
 
 #include "ofconnectionmanager_log.h"
+#include <cxn_instance.h>
+#include <cxn_trace.h>
+#include <cxn_shm.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
 
 #define OK(op)  INDIGO_ASSERT((op) == INDIGO_ERROR_NONE)
 
@@ -91,11 +101,22 @@ setup_cxn(void)
 
 static int got_cxn_msg;
 
+/* Set to keep received objects in held_msg instead of deleting them */
+static int hold_msgs;
+static of_object_t *held_msg;
+
 static void
 cxn_msg_rx(indigo_cxn_id_t cxn_id, of_object_t *obj)
 {
     printf("Got msg from %d: type %d\n", cxn_id, obj->object_id);
 
+    if (hold_msgs) {
+        INDIGO_ASSERT(held_msg == NULL);
+        held_msg = obj;
+        got_cxn_msg = 1;
+        return;
+    }
+
     /* Just respond to echo request */
     if (obj->object_id == OF_ECHO_REQUEST) {
         of_echo_request_t *echo;
@@ -119,6 +140,16 @@ cxn_msg_rx(indigo_cxn_id_t cxn_id, of_object_t *obj)
         of_echo_reply_xid_set(reply, xid);
 
         indigo_cxn_send_controller_message(cxn_id, reply);
+    } else if (obj->object_id == OF_FEATURES_REQUEST) {
+        /* Completes the handshake */
+        of_features_reply_t *reply;
+        uint32_t xid;
+
+        of_features_request_xid_get(obj, &xid);
+        if ((reply = of_features_reply_new(obj->version)) != NULL) {
+            of_features_reply_xid_set(reply, xid);
+            indigo_cxn_send_controller_message(cxn_id, reply);
+        }
     }
 
  done:
@@ -137,11 +168,993 @@ indigo_core_receive_controller_message(indigo_cxn_id_t cxn_id,
     cxn_msg_rx(cxn_id, obj);
 }
 
+static void
+test_packet_in_pool(void)
+{
+    of_packet_in_t *header, *pkt_in;
+    of_octets_t data;
+    uint8_t *frame;
+    uint16_t total_len;
+
+    header = of_packet_in_new(OF_VERSION_1_3);
+    INDIGO_ASSERT(header != NULL);
+    of_packet_in_total_len_set(header, 64);
+
+    INDIGO_ASSERT((frame = indigo_cxn_packet_in_frame_alloc()) != NULL);
+    memset(frame, 0xab, 64);
+
+    pkt_in = indigo_cxn_packet_in_build(header, frame, 64);
+    INDIGO_ASSERT(pkt_in != NULL);
+    INDIGO_ASSERT(pkt_in->length == header->length + 64);
+    of_packet_in_total_len_get(pkt_in, &total_len);
+    INDIGO_ASSERT(total_len == 64);
+    of_packet_in_data_get(pkt_in, &data);
+    INDIGO_ASSERT(data.data == frame && data.bytes == 64);
+
+    /* Deleting the packet-in returns its slot to the pool */
+    of_object_delete(pkt_in);
+    INDIGO_ASSERT(indigo_cxn_packet_in_frame_alloc() == frame);
+
+    /* An oversized frame is rejected and released */
+    INDIGO_ASSERT(indigo_cxn_packet_in_build(
+        header, frame, INDIGO_CXN_PACKET_IN_FRAME_MAX + 1) == NULL);
+    INDIGO_ASSERT(indigo_cxn_packet_in_frame_alloc() == frame);
+    indigo_cxn_packet_in_frame_free(frame);
+
+    of_object_delete(header);
+}
+
+static void
+test_msg_buffer_pool(void)
+{
+    uint8_t *small, *other, *large, *huge;
+
+    small = ind_cxn_msg_buffer_alloc(16);
+    other = ind_cxn_msg_buffer_alloc(100);
+    INDIGO_ASSERT(small != NULL && other != NULL && small != other);
+
+    /* A released buffer is reused by the next message of its class */
+    ind_cxn_msg_data_free(small);
+    INDIGO_ASSERT(ind_cxn_msg_buffer_alloc(16) == small);
+
+    large = ind_cxn_msg_buffer_alloc(3000);
+    INDIGO_ASSERT(large != NULL);
+    ind_cxn_msg_data_free(large);
+    INDIGO_ASSERT(ind_cxn_msg_buffer_alloc(3000) == large);
+
+    /* Messages beyond the largest class come from the heap */
+    huge = ind_cxn_msg_buffer_alloc(64 * 1024);
+    INDIGO_ASSERT(huge != NULL);
+    memset(huge, 0, 64 * 1024);
+
+    ind_cxn_msg_data_free(huge);
+    ind_cxn_msg_data_free(large);
+    ind_cxn_msg_data_free(other);
+    ind_cxn_msg_data_free(small);
+}
+
+static void
+test_trace_ring(void)
+{
+    const char *filename = "/tmp/ofconnectionmanager_utest_trace.pcap";
+    uint8_t msg[100];
+    uint8_t buf[256];
+    uint32_t magic, incl_len, orig_len;
+    FILE *f;
+    int count, i;
+
+    /* Nothing to export before the ring is enabled */
+    INDIGO_ASSERT(ind_cxn_trace_ring_export(filename, &count) ==
+                  INDIGO_ERROR_NOT_READY);
+
+    OK(ind_cxn_trace_ring_enable(4, 64));
+
+    memset(msg, 0, sizeof(msg));
+    msg[0] = OF_VERSION_1_3;
+    for (i = 0; i < 6; i++) {
+        msg[7] = i;
+        ind_cxn_trace_ring_record(1, 0x7f000001, CONTROLLER_PORT,
+                                  i & 1 ? CXN_TRACE_TX : CXN_TRACE_RX,
+                                  msg, sizeof(msg));
+    }
+
+    /* Only the newest 4 are kept */
+    OK(ind_cxn_trace_ring_export(filename, &count));
+    INDIGO_ASSERT(count == 4);
+
+    INDIGO_ASSERT((f = fopen(filename, "r")) != NULL);
+    INDIGO_ASSERT(fread(buf, 24, 1, f) == 1);
+    memcpy(&magic, buf, sizeof(magic));
+    INDIGO_ASSERT(magic == 0xa1b2c3d4);
+
+    /* First record is message 2, received, truncated to the snap length */
+    INDIGO_ASSERT(fread(buf, 16 + 54 + 64, 1, f) == 1);
+    memcpy(&incl_len, buf + 8, sizeof(incl_len));
+    memcpy(&orig_len, buf + 12, sizeof(orig_len));
+    INDIGO_ASSERT(incl_len == 54 + 64);
+    INDIGO_ASSERT(orig_len == 54 + sizeof(msg));
+    /* TCP source port is the controller's */
+    INDIGO_ASSERT(((buf[16 + 34] << 8) | buf[16 + 35]) == CONTROLLER_PORT);
+    INDIGO_ASSERT(buf[16 + 54 + 7] == 2);
+    fclose(f);
+    unlink(filename);
+
+    /* Disabled rings stop recording but can still be exported */
+    OK(ind_cxn_trace_ring_enable(0, 0));
+    ind_cxn_trace_ring_record(1, 0, 0, CXN_TRACE_RX, msg, sizeof(msg));
+    OK(ind_cxn_trace_ring_export(filename, &count));
+    INDIGO_ASSERT(count == 4);
+    unlink(filename);
+
+    INDIGO_ASSERT(ind_cxn_trace_ring_enable(4, 0) == INDIGO_ERROR_PARAM);
+}
+
+static void
+test_async_config(void)
+{
+    connection_t cxn;
+    of_packet_in_t *pktin_action, *pktin_miss;
+    of_port_status_t *port_status;
+    of_flow_removed_t *flow_removed;
+
+    INDIGO_MEM_CLEAR(&cxn, sizeof(cxn));
+    cxn.status.state = INDIGO_CXN_S_HANDSHAKE_COMPLETE;
+    cxn.status.role = INDIGO_CXN_R_EQUAL;
+    ind_cxn_async_config_reset(&cxn);
+
+    INDIGO_ASSERT((pktin_action = of_packet_in_new(OF_VERSION_1_3)) != NULL);
+    of_packet_in_reason_set(pktin_action, OF_PACKET_IN_REASON_ACTION);
+    INDIGO_ASSERT((pktin_miss = of_packet_in_new(OF_VERSION_1_3)) != NULL);
+    of_packet_in_reason_set(pktin_miss, OF_PACKET_IN_REASON_NO_MATCH);
+    INDIGO_ASSERT((port_status = of_port_status_new(OF_VERSION_1_3)) != NULL);
+    INDIGO_ASSERT((flow_removed = of_flow_removed_new(OF_VERSION_1_3)) != NULL);
+
+    /* Defaults: everything for equal, port status only for slave */
+    INDIGO_ASSERT(ind_cxn_accepts_async_message(&cxn, pktin_action));
+    INDIGO_ASSERT(ind_cxn_accepts_async_message(&cxn, flow_removed));
+    cxn.status.role = INDIGO_CXN_R_SLAVE;
+    INDIGO_ASSERT(!ind_cxn_accepts_async_message(&cxn, pktin_action));
+    INDIGO_ASSERT(!ind_cxn_accepts_async_message(&cxn, flow_removed));
+    INDIGO_ASSERT(ind_cxn_accepts_async_message(&cxn, port_status));
+
+    /* Masks select reasons per role */
+    cxn.async_config[CXN_ASYNC_ROLE_SLAVE][CXN_ASYNC_PACKET_IN] =
+        CXN_ASYNC_REASON_BIT(OF_PACKET_IN_REASON_NO_MATCH);
+    cxn.async_config[CXN_ASYNC_ROLE_MASTER][CXN_ASYNC_PACKET_IN] =
+        CXN_ASYNC_REASON_BIT(OF_PACKET_IN_REASON_ACTION);
+    INDIGO_ASSERT(ind_cxn_accepts_async_message(&cxn, pktin_miss));
+    INDIGO_ASSERT(!ind_cxn_accepts_async_message(&cxn, pktin_action));
+    cxn.status.role = INDIGO_CXN_R_MASTER;
+    INDIGO_ASSERT(!ind_cxn_accepts_async_message(&cxn, pktin_miss));
+    INDIGO_ASSERT(ind_cxn_accepts_async_message(&cxn, pktin_action));
+
+    /* Auxiliary connections never take async messages themselves */
+    cxn.auxiliary_id = 1;
+    INDIGO_ASSERT(!ind_cxn_accepts_async_message(&cxn, pktin_action));
+
+    of_object_delete(pktin_action);
+    of_object_delete(pktin_miss);
+    of_object_delete(port_status);
+    of_object_delete(flow_removed);
+}
+
+static void
+test_packet_in_meter(void)
+{
+    connection_t cxn;
+    ind_cxn_rate_limits_t limits;
+    of_packet_in_t *pktin[4];
+    int i;
+
+    INDIGO_MEM_CLEAR(&cxn, sizeof(cxn));
+    INDIGO_MEM_CLEAR(&limits, sizeof(limits));
+    limits.packet_in.rate = 1;
+    limits.packet_in.burst = 2;
+    limits.packet_in_port.rate = 1;
+    limits.packet_in_port.burst = 1;
+    ind_cxn_rate_limits_set(&limits);
+
+    for (i = 0; i < 4; i++) {
+        INDIGO_ASSERT((pktin[i] = of_packet_in_new(OF_VERSION_1_0)) != NULL);
+    }
+    of_packet_in_in_port_set(pktin[0], 1);
+    of_packet_in_in_port_set(pktin[1], 1);
+    of_packet_in_in_port_set(pktin[2], 2);
+    of_packet_in_in_port_set(pktin[3], 3);
+
+    /* The loop time does not advance, so no bucket refills */
+    INDIGO_ASSERT(ind_cxn_packet_in_meter(&cxn, pktin[0]));
+
+    /* Dropped by the port meter without draining the aggregate */
+    INDIGO_ASSERT(!ind_cxn_packet_in_meter(&cxn, pktin[1]));
+    INDIGO_ASSERT(ind_cxn_packet_in_meter(&cxn, pktin[2]));
+
+    /* Dropped by the aggregate without draining port 3 */
+    INDIGO_ASSERT(!ind_cxn_packet_in_meter(&cxn, pktin[3]));
+    INDIGO_ASSERT(cxn.meters.packet_in_port[3].tokens == 1000000);
+
+    for (i = 0; i < 4; i++) {
+        of_object_delete(pktin[i]);
+    }
+
+    INDIGO_MEM_CLEAR(&limits, sizeof(limits));
+    ind_cxn_rate_limits_set(&limits);
+}
+
+static int backpressure_reads;
+static int backpressure_wakeups;
+
+static void
+backpressure_socket_ready(int socket_id, void *cookie,
+                          int read_ready, int write_ready, int error_seen)
+{
+    /* Leave the data unread so the socket stays readable */
+    if (read_ready) {
+        backpressure_reads++;
+    }
+}
+
+static void
+backpressure_output_ready(void *cookie)
+{
+    backpressure_wakeups++;
+}
+
+static void
+test_output_backpressure(void)
+{
+    connection_t cxn;
+    uint8_t *data, buf[65536];
+    int sv[2], cls, len = 60000, msgs = 0, i;
+
+    INDIGO_MEM_CLEAR(&cxn, sizeof(cxn));
+    ind_cxn_disconnected_init(&cxn);
+    INDIGO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    INDIGO_ASSERT(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+    INDIGO_ASSERT(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+    cxn.sd = sv[0];
+    OK(ind_soc_socket_register(sv[0], backpressure_socket_ready, NULL));
+
+    /* Input is serviced while the queue is short */
+    INDIGO_ASSERT(write(sv[1], "x", 1) == 1);
+    backpressure_reads = 0;
+    OK(ind_soc_select_and_run(0));
+    INDIGO_ASSERT(backpressure_reads > 0);
+    INDIGO_ASSERT(ind_cxn_output_waiter_add(&cxn, backpressure_output_ready,
+                                            NULL) == INDIGO_ERROR_NOT_FOUND);
+
+    /* Queue without writing until the high watermark pauses input */
+    while (!cxn.output_blocked) {
+        INDIGO_ASSERT(cxn.bytes_enqueued < CXN_OUTPUT_HIGH_WATERMARK);
+        INDIGO_ASSERT((data = ind_cxn_msg_buffer_alloc(len)) != NULL);
+        INDIGO_MEM_CLEAR(data, len);
+        data[0] = OF_VERSION_1_3;
+        data[2] = len >> 8;
+        data[3] = len & 0xff;
+        OK(ind_cxn_instance_enqueue(&cxn, CXN_OUTPUT_CLASS_BULK, data, len));
+        msgs++;
+    }
+    INDIGO_ASSERT(msgs == (CXN_OUTPUT_HIGH_WATERMARK + len - 1) / len);
+    OK(ind_cxn_output_waiter_add(&cxn, backpressure_output_ready, NULL));
+
+    backpressure_reads = 0;
+    OK(ind_soc_select_and_run(0));
+    INDIGO_ASSERT(backpressure_reads == 0);
+
+    /* Draining below the low watermark resumes input and the waiter */
+    backpressure_wakeups = 0;
+    for (i = 0; i < 100000 && cxn.output_blocked; i++) {
+        INDIGO_ASSERT(ind_cxn_process_write_buffer(&cxn) >= 0);
+        while (read(sv[1], buf, sizeof(buf)) > 0);
+    }
+    INDIGO_ASSERT(!cxn.output_blocked);
+    INDIGO_ASSERT(cxn.bytes_enqueued < CXN_OUTPUT_LOW_WATERMARK);
+    INDIGO_ASSERT(backpressure_wakeups == 1);
+
+    backpressure_reads = 0;
+    OK(ind_soc_select_and_run(0));
+    INDIGO_ASSERT(backpressure_reads > 0);
+
+    while (cxn.pkts_enqueued > 0) {
+        INDIGO_ASSERT(ind_cxn_process_write_buffer(&cxn) >= 0);
+        while (read(sv[1], buf, sizeof(buf)) > 0);
+    }
+
+    OK(ind_soc_socket_unregister(sv[0]));
+    for (cls = 0; cls < CXN_OUTPUT_CLASS_COUNT; cls++) {
+        INDIGO_MEM_FREE(cxn.output[cls].ring);
+    }
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/*
+ * A handshaken OpenFlow 1.3 connection on one end of a socketpair; the
+ * test plays the controller on sv[1]. The id is out of range, so objects
+ * it tracks are not found again when deleted.
+ */
+static void
+test_cxn_ready(int socket_id, void *cookie,
+               int read_ready, int write_ready, int error_seen)
+{
+}
+
+static void
+test_cxn_open(connection_t *cxn, int sv[2])
+{
+    INDIGO_MEM_CLEAR(cxn, sizeof(*cxn));
+    ind_cxn_disconnected_init(cxn);
+    INDIGO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    INDIGO_ASSERT(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+    INDIGO_ASSERT(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+    cxn->sd = sv[0];
+    cxn->cxn_id = 0xffff;
+    cxn->active = 1;
+    cxn->status.state = INDIGO_CXN_S_HANDSHAKE_COMPLETE;
+    cxn->status.negotiated_version = OF_VERSION_1_3;
+    OK(ind_soc_socket_register(sv[0], test_cxn_ready, NULL));
+}
+
+static void
+test_cxn_close(connection_t *cxn, int sv[2])
+{
+    uint8_t buf[4096];
+    int cls;
+
+    while (cxn->pkts_enqueued > 0) {
+        INDIGO_ASSERT(ind_cxn_process_write_buffer(cxn) >= 0);
+        while (read(sv[1], buf, sizeof(buf)) > 0);
+    }
+
+    OK(ind_soc_socket_unregister(sv[0]));
+    for (cls = 0; cls < CXN_OUTPUT_CLASS_COUNT; cls++) {
+        INDIGO_MEM_FREE(cxn->output[cls].ring);
+    }
+    ind_cxn_instance_release(cxn);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/* Write the OpenFlow 1.3 header of a message and return its length */
+static int
+test_msg_header(uint8_t *buf, uint8_t type, int len, uint32_t xid)
+{
+    buf[0] = OF_VERSION_1_3;
+    buf[1] = type;
+    buf[2] = len >> 8;
+    buf[3] = len & 0xff;
+    buf[4] = xid >> 24;
+    buf[5] = xid >> 16;
+    buf[6] = xid >> 8;
+    buf[7] = xid;
+    return len;
+}
+
+/* Flush the connection's output and read it as the controller */
+static int
+test_cxn_output_read(connection_t *cxn, int sv[2], uint8_t *buf, int len)
+{
+    int bytes = 0, rv;
+
+    while (bytes < len) {
+        if (cxn->pkts_enqueued > 0) {
+            INDIGO_ASSERT(ind_cxn_process_write_buffer(cxn) >= 0);
+        }
+        if ((rv = read(sv[1], buf + bytes, len - bytes)) > 0) {
+            bytes += rv;
+        } else if (cxn->pkts_enqueued == 0) {
+            break;
+        }
+    }
+
+    return bytes;
+}
+
+#define TEST_MSG_XID(buf) \
+    (((buf)[4] << 24) | ((buf)[5] << 16) | ((buf)[6] << 8) | (buf)[7])
+
+static void
+test_read_framing(void)
+{
+    connection_t cxn;
+    uint8_t buf[256];
+    int sv[2], len = 0, echo;
+
+    test_cxn_open(&cxn, sv);
+
+    /* An echo with data, a features request and half of another echo */
+    len += test_msg_header(buf + len, 2, 12, 1);
+    memcpy(buf + len - 4, "abcd", 4);
+    len += test_msg_header(buf + len, 5, 8, 2);
+    echo = len;
+    len += test_msg_header(buf + len, 2, 8, 3);
+    INDIGO_ASSERT(write(sv[1], buf, len - 4) == len - 4);
+
+    /* One read frames both complete messages and keeps the partial one */
+    got_cxn_msg = 0;
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.status.messages_in == 2);
+    INDIGO_ASSERT(got_cxn_msg);
+    INDIGO_ASSERT(cxn.read_bytes - cxn.read_offset == 4);
+    INDIGO_ASSERT(memcmp(&cxn.read_buffer[cxn.read_offset], buf + echo, 4) == 0);
+
+    /* The rest completes it and the drained buffer is released */
+    INDIGO_ASSERT(write(sv[1], buf + len - 4, 4) == 4);
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.status.messages_in == 3);
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+
+    /* Both echoes were answered in order */
+    INDIGO_ASSERT(test_cxn_output_read(&cxn, sv, buf, sizeof(buf)) == 20);
+    INDIGO_ASSERT(buf[1] == 3 && TEST_MSG_XID(buf) == 1);
+    INDIGO_ASSERT(memcmp(buf + 8, "abcd", 4) == 0);
+    INDIGO_ASSERT(buf[13] == 3 && TEST_MSG_XID(buf + 12) == 3);
+
+    /* A length shorter than the header is a framing error */
+    test_msg_header(buf, 2, 4, 4);
+    INDIGO_ASSERT(write(sv[1], buf, 8) == 8);
+    INDIGO_ASSERT(ind_cxn_process_read_buffer(&cxn) == INDIGO_ERROR_PROTOCOL);
+    cxn.read_offset = cxn.read_bytes;
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+
+    test_cxn_close(&cxn, sv);
+}
+
+static void
+test_read_in_place(void)
+{
+    connection_t cxn;
+    cxn_rx_segment_t *seg;
+    of_object_t *obj;
+    uint8_t buf[64], *data;
+    uint32_t xid;
+    int sv[2], len = 0;
+
+    test_cxn_open(&cxn, sv);
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+
+    len += test_msg_header(buf + len, 5, 8, 5);
+    len += test_msg_header(buf + len, 2, 8, 6);
+    INDIGO_ASSERT(write(sv[1], buf, len - 4) == len - 4);
+
+    /* The object points into the read segment and holds a reference */
+    hold_msgs = 1;
+    OK(ind_cxn_process_read_buffer(&cxn));
+    hold_msgs = 0;
+    INDIGO_ASSERT((obj = held_msg) != NULL);
+    held_msg = NULL;
+    INDIGO_ASSERT(obj->object_id == OF_FEATURES_REQUEST);
+    seg = cxn.read_segment;
+    INDIGO_ASSERT(seg != NULL && seg->refcount == 2);
+    INDIGO_ASSERT(OF_OBJECT_BUFFER_INDEX(obj, 0) == seg->data);
+
+    /* Draining the buffer drops the connection's reference only */
+    INDIGO_ASSERT(write(sv[1], buf + len - 4, 4) == 4);
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+    INDIGO_ASSERT(seg->refcount == 1);
+    of_features_request_xid_get(obj, &xid);
+    INDIGO_ASSERT(xid == 5);
+
+    /* Stealing the buffer copies the message out of the segment */
+    OK(ind_cxn_wire_buffer_steal(obj, &data));
+    INDIGO_ASSERT(data != seg->data);
+    INDIGO_ASSERT(memcmp(data, buf, 8) == 0);
+    ind_cxn_msg_data_free(data);
+
+    /* Deleting the object frees the segment for the next read */
+    of_object_delete(obj);
+    INDIGO_ASSERT(write(sv[1], buf + 8, 4) == 4);
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.read_segment == seg && seg->refcount == 1);
+    INDIGO_ASSERT(write(sv[1], buf + 12, 4) == 4);
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+
+    test_cxn_close(&cxn, sv);
+}
+
+static void
+test_cxn_enqueue_header(connection_t *cxn, cxn_output_class_t cls,
+                        uint8_t type, uint32_t xid)
+{
+    uint8_t *data;
+
+    INDIGO_ASSERT((data = ind_cxn_msg_buffer_alloc(8)) != NULL);
+    OK(ind_cxn_instance_enqueue(cxn, cls, data,
+                                test_msg_header(data, type, 8, xid)));
+}
+
+static void
+test_output_ring(void)
+{
+    connection_t cxn;
+    uint8_t buf[8 * 128];
+    int sv[2], i;
+
+    test_cxn_open(&cxn, sv);
+
+    /* Advance the head so that later messages wrap around the ring */
+    for (i = 0; i < 16; i++) {
+        test_cxn_enqueue_header(&cxn, CXN_OUTPUT_CLASS_BULK, 19, i);
+    }
+    INDIGO_ASSERT(cxn.output[CXN_OUTPUT_CLASS_BULK].size ==
+                  CXN_OUTPUT_RING_INIT_SIZE);
+    INDIGO_ASSERT(test_cxn_output_read(&cxn, sv, buf, sizeof(buf)) == 16 * 8);
+    INDIGO_ASSERT(cxn.output[CXN_OUTPUT_CLASS_BULK].head == 16);
+
+    /* Grow while wrapped, with a control message queued partway through */
+    for (i = 0; i < 100; i++) {
+        if (i == 50) {
+            test_cxn_enqueue_header(&cxn, CXN_OUTPUT_CLASS_CONTROL, 3, 999);
+        }
+        test_cxn_enqueue_header(&cxn, CXN_OUTPUT_CLASS_BULK, 19, 100 + i);
+    }
+    INDIGO_ASSERT(cxn.output[CXN_OUTPUT_CLASS_BULK].size ==
+                  2 * CXN_OUTPUT_RING_INIT_SIZE);
+    INDIGO_ASSERT(cxn.output[CXN_OUTPUT_CLASS_BULK].pkts == 100);
+    INDIGO_ASSERT(cxn.pkts_enqueued == 101);
+    INDIGO_ASSERT(cxn.bytes_enqueued == 101 * 8);
+
+    /* The control message goes first, then the bulk ones in order */
+    INDIGO_ASSERT(test_cxn_output_read(&cxn, sv, buf, sizeof(buf)) == 101 * 8);
+    INDIGO_ASSERT(TEST_MSG_XID(buf) == 999);
+    for (i = 0; i < 100; i++) {
+        INDIGO_ASSERT(TEST_MSG_XID(buf + 8 * (i + 1)) == 100 + i);
+    }
+    INDIGO_ASSERT(cxn.bytes_enqueued == 0);
+    INDIGO_ASSERT(cxn.output[CXN_OUTPUT_CLASS_BULK].bytes == 0);
+
+    test_cxn_close(&cxn, sv);
+}
+
+static void
+test_shared_fanout(void)
+{
+    connection_t cxns[2];
+    cxn_shared_msg_t *shared;
+    uint8_t *data, *other, buf[64];
+    int sv[2][2], i;
+
+    for (i = 0; i < 2; i++) {
+        test_cxn_open(&cxns[i], sv[i]);
+    }
+
+    INDIGO_ASSERT((data = ind_cxn_msg_buffer_alloc(16)) != NULL);
+    INDIGO_MEM_CLEAR(data, 16);
+    test_msg_header(data, 10, 16, 42);
+    INDIGO_ASSERT((shared = ind_cxn_shared_msg_new(data, 16)) != NULL);
+
+    /* Each write queue takes a reference on the one buffer */
+    for (i = 0; i < 2; i++) {
+        OK(ind_cxn_instance_enqueue_shared(&cxns[i], CXN_OUTPUT_CLASS_ASYNC,
+                                           shared));
+    }
+    INDIGO_ASSERT(shared->refcount == 3);
+    ind_cxn_shared_msg_unref(shared);
+
+    /* Still in use after the first connection has written it */
+    INDIGO_ASSERT(test_cxn_output_read(&cxns[0], sv[0], buf, sizeof(buf)) == 16);
+    INDIGO_ASSERT(memcmp(buf, data, 16) == 0);
+    INDIGO_ASSERT(shared->refcount == 1);
+    INDIGO_ASSERT((other = ind_cxn_msg_buffer_alloc(16)) != data);
+    ind_cxn_msg_data_free(other);
+
+    /* Freed by the last one */
+    INDIGO_ASSERT(test_cxn_output_read(&cxns[1], sv[1], buf, sizeof(buf)) == 16);
+    INDIGO_ASSERT(buf[1] == 10 && TEST_MSG_XID(buf) == 42);
+    INDIGO_ASSERT(ind_cxn_msg_buffer_alloc(16) == data);
+
+    /* A refused enqueue takes no reference */
+    test_msg_header(data, 10, 16, 43);
+    INDIGO_ASSERT((shared = ind_cxn_shared_msg_new(data, 12)) != NULL);
+    INDIGO_ASSERT(ind_cxn_instance_enqueue_shared(&cxns[0],
+                                                  CXN_OUTPUT_CLASS_ASYNC,
+                                                  shared) < 0);
+    INDIGO_ASSERT(shared->refcount == 1 && cxns[0].pkts_enqueued == 0);
+    ind_cxn_shared_msg_unref(shared);
+
+    for (i = 0; i < 2; i++) {
+        test_cxn_close(&cxns[i], sv[i]);
+    }
+}
+
+static void
+test_read_buffer_lifetime(void)
+{
+    static uint8_t buf[100000];
+    connection_t cxn;
+    int sv[2], len = 50000;
+
+    test_cxn_open(&cxn, sv);
+
+    /* Nothing is allocated for an idle connection */
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+    INDIGO_ASSERT(cxn.counters == NULL);
+
+    /* A large message and most of another */
+    INDIGO_MEM_CLEAR(buf, sizeof(buf));
+    test_msg_header(buf, 2, len, 1);
+    test_msg_header(buf + len, 2, len, 2);
+    INDIGO_ASSERT(write(sv[1], buf, len + 30000) == len + 30000);
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.status.messages_in == 1);
+    INDIGO_ASSERT(cxn.counters != NULL);
+    INDIGO_ASSERT(cxn.counters->in_by_type[OF_ECHO_REQUEST] == 1);
+    INDIGO_ASSERT(cxn.read_offset == len && cxn.read_bytes == len + 30000);
+
+    /* Too little room is left, so the partial message moves to the front */
+    INDIGO_ASSERT(write(sv[1], buf + len + 30000, 20000) == 20000);
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.status.messages_in == 2);
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+
+    INDIGO_ASSERT(test_cxn_output_read(&cxn, sv, buf, sizeof(buf)) == 2 * len);
+    INDIGO_ASSERT(TEST_MSG_XID(buf) == 1 && TEST_MSG_XID(buf + len) == 2);
+
+    /* Counters go when the slot is released */
+    ind_cxn_instance_release(&cxn);
+    INDIGO_ASSERT(cxn.counters == NULL);
+
+    test_cxn_close(&cxn, sv);
+}
+
+static void
+test_raw_keepalive(void)
+{
+    connection_t cxn;
+    uint8_t buf[64];
+    int sv[2], len = 0;
+
+    test_cxn_open(&cxn, sv);
+    cxn.keepalive.xid = 77;
+    cxn.keepalive.outstanding_echo_cnt = 2;
+
+    /* An echo reply, a barrier and an echo request with data */
+    len += test_msg_header(buf + len, 3, 8, 77);
+    len += test_msg_header(buf + len, 20, 8, 7);
+    len += test_msg_header(buf + len, 2, 10, 8);
+    memcpy(buf + len - 2, "hi", 2);
+    INDIGO_ASSERT(write(sv[1], buf, len) == len);
+
+    /* All answered from the header; nothing is passed on */
+    got_cxn_msg = 0;
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(!got_cxn_msg);
+    INDIGO_ASSERT(cxn.status.messages_in == 3);
+    INDIGO_ASSERT(cxn.keepalive.outstanding_echo_cnt == 0);
+    INDIGO_ASSERT(cxn.counters->in_by_type[OF_ECHO_REPLY] == 1);
+    INDIGO_ASSERT(cxn.counters->in_by_type[OF_BARRIER_REQUEST] == 1);
+    INDIGO_ASSERT(cxn.counters->in_by_type[OF_ECHO_REQUEST] == 1);
+    INDIGO_ASSERT(cxn.counters->out_by_type[OF_ECHO_REPLY] == 1);
+    INDIGO_ASSERT(cxn.counters->out_by_type[OF_BARRIER_REPLY] == 1);
+    INDIGO_ASSERT(cxn.read_segment == NULL);
+
+    /* The echo reply goes ahead of the barrier reply */
+    INDIGO_ASSERT(test_cxn_output_read(&cxn, sv, buf, sizeof(buf)) == 18);
+    INDIGO_ASSERT(buf[0] == OF_VERSION_1_3 && buf[1] == 3 && buf[3] == 10);
+    INDIGO_ASSERT(TEST_MSG_XID(buf) == 8 && memcmp(buf + 8, "hi", 2) == 0);
+    INDIGO_ASSERT(buf[11] == 21 && buf[13] == 8 && TEST_MSG_XID(buf + 10) == 7);
+
+    test_cxn_close(&cxn, sv);
+}
+
+static void
+test_keepalive_deadline(void)
+{
+    connection_t cxn;
+    indigo_time_us_t now = ind_soc_loop_now_us(), due;
+    uint8_t buf[8];
+    uint32_t xid;
+    int sv[2];
+
+    test_cxn_open(&cxn, sv);
+    cxn.keepalive.period_ms = 100;
+    cxn.keepalive.threshold = 3;
+    cxn.keepalive.next_echo = due = now + 100000;
+
+    /* Nothing is sent before the deadline */
+    ind_cxn_keepalive_check(&cxn, due - 1);
+    INDIGO_ASSERT(cxn.keepalive.outstanding_echo_cnt == 0);
+    INDIGO_ASSERT(cxn.keepalive.next_echo == due);
+
+    /* At the deadline an echo goes out and the next one is a period away */
+    xid = cxn.keepalive.xid;
+    ind_cxn_keepalive_check(&cxn, due);
+    INDIGO_ASSERT(cxn.keepalive.outstanding_echo_cnt == 1);
+    INDIGO_ASSERT(cxn.keepalive.xid != xid);
+    INDIGO_ASSERT(cxn.keepalive.next_echo >= now + 100000);
+    INDIGO_ASSERT(cxn.keepalive.next_echo <= ind_soc_loop_now_us() + 100000);
+
+    /* Disabled keepalives and unfinished handshakes are skipped */
+    cxn.keepalive.period_ms = 0;
+    ind_cxn_keepalive_check(&cxn, due + 1000000);
+    INDIGO_ASSERT(cxn.keepalive.outstanding_echo_cnt == 1);
+    cxn.keepalive.period_ms = 100;
+    cxn.status.state = INDIGO_CXN_S_CONNECTING;
+    ind_cxn_keepalive_check(&cxn, due + 1000000);
+    INDIGO_ASSERT(cxn.keepalive.outstanding_echo_cnt == 1);
+    cxn.status.state = INDIGO_CXN_S_HANDSHAKE_COMPLETE;
+
+    /* Any message from the controller clears the outstanding count */
+    test_msg_header(buf, 3, 8, 12345);
+    INDIGO_ASSERT(write(sv[1], buf, 8) == 8);
+    OK(ind_cxn_process_read_buffer(&cxn));
+    INDIGO_ASSERT(cxn.keepalive.outstanding_echo_cnt == 0);
+#if OFCONNECTIONMANAGER_CONFIG_ECHO_OPTIMIZATION == 1
+    /* ... and puts off the next echo */
+    INDIGO_ASSERT(cxn.keepalive.last_rx >= now);
+    ind_cxn_keepalive_check(&cxn, cxn.keepalive.last_rx + 100000 - 1);
+    INDIGO_ASSERT(cxn.keepalive.outstanding_echo_cnt == 0);
+#endif
+
+    test_cxn_close(&cxn, sv);
+}
+
+/* A packet-in of len bytes from port, with id as its last data byte */
+static of_packet_in_t *
+fq_packet_in(of_port_no_t port, int len, uint8_t id)
+{
+    static uint8_t data[65536];
+    of_packet_in_t *obj;
+    of_octets_t octets;
+    of_match_t match;
+
+    INDIGO_ASSERT((obj = of_packet_in_new(OF_VERSION_1_3)) != NULL);
+    of_packet_in_reason_set(obj, OF_PACKET_IN_REASON_ACTION);
+    INDIGO_MEM_CLEAR(&match, sizeof(match));
+    match.version = OF_VERSION_1_3;
+    match.fields.in_port = port;
+    match.masks.in_port = 0xffffffff;
+    OK(of_packet_in_match_set(obj, &match));
+
+    octets.data = data;
+    octets.bytes = len - obj->length;
+    data[octets.bytes - 1] = id;
+    OK(of_packet_in_data_set(obj, &octets));
+    INDIGO_ASSERT(obj->length == len);
+
+    return obj;
+}
+
+/* Read from the switch, collecting the ids of packet-ins of len bytes */
+static int
+fq_controller_read(int sd, int len, uint8_t *ids, int max)
+{
+    static uint8_t buf[2 * 65536];
+    static int bytes;
+    int msg_len, rv, count = 0;
+
+    while ((rv = read(sd, buf + bytes, sizeof(buf) - bytes)) > 0) {
+        bytes += rv;
+        while (bytes >= 8 && bytes >= (msg_len = (buf[2] << 8) | buf[3])) {
+            if (buf[1] == 10 && msg_len == len) {
+                INDIGO_ASSERT(count < max);
+                ids[count++] = buf[msg_len - 1];
+            }
+            memmove(buf, buf + msg_len, bytes - msg_len);
+            bytes -= msg_len;
+        }
+    }
+
+    return count;
+}
+
+#define FQ_SMALL_LEN 1400
+
+static void
+test_packet_in_fair_queue(void)
+{
+    const int async_max = ind_cxn_output_bytes_max[CXN_OUTPUT_CLASS_ASYNC];
+    ind_cxn_rate_limits_t limits;
+    indigo_cxn_protocol_params_t params;
+    indigo_cxn_config_params_t config;
+    indigo_cxn_status_t status;
+    indigo_cxn_id_t cxn_id;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    uint8_t buf[16], ids[8];
+    int lsd, sd = -1, num_ids = 0, i;
+
+    /* The test is the controller, listening on an ephemeral port */
+    INDIGO_ASSERT((lsd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+    INDIGO_MEM_CLEAR(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    INDIGO_ASSERT(bind(lsd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    INDIGO_ASSERT(listen(lsd, 1) == 0);
+    INDIGO_ASSERT(getsockname(lsd, (struct sockaddr *)&addr, &addrlen) == 0);
+    INDIGO_ASSERT(fcntl(lsd, F_SETFL, O_NONBLOCK) == 0);
+
+    INDIGO_MEM_CLEAR(&limits, sizeof(limits));
+    limits.packet_in_fair_queue.depth = 2;
+    ind_cxn_rate_limits_set(&limits);
+
+    INDIGO_MEM_CLEAR(&params, sizeof(params));
+    params.tcp_over_ipv4.protocol = INDIGO_CXN_PROTO_TCP_OVER_IPV4;
+    sprintf(params.tcp_over_ipv4.controller_ip, "%s", CONTROLLER_IP);
+    params.tcp_over_ipv4.controller_port = ntohs(addr.sin_port);
+    INDIGO_MEM_CLEAR(&config, sizeof(config));
+    config.version = OF_VERSION_1_3;
+    OK(indigo_cxn_connection_add(&params, &config, &cxn_id));
+
+    for (i = 0; i < 100 && sd < 0; i++) {
+        (void)ind_soc_select_and_run(10);
+        sd = accept(lsd, NULL, NULL);
+    }
+    INDIGO_ASSERT(sd >= 0);
+    INDIGO_ASSERT(fcntl(sd, F_SETFL, O_NONBLOCK) == 0);
+
+    /* Hello and features request; cxn_msg_rx sends the features reply */
+    test_msg_header(buf, 0, 8, 1);
+    test_msg_header(buf + 8, 5, 8, 2);
+    INDIGO_ASSERT(write(sd, buf, 16) == 16);
+    for (i = 0; i < 100; i++) {
+        (void)ind_soc_select_and_run(10);
+        OK(indigo_cxn_connection_status_get(cxn_id, &status));
+        if (status.state == INDIGO_CXN_S_HANDSHAKE_COMPLETE) {
+            break;
+        }
+    }
+    INDIGO_ASSERT(status.state == INDIGO_CXN_S_HANDSHAKE_COMPLETE);
+    (void)ind_soc_select_and_run(10);
+    INDIGO_ASSERT(fq_controller_read(sd, FQ_SMALL_LEN, ids, 0) == 0);
+
+    /* Fill the async queue; the loop is not run, so nothing is written */
+    for (i = 0; i < 16; i++) {
+        indigo_cxn_send_async_message(fq_packet_in(3, 65000, 0x99));
+    }
+    indigo_cxn_send_async_message(
+        fq_packet_in(3, async_max - 16 * 65000 - FQ_SMALL_LEN / 2, 0x99));
+
+    /* Storms from two ports; each queue keeps two packet-ins */
+    for (i = 1; i <= 3; i++) {
+        indigo_cxn_send_async_message(fq_packet_in(1, FQ_SMALL_LEN, 0x10 + i));
+    }
+    for (i = 1; i <= 3; i++) {
+        indigo_cxn_send_async_message(fq_packet_in(2, FQ_SMALL_LEN, 0x20 + i));
+    }
+
+    /* As the output drains, the ports take turns */
+    for (i = 0; i < 200 && num_ids < 4; i++) {
+        (void)ind_soc_select_and_run(10);
+        num_ids += fq_controller_read(sd, FQ_SMALL_LEN, ids + num_ids,
+                                      sizeof(ids) - num_ids);
+    }
+    for (i = 0; i < 10; i++) {
+        (void)ind_soc_select_and_run(10);
+        num_ids += fq_controller_read(sd, FQ_SMALL_LEN, ids + num_ids,
+                                      sizeof(ids) - num_ids);
+    }
+    INDIGO_ASSERT(num_ids == 4);
+    INDIGO_ASSERT(ids[0] == 0x11 && ids[1] == 0x21);
+    INDIGO_ASSERT(ids[2] == 0x12 && ids[3] == 0x22);
+
+    OK(indigo_cxn_connection_remove(cxn_id));
+    for (i = 0; i < 10; i++) {
+        (void)ind_soc_select_and_run(10);
+    }
+    close(sd);
+    close(lsd);
+
+    INDIGO_MEM_CLEAR(&limits, sizeof(limits));
+    ind_cxn_rate_limits_set(&limits);
+}
+
+static void
+test_socket_options(void)
+{
+    connection_t cxn;
+    int value;
+    socklen_t len;
+
+    INDIGO_MEM_CLEAR(&cxn, sizeof(cxn));
+    INDIGO_ASSERT((cxn.sd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+
+    /* Defaults only disable Nagle's algorithm */
+    ind_cxn_socket_options_set(&cxn);
+    len = sizeof(value);
+    INDIGO_ASSERT(getsockopt(cxn.sd, IPPROTO_TCP, TCP_NODELAY,
+                             &value, &len) == 0);
+    INDIGO_ASSERT(value != 0);
+
+    cxn.config_params.socket.rcvbuf = 65536;
+    cxn.config_params.socket.dscp = 46;
+    ind_cxn_socket_options_set(&cxn);
+    len = sizeof(value);
+    INDIGO_ASSERT(getsockopt(cxn.sd, SOL_SOCKET, SO_RCVBUF,
+                             &value, &len) == 0);
+    INDIGO_ASSERT(value >= 65536);
+    len = sizeof(value);
+    INDIGO_ASSERT(getsockopt(cxn.sd, IPPROTO_IP, IP_TOS, &value, &len) == 0);
+    INDIGO_ASSERT(value == 46 << 2);
+
+    close(cxn.sd);
+}
+
+static void
+test_shm_transport(void)
+{
+    ind_cxn_shm_ring_t *ring;
+    ind_cxn_shm_region_t *region;
+    ind_cxn_shm_hello_t hello;
+    cxn_shm_t *shm;
+    uint8_t msg[100], buf[200];
+    struct iovec iov[2];
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(int) * IND_CXN_SHM_FDS)];
+    } control;
+    struct msghdr mh;
+    struct cmsghdr *cmsg;
+    int fds[IND_CXN_SHM_FDS];
+    int sv[2], data_fd, was_empty, i;
+
+    INDIGO_ASSERT((ring = calloc(1, sizeof(*ring))) != NULL);
+    for (i = 0; i < sizeof(msg); i++) {
+        msg[i] = i;
+    }
+
+    /* Start near the end so the data wraps around */
+    ring->head = ring->tail = IND_CXN_SHM_RING_SIZE - 30;
+    iov[0].iov_base = msg;
+    iov[0].iov_len = 40;
+    iov[1].iov_base = msg + 40;
+    iov[1].iov_len = 60;
+    INDIGO_ASSERT(ind_cxn_shm_ring_put(ring, iov, 2, &was_empty) == 100);
+    INDIGO_ASSERT(was_empty);
+    INDIGO_ASSERT(ind_cxn_shm_ring_put(ring, iov, 1, &was_empty) == 40);
+    INDIGO_ASSERT(!was_empty);
+
+    INDIGO_ASSERT(ind_cxn_shm_ring_get(ring, buf, sizeof(buf)) == 140);
+    INDIGO_ASSERT(memcmp(buf, msg, 100) == 0);
+    INDIGO_ASSERT(memcmp(buf + 100, msg, 40) == 0);
+    INDIGO_ASSERT(ind_cxn_shm_ring_get(ring, buf, sizeof(buf)) == 0);
+
+    /* A full ring takes no more */
+    ring->head = ring->tail + IND_CXN_SHM_RING_SIZE - 10;
+    INDIGO_ASSERT(ind_cxn_shm_ring_put(ring, iov, 2, &was_empty) == 10);
+    INDIGO_ASSERT(ind_cxn_shm_ring_put(ring, iov, 2, &was_empty) == 0);
+    free(ring);
+
+    /* The client gets the hello, the region and the eventfds */
+    INDIGO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    OK(ind_cxn_shm_accept(sv[0], &shm, &data_fd));
+
+    iov[0].iov_base = &hello;
+    iov[0].iov_len = sizeof(hello);
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    INDIGO_ASSERT(recvmsg(sv[1], &mh, 0) == sizeof(hello));
+    INDIGO_ASSERT(hello.magic == IND_CXN_SHM_MAGIC);
+    INDIGO_ASSERT(hello.region_size == sizeof(*region));
+    INDIGO_ASSERT((cmsg = CMSG_FIRSTHDR(&mh)) != NULL);
+    INDIGO_ASSERT(cmsg->cmsg_type == SCM_RIGHTS);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    region = mmap(NULL, sizeof(*region), PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fds[IND_CXN_SHM_FD_REGION], 0);
+    INDIGO_ASSERT(region != MAP_FAILED);
+    INDIGO_ASSERT(region->ring_size == IND_CXN_SHM_RING_SIZE);
+
+    munmap(region, sizeof(*region));
+    for (i = 0; i < IND_CXN_SHM_FDS; i++) {
+        close(fds[i]);
+    }
+    ind_cxn_shm_destroy(shm);
+    close(data_fd);
+    close(sv[1]);
+}
+
 int main(int argc, char* argv[])
 {
     int cxn_id;
     int idx;
-    ind_soc_config_t config; /* Currently ignored */
+    ind_soc_config_t config = { 0 };
 
     INDIGO_MEM_CLEAR(&config, sizeof(config));
     OK(ind_soc_init(&config));
@@ -166,6 +1179,23 @@ int main(int argc, char* argv[])
 
     OK(indigo_cxn_connection_remove(cxn_id));
 
+    test_packet_in_pool();
+    test_msg_buffer_pool();
+    test_trace_ring();
+    test_async_config();
+    test_packet_in_meter();
+    test_output_backpressure();
+    test_read_framing();
+    test_read_in_place();
+    test_output_ring();
+    test_shared_fanout();
+    test_read_buffer_lifetime();
+    test_raw_keepalive();
+    test_keepalive_deadline();
+    test_packet_in_fair_queue();
+    test_socket_options();
+    test_shm_transport();
+
     OK(ind_cxn_enable_set(0));
     OK(ind_cxn_finish());
 
@@ -47,11 +47,63 @@
 #define IND_CORE_DP_DESC_DEFAULT "Virtual forwarding module"
 #define IND_CORE_SERIAL_NUM_DEFAULT "11235813213455"
 
+/**
+ * @brief Maximum number of cookie indexes in the flowtable
+ */
+
+#define IND_CORE_COOKIE_INDEXES_MAX 4
+
 typedef struct ind_core_config_s {
     int expire_flows;   /**< Boolean, should state mgr manage flow expires */
     int stats_check_ms; /**< How frequently to check stats for expire, etc */
     indigo_core_disconnected_mode_t disconnected_mode;
     int max_flowtable_entries; /**< Maximum number of entries in the flowtable */
+    /**
+     * Cookie bits to index flows by, for cookie-masked modify, delete and
+     * stats requests. A zero mask ends the list; all zero indexes the top
+     * 8 bits.
+     */
+    uint64_t cookie_index_masks[IND_CORE_COOKIE_INDEXES_MAX];
+    /**
+     * How often to refresh the cached flow counters used for flow and
+     * aggregate stats replies, and how long VLAN, group and table
+     * counters may be reused. 0 disables the cache and reads the
+     * counters from Forwarding for every request.
+     */
+    int counter_cache_ms;
+    /**
+     * How long a snapshot of the port and queue counters may be reused
+     * for port, queue and BSN port counter stats replies. 0 disables
+     * the snapshot and reads the counters for every request.
+     */
+    int port_stats_cache_ms;
+    /**
+     * How long to hold port status updates so that only the latest one
+     * for each port is delivered. 0 delivers every update immediately.
+     */
+    int port_status_coalesce_ms;
+    /**
+     * Half-life of the penalty used to suppress updates for flapping
+     * ports, if port_status_coalesce_ms is nonzero. 0 disables
+     * dampening.
+     */
+    int port_status_dampening_half_life_ms;
+    /**
+     * Number of threads encoding flow stats replies from snapshots of
+     * the matching flows. 0 encodes them on the event loop.
+     */
+    int flow_stats_workers;
+    /**
+     * Allocate flow and gentable entries from huge page arenas, to cut
+     * TLB misses when iterating over large tables. Only takes effect if
+     * set on the first ind_core_init.
+     */
+    int huge_pages;
+    /**
+     * NUMA node for the huge page arenas, or -1 to leave placement to
+     * the kernel.
+     */
+    int huge_pages_numa_node;
 } ind_core_config_t;
 
 
@@ -97,20 +149,93 @@ indigo_error_t ind_core_serial_num_get(of_serial_num_t serial_num);
 
 /**
  * Dump all entries in the flow table.
- * This is verbose.
+ * This is verbose. May be called from any thread.
  */
 void ind_core_ft_dump(aim_pvs_t* pvs);
 
 /**
  * Show all entries in the flow table.
- * Human readable.
+ * Human readable. May be called from any thread.
  */
 void ind_core_ft_show(aim_pvs_t* pvs);
 
+/**
+ * Flows to include in ind_core_ft_show_start
+ */
+typedef struct ind_core_ft_filter_s {
+    int table_id;           /**< Table, or -1 for all */
+    uint64_t cookie;        /**< Cookie bits to match under cookie_mask */
+    uint64_t cookie_mask;   /**< 0 for any cookie */
+    of_port_no_t out_port;  /**< Output port, or OF_PORT_DEST_WILDCARD */
+} ind_core_ft_filter_t;
+
+/**
+ * Initialize a filter to include every flow
+ */
+void ind_core_ft_filter_init(ind_core_ft_filter_t *filter);
+
+/**
+ * Called once ind_core_ft_show_start has written every flow
+ * @param cookie Passed to ind_core_ft_show_start
+ * @param count Number of flows written
+ */
+typedef void (*ind_core_ft_show_done_f)(void *cookie, int count);
+
+/**
+ * Write the matching flows from a background task
+ * @param pvs Output; must stay valid until done is called
+ * @param filter Flows to include, or NULL for all
+ * @param verbose Use the ind_core_ft_dump format instead of the
+ * ind_core_ft_show one
+ * @param done Called from the event loop after the last flow, or NULL
+ * @param cookie Passed to done
+ *
+ * The flowtable is walked a slice at a time by a low priority event loop
+ * task, so a large table does not stall the control plane. Flows added
+ * or removed while the task runs may or may not be written.
+ */
+indigo_error_t ind_core_ft_show_start(aim_pvs_t *pvs,
+                                      const ind_core_ft_filter_t *filter,
+                                      bool verbose,
+                                      ind_core_ft_show_done_f done,
+                                      void *cookie);
+
 /**
  * Show basic stats about a flow table
  */
 void ind_core_ft_stats(aim_pvs_t* pvs);
 
+/**
+ * Show per-gentable operation counts, failures, resync traffic and
+ * latency histograms
+ */
+void ind_core_gentable_stats_show(aim_pvs_t* pvs);
+
+/**
+ * Reset the stats shown by ind_core_gentable_stats_show
+ */
+void ind_core_gentable_stats_clear(void);
+
+/**
+ * Show the count and handler time of each controller message type
+ */
+void ind_core_message_stats_show(aim_pvs_t* pvs);
+
+/**
+ * Reset the stats shown by ind_core_message_stats_show
+ */
+void ind_core_message_stats_clear(void);
+
+/**
+ * Show the call count, error count and latency of each forwarding and
+ * port manager function called
+ */
+void ind_core_driver_stats_show(aim_pvs_t* pvs);
+
+/**
+ * Reset the stats shown by ind_core_driver_stats_show
+ */
+void ind_core_driver_stats_clear(void);
+
 #endif /* __OFSTATEMANAGER_H__ */
 /** @} */
@@ -119,6 +119,136 @@
 #define OFSTATEMANAGER_CONFIG_DPID_DEFAULT 55930
 #endif
 
+/**
+ * OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX
+ *
+ * Maximum number of flow operations in one forwarding batch */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX
+#define OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX 64
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX
+ *
+ * Maximum number of packet-outs in one forwarding batch */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX
+#define OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX 64
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_MAX_BUNDLES
+ *
+ * Maximum number of open bundles across all connections */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_MAX_BUNDLES
+#define OFSTATEMANAGER_CONFIG_MAX_BUNDLES 16
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS
+ *
+ * Maximum number of messages staged in one bundle */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS
+#define OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS 65536
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX
+ *
+ * Maximum number of flows in one bulk hit status read */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX
+#define OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX 256
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX
+ *
+ * Maximum number of flow-removed messages coalesced into one run */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX
+#define OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX 64
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX
+ *
+ * Maximum number of flows in one bulk flow stats read */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX
+#define OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX 256
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS
+ *
+ * Maximum number of connections tracked for delta flow stats */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS
+#define OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS 16
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS
+ *
+ * Maximum number of connections with a paginated flow stats walk in progress */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS
+#define OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS 16
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE
+ *
+ * Flows in a paginated flow stats page if the request does not say */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE
+#define OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE 1024
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS
+ *
+ * Maximum number of flow monitors across all connections */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS
+#define OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS 32
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX
+ *
+ * Maximum number of gentable requests in one batch */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX
+#define OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX 256
+#endif
+
+/**
+ * OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES
+ *
+ * Maximum number of secondary indexes on one gentable */
+
+
+#ifndef OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES
+#define OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES 2
+#endif
+
 
 
 /**
@@ -25,15 +25,43 @@
 #include "ofstatemanager_log.h"
 
 #include <OFStateManager/ofstatemanager_config.h>
+#include <OFConnectionManager/ofconnectionmanager.h>
 #include <indigo/indigo.h>
 #include <indigo/forwarding.h>
 #include <indigo/port_manager.h>
 #include <loci/loci.h>
 #include "handlers.h"
+#include "port_stats.h"
+#include "counter_cache.h"
+#include "driver_stats.h"
 
 /* TODO move into LOXI */
 #define OF_BSN_VLAN_ALL 0xffff
 
+/* Counters read from Forwarding or PortManager in one call */
+#define COUNTER_STATS_BATCH_MAX 64
+
+/*
+ * State for a VLAN_ALL or port ALL counter stats request
+ *
+ * Runs as a task, reading COUNTER_STATS_BATCH_MAX VLANs or ports at a
+ * time, so a large request does not stall the event loop.
+ */
+struct ind_core_bsn_counter_stats_state {
+    ind_soc_task_t task;
+    of_object_t *req;
+    indigo_cxn_id_t cxn_id;
+    of_object_t *reply;
+    uint32_t xid;
+    int done;
+    uint16_t next_vid;          /* VLAN requests */
+    of_port_no_t *port_nos;     /* Port requests; snapshot of the ports */
+    int num_ports;
+    int next_idx;
+};
+
+static ind_soc_task_status_t counter_stats_task(void *cookie);
+
 static void
 append_uint64(of_list_uint64_t *list, uint64_t value)
 {
@@ -57,23 +85,264 @@ truncate_of_object(of_object_t *obj)
 
 static void
 ind_core_bsn_vlan_counter_stats_entry_populate(of_bsn_vlan_counter_stats_entry_t *entry,
-                                               uint16_t vlan_vid)
+                                               uint16_t vlan_vid,
+                                               indigo_fi_vlan_stats_t *stats)
 {
-    indigo_fi_vlan_stats_t stats;
     of_list_uint64_t values;
 
+    of_bsn_vlan_counter_stats_entry_vlan_vid_set(entry, vlan_vid);
+    of_bsn_vlan_counter_stats_entry_values_bind(entry, &values);
+
+    append_uint64(&values, stats->rx_bytes);
+    append_uint64(&values, stats->rx_packets);
+    append_uint64(&values, stats->tx_bytes);
+    append_uint64(&values, stats->tx_packets);
+}
+
+static void
+ind_core_bsn_port_counter_stats_entry_populate(of_bsn_port_counter_stats_entry_t *entry,
+                                               of_port_no_t port_no,
+                                               indigo_fi_port_stats_t *stats)
+{
+    of_list_uint64_t values;
+
+    of_bsn_port_counter_stats_entry_port_no_set(entry, port_no);
+    of_bsn_port_counter_stats_entry_values_bind(entry, &values);
+
+    append_uint64(&values, stats->rx_bytes);
+    append_uint64(&values, stats->rx_packets_unicast);
+    append_uint64(&values, stats->rx_packets_broadcast);
+    append_uint64(&values, stats->rx_packets_multicast);
+    append_uint64(&values, stats->rx_dropped);
+    append_uint64(&values, stats->rx_errors);
+    append_uint64(&values, stats->tx_bytes);
+    append_uint64(&values, stats->tx_packets_unicast);
+    append_uint64(&values, stats->tx_packets_broadcast);
+    append_uint64(&values, stats->tx_packets_multicast);
+    append_uint64(&values, stats->tx_dropped);
+    append_uint64(&values, stats->tx_errors);
+}
+
+/* Allocate a reply with the request's xid */
+static of_object_t *
+counter_stats_reply_new(of_object_t *req, uint32_t xid)
+{
+    of_object_t *reply;
+
+    if (req->object_id == OF_BSN_VLAN_COUNTER_STATS_REQUEST) {
+        reply = of_bsn_vlan_counter_stats_reply_new(req->version);
+        AIM_TRUE_OR_DIE(reply != NULL);
+        of_bsn_vlan_counter_stats_reply_xid_set(reply, xid);
+    } else {
+        reply = of_bsn_port_counter_stats_reply_new(req->version);
+        AIM_TRUE_OR_DIE(reply != NULL);
+        of_bsn_port_counter_stats_reply_xid_set(reply, xid);
+    }
+
+    return reply;
+}
+
+static void
+counter_stats_reply_entries_bind(of_object_t *reply, of_object_t *entries)
+{
+    if (reply->object_id == OF_BSN_VLAN_COUNTER_STATS_REPLY) {
+        of_bsn_vlan_counter_stats_reply_entries_bind(reply, entries);
+    } else {
+        of_bsn_port_counter_stats_reply_entries_bind(reply, entries);
+    }
+}
+
+/*
+ * Append an entry to the current reply
+ *
+ * If the entry doesn't fit, send out the current message and allocate
+ * a new one.
+ */
+static void
+counter_stats_append(struct ind_core_bsn_counter_stats_state *state,
+                     of_object_t *entry)
+{
+    of_object_t entries;
+
+    if (state->reply == NULL) {
+        state->reply = counter_stats_reply_new(state->req, state->xid);
+    }
+
+    counter_stats_reply_entries_bind(state->reply, &entries);
+    if (of_list_append(&entries, entry) < 0) {
+        if (state->reply->object_id == OF_BSN_VLAN_COUNTER_STATS_REPLY) {
+            of_bsn_vlan_counter_stats_reply_flags_set(
+                state->reply, OF_STATS_REPLY_FLAG_REPLY_MORE);
+        } else {
+            of_bsn_port_counter_stats_reply_flags_set(
+                state->reply, OF_STATS_REPLY_FLAG_REPLY_MORE);
+        }
+        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+
+        state->reply = counter_stats_reply_new(state->req, state->xid);
+        counter_stats_reply_entries_bind(state->reply, &entries);
+
+        if (of_list_append(&entries, entry) < 0) {
+            AIM_DIE("unexpected failure appending single bsn counter stats entry");
+        }
+    }
+}
+
+/* Report the next batch of active VLANs */
+static void
+vlan_counter_stats_batch(struct ind_core_bsn_counter_stats_state *state)
+{
+    uint16_t vlan_vids[COUNTER_STATS_BATCH_MAX];
+    indigo_fi_vlan_stats_t stats[COUNTER_STATS_BATCH_MAX];
+    of_bsn_vlan_counter_stats_entry_t *entry;
+    int count;
+    int i;
+
     /* Default to "counter not supported" */
-    memset(&stats, 0xff, sizeof(stats));
+    memset(stats, 0xff, sizeof(stats));
 
-    indigo_fwd_vlan_stats_get(vlan_vid, &stats);
+    count = ind_core_vlan_stats_bulk_get(state->next_vid, vlan_vids, stats,
+                                         COUNTER_STATS_BATCH_MAX);
 
-    of_bsn_vlan_counter_stats_entry_vlan_vid_set(entry, vlan_vid);
-    of_bsn_vlan_counter_stats_entry_values_bind(entry, &values);
+    entry = of_bsn_vlan_counter_stats_entry_new(state->req->version);
+    AIM_TRUE_OR_DIE(entry != NULL);
+
+    for (i = 0; i < count; i++) {
+        ind_core_bsn_vlan_counter_stats_entry_populate(entry, vlan_vids[i],
+                                                       &stats[i]);
+        counter_stats_append(state, entry);
+        truncate_of_object(entry);
+    }
+
+    of_object_delete(entry);
+
+    if (count < COUNTER_STATS_BATCH_MAX || vlan_vids[count - 1] >= 4095) {
+        state->done = 1;
+    } else {
+        state->next_vid = vlan_vids[count - 1] + 1;
+    }
+}
+
+/* Report the next batch of ports */
+static void
+port_counter_stats_batch(struct ind_core_bsn_counter_stats_state *state)
+{
+    indigo_fi_port_stats_t stats[COUNTER_STATS_BATCH_MAX];
+    of_bsn_port_counter_stats_entry_t *entry;
+    of_port_no_t *port_nos = &state->port_nos[state->next_idx];
+    int count = state->num_ports - state->next_idx;
+    int i;
+
+    if (count > COUNTER_STATS_BATCH_MAX) {
+        count = COUNTER_STATS_BATCH_MAX;
+    }
+
+    /* Default to "counter not supported" */
+    memset(stats, 0xff, sizeof(stats));
+
+    ind_core_port_extended_stats_get(port_nos, stats, count);
+
+    entry = of_bsn_port_counter_stats_entry_new(state->req->version);
+    AIM_TRUE_OR_DIE(entry != NULL);
+
+    for (i = 0; i < count; i++) {
+        ind_core_bsn_port_counter_stats_entry_populate(entry, port_nos[i],
+                                                       &stats[i]);
+        counter_stats_append(state, entry);
+        truncate_of_object(entry);
+    }
+
+    of_object_delete(entry);
+
+    state->next_idx += count;
+    state->done = state->next_idx == state->num_ports;
+}
+
+static void
+counter_stats_finish(struct ind_core_bsn_counter_stats_state *state)
+{
+    /* Send last reply */
+    if (state->reply == NULL) {
+        state->reply = counter_stats_reply_new(state->req, state->xid);
+    }
+    indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+
+    of_object_delete(state->req);
+    INDIGO_MEM_FREE(state->port_nos);
+    INDIGO_MEM_FREE(state);
+}
 
-    append_uint64(&values, stats.rx_bytes);
-    append_uint64(&values, stats.rx_packets);
-    append_uint64(&values, stats.tx_bytes);
-    append_uint64(&values, stats.tx_packets);
+static void
+counter_stats_task_resume(void *cookie)
+{
+    struct ind_core_bsn_counter_stats_state *state = cookie;
+
+    if (ind_soc_task_start(&state->task, counter_stats_task, state,
+                           IND_SOC_DEFAULT_PRIORITY) < 0) {
+        /* Should not happen; the same start succeeded before */
+        LOG_ERROR("Failed to resume bsn counter stats task");
+        counter_stats_finish(state);
+    }
+}
+
+static ind_soc_task_status_t
+counter_stats_task(void *cookie)
+{
+    struct ind_core_bsn_counter_stats_state *state = cookie;
+
+    do {
+        if (indigo_cxn_output_blocked(state->cxn_id) &&
+            indigo_cxn_output_wait(state->cxn_id, counter_stats_task_resume,
+                                   state) == INDIGO_ERROR_NONE) {
+            return IND_SOC_TASK_FINISHED;
+        }
+
+        if (state->done) {
+            counter_stats_finish(state);
+            return IND_SOC_TASK_FINISHED;
+        }
+
+        if (state->req->object_id == OF_BSN_VLAN_COUNTER_STATS_REQUEST) {
+            vlan_counter_stats_batch(state);
+        } else {
+            port_counter_stats_batch(state);
+        }
+    } while (!ind_soc_should_yield());
+
+    return IND_SOC_TASK_CONTINUE;
+}
+
+/*
+ * Start a counter stats task
+ *
+ * Takes ownership of state and its request.
+ */
+static void
+counter_stats_spawn(struct ind_core_bsn_counter_stats_state *state)
+{
+    if (ind_soc_task_start(&state->task, counter_stats_task, state,
+                           IND_SOC_DEFAULT_PRIORITY) < 0) {
+        LOG_ERROR("Failed to start bsn counter stats task");
+        of_object_delete(state->req);
+        INDIGO_MEM_FREE(state->port_nos);
+        INDIGO_MEM_FREE(state);
+    }
+}
+
+static struct ind_core_bsn_counter_stats_state *
+counter_stats_state_new(of_object_t *req, indigo_cxn_id_t cxn_id,
+                        uint32_t xid)
+{
+    struct ind_core_bsn_counter_stats_state *state;
+
+    state = INDIGO_MEM_ALLOC(sizeof(*state));
+    AIM_TRUE_OR_DIE(state != NULL);
+    INDIGO_MEM_SET(state, 0, sizeof(*state));
+    state->req = req;
+    state->cxn_id = cxn_id;
+    state->xid = xid;
+
+    return state;
 }
 
 void
@@ -84,6 +353,8 @@ ind_core_bsn_vlan_counter_stats_request_handler(of_object_t *_obj,
     of_bsn_vlan_counter_stats_reply_t *reply;
     of_list_bsn_vlan_counter_stats_entry_t entries;
     of_bsn_vlan_counter_stats_entry_t *entry;
+    struct ind_core_bsn_counter_stats_state *state;
+    indigo_fi_vlan_stats_t stats;
     uint32_t xid;
     uint16_t vlan_vid;
 
@@ -98,46 +369,33 @@ ind_core_bsn_vlan_counter_stats_request_handler(of_object_t *_obj,
         return;
     }
 
+    of_bsn_vlan_counter_stats_request_xid_get(obj, &xid);
+
+    if (vlan_vid == OF_BSN_VLAN_ALL) {
+        state = counter_stats_state_new(obj, cxn_id, xid);
+        state->next_vid = 1;
+        counter_stats_spawn(state);
+        return;
+    }
+
     reply = of_bsn_vlan_counter_stats_reply_new(obj->version);
     AIM_TRUE_OR_DIE(reply != NULL);
 
-    of_bsn_vlan_counter_stats_request_xid_get(obj, &xid);
     of_bsn_vlan_counter_stats_reply_xid_set(reply, xid);
     of_bsn_vlan_counter_stats_reply_entries_bind(reply, &entries);
 
     entry = of_bsn_vlan_counter_stats_entry_new(entries.version);
     AIM_TRUE_OR_DIE(entry != NULL);
 
-    if (vlan_vid == OF_BSN_VLAN_ALL) {
-        for (vlan_vid = 1; vlan_vid < 4096; vlan_vid++) {
-            ind_core_bsn_vlan_counter_stats_entry_populate(entry, vlan_vid);
-
-            if (of_list_append(&entries, entry) < 0) {
-                /* This entry didn't fit, send out the current message and
-                 * allocate a new one. */
-                of_bsn_vlan_counter_stats_reply_flags_set(
-                    reply, OF_STATS_REPLY_FLAG_REPLY_MORE);
-                indigo_cxn_send_controller_message(cxn_id, reply);
-
-                reply = of_bsn_vlan_counter_stats_reply_new(obj->version);
-                AIM_TRUE_OR_DIE(reply != NULL);
+    /* Default to "counter not supported" */
+    memset(&stats, 0xff, sizeof(stats));
 
-                of_bsn_vlan_counter_stats_reply_xid_set(reply, xid);
-                of_bsn_vlan_counter_stats_reply_entries_bind(reply, &entries);
+    ind_core_vlan_stats_get(vlan_vid, &stats);
 
-                if (of_list_append(&entries, entry) < 0) {
-                    AIM_DIE("unexpected failure appending single bsn_vlan_counter stats entry");
-                }
-            }
+    ind_core_bsn_vlan_counter_stats_entry_populate(entry, vlan_vid, &stats);
 
-            truncate_of_object(entry);
-        }
-    } else {
-        ind_core_bsn_vlan_counter_stats_entry_populate(entry, vlan_vid);
-
-        if (of_list_append(&entries, entry) < 0) {
-            AIM_DIE("unexpected failure appending single bsn_vlan_counter stats entry");
-        }
+    if (of_list_append(&entries, entry) < 0) {
+        AIM_DIE("unexpected failure appending single bsn_vlan_counter stats entry");
     }
 
     of_object_delete(entry);
@@ -146,35 +404,6 @@ ind_core_bsn_vlan_counter_stats_request_handler(of_object_t *_obj,
     indigo_cxn_send_controller_message(cxn_id, reply);
 }
 
-static void
-ind_core_bsn_port_counter_stats_entry_populate(of_bsn_port_counter_stats_entry_t *entry,
-                                               of_port_no_t port_no)
-{
-    indigo_fi_port_stats_t stats;
-    of_list_uint64_t values;
-
-    /* Default to "counter not supported" */
-    memset(&stats, 0xff, sizeof(stats));
-
-    indigo_port_extended_stats_get(port_no, &stats);
-
-    of_bsn_port_counter_stats_entry_port_no_set(entry, port_no);
-    of_bsn_port_counter_stats_entry_values_bind(entry, &values);
-
-    append_uint64(&values, stats.rx_bytes);
-    append_uint64(&values, stats.rx_packets_unicast);
-    append_uint64(&values, stats.rx_packets_broadcast);
-    append_uint64(&values, stats.rx_packets_multicast);
-    append_uint64(&values, stats.rx_dropped);
-    append_uint64(&values, stats.rx_errors);
-    append_uint64(&values, stats.tx_bytes);
-    append_uint64(&values, stats.tx_packets_unicast);
-    append_uint64(&values, stats.tx_packets_broadcast);
-    append_uint64(&values, stats.tx_packets_multicast);
-    append_uint64(&values, stats.tx_dropped);
-    append_uint64(&values, stats.tx_errors);
-}
-
 void
 ind_core_bsn_port_counter_stats_request_handler(of_object_t *_obj,
                                                 indigo_cxn_id_t cxn_id)
@@ -183,66 +412,65 @@ ind_core_bsn_port_counter_stats_request_handler(of_object_t *_obj,
     of_bsn_port_counter_stats_reply_t *reply;
     of_list_bsn_port_counter_stats_entry_t entries;
     of_bsn_port_counter_stats_entry_t *entry;
+    struct ind_core_bsn_counter_stats_state *state;
+    indigo_fi_port_stats_t stats;
     uint32_t xid;
     of_port_no_t port_no;
 
     of_bsn_port_counter_stats_request_port_no_get(obj, &port_no);
-
-    reply = of_bsn_port_counter_stats_reply_new(obj->version);
-    AIM_TRUE_OR_DIE(reply != NULL);
-
     of_bsn_port_counter_stats_request_xid_get(obj, &xid);
-    of_bsn_port_counter_stats_reply_xid_set(reply, xid);
-    of_bsn_port_counter_stats_reply_entries_bind(reply, &entries);
-
-    entry = of_bsn_port_counter_stats_entry_new(entries.version);
-    AIM_TRUE_OR_DIE(entry != NULL);
 
     if (port_no == OF_PORT_DEST_ALL) {
         indigo_port_info_t *port_list, *port_info;
 
-        if (indigo_port_interface_list(&port_list) < 0) {
-            of_object_delete(reply);
-            of_object_delete(entry);
+        if (IND_CORE_DRIVER_CALL(indigo_port_interface_list, &port_list) < 0) {
             indigo_cxn_send_error_reply(cxn_id, obj,
                                         OF_ERROR_TYPE_BAD_REQUEST,
                                         OF_REQUEST_FAILED_EPERM);
+            of_object_delete(obj);
             return;
         }
 
+        state = counter_stats_state_new(obj, cxn_id, xid);
+
         for (port_info = port_list; port_info; port_info = port_info->next) {
-            port_no = port_info->of_port;
+            state->num_ports++;
+        }
 
-            ind_core_bsn_port_counter_stats_entry_populate(entry, port_no);
+        state->port_nos = INDIGO_MEM_ALLOC(
+            sizeof(*state->port_nos) * (state->num_ports + 1));
+        AIM_TRUE_OR_DIE(state->port_nos != NULL);
 
-            if (of_list_append(&entries, entry) < 0) {
-                /* This entry didn't fit, send out the current message and
-                 * allocate a new one. */
-                of_bsn_port_counter_stats_reply_flags_set(
-                    reply, OF_STATS_REPLY_FLAG_REPLY_MORE);
-                indigo_cxn_send_controller_message(cxn_id, reply);
+        state->num_ports = 0;
+        for (port_info = port_list; port_info; port_info = port_info->next) {
+            state->port_nos[state->num_ports++] = port_info->of_port;
+        }
 
-                reply = of_bsn_port_counter_stats_reply_new(obj->version);
-                AIM_TRUE_OR_DIE(reply != NULL);
+        IND_CORE_DRIVER_CALL_VOID(indigo_port_interface_list_destroy, port_list);
 
-                of_bsn_port_counter_stats_reply_xid_set(reply, xid);
-                of_bsn_port_counter_stats_reply_entries_bind(reply, &entries);
+        state->done = state->num_ports == 0;
+        counter_stats_spawn(state);
+        return;
+    }
 
-                if (of_list_append(&entries, entry) < 0) {
-                    AIM_DIE("unexpected failure appending single bsn_port_counter stats entry");
-                }
-            }
+    reply = of_bsn_port_counter_stats_reply_new(obj->version);
+    AIM_TRUE_OR_DIE(reply != NULL);
 
-            truncate_of_object(entry);
-        }
+    of_bsn_port_counter_stats_reply_xid_set(reply, xid);
+    of_bsn_port_counter_stats_reply_entries_bind(reply, &entries);
 
-        indigo_port_interface_list_destroy(port_list);
-    } else {
-        ind_core_bsn_port_counter_stats_entry_populate(entry, port_no);
+    entry = of_bsn_port_counter_stats_entry_new(entries.version);
+    AIM_TRUE_OR_DIE(entry != NULL);
 
-        if (of_list_append(&entries, entry) < 0) {
-            AIM_DIE("unexpected failure appending single bsn_port_counter stats entry");
-        }
+    /* Default to "counter not supported" */
+    memset(&stats, 0xff, sizeof(stats));
+
+    ind_core_port_extended_stats_get(&port_no, &stats, 1);
+
+    ind_core_bsn_port_counter_stats_entry_populate(entry, port_no, &stats);
+
+    if (of_list_append(&entries, entry) < 0) {
+        AIM_DIE("unexpected failure appending single bsn_port_counter stats entry");
     }
 
     of_object_delete(entry);
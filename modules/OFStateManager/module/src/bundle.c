@@ -0,0 +1,524 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief OpenFlow bundles
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <OFConnectionManager/ofconnectionmanager.h>
+#include <indigo/indigo.h>
+#include <indigo/of_state_manager.h>
+#include <loci/loci.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "handlers.h"
+#include "flow_batch.h"
+#include "bundle.h"
+
+/* ofp_bundle_ctrl_type */
+#define BUNDLE_OPEN_REQUEST     0
+#define BUNDLE_CLOSE_REQUEST    2
+#define BUNDLE_COMMIT_REQUEST   4
+#define BUNDLE_DISCARD_REQUEST  6
+
+/* ofp_bundle_flags */
+#define BUNDLE_FLAG_ATOMIC      1
+
+/* ofp_bundle_failed_code */
+#define BUNDLE_FAILED_UNKNOWN         0
+#define BUNDLE_FAILED_BAD_ID          2
+#define BUNDLE_FAILED_BUNDLE_EXIST    3
+#define BUNDLE_FAILED_BUNDLE_CLOSED   4
+#define BUNDLE_FAILED_OUT_OF_BUNDLES  5
+#define BUNDLE_FAILED_BAD_TYPE        6
+#define BUNDLE_FAILED_BAD_FLAGS       7
+#define BUNDLE_FAILED_MSG_BAD_LEN     8
+#define BUNDLE_FAILED_MSG_BAD_XID     9
+#define BUNDLE_FAILED_MSG_UNSUP       10
+#define BUNDLE_FAILED_MSG_CONFLICT    11
+#define BUNDLE_FAILED_MSG_TOO_MANY    12
+#define BUNDLE_FAILED_MSG_FAILED      13
+
+typedef struct ind_core_bundle_s {
+    bool in_use;
+    bool closed;
+    bool failed;                /* A message could not be staged */
+    indigo_cxn_id_t cxn_id;
+    uint32_t id;
+    uint16_t flags;
+    int num_msgs;
+    int alloc_msgs;
+    of_object_t **msgs;         /* Staged messages, in arrival order */
+} ind_core_bundle_t;
+
+static ind_core_bundle_t bundles[OFSTATEMANAGER_CONFIG_MAX_BUNDLES];
+
+static ind_core_bundle_t *
+bundle_find(indigo_cxn_id_t cxn_id, uint32_t id)
+{
+    int i;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_BUNDLES; i++) {
+        if (bundles[i].in_use && bundles[i].cxn_id == cxn_id &&
+                bundles[i].id == id) {
+            return &bundles[i];
+        }
+    }
+
+    return NULL;
+}
+
+static ind_core_bundle_t *
+bundle_open(indigo_cxn_id_t cxn_id, uint32_t id, uint16_t flags)
+{
+    int i;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_BUNDLES; i++) {
+        ind_core_bundle_t *bundle = &bundles[i];
+        if (!bundle->in_use) {
+            INDIGO_MEM_CLEAR(bundle, sizeof(*bundle));
+            bundle->in_use = true;
+            bundle->cxn_id = cxn_id;
+            bundle->id = id;
+            bundle->flags = flags;
+            LOG_TRACE("Opened bundle %u on cxn %d", id, cxn_id);
+            return bundle;
+        }
+    }
+
+    return NULL;
+}
+
+/* Delete any messages not yet applied and free the slot */
+static void
+bundle_free(ind_core_bundle_t *bundle)
+{
+    int i;
+
+    for (i = 0; i < bundle->num_msgs; i++) {
+        if (bundle->msgs[i] != NULL) {
+            of_object_delete(bundle->msgs[i]);
+        }
+    }
+
+    INDIGO_MEM_FREE(bundle->msgs);
+    bundle->msgs = NULL;
+    bundle->in_use = false;
+}
+
+static indigo_error_t
+bundle_msgs_grow(ind_core_bundle_t *bundle)
+{
+    int alloc = bundle->alloc_msgs ? bundle->alloc_msgs * 2 : 64;
+    of_object_t **msgs;
+
+    if (alloc > OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS) {
+        alloc = OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS;
+    }
+
+    if ((msgs = INDIGO_MEM_ALLOC(alloc * sizeof(*msgs))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    if (bundle->num_msgs > 0) {
+        INDIGO_MEM_COPY(msgs, bundle->msgs,
+                        bundle->num_msgs * sizeof(*msgs));
+    }
+    INDIGO_MEM_FREE(bundle->msgs);
+    bundle->msgs = msgs;
+    bundle->alloc_msgs = alloc;
+
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+bundle_msg_buffer_free(void *buf)
+{
+    INDIGO_MEM_FREE(buf);
+}
+
+/* Messages that may be staged in a bundle */
+static bool
+bundle_msg_supported(of_object_id_t object_id)
+{
+    switch (object_id) {
+    case OF_FLOW_ADD:
+    case OF_FLOW_MODIFY:
+    case OF_FLOW_MODIFY_STRICT:
+    case OF_FLOW_DELETE:
+    case OF_FLOW_DELETE_STRICT:
+    case OF_GROUP_ADD:
+    case OF_GROUP_MODIFY:
+    case OF_GROUP_DELETE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Whether group id exists when message idx of the bundle is applied,
+ * given the group table and the messages staged before it.
+ */
+static bool
+bundle_group_exists(ind_core_bundle_t *bundle, int idx, uint32_t id)
+{
+    uint32_t msg_id;
+
+    while (--idx >= 0) {
+        of_object_t *msg = bundle->msgs[idx];
+        if (msg->object_id == OF_GROUP_ADD) {
+            of_group_add_group_id_get(msg, &msg_id);
+            if (msg_id == id) {
+                return true;
+            }
+        } else if (msg->object_id == OF_GROUP_DELETE) {
+            of_group_delete_group_id_get(msg, &msg_id);
+            if (msg_id == id || msg_id == OF_GROUP_ALL) {
+                return false;
+            }
+        }
+    }
+
+    return ind_core_group_exists(id);
+}
+
+/*
+ * Check the bundle as a whole before applying any of it
+ *
+ * Returns the index of the first message that would fail, or -1.
+ */
+static int
+bundle_validate(ind_core_bundle_t *bundle)
+{
+    uint32_t id;
+    int i;
+
+    for (i = 0; i < bundle->num_msgs; i++) {
+        of_object_t *msg = bundle->msgs[i];
+        switch (msg->object_id) {
+        case OF_GROUP_ADD:
+            of_group_add_group_id_get(msg, &id);
+            if (bundle_group_exists(bundle, i, id)) {
+                return i;
+            }
+            break;
+        case OF_GROUP_MODIFY:
+            of_group_modify_group_id_get(msg, &id);
+            if (!bundle_group_exists(bundle, i, id)) {
+                return i;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return -1;
+}
+
+static void
+bundle_ctrl_reply_send(of_object_t *obj, indigo_cxn_id_t cxn_id,
+                       uint32_t id, uint16_t ctrl_type, uint16_t flags)
+{
+    of_object_t *reply;
+    uint32_t xid;
+
+    if ((reply = of_bundle_ctrl_msg_new(obj->version)) == NULL) {
+        LOG_ERROR("Could not allocate bundle ctrl reply");
+        return;
+    }
+
+    of_bundle_ctrl_msg_xid_get(obj, &xid);
+    of_bundle_ctrl_msg_xid_set(reply, xid);
+    of_bundle_ctrl_msg_bundle_id_set(reply, id);
+    /* Each reply type follows its request type */
+    of_bundle_ctrl_msg_bundle_ctrl_type_set(reply, ctrl_type + 1);
+    of_bundle_ctrl_msg_flags_set(reply, flags);
+
+    indigo_cxn_send_controller_message(cxn_id, reply);
+}
+
+/* Apply every staged message in order and program them */
+static void
+bundle_commit(ind_core_bundle_t *bundle)
+{
+    int i;
+
+    for (i = 0; i < bundle->num_msgs; i++) {
+        of_object_t *msg = bundle->msgs[i];
+        bundle->msgs[i] = NULL;
+        /* Barriers after the commit wait for these like any request */
+        ind_cxn_message_track_setup(bundle->cxn_id, msg);
+        indigo_core_receive_controller_message(bundle->cxn_id, msg);
+    }
+
+    ind_core_flow_batch_flush();
+}
+
+/**
+ * Handle a bundle_ctrl message
+ * @param _obj Generic type object for the message to be coerced
+ * @param cxn_id Connection handler for the owning connection
+ */
+
+void
+ind_core_bundle_ctrl_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
+{
+    ind_core_bundle_t *bundle;
+    uint32_t id;
+    uint16_t ctrl_type;
+    uint16_t flags;
+    uint16_t code = BUNDLE_FAILED_UNKNOWN;
+    int idx;
+
+    of_bundle_ctrl_msg_bundle_id_get(_obj, &id);
+    of_bundle_ctrl_msg_bundle_ctrl_type_get(_obj, &ctrl_type);
+    of_bundle_ctrl_msg_flags_get(_obj, &flags);
+
+    bundle = bundle_find(cxn_id, id);
+
+    switch (ctrl_type) {
+    case BUNDLE_OPEN_REQUEST:
+        if (bundle != NULL) {
+            code = BUNDLE_FAILED_BUNDLE_EXIST;
+            goto error;
+        }
+        if (flags & BUNDLE_FLAG_ATOMIC) {
+            code = BUNDLE_FAILED_BAD_FLAGS;
+            goto error;
+        }
+        if (bundle_open(cxn_id, id, flags) == NULL) {
+            code = BUNDLE_FAILED_OUT_OF_BUNDLES;
+            goto error;
+        }
+        break;
+
+    case BUNDLE_CLOSE_REQUEST:
+        if (bundle == NULL) {
+            code = BUNDLE_FAILED_BAD_ID;
+            goto error;
+        }
+        if (bundle->closed) {
+            code = BUNDLE_FAILED_BUNDLE_CLOSED;
+            goto error;
+        }
+        bundle->closed = true;
+        break;
+
+    case BUNDLE_COMMIT_REQUEST:
+        if (bundle == NULL) {
+            code = BUNDLE_FAILED_BAD_ID;
+            goto error;
+        }
+        if (flags != bundle->flags) {
+            code = BUNDLE_FAILED_BAD_FLAGS;
+            bundle_free(bundle);
+            goto error;
+        }
+        if (bundle->failed) {
+            code = BUNDLE_FAILED_MSG_FAILED;
+            bundle_free(bundle);
+            goto error;
+        }
+        if ((idx = bundle_validate(bundle)) >= 0) {
+            LOG_VERBOSE("Bundle %u message %d (%s) conflicts", id, idx,
+                        of_object_id_str[bundle->msgs[idx]->object_id]);
+            code = BUNDLE_FAILED_MSG_CONFLICT;
+            bundle_free(bundle);
+            goto error;
+        }
+        LOG_TRACE("Committing bundle %u with %d messages", id,
+                  bundle->num_msgs);
+        bundle_commit(bundle);
+        bundle_free(bundle);
+        break;
+
+    case BUNDLE_DISCARD_REQUEST:
+        if (bundle == NULL) {
+            code = BUNDLE_FAILED_BAD_ID;
+            goto error;
+        }
+        bundle_free(bundle);
+        break;
+
+    default:
+        code = BUNDLE_FAILED_BAD_TYPE;
+        goto error;
+    }
+
+    bundle_ctrl_reply_send(_obj, cxn_id, id, ctrl_type, flags);
+    of_object_delete(_obj);
+    return;
+
+error:
+    indigo_cxn_send_error_reply(cxn_id, _obj,
+                                OF_ERROR_TYPE_BUNDLE_FAILED, code);
+    of_object_delete(_obj);
+}
+
+/**
+ * Handle a bundle_add message
+ * @param _obj Generic type object for the message to be coerced
+ * @param cxn_id Connection handler for the owning connection
+ *
+ * The enclosed message is copied out, since the request is not kept.
+ */
+
+void
+ind_core_bundle_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
+{
+    ind_core_bundle_t *bundle;
+    of_object_t *msg;
+    of_octets_t data;
+    uint8_t *buf;
+    uint32_t id;
+    uint32_t xid;
+    uint16_t flags;
+    uint16_t code;
+
+    of_bundle_add_msg_bundle_id_get(_obj, &id);
+    of_bundle_add_msg_flags_get(_obj, &flags);
+    of_bundle_add_msg_xid_get(_obj, &xid);
+    of_bundle_add_msg_data_get(_obj, &data);
+
+    if ((bundle = bundle_find(cxn_id, id)) == NULL) {
+        /* Adding to an unknown bundle opens it */
+        if (flags & BUNDLE_FLAG_ATOMIC) {
+            code = BUNDLE_FAILED_BAD_FLAGS;
+            goto error;
+        }
+        if ((bundle = bundle_open(cxn_id, id, flags)) == NULL) {
+            code = BUNDLE_FAILED_OUT_OF_BUNDLES;
+            goto error;
+        }
+    }
+
+    if (bundle->closed) {
+        code = BUNDLE_FAILED_BUNDLE_CLOSED;
+        goto error;
+    }
+
+    if (flags != bundle->flags) {
+        code = BUNDLE_FAILED_BAD_FLAGS;
+        goto failed;
+    }
+
+    if (data.bytes < OF_MESSAGE_MIN_LENGTH ||
+            of_message_length_get(OF_BUFFER_TO_MESSAGE(data.data)) !=
+            data.bytes) {
+        code = BUNDLE_FAILED_MSG_BAD_LEN;
+        goto failed;
+    }
+
+    if (of_message_xid_get(OF_BUFFER_TO_MESSAGE(data.data)) != xid) {
+        code = BUNDLE_FAILED_MSG_BAD_XID;
+        goto failed;
+    }
+
+    if (bundle->num_msgs == OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS) {
+        code = BUNDLE_FAILED_MSG_TOO_MANY;
+        goto failed;
+    }
+
+    if (bundle->num_msgs == bundle->alloc_msgs &&
+            bundle_msgs_grow(bundle) < 0) {
+        code = BUNDLE_FAILED_UNKNOWN;
+        goto failed;
+    }
+
+    if ((buf = INDIGO_MEM_ALLOC(data.bytes)) == NULL) {
+        code = BUNDLE_FAILED_UNKNOWN;
+        goto failed;
+    }
+    INDIGO_MEM_COPY(buf, data.data, data.bytes);
+
+    msg = of_object_new_from_message(OF_BUFFER_TO_MESSAGE(buf), data.bytes);
+    if (msg == NULL) {
+        INDIGO_MEM_FREE(buf);
+        code = BUNDLE_FAILED_MSG_UNSUP;
+        goto failed;
+    }
+    OF_OBJECT_TO_WBUF(msg)->free = bundle_msg_buffer_free;
+
+    if (msg->version != _obj->version ||
+            !bundle_msg_supported(msg->object_id)) {
+        of_object_delete(msg);
+        code = BUNDLE_FAILED_MSG_UNSUP;
+        goto failed;
+    }
+
+    bundle->msgs[bundle->num_msgs++] = msg;
+    of_object_delete(_obj);
+    return;
+
+failed:
+    bundle->failed = true;
+error:
+    indigo_cxn_send_error_reply(cxn_id, _obj,
+                                OF_ERROR_TYPE_BUNDLE_FAILED, code);
+    of_object_delete(_obj);
+}
+
+static void
+bundle_cxn_status_change(indigo_cxn_id_t cxn_id,
+                         indigo_cxn_protocol_params_t *cxn_proto_params,
+                         indigo_cxn_state_t state, void *cookie)
+{
+    int i;
+
+    if (state != INDIGO_CXN_S_CLOSING && state != INDIGO_CXN_S_DISCONNECTED) {
+        return;
+    }
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_BUNDLES; i++) {
+        if (bundles[i].in_use && bundles[i].cxn_id == cxn_id) {
+            LOG_VERBOSE("Discarding bundle %u of closed cxn %d",
+                        bundles[i].id, cxn_id);
+            bundle_free(&bundles[i]);
+        }
+    }
+}
+
+indigo_error_t
+ind_core_bundle_enable_set(int enable)
+{
+    if (enable) {
+        return indigo_cxn_status_change_register(bundle_cxn_status_change,
+                                                 NULL);
+    } else {
+        return indigo_cxn_status_change_unregister(bundle_cxn_status_change,
+                                                   NULL);
+    }
+}
+
+void
+ind_core_bundle_finish(void)
+{
+    int i;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_BUNDLES; i++) {
+        if (bundles[i].in_use) {
+            bundle_free(&bundles[i]);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief OpenFlow bundles
+ *
+ * Flow-mods and group-mods added to a bundle are parsed and staged
+ * without being applied. On commit the whole bundle is checked against
+ * the flowtable and group table, then every message is applied in order
+ * and the flow batch is flushed, so Forwarding sees the bundle as one
+ * batch (up to OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX operations at a
+ * time). A bundle with a message that failed to stage cannot be
+ * committed.
+ *
+ * Atomic bundles are refused with OFPBFC_BAD_FLAGS: a message can still
+ * fail in Forwarding after earlier ones were applied, and those are not
+ * rolled back.
+ *
+ * Bundles belong to a connection and are discarded when it closes.
+ */
+
+#ifndef _OFSTATEMANAGER_BUNDLE_H_
+#define _OFSTATEMANAGER_BUNDLE_H_
+
+#include <indigo/indigo.h>
+#include <indigo/of_connection_manager.h>
+#include <loci/loci.h>
+
+void ind_core_bundle_ctrl_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id);
+void ind_core_bundle_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id);
+
+/**
+ * Start or stop watching for connections closing
+ */
+indigo_error_t ind_core_bundle_enable_set(int enable);
+
+/**
+ * Discard all bundles
+ */
+void ind_core_bundle_finish(void);
+
+#endif /* _OFSTATEMANAGER_BUNDLE_H_ */
@@ -0,0 +1,338 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flow, VLAN, group and table counter cache
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/forwarding.h>
+#include <SocketManager/socketmanager.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "ft.h"
+#include "flow_batch.h"
+#include "counter_cache.h"
+#include "driver_stats.h"
+
+static int cache_refresh_ms;    /* 0 if disabled */
+static bool sweep_running;
+
+/* Flows visited by the sweep whose counters have not been read yet */
+static int num_sweep_flows;
+static indigo_cookie_t sweep_flow_ids[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+static indigo_fi_flow_stats_t sweep_flow_stats[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+static indigo_error_t sweep_results[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+
+/* VLAN IDs are 1 through VLAN_VID_MAX */
+#define VLAN_VID_MAX 4095
+
+/* Counters last read for each VLAN ID; time 0 if never */
+struct vlan_cache_entry {
+    indigo_time_t time;
+    indigo_fi_vlan_stats_t stats;
+};
+
+static struct vlan_cache_entry *vlan_cache;
+
+/* Configured VLANs from the last full walk, ascending */
+static indigo_time_t vlan_list_time;
+static int num_vlan_list;
+static uint16_t *vlan_list;
+
+/* Last table stats reply, for its OpenFlow version */
+static indigo_time_t table_stats_time;
+static of_table_stats_reply_t *table_stats_cache;
+
+static void
+vlan_cache_free(void)
+{
+    INDIGO_MEM_FREE(vlan_cache);
+    INDIGO_MEM_FREE(vlan_list);
+    vlan_cache = NULL;
+    vlan_list = NULL;
+    num_vlan_list = 0;
+    vlan_list_time = 0;
+}
+
+static void
+sweep_flush(void)
+{
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+    int i;
+
+    if (num_sweep_flows == 0) {
+        return;
+    }
+
+    ind_core_flow_batch_flush();
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_flow_stats_bulk_get,
+                              sweep_flow_ids, num_sweep_flows,
+                              sweep_flow_stats, sweep_results);
+
+    for (i = 0; i < num_sweep_flows; i++) {
+        ft_entry_t *entry;
+        if (sweep_results[i] != INDIGO_ERROR_NONE) {
+            continue;
+        }
+        /* The sweep may have yielded and let the flow be deleted */
+        if ((entry = ft_lookup(ind_core_ft, sweep_flow_ids[i])) != NULL) {
+            entry->cached_packets = sweep_flow_stats[i].packets;
+            entry->cached_bytes = sweep_flow_stats[i].bytes;
+            entry->counters_time = now;
+        }
+    }
+
+    num_sweep_flows = 0;
+}
+
+static void
+sweep_iter(void *cookie, ft_entry_t *entry)
+{
+    if (entry != NULL) {
+        sweep_flow_ids[num_sweep_flows++] = entry->id;
+        if (num_sweep_flows == OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX) {
+            sweep_flush();
+        }
+        return;
+    }
+
+    sweep_flush();
+    sweep_running = false;
+}
+
+static void
+counter_cache_timer(void *cookie)
+{
+    indigo_error_t rv;
+
+    if (sweep_running) {
+        LOG_VERBOSE("Counter cache sweep still running");
+        return;
+    }
+
+    rv = ft_spawn_iter_task(ind_core_ft, NULL, sweep_iter, NULL,
+                            IND_SOC_DEFAULT_PRIORITY - 10);
+    if (rv < 0) {
+        LOG_ERROR("Failed to start counter cache sweep: %s",
+                  indigo_strerror(rv));
+    } else {
+        sweep_running = true;
+    }
+}
+
+indigo_error_t
+ind_core_counter_cache_enable_set(int refresh_ms)
+{
+    indigo_error_t rv = INDIGO_ERROR_NONE;
+
+    if (refresh_ms == cache_refresh_ms) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if (cache_refresh_ms > 0) {
+        ind_soc_timer_event_unregister(counter_cache_timer, NULL);
+    }
+
+    if (refresh_ms > 0) {
+        rv = ind_soc_timer_event_register_with_priority(
+            counter_cache_timer, NULL, refresh_ms, -10);
+        if (rv < 0) {
+            refresh_ms = 0;
+        }
+    }
+
+    cache_refresh_ms = refresh_ms;
+
+    if (refresh_ms == 0) {
+        vlan_cache_free();
+        of_object_delete(table_stats_cache);
+        table_stats_cache = NULL;
+        table_stats_time = 0;
+    }
+
+    return rv;
+}
+
+bool
+ind_core_counter_cache_enabled(void)
+{
+    return cache_refresh_ms != 0;
+}
+
+bool
+ind_core_counter_cache_fresh(indigo_time_t time)
+{
+    return cache_refresh_ms != 0 && time != 0 &&
+        INDIGO_CURRENT_TIME - time <= cache_refresh_ms;
+}
+
+/* Allocate the VLAN cache on first use; false if it can't be used */
+static bool
+vlan_cache_alloc(void)
+{
+    if (cache_refresh_ms == 0) {
+        return false;
+    }
+
+    if (vlan_cache == NULL) {
+        vlan_cache = INDIGO_MEM_ALLOC((VLAN_VID_MAX + 1) * sizeof(*vlan_cache));
+        vlan_list = INDIGO_MEM_ALLOC(VLAN_VID_MAX * sizeof(*vlan_list));
+        if (vlan_cache == NULL || vlan_list == NULL) {
+            LOG_ERROR("Failed to allocate VLAN counter cache");
+            vlan_cache_free();
+            return false;
+        }
+        INDIGO_MEM_SET(vlan_cache, 0, (VLAN_VID_MAX + 1) * sizeof(*vlan_cache));
+    }
+
+    return true;
+}
+
+/* Read the counters of every configured VLAN */
+static void
+vlan_list_refresh(void)
+{
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+    indigo_fi_vlan_stats_t stats[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    uint16_t vids[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    uint16_t start_vid = 1;
+    int count, i;
+
+    num_vlan_list = 0;
+
+    while (true) {
+        /* Default to "counter not supported" */
+        INDIGO_MEM_SET(stats, 0xff, sizeof(stats));
+        count = IND_CORE_DRIVER_CALL(indigo_fwd_vlan_stats_bulk_get,
+                                     start_vid, vids, stats,
+                                     OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX);
+
+        for (i = 0; i < count && num_vlan_list < VLAN_VID_MAX; i++) {
+            vlan_list[num_vlan_list++] = vids[i];
+            vlan_cache[vids[i]].stats = stats[i];
+            vlan_cache[vids[i]].time = now;
+        }
+
+        if (count < OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX ||
+            vids[count - 1] >= VLAN_VID_MAX) {
+            break;
+        }
+        start_vid = vids[count - 1] + 1;
+    }
+
+    vlan_list_time = now;
+}
+
+void
+ind_core_vlan_stats_get(uint16_t vlan_vid, indigo_fi_vlan_stats_t *stats)
+{
+    if (vlan_vid == 0 || vlan_vid > VLAN_VID_MAX || !vlan_cache_alloc()) {
+        IND_CORE_DRIVER_CALL_VOID(indigo_fwd_vlan_stats_get, vlan_vid, stats);
+        return;
+    }
+
+    if (!ind_core_counter_cache_fresh(vlan_cache[vlan_vid].time)) {
+        /* Default to "counter not supported" */
+        INDIGO_MEM_SET(&vlan_cache[vlan_vid].stats, 0xff,
+               sizeof(vlan_cache[vlan_vid].stats));
+        IND_CORE_DRIVER_CALL_VOID(indigo_fwd_vlan_stats_get, vlan_vid,
+                                  &vlan_cache[vlan_vid].stats);
+        vlan_cache[vlan_vid].time = INDIGO_CURRENT_TIME;
+    }
+
+    *stats = vlan_cache[vlan_vid].stats;
+}
+
+int
+ind_core_vlan_stats_bulk_get(uint16_t start_vid, uint16_t *vlan_vids,
+                             indigo_fi_vlan_stats_t *vlan_stats, int max)
+{
+    int first, count;
+
+    if (!vlan_cache_alloc()) {
+        return IND_CORE_DRIVER_CALL(indigo_fwd_vlan_stats_bulk_get,
+                                    start_vid, vlan_vids, vlan_stats, max);
+    }
+
+    if (!ind_core_counter_cache_fresh(vlan_list_time)) {
+        vlan_list_refresh();
+    }
+
+    for (first = 0; first < num_vlan_list && vlan_list[first] < start_vid;
+         first++);
+
+    for (count = 0; count < max && first + count < num_vlan_list; count++) {
+        uint16_t vid = vlan_list[first + count];
+        vlan_vids[count] = vid;
+        vlan_stats[count] = vlan_cache[vid].stats;
+    }
+
+    return count;
+}
+
+indigo_error_t
+ind_core_table_stats_get(of_table_stats_request_t *req,
+                         of_table_stats_reply_t **reply)
+{
+    indigo_error_t rv;
+    uint32_t xid;
+
+    if (table_stats_cache != NULL &&
+        table_stats_cache->version == req->version &&
+        ind_core_counter_cache_fresh(table_stats_time)) {
+        if ((*reply = of_object_dup(table_stats_cache)) == NULL) {
+            return INDIGO_ERROR_RESOURCE;
+        }
+        of_table_stats_request_xid_get(req, &xid);
+        of_table_stats_reply_xid_set(*reply, xid);
+        return INDIGO_ERROR_NONE;
+    }
+
+    rv = IND_CORE_DRIVER_CALL(indigo_fwd_table_stats_get, req, reply);
+    if (rv < 0 || cache_refresh_ms == 0) {
+        return rv;
+    }
+
+    of_object_delete(table_stats_cache);
+    table_stats_cache = of_object_dup(*reply);
+    table_stats_time = INDIGO_CURRENT_TIME;
+
+    return rv;
+}
+
+bool
+ind_core_counter_cache_get(ft_entry_t *entry,
+                           indigo_fi_flow_stats_t *flow_stats)
+{
+    if (cache_refresh_ms == 0 || entry->counters_time == 0 ||
+        INDIGO_CURRENT_TIME - entry->counters_time > 2 * cache_refresh_ms) {
+        return false;
+    }
+
+    flow_stats->flow_id = entry->id;
+    flow_stats->duration_ns = 0;
+    flow_stats->packets = entry->cached_packets;
+    flow_stats->bytes = entry->cached_bytes;
+
+    return true;
+}
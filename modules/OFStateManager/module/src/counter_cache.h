@@ -0,0 +1,103 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flow, VLAN, group and table counter cache
+ *
+ * When ind_core_config_t.counter_cache_ms is nonzero, a background task
+ * sweeps the whole flowtable every counter_cache_ms, reading the flow
+ * counters from Forwarding in bulk and caching them in the entries.
+ * Flow and aggregate stats requests are then answered from the cache,
+ * so controllers polling the same flows cost one hardware read per
+ * sweep rather than one per request.
+ *
+ * Cached counters are used only if they are at most twice
+ * counter_cache_ms old; otherwise (a new flow, or a sweep that is
+ * running behind) the counters are read from Forwarding as before.
+ *
+ * VLAN, group and table counters are cached when a request reads them
+ * and reused by later requests until they are counter_cache_ms old.
+ * Port and queue counters have their own snapshot; see port_stats.h.
+ */
+
+#ifndef _OFSTATEMANAGER_COUNTER_CACHE_H_
+#define _OFSTATEMANAGER_COUNTER_CACHE_H_
+
+#include <indigo/indigo.h>
+#include <indigo/fi.h>
+
+#include "ft_entry.h"
+
+/**
+ * Start or stop the periodic sweep
+ * @param refresh_ms Sweep interval; 0 disables the cache
+ */
+indigo_error_t ind_core_counter_cache_enable_set(int refresh_ms);
+
+/**
+ * Get an entry's cached counters
+ * @param entry The flowtable entry
+ * @param [out] flow_stats Filled in from the cache
+ * @returns true if the cache is enabled and fresh for this entry
+ */
+bool ind_core_counter_cache_get(ft_entry_t *entry,
+                                indigo_fi_flow_stats_t *flow_stats);
+
+/**
+ * Check whether counters read now should be cached
+ */
+bool ind_core_counter_cache_enabled(void);
+
+/**
+ * Check whether counters read at the given time may still be reported
+ * @param time When the counters were read; 0 if never
+ * @returns true if the cache is enabled and time is at most
+ * counter_cache_ms ago
+ */
+bool ind_core_counter_cache_fresh(indigo_time_t time);
+
+/**
+ * Get a VLAN's counters
+ *
+ * Same as indigo_fwd_vlan_stats_get, but served from the cache when it
+ * is enabled.
+ */
+void ind_core_vlan_stats_get(uint16_t vlan_vid, indigo_fi_vlan_stats_t *stats);
+
+/**
+ * Get the counters of the configured VLANs
+ *
+ * Same as indigo_fwd_vlan_stats_bulk_get. When the cache is enabled,
+ * every configured VLAN is read at once and later calls are served from
+ * that list until it is stale.
+ */
+int ind_core_vlan_stats_bulk_get(uint16_t start_vid, uint16_t *vlan_vids,
+                                 indigo_fi_vlan_stats_t *vlan_stats, int max);
+
+/**
+ * Get the table stats reply for a request
+ *
+ * Same as indigo_fwd_table_stats_get, but a reply for the same OpenFlow
+ * version is copied from the cache when it is enabled and fresh.
+ */
+indigo_error_t ind_core_table_stats_get(of_table_stats_request_t *req,
+                                        of_table_stats_reply_t **reply);
+
+#endif /* _OFSTATEMANAGER_COUNTER_CACHE_H_ */
@@ -0,0 +1,113 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Delta flow stats
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/of_state_manager.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "delta_stats.h"
+#include "ft.h"
+
+/* Start time of each connection's last delta request */
+static struct {
+    bool in_use;
+    indigo_cxn_id_t cxn_id;
+    indigo_time_t last_start;
+} delta_cxns[OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS];
+
+indigo_error_t
+ind_core_delta_stats_start(indigo_cxn_id_t cxn_id, indigo_time_t now,
+                           indigo_time_t *since)
+{
+    int i, free_idx = -1;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS; i++) {
+        if (!delta_cxns[i].in_use) {
+            if (free_idx < 0) {
+                free_idx = i;
+            }
+        } else if (delta_cxns[i].cxn_id == cxn_id) {
+            *since = delta_cxns[i].last_start;
+            delta_cxns[i].last_start = now;
+            return INDIGO_ERROR_NONE;
+        }
+    }
+
+    if (free_idx < 0) {
+        LOG_ERROR("Too many connections using delta flow stats");
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    delta_cxns[free_idx].in_use = true;
+    delta_cxns[free_idx].cxn_id = cxn_id;
+    delta_cxns[free_idx].last_start = now;
+    *since = 0;
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_core_delta_stats_observe(ft_entry_t *entry,
+                             indigo_fi_flow_stats_t *flow_stats,
+                             indigo_time_t now)
+{
+    if (flow_stats->packets != entry->last_packets ||
+        flow_stats->bytes != entry->last_bytes) {
+        entry->last_packets = flow_stats->packets;
+        entry->last_bytes = flow_stats->bytes;
+        ft_entry_counters_changed(ind_core_ft, entry, now);
+    }
+}
+
+static void
+delta_stats_cxn_status_change(indigo_cxn_id_t cxn_id,
+                              indigo_cxn_protocol_params_t *cxn_proto_params,
+                              indigo_cxn_state_t state, void *cookie)
+{
+    int i;
+
+    if (state != INDIGO_CXN_S_CLOSING && state != INDIGO_CXN_S_DISCONNECTED) {
+        return;
+    }
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS; i++) {
+        if (delta_cxns[i].in_use && delta_cxns[i].cxn_id == cxn_id) {
+            delta_cxns[i].in_use = false;
+        }
+    }
+}
+
+indigo_error_t
+ind_core_delta_stats_enable_set(int enable)
+{
+    if (enable) {
+        return indigo_cxn_status_change_register(delta_stats_cxn_status_change,
+                                                 NULL);
+    } else {
+        return indigo_cxn_status_change_unregister(delta_stats_cxn_status_change,
+                                                   NULL);
+    }
+}
@@ -0,0 +1,67 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Delta flow stats
+ *
+ * A flow stats request with INDIGO_CORE_FLOW_STATS_REQ_BSN_DELTA set
+ * gets only the flows whose counters changed since the same
+ * connection's previous delta request started.
+ *
+ * Every flow stats read compares the counters with the ones seen last
+ * time (last_packets and last_bytes in the entry) and moves
+ * last_counter_change forward if they differ. A delta request then
+ * skips flows whose last_counter_change is older than the start of the
+ * connection's previous delta request. A flow may be reported twice in
+ * a row when it changes during a request, but a change is never missed.
+ */
+
+#ifndef _OFSTATEMANAGER_DELTA_STATS_H_
+#define _OFSTATEMANAGER_DELTA_STATS_H_
+
+#include <indigo/indigo.h>
+#include <indigo/fi.h>
+#include <indigo/of_connection_manager.h>
+
+#include "ft_entry.h"
+
+/**
+ * Note the start of a delta request
+ * @param cxn_id Requesting connection
+ * @param now Start time of this request
+ * @param [out] since Start time of the previous one; 0 on the first
+ */
+indigo_error_t ind_core_delta_stats_start(indigo_cxn_id_t cxn_id,
+                                          indigo_time_t now,
+                                          indigo_time_t *since);
+
+/**
+ * Record counters read from Forwarding for an entry
+ */
+void ind_core_delta_stats_observe(ft_entry_t *entry,
+                                  indigo_fi_flow_stats_t *flow_stats,
+                                  indigo_time_t now);
+
+/**
+ * Start or stop watching for connections closing
+ */
+indigo_error_t ind_core_delta_stats_enable_set(int enable);
+
+#endif /* _OFSTATEMANAGER_DELTA_STATS_H_ */
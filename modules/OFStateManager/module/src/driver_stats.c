@@ -0,0 +1,185 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Forwarding and port manager call timing, see driver_stats.h
+ */
+
+#include "ofstatemanager_log.h"
+#include <OFStateManager/ofstatemanager.h>
+#include <indigo/indigo.h>
+#include <indigo/of_connection_manager.h>
+#include <loci/loci.h>
+#include "driver_stats.h"
+#include "handlers.h"
+
+#include <string.h>
+
+/* Name of the BSN generic stats holding these stats */
+#define DRIVER_STATS_NAME "driver_calls"
+
+static ind_core_driver_stats_t driver_stats[IND_CORE_DRIVER_FUNC_COUNT];
+
+static const char *driver_func_names[IND_CORE_DRIVER_FUNC_COUNT] = {
+#define FUNC(name) #name,
+    IND_CORE_DRIVER_FUNCS
+#undef FUNC
+};
+
+void
+ind_core_driver_call_record(ind_core_driver_func_t func,
+                            indigo_time_us_t start, int error)
+{
+    ind_core_driver_stats_t *stats = &driver_stats[func];
+
+    stats->calls++;
+    if (error) {
+        stats->errors++;
+    }
+    ind_soc_histogram_add(&stats->us, INDIGO_CURRENT_TIME_us - start);
+}
+
+void
+ind_core_driver_stats_get(ind_core_driver_func_t func,
+                          ind_core_driver_stats_t *stats)
+{
+    *stats = driver_stats[func];
+}
+
+void
+ind_core_driver_stats_show(aim_pvs_t *pvs)
+{
+    int i;
+
+    for (i = 0; i < IND_CORE_DRIVER_FUNC_COUNT; i++) {
+        ind_core_driver_stats_t *stats = &driver_stats[i];
+        if (stats->calls == 0) {
+            continue;
+        }
+        aim_printf(pvs, "%s: calls %"PRIu64", errors %"PRIu64
+                   ", p50 %"PRIu64" us, p99 %"PRIu64" us\n",
+                   driver_func_names[i], stats->calls, stats->errors,
+                   ind_soc_histogram_percentile(&stats->us, 50),
+                   ind_soc_histogram_percentile(&stats->us, 99));
+        ind_soc_histogram_show(pvs, "latency", &stats->us);
+    }
+}
+
+void
+ind_core_driver_stats_clear(void)
+{
+    INDIGO_MEM_SET(driver_stats, 0, sizeof(driver_stats));
+}
+
+static void
+append_uint64(of_list_uint64_t *list, uint64_t value)
+{
+    of_uint64_t elem;
+    of_uint64_init(&elem, list->version, -1, 1);
+    if (of_list_uint64_append_bind(list, &elem) < 0) {
+        AIM_DIE("unexpected failure appending driver stats value");
+    }
+    of_uint64_value_set(&elem, value);
+}
+
+/*
+ * One entry per function called: a name TLV, then a uint64 list TLV
+ * with the call count, error count, p50, p99 and max in microseconds
+ */
+static indigo_error_t
+driver_stats_entry_append(of_list_bsn_generic_stats_entry_t *entries,
+                          int func)
+{
+    const ind_core_driver_stats_t *stats = &driver_stats[func];
+    of_bsn_generic_stats_entry_t *entry;
+    of_list_bsn_tlv_t tlvs;
+    of_list_uint64_t values;
+    of_object_t *tlv;
+    of_octets_t name;
+    int rv;
+
+    entry = of_bsn_generic_stats_entry_new(entries->version);
+    AIM_TRUE_OR_DIE(entry != NULL);
+    of_bsn_generic_stats_entry_tlvs_bind(entry, &tlvs);
+
+    tlv = of_bsn_tlv_name_new(entries->version);
+    AIM_TRUE_OR_DIE(tlv != NULL);
+    name.data = (uint8_t *)driver_func_names[func];
+    name.bytes = strlen(driver_func_names[func]);
+    AIM_TRUE_OR_DIE(of_bsn_tlv_name_value_set(tlv, &name) == 0);
+    AIM_TRUE_OR_DIE(of_list_append(&tlvs, tlv) == 0);
+    of_object_delete(tlv);
+
+    tlv = of_bsn_tlv_uint64_list_new(entries->version);
+    AIM_TRUE_OR_DIE(tlv != NULL);
+    of_bsn_tlv_uint64_list_value_bind(tlv, &values);
+    append_uint64(&values, stats->calls);
+    append_uint64(&values, stats->errors);
+    append_uint64(&values, ind_soc_histogram_percentile(&stats->us, 50));
+    append_uint64(&values, ind_soc_histogram_percentile(&stats->us, 99));
+    append_uint64(&values, stats->us.max_us);
+    AIM_TRUE_OR_DIE(of_list_append(&tlvs, tlv) == 0);
+    of_object_delete(tlv);
+
+    rv = of_list_append(entries, entry);
+    of_object_delete(entry);
+
+    return rv < 0 ? INDIGO_ERROR_RESOURCE : INDIGO_ERROR_NONE;
+}
+
+void
+ind_core_bsn_generic_stats_request_handler(of_object_t *_obj,
+                                           indigo_cxn_id_t cxn_id)
+{
+    of_bsn_generic_stats_request_t *obj = _obj;
+    of_bsn_generic_stats_reply_t *reply;
+    of_list_bsn_generic_stats_entry_t entries;
+    of_str64_t name;
+    uint32_t xid;
+    int i;
+
+    of_bsn_generic_stats_request_name_get(obj, &name);
+    if (strncmp(name, DRIVER_STATS_NAME, sizeof(name)) != 0) {
+        ind_core_unhandled_message(_obj, cxn_id);
+        return;
+    }
+
+    of_bsn_generic_stats_request_xid_get(obj, &xid);
+
+    reply = of_bsn_generic_stats_reply_new(obj->version);
+    AIM_TRUE_OR_DIE(reply != NULL);
+
+    of_bsn_generic_stats_reply_xid_set(reply, xid);
+    of_bsn_generic_stats_reply_entries_bind(reply, &entries);
+
+    for (i = 0; i < IND_CORE_DRIVER_FUNC_COUNT; i++) {
+        if (driver_stats[i].calls == 0) {
+            continue;
+        }
+        if (driver_stats_entry_append(&entries, i) < 0) {
+            LOG_ERROR("Too many driver stats for one reply, truncating");
+            break;
+        }
+    }
+
+    of_object_delete(obj);
+
+    indigo_cxn_send_controller_message(cxn_id, reply);
+}
@@ -0,0 +1,151 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Forwarding and port manager call timing
+ *
+ * The state manager calls the platform's indigo_fwd_* and indigo_port_*
+ * functions through IND_CORE_DRIVER_CALL, which counts each call and its
+ * negative (error) returns and records its duration in a histogram.
+ * Platforms are unchanged.  The weak defaults in weak.c are not wrapped,
+ * so a bulk call that falls back to per-entry calls is timed as one.
+ * Every call other than the flow batch calls commits an open flow batch
+ * first (see ind_core_flow_batch_flush).
+ *
+ * The stats are shown by the ofstatemanager "driver_stats" ucli command
+ * and returned by a BSN generic stats request named "driver_calls".
+ */
+
+#ifndef _OFSTATEMANAGER_DRIVER_STATS_H_
+#define _OFSTATEMANAGER_DRIVER_STATS_H_
+
+#include <indigo/indigo.h>
+#include <indigo/time.h>
+#include <SocketManager/socketmanager.h>
+
+#include "flow_batch.h"
+
+#define IND_CORE_DRIVER_FUNCS                           \
+    FUNC(indigo_fwd_forwarding_features_get)            \
+    FUNC(indigo_fwd_flow_create)                        \
+    FUNC(indigo_fwd_flow_modify)                        \
+    FUNC(indigo_fwd_flow_delete)                        \
+    FUNC(indigo_fwd_flow_batch_begin)                   \
+    FUNC(indigo_fwd_flow_batch_create)                  \
+    FUNC(indigo_fwd_flow_batch_modify)                  \
+    FUNC(indigo_fwd_flow_batch_commit)                  \
+    FUNC(indigo_fwd_flow_restore)                       \
+    FUNC(indigo_fwd_flow_restore_end)                   \
+    FUNC(indigo_fwd_flow_stats_bulk_get)                \
+    FUNC(indigo_fwd_flow_hit_status_bulk_get)           \
+    FUNC(indigo_fwd_table_stats_get)                    \
+    FUNC(indigo_fwd_vlan_stats_get)                     \
+    FUNC(indigo_fwd_vlan_stats_bulk_get)                \
+    FUNC(indigo_fwd_packet_out_batch)                   \
+    FUNC(indigo_fwd_experimenter)                       \
+    FUNC(indigo_fwd_expiration_enable_set)              \
+    FUNC(indigo_fwd_group_add)                          \
+    FUNC(indigo_fwd_group_modify)                       \
+    FUNC(indigo_fwd_group_delete)                       \
+    FUNC(indigo_fwd_group_stats_bulk_get)               \
+    FUNC(indigo_fwd_pipeline_get)                       \
+    FUNC(indigo_fwd_pipeline_set)                       \
+    FUNC(indigo_fwd_pipeline_stats_get)                 \
+    FUNC(indigo_port_features_get)                      \
+    FUNC(indigo_port_desc_stats_get)                    \
+    FUNC(indigo_port_interface_list)                    \
+    FUNC(indigo_port_interface_list_destroy)            \
+    FUNC(indigo_port_modify)                            \
+    FUNC(indigo_port_stats_get)                         \
+    FUNC(indigo_port_stats_bulk_get)                    \
+    FUNC(indigo_port_extended_stats_get)                \
+    FUNC(indigo_port_extended_stats_bulk_get)           \
+    FUNC(indigo_port_queue_config_get)                  \
+    FUNC(indigo_port_queue_stats_get)                   \
+    FUNC(indigo_port_queue_stats_bulk_get)              \
+    FUNC(indigo_port_experimenter)
+
+typedef enum ind_core_driver_func_e {
+#define FUNC(name) IND_CORE_DRIVER_##name,
+    IND_CORE_DRIVER_FUNCS
+#undef FUNC
+    IND_CORE_DRIVER_FUNC_COUNT
+} ind_core_driver_func_t;
+
+/*
+ * The calls that make up a flow batch. Forwarding sees no other call
+ * while a batch is open, so the macros below commit it first.
+ */
+#define IND_CORE_DRIVER_IN_FLOW_BATCH(func)                             \
+    ((func) >= IND_CORE_DRIVER_indigo_fwd_flow_batch_begin &&           \
+     (func) <= IND_CORE_DRIVER_indigo_fwd_flow_batch_commit)
+
+/**
+ * Record a completed driver call; use IND_CORE_DRIVER_CALL
+ */
+void ind_core_driver_call_record(ind_core_driver_func_t func,
+                                 indigo_time_us_t start, int error);
+
+/**
+ * Call a driver function returning an error code or a count
+ *
+ * Evaluates to the function's result; a negative result is an error.
+ */
+#define IND_CORE_DRIVER_CALL(fn, ...)                                   \
+    ({                                                                  \
+        indigo_time_us_t _driver_start;                                 \
+        if (!IND_CORE_DRIVER_IN_FLOW_BATCH(IND_CORE_DRIVER_##fn)) {     \
+            ind_core_flow_batch_flush();                                \
+        }                                                               \
+        _driver_start = INDIGO_CURRENT_TIME_us;                         \
+        __typeof__(fn(__VA_ARGS__)) _driver_rv = fn(__VA_ARGS__);       \
+        ind_core_driver_call_record(IND_CORE_DRIVER_##fn,               \
+                                    _driver_start, _driver_rv < 0);     \
+        _driver_rv;                                                     \
+    })
+
+/**
+ * Call a driver function returning void
+ */
+#define IND_CORE_DRIVER_CALL_VOID(fn, ...)                              \
+    do {                                                                \
+        indigo_time_us_t _driver_start;                                 \
+        if (!IND_CORE_DRIVER_IN_FLOW_BATCH(IND_CORE_DRIVER_##fn)) {     \
+            ind_core_flow_batch_flush();                                \
+        }                                                               \
+        _driver_start = INDIGO_CURRENT_TIME_us;                         \
+        fn(__VA_ARGS__);                                                \
+        ind_core_driver_call_record(IND_CORE_DRIVER_##fn,               \
+                                    _driver_start, 0);                  \
+    } while (0)
+
+typedef struct ind_core_driver_stats_s {
+    uint64_t calls;
+    uint64_t errors;
+    ind_soc_histogram_t us;
+} ind_core_driver_stats_t;
+
+/**
+ * Get the stats of a driver function
+ */
+void ind_core_driver_stats_get(ind_core_driver_func_t func,
+                               ind_core_driver_stats_t *stats);
+
+#endif /* _OFSTATEMANAGER_DRIVER_STATS_H_ */
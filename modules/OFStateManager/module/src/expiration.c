@@ -28,11 +28,27 @@
 
 #include "ofstatemanager_log.h"
 #include "ofstatemanager_decs.h"
-#include "ft_entry.h"
+#include "ft.h"
+#include "flow_batch.h"
+#include "driver_stats.h"
+
+/*
+ * Entries with timeouts are kept in a hashed timer wheel. Slot i holds
+ * the entries whose cached expiration time falls in a tick congruent to
+ * i, so inserting and removing are O(1). Each tick's slot is visited
+ * once that tick has passed; entries found there that are not yet due
+ * (timeouts longer than one revolution) are simply relinked.
+ */
+#define EXPIRATION_TICK_MS 100
+#define EXPIRATION_WHEEL_SLOTS 4096 /* About 7 minutes per revolution */
 
 static void send_idle_notification(ft_entry_t *entry);
 
-static LIST_DEFINE(expiration_queue);
+static list_head_t expiration_wheel[EXPIRATION_WHEEL_SLOTS];
+static bool expiration_wheel_ready = false;
+static uint64_t expiration_tick; /* Next tick to visit */
+/* Entries taken from a visited slot and not yet handled */
+static LIST_DEFINE(expiration_due);
 static bool task_running = false;
 
 static indigo_time_t
@@ -57,27 +73,42 @@ calc_expiration_time(ft_entry_t *entry, int *reason)
     }
 }
 
+static void
+expiration_wheel_init(void)
+{
+    int i;
+
+    for (i = 0; i < EXPIRATION_WHEEL_SLOTS; i++) {
+        list_init(&expiration_wheel[i]);
+    }
+    expiration_wheel_ready = true;
+}
+
+/* Link into the slot for the cached expiration time; never a past tick */
+static void
+expiration_link(ft_entry_t *entry)
+{
+    uint64_t tick = entry->expiration_time / EXPIRATION_TICK_MS;
+
+    if (tick < expiration_tick) {
+        tick = expiration_tick;
+    }
+
+    list_push(&expiration_wheel[tick % EXPIRATION_WHEEL_SLOTS],
+              &entry->expiration_links);
+}
+
 void
 ind_core_expiration_add(ft_entry_t *entry)
 {
     int reason;
-    indigo_time_t expiration_time = calc_expiration_time(entry, &reason);
-    list_links_t *cur;
-
-    /* Iterate over list in reverse order */
-    for (cur = expiration_queue.links.prev;
-         cur != &expiration_queue.links;
-         cur = cur->prev) {
-        ft_entry_t *other = FT_ENTRY_CONTAINER(cur, expiration);
-        if (calc_expiration_time(other, &reason) <= expiration_time) {
-            /* 'other' expires before us. Insert after it. */
-            list_insert_after(cur, &entry->expiration_links);
-            return;
-        }
+
+    if (!expiration_wheel_ready) {
+        expiration_wheel_init();
     }
 
-    /* Lowest expiration time. Insert at front of list. */
-    list_unshift(&expiration_queue, &entry->expiration_links);
+    entry->expiration_time = calc_expiration_time(entry, &reason);
+    expiration_link(entry);
 }
 
 void
@@ -86,43 +117,96 @@ ind_core_expiration_remove(ft_entry_t *entry)
     list_remove(&entry->expiration_links);
 }
 
+/* Idle timeout candidates waiting for one bulk hit status read */
+static indigo_cookie_t hit_candidates[OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX];
+static int num_hit_candidates;
+
+static void
+expire_idle(ft_entry_t *entry, bool hit)
+{
+    if (hit || entry->flags & OF_FLOW_MOD_FLAG_BSN_SEND_IDLE) {
+        /* Reinsert entry into the expiration wheel */
+        ft_entry_counters_changed(ind_core_ft, entry, ind_soc_loop_now());
+        ind_core_expiration_remove(entry);
+        ind_core_expiration_add(entry);
+    }
+
+    if (!hit) {
+        if (entry->flags & OF_FLOW_MOD_FLAG_BSN_SEND_IDLE) {
+            send_idle_notification(entry);
+        } else {
+            LOG_TRACE("Idle TO (%d): " INDIGO_FLOW_ID_PRINTF_FORMAT,
+                      entry->idle_timeout,
+                      INDIGO_FLOW_ID_PRINTF_ARG(entry->id));
+            ind_core_flow_entry_delete(entry,
+                                       OF_FLOW_REMOVED_REASON_IDLE_TIMEOUT,
+                                       NULL);
+        }
+    }
+}
+
+/*
+ * Read the hit status of all idle candidates in one call and expire them
+ *
+ * Candidates are kept by flow ID, since expiring one flow may delete
+ * others (see ind_core_flow_batch_flush). A candidate is skipped if it
+ * is gone or was already refreshed.
+ */
 static void
-expire_flow(ft_entry_t *entry, int reason)
+hit_candidates_drain(indigo_time_t current_time)
+{
+    uint8_t hit_bitmap[(OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX + 7) / 8];
+    uint8_t unread_bitmap[sizeof(hit_bitmap)];
+    int rv;
+    int i;
+
+    if (num_hit_candidates == 0) {
+        return;
+    }
+
+    ind_core_flow_batch_flush();
+
+    INDIGO_MEM_CLEAR(hit_bitmap, sizeof(hit_bitmap));
+    INDIGO_MEM_CLEAR(unread_bitmap, sizeof(unread_bitmap));
+    rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_hit_status_bulk_get,
+                              hit_candidates, num_hit_candidates, hit_bitmap,
+                              unread_bitmap);
+    if (rv != INDIGO_ERROR_NONE) {
+        /* The candidates stay in the wheel and are retried next tick */
+        LOG_ERROR("Failed to get hit status for %d flows: %s",
+                  num_hit_candidates, indigo_strerror(rv));
+        num_hit_candidates = 0;
+        return;
+    }
+
+    for (i = 0; i < num_hit_candidates; i++) {
+        ft_entry_t *entry;
+        if ((unread_bitmap[i / 8] >> (i % 8)) & 1) {
+            /* Still in the wheel; retried next tick */
+            continue;
+        }
+        entry = ft_lookup(ind_core_ft, hit_candidates[i]);
+        if (entry != NULL && entry->expiration_time <= current_time) {
+            expire_idle(entry, (hit_bitmap[i / 8] >> (i % 8)) & 1);
+        }
+    }
+
+    num_hit_candidates = 0;
+}
+
+static void
+expire_flow(ft_entry_t *entry, int reason, indigo_time_t current_time)
 {
     if (reason == INDIGO_FLOW_REMOVED_HARD_TIMEOUT) {
         LOG_TRACE("Hard TO (%d): " INDIGO_FLOW_ID_PRINTF_FORMAT,
                   entry->hard_timeout,
                   INDIGO_FLOW_ID_PRINTF_ARG(entry->id));
-        ind_core_flow_entry_delete(entry, reason);
+        ind_core_flow_entry_delete(entry, reason, NULL);
     } else if (reason == OF_FLOW_REMOVED_REASON_IDLE_TIMEOUT) {
-        int rv;
-        bool hit;
-
-        /* Get hit status for idle timeouts */
-        rv = indigo_fwd_flow_hit_status_get(entry->id, &hit);
-        if (rv != INDIGO_ERROR_NONE) {
-            LOG_ERROR("Failed to get hit status for flow "
-                      INDIGO_FLOW_ID_PRINTF_FORMAT": %s",
-                      entry->id, indigo_strerror(rv));
-            return;
-        }
-
-        if (hit || entry->flags & OF_FLOW_MOD_FLAG_BSN_SEND_IDLE) {
-            /* Reinsert entry into the expiration list */
-            entry->last_counter_change = INDIGO_CURRENT_TIME;
-            ind_core_expiration_remove(entry);
-            ind_core_expiration_add(entry);
-        }
-
-        if (!hit) {
-            if (entry->flags & OF_FLOW_MOD_FLAG_BSN_SEND_IDLE) {
-                send_idle_notification(entry);
-            } else {
-                LOG_TRACE("Idle TO (%d): " INDIGO_FLOW_ID_PRINTF_FORMAT,
-                          entry->idle_timeout,
-                          INDIGO_FLOW_ID_PRINTF_ARG(entry->id));
-                ind_core_flow_entry_delete(entry, reason);
-            }
+        /* Hit status is read in bulk for idle timeouts */
+        hit_candidates[num_hit_candidates++] = entry->id;
+        if (num_hit_candidates == OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX) {
+            hit_candidates_drain(current_time);
         }
     }
 }
@@ -130,23 +214,57 @@ expire_flow(ft_entry_t *entry, int reason)
 static ind_soc_task_status_t
 expiration_task(void *cookie)
 {
-    indigo_time_t current_time = INDIGO_CURRENT_TIME;
+    indigo_time_t current_time = ind_soc_loop_now();
+    uint64_t current_tick = current_time / EXPIRATION_TICK_MS;
     (void) cookie;
 
-    while (!list_empty(&expiration_queue)) {
-        int reason;
-        list_links_t *links = expiration_queue.links.next;
-        ft_entry_t *entry = FT_ENTRY_CONTAINER(links, expiration);
-        if (calc_expiration_time(entry, &reason) <= current_time) {
-            expire_flow(entry, reason);
-        } else {
+    if (!expiration_wheel_ready) {
+        expiration_wheel_init();
+    }
+
+    /* After a long gap, one revolution visits every slot */
+    if (expiration_tick + EXPIRATION_WHEEL_SLOTS < current_tick) {
+        expiration_tick = current_tick - EXPIRATION_WHEEL_SLOTS;
+    }
+
+    while (1) {
+        list_links_t *links;
+        list_head_t *slot;
+
+        while ((links = list_pop(&expiration_due)) != NULL) {
+            int reason;
+            ft_entry_t *entry = FT_ENTRY_CONTAINER(links, expiration);
+
+            /*
+             * Relink first: a due entry lands in the next tick's slot, so
+             * it is retried if it survives expire_flow unchanged.
+             */
+            expiration_link(entry);
+            if (entry->expiration_time <= current_time) {
+                (void) calc_expiration_time(entry, &reason);
+                expire_flow(entry, reason, current_time);
+            }
+
+            if (ind_soc_should_yield()) {
+                hit_candidates_drain(current_time);
+                return IND_SOC_TASK_CONTINUE;
+            }
+        }
+
+        /* Only visit ticks that have fully passed */
+        if (expiration_tick >= current_tick) {
             break;
         }
-        if (ind_soc_should_yield()) {
-            return IND_SOC_TASK_CONTINUE;
+
+        slot = &expiration_wheel[expiration_tick % EXPIRATION_WHEEL_SLOTS];
+        expiration_tick++;
+        while ((links = list_pop(slot)) != NULL) {
+            list_push(&expiration_due, links);
         }
     }
 
+    hit_candidates_drain(current_time);
+
     task_running = false;
     return IND_SOC_TASK_FINISHED;
 }
@@ -181,6 +299,7 @@ send_idle_notification(ft_entry_t *entry)
 {
     of_bsn_flow_idle_t *msg;
     of_version_t ver;
+    of_match_t match;
 
     if (indigo_cxn_get_async_version(&ver) < 0) {
         /* No controllers connected */
@@ -196,7 +315,8 @@ send_idle_notification(ft_entry_t *entry)
     of_bsn_flow_idle_priority_set(msg, entry->priority);
     of_bsn_flow_idle_table_id_set(msg, entry->table_id);
 
-    if (of_bsn_flow_idle_match_set(msg, &entry->match)) {
+    ft_entry_match_get(entry, &match);
+    if (of_bsn_flow_idle_match_set(msg, &match)) {
         LOG_ERROR("Failed to set match in idle notification");
         of_object_delete(msg);
         return;
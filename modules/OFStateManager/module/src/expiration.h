@@ -22,7 +22,7 @@
  * @brief Flow expiration interfaces
  *
  * These functions implement efficient timeouts for large numbers of
- * flowtable entries.
+ * flowtable entries, using a timer wheel with O(1) insert and removal.
  */
 
 #ifndef _OFSTATEMANAGER_EXPIRATION_H_
@@ -0,0 +1,199 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Batched flow programming
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/forwarding.h>
+#include <SocketManager/socketmanager.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "handlers.h"
+#include "flow_batch.h"
+#include "pending.h"
+#include "driver_stats.h"
+
+enum flow_batch_op_type {
+    FLOW_BATCH_CREATE,
+    FLOW_BATCH_MODIFY,
+};
+
+struct flow_batch_op {
+    enum flow_batch_op_type type;
+    indigo_flow_id_t flow_id;
+    of_flow_modify_t *request;
+    indigo_cxn_id_t cxn_id;
+    bool release;               /* Last op using request; delete after commit */
+};
+
+static struct flow_batch_op ops[OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX];
+static indigo_fwd_flow_batch_result_t results[OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX];
+static int num_ops;
+static bool batch_open;         /* indigo_fwd_flow_batch_begin succeeded */
+
+static indigo_error_t
+flow_batch_queue(enum flow_batch_op_type type, indigo_flow_id_t flow_id,
+                 of_flow_modify_t *request, indigo_cxn_id_t cxn_id)
+{
+    struct flow_batch_op *op;
+    indigo_error_t rv;
+
+    /* Only consecutive flow-mods from one connection share a batch */
+    if (num_ops > 0 && ops[num_ops - 1].cxn_id != cxn_id) {
+        ind_core_flow_batch_flush();
+    }
+
+    if (!batch_open) {
+        rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_batch_begin);
+        if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+            return rv;
+        } else if (rv < 0) {
+            /* Program this flow without a batch */
+            LOG_ERROR("Failed to begin flow batch: %s", indigo_strerror(rv));
+            return INDIGO_ERROR_NOT_SUPPORTED;
+        }
+        batch_open = true;
+    }
+
+    if (type == FLOW_BATCH_CREATE) {
+        rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_batch_create, flow_id,
+                                  (of_flow_add_t *)request);
+    } else {
+        rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_batch_modify, flow_id, request);
+    }
+    if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+        /* The caller will program it directly, after the queued flows */
+        ind_core_flow_batch_flush();
+        return rv;
+    } else if (rv < 0) {
+        return rv;
+    }
+
+    op = &ops[num_ops++];
+    op->type = type;
+    op->flow_id = flow_id;
+    op->request = request;
+    op->cxn_id = cxn_id;
+    op->release = false;
+
+    if (num_ops == OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX) {
+        ind_core_flow_batch_flush();
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_core_flow_batch_create(indigo_flow_id_t flow_id,
+                           of_flow_modify_t *request,
+                           indigo_cxn_id_t cxn_id)
+{
+    return flow_batch_queue(FLOW_BATCH_CREATE, flow_id, request, cxn_id);
+}
+
+indigo_error_t
+ind_core_flow_batch_modify(indigo_flow_id_t flow_id,
+                           of_flow_modify_t *request,
+                           indigo_cxn_id_t cxn_id)
+{
+    return flow_batch_queue(FLOW_BATCH_MODIFY, flow_id, request, cxn_id);
+}
+
+void
+ind_core_flow_batch_release(of_object_t *request)
+{
+    int i;
+
+    for (i = num_ops - 1; i >= 0; i--) {
+        if (ops[i].request == request) {
+            ops[i].release = true;
+            return;
+        }
+    }
+
+    ind_core_pending_release(request);
+}
+
+void
+ind_core_flow_batch_flush(void)
+{
+    struct flow_batch_op *op;
+    int count = num_ops;
+    int i;
+
+    if (!batch_open) {
+        return;
+    }
+
+    LOG_TRACE("Committing flow batch of %d operations", count);
+
+    /* Closed before the results are handled */
+    batch_open = false;
+    num_ops = 0;
+
+    for (i = 0; i < count; i++) {
+        ft_entry_t *entry = ft_lookup(ind_core_ft, ops[i].flow_id);
+        results[i].status = INDIGO_ERROR_UNKNOWN;
+        /* Forwarding only sets it if it chose another table */
+        results[i].table_id = entry != NULL ? entry->table_id : 0;
+    }
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_flow_batch_commit, results, count);
+
+    for (i = 0; i < count; i++) {
+        op = &ops[i];
+        if (results[i].status == INDIGO_ERROR_PENDING) {
+            (void)ind_core_pending_add(op->type == FLOW_BATCH_CREATE ?
+                                       IND_CORE_PENDING_FLOW_CREATE :
+                                       IND_CORE_PENDING_FLOW_MODIFY,
+                                       op->flow_id, op->request, op->cxn_id);
+        } else if (op->type == FLOW_BATCH_CREATE) {
+            ind_core_flow_add_finish(results[i].status, op->flow_id,
+                                     results[i].table_id, op->request,
+                                     op->cxn_id);
+        } else {
+            ind_core_flow_modify_finish(results[i].status, op->flow_id,
+                                        op->request, op->cxn_id);
+        }
+        if (op->release) {
+            ind_core_pending_release(op->request);
+        }
+    }
+}
+
+static void
+flow_batch_pass_end(void *cookie)
+{
+    ind_core_flow_batch_flush();
+}
+
+indigo_error_t
+ind_core_flow_batch_enable_set(int enable)
+{
+    if (enable) {
+        return ind_soc_pass_end_register(flow_batch_pass_end, NULL);
+    } else {
+        ind_core_flow_batch_flush();
+        return ind_soc_pass_end_unregister(flow_batch_pass_end, NULL);
+    }
+}
@@ -0,0 +1,87 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Batched flow programming
+ *
+ * Flow creates and modifies are queued into a Forwarding batch when
+ * Forwarding supports it. The batch is committed at the end of the event
+ * loop pass, when it fills up, when a flow-mod arrives from a different
+ * connection, or before any other call into Forwarding or the port
+ * manager (IND_CORE_DRIVER_CALL does this). Each result is then handled as if the operation had
+ * just returned, so errors still reach the right connection and xid.
+ *
+ * Flow-mod requests with queued operations are kept until the commit.
+ * Barrier replies wait for them to be released, so a barrier also
+ * waits for the batch.
+ */
+
+#ifndef _OFSTATEMANAGER_FLOW_BATCH_H_
+#define _OFSTATEMANAGER_FLOW_BATCH_H_
+
+#include <indigo/indigo.h>
+#include <indigo/of_connection_manager.h>
+#include <loci/loci.h>
+
+/**
+ * Queue a flow create
+ * @param flow_id ID of the flowtable entry already added
+ * @param request The flow-mod; must stay allocated until released
+ * @param cxn_id Connection the request arrived on
+ * @returns INDIGO_ERROR_NOT_SUPPORTED if the caller must program the flow
+ * itself, or an error if Forwarding refused to queue it
+ */
+indigo_error_t ind_core_flow_batch_create(indigo_flow_id_t flow_id,
+                                          of_flow_modify_t *request,
+                                          indigo_cxn_id_t cxn_id);
+
+/**
+ * Queue a flow modify
+ *
+ * Same as ind_core_flow_batch_create. Several modifies may share one
+ * request.
+ */
+indigo_error_t ind_core_flow_batch_modify(indigo_flow_id_t flow_id,
+                                          of_flow_modify_t *request,
+                                          indigo_cxn_id_t cxn_id);
+
+/**
+ * Release a flow-mod request
+ * @param request The request
+ *
+ * The request is deleted now unless queued operations still use it,
+ * in which case it is deleted once they are committed.
+ */
+void ind_core_flow_batch_release(of_object_t *request);
+
+/**
+ * Commit any queued operations
+ *
+ * Called by IND_CORE_DRIVER_CALL before every call outside the batch.
+ * Cheap when no batch is open.
+ */
+void ind_core_flow_batch_flush(void);
+
+/**
+ * Start or stop committing at the end of each event loop pass
+ */
+indigo_error_t ind_core_flow_batch_enable_set(int enable);
+
+#endif /* _OFSTATEMANAGER_FLOW_BATCH_H_ */
@@ -0,0 +1,622 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flowtable checkpoints
+ *
+ * See flow_checkpoint.h.
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/forwarding.h>
+#include <indigo/of_state_manager.h>
+#include <SocketManager/socketmanager.h>
+#include <loci/loci.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "handlers.h"
+#include "ft.h"
+#include "pending.h"
+#include "driver_stats.h"
+#include "flow_checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * File layout, in host byte order: a checkpoint_header, then records,
+ * each a checkpoint_record followed by 2 * match_count compact match
+ * words (see ft_match_t) and effects_length bytes of effects, padded to
+ * a multiple of 8 bytes so the match words of the next record are
+ * aligned in the mapped file.
+ */
+
+#define CHECKPOINT_MAGIC 0x46544350 /* "FTCP" */
+#define CHECKPOINT_VERSION 2
+
+/* Rewrite the file once the appended records exceed the rest by this */
+#define CHECKPOINT_COMPACT_MIN (1024 * 1024)
+
+#define CHECKPOINT_PAD(_len) ((8 - ((_len) % 8)) % 8)
+
+enum checkpoint_record_type {
+    CHECKPOINT_RECORD_FLOW = 1,     /* Flow added or modified */
+    CHECKPOINT_RECORD_DELETE = 2,   /* Only flow_id is set */
+};
+
+struct checkpoint_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t match_words;           /* FT_MATCH_WORDS of the writer */
+    uint32_t pad;
+};
+
+struct checkpoint_record {
+    uint64_t flow_id;
+    uint64_t cookie;
+    uint64_t age;                   /* ms since the flow was added */
+    uint64_t match_present[FT_MATCH_PRESENT_WORDS];
+    uint32_t effects_length;
+    uint16_t type;
+    uint16_t match_count;
+    uint16_t priority;
+    uint16_t idle_timeout;
+    uint16_t hard_timeout;
+    uint16_t flags;
+    uint8_t version;                /* Of the effects */
+    uint8_t match_version;
+    uint8_t table_id;
+    uint8_t pad0;
+    uint16_t importance;
+    uint8_t pad[2];
+};
+
+/* Wraps the effects bytes of a mapped record */
+struct checkpoint_effects_view {
+    of_object_t list;
+    of_wire_buffer_t wbuf;
+};
+
+/* Open while checkpointing */
+static FILE *checkpoint_file;
+static char checkpoint_path[PATH_MAX];
+static uint64_t checkpoint_base_bytes;      /* Written by the last rewrite */
+static uint64_t checkpoint_journal_bytes;   /* Appended since */
+static bool checkpoint_dirty;               /* Records not yet flushed */
+
+static void checkpoint_pass_end(void *cookie);
+
+static bool
+checkpoint_write(FILE *f, const void *data, size_t length)
+{
+    return length == 0 || fwrite(data, length, 1, f) == 1;
+}
+
+static size_t
+checkpoint_record_length(const struct checkpoint_record *rec)
+{
+    return sizeof(*rec) + 2 * rec->match_count * sizeof(uint64_t) +
+        rec->effects_length + CHECKPOINT_PAD(rec->effects_length);
+}
+
+static void
+checkpoint_record_fill(struct checkpoint_record *rec, ft_entry_t *entry)
+{
+    of_object_t *effects = entry->effects.actions;
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->type = CHECKPOINT_RECORD_FLOW;
+    rec->flow_id = entry->id;
+    rec->cookie = entry->cookie;
+    rec->age = now > entry->insert_time ? now - entry->insert_time : 0;
+    memcpy(rec->match_present, entry->match.present,
+           sizeof(rec->match_present));
+    rec->match_count = entry->match.count;
+    rec->match_version = entry->match.version;
+    rec->priority = entry->priority;
+    rec->idle_timeout = entry->idle_timeout;
+    rec->hard_timeout = entry->hard_timeout;
+    rec->flags = entry->flags;
+    rec->table_id = entry->table_id;
+    rec->importance = entry->importance;
+    if (effects != NULL) {
+        rec->version = effects->version;
+        rec->effects_length = effects->length;
+    } else {
+        rec->version = entry->match.version;
+    }
+}
+
+/* Write a flow record; returns the bytes written, or 0 on error */
+static size_t
+checkpoint_write_flow(FILE *f, ft_entry_t *entry)
+{
+    static const uint8_t zeros[8];
+    struct checkpoint_record rec;
+    of_object_t *effects = entry->effects.actions;
+
+    checkpoint_record_fill(&rec, entry);
+
+    if (!checkpoint_write(f, &rec, sizeof(rec)) ||
+            !checkpoint_write(f, entry->match.words,
+                              2 * rec.match_count * sizeof(uint64_t)) ||
+            (effects != NULL &&
+             !checkpoint_write(f, OF_OBJECT_BUFFER_INDEX(effects, 0),
+                               rec.effects_length)) ||
+            !checkpoint_write(f, zeros, CHECKPOINT_PAD(rec.effects_length))) {
+        return 0;
+    }
+
+    return checkpoint_record_length(&rec);
+}
+
+/*
+ * Write every flow to a new file and append to it from then on
+ *
+ * The new file replaces the old one atomically, so a restart always
+ * finds a complete set of flows. If this fails the old file, if any,
+ * is kept.
+ */
+static indigo_error_t
+checkpoint_rewrite(void)
+{
+    struct checkpoint_header hdr;
+    char tmp_path[PATH_MAX];
+    ft_entry_t *entry;
+    list_links_t *cur, *next;
+    uint64_t length;
+    size_t n;
+    FILE *f;
+    bool ok;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", checkpoint_path);
+
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        LOG_ERROR("Failed to open flow checkpoint %s: %s",
+                  tmp_path, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CHECKPOINT_MAGIC;
+    hdr.version = CHECKPOINT_VERSION;
+    hdr.match_words = FT_MATCH_WORDS;
+
+    ok = checkpoint_write(f, &hdr, sizeof(hdr));
+    length = sizeof(hdr);
+    FT_ITER(ind_core_ft, entry, cur, next) {
+        if (ok) {
+            n = checkpoint_write_flow(f, entry);
+            ok = n > 0;
+            length += n;
+        }
+    }
+
+    if (!ok || fflush(f) != 0 || rename(tmp_path, checkpoint_path) < 0) {
+        LOG_ERROR("Failed to write flow checkpoint %s: %s",
+                  checkpoint_path, strerror(errno));
+        fclose(f);
+        unlink(tmp_path);
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    /* Later records go to the renamed file */
+    if (checkpoint_file != NULL) {
+        fclose(checkpoint_file);
+    }
+    checkpoint_file = f;
+    checkpoint_base_bytes = length;
+    checkpoint_journal_bytes = 0;
+    checkpoint_dirty = false;
+
+    LOG_VERBOSE("Wrote %d flows to checkpoint %s",
+                FT_STATUS(ind_core_ft)->current_count, checkpoint_path);
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Stop checkpointing; on failure the file is missing changes, remove it */
+static void
+checkpoint_close(bool ok)
+{
+    ind_soc_pass_end_unregister(checkpoint_pass_end, NULL);
+
+    if (fclose(checkpoint_file) != 0) {
+        ok = false;
+    }
+    checkpoint_file = NULL;
+
+    if (!ok) {
+        LOG_ERROR("Failed to update flow checkpoint %s: %s; removing it",
+                  checkpoint_path, strerror(errno));
+        unlink(checkpoint_path);
+    }
+}
+
+static void
+checkpoint_pass_end(void *cookie)
+{
+    if (!checkpoint_dirty) {
+        return;
+    }
+
+    if (checkpoint_journal_bytes >
+            checkpoint_base_bytes + CHECKPOINT_COMPACT_MIN &&
+            checkpoint_rewrite() == INDIGO_ERROR_NONE) {
+        return;
+    }
+
+    checkpoint_dirty = false;
+    if (fflush(checkpoint_file) != 0) {
+        checkpoint_close(false);
+    }
+}
+
+indigo_error_t
+indigo_core_flow_checkpoint_start(const char *path)
+{
+    indigo_error_t rv;
+
+    indigo_core_flow_checkpoint_stop();
+
+    /* Leave room for the temporary file's suffix */
+    if (strlen(path) + 4 >= sizeof(checkpoint_path)) {
+        return INDIGO_ERROR_PARAM;
+    }
+    strcpy(checkpoint_path, path);
+
+    if ((rv = checkpoint_rewrite()) < 0) {
+        return rv;
+    }
+
+    if ((rv = ind_soc_pass_end_register(checkpoint_pass_end, NULL)) < 0) {
+        LOG_ERROR("Could not register flow checkpoint flush");
+        fclose(checkpoint_file);
+        checkpoint_file = NULL;
+        return rv;
+    }
+
+    LOG_INFO("Writing flow checkpoint %s", path);
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_core_flow_checkpoint_stop(void)
+{
+    if (checkpoint_file != NULL) {
+        checkpoint_close(true);
+    }
+}
+
+void
+ind_core_flow_checkpoint_update(ft_entry_t *entry)
+{
+    size_t length;
+
+    if (checkpoint_file == NULL) {
+        return;
+    }
+
+    if ((length = checkpoint_write_flow(checkpoint_file, entry)) == 0) {
+        checkpoint_close(false);
+        return;
+    }
+
+    checkpoint_journal_bytes += length;
+    checkpoint_dirty = true;
+}
+
+void
+ind_core_flow_checkpoint_delete(ft_entry_t *entry)
+{
+    struct checkpoint_record rec;
+
+    if (checkpoint_file == NULL) {
+        return;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = CHECKPOINT_RECORD_DELETE;
+    rec.flow_id = entry->id;
+
+    if (!checkpoint_write(checkpoint_file, &rec, sizeof(rec))) {
+        checkpoint_close(false);
+        return;
+    }
+
+    checkpoint_journal_bytes += sizeof(rec);
+    checkpoint_dirty = true;
+}
+
+/* Restore */
+
+/* Check a record's type and lengths against the bytes left in the file */
+static bool
+checkpoint_record_valid(const struct checkpoint_record *rec, size_t avail)
+{
+    unsigned int idx;
+    int count = 0;
+
+    if (rec->type != CHECKPOINT_RECORD_FLOW &&
+            rec->type != CHECKPOINT_RECORD_DELETE) {
+        return false;
+    }
+
+    if (avail < checkpoint_record_length(rec)) {
+        return false;
+    }
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        if ((rec->match_present[idx / 64] >> (idx % 64)) & 1) {
+            count++;
+        }
+    }
+
+    return count == rec->match_count;
+}
+
+static of_object_t *
+checkpoint_effects_view_init(struct checkpoint_effects_view *view,
+                             const struct checkpoint_record *rec,
+                             uint8_t *data)
+{
+    view->wbuf.buf = data;
+    view->wbuf.alloc_bytes = rec->effects_length;
+    view->wbuf.current_bytes = rec->effects_length;
+    view->wbuf.free = NULL;
+
+    if (rec->version == OF_VERSION_1_0) {
+        of_list_action_init(&view->list, rec->version, rec->effects_length, 0);
+    } else {
+        of_list_instruction_init(&view->list, rec->version,
+                                 rec->effects_length, 0);
+    }
+    view->list.length = rec->effects_length;
+    view->list.wire_object.wbuf = &view->wbuf;
+    view->list.wire_object.obj_offset = 0;
+
+    return &view->list;
+}
+
+/* Build an add equivalent to a flow record, or NULL */
+static of_flow_add_t *
+checkpoint_flow_add(const struct checkpoint_record *rec, ft_match_t *cm,
+                    of_object_t *effects)
+{
+    of_flow_add_t *flow_add;
+    of_match_t match;
+    int rv = OF_ERROR_NONE;
+
+    if ((flow_add = of_flow_add_new(rec->version)) == NULL) {
+        return NULL;
+    }
+
+    ft_match_get(cm, &match);
+    of_flow_add_cookie_set(flow_add, rec->cookie);
+    of_flow_add_priority_set(flow_add, rec->priority);
+    of_flow_add_idle_timeout_set(flow_add, rec->idle_timeout);
+    of_flow_add_hard_timeout_set(flow_add, rec->hard_timeout);
+    of_flow_add_flags_set(flow_add, rec->flags);
+    if (rec->version >= OF_VERSION_1_1) {
+        of_flow_add_table_id_set(flow_add, rec->table_id);
+    }
+    if (rec->version >= OF_VERSION_1_4) {
+        of_flow_add_importance_set(flow_add, rec->importance);
+    }
+
+    if (effects != NULL) {
+        if (rec->version == OF_VERSION_1_0) {
+            rv = of_flow_add_actions_set(flow_add, effects);
+        } else {
+            rv = of_flow_add_instructions_set(flow_add, effects);
+        }
+    }
+
+    if (rv < 0 || of_flow_add_match_set(flow_add, &match) < 0) {
+        of_object_delete(flow_add);
+        return NULL;
+    }
+
+    return flow_add;
+}
+
+/* Apply one record to the flowtable, without calling Forwarding */
+static void
+checkpoint_replay(const struct checkpoint_record *rec, uint8_t *data)
+{
+    ft_entry_t *entry = ft_lookup(ind_core_ft, rec->flow_id);
+    struct checkpoint_effects_view view;
+    of_flow_add_t *flow_add;
+    ft_match_t cm;
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+    indigo_error_t rv;
+
+    if (rec->type == CHECKPOINT_RECORD_DELETE) {
+        if (entry != NULL) {
+            ft_delete(ind_core_ft, entry);
+        }
+        return;
+    }
+
+    memset(&cm, 0, sizeof(cm));
+    cm.version = rec->match_version;
+    cm.count = rec->match_count;
+    memcpy(cm.present, rec->match_present, sizeof(cm.present));
+    cm.words = (uint64_t *)data;
+
+    flow_add = checkpoint_flow_add(
+        rec, &cm,
+        checkpoint_effects_view_init(
+            &view, rec, data + 2 * rec->match_count * sizeof(uint64_t)));
+    if (flow_add == NULL) {
+        LOG_ERROR("Failed to rebuild checkpointed flow "
+                  INDIGO_FLOW_ID_PRINTF_FORMAT,
+                  INDIGO_FLOW_ID_PRINTF_ARG(rec->flow_id));
+        return;
+    }
+
+    if (entry != NULL) {
+        /* Modified after it was first written */
+        rv = ft_entry_modify_effects(ind_core_ft, entry, flow_add);
+    } else if (FT_FLOW_ID_IS_DIRECT(rec->flow_id) &&
+               (rv = ft_flow_id_claim(ind_core_ft, rec->flow_id)) < 0) {
+        /* Reported below */
+    } else {
+        rv = ft_add(ind_core_ft, rec->flow_id, flow_add, &entry);
+    }
+
+    if (rv == INDIGO_ERROR_NONE) {
+        entry->insert_time = now > rec->age ? now - rec->age : 0;
+        ft_entry_table_id_set(ind_core_ft, entry, rec->table_id);
+    } else {
+        LOG_ERROR("Failed to restore flow " INDIGO_FLOW_ID_PRINTF_FORMAT
+                  ": %s", INDIGO_FLOW_ID_PRINTF_ARG(rec->flow_id),
+                  indigo_strerror(rv));
+    }
+
+    of_object_delete(flow_add);
+}
+
+/*
+ * Hand a restored flow to Forwarding
+ *
+ * Completes like a flow add from a controller, so an error removes the
+ * flow and a pending result holds the add until it is done.
+ */
+static void
+checkpoint_program(ft_entry_t *entry)
+{
+    struct checkpoint_record rec;
+    of_flow_add_t *flow_add;
+    indigo_flow_id_t flow_id = entry->id;
+    uint8_t table_id = entry->table_id;
+    indigo_error_t rv;
+
+    checkpoint_record_fill(&rec, entry);
+    flow_add = checkpoint_flow_add(&rec, &entry->match, entry->effects.actions);
+    if (flow_add == NULL) {
+        LOG_ERROR("Failed to rebuild restored flow "
+                  INDIGO_FLOW_ID_PRINTF_FORMAT,
+                  INDIGO_FLOW_ID_PRINTF_ARG(flow_id));
+        ft_delete(ind_core_ft, entry);
+        return;
+    }
+
+    rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_restore, flow_id, flow_add,
+                              &table_id);
+    if (rv == INDIGO_ERROR_PENDING) {
+        (void)ind_core_pending_add(IND_CORE_PENDING_FLOW_CREATE, flow_id,
+                                   flow_add, INDIGO_CXN_ID_UNSPECIFIED);
+    } else {
+        ind_core_flow_add_finish(rv, flow_id, table_id, flow_add,
+                                 INDIGO_CXN_ID_UNSPECIFIED);
+    }
+
+    ind_core_pending_release(flow_add);
+}
+
+indigo_error_t
+indigo_core_flow_checkpoint_restore(const char *path)
+{
+    struct checkpoint_header hdr;
+    struct stat st;
+    ft_entry_t *entry;
+    list_links_t *cur, *next;
+    uint8_t *data;
+    size_t offset;
+    void *map;
+    int fd;
+
+    if (FT_STATUS(ind_core_ft)->current_count != 0) {
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return INDIGO_ERROR_NOT_FOUND;
+        }
+        LOG_ERROR("Failed to open flow checkpoint %s: %s",
+                  path, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(hdr)) {
+        LOG_ERROR("Invalid flow checkpoint %s", path);
+        close(fd);
+        return INDIGO_ERROR_PARSE;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Failed to map flow checkpoint %s: %s",
+                  path, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+    data = map;
+
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.magic != CHECKPOINT_MAGIC || hdr.version != CHECKPOINT_VERSION ||
+            hdr.match_words != FT_MATCH_WORDS) {
+        LOG_ERROR("Invalid flow checkpoint %s", path);
+        munmap(map, st.st_size);
+        return INDIGO_ERROR_PARSE;
+    }
+
+    offset = sizeof(hdr);
+    while (st.st_size - offset >= sizeof(struct checkpoint_record)) {
+        struct checkpoint_record rec;
+        memcpy(&rec, data + offset, sizeof(rec));
+        if (!checkpoint_record_valid(&rec, st.st_size - offset)) {
+            break;
+        }
+        checkpoint_replay(&rec, data + offset + sizeof(rec));
+        offset += checkpoint_record_length(&rec);
+    }
+
+    if (offset != st.st_size) {
+        LOG_WARN("Ignoring %zu bytes at the end of flow checkpoint %s",
+                 (size_t)st.st_size - offset, path);
+    }
+
+    munmap(map, st.st_size);
+
+    FT_ITER(ind_core_ft, entry, cur, next) {
+        checkpoint_program(entry);
+    }
+
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_flow_restore_end);
+
+    LOG_INFO("Restored %d flows from checkpoint %s",
+             FT_STATUS(ind_core_ft)->current_count, path);
+
+    return INDIGO_ERROR_NONE;
+}
@@ -0,0 +1,52 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flowtable checkpoints
+ *
+ * A checkpoint file starts with a record for every flow, written by
+ * indigo_core_flow_checkpoint_start, followed by a record for each flow
+ * added, modified or deleted since. Restoring replays the records in
+ * order. Records are buffered and flushed at the end of each event loop
+ * pass, and the file is rewritten from the flowtable once the appended
+ * records outgrow the initial ones.
+ *
+ * Only flows Forwarding has accepted are recorded: adds and modifies are
+ * recorded when they complete, deletes when the entry leaves the table.
+ */
+
+#ifndef _OFSTATEMANAGER_FLOW_CHECKPOINT_H_
+#define _OFSTATEMANAGER_FLOW_CHECKPOINT_H_
+
+#include <indigo/indigo.h>
+
+#include "ft_entry.h"
+
+/**
+ * Record a flow's current state after an add or modify
+ */
+void ind_core_flow_checkpoint_update(ft_entry_t *entry);
+
+/**
+ * Record that a flow was removed from the flowtable
+ */
+void ind_core_flow_checkpoint_delete(ft_entry_t *entry);
+
+#endif /* _OFSTATEMANAGER_FLOW_CHECKPOINT_H_ */
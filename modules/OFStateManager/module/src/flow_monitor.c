@@ -0,0 +1,749 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flow monitors
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <OFConnectionManager/ofconnectionmanager.h>
+#include <SocketManager/socketmanager.h>
+#include <indigo/indigo.h>
+#include <indigo/of_state_manager.h>
+#include <loci/loci.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "flow_monitor.h"
+
+/* ofp_flow_monitor_command */
+#define FLOW_MONITOR_CMD_ADD     0
+#define FLOW_MONITOR_CMD_MODIFY  1
+#define FLOW_MONITOR_CMD_DELETE  2
+
+/* ofp_flow_monitor_flags */
+#define FLOW_MONITOR_F_INITIAL       (1 << 0)
+#define FLOW_MONITOR_F_ADD           (1 << 1)
+#define FLOW_MONITOR_F_REMOVED       (1 << 2)
+#define FLOW_MONITOR_F_MODIFY        (1 << 3)
+#define FLOW_MONITOR_F_INSTRUCTIONS  (1 << 4)
+#define FLOW_MONITOR_F_NO_ABBREV     (1 << 5)
+#define FLOW_MONITOR_F_ONLY_OWN      (1 << 6)
+
+/* ofp_flow_monitor_failed_code */
+#define FLOW_MONITOR_FAILED_UNKNOWN          0
+#define FLOW_MONITOR_FAILED_MONITOR_EXISTS   1
+#define FLOW_MONITOR_FAILED_UNKNOWN_MONITOR  3
+#define FLOW_MONITOR_FAILED_BAD_COMMAND      4
+#define FLOW_MONITOR_FAILED_BAD_FLAGS        5
+
+/* ofp_flow_update_event */
+#define FLOW_UPDATE_INITIAL      0
+#define FLOW_UPDATE_ADDED        1
+#define FLOW_UPDATE_REMOVED      2
+#define FLOW_UPDATE_MODIFIED     3
+#define FLOW_UPDATE_ABBREV       4
+#define FLOW_UPDATE_PAUSED       5
+#define FLOW_UPDATE_RESUMED      6
+
+/*
+ * LOCI has no objects for the flow updates in a flow monitor reply, so
+ * replies are encoded here and wrapped with of_object_new_from_message.
+ */
+#define FLOW_MONITOR_OFPT_MULTIPART_REPLY 19
+#define FLOW_MONITOR_OFPMP_FLOW_MONITOR   16
+#define FLOW_MONITOR_OFPMPF_REPLY_MORE    1
+#define FLOW_MONITOR_REPLY_HEADER_LEN     16 /* ofp_multipart_reply */
+#define FLOW_UPDATE_FULL_HEADER_LEN       24 /* ofp_flow_update_full */
+#define FLOW_UPDATE_SHORT_LEN             8  /* Abbreviated and paused */
+
+/* Replies are sent once they pass this size */
+#define FLOW_MONITOR_REPLY_FLUSH_LEN (1 << 15)
+#define FLOW_MONITOR_REPLY_MAX_LEN 0xffff
+
+/* A flow monitor reply being built */
+typedef struct flow_monitor_reply_s {
+    uint8_t *data;              /* NULL until the first update */
+    int len;
+    int alloc;
+} flow_monitor_reply_t;
+
+typedef struct flow_monitor_s {
+    bool in_use;
+    bool paused;                /* Updates dropped until output drains */
+    indigo_cxn_id_t cxn_id;
+    uint32_t monitor_id;
+    of_version_t version;
+    uint16_t flags;
+    of_meta_match_t query;
+    flow_monitor_reply_t pending; /* Updates not yet sent */
+} flow_monitor_t;
+
+static flow_monitor_t monitors[OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS];
+static int num_monitors;
+
+struct flow_monitor_initial_state {
+    of_flow_monitor_request_t *req;
+    indigo_cxn_id_t cxn_id;
+    uint16_t flags;
+    flow_monitor_reply_t reply;
+};
+
+static void
+wire_u16_set(uint8_t *p, uint16_t val)
+{
+    p[0] = val >> 8;
+    p[1] = val;
+}
+
+static void
+wire_u32_set(uint8_t *p, uint32_t val)
+{
+    wire_u16_set(p, val >> 16);
+    wire_u16_set(p + 2, val);
+}
+
+static void
+wire_u64_set(uint8_t *p, uint64_t val)
+{
+    wire_u32_set(p, val >> 32);
+    wire_u32_set(p + 4, val);
+}
+
+static void
+reply_buffer_free(void *buf)
+{
+    INDIGO_MEM_FREE(buf);
+}
+
+/*
+ * Make room for bytes more at the end of a reply, starting it if needed
+ * Returns the zeroed space, or NULL if out of memory.
+ */
+static uint8_t *
+reply_append(flow_monitor_reply_t *reply, int bytes)
+{
+    int len = reply->data != NULL ? reply->len : FLOW_MONITOR_REPLY_HEADER_LEN;
+    int alloc = reply->alloc ? reply->alloc : 1024;
+    uint8_t *data;
+
+    while (alloc < len + bytes) {
+        alloc *= 2;
+    }
+
+    if (alloc > reply->alloc) {
+        if ((data = INDIGO_MEM_ALLOC(alloc)) == NULL) {
+            LOG_ERROR("Failed to allocate flow monitor reply");
+            return NULL;
+        }
+        if (reply->data != NULL) {
+            INDIGO_MEM_COPY(data, reply->data, reply->len);
+            INDIGO_MEM_FREE(reply->data);
+        }
+        reply->data = data;
+        reply->alloc = alloc;
+    }
+
+    reply->len = len + bytes;
+    INDIGO_MEM_CLEAR(reply->data + len, bytes);
+    return reply->data + len;
+}
+
+static void
+reply_discard(flow_monitor_reply_t *reply)
+{
+    INDIGO_MEM_FREE(reply->data);
+    INDIGO_MEM_CLEAR(reply, sizeof(*reply));
+}
+
+/* Send a reply, even if it has no updates, and reset it */
+static void
+reply_send(flow_monitor_reply_t *reply, indigo_cxn_id_t cxn_id,
+           of_version_t version, uint32_t xid, bool more)
+{
+    of_message_t msg;
+    of_object_t *obj;
+
+    if (reply->data == NULL && reply_append(reply, 0) == NULL) {
+        return;
+    }
+
+    msg = OF_BUFFER_TO_MESSAGE(reply->data);
+    of_message_version_set(msg, version);
+    of_message_type_set(msg, FLOW_MONITOR_OFPT_MULTIPART_REPLY);
+    of_message_length_set(msg, reply->len);
+    of_message_xid_set(msg, xid);
+    wire_u16_set(reply->data + 8, FLOW_MONITOR_OFPMP_FLOW_MONITOR);
+    wire_u16_set(reply->data + 10, more ? FLOW_MONITOR_OFPMPF_REPLY_MORE : 0);
+
+    obj = of_object_new_from_message(msg, reply->len);
+    if (obj == NULL) {
+        LOG_ERROR("Failed to wrap flow monitor reply");
+        reply_discard(reply);
+        return;
+    }
+    OF_OBJECT_TO_WBUF(obj)->free = reply_buffer_free;
+    INDIGO_MEM_CLEAR(reply, sizeof(*reply));
+
+    indigo_cxn_send_controller_message(cxn_id, obj);
+}
+
+/* Whether an update of bytes must go in a new reply */
+static bool
+reply_full(flow_monitor_reply_t *reply, int bytes)
+{
+    return reply->data != NULL &&
+        (reply->len >= FLOW_MONITOR_REPLY_FLUSH_LEN ||
+         reply->len + bytes > FLOW_MONITOR_REPLY_MAX_LEN);
+}
+
+/* Length of the full update for an entry, or -1 if it cannot be encoded */
+static int
+update_full_len(ft_entry_t *entry, of_octets_t *match_octets,
+                bool instructions)
+{
+    of_match_t match;
+    int len;
+
+    ft_entry_match_get(entry, &match);
+    if (of_match_serialize(entry->effects.instructions->version, &match,
+                           match_octets) < 0) {
+        LOG_ERROR("Failed to encode match for flow monitor update");
+        return -1;
+    }
+
+    len = FLOW_UPDATE_FULL_HEADER_LEN + match_octets->bytes;
+    if (instructions) {
+        len += entry->effects.instructions->length;
+    }
+
+    if (len > FLOW_MONITOR_REPLY_MAX_LEN - FLOW_MONITOR_REPLY_HEADER_LEN) {
+        LOG_ERROR("Flow " INDIGO_FLOW_ID_PRINTF_FORMAT " too large for "
+                  "a flow monitor update", INDIGO_FLOW_ID_PRINTF_ARG(entry->id));
+        INDIGO_MEM_FREE(match_octets->data);
+        return -1;
+    }
+
+    return len;
+}
+
+/* Fill in an ofp_flow_update_full; match_octets is freed */
+static void
+update_full_encode(uint8_t *p, int len, ft_entry_t *entry, uint16_t event,
+                   uint8_t reason, of_octets_t *match_octets,
+                   bool instructions)
+{
+    wire_u16_set(p, len);
+    wire_u16_set(p + 2, event);
+    p[4] = entry->table_id;
+    p[5] = reason;
+    wire_u16_set(p + 6, entry->idle_timeout);
+    wire_u16_set(p + 8, entry->hard_timeout);
+    wire_u16_set(p + 10, entry->priority);
+    wire_u64_set(p + 16, entry->cookie);
+    p += FLOW_UPDATE_FULL_HEADER_LEN;
+
+    INDIGO_MEM_COPY(p, match_octets->data, match_octets->bytes);
+    p += match_octets->bytes;
+    INDIGO_MEM_FREE(match_octets->data);
+
+    if (instructions) {
+        INDIGO_MEM_COPY(p,
+                        OF_OBJECT_BUFFER_INDEX(entry->effects.instructions, 0),
+                        entry->effects.instructions->length);
+    }
+}
+
+static void
+update_short_encode(uint8_t *p, uint16_t event, uint32_t xid)
+{
+    wire_u16_set(p, FLOW_UPDATE_SHORT_LEN);
+    wire_u16_set(p + 2, event);
+    wire_u32_set(p + 4, xid);
+}
+
+/* OFPRR_* for a removal */
+static uint8_t
+update_removed_reason(of_version_t version, indigo_fi_flow_removed_t reason)
+{
+    if (reason == INDIGO_FLOW_REMOVED_EVICTION && version >= OF_VERSION_1_4) {
+        return OF_FLOW_REMOVED_REASON_EVICTION;
+    } else if (reason > INDIGO_FLOW_REMOVED_DELETE) {
+        return INDIGO_FLOW_REMOVED_DELETE;
+    } else {
+        return reason;
+    }
+}
+
+static flow_monitor_t *
+monitor_find(indigo_cxn_id_t cxn_id, uint32_t monitor_id)
+{
+    int i;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS; i++) {
+        if (monitors[i].in_use && monitors[i].cxn_id == cxn_id &&
+                monitors[i].monitor_id == monitor_id) {
+            return &monitors[i];
+        }
+    }
+
+    return NULL;
+}
+
+static flow_monitor_t *
+monitor_alloc(void)
+{
+    int i;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS; i++) {
+        if (!monitors[i].in_use) {
+            INDIGO_MEM_SET(&monitors[i], 0, sizeof(monitors[i]));
+            monitors[i].in_use = true;
+            num_monitors++;
+            return &monitors[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Send the pending updates; unsolicited replies have xid 0 */
+static void
+monitor_flush(flow_monitor_t *monitor)
+{
+    if (monitor->pending.data != NULL) {
+        reply_send(&monitor->pending, monitor->cxn_id, monitor->version, 0,
+                   false);
+    }
+}
+
+static void
+monitor_free(flow_monitor_t *monitor)
+{
+    reply_discard(&monitor->pending);
+    monitor->in_use = false;
+    num_monitors--;
+}
+
+static bool
+monitor_matches(flow_monitor_t *monitor, ft_entry_t *entry)
+{
+    return monitor->version == entry->effects.instructions->version &&
+        ft_entry_meta_match(&monitor->query, entry);
+}
+
+/* Queue a short event, flushing first if the pending reply is full */
+static void
+monitor_short_event(flow_monitor_t *monitor, uint16_t event, uint32_t xid)
+{
+    uint8_t *p;
+
+    if (reply_full(&monitor->pending, FLOW_UPDATE_SHORT_LEN)) {
+        monitor_flush(monitor);
+    }
+
+    if ((p = reply_append(&monitor->pending, FLOW_UPDATE_SHORT_LEN)) != NULL) {
+        update_short_encode(p, event, xid);
+    }
+}
+
+static void
+monitor_full_event(flow_monitor_t *monitor, ft_entry_t *entry,
+                   uint16_t event, uint8_t reason)
+{
+    bool instructions = monitor->flags & FLOW_MONITOR_F_INSTRUCTIONS;
+    of_octets_t match_octets;
+    uint8_t *p;
+    int len;
+
+    if ((len = update_full_len(entry, &match_octets, instructions)) < 0) {
+        return;
+    }
+
+    if (reply_full(&monitor->pending, len)) {
+        monitor_flush(monitor);
+    }
+
+    if ((p = reply_append(&monitor->pending, len)) == NULL) {
+        INDIGO_MEM_FREE(match_octets.data);
+        return;
+    }
+
+    update_full_encode(p, len, entry, event, reason, &match_octets,
+                       instructions);
+}
+
+static void
+flow_monitor_resume(void *cookie)
+{
+    flow_monitor_t *monitor = cookie;
+
+    /* The monitor may have been deleted while paused */
+    if (!monitor->in_use || !monitor->paused) {
+        return;
+    }
+
+    LOG_VERBOSE("Resuming flow monitor %u of cxn %d", monitor->monitor_id,
+                monitor->cxn_id);
+    monitor->paused = false;
+    monitor_short_event(monitor, FLOW_UPDATE_RESUMED, 0);
+    monitor_flush(monitor);
+}
+
+/*
+ * Whether the monitor can take an update now
+ *
+ * Once the connection's output is blocked, updates are dropped until it
+ * drains, bracketed by paused and resumed events.
+ */
+static bool
+monitor_ready(flow_monitor_t *monitor)
+{
+    if (monitor->paused) {
+        return false;
+    }
+
+    if (!indigo_cxn_output_blocked(monitor->cxn_id)) {
+        return true;
+    }
+
+    if (indigo_cxn_output_wait(monitor->cxn_id, flow_monitor_resume,
+                               monitor) != INDIGO_ERROR_NONE) {
+        /* Drained meanwhile */
+        return true;
+    }
+
+    LOG_VERBOSE("Pausing flow monitor %u of cxn %d", monitor->monitor_id,
+                monitor->cxn_id);
+    monitor->paused = true;
+    monitor_short_event(monitor, FLOW_UPDATE_PAUSED, 0);
+    monitor_flush(monitor);
+    return false;
+}
+
+static void
+flow_monitor_reply_send(indigo_cxn_id_t cxn_id, of_flow_monitor_request_t *req)
+{
+    of_flow_monitor_reply_t *reply;
+    uint32_t xid;
+
+    if ((reply = of_flow_monitor_reply_new(req->version)) == NULL) {
+        LOG_ERROR("Failed to allocate flow monitor reply");
+        return;
+    }
+
+    of_flow_monitor_request_xid_get(req, &xid);
+    of_flow_monitor_reply_xid_set(reply, xid);
+    indigo_cxn_send_controller_message(cxn_id, reply);
+}
+
+static void
+flow_monitor_initial_iter(void *cookie, ft_entry_t *entry)
+{
+    struct flow_monitor_initial_state *state = cookie;
+    bool instructions = state->flags & FLOW_MONITOR_F_INSTRUCTIONS;
+    of_octets_t match_octets;
+    uint32_t xid;
+    uint8_t *p;
+    int len;
+
+    of_flow_monitor_request_xid_get(state->req, &xid);
+
+    if (entry != NULL) {
+        if (state->req->version != entry->effects.instructions->version) {
+            return;
+        }
+
+        if ((len = update_full_len(entry, &match_octets, instructions)) < 0) {
+            return;
+        }
+
+        if (reply_full(&state->reply, len)) {
+            reply_send(&state->reply, state->cxn_id, state->req->version, xid,
+                       true);
+        }
+
+        if ((p = reply_append(&state->reply, len)) == NULL) {
+            INDIGO_MEM_FREE(match_octets.data);
+            return;
+        }
+
+        update_full_encode(p, len, entry, FLOW_UPDATE_INITIAL, 0,
+                           &match_octets, instructions);
+        return;
+    }
+
+    /* The last part of the reply acknowledges the request */
+    reply_send(&state->reply, state->cxn_id, state->req->version, xid, false);
+
+    of_object_delete(state->req);
+    INDIGO_MEM_FREE(state);
+}
+
+static indigo_error_t
+flow_monitor_initial_start(of_flow_monitor_request_t *obj,
+                           indigo_cxn_id_t cxn_id, uint16_t flags,
+                           of_meta_match_t *query)
+{
+    struct flow_monitor_initial_state *state;
+    indigo_error_t rv;
+
+    if ((state = INDIGO_MEM_ALLOC(sizeof(*state))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    INDIGO_MEM_CLEAR(state, sizeof(*state));
+    state->req = obj;
+    state->cxn_id = cxn_id;
+    state->flags = flags;
+
+    rv = ft_spawn_cxn_iter_task(ind_core_ft, query, flow_monitor_initial_iter,
+                                state, IND_SOC_DEFAULT_PRIORITY, cxn_id);
+    if (rv != INDIGO_ERROR_NONE) {
+        INDIGO_MEM_FREE(state);
+    }
+
+    return rv;
+}
+
+/**
+ * Handle a flow monitor request
+ *
+ * Adds, modifies or deletes one monitor of the connection.
+ */
+
+void
+ind_core_flow_monitor_request_handler(of_object_t *_obj,
+                                      indigo_cxn_id_t cxn_id)
+{
+    of_flow_monitor_request_t *obj = _obj;
+    flow_monitor_t *monitor;
+    of_meta_match_t query;
+    uint32_t monitor_id;
+    uint16_t flags;
+    uint8_t command;
+    uint16_t code;
+    indigo_error_t rv;
+
+    of_flow_monitor_request_monitor_id_get(obj, &monitor_id);
+    of_flow_monitor_request_monitor_flags_get(obj, &flags);
+    of_flow_monitor_request_command_get(obj, &command);
+
+    INDIGO_MEM_SET(&query, 0, sizeof(query));
+    if (of_flow_monitor_request_match_get(obj, &query.match) < 0) {
+        LOG_ERROR("Failed to get flow monitor match.");
+        code = FLOW_MONITOR_FAILED_UNKNOWN;
+        goto error;
+    }
+    of_flow_monitor_request_table_id_get(obj, &query.table_id);
+    of_flow_monitor_request_out_port_get(obj, &query.out_port);
+    query.mode = OF_MATCH_NON_STRICT;
+
+    monitor = monitor_find(cxn_id, monitor_id);
+
+    if (command != FLOW_MONITOR_CMD_DELETE &&
+            (flags & FLOW_MONITOR_F_ONLY_OWN)) {
+        /* Deletes and timeouts are not attributed to a connection */
+        code = FLOW_MONITOR_FAILED_BAD_FLAGS;
+        goto error;
+    }
+
+    switch (command) {
+    case FLOW_MONITOR_CMD_ADD:
+        if (monitor != NULL) {
+            code = FLOW_MONITOR_FAILED_MONITOR_EXISTS;
+            goto error;
+        }
+        if ((monitor = monitor_alloc()) == NULL) {
+            LOG_ERROR("Too many flow monitors");
+            code = FLOW_MONITOR_FAILED_UNKNOWN;
+            goto error;
+        }
+        monitor->cxn_id = cxn_id;
+        monitor->monitor_id = monitor_id;
+        break;
+    case FLOW_MONITOR_CMD_MODIFY:
+        if (monitor == NULL) {
+            code = FLOW_MONITOR_FAILED_UNKNOWN_MONITOR;
+            goto error;
+        }
+        monitor_flush(monitor);
+        break;
+    case FLOW_MONITOR_CMD_DELETE:
+        if (monitor == NULL) {
+            code = FLOW_MONITOR_FAILED_UNKNOWN_MONITOR;
+            goto error;
+        }
+        LOG_VERBOSE("Deleting flow monitor %u of cxn %d", monitor_id, cxn_id);
+        monitor_free(monitor);
+        flow_monitor_reply_send(cxn_id, obj);
+        of_object_delete(_obj);
+        return;
+    default:
+        code = FLOW_MONITOR_FAILED_BAD_COMMAND;
+        goto error;
+    }
+
+    monitor->version = obj->version;
+    monitor->flags = flags;
+    monitor->query = query;
+
+    if (flags & FLOW_MONITOR_F_INITIAL) {
+        rv = flow_monitor_initial_start(obj, cxn_id, flags, &query);
+        if (rv == INDIGO_ERROR_NONE) {
+            /* Ownership of _obj is passed to the iterator */
+            return;
+        }
+        LOG_ERROR("Failed to start flow monitor iter: %s",
+                  indigo_strerror(rv));
+    }
+
+    flow_monitor_reply_send(cxn_id, obj);
+    of_object_delete(_obj);
+    return;
+
+error:
+    indigo_cxn_send_error_reply(cxn_id, _obj,
+                                OF_ERROR_TYPE_FLOW_MONITOR_FAILED, code);
+    of_object_delete(_obj);
+}
+
+void
+ind_core_flow_monitor_update(ft_entry_t *entry, bool added,
+                             indigo_cxn_id_t cxn_id, uint32_t xid)
+{
+    uint16_t flag = added ? FLOW_MONITOR_F_ADD : FLOW_MONITOR_F_MODIFY;
+    int i;
+
+    if (num_monitors == 0) {
+        return;
+    }
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS; i++) {
+        flow_monitor_t *monitor = &monitors[i];
+
+        if (!monitor->in_use || !(monitor->flags & flag) ||
+                !monitor_matches(monitor, entry) || !monitor_ready(monitor)) {
+            continue;
+        }
+
+        if (monitor->cxn_id == cxn_id &&
+                !(monitor->flags & FLOW_MONITOR_F_NO_ABBREV)) {
+            /* The controller knows what its own flow-mod did */
+            monitor_short_event(monitor, FLOW_UPDATE_ABBREV, xid);
+        } else {
+            monitor_full_event(monitor, entry,
+                               added ? FLOW_UPDATE_ADDED : FLOW_UPDATE_MODIFIED,
+                               0);
+        }
+    }
+}
+
+void
+ind_core_flow_monitor_removed(ft_entry_t *entry,
+                              indigo_fi_flow_removed_t reason,
+                              indigo_fi_flow_stats_t *final_stats)
+{
+    int i;
+
+    if (num_monitors == 0) {
+        return;
+    }
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS; i++) {
+        flow_monitor_t *monitor = &monitors[i];
+
+        if (!monitor->in_use || !(monitor->flags & FLOW_MONITOR_F_REMOVED) ||
+                !monitor_matches(monitor, entry) || !monitor_ready(monitor)) {
+            continue;
+        }
+
+        monitor_full_event(monitor, entry, FLOW_UPDATE_REMOVED,
+                           update_removed_reason(monitor->version, reason));
+    }
+}
+
+static void
+flow_monitor_pass_end(void *cookie)
+{
+    int i;
+
+    if (num_monitors == 0) {
+        return;
+    }
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS; i++) {
+        if (monitors[i].in_use) {
+            monitor_flush(&monitors[i]);
+        }
+    }
+}
+
+static void
+flow_monitor_cxn_status_change(indigo_cxn_id_t cxn_id,
+                               indigo_cxn_protocol_params_t *cxn_proto_params,
+                               indigo_cxn_state_t state, void *cookie)
+{
+    int i;
+
+    if (state != INDIGO_CXN_S_CLOSING && state != INDIGO_CXN_S_DISCONNECTED) {
+        return;
+    }
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS; i++) {
+        if (monitors[i].in_use && monitors[i].cxn_id == cxn_id) {
+            LOG_VERBOSE("Removing flow monitor %u of closed cxn %d",
+                        monitors[i].monitor_id, cxn_id);
+            monitor_free(&monitors[i]);
+        }
+    }
+}
+
+indigo_error_t
+ind_core_flow_monitor_enable_set(int enable)
+{
+    indigo_error_t rv;
+
+    if (enable) {
+        if ((rv = ind_soc_pass_end_register(flow_monitor_pass_end,
+                                            NULL)) < 0) {
+            return rv;
+        }
+        return indigo_cxn_status_change_register(
+            flow_monitor_cxn_status_change, NULL);
+    } else {
+        flow_monitor_pass_end(NULL);
+        (void)ind_soc_pass_end_unregister(flow_monitor_pass_end, NULL);
+        return indigo_cxn_status_change_unregister(
+            flow_monitor_cxn_status_change, NULL);
+    }
+}
+
+void
+ind_core_flow_monitor_finish(void)
+{
+    int i;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS; i++) {
+        if (monitors[i].in_use) {
+            monitor_free(&monitors[i]);
+        }
+    }
+}
@@ -0,0 +1,87 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flow monitors
+ *
+ * A controller adds a flow monitor with an OF 1.4 flow monitor request,
+ * filtering by match (non-strict), table and out port. The monitor's
+ * connection is then told about every flow added, modified or removed
+ * that passes the filter, whichever connection (or timeout) caused it.
+ * Only flows of the monitor's OpenFlow version are reported.
+ *
+ * Events are ofp_flow_update_full entries in flow monitor replies with
+ * xid 0, instructions included only with OFPFMF_INSTRUCTIONS. Adds and
+ * modifies made by the monitoring connection itself are abbreviated to
+ * the flow-mod's xid unless OFPFMF_NO_ABBREV is set. With
+ * OFPFMF_INITIAL the flows already in the table are reported in the
+ * reply to the request; otherwise the reply is empty. OFPFMF_ONLY_OWN
+ * is refused, since deletes and timeouts have no owning connection.
+ *
+ * Updates are coalesced into one reply per monitor until the end of the
+ * socket manager pass. If the connection's output is blocked, updates
+ * are dropped after a paused event until it drains and a resumed event
+ * is sent; the controller must then re-read the flows it cares about.
+ *
+ * LOCI has no objects for flow updates, so the replies are encoded in
+ * flow_monitor.c.
+ */
+
+#ifndef _OFSTATEMANAGER_FLOW_MONITOR_H_
+#define _OFSTATEMANAGER_FLOW_MONITOR_H_
+
+#include <indigo/indigo.h>
+#include <indigo/fi.h>
+#include <indigo/of_connection_manager.h>
+#include <loci/loci.h>
+
+#include "ft_entry.h"
+
+void ind_core_flow_monitor_request_handler(of_object_t *_obj,
+                                           indigo_cxn_id_t cxn_id);
+
+/**
+ * Report a flow that has been added or modified
+ * @param entry The flowtable entry
+ * @param added True for an add, false for a modify
+ * @param cxn_id Connection the flow-mod arrived on
+ * @param xid Of the flow-mod
+ */
+void ind_core_flow_monitor_update(ft_entry_t *entry, bool added,
+                                  indigo_cxn_id_t cxn_id, uint32_t xid);
+
+/**
+ * Report a flow that has been removed
+ */
+void ind_core_flow_monitor_removed(ft_entry_t *entry,
+                                   indigo_fi_flow_removed_t reason,
+                                   indigo_fi_flow_stats_t *final_stats);
+
+/**
+ * Start or stop watching for connections closing and pass ends
+ */
+indigo_error_t ind_core_flow_monitor_enable_set(int enable);
+
+/**
+ * Remove all monitors
+ */
+void ind_core_flow_monitor_finish(void);
+
+#endif /* _OFSTATEMANAGER_FLOW_MONITOR_H_ */
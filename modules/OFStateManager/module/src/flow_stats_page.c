@@ -0,0 +1,127 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Paginated flow stats
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/of_state_manager.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "flow_stats_page.h"
+
+#include <string.h>
+
+/* Each connection's walk in progress */
+static struct {
+    bool in_use;
+    indigo_cxn_id_t cxn_id;
+    of_meta_match_t query;
+    ft_iterator_t iter;
+} page_cxns[OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS];
+
+static void
+page_cxn_release(int idx)
+{
+    ft_iterator_cleanup(&page_cxns[idx].iter);
+    page_cxns[idx].in_use = false;
+}
+
+ft_iterator_t *
+ind_core_flow_stats_page_cursor(indigo_cxn_id_t cxn_id,
+                                of_meta_match_t *query, bool restart)
+{
+    int i, free_idx = -1;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS; i++) {
+        if (!page_cxns[i].in_use) {
+            if (free_idx < 0) {
+                free_idx = i;
+            }
+        } else if (page_cxns[i].cxn_id == cxn_id) {
+            /* The handler clears the query before filling it in */
+            if (!restart && !memcmp(&page_cxns[i].query, query,
+                                    sizeof(*query))) {
+                return &page_cxns[i].iter;
+            }
+            page_cxn_release(i);
+            free_idx = i;
+            break;
+        }
+    }
+
+    if (free_idx < 0) {
+        LOG_ERROR("Too many connections using paginated flow stats");
+        return NULL;
+    }
+
+    page_cxns[free_idx].in_use = true;
+    page_cxns[free_idx].cxn_id = cxn_id;
+    page_cxns[free_idx].query = *query;
+    ft_iterator_init(&page_cxns[free_idx].iter, ind_core_ft,
+                     &page_cxns[free_idx].query);
+
+    return &page_cxns[free_idx].iter;
+}
+
+void
+ind_core_flow_stats_page_done(indigo_cxn_id_t cxn_id)
+{
+    int i;
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS; i++) {
+        if (page_cxns[i].in_use && page_cxns[i].cxn_id == cxn_id) {
+            page_cxn_release(i);
+        }
+    }
+}
+
+static void
+flow_stats_page_cxn_status_change(indigo_cxn_id_t cxn_id,
+                                  indigo_cxn_protocol_params_t *cxn_proto_params,
+                                  indigo_cxn_state_t state, void *cookie)
+{
+    if (state == INDIGO_CXN_S_CLOSING || state == INDIGO_CXN_S_DISCONNECTED) {
+        ind_core_flow_stats_page_done(cxn_id);
+    }
+}
+
+indigo_error_t
+ind_core_flow_stats_page_enable_set(int enable)
+{
+    int i;
+
+    if (enable) {
+        return indigo_cxn_status_change_register(
+            flow_stats_page_cxn_status_change, NULL);
+    }
+
+    for (i = 0; i < OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS; i++) {
+        if (page_cxns[i].in_use) {
+            page_cxn_release(i);
+        }
+    }
+
+    return indigo_cxn_status_change_unregister(
+        flow_stats_page_cxn_status_change, NULL);
+}
@@ -0,0 +1,64 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Paginated flow stats
+ *
+ * A flow stats request with INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE set is
+ * answered with at most one page of the matching flows. The position is
+ * kept per connection in an ft_iterator_t, so flows added or deleted
+ * between pages do not disturb the walk. The next paginated request with
+ * the same filter continues where the last page stopped; one with a
+ * different filter, or with INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_RESTART
+ * set, starts over.
+ */
+
+#ifndef _OFSTATEMANAGER_FLOW_STATS_PAGE_H_
+#define _OFSTATEMANAGER_FLOW_STATS_PAGE_H_
+
+#include <indigo/indigo.h>
+#include <indigo/of_connection_manager.h>
+
+#include "ft.h"
+
+/**
+ * Get the iterator to read a connection's next page from
+ * @param cxn_id Requesting connection
+ * @param query Filter from the request
+ * @param restart Start over even if the filter is unchanged
+ * @returns NULL if too many connections have a walk in progress
+ */
+ft_iterator_t *ind_core_flow_stats_page_cursor(indigo_cxn_id_t cxn_id,
+                                               of_meta_match_t *query,
+                                               bool restart);
+
+/**
+ * Forget a connection's walk once its last page is sent
+ */
+void ind_core_flow_stats_page_done(indigo_cxn_id_t cxn_id);
+
+/**
+ * Start or stop watching for connections closing
+ *
+ * Disabling drops every walk in progress.
+ */
+indigo_error_t ind_core_flow_stats_page_enable_set(int enable);
+
+#endif /* _OFSTATEMANAGER_FLOW_STATS_PAGE_H_ */
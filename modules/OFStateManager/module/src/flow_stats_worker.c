@@ -0,0 +1,520 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flow stats reply encoding on worker threads, see flow_stats_worker.h
+ *
+ * Jobs with batches to encode are kept on a run queue. A job is on the
+ * queue or being encoded by at most one worker at a time, so its batches
+ * are encoded in order and its partial reply needs no locking. Encoded
+ * batches are moved to the job's done list and a drain task is posted to
+ * the job's event loop, which sends their replies.
+ *
+ * If the drain task cannot be posted the job is left on the stranded
+ * list instead, and a pass end callback on its loop drains it.
+ *
+ * The pool lock protects the run queue, the stranded list and each job's
+ * pending and done lists and flags. Everything else in a job is only used on the event
+ * loop, except the partial reply, which belongs to the encoding worker.
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <SocketManager/socketmanager.h>
+
+#include "ofstatemanager_log.h"
+#include "flow_stats_worker.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/* Maximum number of worker threads */
+#define FLOW_STATS_WORKERS_MAX 16
+
+/* Batches a job may have submitted but not yet sent */
+#define FLOW_STATS_JOB_BACKLOG 4
+
+/* A reply is sent once it grows past this many bytes */
+#define FLOW_STATS_REPLY_MAX_BYTES (1 << 15)
+
+struct flow_stats_batch {
+    struct flow_stats_batch *next;
+    bool last;
+    int num_snaps;
+    int num_replies;
+    ind_core_flow_stats_snapshot_t snaps[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    /* Each snapshot closes at most one reply, plus the final reply */
+    of_flow_stats_reply_t *replies[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX + 1];
+};
+
+struct ind_core_flow_stats_job_s {
+    /* Event loop only */
+    indigo_cxn_id_t cxn_id;
+    of_flow_stats_request_t *req;
+    ind_soc_loop_t *loop;
+    struct flow_stats_batch *batch;   /* Being filled */
+    int outstanding;                  /* Batches submitted but not sent */
+    indigo_cxn_output_ready_f resume;
+    void *resume_cookie;
+
+    /* Read only once created */
+    of_version_t version;
+    uint32_t xid;
+    indigo_time_t current_time;
+
+    /* Encoding worker only */
+    of_flow_stats_reply_t *reply;
+
+    /* Protected by pool.lock */
+    struct ind_core_flow_stats_job_s *run_next;
+    struct ind_core_flow_stats_job_s *stranded_next;
+    struct flow_stats_batch *pending_head;
+    struct flow_stats_batch **pending_tail;
+    struct flow_stats_batch *done_head;
+    struct flow_stats_batch **done_tail;
+    bool queued;                      /* On the run queue or being encoded */
+    bool drain_posted;
+    bool finished;                    /* Last batch encoded */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ind_core_flow_stats_job_t *run_head;
+    ind_core_flow_stats_job_t **run_tail;
+    ind_core_flow_stats_job_t *stranded;  /* Drain task could not be posted */
+    bool stopping;
+    int num_threads;
+    pthread_t threads[FLOW_STATS_WORKERS_MAX];
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .run_tail = &pool.run_head,
+};
+
+/* Allocate the job's partial reply if it does not have one */
+static indigo_error_t
+job_reply_alloc(ind_core_flow_stats_job_t *job)
+{
+    if (job->reply != NULL) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    job->reply = of_flow_stats_reply_new(job->version);
+    if (job->reply == NULL) {
+        LOG_ERROR("Failed to allocate of_flow_stats_reply.");
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    of_flow_stats_reply_xid_set(job->reply, job->xid);
+    of_flow_stats_reply_flags_set(job->reply, 1);
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Encode a batch into replies and free its snapshots */
+static void
+batch_encode(ind_core_flow_stats_job_t *job, struct flow_stats_batch *batch)
+{
+    int i;
+
+    for (i = 0; i < batch->num_snaps; i++) {
+        ind_core_flow_stats_snapshot_t *snap = &batch->snaps[i];
+
+        if (job_reply_alloc(job) == INDIGO_ERROR_NONE &&
+            ind_core_flow_stats_snapshot_append(job->reply, snap,
+                                                job->current_time) == 0 &&
+            job->reply->length > FLOW_STATS_REPLY_MAX_BYTES) {
+            batch->replies[batch->num_replies++] = job->reply;
+            job->reply = NULL;
+        }
+
+        of_object_delete(snap->effects);
+    }
+    batch->num_snaps = 0;
+
+    if (batch->last && job_reply_alloc(job) == INDIGO_ERROR_NONE) {
+        of_flow_stats_reply_flags_set(job->reply, 0);
+        batch->replies[batch->num_replies++] = job->reply;
+        job->reply = NULL;
+    }
+}
+
+/*
+ * Send the encoded replies. Runs on the event loop, either as a posted
+ * task or called directly when the job has no drain task pending.
+ */
+static ind_soc_task_status_t
+job_drain(void *cookie)
+{
+    ind_core_flow_stats_job_t *job = cookie;
+    struct flow_stats_batch *batch;
+    bool finished;
+    int i;
+
+    pthread_mutex_lock(&pool.lock);
+    batch = job->done_head;
+    job->done_head = NULL;
+    job->done_tail = &job->done_head;
+    job->drain_posted = false;
+    finished = job->finished;
+    pthread_mutex_unlock(&pool.lock);
+
+    while (batch != NULL) {
+        struct flow_stats_batch *next = batch->next;
+        for (i = 0; i < batch->num_replies; i++) {
+            indigo_cxn_send_controller_message(job->cxn_id, batch->replies[i]);
+        }
+        INDIGO_MEM_FREE(batch);
+        job->outstanding--;
+        batch = next;
+    }
+
+    if (finished) {
+        of_flow_stats_request_delete(job->req);
+        INDIGO_MEM_FREE(job);
+        return IND_SOC_TASK_FINISHED;
+    }
+
+    if (job->resume != NULL && job->outstanding < FLOW_STATS_JOB_BACKLOG) {
+        indigo_cxn_output_ready_f resume = job->resume;
+        job->resume = NULL;
+        resume(job->resume_cookie);
+    }
+
+    return IND_SOC_TASK_FINISHED;
+}
+
+/*
+ * Pass end callback draining the jobs on this loop whose drain task could
+ * not be posted
+ */
+static void
+job_drain_stranded(void *cookie)
+{
+    ind_soc_loop_t *loop = ind_soc_loop_current();
+    ind_core_flow_stats_job_t *job, **prev, *ready = NULL;
+
+    (void) cookie;
+
+    if (__atomic_load_n(&pool.stranded, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    prev = &pool.stranded;
+    while ((job = *prev) != NULL) {
+        if (job->loop == loop) {
+            *prev = job->stranded_next;
+            job->stranded_next = ready;
+            ready = job;
+        } else {
+            prev = &job->stranded_next;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    while ((job = ready) != NULL) {
+        ready = job->stranded_next;
+        (void) job_drain(job);
+    }
+}
+
+/*
+ * Move an encoded batch to the done list. Called with the pool lock held.
+ * Returns true if the caller must arrange for job_drain to run.
+ */
+static bool
+job_batch_done(ind_core_flow_stats_job_t *job, struct flow_stats_batch *batch)
+{
+    batch->next = NULL;
+    *job->done_tail = batch;
+    job->done_tail = &batch->next;
+    if (batch->last) {
+        job->finished = true;
+    }
+
+    if (job->drain_posted) {
+        return false;
+    }
+    job->drain_posted = true;
+    return true;
+}
+
+static void *
+worker_main(void *arg)
+{
+    ind_core_flow_stats_job_t *job;
+    struct flow_stats_batch *batch;
+
+    (void) arg;
+
+    pthread_mutex_lock(&pool.lock);
+    while (true) {
+        while (pool.run_head == NULL && !pool.stopping) {
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        }
+        if ((job = pool.run_head) == NULL) {
+            break; /* Stopping, and nothing left to encode */
+        }
+        if ((pool.run_head = job->run_next) == NULL) {
+            pool.run_tail = &pool.run_head;
+        }
+
+        batch = job->pending_head;
+        if ((job->pending_head = batch->next) == NULL) {
+            job->pending_tail = &job->pending_head;
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        batch_encode(job, batch);
+
+        pthread_mutex_lock(&pool.lock);
+        if (job->pending_head != NULL) {
+            /* Requeue at the tail so large requests take turns */
+            job->run_next = NULL;
+            *pool.run_tail = job;
+            pool.run_tail = &job->run_next;
+        } else {
+            job->queued = false;
+        }
+        if (job_batch_done(job, batch) &&
+            ind_soc_loop_task_post(job->loop, job_drain, job,
+                                   IND_SOC_DEFAULT_PRIORITY) < 0) {
+            /* Leave it for job_drain_stranded; drain_posted stays set */
+            LOG_ERROR("Failed to post flow stats replies to the event loop");
+            job->stranded_next = pool.stranded;
+            __atomic_store_n(&pool.stranded, job, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+static void
+workers_stop(void)
+{
+    int i;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < pool.num_threads; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+
+    pool.num_threads = 0;
+    pool.stopping = false;
+}
+
+indigo_error_t
+ind_core_flow_stats_workers_enable_set(int workers)
+{
+    int rv;
+
+    if (workers < 0 || workers > FLOW_STATS_WORKERS_MAX) {
+        LOG_ERROR("Invalid number of flow stats workers %d (max %d)",
+                  workers, FLOW_STATS_WORKERS_MAX);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (workers == pool.num_threads) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    workers_stop();
+
+    while (pool.num_threads < workers) {
+        rv = pthread_create(&pool.threads[pool.num_threads], NULL,
+                            worker_main, NULL);
+        if (rv != 0) {
+            LOG_ERROR("Failed to start flow stats worker thread: %s",
+                      strerror(rv));
+            workers_stop();
+            return INDIGO_ERROR_RESOURCE;
+        }
+        pool.num_threads++;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+bool
+ind_core_flow_stats_workers_enabled(void)
+{
+    return pool.num_threads > 0;
+}
+
+ind_core_flow_stats_job_t *
+ind_core_flow_stats_job_create(indigo_cxn_id_t cxn_id,
+                               of_flow_stats_request_t *req,
+                               indigo_time_t current_time)
+{
+    ind_core_flow_stats_job_t *job;
+
+    job = INDIGO_MEM_ALLOC(sizeof(*job));
+    if (job == NULL) {
+        return NULL;
+    }
+    INDIGO_MEM_SET(job, 0, sizeof(*job));
+
+    job->cxn_id = cxn_id;
+    job->req = req;
+    job->loop = ind_soc_loop_current();
+    job->version = req->version;
+    of_flow_stats_request_xid_get(req, &job->xid);
+    job->current_time = current_time;
+    job->pending_tail = &job->pending_head;
+    job->done_tail = &job->done_head;
+
+    /* Registering again on the same loop has no effect */
+    if (ind_soc_pass_end_register(job_drain_stranded, NULL) < 0) {
+        LOG_ERROR("Failed to register flow stats pass end callback");
+    }
+
+    return job;
+}
+
+void
+ind_core_flow_stats_job_destroy(ind_core_flow_stats_job_t *job)
+{
+    INDIGO_ASSERT(job->outstanding == 0);
+
+    if (job->batch != NULL) {
+        int i;
+        for (i = 0; i < job->batch->num_snaps; i++) {
+            of_object_delete(job->batch->snaps[i].effects);
+        }
+        INDIGO_MEM_FREE(job->batch);
+    }
+    INDIGO_MEM_FREE(job);
+}
+
+static struct flow_stats_batch *
+batch_alloc(void)
+{
+    struct flow_stats_batch *batch = INDIGO_MEM_ALLOC(sizeof(*batch));
+    if (batch == NULL) {
+        LOG_ERROR("Failed to allocate flow stats batch");
+        return NULL;
+    }
+
+    batch->next = NULL;
+    batch->last = false;
+    batch->num_snaps = 0;
+    batch->num_replies = 0;
+
+    return batch;
+}
+
+indigo_error_t
+ind_core_flow_stats_job_add(ind_core_flow_stats_job_t *job,
+                            ft_entry_t *entry,
+                            indigo_fi_flow_stats_t *flow_stats)
+{
+    ind_core_flow_stats_snapshot_t *snap;
+
+    if (job->batch != NULL &&
+        job->batch->num_snaps == OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX) {
+        ind_core_flow_stats_job_submit(job, false);
+    }
+
+    if (job->batch == NULL && (job->batch = batch_alloc()) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    snap = &job->batch->snaps[job->batch->num_snaps];
+    ind_core_flow_stats_snapshot_take(entry, flow_stats, snap);
+    if ((snap->effects = of_object_dup(snap->effects)) == NULL) {
+        LOG_ERROR("Failed to copy flow effects for flow stats");
+        return INDIGO_ERROR_RESOURCE;
+    }
+    job->batch->num_snaps++;
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_core_flow_stats_job_submit(ind_core_flow_stats_job_t *job, bool last)
+{
+    struct flow_stats_batch *batch = job->batch;
+    bool drain;
+
+    if (batch == NULL) {
+        if (!last) {
+            return;
+        }
+        if ((batch = batch_alloc()) == NULL) {
+            AIM_DIE("Failed to allocate final flow stats batch");
+        }
+    }
+    job->batch = NULL;
+    batch->last = last;
+    job->outstanding++;
+
+    pthread_mutex_lock(&pool.lock);
+    if (pool.num_threads > 0 && !pool.stopping) {
+        batch->next = NULL;
+        *job->pending_tail = batch;
+        job->pending_tail = &batch->next;
+        if (!job->queued) {
+            job->queued = true;
+            job->run_next = NULL;
+            *pool.run_tail = job;
+            pool.run_tail = &job->run_next;
+            pthread_cond_signal(&pool.cond);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    /*
+     * No workers; the earlier batches were all encoded when they were
+     * stopped, so encode this one here
+     */
+    batch_encode(job, batch);
+
+    pthread_mutex_lock(&pool.lock);
+    drain = job_batch_done(job, batch);
+    pthread_mutex_unlock(&pool.lock);
+
+    if (drain) {
+        (void) job_drain(job);
+    }
+}
+
+bool
+ind_core_flow_stats_job_wait(ind_core_flow_stats_job_t *job,
+                             indigo_cxn_output_ready_f callback,
+                             void *cookie)
+{
+    if (job->outstanding < FLOW_STATS_JOB_BACKLOG) {
+        return false;
+    }
+
+    job->resume = callback;
+    job->resume_cookie = cookie;
+
+    return true;
+}
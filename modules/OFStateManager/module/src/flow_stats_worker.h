@@ -0,0 +1,145 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Flow stats reply encoding on worker threads
+ *
+ * When ind_core_config_t.flow_stats_workers is nonzero, flow stats
+ * requests are still iterated and their counters read on the event loop,
+ * but each batch of matching entries is copied into snapshots there and
+ * the reply messages are encoded from the snapshots by a pool of worker
+ * threads. Finished replies are posted back to the event loop, which
+ * sends them in order and deletes the request after the last one, so
+ * barriers still wait for the whole reply.
+ *
+ * A snapshot owns a duplicate of the entry's effects, so later modifies
+ * and deletes do not affect a batch once it has been taken. Each batch
+ * is consistent; as before, flows added or removed while the iterator is
+ * between batches may or may not be reported.
+ *
+ * A request stops taking snapshots while too many of its batches are
+ * encoded but not yet sent, as well as while the connection is blocked.
+ */
+
+#ifndef _OFSTATEMANAGER_FLOW_STATS_WORKER_H_
+#define _OFSTATEMANAGER_FLOW_STATS_WORKER_H_
+
+#include <indigo/indigo.h>
+#include <indigo/fi.h>
+#include <indigo/of_connection_manager.h>
+#include <loci/loci.h>
+
+#include "ft_entry.h"
+
+/**
+ * The fields of a flow entry reported in a flow stats reply
+ */
+typedef struct ind_core_flow_stats_snapshot_s {
+    uint64_t cookie;
+    uint16_t priority;
+    uint16_t idle_timeout;
+    uint16_t hard_timeout;
+    uint16_t flags;
+    uint8_t table_id;
+    indigo_time_t insert_time;
+    of_match_t match;
+    of_object_t *effects;       /* Actions or instructions */
+    indigo_fi_flow_stats_t stats;
+} ind_core_flow_stats_snapshot_t;
+
+/**
+ * Fill in a snapshot of an entry
+ *
+ * The snapshot borrows the entry's effects; duplicate them to keep the
+ * snapshot past the next flow-mod.
+ */
+void ind_core_flow_stats_snapshot_take(ft_entry_t *entry,
+                                       indigo_fi_flow_stats_t *flow_stats,
+                                       ind_core_flow_stats_snapshot_t *snap);
+
+/**
+ * Append a snapshot to a flow stats reply
+ *
+ * Uses no flowtable state, so may be called from a worker thread.
+ */
+indigo_error_t ind_core_flow_stats_snapshot_append(
+    of_flow_stats_reply_t *reply,
+    const ind_core_flow_stats_snapshot_t *snap,
+    indigo_time_t current_time);
+
+/**
+ * Start or stop the worker threads
+ * @param workers Number of threads; 0 encodes replies on the event loop
+ *
+ * Stopping waits for the queued batches to be encoded.
+ */
+indigo_error_t ind_core_flow_stats_workers_enable_set(int workers);
+
+/**
+ * Returns true if new flow stats requests should use the workers
+ */
+bool ind_core_flow_stats_workers_enabled(void);
+
+typedef struct ind_core_flow_stats_job_s ind_core_flow_stats_job_t;
+
+/**
+ * Create a job answering a flow stats request
+ * @param cxn_id Connection to send the replies to
+ * @param req The request; deleted by the job after the last reply
+ * @param current_time Time to compute the flow durations from
+ */
+ind_core_flow_stats_job_t *ind_core_flow_stats_job_create(
+    indigo_cxn_id_t cxn_id,
+    of_flow_stats_request_t *req,
+    indigo_time_t current_time);
+
+/**
+ * Free a job that has not submitted anything, without deleting its request
+ */
+void ind_core_flow_stats_job_destroy(ind_core_flow_stats_job_t *job);
+
+/**
+ * Snapshot an entry into the job's current batch
+ */
+indigo_error_t ind_core_flow_stats_job_add(ind_core_flow_stats_job_t *job,
+                                           ft_entry_t *entry,
+                                           indigo_fi_flow_stats_t *flow_stats);
+
+/**
+ * Hand the current batch to the workers
+ * @param last True if there are no more entries; the job then sends the
+ * final reply, deletes the request and frees itself, and must not be used
+ * again
+ */
+void ind_core_flow_stats_job_submit(ind_core_flow_stats_job_t *job,
+                                    bool last);
+
+/**
+ * Wait for the job's backlog of unsent batches to drain
+ * @param callback Called from the event loop once it has
+ * @param cookie Opaque value passed to callback
+ * @returns true if the caller should wait for callback, false if the
+ * backlog is short enough to continue
+ */
+bool ind_core_flow_stats_job_wait(ind_core_flow_stats_job_t *job,
+                                  indigo_cxn_output_ready_f callback,
+                                  void *cookie);
+
+#endif /* _OFSTATEMANAGER_FLOW_STATS_WORKER_H_ */
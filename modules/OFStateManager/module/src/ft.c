@@ -24,48 +24,859 @@
 
 #include <OFStateManager/ofstatemanager_config.h>
 #include <indigo/indigo.h>
+#include <indigo/of_connection_manager.h>
+#include <indigo/of_state_manager.h>
 #include <murmur/murmur.h>
 
 #include "ofstatemanager_log.h"
 #include "ft.h"
 #include "expiration.h"
 
-static indigo_error_t ft_entry_create(indigo_flow_id_t id, of_flow_add_t *flow_add, ft_entry_t **entry_p);
+static indigo_error_t ft_entry_create(ft_instance_t ft, indigo_flow_id_t id, of_flow_add_t *flow_add, ft_entry_t **entry_p);
 static void ft_entry_destroy(ft_instance_t ft, ft_entry_t *entry);
-static indigo_error_t ft_entry_set_effects(ft_entry_t *entry, of_flow_modify_t *flow_mod);
+static indigo_error_t ft_entry_set_effects(ft_instance_t ft, ft_entry_t *entry, of_flow_modify_t *flow_mod);
 static void ft_entry_link(ft_instance_t ft, ft_entry_t *entry);
 static void ft_entry_unlink(ft_instance_t ft, ft_entry_t *entry);
 static int ft_entry_has_out_port(ft_entry_t *entry, of_port_no_t port);
+static int ft_entry_has_out_group(ft_entry_t *entry, uint32_t group_id);
+static void ft_defer(ft_instance_t ft, ft_deferred_kind_t kind, void *ptr);
+static void ft_deferred_free(ft_instance_t ft, bool all);
+static void ft_checksum_update(ft_instance_t ft, ft_entry_t *entry);
+static void ft_eviction_link(ft_instance_t ft, ft_entry_t *entry);
+static void ft_eviction_unlink(ft_instance_t ft, ft_entry_t *entry);
 
 #define FT_HASH_SEED 0
 
+#define FT_HASH_MULT 0x9e3779b97f4a7c15ULL
+
+/****************************************************************
+ * Compact matches
+ ****************************************************************/
+
+/* Read word idx of an of_match_fields_t, zero padding the last one */
+static inline uint64_t
+ft_match_word(const of_match_fields_t *fields, unsigned int idx)
+{
+    uint64_t word = 0;
+    unsigned int offset = idx * sizeof(word);
+    unsigned int len = sizeof(*fields) - offset;
+
+    if (len > sizeof(word)) {
+        len = sizeof(word);
+    }
+    INDIGO_MEM_COPY(&word, ((const char *)fields) + offset, len);
+
+    return word;
+}
+
+static inline void
+ft_match_word_set(of_match_fields_t *fields, unsigned int idx, uint64_t word)
+{
+    unsigned int offset = idx * sizeof(word);
+    unsigned int len = sizeof(*fields) - offset;
+
+    if (len > sizeof(word)) {
+        len = sizeof(word);
+    }
+    INDIGO_MEM_COPY(((char *)fields) + offset, &word, len);
+}
+
+static inline int
+ft_match_word_present(const ft_match_t *cm, unsigned int idx)
+{
+    return (cm->present[idx / 64] >> (idx % 64)) & 1;
+}
+
+static indigo_error_t
+ft_match_compact(ft_match_t *cm, of_match_t *match)
+{
+    uint64_t mask;
+    unsigned int idx;
+    int count = 0;
+
+    INDIGO_MEM_SET(cm, 0, sizeof(*cm));
+    cm->version = match->version;
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        if (ft_match_word(&match->masks, idx) != 0) {
+            cm->present[idx / 64] |= (uint64_t)1 << (idx % 64);
+            count++;
+        }
+    }
+
+    if (count <= FT_MATCH_INLINE_WORDS) {
+        cm->words = cm->inline_words;
+    } else {
+        cm->words = INDIGO_MEM_ALLOC(2 * count * sizeof(uint64_t));
+        if (cm->words == NULL) {
+            return INDIGO_ERROR_RESOURCE;
+        }
+    }
+    cm->count = count;
+
+    count = 0;
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        if (ft_match_word_present(cm, idx)) {
+            mask = ft_match_word(&match->masks, idx);
+            cm->words[2 * count] = ft_match_word(&match->fields, idx) & mask;
+            cm->words[2 * count + 1] = mask;
+            count++;
+        }
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+ft_match_cleanup(ft_match_t *cm)
+{
+    if (cm->words != NULL && cm->words != cm->inline_words) {
+        INDIGO_MEM_FREE(cm->words);
+    }
+    cm->words = NULL;
+    cm->count = 0;
+}
+
+static void
+ft_match_expand(ft_match_t *cm, of_match_t *match)
+{
+    unsigned int idx;
+    int count = 0;
+
+    INDIGO_MEM_SET(match, 0, sizeof(*match));
+    match->version = cm->version;
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        if (ft_match_word_present(cm, idx)) {
+            ft_match_word_set(&match->fields, idx, cm->words[2 * count]);
+            ft_match_word_set(&match->masks, idx, cm->words[2 * count + 1]);
+            count++;
+        }
+    }
+}
+
+void
+ft_entry_match_get(ft_entry_t *entry, of_match_t *match)
+{
+    ft_match_expand(&entry->match, match);
+}
+
+void
+ft_match_get(ft_match_t *cm, of_match_t *match)
+{
+    ft_match_expand(cm, match);
+}
+
+/* Stored (value, mask) for word idx, or zeros if not present */
+static inline void
+ft_match_pair(const ft_match_t *cm, unsigned int idx, int *k,
+              uint64_t *value, uint64_t *mask)
+{
+    if (ft_match_word_present(cm, idx)) {
+        *value = cm->words[2 * *k];
+        *mask = cm->words[2 * *k + 1];
+        (*k)++;
+    } else {
+        *value = 0;
+        *mask = 0;
+    }
+}
+
+/*
+ * The comparisons below are bitwise over the whole field block, matching
+ * the per-field semantics of of_match_eq, of_match_more_specific and
+ * of_match_overlap.
+ */
+
+/* Entry equals query */
+static int
+ft_match_eq(ft_match_t *cm, of_match_t *query)
+{
+    unsigned int idx;
+    int k = 0;
+    uint64_t ev, em, qm;
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        ft_match_pair(cm, idx, &k, &ev, &em);
+        qm = ft_match_word(&query->masks, idx);
+        if (em != qm ||
+            (qm != 0 && ev != (ft_match_word(&query->fields, idx) & qm))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Entry is at least as specific as query and agrees on the query's bits */
+static int
+ft_match_more_specific(ft_match_t *cm, of_match_t *query)
+{
+    unsigned int idx;
+    int k = 0;
+    uint64_t ev, em, qm;
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        ft_match_pair(cm, idx, &k, &ev, &em);
+        qm = ft_match_word(&query->masks, idx);
+        if (qm == 0) {
+            continue;
+        }
+        if ((em & qm) != qm ||
+            (ev & qm) != (ft_match_word(&query->fields, idx) & qm)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Some packet could match both entry and query */
+static int
+ft_match_overlap(ft_match_t *cm, of_match_t *query)
+{
+    unsigned int idx;
+    int k = 0;
+    uint64_t ev, em, common;
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        ft_match_pair(cm, idx, &k, &ev, &em);
+        common = em & ft_match_word(&query->masks, idx);
+        if (common == 0) {
+            continue;
+        }
+        if ((ev & common) != (ft_match_word(&query->fields, idx) & common)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * The same three tests against a flat query. Words the entry does not
+ * store are settled by comparing the present bitmaps; the stored pairs
+ * (usually a handful) are walked with their differences OR'd together
+ * rather than branching on each word.
+ */
+
+static void
+ft_match_query_init(ft_match_query_t *mq, of_match_t *query)
+{
+    unsigned int idx;
+    uint64_t mask;
+
+    INDIGO_MEM_SET(mq->present, 0, sizeof(mq->present));
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        mask = ft_match_word(&query->masks, idx);
+        mq->masks[idx] = mask;
+        mq->values[idx] = ft_match_word(&query->fields, idx) & mask;
+        if (mask != 0) {
+            mq->present[idx / 64] |= (uint64_t)1 << (idx % 64);
+        }
+    }
+}
+
+static inline int
+ft_match_eq_flat(const ft_match_t *cm, const ft_match_query_t *mq)
+{
+    unsigned int w, idx;
+    uint64_t bits, diff = 0;
+    int k = 0;
+
+    /* Both must mask the same words */
+    for (w = 0; w < FT_MATCH_PRESENT_WORDS; w++) {
+        diff |= cm->present[w] ^ mq->present[w];
+    }
+    if (diff != 0) {
+        return 0;
+    }
+
+    for (w = 0; w < FT_MATCH_PRESENT_WORDS; w++) {
+        for (bits = cm->present[w]; bits != 0; bits &= bits - 1) {
+            idx = w * 64 + __builtin_ctzll(bits);
+            diff |= (cm->words[2 * k] ^ mq->values[idx]) |
+                (cm->words[2 * k + 1] ^ mq->masks[idx]);
+            k++;
+        }
+    }
+
+    return diff == 0;
+}
+
+static inline int
+ft_match_more_specific_flat(const ft_match_t *cm, const ft_match_query_t *mq)
+{
+    unsigned int w, idx;
+    uint64_t bits, em, qm, diff = 0;
+    int k = 0;
+
+    /* The entry must mask every word the query does */
+    for (w = 0; w < FT_MATCH_PRESENT_WORDS; w++) {
+        diff |= mq->present[w] & ~cm->present[w];
+    }
+    if (diff != 0) {
+        return 0;
+    }
+
+    for (w = 0; w < FT_MATCH_PRESENT_WORDS; w++) {
+        for (bits = cm->present[w]; bits != 0; bits &= bits - 1) {
+            idx = w * 64 + __builtin_ctzll(bits);
+            em = cm->words[2 * k + 1];
+            qm = mq->masks[idx];
+            diff |= (qm & ~em) | ((cm->words[2 * k] ^ mq->values[idx]) & qm);
+            k++;
+        }
+    }
+
+    return diff == 0;
+}
+
+static inline int
+ft_match_overlap_flat(const ft_match_t *cm, const ft_match_query_t *mq)
+{
+    unsigned int w, idx;
+    uint64_t bits, diff = 0;
+    int k = 0;
+
+    /* Words only one side masks never conflict */
+    for (w = 0; w < FT_MATCH_PRESENT_WORDS; w++) {
+        for (bits = cm->present[w]; bits != 0; bits &= bits - 1) {
+            idx = w * 64 + __builtin_ctzll(bits);
+            diff |= (cm->words[2 * k] ^ mq->values[idx]) &
+                cm->words[2 * k + 1] & mq->masks[idx];
+            k++;
+        }
+    }
+
+    return diff == 0;
+}
+
+/* Copy len bytes at offset out of the compact fields and masks */
+static void
+ft_match_bytes_get(ft_match_t *cm, unsigned int offset, unsigned int len,
+                   void *value, void *mask)
+{
+    unsigned int first = offset / sizeof(uint64_t);
+    unsigned int last = (offset + len - 1) / sizeof(uint64_t);
+    unsigned int idx;
+    uint64_t words[2][2] = { { 0, 0 }, { 0, 0 } }; /* [word][value, mask] */
+    char fields_buf[2 * sizeof(uint64_t)];
+    char masks_buf[2 * sizeof(uint64_t)];
+    int k = 0;
+
+    INDIGO_ASSERT(last - first < 2);
+
+    for (idx = 0; idx <= last; idx++) {
+        uint64_t v, m;
+        ft_match_pair(cm, idx, &k, &v, &m);
+        if (idx >= first) {
+            words[idx - first][0] = v;
+            words[idx - first][1] = m;
+        }
+    }
+
+    for (idx = 0; idx < 2; idx++) {
+        INDIGO_MEM_COPY(fields_buf + idx * sizeof(uint64_t), &words[idx][0], sizeof(uint64_t));
+        INDIGO_MEM_COPY(masks_buf + idx * sizeof(uint64_t), &words[idx][1], sizeof(uint64_t));
+    }
+
+    offset -= first * sizeof(uint64_t);
+    INDIGO_MEM_COPY(value, fields_buf + offset, len);
+    INDIGO_MEM_COPY(mask, masks_buf + offset, len);
+}
+
 /**
- * @fixme Consider using something other than murmur for small data
- * hash calculations.  Multiplying by a prime is a good option
+ * Hash a match and priority for the strict_match index
+ *
+ * Only words with a nonzero mask contribute, and field bits outside the
+ * mask are ignored, so matches that are of_match_eq hash the same and
+ * mostly-wildcarded matches are cheap to hash. ft_match_hash gives the
+ * same result for the compact form.
  */
 
+#define FT_MATCH_HASH_STEP(_h, _idx, _value, _mask) do {         \
+        (_h) ^= ((_value) ^ ((_mask) * FT_HASH_MULT)) + (_idx);  \
+        (_h) *= FT_HASH_MULT;                                    \
+        (_h) ^= (_h) >> 29;                                      \
+    } while (0)
+
+static uint32_t
+ft_strict_match_hash(of_match_t *match, uint16_t priority)
+{
+    uint64_t h = FT_HASH_SEED ^ priority;
+    uint64_t mask;
+    unsigned int idx;
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        mask = ft_match_word(&match->masks, idx);
+        if (mask != 0) {
+            FT_MATCH_HASH_STEP(h, idx, ft_match_word(&match->fields, idx) & mask,
+                               mask);
+        }
+    }
+
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static uint32_t
+ft_match_hash(ft_match_t *cm, uint16_t priority)
+{
+    uint64_t h = FT_HASH_SEED ^ priority;
+    unsigned int idx;
+    int k = 0;
+
+    for (idx = 0; idx < FT_MATCH_WORDS; idx++) {
+        if (ft_match_word_present(cm, idx)) {
+            FT_MATCH_HASH_STEP(h, idx, cm->words[2 * k], cm->words[2 * k + 1]);
+            k++;
+        }
+    }
+
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static uint32_t
+ft_flow_id_hash(indigo_flow_id_t *flow_id)
+{
+    return murmur_hash(flow_id, sizeof(*flow_id), FT_HASH_SEED);
+}
+
+static uint32_t
+ft_entry_strict_match_hash(ft_entry_t *entry)
+{
+    return entry->strict_match_hash;
+}
+
+static uint32_t
+ft_entry_flow_id_hash(ft_entry_t *entry)
+{
+    return ft_flow_id_hash(&entry->id);
+}
+
+/****************************************************************
+ * Resizable hash tables
+ ****************************************************************/
+
+/****************************************************************
+ * Direct flow IDs
+ ****************************************************************/
+
+static indigo_error_t
+ft_flow_id_slots_grow(ft_instance_t ft)
+{
+    ft_flow_id_slot_t *slots;
+    ft_flow_id_slot_t *old_slots = ft->flow_id_slots;
+    int count;
+    int idx;
+
+    count = ft->flow_id_slot_count ? ft->flow_id_slot_count * 2 :
+        FT_FLOW_ID_SLOTS_INIT;
+    if (count <= ft->flow_id_slot_count) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    slots = INDIGO_MEM_ALLOC(count * sizeof(*slots));
+    if (slots == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+    if (old_slots != NULL) {
+        INDIGO_MEM_COPY(slots, old_slots,
+                        ft->flow_id_slot_count * sizeof(*slots));
+    }
+
+    /* Push new slots so that the lowest is handed out first */
+    for (idx = count - 1; idx >= ft->flow_id_slot_count; idx--) {
+        slots[idx].entry = NULL;
+        slots[idx].generation = 0;
+        slots[idx].next_free = ft->flow_id_free;
+        ft->flow_id_free = idx;
+    }
+
+    /* Readers load the count first, so publish the bigger array first */
+    __atomic_store_n(&ft->flow_id_slots, slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&ft->flow_id_slot_count, count, __ATOMIC_RELEASE);
+
+    if (old_slots != NULL) {
+        ft_defer(ft, FT_DEFERRED_MEM, old_slots);
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Relink the free slots after ft_flow_id_claim, lowest first */
+static void
+ft_flow_id_free_rebuild(ft_instance_t ft)
+{
+    int idx;
+
+    ft->flow_id_free = -1;
+    for (idx = ft->flow_id_slot_count - 1; idx >= 0; idx--) {
+        if (ft->flow_id_slots[idx].next_free != FT_FLOW_ID_SLOT_IN_USE) {
+            ft->flow_id_slots[idx].next_free = ft->flow_id_free;
+            ft->flow_id_free = idx;
+        }
+    }
+
+    ft->flow_id_free_stale = false;
+}
+
+/* Take a free slot, growing the array if necessary */
+static indigo_error_t
+ft_slot_alloc(ft_instance_t ft, ft_flow_id_slot_t **slot_p)
+{
+    ft_flow_id_slot_t *slot;
+    indigo_error_t rv;
+
+    if (ft->flow_id_free_stale) {
+        ft_flow_id_free_rebuild(ft);
+    }
+
+    if (ft->flow_id_free < 0) {
+        if ((rv = ft_flow_id_slots_grow(ft)) < 0) {
+            LOG_ERROR("ERROR: Flow table, flow id slot alloc failed");
+            return rv;
+        }
+    }
+
+    slot = &ft->flow_id_slots[ft->flow_id_free];
+    ft->flow_id_free = slot->next_free;
+    slot->next_free = FT_FLOW_ID_SLOT_IN_USE;
+    slot->entry = NULL;
+    slot->generation = (slot->generation + 1) & 0x7fffffff;
+    if (slot->generation == 0) {
+        slot->generation = 1;
+    }
+
+    *slot_p = slot;
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ft_flow_id_alloc(ft_instance_t ft, indigo_flow_id_t *id)
+{
+    ft_flow_id_slot_t *slot;
+    indigo_error_t rv;
+
+    if ((rv = ft_slot_alloc(ft, &slot)) < 0) {
+        return rv;
+    }
+
+    *id = FT_FLOW_ID_DIRECT | ((uint64_t)slot->generation << 32) |
+        (uint32_t)(slot - ft->flow_id_slots);
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ft_flow_id_claim(ft_instance_t ft, indigo_flow_id_t id)
+{
+    ft_flow_id_slot_t *slot;
+    uint32_t idx = FT_FLOW_ID_SLOT(id);
+    indigo_error_t rv;
+
+    if (!FT_FLOW_ID_IS_DIRECT(id) || FT_FLOW_ID_GENERATION(id) == 0) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    while (idx >= (uint32_t)ft->flow_id_slot_count) {
+        if ((rv = ft_flow_id_slots_grow(ft)) < 0) {
+            return rv;
+        }
+    }
+
+    slot = &ft->flow_id_slots[idx];
+    if (slot->next_free == FT_FLOW_ID_SLOT_IN_USE) {
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    /* Still linked from the free list; unlinked by ft_flow_id_free_rebuild */
+    slot->next_free = FT_FLOW_ID_SLOT_IN_USE;
+    slot->entry = NULL;
+    slot->generation = FT_FLOW_ID_GENERATION(id);
+    ft->flow_id_free_stale = true;
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Slot for a live direct flow ID, or NULL if it is unknown or stale */
+static ft_flow_id_slot_t *
+ft_flow_id_slot_get(ft_instance_t ft, indigo_flow_id_t id)
+{
+    ft_flow_id_slot_t *slot;
+    uint32_t idx = FT_FLOW_ID_SLOT(id);
+
+    if (idx >= (uint32_t)ft->flow_id_slot_count) {
+        return NULL;
+    }
+
+    slot = &ft->flow_id_slots[idx];
+    if (slot->next_free != FT_FLOW_ID_SLOT_IN_USE ||
+        slot->generation != FT_FLOW_ID_GENERATION(id)) {
+        return NULL;
+    }
+
+    return slot;
+}
+
+static void
+ft_flow_id_release(ft_instance_t ft, ft_flow_id_slot_t *slot)
+{
+    __atomic_store_n(&slot->entry, NULL, __ATOMIC_RELEASE);
+    slot->next_free = ft->flow_id_free;
+    ft->flow_id_free = slot - ft->flow_id_slots;
+}
+
+static list_head_t *
+ft_hash_buckets_alloc(int bucket_count)
+{
+    list_head_t *buckets;
+    int bytes;
+    int idx;
+
+    bytes = sizeof(list_head_t) * bucket_count;
+    buckets = INDIGO_MEM_ALLOC(bytes);
+    if (buckets == NULL) {
+        return NULL;
+    }
+    INDIGO_MEM_SET(buckets, 0, bytes);
+    for (idx = 0; idx < bucket_count; idx++) {
+        list_init(&buckets[idx]);
+    }
+
+    return buckets;
+}
+
+static indigo_error_t
+ft_hash_init(ft_hash_t *hash, int bucket_count, int links_offset,
+             uint32_t (*entry_hash)(ft_entry_t *entry))
+{
+    hash->buckets = ft_hash_buckets_alloc(bucket_count);
+    if (hash->buckets == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+    hash->bucket_count = bucket_count;
+    hash->old_buckets = NULL;
+    hash->old_bucket_count = 0;
+    hash->rehash_idx = 0;
+    hash->count = 0;
+    hash->min_bucket_count = bucket_count < FT_HASH_MIN_BUCKETS ?
+        bucket_count : FT_HASH_MIN_BUCKETS;
+    hash->links_offset = links_offset;
+    hash->entry_hash = entry_hash;
+
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+ft_hash_cleanup(ft_hash_t *hash, const char *name)
+{
+#if !defined(FT_NO_ERROR_CHECKING)
+    int idx, cnt;
+    for (idx = 0; idx < hash->bucket_count; idx++) {
+        if ((cnt = list_length(&hash->buckets[idx])) != 0) {
+            LOG_ERROR("ERROR: bucket list %s has len %d on delete",
+                      name, cnt);
+            break;
+        }
+    }
+#endif
+
+    if (hash->old_buckets != NULL) {
+        INDIGO_MEM_FREE(hash->old_buckets);
+        hash->old_buckets = NULL;
+    }
+    if (hash->buckets != NULL) {
+        INDIGO_MEM_FREE(hash->buckets);
+        hash->buckets = NULL;
+    }
+}
+
+/* Bucket currently holding entries with hash value h */
+static list_head_t *
+ft_hash_bucket(ft_hash_t *hash, uint32_t h)
+{
+    if (hash->old_buckets != NULL) {
+        int old_idx = h % hash->old_bucket_count;
+        if (old_idx >= hash->rehash_idx) {
+            return &hash->old_buckets[old_idx];
+        }
+    }
+
+    return &hash->buckets[h % hash->bucket_count];
+}
+
+/* Move up to 'steps' old buckets into the current bucket array */
+static void
+ft_hash_rehash(ft_hash_t *hash, int steps)
+{
+    list_head_t *old_bucket;
+    list_links_t *links;
+    ft_entry_t *entry;
+
+    while (hash->old_buckets != NULL && steps-- > 0) {
+        old_bucket = &hash->old_buckets[hash->rehash_idx++];
+        while ((links = list_pop(old_bucket)) != NULL) {
+            entry = (ft_entry_t *)(((char *)links) - hash->links_offset);
+            list_push(&hash->buckets[hash->entry_hash(entry) % hash->bucket_count],
+                      links);
+        }
+
+        if (hash->rehash_idx == hash->old_bucket_count) {
+            INDIGO_MEM_FREE(hash->old_buckets);
+            hash->old_buckets = NULL;
+            hash->old_bucket_count = 0;
+            hash->rehash_idx = 0;
+        }
+    }
+}
+
+/*
+ * Advance any resize in progress and start a new one if the load
+ * factor is out of range. If the new bucket array can't be allocated
+ * the table keeps its current size.
+ */
+static void
+ft_hash_update(ft_instance_t ft, ft_hash_t *hash, const char *name)
+{
+    int count = hash->count;
+    int new_bucket_count;
+    list_head_t *new_buckets;
+
+    if (hash->buckets == NULL) {
+        return;
+    }
+
+    if (hash->old_buckets != NULL) {
+        ft_hash_rehash(hash, FT_HASH_REHASH_STEP);
+        return;
+    }
+
+    if (count > hash->bucket_count * FT_HASH_LOAD_MAX) {
+        new_bucket_count = hash->bucket_count * 2;
+    } else if (hash->bucket_count > hash->min_bucket_count &&
+               count * FT_HASH_LOAD_MIN < hash->bucket_count) {
+        new_bucket_count = hash->bucket_count / 2;
+        if (new_bucket_count < hash->min_bucket_count) {
+            new_bucket_count = hash->min_bucket_count;
+        }
+    } else {
+        return;
+    }
+
+    new_buckets = ft_hash_buckets_alloc(new_bucket_count);
+    if (new_buckets == NULL) {
+        LOG_ERROR("ERROR: Flow table, %s bucket resize to %d failed",
+                  name, new_bucket_count);
+        return;
+    }
+
+    LOG_VERBOSE("Resizing flow table %s buckets from %d to %d",
+                name, hash->bucket_count, new_bucket_count);
+
+    hash->old_buckets = hash->buckets;
+    hash->old_bucket_count = hash->bucket_count;
+    hash->rehash_idx = 0;
+    hash->buckets = new_buckets;
+    hash->bucket_count = new_bucket_count;
+    ft->status.hash_resizes += 1;
+
+    ft_hash_rehash(hash, FT_HASH_REHASH_STEP);
+}
+
 static int
-ft_strict_match_to_bucket_index(ft_instance_t ft,
-                                of_match_t *match,
-                                uint16_t priority)
+ft_hash_load(ft_hash_t *hash)
+{
+    if (hash->bucket_count == 0) {
+        return 0;
+    }
+    return (int)(((int64_t)hash->count * 100) / hash->bucket_count);
+}
+
+/* Called after each add or delete */
+static void
+ft_hashes_update(ft_instance_t ft)
 {
-    uint32_t h = FT_HASH_SEED;
-    h = murmur_hash(match, sizeof(*match), h);
-    h = murmur_hash(&priority, sizeof(priority), h);
-    return h % ft->config.strict_match_bucket_count;
+    ft_hash_update(ft, &ft->strict_match_hash, "strict_match");
+    ft_hash_update(ft, &ft->flow_id_hash, "flow_id");
+
+    ft->status.strict_match_load = ft_hash_load(&ft->strict_match_hash);
+    ft->status.flow_id_load = ft_hash_load(&ft->flow_id_hash);
 }
 
+/* Multiplicative hash of the indexed cookie bits */
 static int
-ft_flow_id_to_bucket_index(ft_instance_t ft, indigo_flow_id_t *flow_id)
+ft_cookie_to_bucket_index(ft_cookie_index_t *index, uint64_t cookie)
 {
-    return (murmur_hash(flow_id, sizeof(*flow_id), FT_HASH_SEED) %
-            ft->config.flow_id_bucket_count);
+    return ((cookie & index->mask) * FT_HASH_MULT) >>
+        (64 - FT_COOKIE_INDEX_BUCKET_BITS);
 }
 
 static int
-ft_cookie_to_bucket_index(ft_instance_t ft, uint64_t cookie)
+ft_cookie_links_offset(int index)
+{
+    return offsetof(ft_entry_t, cookie_links) + index * sizeof(list_links_t);
+}
+
+static bool
+ft_match_in_port_exact(of_match_t *match)
 {
-    return cookie >> (64-FT_COOKIE_PREFIX_LEN);
+    return match->masks.in_port == (of_port_no_t)-1;
+}
+
+/* Entries without an exact in_port share the last bucket */
+static int
+ft_in_port_to_bucket_index(ft_instance_t ft, of_match_t *match)
+{
+    if (!ft_match_in_port_exact(match)) {
+        return FT_IN_PORT_BUCKETS;
+    }
+    return match->fields.in_port % FT_IN_PORT_BUCKETS;
+}
+
+static int
+ft_entry_in_port_to_bucket_index(ft_instance_t ft, ft_entry_t *entry)
+{
+    of_port_no_t in_port, mask;
+
+    ft_match_bytes_get(&entry->match, offsetof(of_match_fields_t, in_port),
+                       sizeof(in_port), &in_port, &mask);
+    if (mask != (of_port_no_t)-1) {
+        return FT_IN_PORT_BUCKETS;
+    }
+    return in_port % FT_IN_PORT_BUCKETS;
+}
+
+static int
+ft_out_port_to_bucket_index(ft_instance_t ft, ft_entry_t *entry)
+{
+    if (entry->num_out_ports == 0) {
+        return FT_OUT_PORT_BUCKET_NONE;
+    } else if (entry->num_out_ports == 1) {
+        return entry->out_ports[0] % FT_OUT_PORT_BUCKETS;
+    } else {
+        return FT_OUT_PORT_BUCKET_MULTI;
+    }
+}
+
+static int
+ft_out_group_to_bucket_index(ft_instance_t ft, ft_entry_t *entry)
+{
+    if (entry->num_out_groups == 0) {
+        return FT_OUT_GROUP_BUCKET_NONE;
+    } else if (entry->num_out_groups == 1) {
+        return entry->out_groups[0] % FT_OUT_GROUP_BUCKETS;
+    } else {
+        return FT_OUT_GROUP_BUCKET_MULTI;
+    }
+}
+
+static int
+ft_priority_to_bucket_index(ft_instance_t ft, uint16_t priority)
+{
+    return priority % FT_PRIORITY_BUCKETS;
 }
 
 ft_instance_t
@@ -74,6 +885,7 @@ ft_create(ft_config_t *config)
     ft_instance_t ft;
     int bytes;
     int idx;
+    int i;
 
     /* Allocate the flow table itself */
     ft = INDIGO_MEM_ALLOC(sizeof(*ft));
@@ -85,91 +897,202 @@ ft_create(ft_config_t *config)
     INDIGO_MEM_COPY(&ft->config,  config, sizeof(ft_config_t));
 
     list_init(&ft->all_list);
+    list_init(&ft->entry_slabs);
+    ft->flow_id_free = -1;
+    ft->read_epoch = 1;
+
+    for (i = 0; i < FT_TABLES; i++) {
+        ft->checksums[i].buckets = &ft->checksums[i].bucket0;
+        ft->checksums[i].buckets_size = 1;
+        ft->checksums[i].buckets_shift = 64;
+    }
 
     /* Allocate and init buckets for each search type */
-    bytes = sizeof(list_head_t) * config->strict_match_bucket_count;
-    ft->strict_match_buckets = INDIGO_MEM_ALLOC(bytes);
-    if (ft->strict_match_buckets == NULL) {
+    if (ft_hash_init(&ft->strict_match_hash, config->strict_match_bucket_count,
+                     offsetof(ft_entry_t, strict_match_links),
+                     ft_entry_strict_match_hash) < 0) {
         LOG_ERROR("ERROR: Flow table, strict_match bucket alloc failed");
         ft_destroy(ft);
         return NULL;
     }
-    INDIGO_MEM_SET(ft->strict_match_buckets, 0, bytes);
-    for (idx = 0; idx < config->strict_match_bucket_count; idx++) {
-        list_init(&ft->strict_match_buckets[idx]);
-    }
 
-    bytes = sizeof(list_head_t) * config->flow_id_bucket_count;
-    ft->flow_id_buckets = INDIGO_MEM_ALLOC(bytes);
-    if (ft->flow_id_buckets == NULL) {
+    if (ft_hash_init(&ft->flow_id_hash, config->flow_id_bucket_count,
+                     offsetof(ft_entry_t, flow_id_links),
+                     ft_entry_flow_id_hash) < 0) {
         LOG_ERROR("ERROR: Flow table, flow id bucket alloc failed");
         ft_destroy(ft);
         return NULL;
     }
-    INDIGO_MEM_SET(ft->flow_id_buckets, 0, bytes);
-    for (idx = 0; idx < config->flow_id_bucket_count; idx++) {
-        list_init(&ft->flow_id_buckets[idx]);
+
+    for (i = 0; i < FT_COOKIE_INDEXES_MAX; i++) {
+        ft_cookie_index_t *index = &ft->cookie_indexes[i];
+        uint64_t mask = config->cookie_index_masks[i];
+
+        if (mask == 0) {
+            if (i > 0) {
+                break;
+            }
+            mask = FT_COOKIE_PREFIX_MASK;
+        }
+
+        bytes = sizeof(list_head_t) * FT_COOKIE_INDEX_BUCKETS;
+        index->buckets = INDIGO_MEM_ALLOC(bytes);
+        if (index->buckets == NULL) {
+            LOG_ERROR("ERROR: Flow table, cookie bucket alloc failed");
+            ft_destroy(ft);
+            return NULL;
+        }
+        INDIGO_MEM_SET(index->buckets, 0, bytes);
+        for (idx = 0; idx < FT_COOKIE_INDEX_BUCKETS; idx++) {
+            list_init(&index->buckets[idx]);
+        }
+        index->mask = mask;
+        index->bits = __builtin_popcountll(mask);
+        ft->num_cookie_indexes++;
     }
 
-    bytes = sizeof(list_head_t) * (1 << FT_COOKIE_PREFIX_LEN);
-    ft->cookie_buckets = INDIGO_MEM_ALLOC(bytes);
-    if (ft->cookie_buckets == NULL) {
-        LOG_ERROR("ERROR: Flow table, flow id bucket alloc failed");
+    bytes = sizeof(list_head_t) * (FT_IN_PORT_BUCKETS + 1);
+    ft->in_port_buckets = INDIGO_MEM_ALLOC(bytes);
+    if (ft->in_port_buckets == NULL) {
+        LOG_ERROR("ERROR: Flow table, in_port bucket alloc failed");
+        ft_destroy(ft);
+        return NULL;
+    }
+    INDIGO_MEM_SET(ft->in_port_buckets, 0, bytes);
+    for (idx = 0; idx < FT_IN_PORT_BUCKETS + 1; idx++) {
+        list_init(&ft->in_port_buckets[idx]);
+    }
+
+    bytes = sizeof(list_head_t) * (FT_OUT_PORT_BUCKETS + 2);
+    ft->out_port_buckets = INDIGO_MEM_ALLOC(bytes);
+    if (ft->out_port_buckets == NULL) {
+        LOG_ERROR("ERROR: Flow table, out_port bucket alloc failed");
+        ft_destroy(ft);
+        return NULL;
+    }
+    INDIGO_MEM_SET(ft->out_port_buckets, 0, bytes);
+    for (idx = 0; idx < FT_OUT_PORT_BUCKETS + 2; idx++) {
+        list_init(&ft->out_port_buckets[idx]);
+    }
+
+    bytes = sizeof(list_head_t) * (FT_OUT_GROUP_BUCKETS + 2);
+    ft->out_group_buckets = INDIGO_MEM_ALLOC(bytes);
+    if (ft->out_group_buckets == NULL) {
+        LOG_ERROR("ERROR: Flow table, out_group bucket alloc failed");
+        ft_destroy(ft);
+        return NULL;
+    }
+    INDIGO_MEM_SET(ft->out_group_buckets, 0, bytes);
+    for (idx = 0; idx < FT_OUT_GROUP_BUCKETS + 2; idx++) {
+        list_init(&ft->out_group_buckets[idx]);
+    }
+
+    bytes = sizeof(list_head_t) * FT_TABLES;
+    ft->table_buckets = INDIGO_MEM_ALLOC(bytes);
+    if (ft->table_buckets == NULL) {
+        LOG_ERROR("ERROR: Flow table, table bucket alloc failed");
         ft_destroy(ft);
         return NULL;
     }
-    INDIGO_MEM_SET(ft->cookie_buckets, 0, bytes);
-    for (idx = 0; idx < (1 << FT_COOKIE_PREFIX_LEN); idx++) {
-        list_init(&ft->cookie_buckets[idx]);
+    INDIGO_MEM_SET(ft->table_buckets, 0, bytes);
+    for (idx = 0; idx < FT_TABLES; idx++) {
+        list_init(&ft->table_buckets[idx]);
+    }
+
+    bytes = sizeof(list_head_t) * FT_PRIORITY_BUCKETS;
+    ft->priority_buckets = INDIGO_MEM_ALLOC(bytes);
+    if (ft->priority_buckets == NULL) {
+        LOG_ERROR("ERROR: Flow table, priority bucket alloc failed");
+        ft_destroy(ft);
+        return NULL;
+    }
+    INDIGO_MEM_SET(ft->priority_buckets, 0, bytes);
+    for (idx = 0; idx < FT_PRIORITY_BUCKETS; idx++) {
+        list_init(&ft->priority_buckets[idx]);
     }
 
     return ft;
 }
 
-/* Macro for checking bucket lists are empty */
-#if !defined(FT_NO_ERROR_CHECKING)
-#define CHECK_BUCKETS(type) do {                                           \
-        int idx, cnt;                                                      \
-        for (idx = 0; idx < ft->config.type##_bucket_count; idx++) {       \
-            if ((cnt = list_length(&ft->type##_buckets[idx])) != 0) {      \
-                LOG_ERROR("ERROR: bucket list %s has len %d on delete",    \
-                          #type, cnt);                                     \
-                break;                                                     \
-            }                                                              \
-        }                                                                  \
-    } while (0)
-#else
-#define CHECK_BUCKETS(type)
-#endif
-
 void
 ft_destroy(ft_instance_t ft)
 {
     ft_entry_t *entry;
     list_links_t *cur, *next;
+    int i;
 
     if (ft == NULL) {
         return;
     }
 
+    /* There must be no readers left */
+    ft_deferred_free(ft, true);
+    if (ft->deferred != NULL) {
+        INDIGO_MEM_FREE(ft->deferred);
+        ft->deferred = NULL;
+    }
+
     FT_ITER(ft, entry, cur, next) {
         ft_entry_unlink(ft, entry);
         ft_entry_destroy(ft, entry);
     }
 
-    if (ft->strict_match_buckets != NULL) {
-        CHECK_BUCKETS(strict_match);
-        INDIGO_MEM_FREE(ft->strict_match_buckets);
-        ft->strict_match_buckets = NULL;
+    /* All slabs are empty now, so all are on the list */
+    LIST_FOREACH_SAFE(&ft->entry_slabs, cur, next) {
+        list_remove(cur);
+        indigo_mem_tag_free(INDIGO_MEM_TAG_FLOW_ENTRY,
+                            container_of(cur, links, ft_entry_slab_t),
+                            sizeof(ft_entry_slab_t));
+        ft->num_entry_slabs--;
     }
-    if (ft->flow_id_buckets != NULL) {
-        CHECK_BUCKETS(flow_id);
-        INDIGO_MEM_FREE(ft->flow_id_buckets);
-        ft->flow_id_buckets = NULL;
+    INDIGO_ASSERT(ft->num_entry_slabs == 0);
+
+    if (ft->flow_id_slots != NULL) {
+        INDIGO_MEM_FREE(ft->flow_id_slots);
+        ft->flow_id_slots = NULL;
     }
-    if (ft->cookie_buckets != NULL) {
-        INDIGO_MEM_FREE(ft->cookie_buckets);
-        ft->cookie_buckets = NULL;
+
+    for (i = 0; i < FT_TABLES; i++) {
+        if (ft->checksums[i].buckets != &ft->checksums[i].bucket0) {
+            INDIGO_MEM_FREE(ft->checksums[i].buckets);
+        }
+        ft->checksums[i].buckets = NULL;
+        if (ft->evictions[i].heap != NULL) {
+            INDIGO_MEM_FREE(ft->evictions[i].heap);
+            ft->evictions[i].heap = NULL;
+        }
+    }
+
+    if (ft->strict_match_hash.buckets != NULL) {
+        ft_hash_cleanup(&ft->strict_match_hash, "strict_match");
+    }
+    if (ft->flow_id_hash.buckets != NULL) {
+        ft_hash_cleanup(&ft->flow_id_hash, "flow_id");
+    }
+    for (i = 0; i < ft->num_cookie_indexes; i++) {
+        INDIGO_MEM_FREE(ft->cookie_indexes[i].buckets);
+        ft->cookie_indexes[i].buckets = NULL;
+    }
+    ft->num_cookie_indexes = 0;
+    if (ft->in_port_buckets != NULL) {
+        INDIGO_MEM_FREE(ft->in_port_buckets);
+        ft->in_port_buckets = NULL;
+    }
+    if (ft->out_port_buckets != NULL) {
+        INDIGO_MEM_FREE(ft->out_port_buckets);
+        ft->out_port_buckets = NULL;
+    }
+    if (ft->out_group_buckets != NULL) {
+        INDIGO_MEM_FREE(ft->out_group_buckets);
+        ft->out_group_buckets = NULL;
+    }
+    if (ft->table_buckets != NULL) {
+        INDIGO_MEM_FREE(ft->table_buckets);
+        ft->table_buckets = NULL;
+    }
+    if (ft->priority_buckets != NULL) {
+        INDIGO_MEM_FREE(ft->priority_buckets);
+        ft->priority_buckets = NULL;
     }
 
     INDIGO_MEM_FREE(ft);
@@ -180,22 +1103,41 @@ ft_add(ft_instance_t ft, indigo_flow_id_t id,
        of_flow_add_t *flow_add, ft_entry_t **entry_p)
 {
     ft_entry_t *entry = NULL;
+    ft_flow_id_slot_t *slot = NULL;
     indigo_error_t rv;
 
     LOG_TRACE("Adding flow " INDIGO_FLOW_ID_PRINTF_FORMAT, id);
 
-    /* If flow ID already exists, error. */
-    if (ft_lookup(ft, id) != NULL) {
+    if (FT_FLOW_ID_IS_DIRECT(id)) {
+        /* Must come from ft_flow_id_alloc and not be added yet */
+        if ((slot = ft_flow_id_slot_get(ft, id)) == NULL) {
+            LOG_ERROR("Flow id " INDIGO_FLOW_ID_PRINTF_FORMAT " not allocated",
+                      id);
+            return INDIGO_ERROR_PARAM;
+        }
+        if (slot->entry != NULL) {
+            return INDIGO_ERROR_EXISTS;
+        }
+    } else if (ft_lookup(ft, id) != NULL) {
+        /* If flow ID already exists, error. */
         return INDIGO_ERROR_EXISTS;
+    } else if ((rv = ft_slot_alloc(ft, &slot)) < 0) {
+        /* Slot only for readers; the ID is hashed */
+        return rv;
     }
 
-    if ((rv = ft_entry_create(id, flow_add, &entry)) < 0) {
+    if ((rv = ft_entry_create(ft, id, flow_add, &entry)) < 0) {
+        ft_flow_id_release(ft, slot);
         return rv;
     }
 
+    entry->slot = slot - ft->flow_id_slots;
     ft_entry_link(ft, entry);
+    /* Publish to readers once complete */
+    __atomic_store_n(&slot->entry, entry, __ATOMIC_RELEASE);
     ft->status.adds += 1;
     ft->status.current_count += 1;
+    ft_hashes_update(ft);
 
     if (entry_p != NULL) {
         *entry_p = entry;
@@ -209,11 +1151,34 @@ ft_delete(ft_instance_t ft, ft_entry_t *entry)
 {
     LOG_TRACE("Delete flow " INDIGO_FLOW_ID_PRINTF_FORMAT, entry->id);
 
+    ft_detach(ft, entry);
+    ft_detached_free(ft, entry);
+}
+
+void
+ft_detach(ft_instance_t ft, ft_entry_t *entry)
+{
+    ft_flow_id_slot_t *slot = &ft->flow_id_slots[entry->slot];
+
+    INDIGO_ASSERT(slot->entry == entry);
+    /*
+     * Hide the entry from readers but keep the slot, which Forwarding may
+     * use as its handle, until the delete completes
+     */
+    __atomic_store_n(&slot->entry, NULL, __ATOMIC_RELEASE);
+
     ft_entry_unlink(ft, entry);
-    ft_entry_destroy(ft, entry);
 
     ft->status.current_count -= 1;
     ft->status.deletes += 1;
+    ft_hashes_update(ft);
+}
+
+void
+ft_detached_free(ft_instance_t ft, ft_entry_t *entry)
+{
+    ft_flow_id_release(ft, &ft->flow_id_slots[entry->slot]);
+    ft_defer(ft, FT_DEFERRED_ENTRY, entry);
 }
 
 indigo_error_t
@@ -221,17 +1186,21 @@ ft_strict_match(ft_instance_t instance,
                of_meta_match_t *query,
                ft_entry_t **entry_ptr)
 {
-    int bucket_idx;
+    list_head_t *bucket;
     list_links_t *cur;
+    uint32_t h;
 
     INDIGO_ASSERT(query->mode == OF_MATCH_STRICT);
 
-    bucket_idx = ft_strict_match_to_bucket_index(instance, &query->match,
-                                                 query->priority);
-    list_head_t *bucket = &instance->strict_match_buckets[bucket_idx];
+    h = ft_strict_match_hash(&query->match, query->priority);
+    bucket = ft_hash_bucket(&instance->strict_match_hash, h);
 
     LIST_FOREACH(bucket, cur) {
         ft_entry_t *entry = FT_ENTRY_CONTAINER(cur, strict_match);
+        /* Cheap reject before the full comparison */
+        if (entry->strict_match_hash != h) {
+            continue;
+        }
         if (ft_entry_meta_match(query, entry)) {
             *entry_ptr = entry;
             return INDIGO_ERROR_NONE;
@@ -244,9 +1213,16 @@ ft_strict_match(ft_instance_t instance,
 ft_entry_t *
 ft_lookup(ft_instance_t ft, indigo_flow_id_t id)
 {
-    int bucket_idx = ft_flow_id_to_bucket_index(ft, &id);
-    list_head_t *bucket = &ft->flow_id_buckets[bucket_idx];
+    list_head_t *bucket;
     list_links_t *cur;
+    ft_flow_id_slot_t *slot;
+
+    if (FT_FLOW_ID_IS_DIRECT(id)) {
+        slot = ft_flow_id_slot_get(ft, id);
+        return slot != NULL ? slot->entry : NULL;
+    }
+
+    bucket = ft_hash_bucket(&ft->flow_id_hash, ft_flow_id_hash(&id));
 
     LIST_FOREACH(bucket, cur) {
         ft_entry_t *entry = FT_ENTRY_CONTAINER(cur, flow_id);
@@ -258,8 +1234,14 @@ ft_lookup(ft_instance_t ft, indigo_flow_id_t id)
     return NULL;
 }
 
-int
-ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry)
+/*
+ * ft_entry_meta_match, comparing the match with mq if it is not NULL.
+ * Scans prepare mq once with ft_match_query_init; one-off comparisons
+ * are cheaper without it.
+ */
+static inline int
+ft_entry_meta_match_query(of_meta_match_t *query, const ft_match_query_t *mq,
+                          ft_entry_t *entry)
 {
     uint64_t mask;
     int rv = 0; /* Default is no match */
@@ -285,7 +1267,8 @@ ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry)
     switch (query->mode) {
     case OF_MATCH_NON_STRICT:
         /* Check if the entry's match is more specific than the query's */
-        if (!of_match_more_specific(&entry->match, &query->match)) {
+        if (mq != NULL ? !ft_match_more_specific_flat(&entry->match, mq) :
+            !ft_match_more_specific(&entry->match, &query->match)) {
             break;
         }
         if (query->out_port != OF_PORT_DEST_WILDCARD) {
@@ -293,10 +1276,16 @@ ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry)
                 break;
             }
         }
+        if (query->check_out_group) {
+            if (!ft_entry_has_out_group(entry, query->out_group)) {
+                break;
+            }
+        }
         rv = 1;
         break;
     case OF_MATCH_STRICT:
-        if (!of_match_eq(&entry->match, &query->match)) {
+        if (mq != NULL ? !ft_match_eq_flat(&entry->match, mq) :
+            !ft_match_eq(&entry->match, &query->match)) {
             break;
         }
         if (query->out_port != OF_PORT_DEST_WILDCARD) {
@@ -304,6 +1293,11 @@ ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry)
                 break;
             }
         }
+        if (query->check_out_group) {
+            if (!ft_entry_has_out_group(entry, query->out_group)) {
+                break;
+            }
+        }
         rv = 1;
         break;
     case OF_MATCH_COOKIE_ONLY:
@@ -311,7 +1305,8 @@ ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry)
         rv = 1;
         break;
     case OF_MATCH_OVERLAP:
-        if (!of_match_overlap(&entry->match, &query->match)) {
+        if (mq != NULL ? !ft_match_overlap_flat(&entry->match, mq) :
+            !ft_match_overlap(&entry->match, &query->match)) {
             break;
         }
         rv = 1;
@@ -325,19 +1320,407 @@ ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry)
     return rv;
 }
 
+int
+ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry)
+{
+    return ft_entry_meta_match_query(query, NULL, entry);
+}
+
+/*
+ * Move iterators walking the list at links_offset past this entry, before
+ * it is relinked into a different list; they will not return it.
+ */
+static void
+ft_entry_iterators_skip(ft_entry_t *entry, int links_offset)
+{
+    list_links_t *cur, *next;
+
+    LIST_FOREACH_SAFE(&entry->iterators, cur, next) {
+        ft_iterator_t *iter = container_of(cur, entry_links, ft_iterator_t);
+        if (iter->links_offset == links_offset) {
+            ft_iterator_next(iter);
+        }
+    }
+}
+
+void
+ft_entry_table_id_set(ft_instance_t ft, ft_entry_t *entry, uint8_t table_id)
+{
+    if (entry->table_id == table_id) {
+        return;
+    }
+
+    if (ft->table_buckets) {
+        ft_entry_iterators_skip(entry, offsetof(ft_entry_t, table_id_links));
+        list_remove(&entry->table_id_links);
+        list_push(&ft->table_buckets[table_id], &entry->table_id_links);
+    }
+
+    ft->status.table_counts[entry->table_id] -= 1;
+    ft_checksum_update(ft, entry);
+    ft_eviction_unlink(ft, entry);
+    ft->status.table_counts[table_id] += 1;
+    entry->table_id = table_id;
+    ft_checksum_update(ft, entry);
+    ft_eviction_link(ft, entry);
+}
+
+/* One half of an entry's checksum */
+static uint32_t
+ft_entry_checksum_half(ft_entry_t *entry, uint32_t seed)
+{
+    of_object_t *effects = entry->effects.actions;
+
+    seed = murmur_hash(entry->match.present, sizeof(entry->match.present),
+                       seed);
+    seed = murmur_hash(entry->match.words,
+                       entry->match.count * 2 * sizeof(uint64_t), seed);
+    seed = murmur_hash(&entry->priority, sizeof(entry->priority), seed);
+    seed = murmur_hash(&entry->cookie, sizeof(entry->cookie), seed);
+    if (effects != NULL) {
+        seed = murmur_hash(OF_OBJECT_BUFFER_INDEX(effects, 0),
+                           effects->length, seed);
+    }
+
+    return seed;
+}
+
+/* Hash of the match, priority, cookie and effects; see ft_table_checksum_t */
+static uint64_t
+ft_entry_checksum(ft_entry_t *entry)
+{
+    return ((uint64_t)ft_entry_checksum_half(entry, FT_HASH_SEED) << 32) |
+        ft_entry_checksum_half(entry, ~FT_HASH_SEED);
+}
+
+/* Add or remove the entry's checksum in its table's checksums */
+static void
+ft_checksum_update(ft_instance_t ft, ft_entry_t *entry)
+{
+    ft_table_checksum_t *table = &ft->checksums[entry->table_id];
+    uint32_t idx = 0;
+
+    if (table->buckets_shift < 64) {
+        idx = entry->cookie >> table->buckets_shift;
+    }
+
+    table->checksum ^= entry->checksum;
+    table->buckets[idx] ^= entry->checksum;
+}
+
+indigo_error_t
+ft_checksum_buckets_size_set(ft_instance_t ft, uint8_t table_id,
+                             uint32_t buckets_size)
+{
+    ft_table_checksum_t *table = &ft->checksums[table_id];
+    uint64_t *buckets;
+    ft_entry_t *entry;
+    list_links_t *cur, *next;
+    uint8_t shift = 64;
+    uint32_t size;
+
+    if (buckets_size == 0 || (buckets_size & (buckets_size - 1)) != 0 ||
+            buckets_size > FT_CHECKSUM_BUCKETS_MAX) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (buckets_size == table->buckets_size) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if (buckets_size == 1) {
+        buckets = &table->bucket0;
+    } else if ((buckets = INDIGO_MEM_ALLOC(buckets_size * sizeof(*buckets))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    for (size = buckets_size; size > 1; size >>= 1) {
+        shift--;
+    }
+
+    if (table->buckets != &table->bucket0) {
+        INDIGO_MEM_FREE(table->buckets);
+    }
+    table->buckets = buckets;
+    table->buckets_size = buckets_size;
+    table->buckets_shift = shift;
+    INDIGO_MEM_SET(buckets, 0, buckets_size * sizeof(*buckets));
+
+    /* Recompute the total along with the new buckets */
+    table->checksum = 0;
+    if (ft->table_buckets) {
+        LIST_FOREACH_SAFE(&ft->table_buckets[table_id], cur, next) {
+            ft_checksum_update(ft, FT_ENTRY_CONTAINER(cur, table_id));
+        }
+    } else {
+        FT_ITER(ft, entry, cur, next) {
+            if (entry->table_id == table_id) {
+                ft_checksum_update(ft, entry);
+            }
+        }
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* When the entry's hard timeout, if any, expires */
+static indigo_time_t
+ft_entry_hard_expiration(ft_entry_t *entry)
+{
+    if (entry->hard_timeout == 0) {
+        return (indigo_time_t)-1;
+    }
+    return entry->insert_time + entry->hard_timeout * 1000;
+}
+
+/* True if entry a should be evicted before entry b */
+static bool
+ft_eviction_before(uint32_t flags, ft_entry_t *a, ft_entry_t *b)
+{
+    if ((flags & INDIGO_CORE_EVICTION_IMPORTANCE) &&
+            a->importance != b->importance) {
+        return a->importance < b->importance;
+    }
+
+    if (flags & INDIGO_CORE_EVICTION_LIFETIME) {
+        indigo_time_t a_end = ft_entry_hard_expiration(a);
+        indigo_time_t b_end = ft_entry_hard_expiration(b);
+        if (a_end != b_end) {
+            return a_end < b_end;
+        }
+    }
+
+    return a->last_counter_change < b->last_counter_change;
+}
+
+static void
+ft_eviction_place(ft_table_eviction_t *ev, uint32_t idx, ft_entry_t *entry)
+{
+    ev->heap[idx] = entry;
+    entry->eviction_idx = idx;
+}
+
+static void
+ft_eviction_sift_up(ft_table_eviction_t *ev, uint32_t idx)
+{
+    ft_entry_t *entry = ev->heap[idx];
+
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (!ft_eviction_before(ev->flags, entry, ev->heap[parent])) {
+            break;
+        }
+        ft_eviction_place(ev, idx, ev->heap[parent]);
+        idx = parent;
+    }
+
+    ft_eviction_place(ev, idx, entry);
+}
+
+static void
+ft_eviction_sift_down(ft_table_eviction_t *ev, uint32_t idx)
+{
+    ft_entry_t *entry = ev->heap[idx];
+
+    while (2 * idx + 1 < ev->count) {
+        uint32_t child = 2 * idx + 1;
+        if (child + 1 < ev->count &&
+                ft_eviction_before(ev->flags, ev->heap[child + 1],
+                                   ev->heap[child])) {
+            child++;
+        }
+        if (!ft_eviction_before(ev->flags, ev->heap[child], entry)) {
+            break;
+        }
+        ft_eviction_place(ev, idx, ev->heap[child]);
+        idx = child;
+    }
+
+    ft_eviction_place(ev, idx, entry);
+}
+
+/* Add the entry to its table's heap, if eviction is enabled there */
+static void
+ft_eviction_link(ft_instance_t ft, ft_entry_t *entry)
+{
+    ft_table_eviction_t *ev = &ft->evictions[entry->table_id];
+
+    if (ev->flags == 0) {
+        return;
+    }
+
+    if (ev->count == ev->size) {
+        uint32_t size = ev->size ? ev->size * 2 : FT_EVICTION_HEAP_INIT;
+        ft_entry_t **heap = INDIGO_MEM_ALLOC(size * sizeof(*heap));
+        if (heap == NULL) {
+            /* The entry just won't be evicted */
+            LOG_ERROR("Failed to grow eviction heap of table %u",
+                      entry->table_id);
+            return;
+        }
+        if (ev->heap != NULL) {
+            INDIGO_MEM_COPY(heap, ev->heap, ev->count * sizeof(*heap));
+            INDIGO_MEM_FREE(ev->heap);
+        }
+        ev->heap = heap;
+        ev->size = size;
+    }
+
+    ev->heap[ev->count] = entry;
+    ft_eviction_sift_up(ev, ev->count++);
+}
+
+static void
+ft_eviction_unlink(ft_instance_t ft, ft_entry_t *entry)
+{
+    ft_table_eviction_t *ev = &ft->evictions[entry->table_id];
+    uint32_t idx = entry->eviction_idx;
+    ft_entry_t *last;
+
+    if (idx == FT_EVICTION_IDX_NONE) {
+        return;
+    }
+
+    INDIGO_ASSERT(idx < ev->count && ev->heap[idx] == entry);
+    entry->eviction_idx = FT_EVICTION_IDX_NONE;
+
+    last = ev->heap[--ev->count];
+    if (last != entry) {
+        ft_eviction_place(ev, idx, last);
+        ft_eviction_sift_up(ev, idx);
+        ft_eviction_sift_down(ev, last->eviction_idx);
+    }
+}
+
+indigo_error_t
+ft_eviction_set(ft_instance_t ft, uint8_t table_id, uint32_t flags)
+{
+    ft_table_eviction_t *ev = &ft->evictions[table_id];
+    ft_entry_t *entry;
+    list_links_t *cur, *next;
+    uint32_t i;
+
+    if (flags == ev->flags) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    for (i = 0; i < ev->count; i++) {
+        ev->heap[i]->eviction_idx = FT_EVICTION_IDX_NONE;
+    }
+    ev->count = 0;
+    ev->flags = flags;
+
+    if (flags == 0) {
+        if (ev->heap != NULL) {
+            INDIGO_MEM_FREE(ev->heap);
+        }
+        ev->heap = NULL;
+        ev->size = 0;
+        return INDIGO_ERROR_NONE;
+    }
+
+    /* Rebuild the heap from the flows of the table */
+    if (ft->table_buckets) {
+        LIST_FOREACH_SAFE(&ft->table_buckets[table_id], cur, next) {
+            ft_eviction_link(ft, FT_ENTRY_CONTAINER(cur, table_id));
+        }
+    } else {
+        FT_ITER(ft, entry, cur, next) {
+            if (entry->table_id == table_id) {
+                ft_eviction_link(ft, entry);
+            }
+        }
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+ft_entry_t *
+ft_eviction_victim(ft_instance_t ft, uint8_t table_id, ft_entry_t *exclude)
+{
+    ft_table_eviction_t *ev = &ft->evictions[table_id];
+
+    if (ev->count == 0) {
+        return NULL;
+    }
+
+    if (ev->heap[0] != exclude) {
+        return ev->heap[0];
+    }
+
+    /* The runner-up is one of the children of the top */
+    if (ev->count == 1) {
+        return NULL;
+    } else if (ev->count == 2 ||
+               ft_eviction_before(ev->flags, ev->heap[1], ev->heap[2])) {
+        return ev->heap[1];
+    } else {
+        return ev->heap[2];
+    }
+}
+
+void
+ft_entry_counters_changed(ft_instance_t ft, ft_entry_t *entry,
+                          indigo_time_t now)
+{
+    ft_table_eviction_t *ev = &ft->evictions[entry->table_id];
+
+    entry->last_counter_change = now;
+
+    if (entry->eviction_idx != FT_EVICTION_IDX_NONE) {
+        ft_eviction_sift_up(ev, entry->eviction_idx);
+        ft_eviction_sift_down(ev, entry->eviction_idx);
+    }
+}
+
+void
+ft_entry_restart(ft_instance_t ft, ft_entry_t *entry, indigo_time_t now)
+{
+    entry->insert_time = now;
+    ft_entry_counters_changed(ft, entry, now);
+
+    if (entry->idle_timeout || entry->hard_timeout) {
+        ind_core_expiration_remove(entry);
+        ind_core_expiration_add(entry);
+    }
+}
+
 indigo_error_t
 ft_entry_modify_effects(ft_instance_t instance,
                         ft_entry_t *entry,
                         of_flow_modify_t *flow_mod)
 {
     indigo_error_t err;
+    int old_idx, new_idx;
+    int old_group_idx, new_group_idx;
 
     LOG_TRACE("Modifying effects of entry " INDIGO_FLOW_ID_PRINTF_FORMAT,
               entry->id);
 
-    err = ft_entry_set_effects(entry, flow_mod);
+    old_idx = ft_out_port_to_bucket_index(instance, entry);
+    old_group_idx = ft_out_group_to_bucket_index(instance, entry);
+
+    /* Out with the old checksum, in with the new (unchanged on error) */
+    ft_checksum_update(instance, entry);
+    err = ft_entry_set_effects(instance, entry, flow_mod);
+    ft_checksum_update(instance, entry);
     if (err == INDIGO_ERROR_NONE) {
         instance->status.updates += 1;
+
+        new_idx = ft_out_port_to_bucket_index(instance, entry);
+        if (instance->out_port_buckets && new_idx != old_idx) {
+            ft_entry_iterators_skip(entry, offsetof(ft_entry_t, out_port_links));
+            list_remove(&entry->out_port_links);
+            list_push(&instance->out_port_buckets[new_idx], &entry->out_port_links);
+        }
+
+        new_group_idx = ft_out_group_to_bucket_index(instance, entry);
+        if (instance->out_group_buckets && new_group_idx != old_group_idx) {
+            ft_entry_iterators_skip(entry, offsetof(ft_entry_t, out_group_links));
+            list_remove(&entry->out_group_links);
+            list_push(&instance->out_group_buckets[new_group_idx],
+                      &entry->out_group_links);
+        }
     }
 
     return err;
@@ -352,20 +1735,58 @@ ft_entry_modify_effects(ft_instance_t instance,
  *
  * These functions wrap the SocketManager task API to provide a simple method
  * for iterating over the flowtable without delaying higher priority events.
+ *
+ * A task feeding a controller connection finishes early when that
+ * connection's output is blocked and is restarted from the same position
+ * once the output drains.
  */
 
 struct ft_iter_task_state {
+    ind_soc_task_t task;
     ft_iter_task_callback_f callback;
     void *cookie;
     ft_iterator_t iter;
+    int priority;
+    indigo_cxn_id_t cxn_id;
 };
 
+static ind_soc_task_status_t ft_iter_task_callback(void *cookie);
+
+static void
+ft_iter_task_resume(void *cookie)
+{
+    struct ft_iter_task_state *state = cookie;
+
+    if (ind_soc_task_start(&state->task, ft_iter_task_callback, state,
+                           state->priority) < 0) {
+        /* Should not happen; the same start succeeded before */
+        LOG_ERROR("Failed to resume flowtable iterator task");
+        state->callback(state->cookie, NULL);
+        ft_iterator_cleanup(&state->iter);
+        INDIGO_MEM_FREE(state);
+    }
+}
+
+/* Returns true if the task was suspended until the connection drains */
+static bool
+ft_iter_task_suspend(struct ft_iter_task_state *state)
+{
+    return state->cxn_id != INDIGO_CXN_ID_UNSPECIFIED &&
+        indigo_cxn_output_blocked(state->cxn_id) &&
+        indigo_cxn_output_wait(state->cxn_id, ft_iter_task_resume,
+                               state) == INDIGO_ERROR_NONE;
+}
+
 static ind_soc_task_status_t
 ft_iter_task_callback(void *cookie)
 {
     struct ft_iter_task_state *state = cookie;
 
     do {
+        if (ft_iter_task_suspend(state)) {
+            return IND_SOC_TASK_FINISHED;
+        }
+
         ft_entry_t *entry = ft_iterator_next(&state->iter);
         if (entry == NULL) {
             /* Finished */
@@ -387,6 +1808,18 @@ ft_spawn_iter_task(ft_instance_t instance,
                    ft_iter_task_callback_f callback,
                    void *cookie,
                    int priority)
+{
+    return ft_spawn_cxn_iter_task(instance, query, callback, cookie,
+                                  priority, INDIGO_CXN_ID_UNSPECIFIED);
+}
+
+indigo_error_t
+ft_spawn_cxn_iter_task(ft_instance_t instance,
+                       of_meta_match_t *query,
+                       ft_iter_task_callback_f callback,
+                       void *cookie,
+                       int priority,
+                       indigo_cxn_id_t cxn_id)
 {
     indigo_error_t rv;
 
@@ -397,10 +1830,13 @@ ft_spawn_iter_task(ft_instance_t instance,
 
     state->callback = callback;
     state->cookie = cookie;
+    state->priority = priority;
+    state->cxn_id = cxn_id;
 
     ft_iterator_init(&state->iter, instance, query);
 
-    rv = ind_soc_task_register(ft_iter_task_callback, state, priority);
+    rv = ind_soc_task_start(&state->task, ft_iter_task_callback, state,
+                            priority);
     if (rv != INDIGO_ERROR_NONE) {
         INDIGO_MEM_FREE(state);
         return rv;
@@ -421,29 +1857,97 @@ ft_iterator_entry_to_links(ft_iterator_t *iter, ft_entry_t *entry)
     return (list_links_t *)(((char *)entry) + iter->links_offset);
 }
 
+/* Move on to next_head, skipping it if empty */
+static void
+ft_iterator_next_head(ft_iterator_t *iter)
+{
+    iter->head = iter->next_head;
+    iter->next_head = NULL;
+
+    if (iter->head == NULL || list_empty(iter->head)) {
+        iter->next_entry = NULL;
+    } else {
+        iter->next_entry = ft_iterator_links_to_entry(iter, iter->head->links.next);
+    }
+}
+
 void
 ft_iterator_init(ft_iterator_t *iter, ft_instance_t ft, of_meta_match_t *query)
 {
+    int cookie_index;
+    int i;
+
     if (query != NULL) {
         iter->query = *query;
         iter->use_query = true;
+        ft_match_query_init(&iter->match_query, &query->match);
     } else {
         iter->use_query = false;
     }
 
-    if (query && (query->cookie_mask & FT_COOKIE_PREFIX_MASK) == FT_COOKIE_PREFIX_MASK) {
+    iter->next_head = NULL;
+
+    /* Pick the cookie index covering the most query cookie bits */
+    cookie_index = -1;
+    if (query) {
+        for (i = 0; i < ft->num_cookie_indexes; i++) {
+            ft_cookie_index_t *index = &ft->cookie_indexes[i];
+            if ((query->cookie_mask & index->mask) == index->mask &&
+                (cookie_index < 0 ||
+                 index->bits > ft->cookie_indexes[cookie_index].bits)) {
+                cookie_index = i;
+            }
+        }
+    }
+
+    if (cookie_index >= 0) {
         /* Using cookie bucket */
-        iter->head = &ft->cookie_buckets[ft_cookie_to_bucket_index(ft, query->cookie)];
-        iter->links_offset = offsetof(ft_entry_t, cookie_links);
+        ft_cookie_index_t *index = &ft->cookie_indexes[cookie_index];
+        iter->head = &index->buckets[ft_cookie_to_bucket_index(index, query->cookie)];
+        iter->links_offset = ft_cookie_links_offset(cookie_index);
+    } else if (query && (query->mode == OF_MATCH_NON_STRICT ||
+                         query->mode == OF_MATCH_STRICT) &&
+               ft_match_in_port_exact(&query->match)) {
+        /*
+         * Using in_port bucket. Any matching entry must exact-match the
+         * same in_port, since a wildcarded in_port is less specific.
+         */
+        iter->head = &ft->in_port_buckets[ft_in_port_to_bucket_index(ft, &query->match)];
+        iter->links_offset = offsetof(ft_entry_t, in_port_links);
+    } else if (query && (query->mode == OF_MATCH_NON_STRICT ||
+                         query->mode == OF_MATCH_STRICT) &&
+               query->out_port != OF_PORT_DEST_WILDCARD) {
+        /* Using out_port bucket, then the multiple output port bucket */
+        iter->head = &ft->out_port_buckets[query->out_port % FT_OUT_PORT_BUCKETS];
+        iter->next_head = &ft->out_port_buckets[FT_OUT_PORT_BUCKET_MULTI];
+        iter->links_offset = offsetof(ft_entry_t, out_port_links);
+    } else if (query && (query->mode == OF_MATCH_NON_STRICT ||
+                         query->mode == OF_MATCH_STRICT) &&
+               query->check_out_group) {
+        /* Using out_group bucket, then the multiple group bucket */
+        iter->head = &ft->out_group_buckets[query->out_group % FT_OUT_GROUP_BUCKETS];
+        iter->next_head = &ft->out_group_buckets[FT_OUT_GROUP_BUCKET_MULTI];
+        iter->links_offset = offsetof(ft_entry_t, out_group_links);
+    } else if (query && query->check_priority) {
+        /* Using priority bucket, e.g. for overlap checks */
+        iter->head = &ft->priority_buckets[ft_priority_to_bucket_index(ft, query->priority)];
+        iter->links_offset = offsetof(ft_entry_t, priority_links);
+    } else if (query && query->table_id != TABLE_ID_ANY) {
+        /* Using the table's list */
+        iter->head = &ft->table_buckets[query->table_id];
+        iter->links_offset = offsetof(ft_entry_t, table_id_links);
     } else {
         iter->head = &ft->all_list;
         iter->links_offset = offsetof(ft_entry_t, table_links);
     }
 
     if (list_empty(iter->head)) {
-        iter->next_entry = NULL;
+        ft_iterator_next_head(iter);
     } else {
         iter->next_entry = ft_iterator_links_to_entry(iter, iter->head->links.next);
+    }
+
+    if (iter->next_entry != NULL) {
         list_push(&iter->next_entry->iterators, &iter->entry_links);
     }
 }
@@ -460,13 +1964,15 @@ ft_iterator_next(ft_iterator_t *iter)
 
         list_links_t *next_links = ft_iterator_entry_to_links(iter, iter->next_entry)->next;
         if (next_links == &iter->head->links) {
-            /* Finished iteration */
-            iter->next_entry = NULL;
+            /* Finished this list; iteration is done unless next_head is set */
+            ft_iterator_next_head(iter);
         } else {
             iter->next_entry = ft_iterator_links_to_entry(iter, next_links);
         }
 
-        if (iter->use_query && !ft_entry_meta_match(&iter->query, entry)) {
+        if (iter->use_query &&
+            !ft_entry_meta_match_query(&iter->query, &iter->match_query,
+                                       entry)) {
             continue;
         }
 
@@ -497,27 +2003,57 @@ static void
 ft_entry_link(ft_instance_t ft, ft_entry_t *entry)
 {
     int idx;
+    int i;
 
     if (ft == NULL || entry == NULL) {
         INDIGO_ASSERT(!"ft_entry_link called with NULL ft or entry");
         return;
     }
 
+    entry->strict_match_hash = ft_match_hash(&entry->match, entry->priority);
+
     /* Link to full table iteration */
     list_push(&ft->all_list, &entry->table_links);
 
-    if (ft->strict_match_buckets) { /* Strict match hash */
-        idx = ft_strict_match_to_bucket_index(ft, &entry->match, entry->priority);
-        list_push(&ft->strict_match_buckets[idx], &entry->strict_match_links);
+    if (ft->strict_match_hash.buckets) { /* Strict match hash */
+        list_push(ft_hash_bucket(&ft->strict_match_hash,
+                                 ft_entry_strict_match_hash(entry)),
+                  &entry->strict_match_links);
+        ft->strict_match_hash.count += 1;
+    }
+    if (ft->flow_id_hash.buckets && !FT_FLOW_ID_IS_DIRECT(entry->id)) {
+        /* Flow ID hash; direct IDs are found through their slot */
+        list_push(ft_hash_bucket(&ft->flow_id_hash,
+                                 ft_entry_flow_id_hash(entry)),
+                  &entry->flow_id_links);
+        ft->flow_id_hash.count += 1;
+    }
+    for (i = 0; i < ft->num_cookie_indexes; i++) { /* Cookie bits */
+        idx = ft_cookie_to_bucket_index(&ft->cookie_indexes[i], entry->cookie);
+        list_push(&ft->cookie_indexes[i].buckets[idx], &entry->cookie_links[i]);
+    }
+    if (ft->in_port_buckets) { /* In port */
+        idx = ft_entry_in_port_to_bucket_index(ft, entry);
+        list_push(&ft->in_port_buckets[idx], &entry->in_port_links);
+    }
+    if (ft->out_port_buckets) { /* Output port */
+        idx = ft_out_port_to_bucket_index(ft, entry);
+        list_push(&ft->out_port_buckets[idx], &entry->out_port_links);
+    }
+    if (ft->out_group_buckets) { /* Referenced groups */
+        idx = ft_out_group_to_bucket_index(ft, entry);
+        list_push(&ft->out_group_buckets[idx], &entry->out_group_links);
     }
-    if (ft->flow_id_buckets) { /* Flow ID hash */
-        idx = ft_flow_id_to_bucket_index(ft, &entry->id);
-        list_push(&ft->flow_id_buckets[idx], &entry->flow_id_links);
+    if (ft->priority_buckets) { /* Priority */
+        idx = ft_priority_to_bucket_index(ft, entry->priority);
+        list_push(&ft->priority_buckets[idx], &entry->priority_links);
     }
-    if (ft->cookie_buckets) { /* Cookie prefix */
-        idx = ft_cookie_to_bucket_index(ft, entry->cookie);
-        list_push(&ft->cookie_buckets[idx], &entry->cookie_links);
+    if (ft->table_buckets) { /* Table */
+        list_push(&ft->table_buckets[entry->table_id], &entry->table_id_links);
     }
+    ft->status.table_counts[entry->table_id] += 1;
+    ft_checksum_update(ft, entry);
+    ft_eviction_link(ft, entry);
 
     list_init(&entry->iterators);
 
@@ -533,6 +2069,8 @@ ft_entry_link(ft_instance_t ft, ft_entry_t *entry)
 static void
 ft_entry_unlink(ft_instance_t ft, ft_entry_t *entry)
 {
+    int i;
+
     if (ft == NULL || entry == NULL) {
         INDIGO_ASSERT(!"ft_entry_unlink called with NULL ft or entry");
         return;
@@ -549,30 +2087,120 @@ ft_entry_unlink(ft_instance_t ft, ft_entry_t *entry)
     /* Remove from full table iteration */
     list_remove(&entry->table_links);
 
-    if (ft->strict_match_buckets) { /* Strict match hash */
-        INDIGO_ASSERT(!list_empty(&ft->strict_match_buckets[
-            ft_strict_match_to_bucket_index(ft, &entry->match, entry->priority)]));
+    if (ft->strict_match_hash.buckets) { /* Strict match hash */
+        INDIGO_ASSERT(!list_empty(ft_hash_bucket(&ft->strict_match_hash,
+            ft_entry_strict_match_hash(entry))));
         list_remove(&entry->strict_match_links);
+        ft->strict_match_hash.count -= 1;
+    }
+    if (ft->flow_id_hash.buckets && !FT_FLOW_ID_IS_DIRECT(entry->id)) {
+        /* Flow ID hash */
+        INDIGO_ASSERT(!list_empty(ft_hash_bucket(&ft->flow_id_hash,
+            ft_entry_flow_id_hash(entry))));
+        list_remove(&entry->flow_id_links);
+        ft->flow_id_hash.count -= 1;
+    }
+    for (i = 0; i < ft->num_cookie_indexes; i++) { /* Cookie bits */
+        INDIGO_ASSERT(!list_empty(&ft->cookie_indexes[i].buckets[
+            ft_cookie_to_bucket_index(&ft->cookie_indexes[i], entry->cookie)]));
+        list_remove(&entry->cookie_links[i]);
+    }
+    if (ft->in_port_buckets) { /* In port */
+        INDIGO_ASSERT(!list_empty(&ft->in_port_buckets[ft_entry_in_port_to_bucket_index(ft,
+            entry)]));
+        list_remove(&entry->in_port_links);
+    }
+    if (ft->out_port_buckets) { /* Output port */
+        INDIGO_ASSERT(!list_empty(&ft->out_port_buckets[ft_out_port_to_bucket_index(ft,
+            entry)]));
+        list_remove(&entry->out_port_links);
+    }
+    if (ft->out_group_buckets) { /* Referenced groups */
+        INDIGO_ASSERT(!list_empty(&ft->out_group_buckets[ft_out_group_to_bucket_index(ft,
+            entry)]));
+        list_remove(&entry->out_group_links);
+    }
+    if (ft->priority_buckets) { /* Priority */
+        INDIGO_ASSERT(!list_empty(&ft->priority_buckets[ft_priority_to_bucket_index(ft,
+            entry->priority)]));
+        list_remove(&entry->priority_links);
+    }
+    if (ft->table_buckets) { /* Table */
+        list_remove(&entry->table_id_links);
+    }
+    ft->status.table_counts[entry->table_id] -= 1;
+    ft_checksum_update(ft, entry);
+    ft_eviction_unlink(ft, entry);
+
+    if (entry->idle_timeout || entry->hard_timeout) {
+        ind_core_expiration_remove(entry);
+    }
+}
+
+/**
+ * Take an entry from the first slab with free entries, allocating a
+ * new slab if necessary
+ */
+static ft_entry_t *
+ft_entry_alloc(ft_instance_t ft)
+{
+    ft_entry_slab_t *slab;
+    ft_entry_t *entry;
+    int idx;
+
+    if (list_empty(&ft->entry_slabs)) {
+        slab = indigo_mem_tag_alloc(INDIGO_MEM_TAG_FLOW_ENTRY, sizeof(*slab));
+        if (slab == NULL) {
+            return NULL;
+        }
+        list_init(&slab->free_entries);
+        slab->in_use = 0;
+        for (idx = 0; idx < FT_ENTRY_SLAB_ENTRIES; idx++) {
+            list_push(&slab->free_entries, &slab->entries[idx].table_links);
+        }
+        list_push(&ft->entry_slabs, &slab->links);
+        ft->num_entry_slabs++;
     }
-    if (ft->flow_id_buckets) { /* Flow ID hash */
-        INDIGO_ASSERT(!list_empty(&ft->flow_id_buckets[ft_flow_id_to_bucket_index(ft,
-            &entry->id)]));
-        list_remove(&entry->flow_id_links);
+
+    slab = container_of(list_first(&ft->entry_slabs), links, ft_entry_slab_t);
+    entry = FT_ENTRY_CONTAINER(list_pop(&slab->free_entries), table);
+    if (list_empty(&slab->free_entries)) {
+        list_remove(&slab->links);
     }
-    if (ft->cookie_buckets) { /* Cookie prefix */
-        INDIGO_ASSERT(!list_empty(&ft->cookie_buckets[ft_cookie_to_bucket_index(ft,
-            entry->cookie)]));
-        list_remove(&entry->cookie_links);
+    slab->in_use++;
+
+    INDIGO_MEM_SET(entry, 0, sizeof(*entry));
+    entry->slab = slab;
+
+    return entry;
+}
+
+/**
+ * Return an entry to its slab, releasing the slab if it is unused
+ */
+static void
+ft_entry_free(ft_instance_t ft, ft_entry_t *entry)
+{
+    ft_entry_slab_t *slab = entry->slab;
+
+    if (list_empty(&slab->free_entries)) {
+        /* Was full; make it available again */
+        list_push(&ft->entry_slabs, &slab->links);
     }
+    list_push(&slab->free_entries, &entry->table_links);
+    slab->in_use--;
 
-    if (entry->idle_timeout || entry->hard_timeout) {
-        ind_core_expiration_remove(entry);
+    if (slab->in_use == 0 && ft->num_entry_slabs > 1) {
+        list_remove(&slab->links);
+        indigo_mem_tag_free(INDIGO_MEM_TAG_FLOW_ENTRY, slab, sizeof(*slab));
+        ft->num_entry_slabs--;
     }
 }
 
 /**
  * Allocate and initialize a new flowtable entry
  *
+ * @param ft The flowtable to allocate from
  * @param id The flow ID to use
  * @param flow_add Pointer to the flow add object for the entry
  * @param_p entry Populated with pointer to new flowtable entry on success
@@ -580,37 +2208,59 @@ ft_entry_unlink(ft_instance_t ft, ft_entry_t *entry)
  * The list links are not modified by this call.
  */
 static indigo_error_t
-ft_entry_create(indigo_flow_id_t id, of_flow_add_t *flow_add, ft_entry_t **entry_p)
+ft_entry_create(ft_instance_t ft, indigo_flow_id_t id, of_flow_add_t *flow_add, ft_entry_t **entry_p)
 {
     indigo_error_t err;
     ft_entry_t *entry;
+    of_match_t match;
+
+    if (of_flow_add_match_get(flow_add, &match) < 0) {
+        return INDIGO_ERROR_UNKNOWN;
+    }
 
-    entry = INDIGO_MEM_ALLOC(sizeof(*entry));
+    entry = ft_entry_alloc(ft);
     if (entry == NULL) {
         return INDIGO_ERROR_RESOURCE;
     }
-    INDIGO_MEM_SET(entry, 0, sizeof(*entry));
 
     entry->id = id;
 
-    if (of_flow_add_match_get(flow_add, &entry->match) < 0) {
-        INDIGO_MEM_FREE(entry);
-        return INDIGO_ERROR_UNKNOWN;
+    if ((err = ft_match_compact(&entry->match, &match)) < 0) {
+        ft_entry_free(ft, entry);
+        return err;
     }
     of_flow_add_cookie_get(flow_add, &entry->cookie);
     of_flow_add_priority_get(flow_add, &entry->priority);
     of_flow_add_flags_get(flow_add, &entry->flags);
     of_flow_add_idle_timeout_get(flow_add, &entry->idle_timeout);
     of_flow_add_hard_timeout_get(flow_add, &entry->hard_timeout);
+    /*
+     * Queries filter on the table before Forwarding has taken the flow,
+     * so start in the requested table; Forwarding may move it later
+     */
+    entry->table_id = 0;
+    if (flow_add->version >= OF_VERSION_1_1) {
+        of_flow_add_table_id_get(flow_add, &entry->table_id);
+    }
+    entry->importance = 0;
+    if (flow_add->version >= OF_VERSION_1_4) {
+        of_flow_add_importance_get(flow_add, &entry->importance);
+    }
+    entry->eviction_idx = FT_EVICTION_IDX_NONE;
+    entry->stats_cache = NULL;
 
-    err = ft_entry_set_effects(entry, flow_add);
+    err = ft_entry_set_effects(ft, entry, flow_add);
     if (err != INDIGO_ERROR_NONE) {
-        INDIGO_MEM_FREE(entry);
+        ft_match_cleanup(&entry->match);
+        ft_entry_free(ft, entry);
         return err;
     }
 
     entry->insert_time = INDIGO_CURRENT_TIME;
     entry->last_counter_change = entry->insert_time;
+    entry->last_packets = 0;
+    entry->last_bytes = 0;
+    entry->counters_time = 0;
 
     *entry_p = entry;
 
@@ -632,14 +2282,107 @@ ft_entry_destroy(ft_instance_t ft, ft_entry_t *entry)
         entry->effects.actions = NULL;
     }
 
-    INDIGO_MEM_FREE(entry);
+    if (entry->stats_cache != NULL) {
+        of_object_delete(entry->stats_cache);
+        entry->stats_cache = NULL;
+    }
+
+    ft_match_cleanup(&entry->match);
+    ft_entry_free(ft, entry);
+}
+
+static void
+ft_entry_out_port_add(ft_entry_t *entry, of_port_no_t port)
+{
+    int idx;
+
+    if (entry->num_out_ports < 0) {
+        return;
+    }
+
+    for (idx = 0; idx < entry->num_out_ports; idx++) {
+        if (entry->out_ports[idx] == port) {
+            return;
+        }
+    }
+
+    if (entry->num_out_ports == FT_ENTRY_OUT_PORTS_MAX) {
+        entry->num_out_ports = -1;
+        return;
+    }
+
+    entry->out_ports[entry->num_out_ports++] = port;
+}
+
+static void
+ft_entry_out_group_add(ft_entry_t *entry, uint32_t group_id)
+{
+    int idx;
+
+    if (entry->num_out_groups < 0) {
+        return;
+    }
+
+    for (idx = 0; idx < entry->num_out_groups; idx++) {
+        if (entry->out_groups[idx] == group_id) {
+            return;
+        }
+    }
+
+    if (entry->num_out_groups == FT_ENTRY_OUT_GROUPS_MAX) {
+        entry->num_out_groups = -1;
+        return;
+    }
+
+    entry->out_groups[entry->num_out_groups++] = group_id;
+}
+
+static void
+action_list_out_ports_cache(ft_entry_t *entry, of_list_action_t *actions)
+{
+    of_action_t act;
+    int loop_rv;
+    of_port_no_t out_port;
+    uint32_t group_id;
+
+    OF_LIST_ACTION_ITER(actions, &act, loop_rv) {
+        if (act.header.object_id == OF_ACTION_OUTPUT) {
+            of_action_output_port_get(&act.output, &out_port);
+            ft_entry_out_port_add(entry, out_port);
+        } else if (act.header.object_id == OF_ACTION_GROUP) {
+            of_action_group_group_id_get(&act.group, &group_id);
+            ft_entry_out_group_add(entry, group_id);
+        }
+    }
+}
+
+static void
+instruction_list_out_ports_cache(ft_entry_t *entry, of_list_instruction_t *instructions)
+{
+    of_instruction_t inst;
+    int loop_rv;
+
+    OF_LIST_INSTRUCTION_ITER(instructions, &inst, loop_rv) {
+        if (inst.header.object_id == OF_INSTRUCTION_APPLY_ACTIONS) {
+            of_list_action_t actions;
+            of_instruction_apply_actions_actions_bind(&inst.apply_actions, &actions);
+            action_list_out_ports_cache(entry, &actions);
+        } else if (inst.header.object_id == OF_INSTRUCTION_WRITE_ACTIONS) {
+            of_list_action_t actions;
+            of_instruction_write_actions_actions_bind(&inst.write_actions, &actions);
+            action_list_out_ports_cache(entry, &actions);
+        }
+    }
 }
 
-/* Populate the output port list and effects */
+/* Populate the output port and group lists and effects */
 static indigo_error_t
-ft_entry_set_effects(ft_entry_t *entry,
+ft_entry_set_effects(ft_instance_t ft, ft_entry_t *entry,
                     of_flow_modify_t *flow_mod)
 {
+    /* Readers may still be using the old effects, retire them below */
+    of_object_t *old_effects = entry->effects.actions;
+
     if (flow_mod->version == OF_VERSION_1_0)
     {
         of_list_action_t *actions;
@@ -647,18 +2390,35 @@ ft_entry_set_effects(ft_entry_t *entry,
             LOG_ERROR("Could not get action list");
             return INDIGO_ERROR_RESOURCE;
         }
-        of_list_action_delete(entry->effects.actions);
-        entry->effects.actions = actions;
+        __atomic_store_n(&entry->effects.actions, actions, __ATOMIC_RELEASE);
+        entry->num_out_ports = 0;
+        entry->num_out_groups = 0;
+        action_list_out_ports_cache(entry, actions);
     } else {
         of_list_instruction_t *instructions;
         if ((instructions = of_flow_modify_instructions_get(flow_mod)) == NULL) {
             LOG_ERROR("Could not get instruction list");
             return INDIGO_ERROR_RESOURCE;
         }
-        of_list_instruction_delete(entry->effects.instructions);
-        entry->effects.instructions = instructions;
+        __atomic_store_n(&entry->effects.instructions, instructions,
+                         __ATOMIC_RELEASE);
+        entry->num_out_ports = 0;
+        entry->num_out_groups = 0;
+        instruction_list_out_ports_cache(entry, instructions);
+    }
+
+    if (old_effects != NULL) {
+        ft_defer(ft, FT_DEFERRED_OBJECT, old_effects);
     }
 
+    /* The cached encoding has the old effects */
+    if (entry->stats_cache != NULL) {
+        ft_defer(ft, FT_DEFERRED_OBJECT, entry->stats_cache);
+        entry->stats_cache = NULL;
+    }
+
+    entry->checksum = ft_entry_checksum(entry);
+
     return INDIGO_ERROR_NONE;
 }
 
@@ -712,6 +2472,17 @@ instruction_list_has_out_port(of_list_instruction_t *instructions, of_port_no_t
 static int
 ft_entry_has_out_port(ft_entry_t *entry, of_port_no_t port)
 {
+    int idx;
+
+    if (entry->num_out_ports >= 0) {
+        for (idx = 0; idx < entry->num_out_ports; idx++) {
+            if (entry->out_ports[idx] == port) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
     if (entry->effects.actions->version == OF_VERSION_1_0) {
         return action_list_has_out_port(entry->effects.actions, port);
     } else {
@@ -720,3 +2491,292 @@ ft_entry_has_out_port(ft_entry_t *entry, of_port_no_t port)
 
     return 0;
 }
+
+static int
+action_list_has_out_group(of_list_action_t *actions, uint32_t group_id)
+{
+    of_action_t act;
+    int loop_rv;
+    uint32_t id;
+
+    OF_LIST_ACTION_ITER(actions, &act, loop_rv) {
+        if (act.header.object_id == OF_ACTION_GROUP) {
+            of_action_group_group_id_get(&act.group, &id);
+            if (id == group_id) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int
+instruction_list_has_out_group(of_list_instruction_t *instructions, uint32_t group_id)
+{
+    of_instruction_t inst;
+    int loop_rv;
+
+    OF_LIST_INSTRUCTION_ITER(instructions, &inst, loop_rv) {
+        if (inst.header.object_id == OF_INSTRUCTION_APPLY_ACTIONS) {
+            of_list_action_t actions;
+            of_instruction_apply_actions_actions_bind(&inst.apply_actions, &actions);
+            if (action_list_has_out_group(&actions, group_id)) {
+                return 1;
+            }
+        } else if (inst.header.object_id == OF_INSTRUCTION_WRITE_ACTIONS) {
+            of_list_action_t actions;
+            of_instruction_write_actions_actions_bind(&inst.write_actions, &actions);
+            if (action_list_has_out_group(&actions, group_id)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Determine if the given entry's actions refer to a group
+ */
+static int
+ft_entry_has_out_group(ft_entry_t *entry, uint32_t group_id)
+{
+    int idx;
+
+    if (entry->num_out_groups >= 0) {
+        for (idx = 0; idx < entry->num_out_groups; idx++) {
+            if (entry->out_groups[idx] == group_id) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (entry->effects.actions->version == OF_VERSION_1_0) {
+        return action_list_has_out_group(entry->effects.actions, group_id);
+    } else {
+        return instruction_list_has_out_group(entry->effects.instructions, group_id);
+    }
+}
+
+/****************************************************************
+ * Readers on other threads
+ *
+ * Each open read section publishes the epoch it started in. The event
+ * loop retires an object, once it is unreachable, by tagging it with the
+ * current epoch and then advancing the epoch. Sections starting after
+ * that cannot find the object, so it is freed once every open section
+ * has a later epoch.
+ *
+ * A reader stores its epoch and then checks that the epoch has not
+ * moved, retrying if it has. Since these accesses and the event loop's
+ * scan are sequentially consistent, either the scan sees the reader's
+ * epoch or the reader sees the advanced one.
+ ****************************************************************/
+
+indigo_error_t
+ft_read_lock(ft_instance_t ft, ft_read_t *read)
+{
+    uint64_t epoch = __atomic_load_n(&ft->read_epoch, __ATOMIC_SEQ_CST);
+    uint64_t current;
+    uint64_t expected;
+    int i;
+
+    for (i = 0; i < FT_READERS_MAX; i++) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&ft->readers[i], &expected, epoch,
+                                        false, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (i == FT_READERS_MAX) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    while ((current = __atomic_load_n(&ft->read_epoch,
+                                      __ATOMIC_SEQ_CST)) != epoch) {
+        epoch = current;
+        __atomic_store_n(&ft->readers[i], epoch, __ATOMIC_SEQ_CST);
+    }
+
+    read->reader = i;
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ft_read_unlock(ft_instance_t ft, ft_read_t *read)
+{
+    __atomic_store_n(&ft->readers[read->reader], 0, __ATOMIC_RELEASE);
+}
+
+ft_entry_t *
+ft_read_lookup(ft_instance_t ft, indigo_flow_id_t id)
+{
+    /* Count first; see ft_flow_id_slots_grow */
+    int count = __atomic_load_n(&ft->flow_id_slot_count, __ATOMIC_ACQUIRE);
+    ft_flow_id_slot_t *slots = __atomic_load_n(&ft->flow_id_slots,
+                                               __ATOMIC_ACQUIRE);
+    ft_entry_t *entry;
+    int idx;
+
+    if (FT_FLOW_ID_IS_DIRECT(id)) {
+        if (FT_FLOW_ID_SLOT(id) >= (uint32_t)count) {
+            return NULL;
+        }
+        entry = __atomic_load_n(&slots[FT_FLOW_ID_SLOT(id)].entry,
+                                __ATOMIC_ACQUIRE);
+        return entry != NULL && entry->id == id ? entry : NULL;
+    }
+
+    for (idx = 0; idx < count; idx++) {
+        entry = __atomic_load_n(&slots[idx].entry, __ATOMIC_ACQUIRE);
+        if (entry != NULL && entry->id == id) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+void
+ft_read_iter(ft_instance_t ft, of_meta_match_t *query,
+             ft_read_callback_f callback, void *cookie)
+{
+    int count = __atomic_load_n(&ft->flow_id_slot_count, __ATOMIC_ACQUIRE);
+    ft_flow_id_slot_t *slots = __atomic_load_n(&ft->flow_id_slots,
+                                               __ATOMIC_ACQUIRE);
+    ft_match_query_t mq;
+    ft_entry_t *entry;
+    int idx;
+
+    if (query != NULL) {
+        ft_match_query_init(&mq, &query->match);
+    }
+
+    for (idx = 0; idx < count; idx++) {
+        entry = __atomic_load_n(&slots[idx].entry, __ATOMIC_ACQUIRE);
+        if (entry == NULL) {
+            continue;
+        }
+        if (query != NULL && !ft_entry_meta_match_query(query, &mq, entry)) {
+            continue;
+        }
+        callback(cookie, entry);
+    }
+}
+
+/*
+ * Free the retired objects older than every open read section, or all
+ * of them
+ */
+static void
+ft_deferred_free(ft_instance_t ft, bool all)
+{
+    uint64_t min_epoch = UINT64_MAX;
+    uint64_t epoch;
+    int i;
+
+    if (ft->deferred_head == ft->deferred_count) {
+        return;
+    }
+
+    if (!all) {
+        for (i = 0; i < FT_READERS_MAX; i++) {
+            epoch = __atomic_load_n(&ft->readers[i], __ATOMIC_SEQ_CST);
+            if (epoch != 0 && epoch < min_epoch) {
+                min_epoch = epoch;
+            }
+        }
+    }
+
+    while (ft->deferred_head < ft->deferred_count &&
+           ft->deferred[ft->deferred_head].epoch < min_epoch) {
+        ft_deferred_t *deferred = &ft->deferred[ft->deferred_head++];
+        switch (deferred->kind) {
+        case FT_DEFERRED_ENTRY:
+            ft_entry_destroy(ft, deferred->ptr);
+            break;
+        case FT_DEFERRED_OBJECT:
+            of_object_delete(deferred->ptr);
+            break;
+        case FT_DEFERRED_MEM:
+            INDIGO_MEM_FREE(deferred->ptr);
+            break;
+        }
+    }
+
+    if (ft->deferred_head == ft->deferred_count) {
+        ft->deferred_head = ft->deferred_count = 0;
+    }
+}
+
+/* Make room for one more retired object */
+static indigo_error_t
+ft_deferred_reserve(ft_instance_t ft)
+{
+    ft_deferred_t *deferred;
+    int size;
+
+    if (ft->deferred_count < ft->deferred_size) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if (ft->deferred_head > 0) {
+        INDIGO_MEM_MOVE(ft->deferred, &ft->deferred[ft->deferred_head],
+                        (ft->deferred_count - ft->deferred_head) *
+                        sizeof(*deferred));
+        ft->deferred_count -= ft->deferred_head;
+        ft->deferred_head = 0;
+        return INDIGO_ERROR_NONE;
+    }
+
+    size = ft->deferred_size ? ft->deferred_size * 2 : 64;
+    deferred = INDIGO_MEM_ALLOC(size * sizeof(*deferred));
+    if (deferred == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+    if (ft->deferred != NULL) {
+        INDIGO_MEM_COPY(deferred, ft->deferred,
+                        ft->deferred_count * sizeof(*deferred));
+        INDIGO_MEM_FREE(ft->deferred);
+    }
+    ft->deferred = deferred;
+    ft->deferred_size = size;
+
+    return INDIGO_ERROR_NONE;
+}
+
+/*
+ * Retire an object that readers can no longer reach, freeing it once
+ * those that might have reached it are done
+ */
+static void
+ft_defer(ft_instance_t ft, ft_deferred_kind_t kind, void *ptr)
+{
+    ft_deferred_t *deferred;
+
+    if (ft_deferred_reserve(ft) < 0) {
+        /* Not safe to free while a reader may hold it */
+        LOG_ERROR("Failed to defer flowtable free, leaking %p", ptr);
+        return;
+    }
+
+    deferred = &ft->deferred[ft->deferred_count++];
+    deferred->epoch = ft->read_epoch;
+    deferred->kind = kind;
+    deferred->ptr = ptr;
+
+    __atomic_store_n(&ft->read_epoch, ft->read_epoch + 1, __ATOMIC_SEQ_CST);
+
+    ft_deferred_free(ft, false);
+}
+
+void
+ft_read_reclaim(ft_instance_t ft)
+{
+    ft_deferred_free(ft, false);
+}
@@ -57,11 +57,119 @@
 #include "ft_entry.h"
 
 /**
- * Length of the prefix used for bucketing flows by cookie.
+ * Length of the prefix used for bucketing flows by cookie when no
+ * cookie indexes are configured.
  */
 #define FT_COOKIE_PREFIX_LEN 8
 #define FT_COOKIE_PREFIX_MASK (~(uint64_t)0 << (64-FT_COOKIE_PREFIX_LEN))
 
+/**
+ * log2 of the number of buckets in each cookie index
+ */
+#define FT_COOKIE_INDEX_BUCKET_BITS 8
+#define FT_COOKIE_INDEX_BUCKETS (1 << FT_COOKIE_INDEX_BUCKET_BITS)
+
+/**
+ * Number of buckets used for indexing flows by an exact in_port.
+ *
+ * Flows whose in_port is not exact-matched live in one extra bucket
+ * (index FT_IN_PORT_BUCKETS). Such flows can never match a strict or
+ * non-strict query with an exact in_port, so that bucket is not searched.
+ */
+#define FT_IN_PORT_BUCKETS 256
+
+/**
+ * Number of buckets used for indexing flows by output port.
+ *
+ * Flows with a single output port are bucketed by that port. Flows with
+ * several (or too many to cache) share bucket FT_OUT_PORT_BUCKET_MULTI,
+ * which every out_port query also walks. Flows without output ports live
+ * in FT_OUT_PORT_BUCKET_NONE and are never searched.
+ */
+#define FT_OUT_PORT_BUCKETS 256
+#define FT_OUT_PORT_BUCKET_MULTI FT_OUT_PORT_BUCKETS
+#define FT_OUT_PORT_BUCKET_NONE (FT_OUT_PORT_BUCKETS + 1)
+
+/**
+ * Number of buckets used for indexing flows by the groups their actions
+ * refer to, laid out as for output ports. Group deletes and group
+ * filtered queries walk one bucket and FT_OUT_GROUP_BUCKET_MULTI.
+ */
+#define FT_OUT_GROUP_BUCKETS 256
+#define FT_OUT_GROUP_BUCKET_MULTI FT_OUT_GROUP_BUCKETS
+#define FT_OUT_GROUP_BUCKET_NONE (FT_OUT_GROUP_BUCKETS + 1)
+
+/**
+ * Number of OpenFlow table ids. Each table id has its own list of flows.
+ */
+#define FT_TABLES 256
+
+/**
+ * Number of buckets used for indexing flows by priority.
+ */
+#define FT_PRIORITY_BUCKETS 1024
+
+/**
+ * Flowtable entries are allocated in slabs of FT_ENTRY_SLAB_ENTRIES.
+ *
+ * Free entries are kept on their slab's free list, linked by table_links.
+ * A slab is released once none of its entries are in use, unless it is
+ * the only one.
+ */
+#define FT_ENTRY_SLAB_ENTRIES 64
+
+typedef struct ft_entry_slab_s {
+    list_links_t links;            /* In ft->entry_slabs while not full */
+    list_head_t free_entries;
+    int in_use;
+    ft_entry_t entries[FT_ENTRY_SLAB_ENTRIES];
+} ft_entry_slab_t;
+
+/**
+ * Flow IDs allocated by ft_flow_id_alloc
+ *
+ * These index a dense slot array directly: the low 32 bits are the slot,
+ * bits 32-62 a per-slot generation that detects stale IDs, and bit 63 is
+ * set to tell them apart from caller-chosen IDs, which are hashed. The
+ * slot is small and recycled, so it can be used as a hardware handle.
+ *
+ * Entries with caller-chosen IDs are given a slot too, so that the slot
+ * array holds every entry; see ft_read_iter.
+ */
+#define FT_FLOW_ID_DIRECT ((uint64_t)1 << 63)
+#define FT_FLOW_ID_IS_DIRECT(_id) (((_id) & FT_FLOW_ID_DIRECT) != 0)
+#define FT_FLOW_ID_SLOT(_id) ((uint32_t)(_id))
+#define FT_FLOW_ID_GENERATION(_id) ((uint32_t)((_id) >> 32) & 0x7fffffff)
+#define FT_FLOW_ID_SLOTS_INIT 1024
+
+typedef struct ft_flow_id_slot_s {
+    ft_entry_t *entry;             /* NULL until ft_add; read by readers */
+    uint32_t generation;
+    int next_free;                 /* Free list link, or FT_FLOW_ID_SLOT_IN_USE */
+} ft_flow_id_slot_t;
+
+#define FT_FLOW_ID_SLOT_IN_USE (-2)
+
+/**
+ * Maximum number of concurrent read sections; see ft_read_lock
+ */
+#define FT_READERS_MAX 16
+
+/**
+ * A free waiting for the readers that may still see the object
+ */
+typedef enum ft_deferred_kind_e {
+    FT_DEFERRED_ENTRY,             /* ft_entry_t, and its match and effects */
+    FT_DEFERRED_OBJECT,            /* LOCI object */
+    FT_DEFERRED_MEM,               /* INDIGO_MEM_ALLOC'd memory */
+} ft_deferred_kind_t;
+
+typedef struct ft_deferred_s {
+    uint64_t epoch;                /* ft->read_epoch when it was retired */
+    ft_deferred_kind_t kind;
+    void *ptr;
+} ft_deferred_t;
+
 /**
  * Forward declaration of flowtable handle for other typedefs
  */
@@ -81,15 +189,31 @@ typedef ft_public_t *ft_instance_t;
 /**
  * Flow table configuration structure
  * @param max_entries Maximum number of entries to support
- * @param strict_match_bucket_count How many buckets for strict_match hash table
- * @param flow_id_bucket_count How many buckets for flow_id hash table
+ * @param strict_match_bucket_count Initial buckets for strict_match hash table
+ * @param flow_id_bucket_count Initial buckets for flow_id hash table
+ * @param cookie_index_masks Cookie bits to index flows by, one mask per
+ * index. Any bit layout is allowed. A zero mask ends the list; if the
+ * first is zero a single index on the top FT_COOKIE_PREFIX_LEN bits is used.
+ *
+ * The hash tables grow and shrink with the number of entries; see
+ * FT_HASH_LOAD_MAX and FT_HASH_LOAD_MIN.
  */
 
 typedef struct ft_config_s {
     int strict_match_bucket_count;
     int flow_id_bucket_count;
+    uint64_t cookie_index_masks[FT_COOKIE_INDEXES_MAX];
 } ft_config_t;
 
+/**
+ * An index of flowtable entries by the cookie bits in 'mask'
+ */
+typedef struct ft_cookie_index_s {
+    uint64_t mask;
+    int bits;                      /* Number of bits set in mask */
+    list_head_t *buckets;          /* FT_COOKIE_INDEX_BUCKETS lists */
+} ft_cookie_index_t;
+
 /**
  * Flow table status structure
  * @param current_count Current number of entries in the table not
@@ -103,8 +227,14 @@ typedef struct ft_config_s {
  * effects_modify.
  * @param table_full_errors Number of adds that failed due to no space
  * in the table.
+ * @param evictions Number of flows evicted to make room for an add
+ * @param readds Number of adds applied in place to an identical flow
  * @param forwarding_add_errors Number of adds that failed due to a
  * failure in the forwarding layer.
+ * @param strict_match_load Entries per 100 strict_match buckets
+ * @param flow_id_load Entries per 100 flow_id buckets
+ * @param hash_resizes Number of hash table resizes started
+ * @param table_counts Current number of entries with each table id
  */
 
 typedef struct ft_status_s {
@@ -115,9 +245,89 @@ typedef struct ft_status_s {
     uint64_t idle_expires;
     uint64_t updates;
     uint64_t table_full_errors;
+    uint64_t evictions;
+    uint64_t readds;
     uint64_t forwarding_add_errors;
+    int strict_match_load;
+    int flow_id_load;
+    uint64_t hash_resizes;
+    int table_counts[FT_TABLES];
 } ft_status_t;
 
+/**
+ * Flow checksums
+ *
+ * Each table keeps the XOR of a 64-bit hash of each flow's match,
+ * priority, cookie and effects, both in total and in checksum buckets
+ * selected by the top bits of the cookie. A controller that compares
+ * them across a failover, or between switches given the same flows, can
+ * read back only the buckets that differ. A controller that spreads its
+ * cookies over the cookie space keeps the buckets balanced.
+ *
+ * Adds, deletes, table changes and effect modifies update the checksums.
+ */
+#define FT_CHECKSUM_BUCKETS_MAX (1 << 16)
+
+typedef struct ft_table_checksum_s {
+    uint64_t checksum;
+    uint64_t *buckets;             /* buckets_size, or &bucket0 for one */
+    uint32_t buckets_size;         /* A power of 2 */
+    uint8_t buckets_shift;         /* Cookie bits below the bucket index */
+    uint64_t bucket0;
+} ft_table_checksum_t;
+
+/**
+ * Flow eviction
+ *
+ * A table with eviction enabled keeps its flows in a binary min-heap,
+ * ordered by the INDIGO_CORE_EVICTION_* flags set for it: lowest
+ * importance first, then soonest hard timeout, then least recently hit
+ * (by last_counter_change). When Forwarding reports the table full, the
+ * flow at the top of the heap is evicted to make room; finding it is
+ * O(1) and keeping the heap up to date O(log N) per change.
+ */
+#define FT_EVICTION_IDX_NONE ((uint32_t)-1)
+#define FT_EVICTION_HEAP_INIT 64
+
+typedef struct ft_table_eviction_s {
+    uint32_t flags;                /* INDIGO_CORE_EVICTION_*, 0 if disabled */
+    ft_entry_t **heap;
+    uint32_t count;                /* Entries in heap */
+    uint32_t size;                 /* Entries allocated in heap */
+} ft_table_eviction_t;
+
+/**
+ * Hash tables are doubled when there are more than FT_HASH_LOAD_MAX
+ * entries per bucket and halved when there are fewer than one entry per
+ * FT_HASH_LOAD_MIN buckets, but not below FT_HASH_MIN_BUCKETS (or the
+ * configured size, if smaller).
+ *
+ * Entries are moved to the new buckets incrementally, FT_HASH_REHASH_STEP
+ * old buckets per add or delete.
+ */
+#define FT_HASH_LOAD_MAX 2
+#define FT_HASH_LOAD_MIN 8
+#define FT_HASH_MIN_BUCKETS 64
+#define FT_HASH_REHASH_STEP 16
+
+/**
+ * An incrementally resizable hash table of flowtable entries
+ *
+ * While a resize is in progress, old buckets below rehash_idx have been
+ * moved to 'buckets' and the rest are still in 'old_buckets'.
+ */
+typedef struct ft_hash_s {
+    list_head_t *buckets;          /* Current bucket array */
+    int bucket_count;
+    list_head_t *old_buckets;      /* Bucket array being drained, or NULL */
+    int old_bucket_count;
+    int rehash_idx;                /* Next old bucket to move */
+    int min_bucket_count;          /* Do not shrink below this */
+    int count;                     /* Entries linked into this table */
+    int links_offset;              /* Offset of the links in ft_entry_t */
+    uint32_t (*entry_hash)(ft_entry_t *entry);
+} ft_hash_t;
+
 /**
  * The public view of the instance for easier dereference
  *
@@ -130,9 +340,34 @@ struct ft_public_s {
 
     list_head_t all_list;          /* Single list of all current entries */
 
-    list_head_t *strict_match_buckets;  /* Array of strict match based buckets */
-    list_head_t *flow_id_buckets;  /* Array of flow_id based buckets */
-    list_head_t *cookie_buckets;   /* Array of cookie (prefix) based buckets */
+    ft_hash_t strict_match_hash;   /* Strict match based buckets */
+    ft_hash_t flow_id_hash;        /* Flow_id based buckets */
+    ft_cookie_index_t cookie_indexes[FT_COOKIE_INDEXES_MAX];
+    int num_cookie_indexes;
+    list_head_t *in_port_buckets;  /* Array of in_port based buckets */
+    list_head_t *out_port_buckets; /* Array of output port based buckets */
+    list_head_t *out_group_buckets; /* Array of group based buckets */
+    list_head_t *priority_buckets; /* Array of priority based buckets */
+    list_head_t *table_buckets;    /* Array of per-table lists */
+
+    ft_flow_id_slot_t *flow_id_slots; /* Slots for all entries */
+    int flow_id_slot_count;
+    int flow_id_free;              /* First free slot, or -1 */
+    bool flow_id_free_stale;       /* Claimed slots still on the free list */
+
+    /* Readers on other threads; see ft_read_lock */
+    uint64_t read_epoch;           /* Advanced after each retire */
+    uint64_t readers[FT_READERS_MAX]; /* Epoch of each reader, 0 if unused */
+    ft_deferred_t *deferred;       /* Retired objects, oldest first */
+    int deferred_head;             /* First unfreed element of deferred */
+    int deferred_count;            /* Elements used in deferred */
+    int deferred_size;             /* Elements allocated in deferred */
+
+    ft_table_checksum_t checksums[FT_TABLES]; /* See ft_table_checksum_t */
+    ft_table_eviction_t evictions[FT_TABLES]; /* See ft_table_eviction_t */
+
+    list_head_t entry_slabs;       /* Slabs with free entries */
+    int num_entry_slabs;
 };
 
 #define FT_CONFIG(_ft) (&(_ft)->config)
@@ -147,11 +382,13 @@ struct ft_public_s {
  */
 typedef struct ft_iterator_s {
     list_head_t *head;             /* List head for this iteration */
+    list_head_t *next_head;        /* Walked once head is done, or NULL */
     ft_entry_t *next_entry;        /* Entry to be returned on next() */
     int links_offset;              /* Offset of the links we're using in the flowtable entry */
     list_links_t entry_links;      /* Linked into next_entry->iterators if next_entry != NULL */
     bool use_query;                /* Whether 'query' is valid */
     of_meta_match_t query;         /* Optional query to filter by */
+    ft_match_query_t match_query;  /* query.match in flat form */
 } ft_iterator_t;
 
 /**
@@ -202,7 +439,8 @@ void ft_destroy(ft_instance_t ft);
  * @param flow_add The LOCI flow mod object resulting in the add
  * @param entry_p Output; pointer to place to store entry if successful
  *
- * If the entry already exists, an error is returned.
+ * If the entry already exists, an error is returned. An ID from
+ * ft_flow_id_alloc is consumed by this call even if it fails.
  */
 
 indigo_error_t ft_add(ft_instance_t ft,
@@ -210,6 +448,31 @@ indigo_error_t ft_add(ft_instance_t ft,
                       of_flow_add_t *flow_add,
                       ft_entry_t **entry_p);
 
+/**
+ * Allocate a flow ID for a subsequent ft_add
+ * @param ft The flow table handle
+ * @param id Output; the new flow ID
+ *
+ * Lookups of IDs from this function are a direct array index. Once the
+ * flow is deleted its slot is reused with a new generation, so the old
+ * ID no longer finds anything.
+ */
+
+indigo_error_t ft_flow_id_alloc(ft_instance_t ft, indigo_flow_id_t *id);
+
+/**
+ * Reserve a specific flow ID for a subsequent ft_add
+ * @param ft The flow table handle
+ * @param id An ID returned by ft_flow_id_alloc in an earlier instance,
+ * e.g. one restored from a checkpoint
+ *
+ * Returns INDIGO_ERROR_EXISTS if the ID's slot is already in use. The
+ * free list is rebuilt on the next allocation, so claiming many IDs in a
+ * row is cheap.
+ */
+
+indigo_error_t ft_flow_id_claim(ft_instance_t ft, indigo_flow_id_t id);
+
 /**
  * Remove a specific flow entry from the table
  * @param ft The flow table handle
@@ -218,6 +481,26 @@ indigo_error_t ft_add(ft_instance_t ft,
 
 void ft_delete(ft_instance_t ft, ft_entry_t *entry);
 
+/**
+ * Remove a flow entry from the table but keep it allocated
+ * @param ft The flow table handle
+ * @param entry Pointer to the entry to be removed
+ *
+ * Lookups and iterators no longer find the entry, but its fields stay
+ * valid and its flow ID is not reused until ft_detached_free. Used while
+ * Forwarding finishes deleting the flow.
+ */
+
+void ft_detach(ft_instance_t ft, ft_entry_t *entry);
+
+/**
+ * Free an entry removed with ft_detach
+ * @param ft The flow table handle
+ * @param entry Pointer to the entry
+ */
+
+void ft_detached_free(ft_instance_t ft, ft_entry_t *entry);
+
 /**
  * Query the flow table (strict match) and return the first match if found
  * @param ft Handle for a flow table instance
@@ -254,6 +537,85 @@ ft_entry_modify_effects(ft_instance_t instance,
                         ft_entry_t *entry,
                         of_flow_modify_t *flow_mod);
 
+/**
+ * Set the table id of a flow entry in the table
+ * @param ft The flow table handle
+ * @param entry Pointer to the entry to update
+ * @param table_id The table the forwarding layer placed the flow in
+ *
+ * Iterations over the entry's old table that have not reached it yet
+ * will not return it.
+ */
+
+void
+ft_entry_table_id_set(ft_instance_t ft, ft_entry_t *entry, uint8_t table_id);
+
+/**
+ * Change the number of checksum buckets of a table
+ * @param ft The flow table handle
+ * @param table_id The table
+ * @param buckets_size A power of 2 up to FT_CHECKSUM_BUCKETS_MAX
+ *
+ * The buckets are recomputed from the table's flows.
+ */
+
+indigo_error_t
+ft_checksum_buckets_size_set(ft_instance_t ft, uint8_t table_id,
+                             uint32_t buckets_size);
+
+/**
+ * Enable or disable eviction for a table
+ * @param ft The flow table handle
+ * @param table_id The table
+ * @param flags INDIGO_CORE_EVICTION_* flags ordering the flows; 0 disables
+ * eviction
+ *
+ * The table's eviction heap is rebuilt from its flows.
+ */
+
+indigo_error_t
+ft_eviction_set(ft_instance_t ft, uint8_t table_id, uint32_t flags);
+
+/**
+ * Choose the flow to evict from a table
+ * @param ft The flow table handle
+ * @param table_id The table
+ * @param exclude An entry never to return, e.g. the one being added, or
+ * NULL
+ * @returns The entry, or NULL if eviction is disabled or there is no
+ * other flow in the table
+ */
+
+ft_entry_t *
+ft_eviction_victim(ft_instance_t ft, uint8_t table_id, ft_entry_t *exclude);
+
+/**
+ * Record that an entry's counters changed
+ * @param ft The flow table handle
+ * @param entry The entry
+ * @param now The current time
+ *
+ * Updates last_counter_change, keeping the entry's eviction order.
+ */
+
+void
+ft_entry_counters_changed(ft_instance_t ft, ft_entry_t *entry,
+                          indigo_time_t now);
+
+/**
+ * Restart an entry's lifetime
+ * @param ft The flow table handle
+ * @param entry The entry
+ * @param now The current time
+ *
+ * Sets insert_time and last_counter_change as if the entry had just been
+ * added, moving it in the expiration wheel and the eviction heap.
+ * Counters are kept.
+ */
+
+void
+ft_entry_restart(ft_instance_t ft, ft_entry_t *entry, indigo_time_t now);
+
 /*
  * Spawn a task that iterates over the flowtable
  *
@@ -282,6 +644,21 @@ ft_spawn_iter_task(ft_instance_t instance,
                    void *cookie,
                    int priority);
 
+/*
+ * Spawn a flowtable iterator task feeding a controller connection
+ *
+ * Same as ft_spawn_iter_task, but the task is suspended while the
+ * connection's output queue is blocked (see indigo_cxn_output_blocked).
+ */
+
+indigo_error_t
+ft_spawn_cxn_iter_task(ft_instance_t instance,
+                       of_meta_match_t *query,
+                       ft_iter_task_callback_f callback,
+                       void *cookie,
+                       int priority,
+                       indigo_cxn_id_t cxn_id);
+
 /**
  * Initialize a flowtable iterator
  *
@@ -292,6 +669,10 @@ ft_spawn_iter_task(ft_instance_t instance,
  * This iterator does not guarantee a consistent view of the flowtable over
  * the course of the iteration. Flows added during the iteration may or may
  * not be returned by the iterator.
+ *
+ * Queries that fix the bits of a cookie index, exact-match in_port, filter on
+ * out_port or out_group, check priority or name a table only walk the
+ * corresponding buckets; anything else falls back to the full table.
  */
 void
 ft_iterator_init(ft_iterator_t *iter, ft_instance_t ft, of_meta_match_t *query);
@@ -310,4 +691,94 @@ ft_iterator_next(ft_iterator_t *iter);
 void
 ft_iterator_cleanup(ft_iterator_t *iter);
 
+/****************************************************************
+ * Reading from other threads
+ *
+ * Everything above must be called from the event loop thread, which owns
+ * the flowtable. Other threads (stats workers, platform drivers, debug
+ * dumps) may look up and iterate entries inside a read section instead:
+ *
+ *     ft_read_t read;
+ *     if (ft_read_lock(ft, &read) == INDIGO_ERROR_NONE) {
+ *         entry = ft_read_lookup(ft, id);
+ *         ...
+ *         ft_read_unlock(ft, &read);
+ *     }
+ *
+ * Readers take no locks and the event loop never waits for them. Entries,
+ * effects and slot arrays freed by the event loop are retired instead and
+ * freed once no read section that could have seen them is still open.
+ * Entries found in a read section stay valid until ft_read_unlock, even
+ * if they are deleted meanwhile.
+ *
+ * Readers see each entry's invariant fields and match as added. Fields
+ * updated by modifies (cookie, effects, cached ports, counters) may be
+ * from before or after a concurrent update; read the effects pointer
+ * once, with ft_read_effects. Lists, hashes and ft_iterator_t are not
+ * safe for readers.
+ ****************************************************************/
+
+typedef struct ft_read_s {
+    int reader;                    /* Index in ft->readers */
+} ft_read_t;
+
+/**
+ * Enter a read section
+ * @param ft The flow table handle
+ * @param read Filled in; pass to ft_read_unlock
+ * @returns INDIGO_ERROR_RESOURCE if FT_READERS_MAX sections are open
+ *
+ * May be called from any thread. Read sections should be short, since
+ * nothing retired after one starts is freed until it ends.
+ */
+
+indigo_error_t ft_read_lock(ft_instance_t ft, ft_read_t *read);
+
+/**
+ * Leave a read section
+ */
+
+void ft_read_unlock(ft_instance_t ft, ft_read_t *read);
+
+/**
+ * Look up a flow by ID inside a read section
+ *
+ * IDs from ft_flow_id_alloc are a direct index; caller-chosen IDs are
+ * found by scanning the slots.
+ */
+
+ft_entry_t *ft_read_lookup(ft_instance_t ft, indigo_flow_id_t id);
+
+/**
+ * Call callback for each entry matching query (or all, if NULL) inside
+ * a read section
+ *
+ * Entries are visited in slot order. Entries added or deleted during the
+ * iteration may or may not be visited.
+ */
+
+typedef void (*ft_read_callback_f)(void *cookie, ft_entry_t *entry);
+
+void ft_read_iter(ft_instance_t ft, of_meta_match_t *query,
+                  ft_read_callback_f callback, void *cookie);
+
+/**
+ * Get an entry's current effects inside a read section
+ */
+
+static inline of_object_t *
+ft_read_effects(ft_entry_t *entry)
+{
+    return __atomic_load_n(&entry->effects.actions, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Free the retired objects no read section can still see
+ *
+ * Done automatically as the flowtable is modified; may be called from
+ * the event loop after readers finish to release memory sooner.
+ */
+
+void ft_read_reclaim(ft_instance_t ft);
+
 #endif /* _OFSTATEMANAGER_FT_H_ */
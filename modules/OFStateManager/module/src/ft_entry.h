@@ -34,17 +34,30 @@
  * The data in a flow table entry
  *
  * @param id The externally determined flow ID; primary key
+ * @param slot Index of the entry's flow ID slot, for any kind of ID
  * @param match The match structure recorded from the original add
  * @param priority The priority, from the original add
  * @param idle_timeout The idle_timeout, from the original add
  * @param hard_timeout The hard_timeout, from the original add
+ * @param importance The OpenFlow 1.4 importance, from the original add
  * @param cookie The cookie, from the original or as updated
+ * @param checksum Hash of the match, priority, cookie and effects, kept
+ * with the effects; see ft_table_checksum_t
  * @param effects The actions or instructions from the add or as updated.
  * See below.
+ * @param stats_cache The entry encoded as a flow stats entry, or NULL until
+ * first reported. Dropped when the effects change.
  * @param insert_time The timestamp when the entry was inserted
  * @param packets Number of packets matched by the entry
  * @param bytes Number of bytes matched by the entry
  * @param last_counter_change Last update when counters changed
+ * @param last_packets Packet count at the last flow stats read
+ * @param last_bytes Byte count at the last flow stats read
+ * @param expiration_time When the entry next times out, cached by expiration
+ * @param eviction_idx Position in its table's eviction heap, or
+ * FT_EVICTION_IDX_NONE; see ft_table_eviction_t
+ * @param counters_time When cached_packets and cached_bytes were read; 0 if
+ * never. See counter_cache.h
  * @param table_links For iterating across the flow table
  * @param prio_links Search by priority
  * @param match_links Search by strict match
@@ -58,39 +71,119 @@
  * The match, priority, timeouts and flags are invariant once the entry
  * has been added to the table.  The cookie and effects may be updated by
  * modify commands.
+ *
+ * Fields used by iteration, lookups and expiration come first so they
+ * share cache lines; the large match and the effects come last.
+ */
+
+/**
+ * Compact flowtable match
+ *
+ * of_match_fields_t is treated as FT_MATCH_WORDS 64-bit words (the last
+ * zero padded). Only words with a nonzero mask are stored, as pairs of
+ * (value & mask, mask) in word order; bit i of 'present' is set if word i
+ * is stored. Up to FT_MATCH_INLINE_WORDS pairs are kept in the entry
+ * itself, larger matches are allocated separately.
+ *
+ * Use ft_entry_match_get to expand it to an of_match_t.
+ */
+#define FT_MATCH_WORDS ((sizeof(of_match_fields_t) + 7) / 8)
+#define FT_MATCH_PRESENT_WORDS ((FT_MATCH_WORDS + 63) / 64)
+#define FT_MATCH_INLINE_WORDS 4
+
+typedef struct ft_match_s {
+    of_version_t version;
+    int count;                     /* Number of stored pairs */
+    uint64_t present[FT_MATCH_PRESENT_WORDS];
+    uint64_t *words;               /* 2 * count words; inline_words or heap */
+    uint64_t inline_words[2 * FT_MATCH_INLINE_WORDS];
+} ft_match_t;
+
+/**
+ * Query match in flat form
+ *
+ * Every word of the query's fields (masked) and masks, with 'present' as
+ * in ft_match_t. Built once for a scan so each entry comparison only
+ * visits the words the entry stores.
  */
+typedef struct ft_match_query_s {
+    uint64_t present[FT_MATCH_PRESENT_WORDS];
+    uint64_t values[FT_MATCH_WORDS];
+    uint64_t masks[FT_MATCH_WORDS];
+} ft_match_query_t;
+
+/**
+ * Maximum number of cookie indexes; see ft_config_t
+ */
+#define FT_COOKIE_INDEXES_MAX 4
+
+/**
+ * Number of distinct output ports cached per entry. Entries with more
+ * fall back to walking their effects for out_port queries.
+ */
+#define FT_ENTRY_OUT_PORTS_MAX 4
+
+/**
+ * Number of distinct groups cached per entry, as for output ports
+ */
+#define FT_ENTRY_OUT_GROUPS_MAX 4
 
 typedef struct ft_entry_s {
     /* Key */
     indigo_flow_id_t     id;
 
     /* Invariant */
-    of_match_t match;
+    uint32_t slot;
     uint16_t priority;
     uint16_t idle_timeout;
     uint16_t hard_timeout;
     uint16_t flags;
-
-    /* Modifiable thru API calls */
-    uint64_t cookie;
-    union { /* May not be maintained by some implementations */
-        of_list_action_t *actions;
-        of_list_instruction_t *instructions;
-    } effects;
+    uint16_t importance;
+    uint32_t strict_match_hash;  /* Cached hash of match and priority */
 
     /* Updated by implementation */
     uint8_t table_id;
     indigo_time_t insert_time;
     indigo_time_t last_counter_change;
+    uint64_t last_packets;
+    uint64_t last_bytes;
+    indigo_time_t expiration_time;
+    uint32_t eviction_idx;
+    indigo_time_t counters_time;
+    uint64_t cached_packets;
+    uint64_t cached_bytes;
+
+    /* Modifiable thru API calls */
+    uint64_t cookie;
+    uint64_t checksum;
+    int num_out_ports;             /* Entries in out_ports, or -1 if too many */
+    of_port_no_t out_ports[FT_ENTRY_OUT_PORTS_MAX];
+    int num_out_groups;            /* Entries in out_groups, or -1 if too many */
+    uint32_t out_groups[FT_ENTRY_OUT_GROUPS_MAX];
+
+    struct ft_entry_slab_s *slab;  /* Slab this entry was allocated from */
 
     /* For linked list maintance */
     list_links_t table_links;      /* For iterating across the flow table */
     list_links_t strict_match_links;  /* Search by strict match */
     list_links_t flow_id_links;    /* Search by flow id */
-    list_links_t cookie_links;     /* Search by cookie */
+    list_links_t cookie_links[FT_COOKIE_INDEXES_MAX]; /* Search by cookie */
+    list_links_t in_port_links;    /* Search by in_port */
+    list_links_t out_port_links;   /* Search by output port */
+    list_links_t out_group_links;  /* Search by referenced group */
+    list_links_t priority_links;   /* Search by priority */
+    list_links_t table_id_links;   /* Search by table id */
     list_links_t expiration_links; /* Expiration list entry */
     list_head_t iterators;         /* List of ft_iterator_t objects
                                       pointing to this entry */
+
+    /* Cold: invariant match and modifiable effects */
+    ft_match_t match;
+    union { /* May not be maintained by some implementations */
+        of_list_action_t *actions;
+        of_list_instruction_t *instructions;
+    } effects;
+    of_flow_stats_entry_t *stats_cache;
 } ft_entry_t;
 
 /**
@@ -160,6 +253,8 @@ typedef struct of_meta_match_s {
     int check_priority;     /* Boolean; should priority be checked */
     int check_overlap;      /* Boolean, for adds */
     of_port_no_t out_port;  /* OFPP_ANY means do not match */
+    int check_out_group;    /* Boolean; should out_group be checked */
+    uint32_t out_group;     /* Group the entry must refer to */
     uint8_t table_id;       /* Set to TABLE_ID_ANY to wildcard */
 } of_meta_match_t;
 
@@ -172,4 +267,16 @@ typedef struct of_meta_match_s {
 
 extern int ft_entry_meta_match(of_meta_match_t *query, ft_entry_t *entry);
 
+/**
+ * Expand an entry's compact match
+ * @param entry The flowtable entry
+ * @param match Filled in with the entry's match
+ */
+extern void ft_entry_match_get(ft_entry_t *entry, of_match_t *match);
+
+/**
+ * Expand a compact match that is not in an entry, e.g. a saved one
+ */
+extern void ft_match_get(ft_match_t *cm, of_match_t *match);
+
 #endif /* _OFSTATEMANAGER_FT_ENTRY_H_ */
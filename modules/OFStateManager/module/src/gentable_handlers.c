@@ -25,8 +25,38 @@
  *
  * TODO:
  *  - Reduce LOCI allocation overhead per entry.
- *  - Reuse stats entry during stats tasks.
- *  - Automatically resize key hashtable buckets.
+ *
+ * The key hashtable grows and shrinks with the number of entries. As in
+ * the flowtable, entries are moved to a new bucket array incrementally,
+ * GENTABLE_KEY_REHASH_STEP old buckets per add or delete, and lookups
+ * check the old array for buckets that have not been moved yet.
+ *
+ * Compact gentables (see indigo_core_gentable_compact_set) store the key
+ * and value bytes inline after the entry, in the same allocation, and
+ * wrap them in a TLV list view only while a handler or ops callback
+ * needs them.
+ *
+ * Above the checksum buckets the gentable keeps a binary tree of
+ * checksums, each node the XOR of its two halves of the checksum space,
+ * so a bucket stats request can ask for any depth down to the buckets.
+ *
+ * A gentable may have secondary indexes, each on one TLV type. An entry
+ * whose key or value contains a TLV of that type is linked into the
+ * index bucket for the TLV's bytes, so entries sharing e.g. a VLAN can
+ * be found without walking the table.
+ *
+ * A checkpoint file holds the entries of every registered gentable. Once
+ * loaded, each gentable registered with a name found in it gets its
+ * entries back through ops->add, with the checkpointed checksums, so the
+ * controller only has to resync what changed since.
+ *
+ * Gentables that implement the begin and commit ops get their adds,
+ * modifies and deletes in batches. A batch is opened on the first change
+ * to the table and committed at the end of the event loop pass, when it
+ * holds OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX requests, when another
+ * gentable is changed, or before the table's stats are read. Entry
+ * add and delete requests are kept until the commit so that barrier
+ * replies wait for the batch.
  */
 
 #include "ofstatemanager_log.h"
@@ -38,25 +68,101 @@
 #include "ofstatemanager_int.h"
 #include "handlers.h"
 #include <murmur/murmur.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define MAX_GENTABLES 16
 
+/*
+ * Key hashtable sizing: doubled above GENTABLE_KEY_LOAD_MAX entries per
+ * bucket, halved below one entry per GENTABLE_KEY_LOAD_MIN buckets.
+ */
+#define GENTABLE_KEY_LOAD_MAX 2
+#define GENTABLE_KEY_LOAD_MIN 8
+#define GENTABLE_KEY_MIN_BUCKETS 64
+#define GENTABLE_KEY_REHASH_STEP 16
+
+/* Buckets in each secondary index hashtable */
+#define GENTABLE_INDEX_BUCKETS 1024
+
+/* Maximum number of entries passed to one get_stats_batch call */
+#define GENTABLE_STATS_BATCH_MAX 64
+
 struct ind_core_gentable_entry;
 
+/* A TLV list over bytes stored inline in a compact entry */
+struct ind_core_gentable_tlv_view {
+    of_list_bsn_tlv_t list;
+    of_wire_buffer_t wbuf;
+};
+
 typedef void (*ind_core_gentable_iter_task_callback_f)(
     void *cookie, indigo_core_gentable_t *gentable, struct ind_core_gentable_entry *entry);
 
+typedef void (*ind_core_gentable_iter_task_bucket_end_f)(
+    void *cookie, indigo_core_gentable_t *gentable);
+
 static indigo_core_gentable_t *find_gentable_by_id(uint32_t table_id);
 static uint16_t alloc_table_id(void);
 static uint8_t calc_checksum_buckets_shift(uint32_t checksum_buckets_size);
 static struct ind_core_gentable_checksum_bucket *find_checksum_bucket(indigo_core_gentable_t *gentable, of_checksum_128_t *checksum);
 static void update_checksum(of_checksum_128_t *dst, const of_checksum_128_t *src);
+static void update_bucket_checksum(indigo_core_gentable_t *gentable, struct ind_core_gentable_checksum_bucket *bucket, const of_checksum_128_t *src);
+static void build_checksum_tree(indigo_core_gentable_t *gentable);
 static uint32_t hash_key(of_list_bsn_tlv_t *key);
 static list_head_t *find_key_bucket(indigo_core_gentable_t *gentable, uint32_t key_hash);
+static void key_buckets_update(indigo_core_gentable_t *gentable);
 static indigo_error_t delete_entry(indigo_core_gentable_t *gentable, struct ind_core_gentable_entry *entry);
+static bool clear_all_entries(indigo_core_gentable_t *gentable);
+static indigo_error_t set_entry(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *value, const of_checksum_128_t *checksum);
+static void checkpoint_restore(indigo_core_gentable_t *gentable);
+static void index_insert(indigo_core_gentable_t *gentable, int idx, struct ind_core_gentable_entry *entry);
+static void index_insert_all(indigo_core_gentable_t *gentable, struct ind_core_gentable_entry *entry);
+static void index_remove_all(struct ind_core_gentable_entry *entry);
+static void count_op(indigo_core_gentable_t *gentable, uint64_t *counter, ind_soc_histogram_t *hist, indigo_time_us_t start, indigo_error_t rv);
 static struct ind_core_gentable_entry *find_entry_by_key(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key);
 static bool key_equality(of_list_bsn_tlv_t *a, of_list_bsn_tlv_t *b);
-static indigo_error_t ind_core_gentable_spawn_iter_task(indigo_core_gentable_t *gentable, ind_core_gentable_iter_task_callback_f callback, void *cookie, int priority, of_checksum_128_t checksum_prefix, of_checksum_128_t checksum_mask);
+static struct ind_core_gentable_entry *alloc_entry(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *value);
+static struct ind_core_gentable_entry *set_entry_value(indigo_core_gentable_t *gentable, struct ind_core_gentable_entry *entry, of_list_bsn_tlv_t *value);
+static of_list_bsn_tlv_t *entry_key(struct ind_core_gentable_entry *entry, struct ind_core_gentable_tlv_view *view);
+static of_list_bsn_tlv_t *entry_value(struct ind_core_gentable_entry *entry, struct ind_core_gentable_tlv_view *view);
+static of_list_bsn_tlv_t *tlv_view_init(struct ind_core_gentable_tlv_view *view, of_version_t version, uint8_t *data, uint16_t length);
+static void batch_begin(indigo_core_gentable_t *gentable);
+static void batch_commit(void);
+static void batch_release(of_object_t *request);
+static indigo_error_t ind_core_gentable_spawn_iter_task(indigo_core_gentable_t *gentable, ind_core_gentable_iter_task_callback_f callback, ind_core_gentable_iter_task_bucket_end_f bucket_end, void *cookie, int priority, of_checksum_128_t checksum_prefix, of_checksum_128_t checksum_mask, indigo_cxn_id_t cxn_id);
+
+/* Failures are counted per error code, the last slot for any others */
+#define GENTABLE_ERROR_SLOTS 24
+
+struct ind_core_gentable_op_stats {
+    uint64_t adds;
+    uint64_t modifies;
+    uint64_t deletes;
+    uint64_t failures[GENTABLE_ERROR_SLOTS]; /* Indexed by -error */
+    /* Resync traffic */
+    uint64_t clear_requests;
+    uint64_t bucket_stats_requests;
+    uint64_t desc_stats_entries;
+    uint64_t stats_entries;
+    /* Microseconds spent in ops calls and iterator task invocations */
+    ind_soc_histogram_t add_us;
+    ind_soc_histogram_t modify_us;
+    ind_soc_histogram_t delete_us;
+    ind_soc_histogram_t iter_task_us;
+};
+
+struct ind_core_gentable_index {
+    of_object_id_t tlv_type;
+    list_head_t buckets[GENTABLE_INDEX_BUCKETS];
+};
 
 struct ind_core_gentable_checksum_bucket {
     of_checksum_128_t checksum;
@@ -68,15 +174,28 @@ struct indigo_core_gentable {
     void *priv;
     uint64_t generation_id;
     list_head_t *key_buckets;
+    list_head_t *old_key_buckets; /* Being drained into key_buckets, or NULL */
     struct ind_core_gentable_checksum_bucket *checksum_buckets;
+    /*
+     * Heap-ordered checksums above the buckets: node 1 covers the whole
+     * checksum space, node i has children 2i and 2i+1, and node
+     * checksum_buckets_size + j would be bucket j. Index 0 is unused.
+     */
+    of_checksum_128_t *checksum_tree;
     uint32_t max_entries;
     uint32_t num_entries;
     uint32_t key_buckets_size; /* always a power of 2 */
+    uint32_t old_key_buckets_size;
+    uint32_t key_rehash_idx; /* Next old key bucket to move */
     uint32_t checksum_buckets_size; /* always a power of 2 */
     uint16_t table_id;
     uint8_t checksum_buckets_shift; /* see checksum_buckets_shift */
+    bool compact; /* Keys and values stored inline in entries */
+    uint8_t num_indexes;
+    struct ind_core_gentable_index *indexes[OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES];
     of_checksum_128_t checksum;
     of_table_name_t name;
+    struct ind_core_gentable_op_stats stats;
 };
 
 struct ind_core_gentable_entry {
@@ -84,19 +203,123 @@ struct ind_core_gentable_entry {
     list_links_t checksum_links;
     uint32_t key_hash;
     void *priv;
-    of_list_bsn_tlv_t *key;
-    of_list_bsn_tlv_t *value;
+    of_list_bsn_tlv_t *key;     /* NULL in compact entries */
+    of_list_bsn_tlv_t *value;   /* NULL in compact entries */
     of_checksum_128_t checksum;
+    /* Bit i set if linked into secondary index i */
+    uint8_t index_mask;
+    uint32_t index_hashes[OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES];
+    list_links_t index_links[OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES];
+    /* Compact entries only: key bytes followed by value bytes */
+    of_version_t version;
+    uint16_t key_length;
+    uint16_t value_length;
+    uint8_t data[];
 };
 
+static struct ind_core_gentable_entry *
+entry_mem_alloc(size_t bytes)
+{
+    struct ind_core_gentable_entry *entry;
+
+    entry = indigo_mem_tag_alloc(INDIGO_MEM_TAG_GENTABLE_ENTRY, bytes);
+    AIM_TRUE_OR_DIE(entry != NULL);
+
+    return entry;
+}
+
+/* Lengths are zero in non-compact entries */
+static void
+entry_mem_free(struct ind_core_gentable_entry *entry)
+{
+    indigo_mem_tag_free(INDIGO_MEM_TAG_GENTABLE_ENTRY, entry,
+                        sizeof(*entry) + entry->key_length + entry->value_length);
+}
+
 static indigo_core_gentable_t *gentables[MAX_GENTABLES];
 
+/* Gentable with an open batch, or NULL */
+static indigo_core_gentable_t *batch_gentable;
+static of_object_t *batch_requests[OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX];
+static int batch_num_requests;
+
 /*
  * Used to fix an ABA problem with iteration.
  */
 static uint64_t next_generation_id = 0;
 
 
+/* Batching */
+
+static void
+batch_begin(indigo_core_gentable_t *gentable)
+{
+    if (batch_gentable == gentable) {
+        return;
+    }
+
+    batch_commit();
+
+    if (gentable->ops->begin != NULL) {
+        gentable->ops->begin(gentable->priv);
+        batch_gentable = gentable;
+    }
+}
+
+static void
+batch_commit(void)
+{
+    int i;
+
+    if (batch_gentable == NULL) {
+        return;
+    }
+
+    batch_gentable->ops->commit(batch_gentable->priv);
+    batch_gentable = NULL;
+
+    for (i = 0; i < batch_num_requests; i++) {
+        of_object_delete(batch_requests[i]);
+    }
+    batch_num_requests = 0;
+}
+
+/*
+ * Delete a request now, or after the commit if it has changes in the
+ * open batch
+ */
+static void
+batch_release(of_object_t *request)
+{
+    if (batch_gentable == NULL) {
+        of_object_delete(request);
+        return;
+    }
+
+    batch_requests[batch_num_requests++] = request;
+    if (batch_num_requests == OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX) {
+        batch_commit();
+    }
+}
+
+static void
+batch_pass_end(void *cookie)
+{
+    batch_commit();
+}
+
+indigo_error_t
+ind_core_gentable_enable_set(int enable)
+{
+    if (enable) {
+        return ind_soc_pass_end_register(batch_pass_end, NULL);
+    } else {
+        batch_commit();
+        return ind_soc_pass_end_unregister(batch_pass_end, NULL);
+    }
+}
+
+
 /* Registration */
 
 void
@@ -114,6 +337,7 @@ indigo_core_gentable_register(
     AIM_TRUE_OR_DIE(ops->modify != NULL);
     AIM_TRUE_OR_DIE(ops->del != NULL);
     AIM_TRUE_OR_DIE(ops->get_stats != NULL);
+    AIM_TRUE_OR_DIE((ops->begin == NULL) == (ops->commit == NULL));
 
     struct indigo_core_gentable *gentable = aim_zmalloc(sizeof(*gentable));
 
@@ -122,7 +346,7 @@ indigo_core_gentable_register(
     gentable->priv = table_priv;
     gentable->max_entries = max_entries;
     gentable->checksum_buckets_size = buckets_size;
-    gentable->key_buckets_size = buckets_size;
+    gentable->key_buckets_size = GENTABLE_KEY_MIN_BUCKETS;
 
     gentable->checksum_buckets_shift =
         calc_checksum_buckets_shift(gentable->checksum_buckets_size);
@@ -148,11 +372,72 @@ indigo_core_gentable_register(
         list_init(&bucket->entries);
     }
 
+    gentable->checksum_tree = NULL;
+    build_checksum_tree(gentable);
+
     gentables[gentable->table_id] = gentable;
     *gentable_ptr = gentable;
 
     AIM_LOG_INFO("Registered gentable \"%s\" with table id %d",
                  gentable->name, gentable->table_id);
+
+    checkpoint_restore(gentable);
+}
+
+void
+indigo_core_gentable_compact_set(indigo_core_gentable_t *gentable,
+                                 bool compact)
+{
+    int i;
+
+    if (gentable->compact == compact) {
+        return;
+    }
+
+    gentable->compact = !compact;
+
+    /* Convert entries restored from a checkpoint */
+    for (i = 0; i < gentable->checksum_buckets_size; i++) {
+        list_head_t old_entries;
+        list_links_t *links;
+
+        list_init(&old_entries);
+        while ((links = list_pop(&gentable->checksum_buckets[i].entries)) != NULL) {
+            list_push(&old_entries, links);
+        }
+
+        while ((links = list_pop(&old_entries)) != NULL) {
+            struct ind_core_gentable_entry *entry =
+                container_of(links, checksum_links, struct ind_core_gentable_entry);
+            struct ind_core_gentable_entry *new_entry;
+            struct ind_core_gentable_tlv_view key_view, value_view;
+
+            gentable->compact = compact;
+            new_entry = alloc_entry(gentable, entry_key(entry, &key_view),
+                                    entry_value(entry, &value_view));
+            gentable->compact = !compact;
+
+            new_entry->key_hash = entry->key_hash;
+            new_entry->priv = entry->priv;
+            new_entry->checksum = entry->checksum;
+
+            list_remove(&entry->key_links);
+            list_push(find_key_bucket(gentable, new_entry->key_hash),
+                      &new_entry->key_links);
+            list_push(&gentable->checksum_buckets[i].entries,
+                      &new_entry->checksum_links);
+            index_remove_all(entry);
+            index_insert_all(gentable, new_entry);
+
+            if (entry->key != NULL) {
+                of_object_delete(entry->key);
+                of_object_delete(entry->value);
+            }
+            entry_mem_free(entry);
+        }
+    }
+
+    gentable->compact = compact;
 }
 
 void
@@ -163,12 +448,20 @@ indigo_core_gentable_unregister(indigo_core_gentable_t *gentable)
 
     AIM_TRUE_OR_DIE(gentables[gentable->table_id] == gentable);
 
-    /* Delete all entries */
-    for (i = 0; i < gentable->key_buckets_size; i++) {
+    /*
+     * Delete all entries in one batch. Walk the checksum buckets, which
+     * are not rearranged as the key hashtable shrinks.
+     */
+    if (clear_all_entries(gentable)) {
+        goto cleared;
+    }
+
+    batch_begin(gentable);
+    for (i = 0; i < gentable->checksum_buckets_size; i++) {
         list_links_t *cur, *next;
-        LIST_FOREACH_SAFE(&gentable->key_buckets[i], cur, next) {
+        LIST_FOREACH_SAFE(&gentable->checksum_buckets[i].entries, cur, next) {
             struct ind_core_gentable_entry *entry =
-                container_of(cur, key_links, struct ind_core_gentable_entry);
+                container_of(cur, checksum_links, struct ind_core_gentable_entry);
             rv = delete_entry(gentable, entry);
             if (rv < 0) {
                 AIM_LOG_ERROR("failed to delete %s gentable entry during unregister, leaking", gentable->name);
@@ -176,108 +469,710 @@ indigo_core_gentable_unregister(indigo_core_gentable_t *gentable)
         }
     }
 
+    batch_commit();
+
+cleared:
     gentables[gentable->table_id] = NULL;
 
     aim_free(gentable->key_buckets);
+    aim_free(gentable->old_key_buckets);
     aim_free(gentable->checksum_buckets);
+    aim_free(gentable->checksum_tree);
+    for (i = 0; i < gentable->num_indexes; i++) {
+        aim_free(gentable->indexes[i]);
+    }
     aim_free(gentable);
 }
 
 
-/* OpenFlow message handlers */
+/* Statistics */
+
+static void
+count_op(indigo_core_gentable_t *gentable, uint64_t *counter,
+         ind_soc_histogram_t *hist, indigo_time_us_t start, indigo_error_t rv)
+{
+    ind_soc_histogram_add(hist, INDIGO_CURRENT_TIME_us - start);
+
+    if (rv < 0) {
+        int slot = -rv < GENTABLE_ERROR_SLOTS ? -rv : GENTABLE_ERROR_SLOTS - 1;
+        gentable->stats.failures[slot]++;
+    } else {
+        (*counter)++;
+    }
+}
 
 void
-ind_core_bsn_gentable_entry_add_handler(
-    of_object_t *obj,
-    indigo_cxn_id_t cxn_id)
+ind_core_gentable_stats_show(aim_pvs_t *pvs)
+{
+    int i, slot;
+
+    for (i = 0; i < MAX_GENTABLES; i++) {
+        indigo_core_gentable_t *gentable = gentables[i];
+        struct ind_core_gentable_op_stats *stats;
+
+        if (gentable == NULL) {
+            continue;
+        }
+
+        stats = &gentable->stats;
+        aim_printf(pvs, "Gentable %s (id %u):\n", gentable->name, gentable->table_id);
+        aim_printf(pvs, "  Entries:               %u\n", gentable->num_entries);
+        aim_printf(pvs, "  Adds:                  %"PRIu64"\n", stats->adds);
+        aim_printf(pvs, "  Modifies:              %"PRIu64"\n", stats->modifies);
+        aim_printf(pvs, "  Deletes:               %"PRIu64"\n", stats->deletes);
+        for (slot = 1; slot < GENTABLE_ERROR_SLOTS; slot++) {
+            if (stats->failures[slot] != 0) {
+                aim_printf(pvs, "  Failures (%s): %"PRIu64"\n",
+                           slot == GENTABLE_ERROR_SLOTS - 1 ?
+                               "other" : indigo_strerror(-slot),
+                           stats->failures[slot]);
+            }
+        }
+        aim_printf(pvs, "  Clear requests:        %"PRIu64"\n", stats->clear_requests);
+        aim_printf(pvs, "  Bucket stats requests: %"PRIu64"\n", stats->bucket_stats_requests);
+        aim_printf(pvs, "  Desc stats entries:    %"PRIu64"\n", stats->desc_stats_entries);
+        aim_printf(pvs, "  Stats entries:         %"PRIu64"\n", stats->stats_entries);
+        ind_soc_histogram_show(pvs, "add", &stats->add_us);
+        ind_soc_histogram_show(pvs, "modify", &stats->modify_us);
+        ind_soc_histogram_show(pvs, "delete", &stats->delete_us);
+        ind_soc_histogram_show(pvs, "iterator task", &stats->iter_task_us);
+    }
+}
+
+void
+ind_core_gentable_stats_clear(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_GENTABLES; i++) {
+        if (gentables[i] != NULL) {
+            memset(&gentables[i]->stats, 0, sizeof(gentables[i]->stats));
+        }
+    }
+}
+
+
+/* Secondary indexes */
+
+/*
+ * Find the first TLV of the given type in an entry's key, then its value
+ *
+ * Points 'tlv' at it and returns true if found. The views must outlive
+ * 'tlv'.
+ */
+static bool
+entry_find_tlv(struct ind_core_gentable_entry *entry, of_object_id_t tlv_type,
+               struct ind_core_gentable_tlv_view *key_view,
+               struct ind_core_gentable_tlv_view *value_view,
+               of_bsn_tlv_t *tlv)
+{
+    of_list_bsn_tlv_t *lists[2] = {
+        entry_key(entry, key_view),
+        entry_value(entry, value_view),
+    };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        int loop_rv = 0;
+        OF_LIST_BSN_TLV_ITER(lists[i], tlv, loop_rv) {
+            if (tlv->header.object_id == tlv_type) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static uint32_t
+hash_tlv(of_bsn_tlv_t *tlv)
+{
+    return murmur_hash(OF_OBJECT_BUFFER_INDEX(&tlv->header, 0),
+                       tlv->header.length, 0);
+}
+
+static void
+index_insert(indigo_core_gentable_t *gentable, int idx,
+             struct ind_core_gentable_entry *entry)
+{
+    struct ind_core_gentable_index *index = gentable->indexes[idx];
+    struct ind_core_gentable_tlv_view key_view, value_view;
+    of_bsn_tlv_t tlv;
+
+    if (!entry_find_tlv(entry, index->tlv_type, &key_view, &value_view, &tlv)) {
+        return;
+    }
+
+    entry->index_hashes[idx] = hash_tlv(&tlv);
+    list_push(&index->buckets[entry->index_hashes[idx] % GENTABLE_INDEX_BUCKETS],
+              &entry->index_links[idx]);
+    entry->index_mask |= 1 << idx;
+}
+
+/* Link a new or changed entry into every index */
+static void
+index_insert_all(indigo_core_gentable_t *gentable,
+                 struct ind_core_gentable_entry *entry)
+{
+    int i;
+
+    entry->index_mask = 0;
+    for (i = 0; i < gentable->num_indexes; i++) {
+        index_insert(gentable, i, entry);
+    }
+}
+
+static void
+index_remove_all(struct ind_core_gentable_entry *entry)
+{
+    int i;
+
+    for (i = 0; entry->index_mask != 0; i++) {
+        if (entry->index_mask & (1 << i)) {
+            list_remove(&entry->index_links[i]);
+            entry->index_mask &= ~(1 << i);
+        }
+    }
+}
+
+indigo_error_t
+indigo_core_gentable_index_add(indigo_core_gentable_t *gentable,
+                               of_object_id_t tlv_type)
+{
+    struct ind_core_gentable_index *index;
+    int idx, i;
+
+    for (i = 0; i < gentable->num_indexes; i++) {
+        if (gentable->indexes[i]->tlv_type == tlv_type) {
+            return INDIGO_ERROR_EXISTS;
+        }
+    }
+
+    if (gentable->num_indexes == OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES) {
+        AIM_LOG_ERROR("Too many indexes on %s gentable", gentable->name);
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    index = aim_zmalloc(sizeof(*index));
+    index->tlv_type = tlv_type;
+    for (i = 0; i < GENTABLE_INDEX_BUCKETS; i++) {
+        list_init(&index->buckets[i]);
+    }
+
+    idx = gentable->num_indexes++;
+    gentable->indexes[idx] = index;
+
+    /* Index any existing entries */
+    for (i = 0; i < gentable->checksum_buckets_size; i++) {
+        list_links_t *cur, *next;
+        LIST_FOREACH_SAFE(&gentable->checksum_buckets[i].entries, cur, next) {
+            struct ind_core_gentable_entry *entry =
+                container_of(cur, checksum_links, struct ind_core_gentable_entry);
+            index_insert(gentable, idx, entry);
+        }
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_core_gentable_index_iter(indigo_core_gentable_t *gentable,
+                                of_object_t *tlv,
+                                indigo_core_gentable_index_iter_f callback,
+                                void *cookie)
+{
+    struct ind_core_gentable_index *index = NULL;
+    uint32_t hash;
+    list_links_t *cur, *next;
+    int idx;
+
+    for (idx = 0; idx < gentable->num_indexes; idx++) {
+        if (gentable->indexes[idx]->tlv_type == tlv->object_id) {
+            index = gentable->indexes[idx];
+            break;
+        }
+    }
+
+    if (index == NULL) {
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    hash = murmur_hash(OF_OBJECT_BUFFER_INDEX(tlv, 0), tlv->length, 0);
+
+    LIST_FOREACH_SAFE(&index->buckets[hash % GENTABLE_INDEX_BUCKETS], cur, next) {
+        /* cur is &entry->index_links[idx] */
+        struct ind_core_gentable_entry *entry = (struct ind_core_gentable_entry *)
+            ((char *)(cur - idx) - offsetof(struct ind_core_gentable_entry, index_links));
+        struct ind_core_gentable_tlv_view key_view, value_view;
+        of_bsn_tlv_t entry_tlv;
+
+        if (entry->index_hashes[idx] != hash) {
+            continue;
+        }
+
+        /* Compare the TLV bytes to rule out hash collisions */
+        if (!entry_find_tlv(entry, index->tlv_type, &key_view, &value_view, &entry_tlv) ||
+                entry_tlv.header.length != tlv->length ||
+                memcmp(OF_OBJECT_BUFFER_INDEX(&entry_tlv.header, 0),
+                       OF_OBJECT_BUFFER_INDEX(tlv, 0), tlv->length) != 0) {
+            continue;
+        }
+
+        callback(cookie, entry_key(entry, &key_view),
+                 entry_value(entry, &value_view), entry->priv);
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+
+/* Checkpoints */
+
+/*
+ * File layout, in host byte order: a checkpoint_header, then for each
+ * table a checkpoint_table followed by its entries, each a
+ * checkpoint_entry followed by the key and value bytes. Fields are read
+ * with memcpy since entries are not padded.
+ */
+
+#define CHECKPOINT_MAGIC 0x47544350 /* "GTCP" */
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_tables;
+    uint32_t pad;
+};
+
+struct checkpoint_table {
+    of_table_name_t name;
+    uint32_t num_entries;
+    uint32_t length; /* Bytes of entries following */
+};
+
+struct checkpoint_entry {
+    of_checksum_128_t checksum;
+    uint16_t key_length;
+    uint16_t value_length;
+    uint8_t version;
+    uint8_t pad[3];
+};
+
+/* The loaded checkpoint, or NULL */
+static uint8_t *checkpoint_data;
+static size_t checkpoint_size;
+
+static bool
+checkpoint_write(FILE *f, const void *data, size_t length)
+{
+    return length == 0 || fwrite(data, length, 1, f) == 1;
+}
+
+static bool
+checkpoint_write_table(FILE *f, indigo_core_gentable_t *gentable)
+{
+    struct checkpoint_table table_hdr;
+    long table_offset, end_offset;
+    int i;
+
+    memset(&table_hdr, 0, sizeof(table_hdr));
+    memcpy(table_hdr.name, gentable->name, sizeof(table_hdr.name));
+    table_hdr.num_entries = gentable->num_entries;
+
+    table_offset = ftell(f);
+    if (!checkpoint_write(f, &table_hdr, sizeof(table_hdr))) {
+        return false;
+    }
+
+    for (i = 0; i < gentable->checksum_buckets_size; i++) {
+        list_links_t *cur, *next;
+        LIST_FOREACH_SAFE(&gentable->checksum_buckets[i].entries, cur, next) {
+            struct ind_core_gentable_entry *entry =
+                container_of(cur, checksum_links, struct ind_core_gentable_entry);
+            struct ind_core_gentable_tlv_view key_view, value_view;
+            of_list_bsn_tlv_t *key = entry_key(entry, &key_view);
+            of_list_bsn_tlv_t *value = entry_value(entry, &value_view);
+            struct checkpoint_entry entry_hdr;
+
+            memset(&entry_hdr, 0, sizeof(entry_hdr));
+            entry_hdr.checksum = entry->checksum;
+            entry_hdr.key_length = key->length;
+            entry_hdr.value_length = value->length;
+            entry_hdr.version = key->version;
+
+            if (!checkpoint_write(f, &entry_hdr, sizeof(entry_hdr)) ||
+                    !checkpoint_write(f, OF_OBJECT_BUFFER_INDEX(key, 0), key->length) ||
+                    !checkpoint_write(f, OF_OBJECT_BUFFER_INDEX(value, 0), value->length)) {
+                return false;
+            }
+        }
+    }
+
+    /* Fill in the length now that the entries are written */
+    end_offset = ftell(f);
+    table_hdr.length = end_offset - table_offset - sizeof(table_hdr);
+    return fseek(f, table_offset, SEEK_SET) == 0 &&
+        checkpoint_write(f, &table_hdr, sizeof(table_hdr)) &&
+        fseek(f, end_offset, SEEK_SET) == 0;
+}
+
+indigo_error_t
+indigo_core_gentable_checkpoint_save(const char *path)
+{
+    struct checkpoint_header hdr;
+    char tmp_path[PATH_MAX];
+    FILE *f;
+    bool ok;
+    int i;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path)) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    /* The checkpoint must include the entries of any open batch */
+    batch_commit();
+
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        AIM_LOG_ERROR("Failed to open gentable checkpoint %s: %s",
+                      tmp_path, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CHECKPOINT_MAGIC;
+    hdr.version = CHECKPOINT_VERSION;
+    for (i = 0; i < MAX_GENTABLES; i++) {
+        if (gentables[i] != NULL) {
+            hdr.num_tables++;
+        }
+    }
+
+    ok = checkpoint_write(f, &hdr, sizeof(hdr));
+    for (i = 0; ok && i < MAX_GENTABLES; i++) {
+        if (gentables[i] != NULL) {
+            ok = checkpoint_write_table(f, gentables[i]);
+        }
+    }
+
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+
+    if (!ok || rename(tmp_path, path) < 0) {
+        AIM_LOG_ERROR("Failed to write gentable checkpoint %s: %s",
+                      path, strerror(errno));
+        unlink(tmp_path);
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    AIM_LOG_INFO("Wrote gentable checkpoint %s", path);
+    return INDIGO_ERROR_NONE;
+}
+
+/*
+ * Find a table in the loaded checkpoint
+ *
+ * Returns the first entry byte and sets *table_hdr, or returns NULL.
+ */
+static uint8_t *
+checkpoint_find_table(const char *name, struct checkpoint_table *table_hdr)
+{
+    struct checkpoint_header hdr;
+    size_t offset = sizeof(hdr);
+    int i;
+
+    memcpy(&hdr, checkpoint_data, sizeof(hdr));
+
+    for (i = 0; i < hdr.num_tables; i++) {
+        memcpy(table_hdr, checkpoint_data + offset, sizeof(*table_hdr));
+        offset += sizeof(*table_hdr);
+        if (!strncmp(table_hdr->name, name, sizeof(table_hdr->name))) {
+            return checkpoint_data + offset;
+        }
+        offset += table_hdr->length;
+    }
+
+    return NULL;
+}
+
+/* Check the header and that every table and entry is inside the file */
+static bool
+checkpoint_validate(void)
+{
+    struct checkpoint_header hdr;
+    size_t offset = sizeof(hdr);
+    int i, j;
+
+    if (checkpoint_size < sizeof(hdr)) {
+        return false;
+    }
+
+    memcpy(&hdr, checkpoint_data, sizeof(hdr));
+    if (hdr.magic != CHECKPOINT_MAGIC || hdr.version != CHECKPOINT_VERSION) {
+        return false;
+    }
+
+    for (i = 0; i < hdr.num_tables; i++) {
+        struct checkpoint_table table_hdr;
+        size_t end;
+
+        if (checkpoint_size - offset < sizeof(table_hdr)) {
+            return false;
+        }
+        memcpy(&table_hdr, checkpoint_data + offset, sizeof(table_hdr));
+        offset += sizeof(table_hdr);
+
+        if (checkpoint_size - offset < table_hdr.length) {
+            return false;
+        }
+        end = offset + table_hdr.length;
+
+        for (j = 0; j < table_hdr.num_entries; j++) {
+            struct checkpoint_entry entry_hdr;
+            if (end - offset < sizeof(entry_hdr)) {
+                return false;
+            }
+            memcpy(&entry_hdr, checkpoint_data + offset, sizeof(entry_hdr));
+            offset += sizeof(entry_hdr);
+            if (end - offset < (size_t)entry_hdr.key_length + entry_hdr.value_length) {
+                return false;
+            }
+            offset += entry_hdr.key_length + entry_hdr.value_length;
+        }
+
+        if (offset != end) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+indigo_error_t
+indigo_core_gentable_checkpoint_load(const char *path)
+{
+    struct stat st;
+    void *data;
+    int fd;
+
+    indigo_core_gentable_checkpoint_release();
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return INDIGO_ERROR_NOT_FOUND;
+        }
+        AIM_LOG_ERROR("Failed to open gentable checkpoint %s: %s",
+                      path, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return INDIGO_ERROR_PARSE;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        AIM_LOG_ERROR("Failed to map gentable checkpoint %s: %s",
+                      path, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    checkpoint_data = data;
+    checkpoint_size = st.st_size;
+
+    if (!checkpoint_validate()) {
+        AIM_LOG_ERROR("Invalid gentable checkpoint %s", path);
+        indigo_core_gentable_checkpoint_release();
+        return INDIGO_ERROR_PARSE;
+    }
+
+    AIM_LOG_INFO("Loaded gentable checkpoint %s", path);
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_core_gentable_checkpoint_release(void)
+{
+    if (checkpoint_data != NULL) {
+        munmap(checkpoint_data, checkpoint_size);
+        checkpoint_data = NULL;
+        checkpoint_size = 0;
+    }
+}
+
+/* Add a newly registered gentable's entries from the loaded checkpoint */
+static void
+checkpoint_restore(indigo_core_gentable_t *gentable)
+{
+    struct checkpoint_table table_hdr;
+    uint8_t *data;
+    uint32_t restored = 0;
+    int i;
+
+    if (checkpoint_data == NULL) {
+        return;
+    }
+
+    data = checkpoint_find_table(gentable->name, &table_hdr);
+    if (data == NULL) {
+        return;
+    }
+
+    for (i = 0; i < table_hdr.num_entries; i++) {
+        struct checkpoint_entry entry_hdr;
+        struct ind_core_gentable_tlv_view key_view, value_view;
+        of_list_bsn_tlv_t *key, *value;
+
+        memcpy(&entry_hdr, data, sizeof(entry_hdr));
+        data += sizeof(entry_hdr);
+
+        key = tlv_view_init(&key_view, entry_hdr.version,
+                            data, entry_hdr.key_length);
+        data += entry_hdr.key_length;
+        value = tlv_view_init(&value_view, entry_hdr.version,
+                              data, entry_hdr.value_length);
+        data += entry_hdr.value_length;
+
+        if (set_entry(gentable, key, value, &entry_hdr.checksum) == INDIGO_ERROR_NONE) {
+            restored++;
+        }
+    }
+
+    batch_commit();
+
+    AIM_LOG_INFO("Restored %u of %u %s gentable entries from checkpoint",
+                 restored, table_hdr.num_entries, gentable->name);
+}
+
+
+/* OpenFlow message handlers */
+
+/*
+ * Add an entry or modify the existing entry with the same key
+ *
+ * Used by the entry add handler and when restoring a checkpoint.
+ */
+static indigo_error_t
+set_entry(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key,
+          of_list_bsn_tlv_t *value, const of_checksum_128_t *checksum)
 {
-    uint16_t table_id;
-    indigo_core_gentable_t *gentable;
-    of_list_bsn_tlv_t key, value;
     void *priv = NULL;
     indigo_error_t rv;
     struct ind_core_gentable_checksum_bucket *checksum_bucket;
     struct ind_core_gentable_entry *entry;
 
-    of_bsn_gentable_entry_add_table_id_get(obj, &table_id);
-    of_bsn_gentable_entry_add_key_bind(obj, &key);
-    of_bsn_gentable_entry_add_value_bind(obj, &value);
+    entry = find_entry_by_key(gentable, key);
 
-    gentable = find_gentable_by_id(table_id);
-    if (gentable == NULL) {
-        AIM_LOG_ERROR("Nonexistent gentable id %d", table_id);
-        indigo_cxn_send_error_reply(
-            cxn_id, obj,
-            OF_ERROR_TYPE_BAD_REQUEST,
-            OF_REQUEST_FAILED_BAD_TABLE_ID);
-        of_object_delete(obj);
-        return;
-    }
-
-    entry = find_entry_by_key(gentable, &key);
+    batch_begin(gentable);
 
     if (entry == NULL) {
         /* Adding a new entry */
-        rv = gentable->ops->add(gentable->priv, &key, &value, &priv);
+        indigo_time_us_t start = INDIGO_CURRENT_TIME_us;
+        rv = gentable->ops->add(gentable->priv, key, value, &priv);
+        count_op(gentable, &gentable->stats.adds, &gentable->stats.add_us,
+                 start, rv);
         if (rv != INDIGO_ERROR_NONE) {
             AIM_LOG_ERROR("%s gentable add failed: %s",
                           gentable->name, indigo_strerror(rv));
-            goto error;
+            return rv;
         }
 
         /* Allocate new entry */
-        entry = aim_zmalloc(sizeof(*entry));
-        entry->key = of_object_dup(&key);
+        entry = alloc_entry(gentable, key, value);
 
-        entry->key_hash = hash_key(&key);
+        entry->key_hash = hash_key(key);
         entry->priv = priv;
 
         /* Insert into key bucket */
         list_push(find_key_bucket(gentable, entry->key_hash), &entry->key_links);
+        index_insert_all(gentable, entry);
 
         gentable->num_entries++;
+        key_buckets_update(gentable);
     } else {
         /* Modifying an existing entry */
-        rv = gentable->ops->modify(gentable->priv, entry->priv, &key, &value);
+        indigo_time_us_t start = INDIGO_CURRENT_TIME_us;
+        rv = gentable->ops->modify(gentable->priv, entry->priv, key, value);
+        count_op(gentable, &gentable->stats.modifies, &gentable->stats.modify_us,
+                 start, rv);
         if (rv != INDIGO_ERROR_NONE) {
             AIM_LOG_ERROR("%s gentable modify failed: %s",
                           gentable->name, indigo_strerror(rv));
-            goto error;
+            return rv;
         }
 
-        of_object_delete(entry->value);
-
         /* Remove from old checksum bucket */
         checksum_bucket = find_checksum_bucket(gentable, &entry->checksum);
         list_remove(&entry->checksum_links);
-        update_checksum(&checksum_bucket->checksum, &entry->checksum);
+        update_bucket_checksum(gentable, checksum_bucket, &entry->checksum);
 
         /* Remove from table checksum */
         update_checksum(&gentable->checksum, &entry->checksum);
+
+        /* Update value; a compact entry may move */
+        index_remove_all(entry);
+        entry = set_entry_value(gentable, entry, value);
+        index_insert_all(gentable, entry);
+    }
+
+    /* Update checksum */
+    entry->checksum = *checksum;
+
+    /* Insert into checksum bucket */
+    checksum_bucket = find_checksum_bucket(gentable, &entry->checksum);
+    list_push(&checksum_bucket->entries, &entry->checksum_links);
+    update_bucket_checksum(gentable, checksum_bucket, &entry->checksum);
+
+    /* Add to table checksum */
+    update_checksum(&gentable->checksum, &entry->checksum);
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_core_bsn_gentable_entry_add_handler(
+    of_object_t *obj,
+    indigo_cxn_id_t cxn_id)
+{
+    uint16_t table_id;
+    indigo_core_gentable_t *gentable;
+    of_list_bsn_tlv_t key, value;
+    of_checksum_128_t checksum;
+    indigo_error_t rv;
+
+    of_bsn_gentable_entry_add_table_id_get(obj, &table_id);
+    of_bsn_gentable_entry_add_key_bind(obj, &key);
+    of_bsn_gentable_entry_add_value_bind(obj, &value);
+    of_bsn_gentable_entry_add_checksum_get(obj, &checksum);
+
+    gentable = find_gentable_by_id(table_id);
+    if (gentable == NULL) {
+        AIM_LOG_ERROR("Nonexistent gentable id %d", table_id);
+        indigo_cxn_send_error_reply(
+            cxn_id, obj,
+            OF_ERROR_TYPE_BAD_REQUEST,
+            OF_REQUEST_FAILED_BAD_TABLE_ID);
+        of_object_delete(obj);
+        return;
+    }
+
+    rv = set_entry(gentable, &key, &value, &checksum);
+    if (rv != INDIGO_ERROR_NONE) {
+        /* Not a great error code but we don't have many options */
+        indigo_cxn_send_error_reply(
+            cxn_id, obj,
+            OF_ERROR_TYPE_BAD_REQUEST,
+            OF_REQUEST_FAILED_EPERM);
+        of_object_delete(obj);
+        return;
     }
 
-    /* Update value and checksum */
-    entry->value = of_object_dup(&value);
-    of_bsn_gentable_entry_add_checksum_get(obj, &entry->checksum);
-
-    /* Insert into checksum bucket */
-    checksum_bucket = find_checksum_bucket(gentable, &entry->checksum);
-    list_push(&checksum_bucket->entries, &entry->checksum_links);
-    update_checksum(&checksum_bucket->checksum, &entry->checksum);
-
-    /* Add to table checksum */
-    update_checksum(&gentable->checksum, &entry->checksum);
-
-    of_object_delete(obj);
-    return;
-
-error:
-    /* Not a great error code but we don't have many options */
-    indigo_cxn_send_error_reply(
-        cxn_id, obj,
-        OF_ERROR_TYPE_BAD_REQUEST,
-        OF_REQUEST_FAILED_EPERM);
-    of_object_delete(obj);
+    batch_release(obj);
 }
 
 void
@@ -316,6 +1211,8 @@ ind_core_bsn_gentable_entry_delete_handler(
         return;
     }
 
+    batch_begin(gentable);
+
     rv = delete_entry(gentable, entry);
     if (rv < 0) {
         AIM_LOG_ERROR("%s gentable delete failed: %s",
@@ -328,7 +1225,7 @@ ind_core_bsn_gentable_entry_delete_handler(
         return;
     }
 
-    of_object_delete(obj);
+    batch_release(obj);
 }
 
 struct ind_core_gentable_clear_state {
@@ -345,6 +1242,7 @@ clear_iter(void *cookie, indigo_core_gentable_t *gentable,
     struct ind_core_gentable_clear_state *state = cookie;
 
     if (entry != NULL) {
+        batch_begin(gentable);
         indigo_error_t rv = delete_entry(gentable, entry);
         if (rv < 0) {
             state->error_count++;
@@ -355,6 +1253,9 @@ clear_iter(void *cookie, indigo_core_gentable_t *gentable,
         uint32_t xid;
         of_bsn_gentable_clear_request_xid_get(state->request, &xid);
 
+        /* The deletes are done once the reply is sent */
+        batch_commit();
+
         of_bsn_gentable_clear_reply_t *reply =
             of_bsn_gentable_clear_reply_new(state->request->version);
         of_bsn_gentable_clear_reply_xid_set(reply, xid);
@@ -392,14 +1293,26 @@ ind_core_bsn_gentable_clear_request_handler(
         return;
     }
 
+    gentable->stats.clear_requests++;
+
     struct ind_core_gentable_clear_state *state = aim_zmalloc(sizeof(*state));
     state->cxn_id = cxn_id;
     state->request = obj;
 
+    if (checksum_mask.hi == 0 && checksum_mask.lo == 0) {
+        uint32_t num_entries = gentable->num_entries;
+        if (clear_all_entries(gentable)) {
+            state->deleted_count = num_entries;
+            clear_iter(state, gentable, NULL);
+            return;
+        }
+    }
+
 
-    rv = ind_core_gentable_spawn_iter_task(gentable, clear_iter, state,
+    rv = ind_core_gentable_spawn_iter_task(gentable, clear_iter, NULL, state,
                                            IND_SOC_DEFAULT_PRIORITY,
-                                           checksum, checksum_mask);
+                                           checksum, checksum_mask,
+                                           INDIGO_CXN_ID_UNSPECIFIED);
     if (rv < 0) {
         AIM_LOG_ERROR("Failed to spawn gentable iter task: %s", indigo_strerror(rv));
         of_object_delete(state->request);
@@ -488,53 +1401,156 @@ ind_core_bsn_gentable_set_buckets_size_handler(
 
     aim_free(old_buckets);
 
+    build_checksum_tree(gentable);
+
     of_object_delete(obj);
 }
 
+/*
+ * Entry stats are read in groups with get_stats_batch when the table
+ * implements it. Entries are queued in reusable stats entry objects and
+ * read when the group fills or the iterator finishes a checksum bucket,
+ * so no entry pointers are kept while the task is suspended.
+ *
+ * The entry stats and entry desc stats tasks build each entry in one
+ * stats entry object kept for the whole task, and append it to a reply
+ * list bound once per reply, instead of allocating an object per entry.
+ */
 struct ind_core_gentable_entry_stats_state {
     indigo_cxn_id_t cxn_id;
     of_object_t *request;
     of_object_t *reply;
+    of_list_bsn_gentable_entry_stats_entry_t entries; /* Bound to reply */
+    of_list_bsn_tlv_t *empty_stats;
+    int num_pending;
+    /* Allocated on first use and reused */
+    of_bsn_gentable_entry_stats_entry_t *pending[GENTABLE_STATS_BATCH_MAX];
+    void *pending_privs[GENTABLE_STATS_BATCH_MAX];
+    of_list_bsn_tlv_t pending_keys[GENTABLE_STATS_BATCH_MAX];
+    of_list_bsn_tlv_t pending_stats[GENTABLE_STATS_BATCH_MAX];
 };
 
 static void
-entry_stats_iter(void *cookie, indigo_core_gentable_t *gentable,
-                 struct ind_core_gentable_entry *entry)
+entry_stats_new_reply(struct ind_core_gentable_entry_stats_state *state)
+{
+    uint32_t xid;
+    of_bsn_gentable_entry_stats_request_xid_get(state->request, &xid);
+
+    state->reply = of_bsn_gentable_entry_stats_reply_new(state->request->version);
+    of_bsn_gentable_entry_stats_reply_xid_set(state->reply, xid);
+    of_bsn_gentable_entry_stats_reply_entries_bind(state->reply, &state->entries);
+}
+
+static void
+entry_stats_append(struct ind_core_gentable_entry_stats_state *state,
+                   of_bsn_gentable_entry_stats_entry_t *stats_entry)
+{
+    if (of_list_append(&state->entries, stats_entry) < 0) {
+        of_bsn_gentable_entry_stats_reply_flags_set(state->reply,
+                                                    OF_STATS_REPLY_FLAG_REPLY_MORE);
+        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+
+        entry_stats_new_reply(state);
+
+        if (of_list_append(&state->entries, stats_entry) < 0) {
+            AIM_DIE("unexpected failure appending to an empty stats list");
+        }
+    }
+}
+
+/*
+ * Set up pending slot i for an entry, reusing its stats entry object
+ *
+ * Binds the slot's key and stats lists.
+ */
+static void
+entry_stats_prepare(struct ind_core_gentable_entry_stats_state *state, int i,
+                    of_list_bsn_tlv_t *key)
+{
+    if (state->pending[i] == NULL) {
+        state->pending[i] = of_bsn_gentable_entry_stats_entry_new(OF_VERSION_1_3);
+    }
+
+    AIM_TRUE_OR_DIE(of_bsn_gentable_entry_stats_entry_key_set(state->pending[i], key) == 0);
+    AIM_TRUE_OR_DIE(of_bsn_gentable_entry_stats_entry_stats_set(state->pending[i], state->empty_stats) == 0);
+    of_bsn_gentable_entry_stats_entry_key_bind(state->pending[i], &state->pending_keys[i]);
+    of_bsn_gentable_entry_stats_entry_stats_bind(state->pending[i], &state->pending_stats[i]);
+}
+
+static void
+entry_stats_bucket_end(void *cookie, indigo_core_gentable_t *gentable)
 {
     struct ind_core_gentable_entry_stats_state *state = cookie;
+    of_list_bsn_tlv_t *keys[GENTABLE_STATS_BATCH_MAX];
+    of_list_bsn_tlv_t *stats[GENTABLE_STATS_BATCH_MAX];
+    int i;
 
-    if (entry != NULL) {
-        of_list_bsn_gentable_entry_stats_entry_t stats_entries;
-        of_bsn_gentable_entry_stats_entry_t *stats_entry;
-        of_list_bsn_tlv_t stats;
+    if (state->num_pending == 0) {
+        return;
+    }
+
+    if (batch_gentable == gentable) {
+        batch_commit();
+    }
 
-        stats_entry = of_bsn_gentable_entry_stats_entry_new(OF_VERSION_1_3);
-        AIM_TRUE_OR_DIE(of_bsn_gentable_entry_stats_entry_key_set(stats_entry, entry->key) == 0);
-        of_bsn_gentable_entry_stats_entry_stats_bind(stats_entry, &stats);
+    for (i = 0; i < state->num_pending; i++) {
+        keys[i] = &state->pending_keys[i];
+        stats[i] = &state->pending_stats[i];
+    }
 
-        gentable->ops->get_stats(gentable->priv, entry->priv, entry->key, &stats);
+    gentable->ops->get_stats_batch(gentable->priv, state->num_pending,
+                                   state->pending_privs, keys, stats);
 
-        of_bsn_gentable_entry_stats_reply_entries_bind(state->reply, &stats_entries);
-        if (of_list_append(&stats_entries, stats_entry) < 0) {
-            of_bsn_gentable_entry_stats_reply_flags_set(state->reply,
-                                                        OF_STATS_REPLY_FLAG_REPLY_MORE);
-            indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+    for (i = 0; i < state->num_pending; i++) {
+        entry_stats_append(state, state->pending[i]);
+    }
+    gentable->stats.stats_entries += state->num_pending;
 
-            state->reply = of_bsn_gentable_entry_stats_reply_new(state->request->version);
+    state->num_pending = 0;
+}
 
-            uint32_t xid;
-            of_bsn_gentable_entry_stats_request_xid_get(state->request, &xid);
-            of_bsn_gentable_entry_stats_reply_xid_set(state->reply, xid);
+static void
+entry_stats_iter(void *cookie, indigo_core_gentable_t *gentable,
+                 struct ind_core_gentable_entry *entry)
+{
+    struct ind_core_gentable_entry_stats_state *state = cookie;
 
-            of_bsn_gentable_entry_stats_reply_entries_bind(state->reply, &stats_entries);
-            if (of_list_append(&stats_entries, stats_entry) < 0) {
-                AIM_DIE("unexpected failure appending to an empty stats list");
+    if (entry != NULL) {
+        struct ind_core_gentable_tlv_view key_view;
+        of_list_bsn_tlv_t *key = entry_key(entry, &key_view);
+
+        if (gentable->ops->get_stats_batch != NULL) {
+            int i = state->num_pending++;
+            entry_stats_prepare(state, i, key);
+            state->pending_privs[i] = entry->priv;
+            if (state->num_pending == GENTABLE_STATS_BATCH_MAX) {
+                entry_stats_bucket_end(state, gentable);
             }
+            return;
         }
 
-        of_object_delete(stats_entry);
+        /* Slot 0 is the scratch entry when not batching */
+        entry_stats_prepare(state, 0, key);
+
+        if (batch_gentable == gentable) {
+            batch_commit();
+        }
+        gentable->ops->get_stats(gentable->priv, entry->priv, key,
+                                 &state->pending_stats[0]);
+
+        entry_stats_append(state, state->pending[0]);
+        gentable->stats.stats_entries++;
     } else {
+        /* Normally already read at the end of the last bucket */
+        int i;
+        for (i = 0; i < GENTABLE_STATS_BATCH_MAX; i++) {
+            if (state->pending[i] != NULL) {
+                of_object_delete(state->pending[i]);
+            }
+        }
+
         indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+        of_object_delete(state->empty_stats);
         of_object_delete(state->request);
         aim_free(state);
     }
@@ -547,13 +1563,10 @@ ind_core_bsn_gentable_entry_stats_request_handler(
 {
     uint16_t table_id;
     indigo_core_gentable_t *gentable;
-    uint32_t xid;
-    of_bsn_gentable_entry_stats_reply_t *reply;
     struct ind_core_gentable_entry_stats_state *state;
     indigo_error_t rv;
     of_checksum_128_t checksum, checksum_mask;
 
-    of_bsn_gentable_entry_stats_request_xid_get(obj, &xid);
     of_bsn_gentable_entry_stats_request_table_id_get(obj, &table_id);
     of_bsn_gentable_entry_stats_request_checksum_get(obj, &checksum);
     of_bsn_gentable_entry_stats_request_checksum_mask_get(obj, &checksum_mask);
@@ -569,20 +1582,20 @@ ind_core_bsn_gentable_entry_stats_request_handler(
         return;
     }
 
-    reply = of_bsn_gentable_entry_stats_reply_new(obj->version);
-    of_bsn_gentable_entry_stats_reply_xid_set(reply, xid);
-
     state = aim_zmalloc(sizeof(*state));
     state->cxn_id = cxn_id;
     state->request = obj;
-    state->reply = reply;
+    state->empty_stats = of_list_bsn_tlv_new(OF_VERSION_1_3);
+    entry_stats_new_reply(state);
 
-    rv = ind_core_gentable_spawn_iter_task(gentable, entry_stats_iter, state,
+    rv = ind_core_gentable_spawn_iter_task(gentable, entry_stats_iter,
+                                           entry_stats_bucket_end, state,
                                            IND_SOC_DEFAULT_PRIORITY,
-                                           checksum, checksum_mask);
+                                           checksum, checksum_mask, cxn_id);
     if (rv < 0) {
         AIM_LOG_ERROR("Failed to spawn gentable iter task: %s", indigo_strerror(rv));
         of_object_delete(state->reply);
+        of_object_delete(state->empty_stats);
         of_object_delete(state->request);
         aim_free(state);
     }
@@ -592,8 +1605,21 @@ struct ind_core_gentable_entry_desc_stats_state {
     indigo_cxn_id_t cxn_id;
     of_object_t *request;
     of_object_t *reply;
+    of_list_bsn_gentable_entry_desc_stats_entry_t entries; /* Bound to reply */
+    of_bsn_gentable_entry_desc_stats_entry_t *stats_entry; /* Reused */
 };
 
+static void
+entry_desc_stats_new_reply(struct ind_core_gentable_entry_desc_stats_state *state)
+{
+    uint32_t xid;
+    of_bsn_gentable_entry_desc_stats_request_xid_get(state->request, &xid);
+
+    state->reply = of_bsn_gentable_entry_desc_stats_reply_new(state->request->version);
+    of_bsn_gentable_entry_desc_stats_reply_xid_set(state->reply, xid);
+    of_bsn_gentable_entry_desc_stats_reply_entries_bind(state->reply, &state->entries);
+}
+
 static void
 entry_desc_stats_iter(void *cookie, indigo_core_gentable_t *gentable,
                       struct ind_core_gentable_entry *entry)
@@ -601,35 +1627,29 @@ entry_desc_stats_iter(void *cookie, indigo_core_gentable_t *gentable,
     struct ind_core_gentable_entry_desc_stats_state *state = cookie;
 
     if (entry != NULL) {
-        of_list_bsn_gentable_entry_desc_stats_entry_t stats_entries;
-        of_bsn_gentable_entry_desc_stats_entry_t *stats_entry;
+        of_bsn_gentable_entry_desc_stats_entry_t *stats_entry = state->stats_entry;
+        struct ind_core_gentable_tlv_view key_view, value_view;
 
-        stats_entry = of_bsn_gentable_entry_desc_stats_entry_new(OF_VERSION_1_3);
         of_bsn_gentable_entry_desc_stats_entry_checksum_set(stats_entry, entry->checksum);
-        AIM_TRUE_OR_DIE(of_bsn_gentable_entry_desc_stats_entry_key_set(stats_entry, entry->key) == 0);
-        AIM_TRUE_OR_DIE(of_bsn_gentable_entry_desc_stats_entry_value_set(stats_entry, entry->value) == 0);
+        AIM_TRUE_OR_DIE(of_bsn_gentable_entry_desc_stats_entry_key_set(stats_entry, entry_key(entry, &key_view)) == 0);
+        AIM_TRUE_OR_DIE(of_bsn_gentable_entry_desc_stats_entry_value_set(stats_entry, entry_value(entry, &value_view)) == 0);
 
-        of_bsn_gentable_entry_desc_stats_reply_entries_bind(state->reply, &stats_entries);
-        if (of_list_append(&stats_entries, stats_entry) < 0) {
+        gentable->stats.desc_stats_entries++;
+
+        if (of_list_append(&state->entries, stats_entry) < 0) {
             of_bsn_gentable_entry_desc_stats_reply_flags_set(state->reply,
                                                              OF_STATS_REPLY_FLAG_REPLY_MORE);
             indigo_cxn_send_controller_message(state->cxn_id, state->reply);
 
-            state->reply = of_bsn_gentable_entry_desc_stats_reply_new(state->request->version);
+            entry_desc_stats_new_reply(state);
 
-            uint32_t xid;
-            of_bsn_gentable_entry_desc_stats_request_xid_get(state->request, &xid);
-            of_bsn_gentable_entry_desc_stats_reply_xid_set(state->reply, xid);
-
-            of_bsn_gentable_entry_desc_stats_reply_entries_bind(state->reply, &stats_entries);
-            if (of_list_append(&stats_entries, stats_entry) < 0) {
+            if (of_list_append(&state->entries, stats_entry) < 0) {
                 AIM_DIE("unexpected failure appending to an empty stats list");
             }
         }
-
-        of_object_delete(stats_entry);
     } else {
         indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+        of_object_delete(state->stats_entry);
         of_object_delete(state->request);
         aim_free(state);
     }
@@ -642,13 +1662,10 @@ ind_core_bsn_gentable_entry_desc_stats_request_handler(
 {
     uint16_t table_id;
     indigo_core_gentable_t *gentable;
-    uint32_t xid;
-    of_bsn_gentable_entry_desc_stats_reply_t *reply;
     struct ind_core_gentable_entry_desc_stats_state *state;
     indigo_error_t rv;
     of_checksum_128_t checksum, checksum_mask;
 
-    of_bsn_gentable_entry_desc_stats_request_xid_get(obj, &xid);
     of_bsn_gentable_entry_desc_stats_request_table_id_get(obj, &table_id);
     of_bsn_gentable_entry_desc_stats_request_checksum_get(obj, &checksum);
     of_bsn_gentable_entry_desc_stats_request_checksum_mask_get(obj, &checksum_mask);
@@ -664,21 +1681,20 @@ ind_core_bsn_gentable_entry_desc_stats_request_handler(
         return;
     }
 
-    reply = of_bsn_gentable_entry_desc_stats_reply_new(obj->version);
-    of_bsn_gentable_entry_desc_stats_reply_xid_set(reply, xid);
-
     state = aim_zmalloc(sizeof(*state));
     state->cxn_id = cxn_id;
     state->request = obj;
-    state->reply = reply;
+    state->stats_entry = of_bsn_gentable_entry_desc_stats_entry_new(OF_VERSION_1_3);
+    entry_desc_stats_new_reply(state);
 
-    rv = ind_core_gentable_spawn_iter_task(gentable, entry_desc_stats_iter, state,
+    rv = ind_core_gentable_spawn_iter_task(gentable, entry_desc_stats_iter, NULL, state,
                                            IND_SOC_DEFAULT_PRIORITY,
-                                           checksum, checksum_mask);
+                                           checksum, checksum_mask, cxn_id);
     if (rv < 0) {
         AIM_LOG_ERROR("Failed to spawn gentable iter task: %s", indigo_strerror(rv));
         of_object_delete(state->request);
         of_object_delete(state->reply);
+        of_object_delete(state->stats_entry);
         aim_free(state);
     }
 }
@@ -776,11 +1792,14 @@ ind_core_bsn_gentable_bucket_stats_request_handler(
     uint32_t xid;
     uint16_t table_id;
     of_bsn_gentable_bucket_stats_reply_t *reply;
+    uint16_t flags;
+    uint32_t depth, num_nodes;
     int i;
     of_list_bsn_gentable_bucket_stats_entry_t stats_entries;
 
     of_bsn_gentable_bucket_stats_request_xid_get(obj, &xid);
     of_bsn_gentable_bucket_stats_request_table_id_get(obj, &table_id);
+    of_bsn_gentable_bucket_stats_request_flags_get(obj, &flags);
 
     reply = of_bsn_gentable_bucket_stats_reply_new(obj->version);
     of_bsn_gentable_bucket_stats_reply_xid_set(reply, xid);
@@ -797,9 +1816,24 @@ ind_core_bsn_gentable_bucket_stats_request_handler(
         return;
     }
 
-    for (i = 0; i < gentable->checksum_buckets_size; i++) {
-        struct ind_core_gentable_checksum_bucket *bucket =
-            &gentable->checksum_buckets[i];
+    gentable->stats.bucket_stats_requests++;
+
+    /* Reply with the tree nodes at the requested depth, or the buckets */
+    depth = (flags & INDIGO_CORE_GENTABLE_BUCKET_STATS_REQ_BSN_DEPTH_MASK) >>
+        INDIGO_CORE_GENTABLE_BUCKET_STATS_REQ_BSN_DEPTH_SHIFT;
+    if (depth == 0 || ((uint32_t)1 << depth) >= gentable->checksum_buckets_size) {
+        num_nodes = gentable->checksum_buckets_size;
+    } else {
+        num_nodes = (uint32_t)1 << depth;
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        of_checksum_128_t *checksum;
+        if (num_nodes == gentable->checksum_buckets_size) {
+            checksum = &gentable->checksum_buckets[i].checksum;
+        } else {
+            checksum = &gentable->checksum_tree[num_nodes + i];
+        }
 
         of_bsn_gentable_bucket_stats_entry_t stats_entry;
         of_bsn_gentable_bucket_stats_entry_init(&stats_entry, reply->version, -1, 1);
@@ -816,7 +1850,7 @@ ind_core_bsn_gentable_bucket_stats_request_handler(
             }
         }
 
-        of_bsn_gentable_bucket_stats_entry_checksum_set(&stats_entry, bucket->checksum);
+        of_bsn_gentable_bucket_stats_entry_checksum_set(&stats_entry, *checksum);
     }
 
     indigo_cxn_send_controller_message(cxn_id, reply);
@@ -888,46 +1922,238 @@ update_checksum(of_checksum_128_t *dst, const of_checksum_128_t *src)
     dst->hi ^= src->hi;
 }
 
+/* Update a bucket checksum and the tree nodes above it */
+static void
+update_bucket_checksum(indigo_core_gentable_t *gentable,
+                       struct ind_core_gentable_checksum_bucket *bucket,
+                       const of_checksum_128_t *src)
+{
+    uint32_t node = gentable->checksum_buckets_size +
+        (bucket - gentable->checksum_buckets);
+
+    update_checksum(&bucket->checksum, src);
+
+    for (node /= 2; node >= 1; node /= 2) {
+        update_checksum(&gentable->checksum_tree[node], src);
+    }
+}
+
+/* Recompute the checksum tree from the buckets */
+static void
+build_checksum_tree(indigo_core_gentable_t *gentable)
+{
+    uint32_t size = gentable->checksum_buckets_size;
+    uint32_t node;
+
+    aim_free(gentable->checksum_tree);
+    gentable->checksum_tree = aim_zmalloc(sizeof(*gentable->checksum_tree) * size);
+
+    for (node = size - 1; node >= 1; node--) {
+        uint32_t child;
+        for (child = 2 * node; child <= 2 * node + 1; child++) {
+            update_checksum(&gentable->checksum_tree[node],
+                            child >= size ?
+                                &gentable->checksum_buckets[child - size].checksum :
+                                &gentable->checksum_tree[child]);
+        }
+    }
+}
+
 static uint32_t
 hash_key(of_list_bsn_tlv_t *key)
 {
     return murmur_hash(OF_OBJECT_BUFFER_INDEX(key, 0), key->length, 0);
 }
 
+/* Bucket currently holding entries with this key hash */
 static list_head_t *
 find_key_bucket(indigo_core_gentable_t *gentable, uint32_t key_hash)
 {
+    if (gentable->old_key_buckets != NULL) {
+        uint32_t old_idx = key_hash & (gentable->old_key_buckets_size - 1);
+        if (old_idx >= gentable->key_rehash_idx) {
+            return &gentable->old_key_buckets[old_idx];
+        }
+    }
+
     return &gentable->key_buckets[key_hash & (gentable->key_buckets_size - 1)];
 }
 
+/* Move up to 'steps' old key buckets into the current bucket array */
+static void
+key_buckets_rehash(indigo_core_gentable_t *gentable, int steps)
+{
+    list_head_t *old_bucket;
+    list_links_t *links;
+
+    while (gentable->old_key_buckets != NULL && steps-- > 0) {
+        old_bucket = &gentable->old_key_buckets[gentable->key_rehash_idx++];
+        while ((links = list_pop(old_bucket)) != NULL) {
+            struct ind_core_gentable_entry *entry =
+                container_of(links, key_links, struct ind_core_gentable_entry);
+            list_push(&gentable->key_buckets[entry->key_hash & (gentable->key_buckets_size - 1)],
+                      links);
+        }
+
+        if (gentable->key_rehash_idx == gentable->old_key_buckets_size) {
+            aim_free(gentable->old_key_buckets);
+            gentable->old_key_buckets = NULL;
+            gentable->old_key_buckets_size = 0;
+            gentable->key_rehash_idx = 0;
+        }
+    }
+}
+
+/*
+ * Called after each add or delete: advance any resize in progress, or
+ * start a new one if the load factor is out of range.
+ */
+static void
+key_buckets_update(indigo_core_gentable_t *gentable)
+{
+    uint32_t new_size;
+    int i;
+
+    if (gentable->old_key_buckets != NULL) {
+        key_buckets_rehash(gentable, GENTABLE_KEY_REHASH_STEP);
+        return;
+    }
+
+    if (gentable->num_entries > gentable->key_buckets_size * GENTABLE_KEY_LOAD_MAX) {
+        new_size = gentable->key_buckets_size * 2;
+    } else if (gentable->key_buckets_size > GENTABLE_KEY_MIN_BUCKETS &&
+               gentable->num_entries * GENTABLE_KEY_LOAD_MIN < gentable->key_buckets_size) {
+        new_size = gentable->key_buckets_size / 2;
+    } else {
+        return;
+    }
+
+    AIM_LOG_VERBOSE("Resizing %s gentable key buckets from %u to %u",
+                    gentable->name, gentable->key_buckets_size, new_size);
+
+    gentable->old_key_buckets = gentable->key_buckets;
+    gentable->old_key_buckets_size = gentable->key_buckets_size;
+    gentable->key_rehash_idx = 0;
+
+    gentable->key_buckets = aim_malloc(sizeof(*gentable->key_buckets) * new_size);
+    gentable->key_buckets_size = new_size;
+    for (i = 0; i < new_size; i++) {
+        list_init(&gentable->key_buckets[i]);
+    }
+
+    key_buckets_rehash(gentable, GENTABLE_KEY_REHASH_STEP);
+}
+
 static indigo_error_t
 delete_entry(indigo_core_gentable_t *gentable, struct ind_core_gentable_entry *entry)
 {
     indigo_error_t rv;
     struct ind_core_gentable_checksum_bucket *checksum_bucket;
+    struct ind_core_gentable_tlv_view key_view;
+    indigo_time_us_t start = INDIGO_CURRENT_TIME_us;
 
-    rv = gentable->ops->del(gentable->priv, entry->priv, entry->key);
+    rv = gentable->ops->del(gentable->priv, entry->priv,
+                            entry_key(entry, &key_view));
+    count_op(gentable, &gentable->stats.deletes, &gentable->stats.delete_us,
+             start, rv);
     if (rv < 0) {
         return rv;
     }
 
     list_remove(&entry->key_links);
     list_remove(&entry->checksum_links);
+    index_remove_all(entry);
 
     checksum_bucket = find_checksum_bucket(gentable, &entry->checksum);
 
-    update_checksum(&checksum_bucket->checksum, &entry->checksum);
+    update_bucket_checksum(gentable, checksum_bucket, &entry->checksum);
     update_checksum(&gentable->checksum, &entry->checksum);
 
-    of_object_delete(entry->key);
-    of_object_delete(entry->value);
-    aim_free(entry);
+    if (!gentable->compact) {
+        of_object_delete(entry->key);
+        of_object_delete(entry->value);
+    }
+    entry_mem_free(entry);
 
     gentable->num_entries--;
+    key_buckets_update(gentable);
 
     return INDIGO_ERROR_NONE;
 }
 
+/*
+ * Remove every entry with one ops->clear call and free them without
+ * per-entry unlinking or checksum updates
+ *
+ * Returns false if the table has no clear op or it failed, in which case
+ * nothing is changed.
+ */
+static bool
+clear_all_entries(indigo_core_gentable_t *gentable)
+{
+    indigo_error_t rv;
+    int i;
+
+    if (gentable->ops->clear == NULL) {
+        return false;
+    }
+
+    batch_commit();
+
+    rv = gentable->ops->clear(gentable->priv);
+    if (rv < 0) {
+        AIM_LOG_WARN("%s gentable clear failed, deleting entries individually: %s",
+                     gentable->name, indigo_strerror(rv));
+        return false;
+    }
+
+    for (i = 0; i < gentable->checksum_buckets_size; i++) {
+        struct ind_core_gentable_checksum_bucket *bucket =
+            &gentable->checksum_buckets[i];
+        list_links_t *links;
+        while ((links = list_pop(&bucket->entries)) != NULL) {
+            struct ind_core_gentable_entry *entry =
+                container_of(links, checksum_links, struct ind_core_gentable_entry);
+            if (!gentable->compact) {
+                of_object_delete(entry->key);
+                of_object_delete(entry->value);
+            }
+            entry_mem_free(entry);
+        }
+        bucket->checksum.lo = 0;
+        bucket->checksum.hi = 0;
+    }
+
+    memset(gentable->checksum_tree, 0,
+           sizeof(*gentable->checksum_tree) * gentable->checksum_buckets_size);
+    gentable->checksum.lo = 0;
+    gentable->checksum.hi = 0;
+
+    /* The key lists now hold freed entries; start over at the minimum size */
+    aim_free(gentable->key_buckets);
+    aim_free(gentable->old_key_buckets);
+    gentable->old_key_buckets = NULL;
+    gentable->old_key_buckets_size = 0;
+    gentable->key_rehash_idx = 0;
+    gentable->key_buckets_size = GENTABLE_KEY_MIN_BUCKETS;
+    gentable->key_buckets = aim_malloc(sizeof(*gentable->key_buckets) *
+                                       gentable->key_buckets_size);
+    for (i = 0; i < gentable->key_buckets_size; i++) {
+        list_init(&gentable->key_buckets[i]);
+    }
+
+    for (i = 0; i < gentable->num_indexes; i++) {
+        int j;
+        for (j = 0; j < GENTABLE_INDEX_BUCKETS; j++) {
+            list_init(&gentable->indexes[i]->buckets[j]);
+        }
+    }
+
+    gentable->num_entries = 0;
+
+    return true;
+}
+
 static struct ind_core_gentable_entry *
 find_entry_by_key(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key)
 {
@@ -939,7 +2165,17 @@ find_entry_by_key(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key)
     LIST_FOREACH_SAFE(bucket, cur, next) {
         struct ind_core_gentable_entry *entry =
             container_of(cur, key_links, struct ind_core_gentable_entry);
-        if (entry->key_hash == hash && key_equality(key, entry->key)) {
+        if (entry->key_hash != hash) {
+            continue;
+        }
+        if (entry->key == NULL) {
+            /* Compact entry; compare the inline bytes */
+            if (entry->key_length == key->length &&
+                    memcmp(entry->data, OF_OBJECT_BUFFER_INDEX(key, 0),
+                           key->length) == 0) {
+                return entry;
+            }
+        } else if (key_equality(key, entry->key)) {
             return entry;
         }
     }
@@ -947,6 +2183,113 @@ find_entry_by_key(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key)
     return NULL;
 }
 
+/* Wrap bytes stored in a compact entry in a TLV list */
+static of_list_bsn_tlv_t *
+tlv_view_init(struct ind_core_gentable_tlv_view *view, of_version_t version,
+              uint8_t *data, uint16_t length)
+{
+    view->wbuf.buf = data;
+    view->wbuf.alloc_bytes = length;
+    view->wbuf.current_bytes = length;
+    view->wbuf.free = NULL;
+
+    of_list_bsn_tlv_init(&view->list, version, length, 0);
+    view->list.length = length;
+    view->list.wire_object.wbuf = &view->wbuf;
+    view->list.wire_object.obj_offset = 0;
+
+    return &view->list;
+}
+
+/* The entry's key; 'view' must outlive the returned list */
+static of_list_bsn_tlv_t *
+entry_key(struct ind_core_gentable_entry *entry,
+          struct ind_core_gentable_tlv_view *view)
+{
+    if (entry->key != NULL) {
+        return entry->key;
+    }
+
+    return tlv_view_init(view, entry->version, entry->data, entry->key_length);
+}
+
+/* The entry's value; 'view' must outlive the returned list */
+static of_list_bsn_tlv_t *
+entry_value(struct ind_core_gentable_entry *entry,
+            struct ind_core_gentable_tlv_view *view)
+{
+    if (entry->value != NULL) {
+        return entry->value;
+    }
+
+    return tlv_view_init(view, entry->version,
+                         entry->data + entry->key_length, entry->value_length);
+}
+
+static struct ind_core_gentable_entry *
+alloc_entry(indigo_core_gentable_t *gentable, of_list_bsn_tlv_t *key,
+            of_list_bsn_tlv_t *value)
+{
+    struct ind_core_gentable_entry *entry;
+
+    if (!gentable->compact) {
+        entry = entry_mem_alloc(sizeof(*entry));
+        memset(entry, 0, sizeof(*entry));
+        entry->key = of_object_dup(key);
+        entry->value = of_object_dup(value);
+        return entry;
+    }
+
+    entry = entry_mem_alloc(sizeof(*entry) + key->length + value->length);
+    memset(entry, 0, sizeof(*entry));
+    entry->version = key->version;
+    entry->key_length = key->length;
+    entry->value_length = value->length;
+    memcpy(entry->data, OF_OBJECT_BUFFER_INDEX(key, 0), key->length);
+    memcpy(entry->data + key->length, OF_OBJECT_BUFFER_INDEX(value, 0),
+           value->length);
+
+    return entry;
+}
+
+/*
+ * Replace an entry's value. A compact entry whose value changes length
+ * is reallocated and relinked into its key bucket; the caller relinks
+ * the checksum links.
+ */
+static struct ind_core_gentable_entry *
+set_entry_value(indigo_core_gentable_t *gentable,
+                struct ind_core_gentable_entry *entry,
+                of_list_bsn_tlv_t *value)
+{
+    struct ind_core_gentable_entry *new_entry;
+
+    if (!gentable->compact) {
+        of_object_delete(entry->value);
+        entry->value = of_object_dup(value);
+        return entry;
+    }
+
+    if (entry->value_length == value->length) {
+        memcpy(entry->data + entry->key_length,
+               OF_OBJECT_BUFFER_INDEX(value, 0), value->length);
+        return entry;
+    }
+
+    new_entry = entry_mem_alloc(sizeof(*entry) + entry->key_length + value->length);
+    memcpy(new_entry, entry, sizeof(*entry) + entry->key_length);
+    new_entry->value_length = value->length;
+    memcpy(new_entry->data + new_entry->key_length,
+           OF_OBJECT_BUFFER_INDEX(value, 0), value->length);
+
+    list_remove(&entry->key_links);
+    list_push(find_key_bucket(gentable, new_entry->key_hash),
+              &new_entry->key_links);
+    entry_mem_free(entry);
+
+    return new_entry;
+}
+
 static bool
 key_equality(of_list_bsn_tlv_t *a, of_list_bsn_tlv_t *b)
 {
@@ -968,11 +2311,19 @@ key_equality(of_list_bsn_tlv_t *a, of_list_bsn_tlv_t *b)
  *
  * These functions wrap the SocketManager task API to provide a simple method
  * for iterating over a gentable without delaying higher priority events.
+ *
+ * A task feeding a controller connection finishes early when that
+ * connection's output is blocked and is restarted where it left off once
+ * the output drains.
  */
 
 struct ind_core_gentable_iter_task_state {
+    ind_soc_task_t task;
     ind_core_gentable_iter_task_callback_f callback;
+    ind_core_gentable_iter_task_bucket_end_f bucket_end;
     void *cookie;
+    int priority;
+    indigo_cxn_id_t cxn_id;
     uint16_t table_id;
     uint64_t generation_id;
     of_checksum_128_t next_checksum;
@@ -980,11 +2331,45 @@ struct ind_core_gentable_iter_task_state {
     of_checksum_128_t checksum_mask;
 };
 
+static ind_soc_task_status_t ind_core_gentable_iter_task_callback(void *cookie);
+
+static void
+ind_core_gentable_iter_task_resume(void *cookie)
+{
+    struct ind_core_gentable_iter_task_state *state = cookie;
+
+    if (ind_soc_task_start(&state->task, ind_core_gentable_iter_task_callback,
+                           state, state->priority) < 0) {
+        /* Should not happen; the same start succeeded before */
+        AIM_LOG_ERROR("Failed to resume gentable iterator task");
+        state->callback(state->cookie, NULL, NULL);
+        aim_free(state);
+    }
+}
+
+/* Returns true if the task was suspended until the connection drains */
+static bool
+ind_core_gentable_iter_task_suspend(
+    struct ind_core_gentable_iter_task_state *state)
+{
+    return state->cxn_id != INDIGO_CXN_ID_UNSPECIFIED &&
+        indigo_cxn_output_blocked(state->cxn_id) &&
+        indigo_cxn_output_wait(state->cxn_id,
+                               ind_core_gentable_iter_task_resume,
+                               state) == INDIGO_ERROR_NONE;
+}
+
+static ind_soc_task_status_t ind_core_gentable_iter_task_run(
+    struct ind_core_gentable_iter_task_state *state,
+    indigo_core_gentable_t *gentable);
+
 static ind_soc_task_status_t
 ind_core_gentable_iter_task_callback(void *cookie)
 {
     struct ind_core_gentable_iter_task_state *state = cookie;
     indigo_core_gentable_t *gentable = find_gentable_by_id(state->table_id);
+    indigo_time_us_t start = INDIGO_CURRENT_TIME_us;
+    ind_soc_task_status_t status;
 
     if (gentable == NULL || gentable->generation_id != state->generation_id) {
         AIM_LOG_WARN("gentable %s disappeared during iteration");
@@ -993,6 +2378,19 @@ ind_core_gentable_iter_task_callback(void *cookie)
         return IND_SOC_TASK_FINISHED;
     }
 
+    status = ind_core_gentable_iter_task_run(state, gentable);
+
+    ind_soc_histogram_add(&gentable->stats.iter_task_us,
+                          INDIGO_CURRENT_TIME_us - start);
+
+    return status;
+}
+
+static ind_soc_task_status_t
+ind_core_gentable_iter_task_run(
+    struct ind_core_gentable_iter_task_state *state,
+    indigo_core_gentable_t *gentable)
+{
     /*
      * This code needs to handle resizing of the checksum buckets array between
      * task invocations.
@@ -1005,6 +2403,10 @@ ind_core_gentable_iter_task_callback(void *cookie)
      */
 
     do {
+        if (ind_core_gentable_iter_task_suspend(state)) {
+            return IND_SOC_TASK_FINISHED;
+        }
+
         struct ind_core_gentable_checksum_bucket *bucket =
             find_checksum_bucket(gentable, &state->next_checksum);
 
@@ -1029,6 +2431,10 @@ ind_core_gentable_iter_task_callback(void *cookie)
             state->callback(state->cookie, gentable, entry);
         }
 
+        if (state->bucket_end != NULL) {
+            state->bucket_end(state->cookie, gentable);
+        }
+
         const uint64_t bucket_interval = (uint64_t)1 << gentable->checksum_buckets_shift;
         const uint64_t bucket_mask = ~(uint64_t)0 << gentable->checksum_buckets_shift;
 
@@ -1063,8 +2469,10 @@ ind_core_gentable_iter_task_callback(void *cookie)
  *
  * @param gentable Handle for a gentable instance
  * @param callback Function called for each flowtable entry
+ * @param bucket_end Optional function called after each checksum bucket
  * @param cookie Opaque value passed to callback
  * @param priority SocketManager task priority
+ * @param cxn_id Connection the task feeds, or INDIGO_CXN_ID_UNSPECIFIED
  * @returns An error code
  *
  * This function does not guarantee a consistent view of the
@@ -1078,24 +2486,30 @@ static indigo_error_t
 ind_core_gentable_spawn_iter_task(
     indigo_core_gentable_t *gentable,
     ind_core_gentable_iter_task_callback_f callback,
+    ind_core_gentable_iter_task_bucket_end_f bucket_end,
     void *cookie,
     int priority,
     of_checksum_128_t checksum_prefix,
-    of_checksum_128_t checksum_mask)
+    of_checksum_128_t checksum_mask,
+    indigo_cxn_id_t cxn_id)
 {
     indigo_error_t rv;
 
     struct ind_core_gentable_iter_task_state *state = aim_zmalloc(sizeof(*state));
 
     state->callback = callback;
+    state->bucket_end = bucket_end;
     state->cookie = cookie;
+    state->priority = priority;
+    state->cxn_id = cxn_id;
     state->table_id = gentable->table_id;
     state->generation_id = gentable->generation_id;
     state->checksum_prefix = checksum_prefix;
     state->checksum_mask = checksum_mask;
     state->next_checksum = checksum_prefix;
 
-    rv = ind_soc_task_register(ind_core_gentable_iter_task_callback, state, priority);
+    rv = ind_soc_task_start(&state->task, ind_core_gentable_iter_task_callback,
+                            state, priority);
     if (rv != INDIGO_ERROR_NONE) {
         aim_free(state);
         return rv;
@@ -35,6 +35,11 @@
 #include "ofstatemanager_decs.h"
 #include "ofstatemanager_int.h"
 #include "handlers.h"
+#include "flow_batch.h"
+#include "pending.h"
+#include "ft.h"
+#include "driver_stats.h"
+#include "counter_cache.h"
 #include <BigHash/bighash.h>
 
 typedef struct ind_core_group_s {
@@ -43,6 +48,8 @@ typedef struct ind_core_group_s {
     uint32_t type;
     of_list_bucket_t *buckets;
     indigo_time_t creation_time;
+    of_group_stats_entry_t *stats_cache; /* Last stats read; see counter_cache.h */
+    indigo_time_t stats_time;
 } ind_core_group_t;
 
 #define TEMPLATE_NAME group_hashtable
@@ -59,15 +66,65 @@ ind_core_group_lookup(uint32_t id)
     return group_hashtable_first(ind_core_group_hashtable, &id);
 }
 
+bool
+ind_core_group_exists(uint32_t id)
+{
+    return ind_core_group_lookup(id) != NULL;
+}
+
+/* Forget the cached stats, whose bucket counters may no longer apply */
 static void
-ind_core_group_delete_one(ind_core_group_t *group)
+ind_core_group_stats_cache_drop(ind_core_group_t *group)
 {
-    indigo_fwd_group_delete(group->id);
+    of_object_delete(group->stats_cache);
+    group->stats_cache = NULL;
+    group->stats_time = 0;
+}
+
+static void
+ind_core_group_free(ind_core_group_t *group)
+{
+    ind_core_group_stats_cache_drop(group);
     of_object_delete(group->buckets);
     bighash_remove(ind_core_group_hashtable, &group->hash_entry);
     INDIGO_MEM_FREE(group);
 }
 
+/*
+ * Delete the flows whose actions refer to a group, as the OpenFlow spec
+ * requires when the group is deleted. The flowtable indexes flows by
+ * referenced group, so this only walks the flows using it.
+ */
+static void
+ind_core_group_flows_delete(uint32_t id, of_object_t *request)
+{
+    ft_iterator_t iter;
+    of_meta_match_t query;
+    ft_entry_t *entry;
+
+    INDIGO_MEM_SET(&query, 0, sizeof(query));
+    query.mode = OF_MATCH_NON_STRICT;
+    query.out_port = OF_PORT_DEST_WILDCARD;
+    query.table_id = TABLE_ID_ANY;
+    query.check_out_group = 1;
+    query.out_group = id;
+
+    ft_iterator_init(&iter, ind_core_ft, &query);
+    while ((entry = ft_iterator_next(&iter)) != NULL) {
+        ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_GROUP_DELETE,
+                                   request);
+    }
+    ft_iterator_cleanup(&iter);
+}
+
+static void
+ind_core_group_delete_one(ind_core_group_t *group, of_object_t *request)
+{
+    ind_core_group_flows_delete(group->id, request);
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_group_delete, group->id);
+    ind_core_group_free(group);
+}
+
 void
 ind_core_group_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
 {
@@ -98,7 +155,7 @@ ind_core_group_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
         goto error;
     }
 
-    result = indigo_fwd_group_add(id, type, &buckets);
+    result = IND_CORE_DRIVER_CALL(indigo_fwd_group_add, id, type, &buckets);
     if (result < 0) {
         err_code = OF_GROUP_MOD_FAILED_INVALID_GROUP;
         goto error;
@@ -111,10 +168,18 @@ ind_core_group_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     group->buckets = of_object_dup(&buckets);
     AIM_TRUE_OR_DIE(group->buckets != NULL);
     group->creation_time = INDIGO_CURRENT_TIME;
+    group->stats_cache = NULL;
+    group->stats_time = 0;
 
     group_hashtable_insert(ind_core_group_hashtable, group);
 
-    of_object_delete(obj);
+    if (result == INDIGO_ERROR_PENDING) {
+        /* Kept in the local table meanwhile; removed again on failure */
+        (void)ind_core_pending_add(IND_CORE_PENDING_GROUP_ADD, id, _obj,
+                                   cxn_id);
+    }
+
+    ind_core_pending_release(_obj);
     return;
 
 error:
@@ -122,6 +187,32 @@ error:
     of_object_delete(obj);
 }
 
+/**
+ * Complete a group add that Forwarding returned INDIGO_ERROR_PENDING for
+ */
+
+void
+ind_core_group_add_finish(indigo_error_t result, uint32_t id,
+                          of_object_t *request, indigo_cxn_id_t cxn_id)
+{
+    ind_core_group_t *group;
+
+    if (result >= 0) {
+        return;
+    }
+
+    LOG_ERROR("Error from Forwarding while adding group %u: %s",
+              id, indigo_strerror(result));
+
+    if ((group = ind_core_group_lookup(id)) != NULL) {
+        ind_core_group_free(group);
+    }
+
+    indigo_cxn_send_error_reply(cxn_id, request,
+                                OF_ERROR_TYPE_GROUP_MOD_FAILED,
+                                OF_GROUP_MOD_FAILED_INVALID_GROUP);
+}
+
 void
 ind_core_group_modify_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
 {
@@ -149,11 +240,14 @@ ind_core_group_modify_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
         goto error;
     }
 
+    /* Queued flows may refer to the old group */
+    ind_core_flow_batch_flush();
+
     if (group->type == type) {
-        result = indigo_fwd_group_modify(id, &buckets);
+        result = IND_CORE_DRIVER_CALL(indigo_fwd_group_modify, id, &buckets);
     } else {
-        indigo_fwd_group_delete(id);
-        result = indigo_fwd_group_add(id, type, &buckets);
+        IND_CORE_DRIVER_CALL_VOID(indigo_fwd_group_delete, id);
+        result = IND_CORE_DRIVER_CALL(indigo_fwd_group_add, id, type, &buckets);
     }
 
     if (result < 0) {
@@ -161,12 +255,25 @@ ind_core_group_modify_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
         goto error;
     }
 
+    if (result == INDIGO_ERROR_PENDING) {
+        /* Keep the old contents to restore if Forwarding fails */
+        ind_core_group_t *old = INDIGO_MEM_ALLOC(sizeof(*old));
+        AIM_TRUE_OR_DIE(old != NULL);
+        old->id = id;
+        old->type = group->type;
+        old->buckets = group->buckets;
+        ind_core_pending_add(IND_CORE_PENDING_GROUP_MODIFY, id, _obj,
+                             cxn_id)->cookie = old;
+    } else {
+        of_object_delete(group->buckets);
+    }
+
     group->type = type;
-    of_object_delete(group->buckets);
     group->buckets = of_object_dup(&buckets);
     AIM_TRUE_OR_DIE(group->buckets != NULL);
+    ind_core_group_stats_cache_drop(group);
 
-    of_object_delete(obj);
+    ind_core_pending_release(_obj);
     return;
 
 error:
@@ -174,6 +281,48 @@ error:
     of_object_delete(obj);
 }
 
+/**
+ * Complete a group modify that Forwarding returned INDIGO_ERROR_PENDING for
+ */
+
+void
+ind_core_group_modify_finish(indigo_error_t result, uint32_t id,
+                             of_object_t *request, indigo_cxn_id_t cxn_id,
+                             void *cookie)
+{
+    ind_core_group_t *old = cookie;
+    ind_core_group_t *group;
+
+    if (result < 0) {
+        LOG_ERROR("Error from Forwarding while modifying group %u: %s",
+                  id, indigo_strerror(result));
+
+        group = ind_core_group_lookup(id);
+        if (group != NULL && group->type != old->type) {
+            /*
+             * A type change deleted the group from Forwarding before the
+             * failed add, so drop it here too, as for a failed group add
+             */
+            ind_core_group_free(group);
+        } else if (group != NULL) {
+            /* Forwarding still has the old contents */
+            of_object_delete(group->buckets);
+            group->buckets = old->buckets;
+            old->buckets = NULL;
+            ind_core_group_stats_cache_drop(group);
+        }
+
+        indigo_cxn_send_error_reply(cxn_id, request,
+                                    OF_ERROR_TYPE_GROUP_MOD_FAILED,
+                                    OF_GROUP_MOD_FAILED_INVALID_GROUP);
+    }
+
+    if (old->buckets != NULL) {
+        of_object_delete(old->buckets);
+    }
+    INDIGO_MEM_FREE(old);
+}
+
 void
 ind_core_group_delete_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
 {
@@ -191,20 +340,24 @@ ind_core_group_delete_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
         group = ind_core_group_lookup(id);
     }
 
+    /* Queued flows may refer to the deleted groups */
+    ind_core_flow_batch_flush();
+
     if (id == OF_GROUP_ALL) {
         bighash_iter_t iter;
         for (group = bighash_iter_start(ind_core_group_hashtable, &iter);
                 group; group = bighash_iter_next(&iter)) {
-            ind_core_group_delete_one(group);
+            ind_core_group_delete_one(group, _obj);
         }
     } else if (group != NULL) {
-        ind_core_group_delete_one(group);
+        ind_core_group_delete_one(group, _obj);
     } else if (id > OF_GROUP_MAX) {
         err_code = OF_GROUP_MOD_FAILED_INVALID_GROUP;
         goto error;
     }
 
-    of_object_delete(obj);
+    ind_core_flow_removed_flush();
+    ind_core_pending_release(_obj);
     return;
 
 error:
@@ -212,10 +365,82 @@ error:
     of_object_delete(obj);
 }
 
+/*
+ * Group stats and group desc stats tasks
+ *
+ * The group IDs are copied when the request arrives and the task looks
+ * each one up again, so groups added while it runs are not reported and
+ * groups deleted while it runs are skipped. Group stats are read from
+ * Forwarding GROUP_STATS_BATCH_MAX groups at a time.
+ *
+ * Replies are sent whenever one fills up, with the REPLY_MORE flag set
+ * on all but the last.
+ */
+
+#define GROUP_STATS_BATCH_MAX 64
+
+struct ind_core_group_stats_state {
+    ind_soc_task_t task;
+    of_object_t *req;
+    indigo_cxn_id_t cxn_id;
+    of_object_t *reply;
+    uint32_t *ids;
+    int num_ids;
+    int next_idx;
+    indigo_time_t current_time;
+};
+
+static ind_soc_task_status_t group_stats_task(void *cookie);
+
+/* Allocate a reply if we don't already have one */
+static indigo_error_t
+group_stats_reply_alloc(struct ind_core_group_stats_state *state)
+{
+    uint32_t xid;
+
+    if (state->reply != NULL) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if (state->req->object_id == OF_GROUP_STATS_REQUEST) {
+        state->reply = of_group_stats_reply_new(state->req->version);
+        if (state->reply == NULL) {
+            LOG_ERROR("Failed to allocate of_group_stats_reply.");
+            return INDIGO_ERROR_RESOURCE;
+        }
+        of_group_stats_request_xid_get(state->req, &xid);
+        of_group_stats_reply_xid_set(state->reply, xid);
+        of_group_stats_reply_flags_set(state->reply,
+                                       OF_STATS_REPLY_FLAG_REPLY_MORE);
+    } else {
+        state->reply = of_group_desc_stats_reply_new(state->req->version);
+        if (state->reply == NULL) {
+            LOG_ERROR("Failed to allocate of_group_desc_stats_reply.");
+            return INDIGO_ERROR_RESOURCE;
+        }
+        of_group_desc_stats_request_xid_get(state->req, &xid);
+        of_group_desc_stats_reply_xid_set(state->reply, xid);
+        of_group_desc_stats_reply_flags_set(state->reply,
+                                            OF_STATS_REPLY_FLAG_REPLY_MORE);
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Send the reply if the next entry could make it too big */
+static void
+group_stats_reply_check(struct ind_core_group_stats_state *state)
+{
+    if (state->reply->length > (1 << 15)) {
+        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+        state->reply = NULL;
+    }
+}
+
 static void
-ind_core_group_stats_entry_populate(of_group_stats_entry_t *entry,
-                                    ind_core_group_t *group,
-                                    indigo_time_t current_time)
+group_stats_entry_populate(of_group_stats_entry_t *entry,
+                           ind_core_group_t *group,
+                           indigo_time_t current_time)
 {
     uint32_t duration_sec, duration_nsec;
 
@@ -224,108 +449,221 @@ ind_core_group_stats_entry_populate(of_group_stats_entry_t *entry,
     calc_duration(current_time, group->creation_time, &duration_sec, &duration_nsec);
     of_group_stats_entry_duration_sec_set(entry, duration_sec);
     of_group_stats_entry_duration_nsec_set(entry, duration_nsec);
+}
+
+/*
+ * Report the next batch of groups
+ *
+ * Groups whose cached stats are fresh are reported from the cache; the
+ * rest are read from Forwarding together and cached if it is enabled.
+ */
+static void
+group_stats_batch(struct ind_core_group_stats_state *state)
+{
+    of_group_stats_entry_t *entries[GROUP_STATS_BATCH_MAX];
+    of_group_stats_entry_t *reads[GROUP_STATS_BATCH_MAX];
+    ind_core_group_t *read_groups[GROUP_STATS_BATCH_MAX];
+    uint32_t ids[GROUP_STATS_BATCH_MAX];
+    of_list_group_stats_entry_t list;
+    ind_core_group_t *group;
+    int num_groups = 0;
+    int num_reads = 0;
+    int i;
+
+    while (state->next_idx < state->num_ids &&
+           num_groups < GROUP_STATS_BATCH_MAX) {
+        of_group_stats_entry_t *entry = NULL;
+        group = ind_core_group_lookup(state->ids[state->next_idx++]);
+        if (group == NULL) {
+            continue;
+        }
+        if (group->stats_cache != NULL &&
+            group->stats_cache->version == state->req->version &&
+            ind_core_counter_cache_fresh(group->stats_time)) {
+            entry = of_object_dup(group->stats_cache);
+        }
+        if (entry == NULL) {
+            entry = of_group_stats_entry_new(state->req->version);
+            AIM_TRUE_OR_DIE(entry != NULL);
+            read_groups[num_reads] = group;
+            reads[num_reads] = entry;
+            ids[num_reads++] = group->id;
+        }
+        group_stats_entry_populate(entry, group, state->current_time);
+        entries[num_groups++] = entry;
+    }
+
+    if (num_reads > 0) {
+        IND_CORE_DRIVER_CALL_VOID(indigo_fwd_group_stats_bulk_get,
+                                  ids, num_reads, reads);
+    }
+
+    for (i = 0; i < num_reads; i++) {
+        group = read_groups[i];
+        ind_core_group_stats_cache_drop(group);
+        if (ind_core_counter_cache_enabled()) {
+            group->stats_cache = of_object_dup(reads[i]);
+            group->stats_time = INDIGO_CURRENT_TIME;
+        }
+    }
 
-    indigo_fwd_group_stats_get(group->id, entry);
+    for (i = 0; i < num_groups; i++) {
+        if (group_stats_reply_alloc(state) == INDIGO_ERROR_NONE) {
+            of_group_stats_reply_entries_bind(state->reply, &list);
+            if (of_list_append(&list, entries[i]) < 0) {
+                LOG_ERROR("Failed to append group stats entry");
+            } else {
+                group_stats_reply_check(state);
+            }
+        }
+        of_object_delete(entries[i]);
+    }
 }
 
-/* TODO segment long replies */
-void
-ind_core_group_stats_request_handler(of_object_t *_obj,
-                                     indigo_cxn_id_t cxn_id)
+/* Report the next group's description */
+static void
+group_desc_stats_one(struct ind_core_group_stats_state *state)
 {
-    of_group_stats_request_t *obj = _obj;
-    of_group_stats_reply_t *reply;
-    of_list_group_stats_entry_t entries;
-    of_group_stats_entry_t *entry;
-    uint32_t xid;
-    uint32_t id;
-    indigo_time_t current_time = INDIGO_CURRENT_TIME;
+    of_list_group_desc_stats_entry_t list;
+    of_group_desc_stats_entry_t entry;
+    ind_core_group_t *group;
 
-    of_group_stats_request_group_id_get(obj, &id);
+    group = ind_core_group_lookup(state->ids[state->next_idx++]);
+    if (group == NULL || group_stats_reply_alloc(state) < 0) {
+        return;
+    }
 
-    reply = of_group_stats_reply_new(obj->version);
-    AIM_TRUE_OR_DIE(reply != NULL);
+    of_group_desc_stats_reply_entries_bind(state->reply, &list);
+    of_group_desc_stats_entry_init(&entry, list.version, -1, 1);
+    if (of_list_group_desc_stats_entry_append_bind(&list, &entry) < 0) {
+        LOG_ERROR("Failed to append group desc stats entry");
+        return;
+    }
 
-    of_group_stats_request_xid_get(obj, &xid);
-    of_group_stats_reply_xid_set(reply, xid);
-    of_group_stats_reply_entries_bind(reply, &entries);
+    of_group_desc_stats_entry_group_type_set(&entry, group->type);
+    of_group_desc_stats_entry_group_id_set(&entry, group->id);
+    if (of_group_desc_stats_entry_buckets_set(&entry, group->buckets) < 0) {
+        AIM_DIE("unexpected failure setting group desc stats entry buckets");
+    }
 
-    entry = of_group_stats_entry_new(entries.version);
-    AIM_TRUE_OR_DIE(entry != NULL);
+    group_stats_reply_check(state);
+}
 
-    if (id == OF_GROUP_ALL) {
-        bighash_iter_t iter;
-        ind_core_group_t *group;
-        for (group = bighash_iter_start(ind_core_group_hashtable, &iter);
-                group; group = bighash_iter_next(&iter)) {
-            ind_core_group_stats_entry_populate(entry, group, current_time);
+static void
+group_stats_finish(struct ind_core_group_stats_state *state)
+{
+    /* Send last reply */
+    if (group_stats_reply_alloc(state) == INDIGO_ERROR_NONE) {
+        if (state->reply->object_id == OF_GROUP_STATS_REPLY) {
+            of_group_stats_reply_flags_set(state->reply, 0);
+        } else {
+            of_group_desc_stats_reply_flags_set(state->reply, 0);
+        }
+        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+    }
 
-            if (of_list_append(&entries, entry) < 0) {
-                break;
-            }
+    of_object_delete(state->req);
+    INDIGO_MEM_FREE(state->ids);
+    INDIGO_MEM_FREE(state);
+}
 
-            /* HACK unable to truncate existing object */
-            of_object_delete(entry);
-            entry = of_group_stats_entry_new(entries.version);
-            AIM_TRUE_OR_DIE(entry != NULL);
+static void
+group_stats_task_resume(void *cookie)
+{
+    struct ind_core_group_stats_state *state = cookie;
+
+    if (ind_soc_task_start(&state->task, group_stats_task, state,
+                           IND_SOC_DEFAULT_PRIORITY) < 0) {
+        /* Should not happen; the same start succeeded before */
+        LOG_ERROR("Failed to resume group stats task");
+        group_stats_finish(state);
+    }
+}
+
+static ind_soc_task_status_t
+group_stats_task(void *cookie)
+{
+    struct ind_core_group_stats_state *state = cookie;
+
+    do {
+        if (indigo_cxn_output_blocked(state->cxn_id) &&
+            indigo_cxn_output_wait(state->cxn_id, group_stats_task_resume,
+                                   state) == INDIGO_ERROR_NONE) {
+            return IND_SOC_TASK_FINISHED;
         }
-    } else if (id <= OF_GROUP_MAX) {
-        ind_core_group_t *group = ind_core_group_lookup(id);
-        if (group != NULL) {
-            ind_core_group_stats_entry_populate(entry, group, current_time);
 
-            if (of_list_append(&entries, entry) < 0) {
-                AIM_DIE("unexpected failure appending single group stats entry");
-            }
+        if (state->next_idx == state->num_ids) {
+            group_stats_finish(state);
+            return IND_SOC_TASK_FINISHED;
         }
-    }
 
-    of_object_delete(entry);
-    of_object_delete(obj);
+        if (state->req->object_id == OF_GROUP_STATS_REQUEST) {
+            group_stats_batch(state);
+        } else {
+            group_desc_stats_one(state);
+        }
+    } while (!ind_soc_should_yield());
 
-    indigo_cxn_send_controller_message(cxn_id, reply);
+    return IND_SOC_TASK_CONTINUE;
 }
 
-/* TODO segment long replies */
-void
-ind_core_group_desc_stats_request_handler(of_object_t *_obj,
-                                          indigo_cxn_id_t cxn_id)
+/*
+ * Start a group stats or group desc stats task for one group, or all
+ * groups if id is OF_GROUP_ALL
+ */
+static void
+group_stats_spawn(of_object_t *req, uint32_t id, indigo_cxn_id_t cxn_id)
 {
-    of_group_desc_stats_request_t *obj = _obj;
-    of_group_desc_stats_reply_t *reply;
-    of_list_group_desc_stats_entry_t entries;
-    of_group_desc_stats_entry_t *entry;
-    uint32_t xid;
-    ind_core_group_t *group;
+    struct ind_core_group_stats_state *state;
     bighash_iter_t iter;
+    ind_core_group_t *group;
+    int max_ids;
 
-    reply = of_group_desc_stats_reply_new(obj->version);
-    AIM_TRUE_OR_DIE(reply != NULL);
-
-    of_group_desc_stats_request_xid_get(obj, &xid);
-    of_group_desc_stats_reply_xid_set(reply, xid);
-    of_group_desc_stats_reply_entries_bind(reply, &entries);
+    state = INDIGO_MEM_ALLOC(sizeof(*state));
+    AIM_TRUE_OR_DIE(state != NULL);
+    INDIGO_MEM_SET(state, 0, sizeof(*state));
+    state->req = req;
+    state->cxn_id = cxn_id;
+    state->current_time = INDIGO_CURRENT_TIME;
 
-    entry = of_group_desc_stats_entry_new(entries.version);
-    AIM_TRUE_OR_DIE(entry != NULL);
+    max_ids = bighash_entry_count(ind_core_group_hashtable);
+    state->ids = INDIGO_MEM_ALLOC(sizeof(uint32_t) * (max_ids + 1));
+    AIM_TRUE_OR_DIE(state->ids != NULL);
 
-    for (group = bighash_iter_start(ind_core_group_hashtable, &iter);
-            group; group = bighash_iter_next(&iter)) {
-        of_group_desc_stats_entry_group_type_set(entry, group->type);
-        of_group_desc_stats_entry_group_id_set(entry, group->id);
-        if (of_group_desc_stats_entry_buckets_set(entry, group->buckets) < 0) {
-            AIM_DIE("unexpected failure setting group desc stats entry buckets");
+    if (id == OF_GROUP_ALL) {
+        for (group = bighash_iter_start(ind_core_group_hashtable, &iter);
+                group; group = bighash_iter_next(&iter)) {
+            state->ids[state->num_ids++] = group->id;
         }
+    } else if (id <= OF_GROUP_MAX) {
+        state->ids[state->num_ids++] = id;
+    }
 
-        if (of_list_append(&entries, entry) < 0) {
-            break;
-        }
+    if (ind_soc_task_start(&state->task, group_stats_task, state,
+                           IND_SOC_DEFAULT_PRIORITY) < 0) {
+        LOG_ERROR("Failed to start group stats task");
+        of_object_delete(req);
+        INDIGO_MEM_FREE(state->ids);
+        INDIGO_MEM_FREE(state);
     }
+}
 
-    of_object_delete(entry);
-    of_object_delete(obj);
+void
+ind_core_group_stats_request_handler(of_object_t *_obj,
+                                     indigo_cxn_id_t cxn_id)
+{
+    of_group_stats_request_t *obj = _obj;
+    uint32_t id;
+
+    of_group_stats_request_group_id_get(obj, &id);
+    group_stats_spawn(obj, id, cxn_id);
+}
 
-    indigo_cxn_send_controller_message(cxn_id, reply);
+void
+ind_core_group_desc_stats_request_handler(of_object_t *_obj,
+                                          indigo_cxn_id_t cxn_id)
+{
+    group_stats_spawn(_obj, OF_GROUP_ALL, cxn_id);
 }
 
 void
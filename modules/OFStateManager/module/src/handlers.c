@@ -32,17 +32,33 @@
 #include <indigo/of_state_manager.h>
 #include <indigo/port_manager.h>
 #include <indigo/forwarding.h>
+#include <indigo/binlog.h>
 #include <loci/loci.h>
 #include <loci/loci_obj_dump.h>
 #include "ofstatemanager_decs.h"
 #include "ofstatemanager_int.h"
 #include "handlers.h"
 #include "ft.h"
+#include "flow_batch.h"
+#include "packet_out_batch.h"
+#include "pending.h"
+#include "counter_cache.h"
+#include "delta_stats.h"
+#include "flow_monitor.h"
+#include "port_stats.h"
+#include "driver_stats.h"
+#include "flow_stats_worker.h"
+#include "flow_checkpoint.h"
+#include "flow_stats_page.h"
 
 static void
 flow_mod_err_msg_send(indigo_error_t indigo_err, of_version_t ver,
                       indigo_cxn_id_t cxn_id, of_flow_modify_t *flow_mod);
 
+static void
+flow_modify_one(ft_entry_t *entry, of_flow_modify_t *obj,
+                indigo_cxn_id_t cxn_id);
+
 /****************************************************************
  *
  * Message handling
@@ -74,17 +90,14 @@ ind_core_unhandled_message(of_object_t *obj, indigo_cxn_id_t cxn_id)
  * @param _obj Generic type object for the message to be coerced
  * @returns Error code
  *
- * Note:  Deletes packet out object, so data from obj should be copied
+ * The packet out is queued and deleted once the batch is sent, see
+ * packet_out_batch.h
  */
 
 void
 ind_core_packet_out_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
 {
-    of_packet_out_t *obj = _obj;
-
-    (void)indigo_fwd_packet_out(obj);
-
-    of_packet_out_delete(obj);
+    ind_core_packet_out_batch_add(_obj);
 }
 
 /****************************************************************/
@@ -102,7 +115,7 @@ ind_core_port_mod_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     of_port_mod_t *obj = _obj;
     indigo_error_t rv;
 
-    rv = indigo_port_modify(obj);
+    rv = IND_CORE_DRIVER_CALL(indigo_port_modify, obj);
     if (rv != INDIGO_ERROR_NONE) {
         of_version_t ver = obj->version;
         of_port_no_t port_no;
@@ -136,7 +149,14 @@ ind_core_port_stats_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     indigo_error_t rv;
     uint32_t xid = 0;
 
-    rv = indigo_port_stats_get(obj, &reply);
+    rv = ind_core_port_stats_reply_send(obj, cxn_id);
+    if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+        rv = IND_CORE_DRIVER_CALL(indigo_port_stats_get, obj, &reply);
+    } else if (rv == INDIGO_ERROR_NONE) {
+        of_port_stats_request_delete(obj);
+        return;
+    }
+
     if (rv == INDIGO_ERROR_NONE) {
         /* Set the XID to match the request */
         of_port_stats_request_xid_get(obj, &xid);
@@ -178,7 +198,7 @@ ind_core_queue_get_config_request_handler(of_object_t *_obj,
     of_queue_get_config_request_xid_get(obj, &xid);
     of_queue_get_config_request_port_get(obj, &port);
 
-    rv = indigo_port_queue_config_get(obj, &reply);
+    rv = IND_CORE_DRIVER_CALL(indigo_port_queue_config_get, obj, &reply);
     if (rv == INDIGO_ERROR_NONE) {
         of_queue_get_config_reply_xid_set(reply, xid);
         of_queue_get_config_reply_port_set(reply, port);
@@ -215,7 +235,14 @@ ind_core_queue_stats_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
 
     of_queue_stats_request_xid_get(obj, &xid);
 
-    rv = indigo_port_queue_stats_get(obj, &reply);
+    rv = ind_core_queue_stats_reply_send(obj, cxn_id);
+    if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+        rv = IND_CORE_DRIVER_CALL(indigo_port_queue_stats_get, obj, &reply);
+    } else if (rv == INDIGO_ERROR_NONE) {
+        of_queue_stats_request_delete(obj);
+        return;
+    }
+
     if (rv == INDIGO_ERROR_NONE) {
         /* Set the XID to match the request */
         of_queue_stats_reply_xid_set(reply, xid);
@@ -263,6 +290,10 @@ flow_mod_setup_query(of_flow_modify_t *obj, /* Works with add, mod, del */
     } else {
         /* Could check object_id is delete or delete_strict */
         of_flow_add_out_port_get(obj, &(query->out_port));
+        if (obj->version >= OF_VERSION_1_1) {
+            of_flow_add_out_group_get(obj, &query->out_group);
+            query->check_out_group = query->out_group != OF_GROUP_ANY;
+        }
     }
     if (query_mode != OF_MATCH_OVERLAP && obj->version >= OF_VERSION_1_1) {
         of_flow_add_cookie_get(obj, &query->cookie);
@@ -281,31 +312,133 @@ flow_mod_setup_query(of_flow_modify_t *obj, /* Works with add, mod, del */
 static int
 overlap_found(of_flow_modify_t *obj)
 {
-    ft_entry_t *entry;
-    list_links_t *cur, *next;
+    ft_iterator_t iter;
     of_meta_match_t query;
+    int found;
 
     _TRY(flow_mod_setup_query(obj, &query, OF_MATCH_OVERLAP, 1));
 
-    FT_ITER(ind_core_ft, entry, cur, next) {
-        if (ft_entry_meta_match(&query, entry)) {
-            return 1;
-        }
+    /* Only flows of the same priority are candidates */
+    ft_iterator_init(&iter, ind_core_ft, &query);
+    found = ft_iterator_next(&iter) != NULL;
+    ft_iterator_cleanup(&iter);
+
+    return found;
+}
+
+/**
+ * Make room for a flow Forwarding found its table full for
+ * @param obj The flow_add
+ * @param entry The flowtable entry for the add, never evicted
+ *
+ * Returns true if a flow was evicted from the table the add targets.
+ */
+
+static bool
+flow_add_evict(of_flow_modify_t *obj, ft_entry_t *entry)
+{
+    uint8_t table_id = 0;
+    ft_entry_t *victim;
+
+    if (obj->version >= OF_VERSION_1_1) {
+        of_flow_modify_table_id_get(obj, &table_id);
+    }
+
+    victim = ft_eviction_victim(ind_core_ft, table_id, entry);
+    if (victim == NULL) {
+        return false;
+    }
+
+    LOG_VERBOSE("Evicting flow " INDIGO_FLOW_ID_PRINTF_FORMAT
+                " from table %u", INDIGO_FLOW_ID_PRINTF_ARG(victim->id),
+                table_id);
+    ind_core_ft->status.evictions += 1;
+    ind_core_flow_entry_delete(victim, INDIGO_FLOW_REMOVED_EVICTION, NULL);
+
+    return true;
+}
+
+/* True if a flow_add carries the same effects a flow already has */
+static bool
+flow_add_effects_eq(of_flow_modify_t *obj, ft_entry_t *entry)
+{
+    of_object_t *cur = entry->effects.actions;
+    of_list_action_t actions;
+    of_list_instruction_t instructions;
+    of_object_t *new;
+
+    if (cur == NULL || cur->version != obj->version) {
+        return false;
+    }
+
+    if (obj->version == OF_VERSION_1_0) {
+        of_flow_modify_actions_bind(obj, &actions);
+        new = &actions;
+    } else {
+        of_flow_modify_instructions_bind(obj, &instructions);
+        new = &instructions;
     }
 
-    return 0;
+    return new->length == cur->length &&
+        memcmp(OF_OBJECT_BUFFER_INDEX(new, 0),
+               OF_OBJECT_BUFFER_INDEX(cur, 0), cur->length) == 0;
 }
 
-static indigo_flow_id_t
-flow_id_next(void)
+/**
+ * Apply a flow_add to the flow it strictly matches without replacing it
+ * @param obj The flow_add
+ * @param entry The existing flowtable entry
+ * @param cxn_id Connection the request arrived on
+ *
+ * Controllers re-assert their flows after reconnecting. If everything but
+ * the effects is unchanged the existing entry, its counters and its
+ * hardware flow are kept: nothing is done if the effects are the same too,
+ * otherwise Forwarding modifies the flow in place. Either way its timeouts
+ * restart, as for a replaced flow. Returns false if the flow must be
+ * replaced instead.
+ */
+
+static bool
+flow_add_in_place(of_flow_modify_t *obj, ft_entry_t *entry,
+                  indigo_cxn_id_t cxn_id)
 {
-    static indigo_flow_id_t next_flow_id = 1;
+    of_version_t ver = obj->version;
+    uint64_t cookie;
+    uint16_t flags, idle_timeout, hard_timeout, importance = 0;
 
-    indigo_flow_id_t result = next_flow_id;
+    of_flow_modify_cookie_get(obj, &cookie);
+    of_flow_modify_flags_get(obj, &flags);
+    of_flow_modify_idle_timeout_get(obj, &idle_timeout);
+    of_flow_modify_hard_timeout_get(obj, &hard_timeout);
+    if (ver >= OF_VERSION_1_4) {
+        of_flow_add_importance_get(obj, &importance);
+    }
 
-    if (++next_flow_id == 0)  next_flow_id = 1;
+    if (cookie != entry->cookie || flags != entry->flags ||
+        idle_timeout != entry->idle_timeout ||
+        hard_timeout != entry->hard_timeout ||
+        importance != entry->importance) {
+        return false;
+    }
 
-    return (result);
+    if (ver >= OF_VERSION_1_3 &&
+        (flags & OF_FLOW_MOD_FLAG_RESET_COUNTS_BY_VERSION(ver))) {
+        return false;
+    }
+
+    ind_core_ft->status.readds += 1;
+    ft_entry_restart(ind_core_ft, entry, INDIGO_CURRENT_TIME);
+
+    if (flow_add_effects_eq(obj, entry)) {
+        LOG_TRACE("Flow " INDIGO_FLOW_ID_PRINTF_FORMAT " re-added unchanged",
+                  INDIGO_FLOW_ID_PRINTF_ARG(entry->id));
+        return true;
+    }
+
+    LOG_TRACE("Flow " INDIGO_FLOW_ID_PRINTF_FORMAT " re-added with new "
+              "effects, modifying", INDIGO_FLOW_ID_PRINTF_ARG(entry->id));
+    flow_modify_one(entry, obj, cxn_id);
+    return true;
 }
 
 /**
@@ -328,6 +461,7 @@ ind_core_flow_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     indigo_flow_id_t  flow_id;
     uint16_t idle_timeout, hard_timeout;
     uint8_t table_id;
+    bool removed = false;
 
     ver = obj->version;
 
@@ -364,15 +498,23 @@ ind_core_flow_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
         goto done;
     }
 
-    /* Delete existing flow if any */
+    /* Update or delete existing flow if any */
     if (ft_strict_match(ind_core_ft, &query, &entry) == INDIGO_ERROR_NONE) {
-        ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_OVERWRITE);
+        if (flow_add_in_place(obj, entry, cxn_id)) {
+            goto done;
+        }
+        ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_OVERWRITE, _obj);
+        removed = true;
     }
 
     /* No match found, add as normal */
-    LOG_TRACE("Adding new flow");
+    INDIGO_BINLOG("Adding new flow");
 
-    flow_id = flow_id_next();
+    rv = ft_flow_id_alloc(ind_core_ft, &flow_id);
+    if (rv != INDIGO_ERROR_NONE) {
+        LOG_ERROR("Failed to allocate flow id: %s", indigo_strerror(rv));
+        goto done;
+    }
 
     rv = ft_add(ind_core_ft, flow_id, obj, &entry);
     if (rv != INDIGO_ERROR_NONE) {
@@ -381,28 +523,76 @@ ind_core_flow_add_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
         goto done;
     }
 
-    rv = indigo_fwd_flow_create(flow_id, (of_flow_add_t *)obj, &table_id);
+    rv = ind_core_flow_batch_create(flow_id, obj, cxn_id);
+    if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+        /* Forwarding only sets it if it chose another table */
+        table_id = entry->table_id;
+        rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_create, flow_id,
+                                  (of_flow_add_t *)obj, &table_id);
+        if (rv == INDIGO_ERROR_TABLE_FULL && flow_add_evict(obj, entry)) {
+            removed = true;
+            rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_create, flow_id,
+                                      (of_flow_add_t *)obj, &table_id);
+        }
+        if (rv == INDIGO_ERROR_PENDING) {
+            (void)ind_core_pending_add(IND_CORE_PENDING_FLOW_CREATE, flow_id,
+                                       _obj, cxn_id);
+        } else {
+            ind_core_flow_add_finish(rv, flow_id, table_id, obj, cxn_id);
+        }
+    } else if (rv != INDIGO_ERROR_NONE) {
+        ind_core_flow_add_finish(rv, flow_id, 0, obj, cxn_id);
+    }
+
+done:
+    /* Flow-removeds for replaced or evicted flows precede a barrier reply */
+    if (removed) {
+        ind_core_flow_removed_flush();
+    }
+    ind_core_flow_batch_release(_obj);
+}
+
+/**
+ * Complete a flow add once Forwarding has programmed it
+ * @param rv Result from Forwarding
+ * @param flow_id ID of the new flowtable entry
+ * @param table_id Table Forwarding inserted the flow into
+ * @param obj The flow_add request
+ * @param cxn_id Connection the request arrived on
+ */
+
+void
+ind_core_flow_add_finish(indigo_error_t rv, indigo_flow_id_t flow_id,
+                         uint8_t table_id, of_flow_modify_t *obj,
+                         indigo_cxn_id_t cxn_id)
+{
+    ft_entry_t *entry = ft_lookup(ind_core_ft, flow_id);
+    uint32_t xid;
+
     if (rv == INDIGO_ERROR_NONE) {
-        LOG_TRACE("Flow table now has %d entries",
-                  FT_STATUS(ind_core_ft)->current_count);
-        entry->table_id = table_id;
+        INDIGO_BINLOG("Flow table now has %d entries",
+                      FT_STATUS(ind_core_ft)->current_count);
+        if (entry != NULL) {
+            ft_entry_table_id_set(ind_core_ft, entry, table_id);
+            of_flow_modify_xid_get(obj, &xid);
+            ind_core_flow_monitor_update(entry, true, cxn_id, xid);
+            ind_core_flow_checkpoint_update(entry);
+        }
     } else { /* Error during insertion at forwarding layer */
-       uint32_t xid;
-
        LOG_ERROR("Error from Forwarding while inserting flow: %s",
                  indigo_strerror(rv));
        ind_core_ft->status.forwarding_add_errors += 1;
+       if (rv == INDIGO_ERROR_TABLE_FULL) {
+           ind_core_ft->status.table_full_errors += 1;
+       }
 
-       of_flow_add_xid_get(obj, &xid);
-       flow_mod_err_msg_send(rv, obj->version, cxn_id,
-                             (of_flow_modify_t *)obj);
+       flow_mod_err_msg_send(rv, obj->version, cxn_id, obj);
 
        /* Free entry in local flow table */
-       ft_delete(ind_core_ft, entry);
+       if (entry != NULL) {
+           ft_delete(ind_core_ft, entry);
+       }
     }
-
-done:
-    of_object_delete(_obj);
 }
 
 /**
@@ -515,6 +705,56 @@ struct flow_modify_state {
     int num_matched;
 };
 
+/**
+ * Complete a flow modify once Forwarding has programmed it
+ * @param rv Result from Forwarding
+ * @param flow_id ID of the modified flowtable entry
+ * @param obj The flow_modify request
+ * @param cxn_id Connection the request arrived on
+ */
+
+void
+ind_core_flow_modify_finish(indigo_error_t rv, indigo_flow_id_t flow_id,
+                            of_flow_modify_t *obj, indigo_cxn_id_t cxn_id)
+{
+    ft_entry_t *entry;
+    uint32_t xid;
+
+    if (rv == INDIGO_ERROR_NONE) {
+        if ((entry = ft_lookup(ind_core_ft, flow_id)) != NULL) {
+            ft_entry_modify_effects(ind_core_ft, entry, obj);
+            of_flow_modify_xid_get(obj, &xid);
+            ind_core_flow_monitor_update(entry, false, cxn_id, xid);
+            ind_core_flow_checkpoint_update(entry);
+        }
+    } else {
+        LOG_ERROR("Error from Forwarding while modifying flow: %s",
+                  indigo_strerror(rv));
+        flow_mod_err_msg_send(rv, obj->version, cxn_id, obj);
+    }
+}
+
+/* Modify one entry, batched if Forwarding supports it */
+static void
+flow_modify_one(ft_entry_t *entry, of_flow_modify_t *obj,
+                indigo_cxn_id_t cxn_id)
+{
+    indigo_error_t rv;
+
+    rv = ind_core_flow_batch_modify(entry->id, obj, cxn_id);
+    if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+        rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_modify, entry->id, obj);
+        if (rv == INDIGO_ERROR_PENDING) {
+            (void)ind_core_pending_add(IND_CORE_PENDING_FLOW_MODIFY, entry->id,
+                                       obj, cxn_id);
+        } else {
+            ind_core_flow_modify_finish(rv, entry->id, obj, cxn_id);
+        }
+    } else if (rv != INDIGO_ERROR_NONE) {
+        ind_core_flow_modify_finish(rv, entry->id, obj, cxn_id);
+    }
+}
+
 /* Flowtable iterator for ind_core_flow_modify_handler */
 static void
 modify_iter_cb(void *cookie, ft_entry_t *entry)
@@ -522,25 +762,16 @@ modify_iter_cb(void *cookie, ft_entry_t *entry)
     struct flow_modify_state *state = cookie;
 
     if (entry != NULL) {
-        indigo_error_t rv;
         state->num_matched++;
-        rv = indigo_fwd_flow_modify(entry->id, state->request);
-        if (rv == INDIGO_ERROR_NONE) {
-            ft_entry_modify_effects(ind_core_ft, entry, state->request);
-        } else {
-            LOG_ERROR("Error from Forwarding while modifying flow: %d",
-                      indigo_strerror(rv));
-            flow_mod_err_msg_send(rv, state->request->version,
-                                  state->cxn_id, state->request);
-        }
+        flow_modify_one(entry, state->request, state->cxn_id);
     } else {
         if (state->num_matched == 0) {
-            LOG_TRACE("No entries to modify, treat as add");
+            INDIGO_BINLOG("No entries to modify, treat as add");
             /* OpenFlow 1.0.0, section 4.6, page 14.  Treat as an add */
             ind_core_flow_add_handler(state->request, state->cxn_id);
         } else {
-            LOG_TRACE("Finished flow modify task");
-            of_object_delete(state->request);
+            INDIGO_BINLOG("Finished flow modify task");
+            ind_core_flow_batch_release(state->request);
         }
         INDIGO_MEM_FREE(state);
     }
@@ -612,23 +843,16 @@ ind_core_flow_modify_strict_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
 
     rv = ft_strict_match(ind_core_ft, &query, &entry);
     if (rv == INDIGO_ERROR_NOT_FOUND) {
-        LOG_TRACE("No entries to modify strict, treat as add.");
+        INDIGO_BINLOG("No entries to modify strict, treat as add.");
         /* OpenFlow 1.0.0, section 4.6, page 14.  Treat as an add */
         ind_core_flow_add_handler(_obj, cxn_id);
         return;
     }
 
-    rv = indigo_fwd_flow_modify(entry->id, obj);
-    if (rv == INDIGO_ERROR_NONE) {
-        ft_entry_modify_effects(ind_core_ft, entry, obj);
-    } else {
-        LOG_ERROR("Error from Forwarding while modifying flow: %d",
-                  indigo_strerror(rv));
-        flow_mod_err_msg_send(rv, obj->version, cxn_id, obj);
-    }
+    flow_modify_one(entry, obj, cxn_id);
 
  done:
-    of_object_delete(obj);
+    ind_core_flow_batch_release(obj);
 }
 
 /****************************************************************/
@@ -640,10 +864,12 @@ delete_iter_cb(void *cookie, ft_entry_t *entry)
     struct flow_modify_state *state = cookie;
 
     if (entry != NULL) {
-        ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_DELETE);
+        ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_DELETE,
+                                   state->request);
     } else {
-        LOG_TRACE("Finished flow delete task");
-        of_object_delete(state->request);
+        INDIGO_BINLOG("Finished flow delete task");
+        ind_core_flow_removed_flush();
+        ind_core_pending_release(state->request);
         INDIGO_MEM_FREE(state);
     }
 }
@@ -715,10 +941,11 @@ ind_core_flow_delete_strict_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     }
 
     if (ft_strict_match(ind_core_ft, &query, &entry) == INDIGO_ERROR_NONE) {
-        ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_DELETE);
+        ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_DELETE, _obj);
     }
 
-    of_object_delete(_obj);
+    ind_core_flow_removed_flush();
+    ind_core_pending_release(_obj);
 }
 
 
@@ -765,55 +992,277 @@ struct ind_core_flow_stats_state {
     of_flow_stats_request_t *req;
     indigo_time_t current_time;
     of_flow_stats_reply_t *reply;
+    bool delta;                 /* Only flows changed since delta_since */
+    indigo_time_t delta_since;
+    bool page_more;             /* Paginated and the page was full */
+    /* Matching flows whose stats have not been read yet */
+    int num_flows;
+    indigo_cookie_t flow_ids[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    indigo_fi_flow_stats_t flow_stats[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    indigo_error_t results[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    /* Set if the replies are encoded by the flow stats workers */
+    ind_core_flow_stats_job_t *job;
+    ind_soc_task_t task;
+    ft_iterator_t iter;
 };
 
+/*
+ * Get the stats of the queued flows. Flows with fresh cached counters are
+ * answered from the cache; the rest are read from Forwarding in one call.
+ */
 static void
-ind_core_flow_stats_iter(void *cookie, ft_entry_t *entry)
+flow_stats_bulk_get(int num_flows, indigo_cookie_t *flow_ids,
+                    indigo_fi_flow_stats_t *flow_stats,
+                    indigo_error_t *results)
 {
-    struct ind_core_flow_stats_state *state = cookie;
-    uint32_t secs, nsecs;
-    indigo_fi_flow_stats_t flow_stats;
-    indigo_error_t rv;
+    static indigo_cookie_t read_ids[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    static indigo_fi_flow_stats_t read_stats[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    static indigo_error_t read_results[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    static int read_idx[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    int num_read = 0;
+    int i;
+
+    for (i = 0; i < num_flows; i++) {
+        ft_entry_t *entry = ft_lookup(ind_core_ft, flow_ids[i]);
+        if (entry != NULL &&
+            ind_core_counter_cache_get(entry, &flow_stats[i])) {
+            results[i] = INDIGO_ERROR_NONE;
+        } else {
+            read_ids[num_read] = flow_ids[i];
+            read_idx[num_read] = i;
+            num_read++;
+        }
+    }
+
+    if (num_read == 0) {
+        return;
+    }
+
+    ind_core_flow_batch_flush();
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_flow_stats_bulk_get,
+                              read_ids, num_read, read_stats, read_results);
+
+    for (i = 0; i < num_read; i++) {
+        flow_stats[read_idx[i]] = read_stats[i];
+        results[read_idx[i]] = read_results[i];
+        if (read_results[i] != INDIGO_ERROR_NONE) {
+            LOG_ERROR("Failed to get stats for flow "INDIGO_FLOW_ID_PRINTF_FORMAT": %s",
+                      read_ids[i], indigo_strerror(read_results[i]));
+        }
+    }
+}
+
+/* Allocate a reply if we don't already have one. */
+static indigo_error_t
+flow_stats_reply_alloc(struct ind_core_flow_stats_state *state)
+{
+    uint32_t xid;
+
+    if (state->reply != NULL) {
+        return INDIGO_ERROR_NONE;
+    }
 
-    /* Allocate a reply if we don't already have one. */
+    state->reply = of_flow_stats_reply_new(state->req->version);
     if (state->reply == NULL) {
-        uint32_t xid;
+        LOG_ERROR("Failed to allocate of_flow_stats_reply.");
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    of_flow_stats_request_xid_get(state->req, &xid);
+    of_flow_stats_reply_xid_set(state->reply, xid);
+    of_flow_stats_reply_flags_set(state->reply, 1);
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_core_flow_stats_snapshot_take(ft_entry_t *entry,
+                                  indigo_fi_flow_stats_t *flow_stats,
+                                  ind_core_flow_stats_snapshot_t *snap)
+{
+    snap->cookie = entry->cookie;
+    snap->priority = entry->priority;
+    snap->idle_timeout = entry->idle_timeout;
+    snap->hard_timeout = entry->hard_timeout;
+    snap->flags = entry->flags;
+    snap->table_id = entry->table_id;
+    snap->insert_time = entry->insert_time;
+    ft_entry_match_get(entry, &snap->match);
+    snap->effects = entry->effects.actions;
+    snap->stats = *flow_stats;
+}
+
+/*
+ * Encode the fields of a flow stats entry that only change with the flow
+ */
+static indigo_error_t
+flow_stats_entry_encode(of_flow_stats_entry_t *stats_entry,
+                        const ind_core_flow_stats_snapshot_t *snap)
+{
+    of_flow_stats_entry_cookie_set(stats_entry, snap->cookie);
+    of_flow_stats_entry_priority_set(stats_entry, snap->priority);
+    of_flow_stats_entry_idle_timeout_set(stats_entry, snap->idle_timeout);
+    of_flow_stats_entry_hard_timeout_set(stats_entry, snap->hard_timeout);
 
-        state->reply = of_flow_stats_reply_new(state->req->version);
-        if (state->reply == NULL) {
-            LOG_ERROR("Failed to allocate of_flow_stats_reply.");
-            if (entry == NULL) {
-                /* This is the last callback, so need to clean up
-                 * before returning. */
-                of_flow_stats_request_delete(state->req);
-                INDIGO_MEM_FREE(state);
+    if (stats_entry->version >= OF_VERSION_1_3) {
+        of_flow_stats_entry_flags_set(stats_entry, snap->flags);
+    }
+
+    if (of_flow_stats_entry_match_set(stats_entry,
+                                      (of_match_t *)&snap->match)) {
+        LOG_ERROR("Failed to set match in flow stats entry");
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    if (stats_entry->version == snap->effects->version) {
+        if (stats_entry->version == OF_VERSION_1_0) {
+            if (of_flow_stats_entry_actions_set(
+                    stats_entry, snap->effects) < 0) {
+                LOG_ERROR("Failed to set actions list of flow stats entry");
+                return INDIGO_ERROR_UNKNOWN;
+            }
+        } else {
+            if (of_flow_stats_entry_instructions_set(
+                    stats_entry, snap->effects) < 0) {
+                LOG_ERROR("Failed to set instructions list of flow stats entry");
+                return INDIGO_ERROR_UNKNOWN;
             }
-            return;
         }
+    }
+
+    return INDIGO_ERROR_NONE;
+}
 
-        of_flow_stats_request_xid_get(state->req, &xid);
-        of_flow_stats_reply_xid_set(state->reply, xid);
-        of_flow_stats_reply_flags_set(state->reply, 1);
+/*
+ * Patch the fields that change between polls: table, duration and counters
+ */
+static void
+flow_stats_entry_counters_set(of_flow_stats_entry_t *stats_entry,
+                              uint8_t table_id, indigo_time_t insert_time,
+                              const indigo_fi_flow_stats_t *stats,
+                              indigo_time_t current_time)
+{
+    uint32_t secs, nsecs;
+
+    /* TODO use time from flow_stats? */
+    calc_duration(current_time, insert_time, &secs, &nsecs);
+
+    of_flow_stats_entry_table_id_set(stats_entry, table_id);
+    of_flow_stats_entry_duration_sec_set(stats_entry, secs);
+    of_flow_stats_entry_duration_nsec_set(stats_entry, nsecs);
+    of_flow_stats_entry_packet_count_set(stats_entry, stats->packets);
+    of_flow_stats_entry_byte_count_set(stats_entry, stats->bytes);
+}
+
+indigo_error_t
+ind_core_flow_stats_snapshot_append(of_flow_stats_reply_t *reply,
+                                    const ind_core_flow_stats_snapshot_t *snap,
+                                    indigo_time_t current_time)
+{
+    of_list_flow_stats_entry_t list;
+    of_flow_stats_entry_t stats_entry;
+    indigo_error_t rv;
+
+    /* Set up the structures to append an entry to the list */
+    of_flow_stats_reply_entries_bind(reply, &list);
+    of_flow_stats_entry_init(&stats_entry, reply->version, -1, 1);
+    if (of_list_flow_stats_entry_append_bind(&list, &stats_entry)) {
+        LOG_ERROR("failed to append to flow stats list");
+        return INDIGO_ERROR_RESOURCE;
     }
 
-    if (entry == NULL) {
-        /* Send last reply */
-        of_flow_stats_reply_flags_set(state->reply, 0);
-        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+    if ((rv = flow_stats_entry_encode(&stats_entry, snap)) < 0) {
+        return rv;
+    }
 
-        /* Clean up state */
-        of_flow_stats_request_delete(state->req);
-        INDIGO_MEM_FREE(state);
-        return;
+    flow_stats_entry_counters_set(&stats_entry, snap->table_id,
+                                  snap->insert_time, &snap->stats,
+                                  current_time);
+
+    return INDIGO_ERROR_NONE;
+}
+
+/*
+ * Return the entry's cached flow stats encoding, building it if needed
+ *
+ * The caller patches in the table, duration and counters before copying
+ * it into a reply.
+ */
+static of_flow_stats_entry_t *
+flow_stats_entry_cache_get(ft_entry_t *entry)
+{
+    ind_core_flow_stats_snapshot_t snap;
+    of_flow_stats_entry_t *stats_entry;
+    indigo_fi_flow_stats_t no_stats = { 0 };
+
+    if (entry->stats_cache != NULL) {
+        return entry->stats_cache;
     }
 
-    rv = indigo_fwd_flow_stats_get(entry->id, &flow_stats);
-    if (rv != INDIGO_ERROR_NONE) {
-        LOG_ERROR("Failed to get stats for flow "INDIGO_FLOW_ID_PRINTF_FORMAT": %s",
-                  entry->id, indigo_strerror(rv));
-        return;
+    stats_entry = of_flow_stats_entry_new(entry->effects.actions->version);
+    if (stats_entry == NULL) {
+        LOG_ERROR("Failed to allocate flow stats entry");
+        return NULL;
     }
 
+    ind_core_flow_stats_snapshot_take(entry, &no_stats, &snap);
+    if (flow_stats_entry_encode(stats_entry, &snap) < 0) {
+        of_object_delete(stats_entry);
+        return NULL;
+    }
+
+    entry->stats_cache = stats_entry;
+    return stats_entry;
+}
+
+/**
+ * Append a flowtable entry to a flow stats reply
+ * @param reply The reply, of the same version as the entry
+ * @param entry The flowtable entry
+ * @param flow_stats Counters to report
+ * @param current_time Time to compute the duration from
+ *
+ * Copies the entry's cached encoding, so only the first reply after an
+ * add or modify encodes the match and effects.
+ */
+
+indigo_error_t
+ind_core_flow_stats_entry_append(of_flow_stats_reply_t *reply,
+                                 ft_entry_t *entry,
+                                 indigo_fi_flow_stats_t *flow_stats,
+                                 indigo_time_t current_time)
+{
+    of_list_flow_stats_entry_t list;
+    of_flow_stats_entry_t *stats_entry;
+
+    /* The cache is only kept in the entry's version */
+    if (reply->version != entry->effects.actions->version) {
+        ind_core_flow_stats_snapshot_t snap;
+        ind_core_flow_stats_snapshot_take(entry, flow_stats, &snap);
+        return ind_core_flow_stats_snapshot_append(reply, &snap, current_time);
+    }
+
+    if ((stats_entry = flow_stats_entry_cache_get(entry)) == NULL) {
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    flow_stats_entry_counters_set(stats_entry, entry->table_id,
+                                  entry->insert_time, flow_stats,
+                                  current_time);
+
+    of_flow_stats_reply_entries_bind(reply, &list);
+    if (of_list_append(&list, stats_entry) < 0) {
+        LOG_ERROR("failed to append to flow stats list");
+        return INDIGO_ERROR_RESOURCE;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+flow_stats_entry_append(struct ind_core_flow_stats_state *state,
+                        ft_entry_t *entry, indigo_fi_flow_stats_t *flow_stats)
+{
     /* Skip entry if stats request version is not equal to entry version */
     if (state->req->version != entry->effects.actions->version) {
         LOG_TRACE("Stats request version (%d) differs from entry version (%d). "
@@ -822,61 +1271,206 @@ ind_core_flow_stats_iter(void *cookie, ft_entry_t *entry)
         return;
     }
 
-    /* TODO use time from flow_stats? */
-    calc_duration(state->current_time, entry->insert_time, &secs, &nsecs);
+    if (state->job != NULL) {
+        (void) ind_core_flow_stats_job_add(state->job, entry, flow_stats);
+        return;
+    }
 
-    /* Set up the structures to append an entry to the list */
-    {
-        of_list_flow_stats_entry_t list;
-        of_flow_stats_entry_t stats_entry;
-        of_flow_stats_reply_entries_bind(state->reply, &list);
-        of_flow_stats_entry_init(&stats_entry, state->reply->version, -1, 1);
-        if (of_list_flow_stats_entry_append_bind(&list, &stats_entry)) {
-            LOG_ERROR("failed to append to flow stats list");
-            return;
+    if (flow_stats_reply_alloc(state) < 0) {
+        return;
+    }
+
+    if (ind_core_flow_stats_entry_append(state->reply, entry, flow_stats,
+                                         state->current_time) < 0) {
+        return;
+    }
+
+    if (state->reply->length > (1 << 15)) { /* Last object would get too big */
+        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+        state->reply = NULL;
+    }
+}
+
+/*
+ * Append the queued flows to the reply
+ *
+ * Flows are looked up again by ID, since the iterator may have yielded
+ * and let them be deleted since they were queued.
+ */
+static void
+flow_stats_flush(struct ind_core_flow_stats_state *state)
+{
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+    int i;
+
+    if (state->num_flows == 0) {
+        return;
+    }
+
+    flow_stats_bulk_get(state->num_flows, state->flow_ids, state->flow_stats,
+                        state->results);
+
+    for (i = 0; i < state->num_flows; i++) {
+        ft_entry_t *entry;
+        if (state->results[i] != INDIGO_ERROR_NONE) {
+            continue;
+        }
+        if ((entry = ft_lookup(ind_core_ft, state->flow_ids[i])) == NULL) {
+            continue;
         }
+        ind_core_delta_stats_observe(entry, &state->flow_stats[i], now);
+        if (state->delta && entry->last_counter_change < state->delta_since) {
+            continue;
+        }
+        flow_stats_entry_append(state, entry, &state->flow_stats[i]);
+    }
+
+    state->num_flows = 0;
 
-        of_flow_stats_entry_cookie_set(&stats_entry, entry->cookie);
-        of_flow_stats_entry_priority_set(&stats_entry, entry->priority);
-        of_flow_stats_entry_idle_timeout_set(&stats_entry, entry->idle_timeout);
-        of_flow_stats_entry_hard_timeout_set(&stats_entry, entry->hard_timeout);
+    if (state->job != NULL) {
+        ind_core_flow_stats_job_submit(state->job, false);
+    }
+}
+
+static void
+ind_core_flow_stats_iter(void *cookie, ft_entry_t *entry)
+{
+    struct ind_core_flow_stats_state *state = cookie;
 
-        if (stats_entry.version >= OF_VERSION_1_3) {
-            of_flow_stats_entry_flags_set(&stats_entry, entry->flags);
+    if (entry != NULL) {
+        state->flow_ids[state->num_flows++] = entry->id;
+        if (state->num_flows == OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX) {
+            flow_stats_flush(state);
         }
+        return;
+    }
 
-        if (of_flow_stats_entry_match_set(&stats_entry, &entry->match)) {
-            LOG_ERROR("Failed to set match in flow stats entry");
-            return;
+    flow_stats_flush(state);
+
+    if (state->job != NULL) {
+        /* The job sends the last reply and deletes the request */
+        ind_core_flow_stats_job_submit(state->job, true);
+        INDIGO_MEM_FREE(state);
+        return;
+    }
+
+    /* Send last reply */
+    if (flow_stats_reply_alloc(state) == INDIGO_ERROR_NONE) {
+        of_flow_stats_reply_flags_set(state->reply, state->page_more ?
+            INDIGO_CORE_FLOW_STATS_REPLY_BSN_PAGE_MORE : 0);
+        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
+    }
+
+    /* Clean up state */
+    of_flow_stats_request_delete(state->req);
+    INDIGO_MEM_FREE(state);
+}
+
+/*
+ * Iteration task used when the replies are encoded by the workers. Like
+ * ft_spawn_cxn_iter_task, but also waits while the job's encoded replies
+ * have not yet been sent, since the connection's output queue does not
+ * fill up until they are.
+ */
+
+static ind_soc_task_status_t flow_stats_offload_task(void *cookie);
+
+static void
+flow_stats_offload_finish(struct ind_core_flow_stats_state *state)
+{
+    ft_iterator_cleanup(&state->iter);
+    ind_core_flow_stats_iter(state, NULL);
+}
+
+static void
+flow_stats_offload_resume(void *cookie)
+{
+    struct ind_core_flow_stats_state *state = cookie;
+
+    if (ind_soc_task_start(&state->task, flow_stats_offload_task, state,
+                           IND_SOC_DEFAULT_PRIORITY) < 0) {
+        /* Should not happen; the same start succeeded before */
+        LOG_ERROR("Failed to resume flow stats task");
+        flow_stats_offload_finish(state);
+    }
+}
+
+/* Returns true if the task was suspended until the replies drain */
+static bool
+flow_stats_offload_suspend(struct ind_core_flow_stats_state *state)
+{
+    if (indigo_cxn_output_blocked(state->cxn_id) &&
+        indigo_cxn_output_wait(state->cxn_id, flow_stats_offload_resume,
+                               state) == INDIGO_ERROR_NONE) {
+        return true;
+    }
+
+    return ind_core_flow_stats_job_wait(state->job, flow_stats_offload_resume,
+                                        state);
+}
+
+static ind_soc_task_status_t
+flow_stats_offload_task(void *cookie)
+{
+    struct ind_core_flow_stats_state *state = cookie;
+    ft_entry_t *entry;
+
+    do {
+        if (flow_stats_offload_suspend(state)) {
+            return IND_SOC_TASK_FINISHED;
         }
 
-        if (stats_entry.version == entry->effects.actions->version) {
-            if (stats_entry.version == OF_VERSION_1_0) {
-                if (of_flow_stats_entry_actions_set(
-                        &stats_entry, entry->effects.actions) < 0) {
-                    LOG_ERROR("Failed to set actions list of flow stats entry");
-                    return;
-                }
-            } else {
-                if (of_flow_stats_entry_instructions_set(
-                        &stats_entry, entry->effects.instructions) < 0) {
-                    LOG_ERROR("Failed to set instructions list of flow stats entry");
-                    return;
-                }
-            }
+        if ((entry = ft_iterator_next(&state->iter)) == NULL) {
+            flow_stats_offload_finish(state);
+            return IND_SOC_TASK_FINISHED;
         }
+        ind_core_flow_stats_iter(state, entry);
+    } while (!ind_soc_should_yield());
 
-        of_flow_stats_entry_table_id_set(&stats_entry, entry->table_id);
-        of_flow_stats_entry_duration_sec_set(&stats_entry, secs);
-        of_flow_stats_entry_duration_nsec_set(&stats_entry, nsecs);
-        of_flow_stats_entry_packet_count_set(&stats_entry, flow_stats.packets);
-        of_flow_stats_entry_byte_count_set(&stats_entry, flow_stats.bytes);
+    return IND_SOC_TASK_CONTINUE;
+}
+
+/*
+ * Answer a paginated request with the next page of the connection's walk
+ *
+ * The page is bounded, so it is read and sent without yielding.
+ */
+static void
+flow_stats_page(struct ind_core_flow_stats_state *state,
+                of_meta_match_t *query, uint16_t flags)
+{
+    uint32_t shift = (flags & INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_SHIFT_MASK) >>
+        INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_SHIFT_SHIFT;
+    uint32_t page_size = shift ? (uint32_t)1 << shift :
+        OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE;
+    ft_iterator_t *iter;
+    ft_entry_t *entry;
+    uint32_t count = 0;
+
+    iter = ind_core_flow_stats_page_cursor(
+        state->cxn_id, query,
+        (flags & INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_RESTART) != 0);
+    if (iter == NULL) {
+        indigo_cxn_send_error_reply(state->cxn_id, state->req,
+                                    OF_ERROR_TYPE_BAD_REQUEST,
+                                    OF_REQUEST_FAILED_EPERM);
+        of_object_delete(state->req);
+        INDIGO_MEM_FREE(state);
+        return;
     }
 
-    if (state->reply->length > (1 << 15)) { /* Last object would get too big */
-        indigo_cxn_send_controller_message(state->cxn_id, state->reply);
-        state->reply = NULL;
+    while (count < page_size && (entry = ft_iterator_next(iter)) != NULL) {
+        ind_core_flow_stats_iter(state, entry);
+        count++;
     }
+
+    state->page_more = count == page_size;
+    if (!state->page_more) {
+        ind_core_flow_stats_page_done(state->cxn_id);
+    }
+
+    /* Sends the last reply and frees the state */
+    ind_core_flow_stats_iter(state, NULL);
 }
 
 /**
@@ -893,6 +1487,7 @@ ind_core_flow_stats_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     of_meta_match_t query;
     struct ind_core_flow_stats_state *state;
     indigo_error_t rv;
+    uint16_t flags;
 
     /* Set up the query structure */
     INDIGO_MEM_SET(&query, 0, sizeof(query));
@@ -906,6 +1501,8 @@ ind_core_flow_stats_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     if (obj->version >= OF_VERSION_1_1) {
         of_flow_stats_request_cookie_get(obj, &query.cookie);
         of_flow_stats_request_cookie_mask_get(obj, &query.cookie_mask);
+        of_flow_stats_request_out_group_get(obj, &query.out_group);
+        query.check_out_group = query.out_group != OF_GROUP_ANY;
     }
 
     /* Non strict; do not check priority or overlap */
@@ -922,9 +1519,50 @@ ind_core_flow_stats_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     state->cxn_id = cxn_id;
     state->current_time = INDIGO_CURRENT_TIME;
     state->reply = NULL;
+    state->num_flows = 0;
+    state->delta = false;
+    state->delta_since = 0;
+    state->page_more = false;
+    state->job = NULL;
+
+    of_flow_stats_request_flags_get(obj, &flags);
+    if (flags & INDIGO_CORE_FLOW_STATS_REQ_BSN_DELTA) {
+        if (ind_core_delta_stats_start(cxn_id, state->current_time,
+                                       &state->delta_since) < 0) {
+            indigo_cxn_send_error_reply(cxn_id, obj,
+                                        OF_ERROR_TYPE_BAD_REQUEST,
+                                        OF_REQUEST_FAILED_EPERM);
+            of_object_delete(_obj);
+            INDIGO_MEM_FREE(state);
+            return;
+        }
+        state->delta = true;
+    }
 
-    rv = ft_spawn_iter_task(ind_core_ft, &query, ind_core_flow_stats_iter,
-                            state, IND_SOC_DEFAULT_PRIORITY);
+    if (flags & INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE) {
+        flow_stats_page(state, &query, flags);
+        return;
+    }
+
+    if (ind_core_flow_stats_workers_enabled() &&
+        (state->job = ind_core_flow_stats_job_create(
+            cxn_id, obj, state->current_time)) == NULL) {
+        LOG_WARN("Failed to allocate flow stats job, encoding inline");
+    }
+
+    if (state->job != NULL) {
+        ft_iterator_init(&state->iter, ind_core_ft, &query);
+        rv = ind_soc_task_start(&state->task, flow_stats_offload_task, state,
+                                IND_SOC_DEFAULT_PRIORITY);
+        if (rv != INDIGO_ERROR_NONE) {
+            ft_iterator_cleanup(&state->iter);
+            ind_core_flow_stats_job_destroy(state->job);
+        }
+    } else {
+        rv = ft_spawn_cxn_iter_task(ind_core_ft, &query,
+                                    ind_core_flow_stats_iter,
+                                    state, IND_SOC_DEFAULT_PRIORITY, cxn_id);
+    }
     if (rv != INDIGO_ERROR_NONE) {
         LOG_ERROR("Failed to start flow stats iter: %s", indigo_strerror(rv));
         of_object_delete(_obj);
@@ -942,29 +1580,50 @@ struct ind_core_aggregate_stats_state {
     uint32_t flows;
     indigo_cxn_id_t cxn_id;
     of_aggregate_stats_request_t *req;
+    /* Matching flows whose stats have not been read yet */
+    int num_flows;
+    indigo_cookie_t flow_ids[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    indigo_fi_flow_stats_t flow_stats[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
+    indigo_error_t results[OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX];
 };
 
+static void
+aggregate_stats_flush(struct ind_core_aggregate_stats_state *state)
+{
+    int i;
+
+    if (state->num_flows == 0) {
+        return;
+    }
+
+    flow_stats_bulk_get(state->num_flows, state->flow_ids, state->flow_stats,
+                        state->results);
+
+    for (i = 0; i < state->num_flows; i++) {
+        if (state->results[i] == INDIGO_ERROR_NONE) {
+            state->bytes += state->flow_stats[i].bytes;
+            state->packets += state->flow_stats[i].packets;
+            state->flows += 1;
+        }
+    }
+
+    state->num_flows = 0;
+}
+
 static void
 ind_core_aggregate_stats_iter(void *cookie, ft_entry_t *entry)
 {
     struct ind_core_aggregate_stats_state *state = cookie;
-    indigo_error_t rv;
 
     if (entry != NULL) {
-        indigo_fi_flow_stats_t flow_stats;
-        rv = indigo_fwd_flow_stats_get(entry->id, &flow_stats);
-        if (rv != INDIGO_ERROR_NONE) {
-            LOG_ERROR("Failed to get stats for flow "INDIGO_FLOW_ID_PRINTF_FORMAT": %s",
-                      entry->id, indigo_strerror(rv));
-            return;
+        state->flow_ids[state->num_flows++] = entry->id;
+        if (state->num_flows == OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX) {
+            aggregate_stats_flush(state);
         }
-
-        state->bytes += flow_stats.bytes;
-        state->packets += flow_stats.packets;
-        state->flows += 1;
     } else {
         uint32_t xid;
         of_aggregate_stats_reply_t* reply;
+        aggregate_stats_flush(state);
         of_aggregate_stats_request_xid_get(state->req, &xid);
         reply = of_aggregate_stats_reply_new(state->req->version);
         if (reply != NULL) {
@@ -1009,6 +1668,8 @@ ind_core_aggregate_stats_request_handler(of_object_t *_obj,
     if (obj->version >= OF_VERSION_1_1) {
         of_aggregate_stats_request_cookie_get(obj, &query.cookie);
         of_aggregate_stats_request_cookie_mask_get(obj, &query.cookie_mask);
+        of_aggregate_stats_request_out_group_get(obj, &query.out_group);
+        query.check_out_group = query.out_group != OF_GROUP_ANY;
     }
 
     /* Non strict; do not check priority or overlap */
@@ -1026,6 +1687,7 @@ ind_core_aggregate_stats_request_handler(of_object_t *_obj,
     state->packets = 0;
     state->bytes = 0;
     state->flows = 0;
+    state->num_flows = 0;
 
     rv = ft_spawn_iter_task(ind_core_ft, &query, ind_core_aggregate_stats_iter,
                             state, IND_SOC_DEFAULT_PRIORITY);
@@ -1095,7 +1757,8 @@ ind_core_table_stats_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     of_table_stats_request_t *reply = NULL;
     indigo_error_t rv;
 
-    rv = indigo_fwd_table_stats_get(obj, &reply);
+    ind_core_flow_batch_flush();
+    rv = ind_core_table_stats_get(obj, &reply);
     if (rv < 0) {
         reply = NULL;
         LOG_ERROR("Table stats failed: %s", indigo_strerror(rv));
@@ -1112,6 +1775,193 @@ done:
 
 /****************************************************************/
 
+/**
+ * Handle a table_mod message
+ * @param cxn_id Connection handler for the owning connection
+ * @param _obj Generic type object for the message to be coerced
+ *
+ * Only the OpenFlow 1.4 eviction config bit is supported. Eviction orders
+ * flows by importance, then lifetime, then recent hits.
+ */
+
+void
+ind_core_table_mod_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
+{
+    of_table_mod_t *obj = _obj;
+    uint8_t table_id;
+    uint32_t config;
+    uint32_t flags = 0;
+    int i;
+
+    if (obj->version < OF_VERSION_1_4) {
+        ind_core_unhandled_message(_obj, cxn_id);
+        return;
+    }
+
+    of_table_mod_table_id_get(obj, &table_id);
+    of_table_mod_config_get(obj, &config);
+
+    if (config & OF_TABLE_CONFIG_EVICTION) {
+        flags = INDIGO_CORE_EVICTION_IMPORTANCE |
+            INDIGO_CORE_EVICTION_LIFETIME | INDIGO_CORE_EVICTION_OTHER;
+    }
+
+    if (table_id == TABLE_ID_ANY) {
+        for (i = 0; i < FT_TABLES; i++) {
+            (void)indigo_core_table_eviction_set(i, flags);
+        }
+    } else {
+        (void)indigo_core_table_eviction_set(table_id, flags);
+    }
+
+    of_table_mod_delete(obj);
+}
+
+/****************************************************************/
+
+/*
+ * Flow checksums
+ *
+ * See ft_table_checksum_t. These mirror the gentable checksum requests:
+ * the controller reads the per-table checksums, then the buckets of any
+ * table that differs, then dumps only the flows whose cookies fall in
+ * the differing buckets.
+ */
+
+/**
+ * Handle a bsn_table_checksum_stats_request message
+ * @param cxn_id Connection handler for the owning connection
+ * @param obj The request
+ *
+ * Replies with the checksum of every table that has flows.
+ */
+
+void
+ind_core_bsn_table_checksum_stats_request_handler(of_object_t *obj,
+                                                  indigo_cxn_id_t cxn_id)
+{
+    of_bsn_table_checksum_stats_reply_t *reply;
+    of_list_bsn_table_checksum_stats_entry_t entries;
+    of_bsn_table_checksum_stats_entry_t entry;
+    uint32_t xid;
+    int table_id;
+
+    of_bsn_table_checksum_stats_request_xid_get(obj, &xid);
+
+    if ((reply = of_bsn_table_checksum_stats_reply_new(obj->version)) == NULL) {
+        LOG_ERROR("Failed to create table checksum stats reply");
+        of_object_delete(obj);
+        return;
+    }
+    of_bsn_table_checksum_stats_reply_xid_set(reply, xid);
+    of_bsn_table_checksum_stats_reply_entries_bind(reply, &entries);
+
+    for (table_id = 0; table_id < FT_TABLES; table_id++) {
+        if (ind_core_ft->status.table_counts[table_id] == 0) {
+            continue;
+        }
+
+        of_bsn_table_checksum_stats_entry_init(&entry, reply->version, -1, 1);
+        if (of_list_bsn_table_checksum_stats_entry_append_bind(&entries, &entry)) {
+            /* At most FT_TABLES small entries always fit */
+            AIM_DIE("unexpected failure appending to a table checksum stats list");
+        }
+        of_bsn_table_checksum_stats_entry_table_id_set(&entry, table_id);
+        of_bsn_table_checksum_stats_entry_checksum_set(
+            &entry, ind_core_ft->checksums[table_id].checksum);
+    }
+
+    indigo_cxn_send_controller_message(cxn_id, reply);
+
+    of_object_delete(obj);
+}
+
+/**
+ * Handle a bsn_flow_checksum_bucket_stats_request message
+ * @param cxn_id Connection handler for the owning connection
+ * @param obj The request
+ *
+ * Replies with the checksum of each bucket of the requested table.
+ */
+
+void
+ind_core_bsn_flow_checksum_bucket_stats_request_handler(of_object_t *obj,
+                                                        indigo_cxn_id_t cxn_id)
+{
+    of_bsn_flow_checksum_bucket_stats_reply_t *reply;
+    of_list_bsn_flow_checksum_bucket_stats_entry_t entries;
+    of_bsn_flow_checksum_bucket_stats_entry_t entry;
+    ft_table_checksum_t *table;
+    uint32_t xid;
+    uint8_t table_id;
+    uint32_t i;
+
+    of_bsn_flow_checksum_bucket_stats_request_xid_get(obj, &xid);
+    of_bsn_flow_checksum_bucket_stats_request_table_id_get(obj, &table_id);
+
+    table = &ind_core_ft->checksums[table_id];
+
+    reply = of_bsn_flow_checksum_bucket_stats_reply_new(obj->version);
+    of_bsn_flow_checksum_bucket_stats_reply_xid_set(reply, xid);
+    of_bsn_flow_checksum_bucket_stats_reply_entries_bind(reply, &entries);
+
+    for (i = 0; i < table->buckets_size; i++) {
+        of_bsn_flow_checksum_bucket_stats_entry_init(&entry, reply->version, -1, 1);
+        if (of_list_bsn_flow_checksum_bucket_stats_entry_append_bind(&entries, &entry)) {
+            of_bsn_flow_checksum_bucket_stats_reply_flags_set(
+                reply, OF_STATS_REPLY_FLAG_REPLY_MORE);
+            indigo_cxn_send_controller_message(cxn_id, reply);
+
+            reply = of_bsn_flow_checksum_bucket_stats_reply_new(obj->version);
+            of_bsn_flow_checksum_bucket_stats_reply_xid_set(reply, xid);
+            of_bsn_flow_checksum_bucket_stats_reply_entries_bind(reply, &entries);
+
+            if (of_list_bsn_flow_checksum_bucket_stats_entry_append_bind(&entries, &entry)) {
+                AIM_DIE("unexpected failure appending to an empty bucket stats list");
+            }
+        }
+
+        of_bsn_flow_checksum_bucket_stats_entry_checksum_set(
+            &entry, table->buckets[i]);
+    }
+
+    indigo_cxn_send_controller_message(cxn_id, reply);
+
+    of_object_delete(obj);
+}
+
+/**
+ * Handle a bsn_table_set_buckets_size message
+ * @param cxn_id Connection handler for the owning connection
+ * @param obj The request
+ */
+
+void
+ind_core_bsn_table_set_buckets_size_handler(of_object_t *obj,
+                                            indigo_cxn_id_t cxn_id)
+{
+    uint8_t table_id;
+    uint32_t buckets_size;
+    indigo_error_t rv;
+
+    of_bsn_table_set_buckets_size_table_id_get(obj, &table_id);
+    of_bsn_table_set_buckets_size_buckets_size_get(obj, &buckets_size);
+
+    rv = ft_checksum_buckets_size_set(ind_core_ft, table_id, buckets_size);
+    if (rv < 0) {
+        LOG_ERROR("Failed to set %u checksum buckets for table %u: %s",
+                  buckets_size, table_id, indigo_strerror(rv));
+        indigo_cxn_send_error_reply(
+            cxn_id, obj,
+            OF_ERROR_TYPE_BAD_REQUEST,
+            OF_REQUEST_FAILED_EPERM);
+    }
+
+    of_object_delete(obj);
+}
+
+/****************************************************************/
+
 /**
  * Handle a port_desc_stats_request message
  * @param cxn_id Connection handler for the owning connection
@@ -1135,7 +1985,7 @@ ind_core_port_desc_stats_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_
 
     of_port_desc_stats_request_xid_get(obj, &xid);
     of_port_desc_stats_reply_xid_set(reply, xid);
-    indigo_port_desc_stats_get(reply);
+    (void)IND_CORE_DRIVER_CALL(indigo_port_desc_stats_get, reply);
 
     of_port_desc_stats_request_delete(obj);
 
@@ -1171,8 +2021,9 @@ ind_core_features_request_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     _TRY_NR(indigo_core_dpid_get(&dpid));
     of_features_reply_datapath_id_set(reply, dpid);
     of_features_reply_n_buffers_set(reply, 0);
-    _TRY_NR(indigo_fwd_forwarding_features_get(reply));
-    _TRY_NR(indigo_port_features_get(reply));
+    _TRY_NR(IND_CORE_DRIVER_CALL(indigo_fwd_forwarding_features_get,
+                                 reply));
+    _TRY_NR(IND_CORE_DRIVER_CALL(indigo_port_features_get, reply));
 
     of_features_request_delete(obj);
 
@@ -1253,10 +2104,12 @@ ind_core_experimenter_handler(of_object_t *_obj, indigo_cxn_id_t cxn_id)
     }
 
     /* Handle object of type of_experimenter_t */
-    if ((fwd_rv = indigo_fwd_experimenter(fwd_obj, cxn_id)) < 0) {
+    if ((fwd_rv = IND_CORE_DRIVER_CALL(indigo_fwd_experimenter,
+                                       fwd_obj, cxn_id)) < 0) {
         LOG_TRACE("Error from fwd_experimenter: %s", indigo_strerror(fwd_rv));
     }
-    if ((port_rv = indigo_port_experimenter(port_obj, cxn_id)) < 0) {
+    if ((port_rv = IND_CORE_DRIVER_CALL(indigo_port_experimenter,
+                                        port_obj, cxn_id)) < 0) {
         LOG_TRACE("Error from port_experimenter: %s", indigo_strerror(port_rv));
     }
 
@@ -1423,7 +2276,7 @@ ind_core_bsn_sw_pipeline_get_request_handler(of_object_t *_obj,
     of_bsn_get_switch_pipeline_request_xid_get(obj, &xid);
     of_bsn_get_switch_pipeline_request_delete(obj);
 
-    indigo_fwd_pipeline_get(pipeline);
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_pipeline_get, pipeline);
 
     of_bsn_get_switch_pipeline_reply_xid_set(reply, xid);
     of_bsn_get_switch_pipeline_reply_pipeline_set(reply, pipeline);
@@ -1459,7 +2312,8 @@ ind_core_bsn_sw_pipeline_set_request_handler(of_object_t *_obj,
     of_bsn_set_switch_pipeline_request_delete(obj);
 
     LOG_INFO("Setting pipeline: %s", pipeline);
-    if ((rv = indigo_fwd_pipeline_set(pipeline)) != INDIGO_ERROR_NONE) {
+    if ((rv = IND_CORE_DRIVER_CALL(indigo_fwd_pipeline_set, pipeline)) !=
+        INDIGO_ERROR_NONE) {
         LOG_ERROR("Failed to set pipeline: %s", indigo_strerror(rv));
         of_bsn_set_switch_pipeline_reply_status_set(reply, 1);
     } else {
@@ -1502,7 +2356,7 @@ ind_core_bsn_sw_pipeline_stats_request_handler(of_object_t *_obj,
 
     of_bsn_switch_pipeline_stats_reply_xid_set(reply, xid);
 
-    indigo_fwd_pipeline_stats_get(&pipelines, &num_pipelines);
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_pipeline_stats_get, &pipelines, &num_pipelines);
     of_list_bsn_switch_pipeline_stats_entry_t list;
     of_bsn_switch_pipeline_stats_reply_entries_bind(reply, &list);
     for (i = 0; i < num_pipelines; i++) {
@@ -54,6 +54,17 @@ extern void ind_core_queue_stats_request_handler(
 extern void ind_core_flow_add_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn);
+extern void ind_core_flow_add_finish(
+    indigo_error_t rv,
+    indigo_flow_id_t flow_id,
+    uint8_t table_id,
+    of_flow_modify_t *obj,
+    indigo_cxn_id_t cxn);
+extern void ind_core_flow_modify_finish(
+    indigo_error_t rv,
+    indigo_flow_id_t flow_id,
+    of_flow_modify_t *obj,
+    indigo_cxn_id_t cxn);
 extern void ind_core_flow_modify_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn);
@@ -81,6 +92,18 @@ extern void ind_core_desc_stats_request_handler(
 extern void ind_core_table_stats_request_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn);
+extern void ind_core_table_mod_handler(
+    of_object_t *_obj,
+    indigo_cxn_id_t cxn);
+extern void ind_core_bsn_table_checksum_stats_request_handler(
+    of_object_t *obj,
+    indigo_cxn_id_t cxn_id);
+extern void ind_core_bsn_flow_checksum_bucket_stats_request_handler(
+    of_object_t *obj,
+    indigo_cxn_id_t cxn_id);
+extern void ind_core_bsn_table_set_buckets_size_handler(
+    of_object_t *obj,
+    indigo_cxn_id_t cxn_id);
 extern void ind_core_port_desc_stats_request_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn_id);
@@ -125,6 +148,18 @@ void ind_core_group_add_handler(
 void ind_core_group_modify_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn_id);
+void ind_core_group_add_finish(
+    indigo_error_t result,
+    uint32_t id,
+    of_object_t *request,
+    indigo_cxn_id_t cxn_id);
+void ind_core_group_modify_finish(
+    indigo_error_t result,
+    uint32_t id,
+    of_object_t *request,
+    indigo_cxn_id_t cxn_id,
+    void *cookie);
+bool ind_core_group_exists(uint32_t id);
 void ind_core_group_delete_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn_id);
@@ -146,7 +181,13 @@ void ind_core_bsn_port_counter_stats_request_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn_id);
 
+/* driver_stats.c */
+void ind_core_bsn_generic_stats_request_handler(
+    of_object_t *_obj,
+    indigo_cxn_id_t cxn_id);
+
 /* gentable_handlers.c */
+indigo_error_t ind_core_gentable_enable_set(int enable);
 void ind_core_bsn_gentable_entry_add_handler(
     of_object_t *_obj,
     indigo_cxn_id_t cxn_id);
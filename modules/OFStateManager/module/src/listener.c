@@ -26,20 +26,96 @@
 #include <OFStateManager/ofstatemanager.h>
 #include <indigo/indigo.h>
 #include <BigList/biglist.h>
+#include <AIM/aim_memory.h>
 
 #include "ofstatemanager_log.h"
 #include "listener.h"
 
 static biglist_t *packet_in_listeners;
 static biglist_t *port_status_listeners;
+static biglist_t *port_status_batch_listeners;
 static biglist_t *message_listeners;
 
 /* Packet in */
 
+/*
+ * Filtered packet-in listeners
+ *
+ * Listeners filtering on eth_type are kept in a bucket chosen by the
+ * ethertype; the rest are on one list. Each packet-in only walks its
+ * ethertype's bucket and that list.
+ */
+
+#define PACKET_IN_ETH_TYPE_BUCKETS 64
+
+struct packet_in_listener {
+    indigo_core_packet_in_listener_f fn;
+    indigo_core_packet_in_filter_t filter;
+};
+
+static biglist_t *packet_in_eth_type_buckets[PACKET_IN_ETH_TYPE_BUCKETS];
+static biglist_t *packet_in_filtered_listeners;
+static int num_filtered_packet_in_listeners;
+
+static biglist_t **
+packet_in_listener_list(const indigo_core_packet_in_filter_t *filter)
+{
+    if (filter->fields & INDIGO_CORE_PACKET_IN_FILTER_ETH_TYPE) {
+        return &packet_in_eth_type_buckets[filter->eth_type % PACKET_IN_ETH_TYPE_BUCKETS];
+    } else {
+        return &packet_in_filtered_listeners;
+    }
+}
+
+static struct packet_in_listener *
+packet_in_listener_find(biglist_t *list, indigo_core_packet_in_listener_f fn)
+{
+    biglist_t *cur;
+    struct packet_in_listener *listener;
+
+    BIGLIST_FOREACH_DATA(cur, list, struct packet_in_listener *, listener) {
+        if (listener->fn == fn) {
+            return listener;
+        }
+    }
+
+    return NULL;
+}
+
+/* Find a filtered listener and the list it is on */
+static struct packet_in_listener *
+packet_in_filtered_listener_find(indigo_core_packet_in_listener_f fn,
+                                 biglist_t ***list)
+{
+    struct packet_in_listener *listener;
+    int i;
+
+    if (num_filtered_packet_in_listeners == 0) {
+        return NULL;
+    }
+
+    if ((listener = packet_in_listener_find(packet_in_filtered_listeners, fn))) {
+        *list = &packet_in_filtered_listeners;
+        return listener;
+    }
+
+    for (i = 0; i < PACKET_IN_ETH_TYPE_BUCKETS; i++) {
+        if ((listener = packet_in_listener_find(packet_in_eth_type_buckets[i], fn))) {
+            *list = &packet_in_eth_type_buckets[i];
+            return listener;
+        }
+    }
+
+    return NULL;
+}
+
 indigo_error_t
 indigo_core_packet_in_listener_register(indigo_core_packet_in_listener_f fn)
 {
-    if (biglist_find(packet_in_listeners, fn)) {
+    biglist_t **list;
+
+    if (biglist_find(packet_in_listeners, fn) ||
+        packet_in_filtered_listener_find(fn, &list)) {
         return INDIGO_ERROR_EXISTS;
     }
 
@@ -48,23 +124,166 @@ indigo_core_packet_in_listener_register(indigo_core_packet_in_listener_f fn)
     return INDIGO_ERROR_NONE;
 }
 
+indigo_error_t
+indigo_core_packet_in_listener_register_filtered(
+    indigo_core_packet_in_listener_f fn,
+    const indigo_core_packet_in_filter_t *filter)
+{
+    struct packet_in_listener *listener;
+    biglist_t **list;
+
+    if (filter == NULL || filter->fields == 0) {
+        return indigo_core_packet_in_listener_register(fn);
+    }
+
+    if (biglist_find(packet_in_listeners, fn) ||
+        packet_in_filtered_listener_find(fn, &list)) {
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    listener = aim_zmalloc(sizeof(*listener));
+    listener->fn = fn;
+    listener->filter = *filter;
+
+    list = packet_in_listener_list(filter);
+    *list = biglist_append(*list, listener);
+    num_filtered_packet_in_listeners++;
+
+    return INDIGO_ERROR_NONE;
+}
+
 void
 indigo_core_packet_in_listener_unregister(indigo_core_packet_in_listener_f fn)
 {
+    struct packet_in_listener *listener;
+    biglist_t **list;
+
+    if ((listener = packet_in_filtered_listener_find(fn, &list))) {
+        *list = biglist_remove(*list, listener);
+        num_filtered_packet_in_listeners--;
+        aim_free(listener);
+        return;
+    }
+
     packet_in_listeners = biglist_remove(packet_in_listeners, fn);
 }
 
+/* Fields of a packet-in that filters can match */
+struct packet_in_key {
+    bool has_eth_type;
+    uint16_t eth_type;
+    uint8_t reason;
+    bool has_table_id;
+    uint8_t table_id;
+    of_port_no_t in_port;
+};
+
+static void
+packet_in_key_get(of_packet_in_t *packet_in, struct packet_in_key *key)
+{
+    of_octets_t data;
+    of_match_t match;
+    int offset = 12;
+
+    INDIGO_MEM_SET(key, 0, sizeof(*key));
+
+    of_packet_in_data_get(packet_in, &data);
+    while (data.bytes >= offset + 2) {
+        key->eth_type = (data.data[offset] << 8) | data.data[offset + 1];
+        key->has_eth_type = true;
+        if (key->eth_type != 0x8100 && key->eth_type != 0x88a8) {
+            break;
+        }
+        /* Skip the VLAN tag */
+        key->has_eth_type = false;
+        offset += 4;
+    }
+
+    of_packet_in_reason_get(packet_in, &key->reason);
+
+    key->in_port = OF_PORT_DEST_NONE;
+    if (packet_in->version == OF_VERSION_1_0) {
+        of_packet_in_in_port_get(packet_in, &key->in_port);
+    } else {
+        of_packet_in_table_id_get(packet_in, &key->table_id);
+        key->has_table_id = true;
+        if (of_packet_in_match_get(packet_in, &match) == 0) {
+            key->in_port = match.fields.in_port;
+        }
+    }
+}
+
+static bool
+packet_in_filter_match(const indigo_core_packet_in_filter_t *filter,
+                       const struct packet_in_key *key)
+{
+    if ((filter->fields & INDIGO_CORE_PACKET_IN_FILTER_ETH_TYPE) &&
+            (!key->has_eth_type || filter->eth_type != key->eth_type)) {
+        return false;
+    }
+
+    if ((filter->fields & INDIGO_CORE_PACKET_IN_FILTER_REASON) &&
+            filter->reason != key->reason) {
+        return false;
+    }
+
+    if ((filter->fields & INDIGO_CORE_PACKET_IN_FILTER_IN_PORT) &&
+            filter->in_port != key->in_port) {
+        return false;
+    }
+
+    if ((filter->fields & INDIGO_CORE_PACKET_IN_FILTER_TABLE_ID) &&
+            (!key->has_table_id || filter->table_id != key->table_id)) {
+        return false;
+    }
+
+    return true;
+}
+
+static indigo_core_listener_result_t
+packet_in_filtered_notify(biglist_t *list, of_packet_in_t *packet_in,
+                          const struct packet_in_key *key)
+{
+    indigo_core_listener_result_t result = INDIGO_CORE_LISTENER_RESULT_PASS;
+    biglist_t *cur;
+    struct packet_in_listener *listener;
+
+    BIGLIST_FOREACH_DATA(cur, list, struct packet_in_listener *, listener) {
+        if (packet_in_filter_match(&listener->filter, key)) {
+            result |= listener->fn(packet_in);
+        }
+    }
+
+    return result;
+}
+
 indigo_core_listener_result_t
 ind_core_packet_in_notify(of_packet_in_t *packet_in)
 {
     indigo_core_listener_result_t result = INDIGO_CORE_LISTENER_RESULT_PASS;
     biglist_t *cur;
     indigo_core_packet_in_listener_f fn;
+    struct packet_in_key key;
 
     BIGLIST_FOREACH_DATA(cur, packet_in_listeners, indigo_core_packet_in_listener_f, fn) {
         result |= fn(packet_in);
     }
 
+    if (num_filtered_packet_in_listeners == 0) {
+        return result;
+    }
+
+    packet_in_key_get(packet_in, &key);
+
+    if (key.has_eth_type) {
+        result |= packet_in_filtered_notify(
+            packet_in_eth_type_buckets[key.eth_type % PACKET_IN_ETH_TYPE_BUCKETS],
+            packet_in, &key);
+    }
+
+    result |= packet_in_filtered_notify(packet_in_filtered_listeners,
+                                        packet_in, &key);
+
     return result;
 }
 
@@ -102,6 +321,36 @@ ind_core_port_status_notify(of_port_status_t *port_status)
     return result;
 }
 
+indigo_error_t
+indigo_core_port_status_batch_listener_register(indigo_core_port_status_batch_listener_f fn)
+{
+    if (biglist_find(port_status_batch_listeners, fn)) {
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    port_status_batch_listeners = biglist_append(port_status_batch_listeners, fn);
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_core_port_status_batch_listener_unregister(indigo_core_port_status_batch_listener_f fn)
+{
+    port_status_batch_listeners = biglist_remove(port_status_batch_listeners, fn);
+}
+
+void
+ind_core_port_status_batch_notify(of_port_status_t **port_statuses,
+                                  int num_port_statuses)
+{
+    biglist_t *cur;
+    indigo_core_port_status_batch_listener_f fn;
+
+    BIGLIST_FOREACH_DATA(cur, port_status_batch_listeners, indigo_core_port_status_batch_listener_f, fn) {
+        fn(port_statuses, num_port_statuses);
+    }
+}
+
 /* Message from controller */
 
 indigo_error_t
@@ -135,3 +384,52 @@ ind_core_message_notify(indigo_cxn_id_t cxn_id, of_object_t *message)
 
     return result;
 }
+
+/* Message from controller, by message type */
+
+static biglist_t *message_type_listeners[OF_MESSAGE_OBJECT_COUNT];
+
+indigo_error_t
+indigo_core_message_type_listener_register(of_object_id_t object_id,
+                                           indigo_core_message_listener_f fn)
+{
+    if (object_id < 0 || object_id >= OF_MESSAGE_OBJECT_COUNT) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (biglist_find(message_type_listeners[object_id], fn)) {
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    message_type_listeners[object_id] =
+        biglist_append(message_type_listeners[object_id], fn);
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_core_message_type_listener_unregister(of_object_id_t object_id,
+                                             indigo_core_message_listener_f fn)
+{
+    if (object_id < 0 || object_id >= OF_MESSAGE_OBJECT_COUNT) {
+        return;
+    }
+
+    message_type_listeners[object_id] =
+        biglist_remove(message_type_listeners[object_id], fn);
+}
+
+indigo_core_listener_result_t
+ind_core_message_type_notify(indigo_cxn_id_t cxn_id, of_object_t *message)
+{
+    indigo_core_listener_result_t result = INDIGO_CORE_LISTENER_RESULT_PASS;
+    biglist_t *cur;
+    indigo_core_message_listener_f fn;
+
+    BIGLIST_FOREACH_DATA(cur, message_type_listeners[message->object_id],
+                         indigo_core_message_listener_f, fn) {
+        result |= fn(cxn_id, message);
+    }
+
+    return result;
+}
@@ -32,7 +32,9 @@
 /* Notify functions for each class of listener */
 indigo_core_listener_result_t ind_core_packet_in_notify(of_packet_in_t *packet_in);
 indigo_core_listener_result_t ind_core_port_status_notify(of_port_status_t *port_status);
+void ind_core_port_status_batch_notify(of_port_status_t **port_statuses, int num_port_statuses);
 indigo_core_listener_result_t ind_core_message_notify(indigo_cxn_id_t cxn_id, of_object_t *message);
+indigo_core_listener_result_t ind_core_message_type_notify(indigo_cxn_id_t cxn_id, of_object_t *message);
 
 #endif /* _OFSTATEMANAGER_LISTENER_H_ */
 
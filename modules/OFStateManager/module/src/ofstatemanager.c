@@ -41,6 +41,20 @@
 #include "ft.h"
 #include "expiration.h"
 #include "listener.h"
+#include "bundle.h"
+#include "counter_cache.h"
+#include "delta_stats.h"
+#include "flow_stats_page.h"
+#include "flow_monitor.h"
+#include "flow_batch.h"
+#include "packet_out_batch.h"
+#include "pending.h"
+#include "port_stats.h"
+#include "port_status.h"
+#include "driver_stats.h"
+#include "flow_stats_worker.h"
+#include "flow_checkpoint.h"
+#include <inttypes.h>
 
 static void
 process_flow_removal(ft_entry_t *entry,
@@ -121,6 +135,45 @@ indigo_core_packet_in(of_packet_in_t *packet_in)
     return INDIGO_ERROR_NONE;
 }
 
+indigo_error_t
+indigo_core_packet_in_batch(of_packet_in_t **packet_ins, int num_packet_ins)
+{
+    of_object_t *msgs[INDIGO_CORE_PACKET_IN_BATCH_MAX];
+    int num_msgs = 0;
+    int i;
+
+    if (!ind_core_module_enabled) {
+        LOG_TRACE("Packet in called when not enabled");
+        for (i = 0; i < num_packet_ins; i++) {
+            of_object_delete(packet_ins[i]);
+        }
+        return INDIGO_ERROR_INIT;
+    }
+
+    LOG_TRACE("Packet in batch of %d rcvd", num_packet_ins);
+    ind_core_packet_ins += num_packet_ins;
+
+    for (i = 0; i < num_packet_ins; i++) {
+        if (ind_core_packet_in_notify(packet_ins[i]) == INDIGO_CORE_LISTENER_RESULT_DROP) {
+            LOG_TRACE("Listener dropped packet-in");
+            of_object_delete(packet_ins[i]);
+            continue;
+        }
+
+        msgs[num_msgs++] = packet_ins[i];
+        if (num_msgs == INDIGO_CORE_PACKET_IN_BATCH_MAX) {
+            indigo_cxn_send_async_messages(msgs, num_msgs);
+            num_msgs = 0;
+        }
+    }
+
+    if (num_msgs > 0) {
+        indigo_cxn_send_async_messages(msgs, num_msgs);
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
 
 /****************************************************************/
 
@@ -129,28 +182,72 @@ indigo_core_packet_in(of_packet_in_t *packet_in)
  * @param entry The local flow table entry
  */
 
+/*
+ * Flow-removed messages are coalesced and sent as one run, so a burst of
+ * removals takes a single slot in each connection's async queue.
+ */
+static of_flow_removed_t *flow_removed_msgs[OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX];
+static int num_flow_removed_msgs;
+
+/**
+ * Send any queued flow-removed messages
+ *
+ * Called at the end of each event loop pass, and before a flow-mod
+ * delete, or a flow-add that replaced or evicted flows, is released so
+ * its flow-removeds precede a following barrier reply.
+ */
+
+void
+ind_core_flow_removed_flush(void)
+{
+    if (num_flow_removed_msgs > 0) {
+        indigo_cxn_send_async_messages(flow_removed_msgs,
+                                       num_flow_removed_msgs);
+        num_flow_removed_msgs = 0;
+    }
+}
+
 static void
-send_flow_removed_message(ft_entry_t *entry,
-                          indigo_fi_flow_removed_t reason,
-                          indigo_fi_flow_stats_t *final_stats)
+flow_removed_queue(of_flow_removed_t *msg)
+{
+    flow_removed_msgs[num_flow_removed_msgs++] = msg;
+    if (num_flow_removed_msgs == OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX) {
+        ind_core_flow_removed_flush();
+    }
+}
+
+static void
+flow_removed_pass_end(void *cookie)
+{
+    ind_core_flow_removed_flush();
+}
+
+/**
+ * Build a flow removed message for an entry
+ * @param ver OpenFlow version of the message
+ * @param entry The removed entry
+ * @param reason Why it was removed
+ * @param final_stats Final stats, or NULL if unknown
+ * @returns The message, or NULL on failure
+ */
+
+of_flow_removed_t *
+ind_core_flow_removed_build(of_version_t ver, ft_entry_t *entry,
+                            indigo_fi_flow_removed_t reason,
+                            indigo_fi_flow_stats_t *final_stats)
 {
     of_flow_removed_t *msg;
     uint32_t secs;
     uint32_t nsecs;
     indigo_time_t current;
     uint64_t packets, bytes;
-    of_version_t ver;
+    of_match_t match;
 
     current = INDIGO_CURRENT_TIME;
 
-    if (indigo_cxn_get_async_version(&ver) < 0) {
-        /* No controllers connected */
-        return;
-    }
-
     if ((msg = of_flow_removed_new(ver)) == NULL) {
         LOG_ERROR("Failed to allocate flow_removed message");
-        return;
+        return NULL;
     }
 
     calc_duration(current, entry->insert_time, &secs, &nsecs);
@@ -167,17 +264,22 @@ send_flow_removed_message(ft_entry_t *entry,
         of_flow_removed_hard_timeout_set(msg, entry->hard_timeout);
     }
 
-    if (of_flow_removed_match_set(msg, &entry->match)) {
+    ft_entry_match_get(entry, &match);
+    if (of_flow_removed_match_set(msg, &match)) {
         LOG_ERROR("Failed to set match in flow removed message");
         of_object_delete(msg);
-        return;
+        return NULL;
     }
 
-    if (reason > INDIGO_FLOW_REMOVED_DELETE) {
-        /* Normalize entry */
-        reason = INDIGO_FLOW_REMOVED_DELETE;
+    if (reason == INDIGO_FLOW_REMOVED_EVICTION && ver >= OF_VERSION_1_4) {
+        of_flow_removed_reason_set(msg, OF_FLOW_REMOVED_REASON_EVICTION);
+    } else {
+        if (reason > INDIGO_FLOW_REMOVED_DELETE) {
+            /* Normalize entry */
+            reason = INDIGO_FLOW_REMOVED_DELETE;
+        }
+        of_flow_removed_reason_set(msg, reason);
     }
-    of_flow_removed_reason_set(msg, reason);
     of_flow_removed_duration_sec_set(msg, secs);
     of_flow_removed_duration_nsec_set(msg, nsecs);
 
@@ -192,12 +294,196 @@ send_flow_removed_message(ft_entry_t *entry,
     of_flow_removed_packet_count_set(msg, packets);
     of_flow_removed_byte_count_set(msg, bytes);
 
-    indigo_cxn_send_async_message(msg);
+    return msg;
+}
+
+static void
+send_flow_removed_message(ft_entry_t *entry,
+                          indigo_fi_flow_removed_t reason,
+                          indigo_fi_flow_stats_t *final_stats)
+{
+    of_flow_removed_t *msg;
+    of_version_t ver;
+
+    if (indigo_cxn_get_async_version(&ver) < 0) {
+        /* No controllers connected */
+        return;
+    }
+
+    msg = ind_core_flow_removed_build(ver, entry, reason, final_stats);
+    if (msg != NULL) {
+        flow_removed_queue(msg);
+    }
 }
 
 
 /****************************************************************/
 
+/****************************************************************/
+
+/* Messages OFConnectionManager should have handled itself */
+static void
+ind_core_cxn_message_handler(of_object_t *obj, indigo_cxn_id_t cxn)
+{
+    LOG_ERROR("Expected OFConnectionManager to handle %s",
+              of_object_id_str[obj->object_id]);
+    ind_core_unhandled_message(obj, cxn);
+}
+
+/*
+ * Default handlers, indexed by object id
+ *
+ * Messages without one (replies, and messages not yet implemented) are
+ * passed to ind_core_unhandled_message.
+ */
+static const indigo_core_message_handler_f
+ind_core_default_handlers[OF_MESSAGE_OBJECT_COUNT] = {
+    [OF_PACKET_OUT] = ind_core_packet_out_handler,
+    [OF_FLOW_ADD] = ind_core_flow_add_handler,
+    [OF_FLOW_MODIFY] = ind_core_flow_modify_handler,
+    [OF_FLOW_MODIFY_STRICT] = ind_core_flow_modify_strict_handler,
+    [OF_FLOW_DELETE] = ind_core_flow_delete_handler,
+    [OF_FLOW_DELETE_STRICT] = ind_core_flow_delete_strict_handler,
+    [OF_PORT_STATS_REQUEST] = ind_core_port_stats_request_handler,
+    [OF_GET_CONFIG_REQUEST] = ind_core_get_config_request_handler,
+    [OF_SET_CONFIG] = ind_core_set_config_handler,
+    [OF_FLOW_STATS_REQUEST] = ind_core_flow_stats_request_handler,
+    [OF_AGGREGATE_STATS_REQUEST] = ind_core_aggregate_stats_request_handler,
+    [OF_TABLE_STATS_REQUEST] = ind_core_table_stats_request_handler,
+    [OF_TABLE_MOD] = ind_core_table_mod_handler,
+    [OF_DESC_STATS_REQUEST] = ind_core_desc_stats_request_handler,
+    [OF_PORT_DESC_STATS_REQUEST] = ind_core_port_desc_stats_request_handler,
+    [OF_FEATURES_REQUEST] = ind_core_features_request_handler,
+    [OF_EXPERIMENTER] = ind_core_experimenter_handler,
+    [OF_PORT_MOD] = ind_core_port_mod_handler,
+    [OF_QUEUE_GET_CONFIG_REQUEST] = ind_core_queue_get_config_request_handler,
+    [OF_QUEUE_STATS_REQUEST] = ind_core_queue_stats_request_handler,
+
+    /* Group messages */
+    [OF_GROUP_ADD] = ind_core_group_add_handler,
+    [OF_GROUP_MODIFY] = ind_core_group_modify_handler,
+    [OF_GROUP_DELETE] = ind_core_group_delete_handler,
+    [OF_GROUP_STATS_REQUEST] = ind_core_group_stats_request_handler,
+    [OF_GROUP_DESC_STATS_REQUEST] = ind_core_group_desc_stats_request_handler,
+    [OF_GROUP_FEATURES_STATS_REQUEST] = ind_core_group_features_stats_request_handler,
+
+    /* Bundle messages */
+    [OF_BUNDLE_CTRL_MSG] = ind_core_bundle_ctrl_handler,
+    [OF_BUNDLE_ADD_MSG] = ind_core_bundle_add_handler,
+
+    /* Flow monitor messages */
+    [OF_FLOW_MONITOR_REQUEST] = ind_core_flow_monitor_request_handler,
+
+    /* Gentable messages */
+    [OF_BSN_GENTABLE_ENTRY_ADD] = ind_core_bsn_gentable_entry_add_handler,
+    [OF_BSN_GENTABLE_ENTRY_DELETE] = ind_core_bsn_gentable_entry_delete_handler,
+    [OF_BSN_GENTABLE_CLEAR_REQUEST] = ind_core_bsn_gentable_clear_request_handler,
+    [OF_BSN_GENTABLE_SET_BUCKETS_SIZE] = ind_core_bsn_gentable_set_buckets_size_handler,
+    [OF_BSN_GENTABLE_ENTRY_STATS_REQUEST] = ind_core_bsn_gentable_entry_stats_request_handler,
+    [OF_BSN_GENTABLE_ENTRY_DESC_STATS_REQUEST] = ind_core_bsn_gentable_entry_desc_stats_request_handler,
+    [OF_BSN_GENTABLE_DESC_STATS_REQUEST] = ind_core_bsn_gentable_desc_stats_request_handler,
+    [OF_BSN_GENTABLE_STATS_REQUEST] = ind_core_bsn_gentable_stats_request_handler,
+    [OF_BSN_GENTABLE_BUCKET_STATS_REQUEST] = ind_core_bsn_gentable_bucket_stats_request_handler,
+
+    /* Flow checksum messages */
+    [OF_BSN_TABLE_CHECKSUM_STATS_REQUEST] = ind_core_bsn_table_checksum_stats_request_handler,
+    [OF_BSN_FLOW_CHECKSUM_BUCKET_STATS_REQUEST] = ind_core_bsn_flow_checksum_bucket_stats_request_handler,
+    [OF_BSN_TABLE_SET_BUCKETS_SIZE] = ind_core_bsn_table_set_buckets_size_handler,
+
+    /* Extension messages */
+    [OF_BSN_SET_IP_MASK] = ind_core_bsn_set_ip_mask_handler,
+    [OF_BSN_GET_IP_MASK_REQUEST] = ind_core_bsn_get_ip_mask_request_handler,
+    [OF_BSN_HYBRID_GET_REQUEST] = ind_core_bsn_hybrid_get_request_handler,
+    [OF_BSN_GET_SWITCH_PIPELINE_REQUEST] = ind_core_bsn_sw_pipeline_get_request_handler,
+    [OF_BSN_SET_SWITCH_PIPELINE_REQUEST] = ind_core_bsn_sw_pipeline_set_request_handler,
+    [OF_BSN_SWITCH_PIPELINE_STATS_REQUEST] = ind_core_bsn_sw_pipeline_stats_request_handler,
+    [OF_BSN_VLAN_COUNTER_STATS_REQUEST] = ind_core_bsn_vlan_counter_stats_request_handler,
+    [OF_BSN_PORT_COUNTER_STATS_REQUEST] = ind_core_bsn_port_counter_stats_request_handler,
+    [OF_BSN_GENERIC_STATS_REQUEST] = ind_core_bsn_generic_stats_request_handler,
+
+    /* These all use the experimenter handler */
+    [OF_BSN_GET_MIRRORING_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_SET_MIRRORING] = ind_core_experimenter_handler,
+    [OF_BSN_SHELL_COMMAND] = ind_core_experimenter_handler,
+    [OF_BSN_GET_INTERFACES_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_SET_PKTIN_SUPPRESSION_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_SET_L2_TABLE_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_GET_L2_TABLE_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_VIRTUAL_PORT_CREATE_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_VIRTUAL_PORT_REMOVE_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_BW_CLEAR_DATA_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_BW_ENABLE_GET_REQUEST] = ind_core_experimenter_handler,
+    [OF_BSN_BW_ENABLE_SET_REQUEST] = ind_core_experimenter_handler,
+
+    /* These are implemented in OFConnectionManager */
+    [OF_HELLO] = ind_core_cxn_message_handler,
+    [OF_ECHO_REQUEST] = ind_core_cxn_message_handler,
+    [OF_ECHO_REPLY] = ind_core_cxn_message_handler,
+    [OF_BARRIER_REQUEST] = ind_core_cxn_message_handler,
+    [OF_NICIRA_CONTROLLER_ROLE_REQUEST] = ind_core_cxn_message_handler,
+};
+
+/* Handlers registered with indigo_core_message_handler_register */
+static indigo_core_message_handler_f
+ind_core_message_handlers[OF_MESSAGE_OBJECT_COUNT];
+
+/* Per message type counters and handler timing */
+static struct ind_core_message_stats {
+    uint64_t count;
+    ind_soc_histogram_t handler_us;
+} ind_core_message_stats[OF_MESSAGE_OBJECT_COUNT];
+
+indigo_error_t
+indigo_core_message_handler_register(of_object_id_t object_id,
+                                     indigo_core_message_handler_f fn)
+{
+    if (object_id < 0 || object_id >= OF_MESSAGE_OBJECT_COUNT || fn == NULL) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (ind_core_message_handlers[object_id] != NULL) {
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    ind_core_message_handlers[object_id] = fn;
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_core_message_handler_unregister(of_object_id_t object_id,
+                                       indigo_core_message_handler_f fn)
+{
+    if (object_id < 0 || object_id >= OF_MESSAGE_OBJECT_COUNT) {
+        return;
+    }
+
+    if (ind_core_message_handlers[object_id] == fn) {
+        ind_core_message_handlers[object_id] = NULL;
+    }
+}
+
+void
+ind_core_message_stats_show(aim_pvs_t *pvs)
+{
+    int i;
+
+    for (i = 0; i < OF_MESSAGE_OBJECT_COUNT; i++) {
+        struct ind_core_message_stats *stats = &ind_core_message_stats[i];
+        if (stats->count == 0) {
+            continue;
+        }
+        aim_printf(pvs, "%s: %"PRIu64"\n", of_object_id_str[i], stats->count);
+        ind_soc_histogram_show(pvs, "handler", &stats->handler_us);
+    }
+}
+
+void
+ind_core_message_stats_clear(void)
+{
+    INDIGO_MEM_SET(ind_core_message_stats, 0, sizeof(ind_core_message_stats));
+}
+
 /**
  * @brief Handle an OF message from the controller
  * @param cxn The connection id from which the request came
@@ -206,278 +492,73 @@ send_flow_removed_message(ft_entry_t *entry,
  * If a handler is called, the handler takes ownership of the LOXI object
  *
  * In any case, ownership of obj is NOT returned to the caller.
+ *
+ * General message listeners see every message, then the listeners for
+ * this message type. The message goes to a registered handler if there
+ * is one, otherwise to the default handler.
  */
 
 void
 indigo_core_receive_controller_message(indigo_cxn_id_t cxn, of_object_t *obj)
 {
+    of_object_id_t object_id = obj->object_id;
+    indigo_core_message_handler_f handler;
+    struct ind_core_message_stats *stats;
+    indigo_time_us_t start;
+
     if (!ind_core_module_enabled) {
         LOG_ERROR("Not enabled");
         return;
     }
 
     LOG_TRACE("Received %s message from cxn %d",
-              of_object_id_str[obj->object_id], cxn);
+              of_object_id_str[object_id], cxn);
 
-    if (ind_core_message_notify(cxn, obj) == INDIGO_CORE_LISTENER_RESULT_DROP) {
+    if (object_id < 0 || object_id >= OF_MESSAGE_OBJECT_COUNT) {
+        ind_core_unhandled_message(obj, cxn);
+        return;
+    }
+
+    if (ind_core_message_notify(cxn, obj) == INDIGO_CORE_LISTENER_RESULT_DROP ||
+        ind_core_message_type_notify(cxn, obj) == INDIGO_CORE_LISTENER_RESULT_DROP) {
         LOG_TRACE("Listener dropped message");
         of_object_delete(obj);
         return;
     }
 
-    /* Default handlers */
-    switch (obj->object_id) {
+    /* Queued packet-outs go first so the controller's ordering holds */
+    if (object_id != OF_PACKET_OUT) {
+        ind_core_packet_out_batch_flush();
+    }
 
+    switch (object_id) {
     case OF_PACKET_OUT:
         ind_core_packet_outs++;
-        ind_core_packet_out_handler(obj, cxn);
         break;
-
     case OF_FLOW_ADD:
-        ind_core_flow_mods++;
-        ind_core_flow_add_handler(obj, cxn);
-        break;
-
     case OF_FLOW_MODIFY:
-        ind_core_flow_mods++;
-        ind_core_flow_modify_handler(obj, cxn);
-        break;
-
     case OF_FLOW_MODIFY_STRICT:
-        ind_core_flow_mods++;
-        ind_core_flow_modify_strict_handler(obj, cxn);
-        break;
-
     case OF_FLOW_DELETE:
-        ind_core_flow_mods++;
-        ind_core_flow_delete_handler(obj, cxn);
-        break;
-
     case OF_FLOW_DELETE_STRICT:
         ind_core_flow_mods++;
-        ind_core_flow_delete_strict_handler(obj, cxn);
-        break;
-
-    case OF_PORT_STATS_REQUEST:
-        ind_core_port_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_GET_CONFIG_REQUEST:
-        ind_core_get_config_request_handler(obj, cxn);
-        break;
-
-    case OF_SET_CONFIG:
-        ind_core_set_config_handler(obj, cxn);
-        break;
-
-    case OF_FLOW_STATS_REQUEST:
-        ind_core_flow_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_AGGREGATE_STATS_REQUEST:
-        ind_core_aggregate_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_TABLE_STATS_REQUEST:
-        ind_core_table_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_DESC_STATS_REQUEST:
-        ind_core_desc_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_PORT_DESC_STATS_REQUEST:
-        ind_core_port_desc_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_FEATURES_REQUEST:
-        ind_core_features_request_handler(obj, cxn);
-        break;
-
-    case OF_EXPERIMENTER:
-        ind_core_experimenter_handler(obj, cxn);
-        break;
-
-    case OF_PORT_MOD:
-        ind_core_port_mod_handler(obj, cxn);
-        break;
-
-    case OF_QUEUE_GET_CONFIG_REQUEST:
-        ind_core_queue_get_config_request_handler(obj, cxn);
-        break;
-
-    case OF_QUEUE_STATS_REQUEST:
-        ind_core_queue_stats_request_handler(obj, cxn);
-        break;
-
-    /****************************************************************
-     * Group messages
-     ****************************************************************/
-
-    case OF_GROUP_ADD:
-        ind_core_group_add_handler(obj, cxn);
-        break;
-
-    case OF_GROUP_MODIFY:
-        ind_core_group_modify_handler(obj, cxn);
-        break;
-
-    case OF_GROUP_DELETE:
-        ind_core_group_delete_handler(obj, cxn);
         break;
-
-    case OF_GROUP_STATS_REQUEST:
-        ind_core_group_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_GROUP_DESC_STATS_REQUEST:
-        ind_core_group_desc_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_GROUP_FEATURES_STATS_REQUEST:
-        ind_core_group_features_stats_request_handler(obj, cxn);
-        break;
-
-    /****************************************************************
-     * Gentable messages
-     ****************************************************************/
-
-    case OF_BSN_GENTABLE_ENTRY_ADD:
-        ind_core_bsn_gentable_entry_add_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_ENTRY_DELETE:
-        ind_core_bsn_gentable_entry_delete_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_CLEAR_REQUEST:
-        ind_core_bsn_gentable_clear_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_SET_BUCKETS_SIZE:
-        ind_core_bsn_gentable_set_buckets_size_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_ENTRY_STATS_REQUEST:
-        ind_core_bsn_gentable_entry_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_ENTRY_DESC_STATS_REQUEST:
-        ind_core_bsn_gentable_entry_desc_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_DESC_STATS_REQUEST:
-        ind_core_bsn_gentable_desc_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_STATS_REQUEST:
-        ind_core_bsn_gentable_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GENTABLE_BUCKET_STATS_REQUEST:
-        ind_core_bsn_gentable_bucket_stats_request_handler(obj, cxn);
-        break;
-
-    /****************************************************************
-     * Extension messages
-     ****************************************************************/
-
-    case OF_BSN_SET_IP_MASK:
-        ind_core_bsn_set_ip_mask_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GET_IP_MASK_REQUEST:
-        ind_core_bsn_get_ip_mask_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_HYBRID_GET_REQUEST:
-        ind_core_bsn_hybrid_get_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_GET_SWITCH_PIPELINE_REQUEST:
-        ind_core_bsn_sw_pipeline_get_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_SET_SWITCH_PIPELINE_REQUEST:
-        ind_core_bsn_sw_pipeline_set_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_SWITCH_PIPELINE_STATS_REQUEST:
-        ind_core_bsn_sw_pipeline_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_VLAN_COUNTER_STATS_REQUEST:
-        ind_core_bsn_vlan_counter_stats_request_handler(obj, cxn);
-        break;
-
-    case OF_BSN_PORT_COUNTER_STATS_REQUEST:
-        ind_core_bsn_port_counter_stats_request_handler(obj, cxn);
-        break;
-
-    /* These all use the experimenter handler */
-    case OF_BSN_GET_MIRRORING_REQUEST:
-    case OF_BSN_SET_MIRRORING:
-    case OF_BSN_SHELL_COMMAND:
-    case OF_BSN_GET_INTERFACES_REQUEST:
-    case OF_BSN_SET_PKTIN_SUPPRESSION_REQUEST:
-    case OF_BSN_SET_L2_TABLE_REQUEST:
-    case OF_BSN_GET_L2_TABLE_REQUEST:
-    case OF_BSN_VIRTUAL_PORT_CREATE_REQUEST:
-    case OF_BSN_VIRTUAL_PORT_REMOVE_REQUEST:
-    case OF_BSN_BW_CLEAR_DATA_REQUEST:
-    case OF_BSN_BW_ENABLE_GET_REQUEST:
-    case OF_BSN_BW_ENABLE_SET_REQUEST:
-        ind_core_experimenter_handler(obj, cxn);
+    default:
         break;
+    }
 
-    /****************************************************************
-     * These are not yet implemented
-     ****************************************************************/
-    case OF_TABLE_MOD:
-    case OF_EXPERIMENTER_STATS_REQUEST:
-        ind_core_unhandled_message(obj, cxn);
-        break;
+    if ((handler = ind_core_message_handlers[object_id]) == NULL &&
+        (handler = ind_core_default_handlers[object_id]) == NULL) {
+        handler = ind_core_unhandled_message;
+    }
 
-    /****************************************************************
-     * These will never be handled by a switch
-     ****************************************************************/
-    case OF_AGGREGATE_STATS_REPLY:
-    case OF_BARRIER_REPLY:
-    case OF_DESC_STATS_REPLY:
-    case OF_ERROR_MSG:
-    case OF_EXPERIMENTER_STATS_REPLY:
-    case OF_FEATURES_REPLY:
-    case OF_FLOW_REMOVED:
-    case OF_FLOW_STATS_REPLY:
-    case OF_GET_CONFIG_REPLY:
-    case OF_GROUP_DESC_STATS_REPLY:
-    case OF_GROUP_FEATURES_STATS_REPLY:
-    case OF_GROUP_STATS_REPLY:
-    case OF_PACKET_IN:
-    case OF_PORT_STATS_REPLY:
-    case OF_PORT_STATUS:
-    case OF_QUEUE_GET_CONFIG_REPLY:
-    case OF_QUEUE_STATS_REPLY:
-    case OF_ROLE_REPLY:
-    case OF_TABLE_STATS_REPLY:
-        ind_core_unhandled_message(obj, cxn);
-        break;
+    stats = &ind_core_message_stats[object_id];
+    stats->count++;
+    start = INDIGO_CURRENT_TIME_us;
 
-    /* These are implemented in OFConnectionManager */
-    case OF_HELLO:
-    case OF_ECHO_REQUEST:
-    case OF_ECHO_REPLY:
-    case OF_BARRIER_REQUEST:
-    case OF_NICIRA_CONTROLLER_ROLE_REQUEST:
-        LOG_ERROR("Expected OFConnectionManager to handle %s",
-                  of_object_id_str[obj->object_id]);
-        ind_core_unhandled_message(obj, cxn);
-        break;
+    /* The handler owns obj now */
+    handler(obj, cxn);
 
-    default:
-        ind_core_unhandled_message(obj, cxn);
-        break;
-    }
+    ind_soc_histogram_add(&stats->handler_us, INDIGO_CURRENT_TIME_us - start);
 }
 
 static of_dpid_t ind_core_dpid = OFSTATEMANAGER_CONFIG_DPID_DEFAULT;
@@ -515,6 +596,7 @@ indigo_error_t
 ind_core_init(ind_core_config_t *config)
 {
     ft_config_t ft_config;
+    int i;
 
     INDIGO_MEM_COPY(&ind_core_config, config, sizeof(*config));
 
@@ -538,13 +620,31 @@ ind_core_init(ind_core_config_t *config)
     INIT_STR(ind_core_of_config.desc_stats.serial_num,
              IND_CORE_SERIAL_NUM_DEFAULT);
 
+    /* Before the flowtable allocates its first slab */
+    if (config->huge_pages) {
+        indigo_error_t rv;
+        if ((rv = indigo_mem_tag_huge_pages_set(
+                INDIGO_MEM_TAG_FLOW_ENTRY,
+                config->huge_pages_numa_node)) < 0 ||
+            (rv = indigo_mem_tag_huge_pages_set(
+                INDIGO_MEM_TAG_GENTABLE_ENTRY,
+                config->huge_pages_numa_node)) < 0) {
+            LOG_WARN("Unable to use huge pages for flow and gentable "
+                     "entries: %s", indigo_strerror(rv));
+        }
+    }
+
     /* Create flow table */
     if (config->max_flowtable_entries == 0) {
         /* Default value */
         config->max_flowtable_entries = 16384;
     }
+    INDIGO_MEM_SET(&ft_config, 0, sizeof(ft_config));
     ft_config.strict_match_bucket_count = config->max_flowtable_entries;
     ft_config.flow_id_bucket_count = config->max_flowtable_entries;
+    for (i = 0; i < IND_CORE_COOKIE_INDEXES_MAX && i < FT_COOKIE_INDEXES_MAX; i++) {
+        ft_config.cookie_index_masks[i] = config->cookie_index_masks[i];
+    }
 
     if ((ind_core_ft = ft_create(&ft_config)) == NULL) {
         LOG_ERROR("Unable to allocate flow table");
@@ -571,19 +671,36 @@ ind_core_init(ind_core_config_t *config)
  * Mark the entry deleted in the flow table.  If the entry is
  * stable (no op pending) then actually process the deletion here by
  * calling into forwarding.
+ *
+ * If forwarding completes the delete asynchronously, request (which may
+ * be NULL) is held until it does.
  */
 
 void
-ind_core_flow_entry_delete(ft_entry_t *entry, indigo_fi_flow_removed_t reason)
+ind_core_flow_entry_delete(ft_entry_t *entry, indigo_fi_flow_removed_t reason,
+                           of_object_t *request)
 {
     indigo_error_t rv;
     indigo_fi_flow_stats_t flow_stats;
+    ind_core_pending_t *op;
 
     LOG_TRACE("Removing flow " INDIGO_FLOW_ID_PRINTF_FORMAT,
               INDIGO_FLOW_ID_PRINTF_ARG(entry->id));
 
-    rv = indigo_fwd_flow_delete(entry->id, &flow_stats);
-    if (rv != INDIGO_ERROR_NONE) {
+    /* Forwarding must have seen any queued changes to this flow */
+    ind_core_flow_batch_flush();
+
+    rv = IND_CORE_DRIVER_CALL(indigo_fwd_flow_delete, entry->id, &flow_stats);
+    if (rv == INDIGO_ERROR_PENDING) {
+        /* Out of the table now; flow removed is sent on completion */
+        ft_detach(ind_core_ft, entry);
+        ind_core_flow_checkpoint_delete(entry);
+        op = ind_core_pending_add(IND_CORE_PENDING_FLOW_DELETE, entry->id,
+                                  request, INDIGO_CXN_ID_UNSPECIFIED);
+        op->cookie = entry;
+        op->reason = reason;
+        return;
+    } else if (rv != INDIGO_ERROR_NONE) {
         LOG_ERROR("Error deleting flow " INDIGO_FLOW_ID_PRINTF_FORMAT ": %s",
                   INDIGO_FLOW_ID_PRINTF_ARG(entry->id), indigo_strerror(rv));
         /* Ignoring failure */
@@ -593,13 +710,17 @@ ind_core_flow_entry_delete(ft_entry_t *entry, indigo_fi_flow_removed_t reason)
 }
 
 /**
- * @brief Process a flow removal from the local flow table
+ * @brief Complete a flow delete that Forwarding returned
+ * INDIGO_ERROR_PENDING for
+ * @param entry The entry, already detached from the flow table
+ * @param reason Reason passed to ind_core_flow_entry_delete
+ * @param final_stats Final stats, or NULL if unknown
  */
 
-static void
-process_flow_removal(ft_entry_t *entry,
-                     indigo_fi_flow_stats_t *final_stats,
-                     indigo_fi_flow_removed_t reason)
+void
+ind_core_flow_delete_finish(ft_entry_t *entry,
+                            indigo_fi_flow_removed_t reason,
+                            indigo_fi_flow_stats_t *final_stats)
 {
     if (entry->flags & OF_FLOW_MOD_FLAG_SEND_FLOW_REM) {
         /* See OF spec 1.0.1, section 3.5, page 6 */
@@ -608,7 +729,23 @@ process_flow_removal(ft_entry_t *entry,
         }
     }
 
-    ft_delete(ind_core_ft, entry);
+    ind_core_flow_monitor_removed(entry, reason, final_stats);
+
+    ft_detached_free(ind_core_ft, entry);
+}
+
+/**
+ * @brief Process a flow removal from the local flow table
+ */
+
+static void
+process_flow_removal(ft_entry_t *entry,
+                     indigo_fi_flow_stats_t *final_stats,
+                     indigo_fi_flow_removed_t reason)
+{
+    ft_detach(ind_core_ft, entry);
+    ind_core_flow_checkpoint_delete(entry);
+    ind_core_flow_delete_finish(entry, reason, final_stats);
 
     LOG_TRACE("Flow table now has %d entries",
               FT_STATUS(ind_core_ft)->current_count);
@@ -664,12 +801,64 @@ ind_core_enable_set(int enable)
                 ind_core_expiration_timer, NULL,
                 ind_core_config.stats_check_ms, -10);
         }
+        if (ind_core_flow_batch_enable_set(1) < 0) {
+            LOG_ERROR("Could not register flow batch commit");
+        }
+        if (ind_core_packet_out_batch_enable_set(1) < 0) {
+            LOG_ERROR("Could not register packet-out batch send");
+        }
+        if (ind_core_gentable_enable_set(1) < 0) {
+            LOG_ERROR("Could not register gentable batch commit");
+        }
+        if (ind_core_bundle_enable_set(1) < 0) {
+            LOG_ERROR("Could not register for connection status changes");
+        }
+        if (ind_core_delta_stats_enable_set(1) < 0) {
+            LOG_ERROR("Could not register for connection status changes");
+        }
+        if (ind_core_flow_stats_page_enable_set(1) < 0) {
+            LOG_ERROR("Could not register for connection status changes");
+        }
+        if (ind_core_flow_monitor_enable_set(1) < 0) {
+            LOG_ERROR("Could not register flow monitor callbacks");
+        }
+        if (ind_soc_pass_end_register(flow_removed_pass_end, NULL) < 0) {
+            LOG_ERROR("Could not register flow removed flush");
+        }
+        if (ind_core_counter_cache_enable_set(
+                ind_core_config.counter_cache_ms) < 0) {
+            LOG_ERROR("Could not register counter cache timer");
+        }
+        (void)ind_core_port_stats_enable_set(
+            ind_core_config.port_stats_cache_ms);
+        if (ind_core_port_status_enable_set(
+                ind_core_config.port_status_coalesce_ms,
+                ind_core_config.port_status_dampening_half_life_ms) < 0) {
+            LOG_ERROR("Could not register port status coalescing timer");
+        }
+        if (ind_core_flow_stats_workers_enable_set(
+                ind_core_config.flow_stats_workers) < 0) {
+            LOG_ERROR("Could not start flow stats worker threads");
+        }
         ind_core_module_enabled = 1;
     } else if (!enable && ind_core_module_enabled) {
         LOG_INFO("Disabling OF state mgr");
         if (CORE_EXPIRES_FLOWS(&ind_core_config)) {
             ind_soc_timer_event_unregister(ind_core_expiration_timer, NULL);
         }
+        (void)ind_core_packet_out_batch_enable_set(0);
+        (void)ind_core_flow_batch_enable_set(0);
+        (void)ind_core_gentable_enable_set(0);
+        (void)ind_core_bundle_enable_set(0);
+        (void)ind_core_delta_stats_enable_set(0);
+        (void)ind_core_flow_stats_page_enable_set(0);
+        (void)ind_core_flow_monitor_enable_set(0);
+        (void)ind_core_counter_cache_enable_set(0);
+        (void)ind_core_port_stats_enable_set(0);
+        (void)ind_core_port_status_enable_set(0, 0);
+        (void)ind_core_flow_stats_workers_enable_set(0);
+        ind_core_flow_removed_flush();
+        (void)ind_soc_pass_end_unregister(flow_removed_pass_end, NULL);
         ind_core_module_enabled = 0;
     } else {
         LOG_VERBOSE("Redundant enable call.  Currently %s",
@@ -704,9 +893,15 @@ ind_core_finish(void)
         ind_core_enable_set(0);
     }
 
+    ind_core_bundle_finish();
+    ind_core_port_status_finish();
+    ind_core_flow_monitor_finish();
+    ind_core_pending_finish();
+    indigo_core_flow_checkpoint_stop();
     ft_destroy(ind_core_ft);
 
     ind_core_test_gentable_finish();
+    indigo_core_gentable_checkpoint_release();
 
     ind_core_init_done = 0;
 
@@ -907,6 +1102,28 @@ indigo_core_disconnected_mode_get(indigo_core_disconnected_mode_t *mode)
 }
 
 
+/**
+ * Enable or disable flow eviction for a table
+ */
+indigo_error_t
+indigo_core_table_eviction_set(uint8_t table_id, uint32_t flags)
+{
+    if (!ind_core_init_done) {
+        return INDIGO_ERROR_INIT;
+    }
+
+    if (flags & ~(INDIGO_CORE_EVICTION_OTHER | INDIGO_CORE_EVICTION_IMPORTANCE |
+                  INDIGO_CORE_EVICTION_LIFETIME)) {
+        LOG_ERROR("Bad eviction flags for table %u: 0x%x", table_id, flags);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    LOG_TRACE("Setting eviction flags for table %u to 0x%x", table_id, flags);
+
+    return ft_eviction_set(ind_core_ft, table_id, flags);
+}
+
+
 /**
  * Notify state manager of a change in remote connection count
  */
@@ -923,10 +1140,10 @@ indigo_core_connection_count_notify(int new_count)
         if (ind_core_config.disconnected_mode ==
                 INDIGO_CORE_DISCONNECTED_MODE_STICKY) {
             /* Notify forwarding of change in behavior */
-            indigo_fwd_expiration_enable_set(0);
+            (void)IND_CORE_DRIVER_CALL(indigo_fwd_expiration_enable_set, 0);
         }
     } else {
-        indigo_fwd_expiration_enable_set(1);
+        (void)IND_CORE_DRIVER_CALL(indigo_fwd_expiration_enable_set, 1);
     }
 }
 
@@ -940,82 +1157,189 @@ indigo_core_port_status_update(of_port_status_t *of_port_status)
 
     LOG_TRACE("OF state mgr port status update");
 
-    if (ind_core_port_status_notify(of_port_status) == INDIGO_CORE_LISTENER_RESULT_DROP) {
-        LOG_TRACE("Listener dropped port status update");
-        of_object_delete(of_port_status);
-        return;
+    ind_core_port_status_add(of_port_status);
+}
+
+static void
+ft_dump_entry(void *cookie, ft_entry_t *entry)
+{
+    aim_pvs_t *pvs = cookie;
+    of_object_t *effects = ft_read_effects(entry);
+    of_match_t match;
+
+    ft_entry_match_get(entry, &match);
+    aim_printf(pvs, "Flow %d:\n", entry->id);
+    loci_dump_match((loci_writer_f)aim_printf, pvs, &match);
+    aim_printf(pvs, "cookie: 0x%016"PRIx64"\n", entry->cookie);
+    aim_printf(pvs, "idle_timeout: %hu\n", entry->idle_timeout);
+    aim_printf(pvs, "hard_timeout: %hu\n", entry->hard_timeout);
+    aim_printf(pvs, "priority: %hu\n", entry->priority);
+    aim_printf(pvs, "flags: %hu\n", entry->flags);
+    aim_printf(pvs, "table_id: %hhu\n", entry->table_id);
+
+    if (effects->version == OF_VERSION_1_0) {
+        int rv;
+        of_action_t elt;
+        OF_LIST_ACTION_ITER(effects, &elt, rv) {
+            of_object_dump((loci_writer_f)aim_printf, pvs, &elt.header);
+        }
+    } else {
+        int rv;
+        of_instruction_t inst;
+        OF_LIST_INSTRUCTION_ITER(effects, &inst, rv) {
+            of_object_dump((loci_writer_f)aim_printf, pvs, &inst.header);
+        }
     }
 
-    indigo_cxn_send_async_message(of_port_status);
+    aim_printf(pvs, "\n");
 }
 
 void
 ind_core_ft_dump(aim_pvs_t* pvs)
 {
-    ft_entry_t *entry;
-    list_links_t *cur, *next;
-
-    FT_ITER(ind_core_ft, entry, cur, next) {
-        aim_printf(pvs, "Flow %d:\n", entry->id);
-        loci_dump_match((loci_writer_f)aim_printf, pvs, &entry->match);
-        aim_printf(pvs, "cookie: 0x%016"PRIx64"\n", entry->cookie);
-        aim_printf(pvs, "idle_timeout: %hu\n", entry->idle_timeout);
-        aim_printf(pvs, "hard_timeout: %hu\n", entry->hard_timeout);
-        aim_printf(pvs, "priority: %hu\n", entry->priority);
-        aim_printf(pvs, "flags: %hu\n", entry->flags);
-        aim_printf(pvs, "table_id: %hhu\n", entry->table_id);
-
-        if (entry->match.version == OF_VERSION_1_0) {
-            int rv;
-            of_action_t elt;
-            OF_LIST_ACTION_ITER(entry->effects.actions, &elt, rv) {
-                of_object_dump((loci_writer_f)aim_printf, pvs, &elt.header);
-            }
-        } else {
-            int rv;
-            of_instruction_t inst;
-            OF_LIST_INSTRUCTION_ITER(entry->effects.instructions, &inst, rv) {
-                of_object_dump((loci_writer_f)aim_printf, pvs, &inst.header);
-            }
-        }
+    ft_read_t read;
 
-        aim_printf(pvs, "\n");
+    if (ft_read_lock(ind_core_ft, &read) < 0) {
+        aim_printf(pvs, "Too many concurrent flowtable readers\n");
+        return;
     }
+
+    ft_read_iter(ind_core_ft, NULL, ft_dump_entry, pvs);
+
+    ft_read_unlock(ind_core_ft, &read);
+}
+
+static void
+ft_show_entry(void *cookie, ft_entry_t *entry)
+{
+    aim_pvs_t *pvs = cookie;
+    of_object_t *effects = ft_read_effects(entry);
+    of_match_t match;
+
+    ft_entry_match_get(entry, &match);
+    aim_printf(pvs, "Flow %d: ", entry->id);
+    loci_show_match((loci_writer_f)aim_printf, pvs, &match);
+    aim_printf(pvs, "cookie=0x%016"PRIx64" ", entry->cookie);
+    aim_printf(pvs, "priority=%hu ", entry->priority);
+    aim_printf(pvs, "table_id=%hhu ", entry->table_id);
+
+    if (effects->version == OF_VERSION_1_0) {
+        int rv;
+        of_action_t elt;
+        OF_LIST_ACTION_ITER(effects, &elt, rv) {
+            aim_printf(pvs, "%s(", of_object_id_str[elt.header.object_id]);
+            of_object_show((loci_writer_f)aim_printf, pvs, &elt.header);
+            aim_printf(pvs, ") ");
+        }
+    } else {
+        int rv;
+        of_instruction_t inst;
+        OF_LIST_INSTRUCTION_ITER(effects, &inst, rv) {
+            aim_printf(pvs, "%s(", of_object_id_str[inst.header.object_id]);
+            of_object_show((loci_writer_f)aim_printf, pvs, &inst.header);
+            aim_printf(pvs, ") ");
+        }
+    }
+
+    aim_printf(pvs, "\n");
 }
 
 void
 ind_core_ft_show(aim_pvs_t* pvs)
 {
-    ft_entry_t *entry;
-    list_links_t *cur, *next;
-
-    FT_ITER(ind_core_ft, entry, cur, next) {
-        aim_printf(pvs, "Flow %d: ", entry->id);
-        loci_show_match((loci_writer_f)aim_printf, pvs, &entry->match);
-        aim_printf(pvs, "cookie=0x%016"PRIx64" ", entry->cookie);
-        aim_printf(pvs, "priority=%hu ", entry->priority);
-        aim_printf(pvs, "table_id=%hhu ", entry->table_id);
-
-        if (entry->match.version == OF_VERSION_1_0) {
-            int rv;
-            of_action_t elt;
-            OF_LIST_ACTION_ITER(entry->effects.actions, &elt, rv) {
-                aim_printf(pvs, "%s(", of_object_id_str[elt.header.object_id]);
-                of_object_show((loci_writer_f)aim_printf, pvs, &elt.header);
-                aim_printf(pvs, ") ");
-            }
-        } else {
-            int rv;
-            of_instruction_t inst;
-            OF_LIST_INSTRUCTION_ITER(entry->effects.instructions, &inst, rv) {
-                aim_printf(pvs, "%s(", of_object_id_str[inst.header.object_id]);
-                of_object_show((loci_writer_f)aim_printf, pvs, &inst.header);
-                aim_printf(pvs, ") ");
+    ft_read_t read;
+
+    if (ft_read_lock(ind_core_ft, &read) < 0) {
+        aim_printf(pvs, "Too many concurrent flowtable readers\n");
+        return;
+    }
+
+    ft_read_iter(ind_core_ft, NULL, ft_show_entry, pvs);
+
+    ft_read_unlock(ind_core_ft, &read);
+}
+
+void
+ind_core_ft_filter_init(ind_core_ft_filter_t *filter)
+{
+    INDIGO_MEM_SET(filter, 0, sizeof(*filter));
+    filter->table_id = -1;
+    filter->out_port = OF_PORT_DEST_WILDCARD;
+}
+
+/* State of an ind_core_ft_show_start task */
+struct ft_show_task {
+    aim_pvs_t *pvs;
+    bool verbose;
+    int count;
+    ind_core_ft_show_done_f done;
+    void *cookie;
+};
+
+static void
+ft_show_task_cb(void *cookie, ft_entry_t *entry)
+{
+    struct ft_show_task *task = cookie;
+
+    if (entry == NULL) {
+        aim_printf(task->pvs, "%d flows\n", task->count);
+        if (task->done != NULL) {
+            task->done(task->cookie, task->count);
+        }
+        INDIGO_MEM_FREE(task);
+        return;
+    }
+
+    task->count++;
+    if (task->verbose) {
+        ft_dump_entry(task->pvs, entry);
+    } else {
+        ft_show_entry(task->pvs, entry);
+    }
+}
+
+indigo_error_t
+ind_core_ft_show_start(aim_pvs_t *pvs, const ind_core_ft_filter_t *filter,
+                       bool verbose, ind_core_ft_show_done_f done,
+                       void *cookie)
+{
+    struct ft_show_task *task;
+    of_meta_match_t query;
+    indigo_error_t rv;
+
+    INDIGO_MEM_SET(&query, 0, sizeof(query));
+    query.mode = OF_MATCH_NON_STRICT;
+    query.table_id = TABLE_ID_ANY;
+    query.out_port = OF_PORT_DEST_WILDCARD;
+
+    if (filter != NULL) {
+        if (filter->table_id >= 0) {
+            if (filter->table_id >= TABLE_ID_ANY) {
+                return INDIGO_ERROR_PARAM;
             }
+            query.table_id = filter->table_id;
         }
+        query.cookie = filter->cookie;
+        query.cookie_mask = filter->cookie_mask;
+        query.out_port = filter->out_port;
+    }
 
-        aim_printf(pvs, "\n");
+    if ((task = INDIGO_MEM_ALLOC(sizeof(*task))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
     }
+    task->pvs = pvs;
+    task->verbose = verbose;
+    task->count = 0;
+    task->done = done;
+    task->cookie = cookie;
+
+    rv = ft_spawn_iter_task(ind_core_ft, &query, ft_show_task_cb, task,
+                            IND_SOC_DEFAULT_PRIORITY - 10);
+    if (rv < 0) {
+        INDIGO_MEM_FREE(task);
+    }
+
+    return rv;
 }
 
 void
@@ -1033,6 +1357,8 @@ ind_core_ft_stats(aim_pvs_t *pvs)
     aim_printf(pvs, "  Updates:        %d\n", (int)ft->status.updates);
     aim_printf(pvs, "  Full Errors:    %d\n",
                (int)ft->status.table_full_errors);
+    aim_printf(pvs, "  Evictions:      %d\n", (int)ft->status.evictions);
+    aim_printf(pvs, "  Re-adds:        %d\n", (int)ft->status.readds);
     aim_printf(pvs, "  Fwd Add Errors: %d\n",
                (int)ft->status.forwarding_add_errors);
 }
@@ -78,6 +78,71 @@ ofstatemanager_config_settings_t ofstatemanager_config_settings[] =
     { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_DPID_DEFAULT), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_DPID_DEFAULT) },
 #else
 { OFSTATEMANAGER_CONFIG_DPID_DEFAULT(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX) },
+#else
+{ OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX) },
+#else
+{ OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_MAX_BUNDLES
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_MAX_BUNDLES), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_MAX_BUNDLES) },
+#else
+{ OFSTATEMANAGER_CONFIG_MAX_BUNDLES(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS) },
+#else
+{ OFSTATEMANAGER_CONFIG_MAX_BUNDLE_MSGS(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX) },
+#else
+{ OFSTATEMANAGER_CONFIG_HIT_STATUS_BATCH_MAX(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX) },
+#else
+{ OFSTATEMANAGER_CONFIG_FLOW_REMOVED_BATCH_MAX(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX) },
+#else
+{ OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS) },
+#else
+{ OFSTATEMANAGER_CONFIG_MAX_DELTA_STATS_CXNS(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS) },
+#else
+{ OFSTATEMANAGER_CONFIG_MAX_FLOW_STATS_PAGE_CXNS(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE) },
+#else
+{ OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS) },
+#else
+{ OFSTATEMANAGER_CONFIG_MAX_FLOW_MONITORS(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX) },
+#else
+{ OFSTATEMANAGER_CONFIG_GENTABLE_BATCH_MAX(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES
+    { __ofstatemanager_config_STRINGIFY_NAME(OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES), __ofstatemanager_config_STRINGIFY_VALUE(OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES) },
+#else
+{ OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES(__ofstatemanager_config_STRINGIFY_NAME), "__undefined__" },
 #endif
     { NULL, NULL }
 };
@@ -262,7 +327,20 @@ ind_core_cfg_commit(void)
     (void)indigo_core_disconnected_mode_set(staged_config.disconnected_mode);
 }
 
+static const char * const cfg_paths[] = {
+    "logging.flowtable",
+    "of_hw_desc",
+    "of_sw_desc",
+    "of_mfr_desc",
+    "of_dp_desc",
+    "of_serial_num",
+    "of_datapath_id",
+    "disconnected_mode",
+    NULL
+};
+
 const struct ind_cfg_ops ind_core_cfg_ops = {
     .stage = ind_core_cfg_stage,
     .commit = ind_core_cfg_commit,
+    .paths = cfg_paths,
 };
@@ -39,7 +39,26 @@ extern ind_core_of_config_t ind_core_of_config;
 extern ft_instance_t ind_core_ft;
 
 extern void ind_core_flow_entry_delete(ft_entry_t *entry,
-                                       indigo_fi_flow_removed_t reason);
+                                       indigo_fi_flow_removed_t reason,
+                                       of_object_t *request);
+
+extern void ind_core_flow_delete_finish(ft_entry_t *entry,
+                                        indigo_fi_flow_removed_t reason,
+                                        indigo_fi_flow_stats_t *final_stats);
+
+extern void ind_core_flow_removed_flush(void);
+
+extern of_flow_removed_t *ind_core_flow_removed_build(
+    of_version_t ver,
+    ft_entry_t *entry,
+    indigo_fi_flow_removed_t reason,
+    indigo_fi_flow_stats_t *final_stats);
+
+extern indigo_error_t ind_core_flow_stats_entry_append(
+    of_flow_stats_reply_t *reply,
+    ft_entry_t *entry,
+    indigo_fi_flow_stats_t *flow_stats,
+    indigo_time_t current_time);
 
 void ind_core_group_init(void);
 
@@ -26,7 +26,12 @@
  *****************************************************************************/
 
 #include <indigo/types.h>
+#include <indigo/memory.h>
+#include <indigo/binlog.h>
 #include <OFStateManager/ofstatemanager_config.h>
+#include <OFStateManager/ofstatemanager.h>
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_int.h"
 
 
 #if OFSTATEMANAGER_CONFIG_INCLUDE_UCLI == 1
@@ -34,6 +39,9 @@
 #include <uCli/ucli.h>
 #include <uCli/ucli_argparse.h>
 #include <uCli/ucli_handler_macros.h>
+#include <AIM/aim_pvs_file.h>
+#include <stdlib.h>
+#include <string.h>
 
 
 
@@ -48,6 +56,212 @@ ofstatemanager_ucli_ucli__config__(ucli_context_t* uc)
     return UCLI_STATUS_OK;
 }
 
+static ucli_status_t
+ofstatemanager_ucli_ucli__gentable_stats__(ucli_context_t *uc)
+{
+    char *str;
+
+    UCLI_COMMAND_INFO(uc,
+                      "gentable_stats", -1,
+                      "$summary#Show gentable operation stats, or clear them.");
+    if (uc->pargs->count == 1) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "s", &str);
+        if (strcmp(str, "clear")) {
+            return UCLI_STATUS_E_ARG;
+        }
+        ind_core_gentable_stats_clear();
+        return UCLI_STATUS_OK;
+    } else if (uc->pargs->count > 1) {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    ind_core_gentable_stats_show(&uc->pvs);
+
+    return UCLI_STATUS_OK;
+}
+
+static ucli_status_t
+ofstatemanager_ucli_ucli__mem_stats__(ucli_context_t *uc)
+{
+    UCLI_COMMAND_INFO(uc,
+                      "mem_stats", 0,
+                      "$summary#Show tagged memory usage and allocation rates.");
+    indigo_mem_stats_show(&uc->pvs);
+
+    return UCLI_STATUS_OK;
+}
+
+static ucli_status_t
+ofstatemanager_ucli_ucli__binlog__(ucli_context_t *uc)
+{
+    char *str, *match;
+    int n = 0;
+
+    UCLI_COMMAND_INFO(uc,
+                      "binlog", -1,
+                      "$summary#Show deferred log records [count], list sites, "
+                      "enable/disable <all|id|file>, or size <records>.");
+    if (uc->pargs->count == 0) {
+        indigo_binlog_show(&uc->pvs, 0);
+        return UCLI_STATUS_OK;
+    }
+
+    if (uc->pargs->count == 1) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "s", &str);
+        if (strcmp(str, "sites")) {
+            return UCLI_STATUS_E_ARG;
+        }
+        indigo_binlog_sites_show(&uc->pvs);
+        return UCLI_STATUS_OK;
+    }
+
+    if (uc->pargs->count != 2) {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    UCLI_ARGPARSE_OR_RETURN(uc, "ss", &str, &match);
+    if (!strcmp(str, "enable") || !strcmp(str, "disable")) {
+        n = indigo_binlog_enable_set(match, str[0] == 'e');
+        ucli_printf(uc, "%d sites changed\n", n);
+    } else if (!strcmp(str, "show") || !strcmp(str, "size")) {
+        n = atoi(match);
+        if (str[1] == 'h') {
+            indigo_binlog_show(&uc->pvs, n);
+        } else if (indigo_binlog_ring_size_set(n) < 0) {
+            return UCLI_STATUS_E_ARG;
+        }
+    } else {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    return UCLI_STATUS_OK;
+}
+
+static ucli_status_t
+ofstatemanager_ucli_ucli__message_stats__(ucli_context_t *uc)
+{
+    char *str;
+
+    UCLI_COMMAND_INFO(uc,
+                      "message_stats", -1,
+                      "$summary#Show controller message stats, or clear them.");
+    if (uc->pargs->count == 1) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "s", &str);
+        if (strcmp(str, "clear")) {
+            return UCLI_STATUS_E_ARG;
+        }
+        ind_core_message_stats_clear();
+        return UCLI_STATUS_OK;
+    } else if (uc->pargs->count > 1) {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    ind_core_message_stats_show(&uc->pvs);
+
+    return UCLI_STATUS_OK;
+}
+
+static ucli_status_t
+ofstatemanager_ucli_ucli__driver_stats__(ucli_context_t *uc)
+{
+    char *str;
+
+    UCLI_COMMAND_INFO(uc,
+                      "driver_stats", -1,
+                      "$summary#Show forwarding and port manager call stats, or clear them.");
+    if (uc->pargs->count == 1) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "s", &str);
+        if (strcmp(str, "clear")) {
+            return UCLI_STATUS_E_ARG;
+        }
+        ind_core_driver_stats_clear();
+        return UCLI_STATUS_OK;
+    } else if (uc->pargs->count > 1) {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    ind_core_driver_stats_show(&uc->pvs);
+
+    return UCLI_STATUS_OK;
+}
+
+/* Closes the output file of a flows command */
+static void
+ofstatemanager_ucli_flows_done(void *cookie, int count)
+{
+    aim_pvs_t *pvs = cookie;
+
+    aim_pvs_destroy(pvs);
+    LOG_INFO("Flow dump finished: %d flows", count);
+}
+
+static ucli_status_t
+ofstatemanager_ucli_ucli__flows__(ucli_context_t *uc)
+{
+    char *path, *format, *table, *cookie, *out_port;
+    ind_core_ft_filter_t filter;
+    aim_pvs_t *pvs;
+    char *end;
+
+    UCLI_COMMAND_INFO(uc,
+                      "flows", -1,
+                      "$summary#Write flows to a file in the background: "
+                      "<file> <brief|verbose> [<table> <cookie>/<mask> <out_port>], "
+                      "'-' for any.");
+
+    ind_core_ft_filter_init(&filter);
+
+    if (uc->pargs->count == 2) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "ss", &path, &format);
+    } else if (uc->pargs->count == 5) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "sssss", &path, &format,
+                                &table, &cookie, &out_port);
+        if (strcmp(table, "-")) {
+            filter.table_id = strtol(table, &end, 0);
+            if (*end != '\0' || filter.table_id < 0 || filter.table_id > 254) {
+                return UCLI_STATUS_E_ARG;
+            }
+        }
+        if (strcmp(cookie, "-")) {
+            filter.cookie = strtoull(cookie, &end, 0);
+            if (*end != '/') {
+                return UCLI_STATUS_E_ARG;
+            }
+            filter.cookie_mask = strtoull(end + 1, &end, 0);
+            if (*end != '\0') {
+                return UCLI_STATUS_E_ARG;
+            }
+        }
+        if (strcmp(out_port, "-")) {
+            filter.out_port = strtoul(out_port, &end, 0);
+            if (*end != '\0') {
+                return UCLI_STATUS_E_ARG;
+            }
+        }
+    } else {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    if (strcmp(format, "brief") && strcmp(format, "verbose")) {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    if ((pvs = aim_pvs_fopen(path, "w")) == NULL) {
+        ucli_printf(uc, "Failed to open %s\n", path);
+        return UCLI_STATUS_E_ERROR;
+    }
+
+    if (ind_core_ft_show_start(pvs, &filter, format[0] == 'v',
+                               ofstatemanager_ucli_flows_done, pvs) < 0) {
+        aim_pvs_destroy(pvs);
+        ucli_printf(uc, "Failed to start the flow dump\n");
+        return UCLI_STATUS_E_ERROR;
+    }
+
+    ucli_printf(uc, "Writing flows to %s\n", path);
+
+    return UCLI_STATUS_OK;
+}
 
 /* <auto.ucli.handlers.start> */
 /******************************************************************************
@@ -59,6 +273,12 @@ ofstatemanager_ucli_ucli__config__(ucli_context_t* uc)
 static ucli_command_handler_f ofstatemanager_ucli_ucli_handlers__[] =
 {
     ofstatemanager_ucli_ucli__config__,
+    ofstatemanager_ucli_ucli__gentable_stats__,
+    ofstatemanager_ucli_ucli__mem_stats__,
+    ofstatemanager_ucli_ucli__binlog__,
+    ofstatemanager_ucli_ucli__message_stats__,
+    ofstatemanager_ucli_ucli__driver_stats__,
+    ofstatemanager_ucli_ucli__flows__,
     NULL
 };
 /******************************************************************************/
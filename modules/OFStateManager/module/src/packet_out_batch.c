@@ -0,0 +1,86 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Batched packet-out
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/forwarding.h>
+#include <SocketManager/socketmanager.h>
+
+#include "ofstatemanager_log.h"
+#include "flow_batch.h"
+#include "packet_out_batch.h"
+#include "driver_stats.h"
+
+static of_packet_out_t *batch[OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX];
+static int batch_count;
+
+void
+ind_core_packet_out_batch_add(of_packet_out_t *obj)
+{
+    batch[batch_count++] = obj;
+
+    if (batch_count == OFSTATEMANAGER_CONFIG_PACKET_OUT_BATCH_MAX) {
+        ind_core_packet_out_batch_flush();
+    }
+}
+
+void
+ind_core_packet_out_batch_flush(void)
+{
+    int count = batch_count;
+    int i;
+
+    if (count == 0) {
+        return;
+    }
+
+    /* Packet-outs to the flow table must see the flows sent before them */
+    ind_core_flow_batch_flush();
+
+    LOG_TRACE("Sending packet-out batch of %d", count);
+
+    batch_count = 0;
+    IND_CORE_DRIVER_CALL_VOID(indigo_fwd_packet_out_batch, batch, count);
+
+    for (i = 0; i < count; i++) {
+        of_packet_out_delete(batch[i]);
+    }
+}
+
+static void
+packet_out_batch_pass_end(void *cookie)
+{
+    ind_core_packet_out_batch_flush();
+}
+
+indigo_error_t
+ind_core_packet_out_batch_enable_set(int enable)
+{
+    if (enable) {
+        return ind_soc_pass_end_register(packet_out_batch_pass_end, NULL);
+    } else {
+        ind_core_packet_out_batch_flush();
+        return ind_soc_pass_end_unregister(packet_out_batch_pass_end, NULL);
+    }
+}
@@ -0,0 +1,53 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Batched packet-out
+ *
+ * Packet-outs are collected instead of being sent one at a time, and
+ * passed to indigo_fwd_packet_out_batch at the end of the event loop
+ * pass, when the batch fills up, or before any other controller message
+ * is handled, so they keep their order relative to the rest of the
+ * controller's messages. Queued flow operations are committed first.
+ */
+
+#ifndef _OFSTATEMANAGER_PACKET_OUT_BATCH_H_
+#define _OFSTATEMANAGER_PACKET_OUT_BATCH_H_
+
+#include <indigo/indigo.h>
+#include <loci/loci.h>
+
+/**
+ * Queue a packet-out
+ * @param obj The packet-out; the batch takes ownership
+ */
+void ind_core_packet_out_batch_add(of_packet_out_t *obj);
+
+/**
+ * Send any queued packet-outs
+ */
+void ind_core_packet_out_batch_flush(void);
+
+/**
+ * Start or stop sending at the end of each event loop pass
+ */
+indigo_error_t ind_core_packet_out_batch_enable_set(int enable);
+
+#endif /* _OFSTATEMANAGER_PACKET_OUT_BATCH_H_ */
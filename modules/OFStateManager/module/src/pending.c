@@ -0,0 +1,194 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Pending forwarding operations
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/of_state_manager.h>
+
+#include "ofstatemanager_log.h"
+#include "ofstatemanager_decs.h"
+#include "handlers.h"
+#include "pending.h"
+
+/* Oldest first, so operations on one flow or group complete in order */
+static LIST_DEFINE(pending_list);
+
+ind_core_pending_t *
+ind_core_pending_add(ind_core_pending_type_t type, uint64_t id,
+                     of_object_t *request, indigo_cxn_id_t cxn_id)
+{
+    ind_core_pending_t *op = INDIGO_MEM_ALLOC(sizeof(*op));
+    AIM_TRUE_OR_DIE(op != NULL);
+
+    op->type = type;
+    op->id = id;
+    op->request = request;
+    op->cxn_id = cxn_id;
+    op->release = false;
+    op->cookie = NULL;
+    op->reason = 0;
+    list_push(&pending_list, &op->links);
+
+    LOG_TRACE("Forwarding operation %d on 0x%"PRIx64" pending", type, id);
+
+    return op;
+}
+
+static ind_core_pending_t *
+pending_find(ind_core_pending_type_t type, uint64_t id)
+{
+    list_links_t *cur;
+
+    LIST_FOREACH(&pending_list, cur) {
+        ind_core_pending_t *op = container_of(cur, links, ind_core_pending_t);
+        if (op->type == type && op->id == id) {
+            return op;
+        }
+    }
+
+    return NULL;
+}
+
+void
+ind_core_pending_release(of_object_t *request)
+{
+    list_links_t *cur;
+
+    if (request == NULL) {
+        return;
+    }
+
+    LIST_FOREACH(&pending_list, cur) {
+        ind_core_pending_t *op = container_of(cur, links, ind_core_pending_t);
+        if (op->request == request) {
+            op->release = true;
+            return;
+        }
+    }
+
+    of_object_delete(request);
+}
+
+/* Handle the result and free the record */
+static void
+pending_complete(ind_core_pending_t *op, indigo_error_t result,
+                 uint8_t table_id, indigo_fi_flow_stats_t *flow_stats)
+{
+    list_remove(&op->links);
+
+    switch (op->type) {
+    case IND_CORE_PENDING_FLOW_CREATE:
+        ind_core_flow_add_finish(result, op->id, table_id,
+                                 (of_flow_modify_t *)op->request, op->cxn_id);
+        break;
+    case IND_CORE_PENDING_FLOW_MODIFY:
+        ind_core_flow_modify_finish(result, op->id,
+                                    (of_flow_modify_t *)op->request,
+                                    op->cxn_id);
+        break;
+    case IND_CORE_PENDING_FLOW_DELETE:
+        ind_core_flow_delete_finish(op->cookie, op->reason,
+                                    result == INDIGO_ERROR_NONE ?
+                                    flow_stats : NULL);
+        break;
+    case IND_CORE_PENDING_GROUP_ADD:
+        ind_core_group_add_finish(result, op->id, op->request, op->cxn_id);
+        break;
+    case IND_CORE_PENDING_GROUP_MODIFY:
+        ind_core_group_modify_finish(result, op->id, op->request,
+                                     op->cxn_id, op->cookie);
+        break;
+    default:
+        INDIGO_ASSERT(0);
+        break;
+    }
+
+    if (op->release) {
+        ind_core_flow_removed_flush();
+        /* Passes to another operation holding it, if any */
+        ind_core_pending_release(op->request);
+    }
+
+    INDIGO_MEM_FREE(op);
+}
+
+static void
+pending_done(ind_core_pending_type_t type, uint64_t id, indigo_error_t result,
+             uint8_t table_id, indigo_fi_flow_stats_t *flow_stats)
+{
+    ind_core_pending_t *op = pending_find(type, id);
+
+    if (op == NULL) {
+        LOG_ERROR("No pending forwarding operation %d on 0x%"PRIx64,
+                  type, id);
+        return;
+    }
+
+    pending_complete(op, result, table_id, flow_stats);
+}
+
+void
+indigo_core_flow_create_done(indigo_cookie_t flow_id, indigo_error_t result,
+                             uint8_t table_id)
+{
+    pending_done(IND_CORE_PENDING_FLOW_CREATE, flow_id, result, table_id,
+                 NULL);
+}
+
+void
+indigo_core_flow_modify_done(indigo_cookie_t flow_id, indigo_error_t result)
+{
+    pending_done(IND_CORE_PENDING_FLOW_MODIFY, flow_id, result, 0, NULL);
+}
+
+void
+indigo_core_flow_delete_done(indigo_cookie_t flow_id, indigo_error_t result,
+                             indigo_fi_flow_stats_t *flow_stats)
+{
+    pending_done(IND_CORE_PENDING_FLOW_DELETE, flow_id, result, 0,
+                 flow_stats);
+}
+
+void
+indigo_core_group_add_done(uint32_t id, indigo_error_t result)
+{
+    pending_done(IND_CORE_PENDING_GROUP_ADD, id, result, 0, NULL);
+}
+
+void
+indigo_core_group_modify_done(uint32_t id, indigo_error_t result)
+{
+    pending_done(IND_CORE_PENDING_GROUP_MODIFY, id, result, 0, NULL);
+}
+
+void
+ind_core_pending_finish(void)
+{
+    list_links_t *cur;
+
+    while ((cur = list_first(&pending_list)) != NULL) {
+        pending_complete(container_of(cur, links, ind_core_pending_t),
+                         INDIGO_ERROR_UNKNOWN, 0, NULL);
+    }
+}
@@ -0,0 +1,89 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Pending forwarding operations
+ *
+ * Forwarding may return INDIGO_ERROR_PENDING from flow and group
+ * operations and report the result later through the indigo_core_*_done
+ * functions. Each such operation is recorded here until then.
+ *
+ * The originating request is held until the operation completes. The
+ * connection manager does not answer a barrier until every request
+ * before it has been deleted, so barriers wait for completions. Errors
+ * are sent when the result arrives, quoting the held request.
+ */
+
+#ifndef _OFSTATEMANAGER_PENDING_H_
+#define _OFSTATEMANAGER_PENDING_H_
+
+#include <indigo/indigo.h>
+#include <indigo/of_connection_manager.h>
+#include <loci/loci.h>
+#include <AIM/aim_list.h>
+
+typedef enum ind_core_pending_type_e {
+    IND_CORE_PENDING_FLOW_CREATE,
+    IND_CORE_PENDING_FLOW_MODIFY,
+    IND_CORE_PENDING_FLOW_DELETE,
+    IND_CORE_PENDING_GROUP_ADD,
+    IND_CORE_PENDING_GROUP_MODIFY,
+} ind_core_pending_type_t;
+
+typedef struct ind_core_pending_s {
+    list_links_t links;
+    ind_core_pending_type_t type;
+    uint64_t id;                /* Flow ID or group ID */
+    of_object_t *request;       /* May be NULL */
+    indigo_cxn_id_t cxn_id;
+    bool release;               /* Last holder of request; delete when done */
+    void *cookie;               /* Per-type state kept by the caller */
+    int reason;                 /* Flow removed reason, for deletes */
+} ind_core_pending_t;
+
+/**
+ * Record an operation Forwarding returned INDIGO_ERROR_PENDING for
+ * @param type Operation type
+ * @param id Flow ID or group ID Forwarding will complete it with
+ * @param request The request to hold, or NULL
+ * @param cxn_id Connection the request arrived on
+ * @returns The new record; the caller may set cookie and reason
+ */
+ind_core_pending_t *ind_core_pending_add(ind_core_pending_type_t type,
+                                         uint64_t id,
+                                         of_object_t *request,
+                                         indigo_cxn_id_t cxn_id);
+
+/**
+ * Release a request
+ *
+ * The request is deleted now unless a pending operation holds it, in
+ * which case it is deleted once the last such operation completes.
+ */
+void ind_core_pending_release(of_object_t *request);
+
+/**
+ * Fail all pending operations
+ *
+ * Called on shutdown, before the flowtable is destroyed.
+ */
+void ind_core_pending_finish(void);
+
+#endif /* _OFSTATEMANAGER_PENDING_H_ */
@@ -0,0 +1,508 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/**
+ * @file
+ * @brief Port stats snapshot
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <indigo/indigo.h>
+#include <indigo/port_manager.h>
+#include <indigo/of_connection_manager.h>
+#include <stdlib.h>
+
+#include "ofstatemanager_log.h"
+#include "port_stats.h"
+#include "driver_stats.h"
+
+/* TODO move into LOXI */
+#define PORT_STATS_QUEUE_ALL 0xffffffff
+
+/*
+ * Counters for every port, sorted by port number
+ *
+ * stats points to an array of stats_size-byte elements in the same order
+ * as port_nos.
+ */
+typedef struct port_snapshot_s {
+    bool valid;
+    indigo_time_t time;
+    int num_ports;
+    int max_ports;
+    of_port_no_t *port_nos;
+    void *stats;
+    int stats_size;
+} port_snapshot_t;
+
+typedef struct queue_snapshot_s {
+    bool valid;
+    indigo_time_t time;
+    int num_queues;
+    int max_queues;
+    indigo_port_queue_stats_t *stats;
+} queue_snapshot_t;
+
+static int snapshot_ms;     /* 0 if disabled */
+
+static port_snapshot_t port_stats_snapshot = {
+    .stats_size = sizeof(indigo_port_stats_t),
+};
+
+static port_snapshot_t extended_stats_snapshot = {
+    .stats_size = sizeof(indigo_fi_port_stats_t),
+};
+
+static queue_snapshot_t queue_stats_snapshot;
+
+/* Set when the port manager doesn't implement the bulk call */
+static bool port_stats_unsupported;
+static bool queue_stats_unsupported;
+
+/*
+ * Truncate the object to its initial length.
+ *
+ * This is called by the stats handlers to reuse a single allocated entry.
+ */
+static void
+truncate_of_object(of_object_t *obj)
+{
+    of_object_init_map[obj->object_id](obj, obj->version, -1, 0);
+    obj->wire_object.wbuf->current_bytes = obj->length;
+}
+
+static bool
+snapshot_fresh(bool valid, indigo_time_t time)
+{
+    return valid && INDIGO_CURRENT_TIME - time < snapshot_ms;
+}
+
+static int
+port_no_compare(const void *a, const void *b)
+{
+    of_port_no_t x = *(const of_port_no_t *)a;
+    of_port_no_t y = *(const of_port_no_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Index of port_no in the snapshot, or -1 */
+static int
+port_snapshot_find(port_snapshot_t *snap, of_port_no_t port_no)
+{
+    of_port_no_t *found;
+
+    found = bsearch(&port_no, snap->port_nos, snap->num_ports,
+                    sizeof(port_no), port_no_compare);
+
+    return found ? found - snap->port_nos : -1;
+}
+
+static void *
+port_snapshot_stats(port_snapshot_t *snap, int idx)
+{
+    return (uint8_t *)snap->stats + idx * snap->stats_size;
+}
+
+/*
+ * Fill in the snapshot's port list and set every counter to -1
+ */
+static indigo_error_t
+port_snapshot_ports(port_snapshot_t *snap)
+{
+    indigo_port_info_t *port_list, *port_info;
+    indigo_error_t rv;
+    int num_ports = 0;
+
+    snap->valid = false;
+
+    if ((rv = IND_CORE_DRIVER_CALL(indigo_port_interface_list, &port_list)) < 0) {
+        LOG_ERROR("Failed to get port list: %s", indigo_strerror(rv));
+        return rv;
+    }
+
+    for (port_info = port_list; port_info; port_info = port_info->next) {
+        num_ports++;
+    }
+
+    if (num_ports > snap->max_ports) {
+        INDIGO_MEM_FREE(snap->port_nos);
+        INDIGO_MEM_FREE(snap->stats);
+        snap->port_nos = INDIGO_MEM_ALLOC(num_ports * sizeof(*snap->port_nos));
+        snap->stats = INDIGO_MEM_ALLOC(num_ports * snap->stats_size);
+        AIM_TRUE_OR_DIE(snap->port_nos != NULL && snap->stats != NULL);
+        snap->max_ports = num_ports;
+    }
+
+    snap->num_ports = 0;
+    for (port_info = port_list; port_info; port_info = port_info->next) {
+        snap->port_nos[snap->num_ports++] = port_info->of_port;
+    }
+
+    IND_CORE_DRIVER_CALL_VOID(indigo_port_interface_list_destroy, port_list);
+
+    qsort(snap->port_nos, snap->num_ports, sizeof(*snap->port_nos),
+          port_no_compare);
+
+    /* Default to "counter not supported" */
+    INDIGO_MEM_SET(snap->stats, 0xff, snap->num_ports * snap->stats_size);
+
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+port_snapshot_free(port_snapshot_t *snap)
+{
+    INDIGO_MEM_FREE(snap->port_nos);
+    INDIGO_MEM_FREE(snap->stats);
+    snap->port_nos = NULL;
+    snap->stats = NULL;
+    snap->num_ports = snap->max_ports = 0;
+    snap->valid = false;
+}
+
+static indigo_error_t
+port_stats_refresh(void)
+{
+    port_snapshot_t *snap = &port_stats_snapshot;
+    indigo_error_t rv;
+
+    if (snapshot_fresh(snap->valid, snap->time)) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if ((rv = port_snapshot_ports(snap)) < 0) {
+        return rv;
+    }
+
+    rv = IND_CORE_DRIVER_CALL(indigo_port_stats_bulk_get, snap->port_nos,
+                              snap->stats, snap->num_ports);
+    if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+        LOG_VERBOSE("Port manager does not support bulk port stats");
+        port_stats_unsupported = true;
+        return rv;
+    } else if (rv < 0) {
+        LOG_ERROR("Failed to get port stats: %s", indigo_strerror(rv));
+        return rv;
+    }
+
+    snap->time = INDIGO_CURRENT_TIME;
+    snap->valid = true;
+    return INDIGO_ERROR_NONE;
+}
+
+static indigo_error_t
+extended_stats_refresh(void)
+{
+    port_snapshot_t *snap = &extended_stats_snapshot;
+    indigo_error_t rv;
+
+    if (snapshot_fresh(snap->valid, snap->time)) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if ((rv = port_snapshot_ports(snap)) < 0) {
+        return rv;
+    }
+
+    IND_CORE_DRIVER_CALL_VOID(indigo_port_extended_stats_bulk_get,
+                              snap->port_nos, snap->stats, snap->num_ports);
+
+    snap->time = INDIGO_CURRENT_TIME;
+    snap->valid = true;
+    return INDIGO_ERROR_NONE;
+}
+
+static indigo_error_t
+queue_stats_refresh(void)
+{
+    queue_snapshot_t *snap = &queue_stats_snapshot;
+    indigo_error_t rv;
+    int num_queues;
+
+    if (snapshot_fresh(snap->valid, snap->time)) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    snap->valid = false;
+
+    /* Retry once if queues were added since the last snapshot */
+    num_queues = snap->max_queues;
+    rv = IND_CORE_DRIVER_CALL(indigo_port_queue_stats_bulk_get, snap->stats, &num_queues);
+    if (rv == INDIGO_ERROR_RESOURCE) {
+        INDIGO_MEM_FREE(snap->stats);
+        snap->stats = INDIGO_MEM_ALLOC(num_queues * sizeof(*snap->stats));
+        AIM_TRUE_OR_DIE(snap->stats != NULL);
+        snap->max_queues = num_queues;
+        rv = IND_CORE_DRIVER_CALL(indigo_port_queue_stats_bulk_get,
+                                  snap->stats, &num_queues);
+    }
+
+    if (rv == INDIGO_ERROR_NOT_SUPPORTED) {
+        LOG_VERBOSE("Port manager does not support bulk queue stats");
+        queue_stats_unsupported = true;
+        return rv;
+    } else if (rv < 0) {
+        LOG_ERROR("Failed to get queue stats: %s", indigo_strerror(rv));
+        return rv;
+    }
+
+    snap->num_queues = num_queues;
+    snap->time = INDIGO_CURRENT_TIME;
+    snap->valid = true;
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+port_stats_entry_populate(of_port_stats_entry_t *entry, of_port_no_t port_no,
+                          indigo_port_stats_t *stats)
+{
+    of_port_stats_entry_port_no_set(entry, port_no);
+    of_port_stats_entry_rx_packets_set(entry, stats->rx_packets);
+    of_port_stats_entry_tx_packets_set(entry, stats->tx_packets);
+    of_port_stats_entry_rx_bytes_set(entry, stats->rx_bytes);
+    of_port_stats_entry_tx_bytes_set(entry, stats->tx_bytes);
+    of_port_stats_entry_rx_dropped_set(entry, stats->rx_dropped);
+    of_port_stats_entry_tx_dropped_set(entry, stats->tx_dropped);
+    of_port_stats_entry_rx_errors_set(entry, stats->rx_errors);
+    of_port_stats_entry_tx_errors_set(entry, stats->tx_errors);
+    of_port_stats_entry_rx_frame_err_set(entry, stats->rx_frame_err);
+    of_port_stats_entry_rx_over_err_set(entry, stats->rx_over_err);
+    of_port_stats_entry_rx_crc_err_set(entry, stats->rx_crc_err);
+    of_port_stats_entry_collisions_set(entry, stats->collisions);
+    if (entry->version >= OF_VERSION_1_3) {
+        of_port_stats_entry_duration_sec_set(entry, stats->duration_sec);
+        of_port_stats_entry_duration_nsec_set(entry, stats->duration_nsec);
+    }
+}
+
+static void
+queue_stats_entry_populate(of_queue_stats_entry_t *entry,
+                           indigo_port_queue_stats_t *stats)
+{
+    of_queue_stats_entry_port_no_set(entry, stats->port_no);
+    of_queue_stats_entry_queue_id_set(entry, stats->queue_id);
+    of_queue_stats_entry_tx_bytes_set(entry, stats->tx_bytes);
+    of_queue_stats_entry_tx_packets_set(entry, stats->tx_packets);
+    of_queue_stats_entry_tx_errors_set(entry, stats->tx_errors);
+    if (entry->version >= OF_VERSION_1_3) {
+        of_queue_stats_entry_duration_sec_set(entry, stats->duration_sec);
+        of_queue_stats_entry_duration_nsec_set(entry, stats->duration_nsec);
+    }
+}
+
+indigo_error_t
+ind_core_port_stats_reply_send(of_port_stats_request_t *req,
+                               indigo_cxn_id_t cxn_id)
+{
+    port_snapshot_t *snap = &port_stats_snapshot;
+    of_port_stats_reply_t *reply;
+    of_list_port_stats_entry_t entries;
+    of_port_stats_entry_t *entry;
+    of_port_no_t port_no;
+    uint32_t xid;
+    indigo_error_t rv;
+    int first, last, i;
+
+    if (snapshot_ms == 0 || port_stats_unsupported) {
+        return INDIGO_ERROR_NOT_SUPPORTED;
+    }
+
+    if ((rv = port_stats_refresh()) < 0) {
+        return rv;
+    }
+
+    of_port_stats_request_port_no_get(req, &port_no);
+    of_port_stats_request_xid_get(req, &xid);
+
+    if (port_no == OF_PORT_DEST_WILDCARD || port_no == OF_PORT_DEST_NONE ||
+        port_no == OF_PORT_DEST_ALL) {
+        first = 0;
+        last = snap->num_ports;
+    } else if ((first = port_snapshot_find(snap, port_no)) >= 0) {
+        last = first + 1;
+    } else {
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    reply = of_port_stats_reply_new(req->version);
+    AIM_TRUE_OR_DIE(reply != NULL);
+    of_port_stats_reply_xid_set(reply, xid);
+    of_port_stats_reply_entries_bind(reply, &entries);
+
+    entry = of_port_stats_entry_new(req->version);
+    AIM_TRUE_OR_DIE(entry != NULL);
+
+    for (i = first; i < last; i++) {
+        port_stats_entry_populate(entry, snap->port_nos[i],
+                                  port_snapshot_stats(snap, i));
+
+        if (of_list_append(&entries, entry) < 0) {
+            /* This entry didn't fit, send out the current message and
+             * allocate a new one. */
+            of_port_stats_reply_flags_set(reply, OF_STATS_REPLY_FLAG_REPLY_MORE);
+            indigo_cxn_send_controller_message(cxn_id, reply);
+
+            reply = of_port_stats_reply_new(req->version);
+            AIM_TRUE_OR_DIE(reply != NULL);
+            of_port_stats_reply_xid_set(reply, xid);
+            of_port_stats_reply_entries_bind(reply, &entries);
+
+            if (of_list_append(&entries, entry) < 0) {
+                AIM_DIE("unexpected failure appending single port stats entry");
+            }
+        }
+
+        truncate_of_object(entry);
+    }
+
+    of_object_delete(entry);
+
+    indigo_cxn_send_controller_message(cxn_id, reply);
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_core_queue_stats_reply_send(of_queue_stats_request_t *req,
+                                indigo_cxn_id_t cxn_id)
+{
+    queue_snapshot_t *snap = &queue_stats_snapshot;
+    of_queue_stats_reply_t *reply;
+    of_list_queue_stats_entry_t entries;
+    of_queue_stats_entry_t *entry;
+    of_port_no_t port_no;
+    uint32_t queue_id;
+    uint32_t xid;
+    indigo_error_t rv;
+    bool all_ports, all_queues;
+    int num_matched = 0;
+    int i;
+
+    if (snapshot_ms == 0 || queue_stats_unsupported) {
+        return INDIGO_ERROR_NOT_SUPPORTED;
+    }
+
+    if ((rv = queue_stats_refresh()) < 0) {
+        return rv;
+    }
+
+    of_queue_stats_request_port_no_get(req, &port_no);
+    of_queue_stats_request_queue_id_get(req, &queue_id);
+    of_queue_stats_request_xid_get(req, &xid);
+
+    all_ports = port_no == OF_PORT_DEST_WILDCARD ||
+        port_no == OF_PORT_DEST_NONE || port_no == OF_PORT_DEST_ALL;
+    all_queues = queue_id == PORT_STATS_QUEUE_ALL;
+
+    reply = of_queue_stats_reply_new(req->version);
+    AIM_TRUE_OR_DIE(reply != NULL);
+    of_queue_stats_reply_xid_set(reply, xid);
+    of_queue_stats_reply_entries_bind(reply, &entries);
+
+    entry = of_queue_stats_entry_new(req->version);
+    AIM_TRUE_OR_DIE(entry != NULL);
+
+    for (i = 0; i < snap->num_queues; i++) {
+        indigo_port_queue_stats_t *stats = &snap->stats[i];
+
+        if ((!all_ports && stats->port_no != port_no) ||
+            (!all_queues && stats->queue_id != queue_id)) {
+            continue;
+        }
+
+        queue_stats_entry_populate(entry, stats);
+        num_matched++;
+
+        if (of_list_append(&entries, entry) < 0) {
+            /* This entry didn't fit, send out the current message and
+             * allocate a new one. */
+            of_queue_stats_reply_flags_set(reply, OF_STATS_REPLY_FLAG_REPLY_MORE);
+            indigo_cxn_send_controller_message(cxn_id, reply);
+
+            reply = of_queue_stats_reply_new(req->version);
+            AIM_TRUE_OR_DIE(reply != NULL);
+            of_queue_stats_reply_xid_set(reply, xid);
+            of_queue_stats_reply_entries_bind(reply, &entries);
+
+            if (of_list_append(&entries, entry) < 0) {
+                AIM_DIE("unexpected failure appending single queue stats entry");
+            }
+        }
+
+        truncate_of_object(entry);
+    }
+
+    of_object_delete(entry);
+
+    if (num_matched == 0 && !all_ports && !all_queues) {
+        of_object_delete(reply);
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    indigo_cxn_send_controller_message(cxn_id, reply);
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_core_port_extended_stats_get(of_port_no_t *port_nos,
+                                 indigo_fi_port_stats_t *port_stats,
+                                 int num_ports)
+{
+    port_snapshot_t *snap = &extended_stats_snapshot;
+    int i;
+
+    if (snapshot_ms == 0 || extended_stats_refresh() < 0) {
+        IND_CORE_DRIVER_CALL_VOID(indigo_port_extended_stats_bulk_get,
+                                  port_nos, port_stats, num_ports);
+        return;
+    }
+
+    for (i = 0; i < num_ports; i++) {
+        int idx = port_snapshot_find(snap, port_nos[i]);
+        if (idx >= 0) {
+            port_stats[i] = *(indigo_fi_port_stats_t *)port_snapshot_stats(snap, idx);
+        } else {
+            /* Added since the snapshot was taken */
+            IND_CORE_DRIVER_CALL_VOID(indigo_port_extended_stats_get,
+                                      port_nos[i], &port_stats[i]);
+        }
+    }
+}
+
+indigo_error_t
+ind_core_port_stats_enable_set(int cache_ms)
+{
+    if (cache_ms == 0) {
+        port_snapshot_free(&port_stats_snapshot);
+        port_snapshot_free(&extended_stats_snapshot);
+        INDIGO_MEM_FREE(queue_stats_snapshot.stats);
+        INDIGO_MEM_SET(&queue_stats_snapshot, 0, sizeof(queue_stats_snapshot));
+    }
+
+    /* Check again whether the port manager supports the bulk calls */
+    port_stats_unsupported = false;
+    queue_stats_unsupported = false;
+
+    snapshot_ms = cache_ms;
+
+    return INDIGO_ERROR_NONE;
+}
@@ -0,0 +1,81 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/**
+ * @file
+ * @brief Port stats snapshot
+ *
+ * When ind_core_config_t.port_stats_cache_ms is nonzero, port, queue and
+ * BSN port counter stats requests are answered from a snapshot of every
+ * port (or queue) read from the port manager in one bulk call. A
+ * snapshot is reused until it is port_stats_cache_ms old, so controllers
+ * polling all ports at different cadences share one hardware read.
+ *
+ * Port and queue stats fall back to indigo_port_stats_get and
+ * indigo_port_queue_stats_get when the snapshot is disabled or the
+ * port manager doesn't implement the bulk call.
+ */
+
+#ifndef _OFSTATEMANAGER_PORT_STATS_H_
+#define _OFSTATEMANAGER_PORT_STATS_H_
+
+#include <indigo/indigo.h>
+#include <indigo/fi.h>
+#include <indigo/port_manager.h>
+#include <indigo/of_connection_manager.h>
+#include <loci/loci.h>
+
+/**
+ * Set the snapshot lifetime
+ * @param cache_ms Maximum snapshot age; 0 disables the snapshot
+ */
+indigo_error_t ind_core_port_stats_enable_set(int cache_ms);
+
+/**
+ * Reply to a port stats request from the snapshot
+ * @returns INDIGO_ERROR_NOT_SUPPORTED if the request must be passed to
+ * indigo_port_stats_get instead
+ *
+ * Ownership of the request is maintained by the caller.
+ */
+indigo_error_t ind_core_port_stats_reply_send(of_port_stats_request_t *req,
+                                              indigo_cxn_id_t cxn_id);
+
+/**
+ * Reply to a queue stats request from the snapshot
+ * @returns INDIGO_ERROR_NOT_SUPPORTED if the request must be passed to
+ * indigo_port_queue_stats_get instead
+ *
+ * Ownership of the request is maintained by the caller.
+ */
+indigo_error_t ind_core_queue_stats_reply_send(of_queue_stats_request_t *req,
+                                               indigo_cxn_id_t cxn_id);
+
+/**
+ * Get extended stats for several ports
+ *
+ * Same as indigo_port_extended_stats_bulk_get, but served from the
+ * snapshot when it is enabled.
+ */
+void ind_core_port_extended_stats_get(of_port_no_t *port_nos,
+                                      indigo_fi_port_stats_t *port_stats,
+                                      int num_ports);
+
+#endif /* _OFSTATEMANAGER_PORT_STATS_H_ */
@@ -0,0 +1,323 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/**
+ * @file
+ * @brief Port status coalescing
+ */
+
+#include <OFStateManager/ofstatemanager_config.h>
+#include <OFConnectionManager/ofconnectionmanager.h>
+#include <indigo/indigo.h>
+#include <indigo/of_state_manager.h>
+#include <SocketManager/socketmanager.h>
+#include <AIM/aim_list.h>
+#include <BigHash/bighash.h>
+#include <loci/loci.h>
+
+#include "ofstatemanager_log.h"
+#include "listener.h"
+#include "port_status.h"
+
+/* Updates delivered to listeners and controllers at a time */
+#define PORT_STATUS_BATCH_MAX 64
+
+/* Dampening penalties */
+#define PORT_STATUS_PENALTY 1000
+#define PORT_STATUS_PENALTY_MAX 12000
+#define PORT_STATUS_SUPPRESS 3000
+#define PORT_STATUS_REUSE 750
+
+typedef struct port_status_state_s {
+    bighash_entry_t hash_entry;
+    of_port_no_t port_no;
+    list_links_t links;         /* pending_list, if pending != NULL */
+    of_port_status_t *pending;  /* Latest undelivered update */
+    uint32_t penalty;           /* As of penalty_time */
+    indigo_time_t penalty_time;
+    bool suppressed;
+} port_status_state_t;
+
+#define TEMPLATE_NAME port_status_hashtable
+#define TEMPLATE_OBJ_TYPE port_status_state_t
+#define TEMPLATE_KEY_FIELD port_no
+#define TEMPLATE_ENTRY_FIELD hash_entry
+#include <BigHash/bighash_template.h>
+
+static bighash_table_t *port_status_hashtable;
+static list_head_t pending_list;
+static int coalesce_ms;     /* 0 if disabled */
+static int half_life_ms;    /* 0 if dampening is disabled */
+
+static void
+port_status_deliver(of_port_status_t **port_statuses, int num_port_statuses)
+{
+    of_object_t *objs[PORT_STATUS_BATCH_MAX];
+    int num_objs = 0;
+    int i;
+
+    ind_core_port_status_batch_notify(port_statuses, num_port_statuses);
+
+    for (i = 0; i < num_port_statuses; i++) {
+        if (ind_core_port_status_notify(port_statuses[i]) == INDIGO_CORE_LISTENER_RESULT_DROP) {
+            LOG_TRACE("Listener dropped port status update");
+            of_object_delete(port_statuses[i]);
+        } else {
+            objs[num_objs++] = port_statuses[i];
+        }
+    }
+
+    if (num_objs == 1) {
+        indigo_cxn_send_async_message(objs[0]);
+    } else if (num_objs > 1) {
+        indigo_cxn_send_async_messages(objs, num_objs);
+    }
+}
+
+static of_port_no_t
+port_status_port_no(of_port_status_t *port_status)
+{
+    of_port_desc_t desc;
+    of_port_no_t port_no;
+
+    of_port_status_desc_bind(port_status, &desc);
+    of_port_desc_port_no_get(&desc, &port_no);
+
+    return port_no;
+}
+
+/* Decay the penalty by a half for each half-life since penalty_time */
+static uint32_t
+port_status_penalty(port_status_state_t *state, indigo_time_t now)
+{
+    while (state->penalty > 0 && now - state->penalty_time >= half_life_ms) {
+        state->penalty >>= 1;
+        state->penalty_time += half_life_ms;
+    }
+
+    if (state->penalty == 0) {
+        state->penalty_time = now;
+    }
+
+    return state->penalty;
+}
+
+static port_status_state_t *
+port_status_state_get(of_port_no_t port_no)
+{
+    port_status_state_t *state;
+
+    state = port_status_hashtable_first(port_status_hashtable, &port_no);
+    if (state == NULL) {
+        state = INDIGO_MEM_ALLOC(sizeof(*state));
+        AIM_TRUE_OR_DIE(state != NULL);
+        INDIGO_MEM_SET(state, 0, sizeof(*state));
+        state->port_no = port_no;
+        state->penalty_time = INDIGO_CURRENT_TIME;
+        port_status_hashtable_insert(port_status_hashtable, state);
+    }
+
+    return state;
+}
+
+/*
+ * Replace the port's pending update with a newer one
+ *
+ * Returns false if the two cancel out.
+ */
+static bool
+port_status_merge(port_status_state_t *state, of_port_status_t *port_status)
+{
+    uint8_t old_reason, new_reason;
+
+    if (state->pending == NULL) {
+        state->pending = port_status;
+        return true;
+    }
+
+    of_port_status_reason_get(state->pending, &old_reason);
+    of_port_status_reason_get(port_status, &new_reason);
+    of_object_delete(state->pending);
+    state->pending = port_status;
+
+    if (old_reason == OF_PORT_CHANGE_REASON_ADD) {
+        if (new_reason == OF_PORT_CHANGE_REASON_DELETE) {
+            /* Controllers never saw the port */
+            of_object_delete(port_status);
+            state->pending = NULL;
+            return false;
+        } else if (new_reason == OF_PORT_CHANGE_REASON_MODIFY) {
+            of_port_status_reason_set(port_status, OF_PORT_CHANGE_REASON_ADD);
+        }
+    } else if (old_reason == OF_PORT_CHANGE_REASON_DELETE &&
+               new_reason == OF_PORT_CHANGE_REASON_ADD) {
+        /* Controllers still know the port */
+        of_port_status_reason_set(port_status, OF_PORT_CHANGE_REASON_MODIFY);
+    }
+
+    return true;
+}
+
+void
+ind_core_port_status_add(of_port_status_t *port_status)
+{
+    port_status_state_t *state;
+    bool was_pending;
+
+    if (coalesce_ms == 0) {
+        port_status_deliver(&port_status, 1);
+        return;
+    }
+
+    state = port_status_state_get(port_status_port_no(port_status));
+    was_pending = state->pending != NULL;
+
+    if (half_life_ms > 0) {
+        uint32_t penalty = port_status_penalty(state, INDIGO_CURRENT_TIME);
+        penalty += PORT_STATUS_PENALTY;
+        if (penalty > PORT_STATUS_PENALTY_MAX) {
+            penalty = PORT_STATUS_PENALTY_MAX;
+        }
+        state->penalty = penalty;
+
+        if (!state->suppressed && penalty > PORT_STATUS_SUPPRESS) {
+            LOG_INFO("Suppressing port status updates for flapping port %u",
+                     state->port_no);
+            state->suppressed = true;
+        }
+    }
+
+    if (port_status_merge(state, port_status)) {
+        if (!was_pending) {
+            list_push(&pending_list, &state->links);
+        }
+    } else if (was_pending) {
+        list_remove(&state->links);
+    }
+}
+
+/*
+ * Deliver pending updates
+ *
+ * If force is false, updates for suppressed ports are held until the
+ * port's penalty decays.
+ */
+static void
+port_status_flush(bool force)
+{
+    of_port_status_t *batch[PORT_STATUS_BATCH_MAX];
+    int num_batch = 0;
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+    list_links_t *cur, *next;
+
+    LIST_FOREACH_SAFE(&pending_list, cur, next) {
+        port_status_state_t *state =
+            container_of(cur, links, port_status_state_t);
+
+        if (state->suppressed) {
+            if (!force && (half_life_ms > 0 &&
+                    port_status_penalty(state, now) >= PORT_STATUS_REUSE)) {
+                continue;
+            }
+            LOG_INFO("Reusing port status updates for port %u",
+                     state->port_no);
+            state->suppressed = false;
+        }
+
+        list_remove(&state->links);
+        batch[num_batch++] = state->pending;
+        state->pending = NULL;
+
+        if (num_batch == PORT_STATUS_BATCH_MAX) {
+            port_status_deliver(batch, num_batch);
+            num_batch = 0;
+        }
+    }
+
+    if (num_batch > 0) {
+        port_status_deliver(batch, num_batch);
+    }
+}
+
+static void
+port_status_timer(void *cookie)
+{
+    port_status_flush(false);
+}
+
+indigo_error_t
+ind_core_port_status_enable_set(int new_coalesce_ms, int new_half_life_ms)
+{
+    indigo_error_t rv = INDIGO_ERROR_NONE;
+
+    if (port_status_hashtable == NULL) {
+        port_status_hashtable = bighash_table_create(256);
+        AIM_TRUE_OR_DIE(port_status_hashtable != NULL);
+        list_init(&pending_list);
+    }
+
+    if (new_coalesce_ms == coalesce_ms) {
+        half_life_ms = new_coalesce_ms > 0 ? new_half_life_ms : 0;
+        return INDIGO_ERROR_NONE;
+    }
+
+    if (coalesce_ms > 0) {
+        ind_soc_timer_event_unregister(port_status_timer, NULL);
+    }
+
+    if (new_coalesce_ms > 0) {
+        rv = ind_soc_timer_event_register(port_status_timer, NULL,
+                                          new_coalesce_ms);
+        if (rv < 0) {
+            new_coalesce_ms = 0;
+        }
+    }
+
+    coalesce_ms = new_coalesce_ms;
+    half_life_ms = new_coalesce_ms > 0 ? new_half_life_ms : 0;
+
+    if (coalesce_ms == 0) {
+        port_status_flush(true);
+    }
+
+    return rv;
+}
+
+void
+ind_core_port_status_finish(void)
+{
+    port_status_state_t *state;
+    bighash_iter_t iter;
+
+    if (port_status_hashtable == NULL) {
+        return;
+    }
+
+    /* Deliver anything still held */
+    port_status_flush(true);
+
+    while ((state = bighash_iter_start(port_status_hashtable, &iter)) != NULL) {
+        bighash_remove(port_status_hashtable, &state->hash_entry);
+        INDIGO_MEM_FREE(state);
+    }
+
+    bighash_table_destroy(port_status_hashtable, NULL);
+    port_status_hashtable = NULL;
+}
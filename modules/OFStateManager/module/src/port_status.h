@@ -0,0 +1,68 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/**
+ * @file
+ * @brief Port status coalescing
+ *
+ * When ind_core_config_t.port_status_coalesce_ms is nonzero, port status
+ * updates are held for up to port_status_coalesce_ms and only the latest
+ * update for each port is delivered. An add followed by a modify is
+ * delivered as an add, an add followed by a delete is not delivered, and
+ * a delete followed by an add is delivered as a modify. Updates held at
+ * the same time are delivered together, to the port status batch
+ * listeners, the port status listeners and then the controllers.
+ *
+ * If port_status_dampening_half_life_ms is also nonzero, each update
+ * adds a penalty to its port that halves every half-life. A port whose
+ * penalty goes over the suppress threshold has its updates held until
+ * the penalty falls below the reuse threshold; the latest one is then
+ * delivered.
+ */
+
+#ifndef _OFSTATEMANAGER_PORT_STATUS_H_
+#define _OFSTATEMANAGER_PORT_STATUS_H_
+
+#include <indigo/indigo.h>
+#include <loci/loci.h>
+
+/**
+ * Handle a port status update from the port manager
+ *
+ * Takes ownership of port_status.
+ */
+void ind_core_port_status_add(of_port_status_t *port_status);
+
+/**
+ * Start or stop coalescing
+ * @param coalesce_ms Coalescing window; 0 delivers updates immediately
+ * @param half_life_ms Dampening half-life; 0 disables dampening
+ *
+ * Held updates are delivered when coalescing is stopped.
+ */
+indigo_error_t ind_core_port_status_enable_set(int coalesce_ms,
+                                               int half_life_ms);
+
+/**
+ * Free the per-port state
+ */
+void ind_core_port_status_finish(void);
+
+#endif /* _OFSTATEMANAGER_PORT_STATUS_H_ */
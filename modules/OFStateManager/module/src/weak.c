@@ -27,6 +27,7 @@
 #include <OFStateManager/ofstatemanager_config.h>
 #include <indigo/indigo.h>
 #include <indigo/forwarding.h>
+#include <indigo/port_manager.h>
 #include <loci/loci.h>
 
 #ifdef __GNUC__
@@ -45,6 +46,129 @@ indigo_fwd_vlan_stats_get(
     /* All counters default to -1 */
 }
 
+WEAK int
+indigo_fwd_vlan_stats_bulk_get(
+    uint16_t start_vid,
+    uint16_t *vlan_vids,
+    indigo_fi_vlan_stats_t *vlan_stats,
+    int max)
+{
+    int count = 0;
+    uint16_t vlan_vid;
+
+    for (vlan_vid = start_vid; vlan_vid < 4096 && count < max; vlan_vid++) {
+        vlan_vids[count] = vlan_vid;
+        indigo_fwd_vlan_stats_get(vlan_vid, &vlan_stats[count]);
+        count++;
+    }
+
+    return count;
+}
+
+WEAK indigo_error_t
+indigo_fwd_flow_batch_begin(void)
+{
+    return INDIGO_ERROR_NOT_SUPPORTED;
+}
+
+WEAK indigo_error_t
+indigo_fwd_flow_batch_create(
+    indigo_cookie_t flow_id,
+    of_flow_add_t *flow_add)
+{
+    return INDIGO_ERROR_NOT_SUPPORTED;
+}
+
+WEAK indigo_error_t
+indigo_fwd_flow_batch_modify(
+    indigo_cookie_t flow_id,
+    of_flow_modify_t *flow_modify)
+{
+    return INDIGO_ERROR_NOT_SUPPORTED;
+}
+
+WEAK void
+indigo_fwd_flow_batch_commit(
+    indigo_fwd_flow_batch_result_t *results,
+    int num_results)
+{
+}
+
+WEAK indigo_error_t
+indigo_fwd_flow_restore(
+    indigo_cookie_t flow_id,
+    of_flow_add_t *flow_add,
+    uint8_t *table_id)
+{
+    return indigo_fwd_flow_create(flow_id, flow_add, table_id);
+}
+
+WEAK void
+indigo_fwd_flow_restore_end(void)
+{
+}
+
+WEAK void
+indigo_fwd_flow_stats_bulk_get(
+    indigo_cookie_t *flow_ids,
+    int num_flows,
+    indigo_fi_flow_stats_t *flow_stats,
+    indigo_error_t *results)
+{
+    int i;
+
+    for (i = 0; i < num_flows; i++) {
+        flow_stats[i].flow_id = flow_ids[i];
+        results[i] = indigo_fwd_flow_stats_get(flow_ids[i], &flow_stats[i]);
+    }
+}
+
+WEAK void
+indigo_fwd_packet_out_batch(
+    of_packet_out_t **packet_outs,
+    int num_packet_outs)
+{
+    int i;
+
+    for (i = 0; i < num_packet_outs; i++) {
+        (void)indigo_fwd_packet_out(packet_outs[i]);
+    }
+}
+
+WEAK void
+indigo_fwd_group_stats_bulk_get(
+    uint32_t *ids,
+    int num_groups,
+    of_group_stats_entry_t **entries)
+{
+    int i;
+
+    for (i = 0; i < num_groups; i++) {
+        indigo_fwd_group_stats_get(ids[i], entries[i]);
+    }
+}
+
+WEAK indigo_error_t
+indigo_fwd_flow_hit_status_bulk_get(
+    indigo_cookie_t *flow_ids,
+    int num_flows,
+    uint8_t *hit_bitmap,
+    uint8_t *unread_bitmap)
+{
+    int i;
+
+    for (i = 0; i < num_flows; i++) {
+        bool hit;
+        if (indigo_fwd_flow_hit_status_get(flow_ids[i], &hit) < 0) {
+            unread_bitmap[i / 8] |= 1 << (i % 8);
+        } else if (hit) {
+            hit_bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
 WEAK void
 indigo_port_extended_stats_get(
     of_port_no_t port_no,
@@ -53,4 +177,34 @@ indigo_port_extended_stats_get(
     /* All counters default to -1 */
 }
 
+WEAK void
+indigo_port_extended_stats_bulk_get(
+    of_port_no_t *port_nos,
+    indigo_fi_port_stats_t *port_stats,
+    int num_ports)
+{
+    int i;
+
+    for (i = 0; i < num_ports; i++) {
+        indigo_port_extended_stats_get(port_nos[i], &port_stats[i]);
+    }
+}
+
+WEAK indigo_error_t
+indigo_port_stats_bulk_get(
+    of_port_no_t *port_nos,
+    indigo_port_stats_t *port_stats,
+    int num_ports)
+{
+    return INDIGO_ERROR_NOT_SUPPORTED;
+}
+
+WEAK indigo_error_t
+indigo_port_queue_stats_bulk_get(
+    indigo_port_queue_stats_t *queue_stats,
+    int *num_queues)
+{
+    return INDIGO_ERROR_NOT_SUPPORTED;
+}
+
 #endif
@@ -38,19 +38,28 @@
 #include <locitest/unittest.h>
 #include <locitest/test_common.h>
 #include <SocketManager/socketmanager.h>
+#include <AIM/aim_pvs_buffer.h>
 
 #define TABLE_ID 1
-#define NUM_ENTRIES 10
+#define NUM_ENTRIES 512
 
 extern void handle_message(of_object_t *obj);
 extern int do_barrier(void);
+extern void (*controller_message_hook)(of_object_t *obj);
 
 static void do_add(uint32_t port, of_mac_addr_t mac, uint8_t csum_hi);
 static void do_delete(uint32_t port);
 static void do_clear(void);
 static void do_entry_stats(void);
 static void do_set_buckets_size(uint32_t buckets_size);
+static int do_bucket_stats(uint32_t depth, of_checksum_128_t *checksums);
+
+/* Entries per port in the entry stats and desc stats replies */
+static int reply_entries[NUM_ENTRIES];
 static void parse_key(of_list_bsn_tlv_t *key, of_port_no_t *port);
+static void parse_value(of_list_bsn_tlv_t *value, of_mac_addr_t *mac);
+static void do_entry_desc_stats(void);
+static void entry_stats_reply_hook(of_object_t *obj);
 
 struct test_entry {
     of_mac_addr_t mac;
@@ -67,12 +76,20 @@ struct test_table {
     int count_modify;
     int count_delete;
     int count_stats;
+    int count_begin;
+    int count_commit;
+    int count_stats_batch;
+    int count_clear;
+    indigo_error_t add_error; /* Returned by the add op if set */
     struct test_entry entries[NUM_ENTRIES];
 };
 
 static struct test_table table;
 
 static indigo_core_gentable_ops_t test_ops;
+static indigo_core_gentable_ops_t test_batch_ops;
+static indigo_core_gentable_ops_t test_stats_batch_ops;
+static indigo_core_gentable_ops_t test_clear_ops;
 
 static const of_mac_addr_t mac1 = { { 0xab, 0xcd, 0xef, 0xff, 0xff, 0x01 } };
 static const of_mac_addr_t mac2 = { { 0xab, 0xcd, 0xef, 0xff, 0xff, 0x02 } };
@@ -233,6 +250,476 @@ test_gentable_entry_stats(void)
     return TEST_PASS;
 }
 
+/* The same operations on a gentable with inline keys and values */
+static int
+test_gentable_compact(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_ops, &table, 10, 8, &gentable);
+    indigo_core_gentable_compact_set(gentable, true);
+
+    do_add(1, mac1, 0);
+    do_add(2, mac2, 0);
+    AIM_TRUE_OR_DIE(table.count_add == 2);
+
+    memset(&table, 0, sizeof(table));
+    do_add(1, mac3, 0);
+    AIM_TRUE_OR_DIE(!memcmp(&table.entries[1].mac, &mac3, sizeof(of_mac_addr_t)));
+    AIM_TRUE_OR_DIE(table.entries[1].count_modify == 1);
+
+    memset(&table, 0, sizeof(table));
+    do_entry_stats();
+    AIM_TRUE_OR_DIE(table.entries[1].count_stats == 1);
+    AIM_TRUE_OR_DIE(table.entries[2].count_stats == 1);
+
+    memset(&table, 0, sizeof(table));
+    do_delete(1);
+    AIM_TRUE_OR_DIE(table.entries[1].count_delete == 1);
+    AIM_TRUE_OR_DIE(table.count_op == 1);
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_unregister(gentable);
+    AIM_TRUE_OR_DIE(table.entries[2].count_delete == 1);
+    AIM_TRUE_OR_DIE(table.count_op == 1);
+
+    return TEST_PASS;
+}
+
+/* Changes to a gentable with begin and commit ops are batched */
+static int
+test_gentable_batch(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_batch_ops, &table, 10, 8, &gentable);
+    AIM_TRUE_OR_DIE(table.count_begin == 0);
+
+    /* The barrier waits for the commit */
+    do_add(1, mac1, 0);
+    AIM_TRUE_OR_DIE(table.count_add == 1);
+    AIM_TRUE_OR_DIE(table.count_begin == 1);
+    AIM_TRUE_OR_DIE(table.count_commit == 1);
+
+    do_add(2, mac2, 0);
+    do_add(1, mac3, 0);
+    AIM_TRUE_OR_DIE(table.count_modify == 1);
+    AIM_TRUE_OR_DIE(table.count_begin == 3);
+    AIM_TRUE_OR_DIE(table.count_commit == 3);
+
+    memset(&table, 0, sizeof(table));
+    do_clear();
+    AIM_TRUE_OR_DIE(table.count_delete == 2);
+    AIM_TRUE_OR_DIE(table.count_begin == 1);
+    AIM_TRUE_OR_DIE(table.count_commit == 1);
+
+    do_add(1, mac1, 0);
+    do_add(2, mac2, 0);
+
+    /* Unregister deletes every entry in one batch */
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_unregister(gentable);
+    AIM_TRUE_OR_DIE(table.count_delete == 2);
+    AIM_TRUE_OR_DIE(table.count_begin == 1);
+    AIM_TRUE_OR_DIE(table.count_commit == 1);
+
+    return TEST_PASS;
+}
+
+/* Entry stats of a gentable with get_stats_batch are read in groups */
+static int
+test_gentable_stats_batch(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_stats_batch_ops, &table, 10, 8, &gentable);
+
+    /* Same checksum bucket */
+    do_add(1, mac1, 0);
+    do_add(2, mac2, 0);
+
+    memset(&table, 0, sizeof(table));
+    do_entry_stats();
+    AIM_TRUE_OR_DIE(table.entries[1].count_stats == 1);
+    AIM_TRUE_OR_DIE(table.entries[2].count_stats == 1);
+    AIM_TRUE_OR_DIE(table.count_stats_batch == 1);
+
+    indigo_core_gentable_unregister(gentable);
+
+    return TEST_PASS;
+}
+
+/* A full clear of a gentable with a clear op makes one call */
+static int
+test_gentable_bulk_clear(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_clear_ops, &table, 10, 8, &gentable);
+
+    do_add(1, mac1, 0);
+    do_add(2, mac2, 0x80);
+
+    memset(&table, 0, sizeof(table));
+    do_clear();
+    AIM_TRUE_OR_DIE(table.count_clear == 1);
+    AIM_TRUE_OR_DIE(table.count_op == 0);
+
+    /* The entries are gone, so this is an add */
+    do_add(1, mac1, 0);
+    AIM_TRUE_OR_DIE(table.count_add == 1);
+
+    memset(&table, 0, sizeof(table));
+    do_entry_stats();
+    AIM_TRUE_OR_DIE(table.count_stats == 1);
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_unregister(gentable);
+    AIM_TRUE_OR_DIE(table.count_clear == 1);
+    AIM_TRUE_OR_DIE(table.count_op == 0);
+
+    return TEST_PASS;
+}
+
+/* Entries saved to a checkpoint are added back on registration */
+static int
+test_gentable_checkpoint(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+    char path[] = "/tmp/gentable_checkpoint_XXXXXX";
+    int fd;
+
+    fd = mkstemp(path);
+    AIM_TRUE_OR_DIE(fd >= 0);
+    close(fd);
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_ops, &table, 10, 8, &gentable);
+    do_add(1, mac1, 0);
+    do_add(2, mac2, 0x80);
+    AIM_TRUE_OR_DIE(indigo_core_gentable_checkpoint_save(path) == INDIGO_ERROR_NONE);
+    indigo_core_gentable_unregister(gentable);
+
+    AIM_TRUE_OR_DIE(indigo_core_gentable_checkpoint_load(path) == INDIGO_ERROR_NONE);
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_ops, &table, 10, 8, &gentable);
+    indigo_core_gentable_checkpoint_release();
+    AIM_TRUE_OR_DIE(table.count_add == 2);
+    AIM_TRUE_OR_DIE(!memcmp(&table.entries[1].mac, &mac1, sizeof(of_mac_addr_t)));
+    AIM_TRUE_OR_DIE(!memcmp(&table.entries[2].mac, &mac2, sizeof(of_mac_addr_t)));
+
+    /* The restored entries are known by key */
+    memset(&table, 0, sizeof(table));
+    do_add(1, mac3, 0);
+    AIM_TRUE_OR_DIE(table.count_modify == 1);
+
+    indigo_core_gentable_unregister(gentable);
+    unlink(path);
+
+    return TEST_PASS;
+}
+
+static void
+count_index_match(void *cookie, of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *value,
+                  void *entry_priv)
+{
+    (*(int *)cookie)++;
+}
+
+static int
+count_mac(indigo_core_gentable_t *gentable, of_mac_addr_t mac)
+{
+    int count = 0;
+    of_object_t *tlv = of_bsn_tlv_mac_new(OF_VERSION_1_3);
+    of_bsn_tlv_mac_value_set(tlv, mac);
+    AIM_TRUE_OR_DIE(indigo_core_gentable_index_iter(
+        gentable, tlv, count_index_match, &count) == INDIGO_ERROR_NONE);
+    of_object_delete(tlv);
+    return count;
+}
+
+/* A secondary index on the value's MAC follows adds, modifies and deletes */
+static int
+test_gentable_index(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_ops, &table, 10, 8, &gentable);
+
+    do_add(1, mac1, 0);
+    AIM_TRUE_OR_DIE(indigo_core_gentable_index_add(gentable, OF_BSN_TLV_MAC) == INDIGO_ERROR_NONE);
+    do_add(2, mac2, 0);
+    do_add(3, mac1, 0);
+    AIM_TRUE_OR_DIE(count_mac(gentable, mac1) == 2);
+    AIM_TRUE_OR_DIE(count_mac(gentable, mac2) == 1);
+    AIM_TRUE_OR_DIE(count_mac(gentable, mac3) == 0);
+
+    do_add(3, mac2, 0);
+    AIM_TRUE_OR_DIE(count_mac(gentable, mac1) == 1);
+    AIM_TRUE_OR_DIE(count_mac(gentable, mac2) == 2);
+
+    do_delete(1);
+    AIM_TRUE_OR_DIE(count_mac(gentable, mac1) == 0);
+
+    indigo_core_gentable_unregister(gentable);
+
+    return TEST_PASS;
+}
+
+/*
+ * Enough entries to grow the key hashtable twice and shrink it again;
+ * every entry stays reachable while buckets are being moved
+ */
+static int
+test_gentable_key_resize(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+    int num_entries = 300;
+    int i;
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_ops, &table, 10, 8, &gentable);
+
+    for (i = 0; i < num_entries; i++) {
+        do_add(i, mac1, 0);
+    }
+    AIM_TRUE_OR_DIE(table.count_add == num_entries);
+
+    /* Re-adds find the existing entries */
+    memset(&table, 0, sizeof(table));
+    for (i = 0; i < num_entries; i++) {
+        do_add(i, mac2, 0);
+    }
+    AIM_TRUE_OR_DIE(table.count_modify == num_entries);
+    AIM_TRUE_OR_DIE(table.count_add == 0);
+
+    memset(&table, 0, sizeof(table));
+    do_entry_stats();
+    AIM_TRUE_OR_DIE(table.count_stats == num_entries);
+
+    memset(&table, 0, sizeof(table));
+    for (i = num_entries - 1; i >= 10; i--) {
+        do_delete(i);
+    }
+    AIM_TRUE_OR_DIE(table.count_delete == num_entries - 10);
+
+    /* The survivors are still found after shrinking */
+    memset(&table, 0, sizeof(table));
+    for (i = 0; i < 10; i++) {
+        do_add(i, mac3, 0);
+        AIM_TRUE_OR_DIE(table.entries[i].count_modify == 1);
+    }
+    AIM_TRUE_OR_DIE(table.count_add == 0);
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_unregister(gentable);
+    AIM_TRUE_OR_DIE(table.count_delete == 10);
+
+    return TEST_PASS;
+}
+
+#define CHECKSUM_LO 0xFFEECCBBAA998877L
+
+/* Check a bucket or tree node checksum for the XOR of entries' csum_hi */
+static void
+check_checksum(of_checksum_128_t *checksum, uint8_t csum_hi, int num_entries)
+{
+    AIM_TRUE_OR_DIE(checksum->hi == (uint64_t)csum_hi << 56);
+    AIM_TRUE_OR_DIE(checksum->lo == (num_entries % 2 ? CHECKSUM_LO : 0));
+}
+
+/* Bucket stats at a tree depth are the XOR of the buckets below */
+static int
+test_gentable_checksum_tree(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+    of_checksum_128_t checksums[8];
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_ops, &table, 10, 8, &gentable);
+
+    /* With 8 buckets, csum_hi selects bucket csum_hi >> 5 */
+    do_add(1, mac1, 1 << 5);
+    do_add(2, mac1, 2 << 5);
+    do_add(3, mac1, 5 << 5);
+
+    AIM_TRUE_OR_DIE(do_bucket_stats(0, checksums) == 8);
+    check_checksum(&checksums[0], 0, 0);
+    check_checksum(&checksums[1], 1 << 5, 1);
+    check_checksum(&checksums[2], 2 << 5, 1);
+    check_checksum(&checksums[5], 5 << 5, 1);
+    AIM_TRUE_OR_DIE(do_bucket_stats(3, checksums) == 8);
+    AIM_TRUE_OR_DIE(do_bucket_stats(5, checksums) == 8);
+
+    AIM_TRUE_OR_DIE(do_bucket_stats(1, checksums) == 2);
+    check_checksum(&checksums[0], 3 << 5, 2);
+    check_checksum(&checksums[1], 5 << 5, 1);
+
+    AIM_TRUE_OR_DIE(do_bucket_stats(2, checksums) == 4);
+    check_checksum(&checksums[0], 1 << 5, 1);
+    check_checksum(&checksums[1], 2 << 5, 1);
+    check_checksum(&checksums[2], 5 << 5, 1);
+    check_checksum(&checksums[3], 0, 0);
+
+    /* Deletes update the nodes above the bucket */
+    do_delete(2);
+    AIM_TRUE_OR_DIE(do_bucket_stats(1, checksums) == 2);
+    check_checksum(&checksums[0], 1 << 5, 1);
+    check_checksum(&checksums[1], 5 << 5, 1);
+
+    /* The tree is rebuilt when the buckets are resized */
+    do_set_buckets_size(4);
+    do_barrier();
+    AIM_TRUE_OR_DIE(do_bucket_stats(1, checksums) == 2);
+    check_checksum(&checksums[0], 1 << 5, 1);
+    check_checksum(&checksums[1], 5 << 5, 1);
+    AIM_TRUE_OR_DIE(do_bucket_stats(2, checksums) == 4);
+
+    indigo_core_gentable_unregister(gentable);
+
+    return TEST_PASS;
+}
+
+/*
+ * Stats entry objects are reused across entries: each reply entry must
+ * carry only its own key, value and stats
+ */
+static int
+check_entry_stats_replies(const indigo_core_gentable_ops_t *ops)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+    int num_entries = 200;
+    int i;
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, ops, &table, 10, 8, &gentable);
+
+    for (i = 0; i < num_entries; i++) {
+        of_mac_addr_t mac = mac1;
+        mac.addr[5] = i;
+        do_add(i, mac, i);
+    }
+
+    memset(&table, 0, sizeof(table));
+    memset(reply_entries, 0, sizeof(reply_entries));
+    controller_message_hook = entry_stats_reply_hook;
+    do_entry_stats();
+    AIM_TRUE_OR_DIE(table.count_stats == num_entries);
+    for (i = 0; i < num_entries; i++) {
+        AIM_TRUE_OR_DIE(reply_entries[i] == 1);
+    }
+
+    memset(reply_entries, 0, sizeof(reply_entries));
+    do_entry_desc_stats();
+    controller_message_hook = NULL;
+    for (i = 0; i < num_entries; i++) {
+        AIM_TRUE_OR_DIE(reply_entries[i] == 1);
+    }
+
+    indigo_core_gentable_unregister(gentable);
+
+    return TEST_PASS;
+}
+
+static int
+test_gentable_stats_reuse(void)
+{
+    TEST_ASSERT(check_entry_stats_replies(&test_ops) == TEST_PASS);
+    TEST_ASSERT(check_entry_stats_replies(&test_stats_batch_ops) == TEST_PASS);
+    return TEST_PASS;
+}
+
+/* Check that the gentable stats show a line */
+static void
+check_stats_line(const char *shown, const char *line)
+{
+    if (strstr(shown, line) == NULL) {
+        AIM_DIE("Missing \"%s\" in gentable stats:\n%s", line, shown);
+    }
+}
+
+/* Operations, failures and resync traffic are counted per gentable */
+static int
+test_gentable_op_stats(void)
+{
+    indigo_core_gentable_t *gentable;
+    of_table_name_t name = "gentable 0";
+    of_checksum_128_t checksums[8];
+    char failures[64];
+    aim_pvs_t *pvs;
+    char *shown;
+
+    memset(&table, 0, sizeof(table));
+    indigo_core_gentable_register(name, &test_ops, &table, 10, 8, &gentable);
+    ind_core_gentable_stats_clear();
+
+    do_add(1, mac1, 0);
+    do_add(2, mac2, 0);
+    do_add(1, mac3, 0);
+    do_delete(2);
+
+    table.add_error = INDIGO_ERROR_RESOURCE;
+    do_add(3, mac1, 0);
+    table.add_error = INDIGO_ERROR_NONE;
+
+    do_clear();
+    do_add(1, mac1, 0);
+    do_add(2, mac2, 0);
+    do_entry_stats();
+    do_entry_desc_stats();
+    AIM_TRUE_OR_DIE(do_bucket_stats(0, checksums) == 8);
+
+    pvs = aim_pvs_buffer_create();
+    ind_core_gentable_stats_show(pvs);
+    shown = aim_pvs_buffer_get(pvs);
+
+    check_stats_line(shown, "Gentable gentable 0");
+    check_stats_line(shown, "Entries:               2\n");
+    check_stats_line(shown, "Adds:                  4\n");
+    check_stats_line(shown, "Modifies:              1\n");
+    check_stats_line(shown, "Deletes:               2\n");
+    snprintf(failures, sizeof(failures), "Failures (%s): 1\n",
+             indigo_strerror(INDIGO_ERROR_RESOURCE));
+    check_stats_line(shown, failures);
+    check_stats_line(shown, "Clear requests:        1\n");
+    check_stats_line(shown, "Bucket stats requests: 1\n");
+    check_stats_line(shown, "Desc stats entries:    2\n");
+    check_stats_line(shown, "Stats entries:         2\n");
+    /* The failed add is timed too */
+    check_stats_line(shown, "add: count 5,");
+    check_stats_line(shown, "modify: count 1,");
+    check_stats_line(shown, "delete: count 2,");
+    aim_free(shown);
+
+    /* Cleared stats start again from zero */
+    ind_core_gentable_stats_clear();
+    aim_pvs_buffer_reset(pvs);
+    ind_core_gentable_stats_show(pvs);
+    shown = aim_pvs_buffer_get(pvs);
+    check_stats_line(shown, "Adds:                  0\n");
+    check_stats_line(shown, "add: count 0,");
+    aim_free(shown);
+    aim_pvs_destroy(pvs);
+
+    indigo_core_gentable_unregister(gentable);
+
+    return TEST_PASS;
+}
+
 static int
 test_gentable_long_running_task(void)
 {
@@ -310,6 +797,16 @@ test_gentable(void)
     RUN_TEST(gentable_entry_modify);
     RUN_TEST(gentable_clear);
     RUN_TEST(gentable_entry_stats);
+    RUN_TEST(gentable_compact);
+    RUN_TEST(gentable_batch);
+    RUN_TEST(gentable_stats_batch);
+    RUN_TEST(gentable_bulk_clear);
+    RUN_TEST(gentable_checkpoint);
+    RUN_TEST(gentable_index);
+    RUN_TEST(gentable_key_resize);
+    RUN_TEST(gentable_checksum_tree);
+    RUN_TEST(gentable_stats_reuse);
+    RUN_TEST(gentable_op_stats);
     RUN_TEST(gentable_long_running_task);
     return TEST_PASS;
 }
@@ -324,7 +821,7 @@ do_add(uint32_t port, of_mac_addr_t mac, uint8_t csum_hi)
     of_bsn_gentable_entry_add_xid_set(obj, 0x12345678);
     of_bsn_gentable_entry_add_table_id_set(obj, TABLE_ID);
     {
-        of_checksum_128_t checksum = { (uint64_t)csum_hi << 56, 0xFFEECCBBAA998877L };
+        of_checksum_128_t checksum = { (uint64_t)csum_hi << 56, CHECKSUM_LO };
         of_bsn_gentable_entry_add_checksum_set(obj, checksum);
     }
     {
@@ -408,6 +905,21 @@ do_entry_stats()
     do_barrier();
 }
 
+static void
+do_entry_desc_stats()
+{
+    of_object_t *obj = of_bsn_gentable_entry_desc_stats_request_new(OF_VERSION_1_3);
+    of_bsn_gentable_entry_desc_stats_request_xid_set(obj, 0x12345678);
+    of_bsn_gentable_entry_desc_stats_request_table_id_set(obj, TABLE_ID);
+    {
+        of_checksum_128_t checksum = { 0x0, 0x0 };
+        of_bsn_gentable_entry_desc_stats_request_checksum_set(obj, checksum);
+        of_bsn_gentable_entry_desc_stats_request_checksum_mask_set(obj, checksum);
+    }
+    handle_message(obj);
+    do_barrier();
+}
+
 static void
 do_set_buckets_size(uint32_t buckets_size)
 {
@@ -423,6 +935,94 @@ do_set_buckets_size(uint32_t buckets_size)
 }
 
 
+/* Checksums from the bucket stats replies, for do_bucket_stats */
+static of_checksum_128_t *bucket_stats_checksums;
+static int bucket_stats_count;
+
+static void
+bucket_stats_reply_hook(of_object_t *obj)
+{
+    of_list_bsn_gentable_bucket_stats_entry_t list;
+    of_bsn_gentable_bucket_stats_entry_t entry;
+    int rv;
+
+    if (obj->object_id != OF_BSN_GENTABLE_BUCKET_STATS_REPLY) {
+        return;
+    }
+
+    of_bsn_gentable_bucket_stats_reply_entries_bind(obj, &list);
+    OF_LIST_BSN_GENTABLE_BUCKET_STATS_ENTRY_ITER(&list, &entry, rv) {
+        if (bucket_stats_count < 8) {
+            of_bsn_gentable_bucket_stats_entry_checksum_get(
+                &entry, &bucket_stats_checksums[bucket_stats_count]);
+        }
+        bucket_stats_count++;
+    }
+}
+
+/* Request bucket stats at a tree depth; return the number of checksums */
+static int
+do_bucket_stats(uint32_t depth, of_checksum_128_t *checksums)
+{
+    of_object_t *obj = of_bsn_gentable_bucket_stats_request_new(OF_VERSION_1_3);
+    of_bsn_gentable_bucket_stats_request_xid_set(obj, 0x12345678);
+    of_bsn_gentable_bucket_stats_request_table_id_set(obj, TABLE_ID);
+    of_bsn_gentable_bucket_stats_request_flags_set(
+        obj, depth << INDIGO_CORE_GENTABLE_BUCKET_STATS_REQ_BSN_DEPTH_SHIFT);
+
+    bucket_stats_checksums = checksums;
+    bucket_stats_count = 0;
+    controller_message_hook = bucket_stats_reply_hook;
+    handle_message(obj);
+    do_barrier();
+    controller_message_hook = NULL;
+
+    return bucket_stats_count;
+}
+
+/* Check each entry in an entry stats or desc stats reply against the table */
+static void
+entry_stats_reply_hook(of_object_t *obj)
+{
+    of_list_bsn_tlv_t key, list;
+    of_bsn_tlv_t tlv;
+    of_port_no_t port;
+    of_mac_addr_t mac;
+    int count, rv, loop_rv;
+
+    if (obj->object_id == OF_BSN_GENTABLE_ENTRY_STATS_REPLY) {
+        of_list_bsn_gentable_entry_stats_entry_t entries;
+        of_bsn_gentable_entry_stats_entry_t entry;
+        of_bsn_gentable_entry_stats_reply_entries_bind(obj, &entries);
+        OF_LIST_BSN_GENTABLE_ENTRY_STATS_ENTRY_ITER(&entries, &entry, rv) {
+            of_bsn_gentable_entry_stats_entry_key_bind(&entry, &key);
+            of_bsn_gentable_entry_stats_entry_stats_bind(&entry, &list);
+            parse_key(&key, &port);
+            AIM_TRUE_OR_DIE(port < NUM_ENTRIES);
+            count = 0;
+            OF_LIST_BSN_TLV_ITER(&list, &tlv, loop_rv) {
+                count++;
+            }
+            /* rx_packets and tx_packets from test_gentable_get_stats */
+            AIM_TRUE_OR_DIE(count == 2);
+            reply_entries[port]++;
+        }
+    } else if (obj->object_id == OF_BSN_GENTABLE_ENTRY_DESC_STATS_REPLY) {
+        of_list_bsn_gentable_entry_desc_stats_entry_t entries;
+        of_bsn_gentable_entry_desc_stats_entry_t entry;
+        of_bsn_gentable_entry_desc_stats_reply_entries_bind(obj, &entries);
+        OF_LIST_BSN_GENTABLE_ENTRY_DESC_STATS_ENTRY_ITER(&entries, &entry, rv) {
+            of_bsn_gentable_entry_desc_stats_entry_key_bind(&entry, &key);
+            of_bsn_gentable_entry_desc_stats_entry_value_bind(&entry, &list);
+            parse_key(&key, &port);
+            AIM_TRUE_OR_DIE(port < NUM_ENTRIES);
+            parse_value(&list, &mac);
+            AIM_TRUE_OR_DIE(mac.addr[5] == (uint8_t)port);
+            reply_entries[port]++;
+        }
+    }
+}
+
 /* Table operations */
 
 static void
@@ -468,6 +1068,10 @@ test_gentable_add(void *table_priv, of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *v
 {
     struct test_table *table = table_priv;
 
+    if (table->add_error != INDIGO_ERROR_NONE) {
+        return table->add_error;
+    }
+
     of_port_no_t port;
     parse_key(key, &port);
 
@@ -577,3 +1181,70 @@ static indigo_core_gentable_ops_t test_ops = {
     test_gentable_delete,
     test_gentable_get_stats,
 };
+
+static void
+test_gentable_begin(void *table_priv)
+{
+    struct test_table *table = table_priv;
+    AIM_TRUE_OR_DIE(table->count_begin == table->count_commit);
+    table->count_begin++;
+}
+
+static void
+test_gentable_commit(void *table_priv)
+{
+    struct test_table *table = table_priv;
+    AIM_TRUE_OR_DIE(table->count_begin == table->count_commit + 1);
+    table->count_commit++;
+}
+
+static indigo_core_gentable_ops_t test_batch_ops = {
+    test_gentable_add,
+    test_gentable_modify,
+    test_gentable_delete,
+    test_gentable_get_stats,
+    test_gentable_begin,
+    test_gentable_commit,
+};
+
+static void
+test_gentable_get_stats_batch(void *table_priv, int num_entries, void **entry_privs, of_list_bsn_tlv_t **keys, of_list_bsn_tlv_t **stats)
+{
+    struct test_table *table = table_priv;
+    int i;
+
+    for (i = 0; i < num_entries; i++) {
+        test_gentable_get_stats(table_priv, entry_privs[i], keys[i], stats[i]);
+    }
+
+    table->count_stats_batch++;
+}
+
+static indigo_core_gentable_ops_t test_stats_batch_ops = {
+    test_gentable_add,
+    test_gentable_modify,
+    test_gentable_delete,
+    test_gentable_get_stats,
+    NULL,
+    NULL,
+    test_gentable_get_stats_batch,
+};
+
+static indigo_error_t
+test_gentable_clear_all(void *table_priv)
+{
+    struct test_table *table = table_priv;
+    table->count_clear++;
+    return INDIGO_ERROR_NONE;
+}
+
+static indigo_core_gentable_ops_t test_clear_ops = {
+    test_gentable_add,
+    test_gentable_modify,
+    test_gentable_delete,
+    test_gentable_get_stats,
+    NULL,
+    NULL,
+    NULL,
+    test_gentable_clear_all,
+};
@@ -38,7 +38,13 @@
 #include <string.h>
 
 #include <unistd.h>
+#include <pthread.h>
 #include <ft.h>
+#include <port_status.h>
+#include <driver_stats.h>
+#include <flow_stats_worker.h>
+#include <counter_cache.h>
+#include <expiration.h>
 
 #include <loci/loci.h>
 #include <locitest/unittest.h>
@@ -90,6 +96,10 @@ indigo_fwd_flow_modify(indigo_cookie_t flow_id,
 
 indigo_error_t create_error = INDIGO_ERROR_NONE;
 
+/* Creates complete asynchronously when set */
+static int fwd_async_enabled;
+static indigo_cookie_t fwd_async_flow_id;
+
 #define CHECK_FLOW_COUNT(status, count) \
    if (create_error == INDIGO_ERROR_NONE) \
        TEST_ASSERT((status)->current_count == (count))
@@ -101,15 +111,93 @@ indigo_fwd_flow_create(indigo_cookie_t flow_id,
 {
     AIM_LOG_VERBOSE("flow create called\n");
     *table_id = 0;
+    if (fwd_async_enabled) {
+        fwd_async_flow_id = flow_id;
+        return INDIGO_ERROR_PENDING;
+    }
+    return INDIGO_ERROR_NONE;
+}
+
+/* Flows handed back to Forwarding by a checkpoint restore */
+static int fwd_restore_calls;
+static int fwd_restore_end_calls;
+
+indigo_error_t
+indigo_fwd_flow_restore(indigo_cookie_t flow_id,
+                        of_flow_add_t *flow_add,
+                        uint8_t *table_id)
+{
+    AIM_LOG_VERBOSE("flow restore called\n");
+    fwd_restore_calls++;
+    *table_id = 0;
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_fwd_flow_restore_end(void)
+{
+    fwd_restore_end_calls++;
+}
+
+
+/* Batch support, off unless a test turns it on */
+static int fwd_batch_enabled;
+static int fwd_batch_ops;
+static int fwd_batch_commits;
+
+indigo_error_t
+indigo_fwd_flow_batch_begin(void)
+{
+    if (!fwd_batch_enabled) {
+        return INDIGO_ERROR_NOT_SUPPORTED;
+    }
+    AIM_LOG_VERBOSE("flow batch begin called\n");
+    assert(fwd_batch_ops == 0);
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_flow_batch_create(indigo_cookie_t flow_id,
+                             of_flow_add_t *flow_add)
+{
+    AIM_LOG_VERBOSE("flow batch create called\n");
+    fwd_batch_ops++;
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_flow_batch_modify(indigo_cookie_t flow_id,
+                             of_flow_modify_t *flow_modify)
+{
+    AIM_LOG_VERBOSE("flow batch modify called\n");
+    fwd_batch_ops++;
     return INDIGO_ERROR_NONE;
 }
 
+void
+indigo_fwd_flow_batch_commit(indigo_fwd_flow_batch_result_t *results,
+                             int num_results)
+{
+    int i;
+
+    AIM_LOG_VERBOSE("flow batch commit called\n");
+    assert(num_results == fwd_batch_ops);
+    for (i = 0; i < num_results; i++) {
+        results[i].status = INDIGO_ERROR_NONE;
+        results[i].table_id = 0;
+    }
+    fwd_batch_ops = 0;
+    fwd_batch_commits++;
+}
+
+static int fwd_table_stats_calls;
 
 indigo_error_t
 indigo_fwd_table_stats_get(of_table_stats_request_t *request,
                            of_table_stats_reply_t **reply)
 {
     AIM_LOG_VERBOSE("table stats get called\n");
+    fwd_table_stats_calls++;
     *reply = of_table_stats_reply_new(request->version);
     return INDIGO_ERROR_NONE;
 }
@@ -125,12 +213,17 @@ indigo_fwd_flow_delete(indigo_cookie_t flow_id,
     return INDIGO_ERROR_NONE;
 }
 
+/* Packet count reported for every flow */
+static uint64_t fwd_flow_packets;
+
 indigo_error_t indigo_fwd_flow_stats_get(
     indigo_cookie_t flow_id,
     indigo_fi_flow_stats_t *flow_stats)
 {
     AIM_LOG_VERBOSE("flow stats get called\n");
     memset(flow_stats, 0, sizeof(*flow_stats));
+    flow_stats->flow_id = flow_id;
+    flow_stats->packets = fwd_flow_packets;
     return INDIGO_ERROR_NONE;
 }
 
@@ -150,6 +243,18 @@ indigo_fwd_packet_out(of_packet_out_t *of_packet_out)
     return INDIGO_ERROR_NONE;
 }
 
+static int fwd_packet_out_batches;
+static int fwd_packet_outs;
+
+void
+indigo_fwd_packet_out_batch(of_packet_out_t **packet_outs,
+                            int num_packet_outs)
+{
+    AIM_LOG_VERBOSE("packet out batch of %d called\n", num_packet_outs);
+    fwd_packet_out_batches++;
+    fwd_packet_outs += num_packet_outs;
+}
+
 indigo_error_t
 indigo_port_features_get(of_features_reply_t *features)
 {
@@ -182,12 +287,71 @@ indigo_cxn_send_error_reply(indigo_cxn_id_t cxn_id, of_object_t *orig,
 
 static int controller_message_counters[OF_MESSAGE_OBJECT_COUNT];
 
+/* Entries in the flow stats replies sent */
+static int flow_stats_reply_entries;
+
+/* Flags of the last flow stats reply sent */
+static uint16_t flow_stats_reply_flags;
+
+static void
+flow_stats_reply_count_entries(of_flow_stats_reply_t *reply)
+{
+    of_list_flow_stats_entry_t list;
+    of_flow_stats_entry_t entry;
+    int rv;
+
+    of_flow_stats_reply_entries_bind(reply, &list);
+    OF_LIST_FLOW_STATS_ENTRY_ITER(&list, &entry, rv) {
+        flow_stats_reply_entries++;
+    }
+}
+
+/* Counts from the last aggregate stats reply sent */
+static uint64_t aggregate_stats_reply_packets;
+static uint32_t aggregate_stats_reply_flows;
+
+/* Flow updates by ofp_flow_update_event in the flow monitor replies sent */
+static int flow_monitor_events[8];
+
+static void
+flow_monitor_reply_count_events(of_object_t *reply)
+{
+    uint8_t *data = OF_OBJECT_BUFFER_INDEX(reply, 0);
+    int offset = 16; /* ofp_multipart_reply */
+    int len, event;
+
+    while (offset + 4 <= reply->length) {
+        len = (data[offset] << 8) | data[offset + 1];
+        event = (data[offset + 2] << 8) | data[offset + 3];
+        assert(len >= 8 && event < 8);
+        flow_monitor_events[event]++;
+        offset += len;
+    }
+}
+
+/* If set, called with each message sent to a controller; see gentable_test.c */
+void (*controller_message_hook)(of_object_t *obj);
+
 void
 indigo_cxn_send_controller_message(indigo_cxn_id_t cxn_id, of_object_t *obj)
 {
     AIM_LOG_VERBOSE("Send msg called for cxn id %d, obj type %d\n",
                       cxn_id, obj->object_id);
     controller_message_counters[obj->object_id]++;
+    if (controller_message_hook != NULL) {
+        controller_message_hook(obj);
+    }
+    if (obj->object_id == OF_FLOW_STATS_REPLY) {
+        flow_stats_reply_count_entries(obj);
+        of_flow_stats_reply_flags_get(obj, &flow_stats_reply_flags);
+    } else if (obj->object_id == OF_FLOW_MONITOR_REPLY) {
+        flow_monitor_reply_count_events(obj);
+    } else if (obj->object_id == OF_AGGREGATE_STATS_REPLY) {
+        of_aggregate_stats_reply_packet_count_get(
+            obj, &aggregate_stats_reply_packets);
+        of_aggregate_stats_reply_flow_count_get(
+            obj, &aggregate_stats_reply_flows);
+    }
     of_object_delete(obj);
 }
 
@@ -202,6 +366,53 @@ indigo_cxn_send_async_message(of_object_t *obj)
     of_object_delete(obj);
 }
 
+indigo_error_t
+indigo_cxn_status_change_register(indigo_cxn_status_change_f handler,
+                                  void *cookie)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_cxn_status_change_unregister(indigo_cxn_status_change_f handler,
+                                    void *cookie)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_cxn_send_async_messages(of_object_t **objs, int num_objs)
+{
+    int i;
+
+    for (i = 0; i < num_objs; i++) {
+        indigo_cxn_send_async_message(objs[i]);
+    }
+}
+
+/* Set to make every connection's output look blocked */
+static int cxn_output_blocked;
+static indigo_cxn_output_ready_f cxn_output_ready;
+static void *cxn_output_ready_cookie;
+
+int
+indigo_cxn_output_blocked(indigo_cxn_id_t cxn_id)
+{
+    return cxn_output_blocked;
+}
+
+indigo_error_t
+indigo_cxn_output_wait(indigo_cxn_id_t cxn_id,
+                       indigo_cxn_output_ready_f callback, void *cookie)
+{
+    if (!cxn_output_blocked) {
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+    cxn_output_ready = callback;
+    cxn_output_ready_cookie = cookie;
+    return INDIGO_ERROR_NONE;
+}
+
 indigo_error_t
 indigo_cxn_get_async_version(of_version_t *ver)
 {
@@ -232,6 +443,22 @@ indigo_port_stats_get(of_port_stats_request_t *request,
     return INDIGO_ERROR_NONE;
 }
 
+static int port_stats_bulk_calls;
+
+indigo_error_t
+indigo_port_stats_bulk_get(of_port_no_t *port_nos,
+                           indigo_port_stats_t *port_stats,
+                           int num_ports)
+{
+    int i;
+
+    port_stats_bulk_calls++;
+    for (i = 0; i < num_ports; i++) {
+        port_stats[i].rx_packets = port_nos[i];
+    }
+    return INDIGO_ERROR_NONE;
+}
+
 indigo_error_t
 indigo_port_queue_config_get(of_queue_get_config_request_t *request,
                              of_queue_get_config_reply_t **reply_ptr)
@@ -269,10 +496,15 @@ indigo_fwd_experimenter(of_experimenter_t *experimenter,
     return INDIGO_ERROR_NONE;
 }
 
+static indigo_port_info_t test_ports[] = {
+    { .next = &test_ports[1], .port_name = "eth2", .of_port = 2 },
+    { .next = NULL, .port_name = "eth1", .of_port = 1 },
+};
+
 indigo_error_t
 indigo_port_interface_list(indigo_port_info_t **list)
 {
-    *list = NULL;
+    *list = test_ports;
     return INDIGO_ERROR_NONE;
 }
 
@@ -306,7 +538,7 @@ indigo_error_t indigo_port_desc_stats_get(
 indigo_error_t
 indigo_fwd_group_add(uint32_t id, uint8_t group_type, of_list_bucket_t *buckets)
 {
-    return INDIGO_ERROR_NOT_SUPPORTED;
+    return INDIGO_ERROR_NONE;
 }
 
 indigo_error_t
@@ -320,9 +552,20 @@ indigo_fwd_group_delete(uint32_t id)
 {
 }
 
+static int fwd_group_stats_entries;
+static int fwd_vlan_stats_calls;
+
+void
+indigo_fwd_vlan_stats_get(uint16_t vlan_vid, indigo_fi_vlan_stats_t *vlan_stats)
+{
+    fwd_vlan_stats_calls++;
+    vlan_stats->rx_packets = vlan_vid;
+}
+
 void
 indigo_fwd_group_stats_get(uint32_t id, of_group_stats_entry_t *entry)
 {
+    fwd_group_stats_entries++;
 }
 
 void
@@ -406,13 +649,15 @@ depopulate_table(ft_instance_t ft)
 {
     int idx;
     ft_entry_t *entry;
+    of_match_t match;
     int count;
 
     count = ft->status.current_count;
     for (idx = 0; idx < count; ++idx) {
         entry = ft_lookup(ft, TEST_KEY(idx));
         TEST_ASSERT(entry != NULL);
-        TEST_ASSERT(entry->match.fields.eth_type == TEST_ETH_TYPE(idx));
+        ft_entry_match_get(entry, &match);
+        TEST_ASSERT(match.fields.eth_type == TEST_ETH_TYPE(idx));
         ft_delete(ft, entry);
         TEST_ASSERT(check_table_entry_states(ft) == 0);
     }
@@ -420,6 +665,24 @@ depopulate_table(ft_instance_t ft)
     return 0;
 }
 
+static int
+hash_entry_count(ft_hash_t *hash)
+{
+    int count = 0;
+    int idx;
+
+    for (idx = 0; idx < hash->bucket_count; idx++) {
+        count += list_length(&hash->buckets[idx]);
+    }
+    if (hash->old_buckets != NULL) {
+        for (idx = hash->rehash_idx; idx < hash->old_bucket_count; idx++) {
+            count += list_length(&hash->old_buckets[idx]);
+        }
+    }
+
+    return count;
+}
+
 static int
 check_bucket_counts(ft_instance_t ft, int expected)
 {
@@ -427,6 +690,7 @@ check_bucket_counts(ft_instance_t ft, int expected)
     ft_entry_t *_entry;
     list_links_t *cur, *next;
     int idx;
+    int i;
 
     FT_ITER(ft, _entry, cur, next) {
         (void)_entry;
@@ -435,15 +699,47 @@ check_bucket_counts(ft_instance_t ft, int expected)
     TEST_ASSERT(count == expected);
 
     /* Check the buckets */
+    TEST_ASSERT(hash_entry_count(&ft->flow_id_hash) == expected);
+    TEST_ASSERT(hash_entry_count(&ft->strict_match_hash) == expected);
+    TEST_ASSERT(ft->flow_id_hash.count == expected);
+    TEST_ASSERT(ft->strict_match_hash.count == expected);
+
+    count = 0;
+    for (idx = 0; idx < FT_IN_PORT_BUCKETS + 1; idx++) {
+        count += list_length(&ft->in_port_buckets[idx]);
+    }
+    TEST_ASSERT(count == expected);
+
+    for (i = 0; i < ft->num_cookie_indexes; i++) {
+        count = 0;
+        for (idx = 0; idx < FT_COOKIE_INDEX_BUCKETS; idx++) {
+            count += list_length(&ft->cookie_indexes[i].buckets[idx]);
+        }
+        TEST_ASSERT(count == expected);
+    }
+
+    count = 0;
+    for (idx = 0; idx < FT_OUT_PORT_BUCKETS + 2; idx++) {
+        count += list_length(&ft->out_port_buckets[idx]);
+    }
+    TEST_ASSERT(count == expected);
+
+    count = 0;
+    for (idx = 0; idx < FT_OUT_GROUP_BUCKETS + 2; idx++) {
+        count += list_length(&ft->out_group_buckets[idx]);
+    }
+    TEST_ASSERT(count == expected);
+
     count = 0;
-    for (idx = 0; idx < ft->config.flow_id_bucket_count; idx++) {
-        count += list_length(&ft->flow_id_buckets[idx]);
+    for (idx = 0; idx < FT_TABLES; idx++) {
+        TEST_ASSERT(list_length(&ft->table_buckets[idx]) == ft->status.table_counts[idx]);
+        count += ft->status.table_counts[idx];
     }
     TEST_ASSERT(count == expected);
 
     count = 0;
-    for (idx = 0; idx < ft->config.strict_match_bucket_count; idx++) {
-        count += list_length(&ft->strict_match_buckets[idx]);
+    for (idx = 0; idx < FT_PRIORITY_BUCKETS; idx++) {
+        count += list_length(&ft->priority_buckets[idx]);
     }
     TEST_ASSERT(count == expected);
 
@@ -722,6 +1018,154 @@ test_ft_hash(void)
     return TEST_PASS;
 }
 
+/*
+ * The strict match hash is cached in the entry and covers only masked
+ * bits, so matches that differ outside their masks hash the same
+ */
+static int
+test_ft_strict_match_hash(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    of_flow_add_t *flow_add;
+    of_meta_match_t query;
+    of_match_t match;
+    ft_entry_t *entry, *other, *lookup_entry;
+    uint32_t h;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+
+    INDIGO_MEM_SET(&match, 0, sizeof(match));
+    match.version = OF_VERSION_1_3;
+    match.fields.eth_type = 0x0800;
+    match.masks.eth_type = 0xffff;
+    match.fields.ipv4_dst = 0x0a000001;
+    match.masks.ipv4_dst = 0xffffff00;
+
+    flow_add = of_flow_add_new(OF_VERSION_1_3);
+    TEST_ASSERT(flow_add != NULL);
+    TEST_OK(of_flow_add_match_set(flow_add, &match));
+    of_flow_add_priority_set(flow_add, 100);
+    TEST_INDIGO_OK(ft_add(ft, TEST_ENT_ID, flow_add, &entry));
+    of_object_delete(flow_add);
+    h = entry->strict_match_hash;
+
+    /* Same prefix, different host bits */
+    match.fields.ipv4_dst = 0x0a0000fe;
+    flow_add = of_flow_add_new(OF_VERSION_1_3);
+    TEST_ASSERT(flow_add != NULL);
+    TEST_OK(of_flow_add_match_set(flow_add, &match));
+    of_flow_add_priority_set(flow_add, 100);
+    TEST_INDIGO_OK(ft_add(ft, TEST_ENT_ID + 1, flow_add, &other));
+    of_object_delete(flow_add);
+    TEST_ASSERT(other->strict_match_hash == h);
+    ft_delete(ft, other);
+
+    /* Another priority hashes differently */
+    flow_add = of_flow_add_new(OF_VERSION_1_3);
+    TEST_ASSERT(flow_add != NULL);
+    TEST_OK(of_flow_add_match_set(flow_add, &match));
+    of_flow_add_priority_set(flow_add, 101);
+    TEST_INDIGO_OK(ft_add(ft, TEST_ENT_ID + 2, flow_add, &other));
+    of_object_delete(flow_add);
+    TEST_ASSERT(other->strict_match_hash != h);
+    ft_delete(ft, other);
+
+    TEST_ASSERT(ft_lookup(ft, TEST_ENT_ID) == entry);
+    TEST_ASSERT(entry->strict_match_hash == h);
+
+    /* A query with other unmasked bits still finds the entry */
+    INDIGO_MEM_SET(&query, 0, sizeof(query));
+    query.match = match;
+    query.match.fields.ipv4_dst = 0x0a000077;
+    query.mode = OF_MATCH_STRICT;
+    query.check_priority = 1;
+    query.priority = 100;
+    query.out_port = OF_PORT_DEST_WILDCARD;
+    query.table_id = TABLE_ID_ANY;
+    TEST_INDIGO_OK(ft_strict_match(ft, &query, &lookup_entry));
+    TEST_ASSERT(lookup_entry == entry);
+
+    /* Priority and masked bits are part of the strict match */
+    query.priority = 101;
+    TEST_ASSERT(ft_strict_match(ft, &query, &lookup_entry) ==
+                INDIGO_ERROR_NOT_FOUND);
+    query.priority = 100;
+    query.match.fields.ipv4_dst = 0x0a000101;
+    TEST_ASSERT(ft_strict_match(ft, &query, &lookup_entry) ==
+                INDIGO_ERROR_NOT_FOUND);
+    query.match.fields.ipv4_dst = 0x0a000001;
+    query.match.masks.ipv4_dst = 0xffffffff;
+    TEST_ASSERT(ft_strict_match(ft, &query, &lookup_entry) ==
+                INDIGO_ERROR_NOT_FOUND);
+
+    TEST_ASSERT(check_table_entry_states(ft) == 0);
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
+/*
+ * Start with tiny hash tables so they grow while populating and shrink
+ * again while depopulating
+ */
+static int
+test_ft_resize(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        4, /* strict_match buckets */
+        4, /* flow_id buckets */
+    };
+    of_match_t match;
+    of_meta_match_t query;
+    ft_entry_t *entry;
+    int idx;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+
+    TEST_OK(populate_table(ft, TEST_FLOW_COUNT, &match));
+    TEST_ASSERT(ft->status.hash_resizes > 0);
+    TEST_ASSERT(ft->num_entry_slabs ==
+                (TEST_FLOW_COUNT + FT_ENTRY_SLAB_ENTRIES - 1) / FT_ENTRY_SLAB_ENTRIES);
+    TEST_ASSERT(ft->strict_match_hash.bucket_count > config.strict_match_bucket_count);
+    TEST_ASSERT(ft->flow_id_hash.bucket_count > config.flow_id_bucket_count);
+    TEST_ASSERT(ft->status.strict_match_load <= 100 * FT_HASH_LOAD_MAX * 2);
+    TEST_ASSERT(ft->status.flow_id_load <= 100 * FT_HASH_LOAD_MAX * 2);
+    TEST_ASSERT(check_bucket_counts(ft, TEST_FLOW_COUNT) == 0);
+
+    /* Every flow is still reachable by id and by strict match */
+    INDIGO_MEM_SET(&query, 0, sizeof(query));
+    query.match = match;
+    query.out_port = OF_PORT_DEST_WILDCARD;
+    query.mode = OF_MATCH_STRICT;
+    query.check_priority = 1;
+    query.table_id = TABLE_ID_ANY;
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        TEST_ASSERT((entry = ft_lookup(ft, TEST_KEY(idx))) != NULL);
+        query.priority = entry->priority;
+        query.match.fields.eth_type = TEST_ETH_TYPE(idx);
+        TEST_INDIGO_OK(ft_strict_match(ft, &query, &entry));
+        TEST_ASSERT(entry->id == TEST_KEY(idx));
+    }
+
+    TEST_OK(depopulate_table(ft));
+    TEST_ASSERT(check_bucket_counts(ft, 0) == 0);
+    TEST_ASSERT(ft->strict_match_hash.bucket_count <= FT_HASH_MIN_BUCKETS * 2);
+    TEST_ASSERT(ft->flow_id_hash.bucket_count <= FT_HASH_MIN_BUCKETS * 2);
+    TEST_ASSERT(ft->status.strict_match_load == 0);
+    TEST_ASSERT(ft->num_entry_slabs == 1);
+
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
 static int
 add_flow(ft_instance_t ft, int id, ft_entry_t **entry_p)
 {
@@ -911,56 +1355,656 @@ iter_task_cb(void *cookie, ft_entry_t *entry)
 }
 
 static int
-test_ft_iter_task(void)
+count_iter_matching(ft_instance_t ft, of_meta_match_t *query)
+{
+    ft_iterator_t iter;
+    int count = 0;
+
+    ft_iterator_init(&iter, ft, query);
+    while (ft_iterator_next(&iter) != NULL) {
+        count++;
+    }
+    ft_iterator_cleanup(&iter);
+
+    return count;
+}
+
+static int
+test_ft_cookie_index(void)
 {
     ft_instance_t ft;
     ft_config_t config = {
         1024, /* strict_match buckets */
         1024, /* flow_id buckets */
+        { 0xffff, 0xff0000 }, /* cookie indexes */
     };
-    of_flow_add_t *flow_add1, *flow_add2;
-    ft_entry_t *entry1, *entry2;
-    struct iter_task_state state;
+    of_meta_match_t query;
+    ft_entry_t *entry;
+    int i;
+    const int num_flows = 100;
 
     ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+    TEST_ASSERT(ft->num_cookie_indexes == 2);
 
-    flow_add1 = of_flow_add_new(OF_VERSION_1_0);
-    of_flow_add_OF_VERSION_1_0_populate(flow_add1, 1);
-    of_flow_add_flags_set(flow_add1, 0);
-
-    flow_add2 = of_flow_add_new(OF_VERSION_1_0);
-    of_flow_add_OF_VERSION_1_0_populate(flow_add2, 2);
-    of_flow_add_flags_set(flow_add2, 0);
-
-    TEST_INDIGO_OK(ft_add(ft, 1, flow_add1, &entry1));
-    TEST_INDIGO_OK(ft_add(ft, 2, flow_add2, &entry2));
-
-    state = (struct iter_task_state) { .ft = ft, .finished = -1, .entries_seen = 0 };
-    ft_spawn_iter_task(ft, NULL, iter_task_cb, &state, IND_SOC_DEFAULT_PRIORITY);
-    TEST_ASSERT(state.finished == -1);
-    TEST_ASSERT(state.entries_seen == 0);
-    TEST_ASSERT(ft->status.current_count == 2);
-    while (state.finished != 1) {
-        ind_soc_select_and_run(0);
+    /* add_flow uses the id as the cookie */
+    for (i = 0; i < num_flows; i++) {
+        TEST_OK(add_flow(ft, (i % 10) | (i / 10) << 16, &entry));
     }
-    TEST_ASSERT(state.finished == 1);
-    TEST_ASSERT(state.entries_seen == 2);
-    TEST_ASSERT(ft->status.current_count == 0);
+    TEST_ASSERT(check_bucket_counts(ft, num_flows) == 0);
+
+    INDIGO_MEM_SET(&query, 0, sizeof(query));
+    query.mode = OF_MATCH_NON_STRICT;
+    query.out_port = OF_PORT_DEST_WILDCARD;
+    query.table_id = TABLE_ID_ANY;
+
+    /* Low bits index */
+    query.cookie = 3;
+    query.cookie_mask = 0xffff;
+    TEST_ASSERT(count_iter_matching(ft, &query) == 10);
+    TEST_ASSERT(count_iter_matching(ft, &query) == count_matching(ft, &query));
+
+    /* Middle bits index */
+    query.cookie = 4 << 16;
+    query.cookie_mask = 0xff0000;
+    TEST_ASSERT(count_iter_matching(ft, &query) == 10);
+
+    /* Both covered, the wider index is used */
+    query.cookie = 3 | 4 << 16;
+    query.cookie_mask = 0xffffff;
+    TEST_ASSERT(count_iter_matching(ft, &query) == 1);
+
+    /* Not covered by any index */
+    query.cookie = 3;
+    query.cookie_mask = 0xff;
+    TEST_ASSERT(count_iter_matching(ft, &query) == 10);
 
     ft_destroy(ft);
-    of_object_delete(flow_add1);
-    of_object_delete(flow_add2);
 
     return TEST_PASS;
 }
 
 static int
-test_hello(void)
+test_ft_flow_id(void)
 {
-    of_hello_t *hello;
-
-    hello = of_hello_new(OF_VERSION_1_0);
-    indigo_core_receive_controller_message(0, hello);
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    of_flow_add_t *flow_add;
+    indigo_flow_id_t id1, id2, id3;
+    ft_entry_t *entry;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    of_flow_add_OF_VERSION_1_0_populate(flow_add, 1);
+    of_flow_add_flags_set(flow_add, 0);
+
+    TEST_INDIGO_OK(ft_flow_id_alloc(ft, &id1));
+    TEST_ASSERT(FT_FLOW_ID_IS_DIRECT(id1));
+    TEST_ASSERT(FT_FLOW_ID_SLOT(id1) == 0);
+    TEST_ASSERT(ft_lookup(ft, id1) == NULL);
+    TEST_INDIGO_OK(ft_add(ft, id1, flow_add, &entry));
+    TEST_ASSERT(ft_lookup(ft, id1) == entry);
+    TEST_ASSERT(ft_add(ft, id1, flow_add, NULL) == INDIGO_ERROR_EXISTS);
+    TEST_ASSERT(hash_entry_count(&ft->flow_id_hash) == 0);
+
+    /* Deleted IDs go stale and their slot is reused */
+    ft_delete(ft, entry);
+    TEST_ASSERT(ft_lookup(ft, id1) == NULL);
+    TEST_INDIGO_OK(ft_flow_id_alloc(ft, &id2));
+    TEST_ASSERT(FT_FLOW_ID_SLOT(id2) == FT_FLOW_ID_SLOT(id1));
+    TEST_ASSERT(id2 != id1);
+    TEST_ASSERT(ft_add(ft, id1, flow_add, NULL) == INDIGO_ERROR_PARAM);
+    TEST_INDIGO_OK(ft_add(ft, id2, flow_add, &entry));
+    TEST_ASSERT(ft_lookup(ft, id1) == NULL);
+    TEST_ASSERT(ft_lookup(ft, id2) == entry);
+
+    TEST_INDIGO_OK(ft_flow_id_alloc(ft, &id3));
+    TEST_ASSERT(FT_FLOW_ID_SLOT(id3) == 1);
+
+    ft_delete(ft, entry);
+    of_object_delete(flow_add);
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
+static int
+test_ft_checksum(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    of_flow_add_t *flow_add;
+    of_flow_modify_t *flow_modify;
+    of_list_action_t *actions;
+    ft_entry_t *entry1, *entry2, *entry3;
+    ft_table_checksum_t *table0, *table1;
+    const uint64_t cookie1 = 0x1000000000000001ULL;
+    const uint64_t cookie2 = 0xc000000000000002ULL;
+    uint64_t sum1, sum2, old_sum;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+    table0 = &ft->checksums[0];
+    table1 = &ft->checksums[1];
+    TEST_ASSERT(table0->buckets_size == 1);
+
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    of_flow_add_OF_VERSION_1_0_populate(flow_add, 1);
+    of_flow_add_flags_set(flow_add, 0);
+    of_flow_add_cookie_set(flow_add, cookie1);
+    TEST_INDIGO_OK(ft_add(ft, 1, flow_add, &entry1));
+    of_flow_add_OF_VERSION_1_0_populate(flow_add, 2);
+    of_flow_add_flags_set(flow_add, 0);
+    of_flow_add_cookie_set(flow_add, cookie2);
+    TEST_INDIGO_OK(ft_add(ft, 2, flow_add, &entry2));
+    sum1 = entry1->checksum;
+    sum2 = entry2->checksum;
+
+    TEST_ASSERT(table0->checksum == (sum1 ^ sum2));
+    TEST_ASSERT(table0->buckets[0] == (sum1 ^ sum2));
+
+    /* Flows with the same cookie do not cancel out */
+    of_flow_add_OF_VERSION_1_0_populate(flow_add, 3);
+    of_flow_add_flags_set(flow_add, 0);
+    of_flow_add_cookie_set(flow_add, cookie1);
+    TEST_INDIGO_OK(ft_add(ft, 3, flow_add, &entry3));
+    TEST_ASSERT(entry3->checksum != sum1);
+    TEST_ASSERT(table0->checksum == (sum1 ^ sum2 ^ entry3->checksum));
+    ft_delete(ft, entry3);
+    TEST_ASSERT(table0->checksum == (sum1 ^ sum2));
+
+    /* Modifying the effects changes the checksum */
+    flow_modify = of_flow_modify_new(OF_VERSION_1_0);
+    actions = of_list_action_new(OF_VERSION_1_0);
+    TEST_OK(of_flow_modify_actions_set(flow_modify, actions));
+    of_object_delete(actions);
+    old_sum = sum1;
+    TEST_INDIGO_OK(ft_entry_modify_effects(ft, entry1, flow_modify));
+    of_object_delete(flow_modify);
+    sum1 = entry1->checksum;
+    TEST_ASSERT(sum1 != old_sum);
+    TEST_ASSERT(table0->checksum == (sum1 ^ sum2));
+
+    /* Resizing recomputes the buckets from the top bits of the cookies */
+    TEST_ASSERT(ft_checksum_buckets_size_set(ft, 0, 3) == INDIGO_ERROR_PARAM);
+    TEST_ASSERT(ft_checksum_buckets_size_set(ft, 0, 0) == INDIGO_ERROR_PARAM);
+    TEST_ASSERT(ft_checksum_buckets_size_set(
+                    ft, 0, FT_CHECKSUM_BUCKETS_MAX * 2) == INDIGO_ERROR_PARAM);
+    TEST_INDIGO_OK(ft_checksum_buckets_size_set(ft, 0, 4));
+    TEST_ASSERT(table0->buckets_size == 4);
+    TEST_ASSERT(table0->checksum == (sum1 ^ sum2));
+    TEST_ASSERT(table0->buckets[0] == sum1);
+    TEST_ASSERT(table0->buckets[1] == 0);
+    TEST_ASSERT(table0->buckets[2] == 0);
+    TEST_ASSERT(table0->buckets[3] == sum2);
+
+    /* Moving an entry moves its contribution */
+    ft_entry_table_id_set(ft, entry2, 1);
+    TEST_ASSERT(table0->checksum == sum1);
+    TEST_ASSERT(table0->buckets[3] == 0);
+    TEST_ASSERT(table1->checksum == sum2);
+    TEST_ASSERT(table1->buckets[0] == sum2);
+
+    /* Deleting removes it */
+    ft_delete(ft, entry1);
+    TEST_ASSERT(table0->checksum == 0);
+    TEST_ASSERT(table0->buckets[0] == 0);
+
+    TEST_INDIGO_OK(ft_checksum_buckets_size_set(ft, 0, 1));
+    TEST_ASSERT(table0->buckets == &table0->bucket0);
+
+    ft_delete(ft, entry2);
+    TEST_ASSERT(table1->checksum == 0);
+
+    of_object_delete(flow_add);
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
+static int
+test_ft_stats_cache(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    of_flow_add_t *flow_add;
+    of_flow_stats_reply_t *reply;
+    ft_entry_t *entry;
+    indigo_fi_flow_stats_t stats = { 0 };
+    of_flow_stats_entry_t *cached;
+    uint64_t packets;
+    int empty_len, entry_len;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    of_flow_add_OF_VERSION_1_0_populate(flow_add, 1);
+    of_flow_add_flags_set(flow_add, 0);
+    TEST_INDIGO_OK(ft_add(ft, 1, flow_add, &entry));
+    TEST_ASSERT(entry->stats_cache == NULL);
+
+    reply = of_flow_stats_reply_new(OF_VERSION_1_0);
+    TEST_ASSERT(reply != NULL);
+    empty_len = reply->length;
+
+    /* The first append builds the cache, later ones reuse it */
+    stats.packets = 10;
+    TEST_INDIGO_OK(ind_core_flow_stats_entry_append(reply, entry, &stats,
+                                                    INDIGO_CURRENT_TIME));
+    TEST_ASSERT((cached = entry->stats_cache) != NULL);
+    entry_len = reply->length - empty_len;
+
+    stats.packets = 20;
+    TEST_INDIGO_OK(ind_core_flow_stats_entry_append(reply, entry, &stats,
+                                                    INDIGO_CURRENT_TIME));
+    TEST_ASSERT(entry->stats_cache == cached);
+    of_flow_stats_entry_packet_count_get(cached, &packets);
+    TEST_ASSERT(packets == 20);
+    TEST_ASSERT(reply->length == empty_len + 2 * entry_len);
+
+    /* Modifying the effects drops it */
+    TEST_INDIGO_OK(ft_entry_modify_effects(ft, entry, flow_add));
+    TEST_ASSERT(entry->stats_cache == NULL);
+
+    of_object_delete(reply);
+    of_object_delete(flow_add);
+    ft_delete(ft, entry);
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
+static int
+test_ft_eviction(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    of_flow_add_t *flow_add;
+    ft_entry_t *entries[4];
+    int i;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+
+    for (i = 0; i < 4; i++) {
+        TEST_OK(add_flow(ft, i + 1, &entries[i]));
+        ft_entry_counters_changed(ft, entries[i], 1000 + i);
+    }
+
+    /* Disabled */
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == NULL);
+
+    /* Least recently hit first */
+    TEST_INDIGO_OK(ft_eviction_set(ft, 0, INDIGO_CORE_EVICTION_OTHER));
+    TEST_ASSERT(ft->evictions[0].count == 4);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == entries[0]);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, entries[0]) == entries[1]);
+    TEST_ASSERT(ft_eviction_victim(ft, 1, NULL) == NULL);
+
+    ft_entry_counters_changed(ft, entries[0], 2000);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == entries[1]);
+    ft_entry_counters_changed(ft, entries[3], 500);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == entries[3]);
+
+    /* Removed and moved entries leave the heap */
+    ft_delete(ft, entries[3]);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == entries[1]);
+    ft_entry_table_id_set(ft, entries[1], 1);
+    TEST_ASSERT(ft->evictions[0].count == 2);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == entries[2]);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, entries[2]) == entries[0]);
+    TEST_ASSERT(ft_eviction_victim(ft, 1, NULL) == NULL);
+
+    /* Soonest hard timeout first, ties by recent hits */
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    of_flow_add_OF_VERSION_1_0_populate(flow_add, 5);
+    of_flow_add_flags_set(flow_add, 0);
+    of_flow_add_idle_timeout_set(flow_add, 0);
+    of_flow_add_hard_timeout_set(flow_add, 10);
+    TEST_INDIGO_OK(ft_add(ft, 5, flow_add, &entries[3]));
+    of_object_delete(flow_add);
+    ft_entry_counters_changed(ft, entries[3], 3000);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == entries[2]);
+    TEST_INDIGO_OK(ft_eviction_set(ft, 0, INDIGO_CORE_EVICTION_LIFETIME |
+                                          INDIGO_CORE_EVICTION_OTHER));
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == entries[3]);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, entries[3]) == entries[2]);
+
+    TEST_INDIGO_OK(ft_eviction_set(ft, 0, 0));
+    TEST_ASSERT(ft->evictions[0].heap == NULL);
+    TEST_ASSERT(entries[0]->eviction_idx == FT_EVICTION_IDX_NONE);
+    TEST_ASSERT(ft_eviction_victim(ft, 0, NULL) == NULL);
+
+    for (i = 0; i < 4; i++) {
+        ft_delete(ft, entries[i]);
+    }
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
+static int
+test_ft_iter_task(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    of_flow_add_t *flow_add1, *flow_add2;
+    ft_entry_t *entry1, *entry2;
+    struct iter_task_state state;
+
+    ft = ft_create(&config);
+
+    flow_add1 = of_flow_add_new(OF_VERSION_1_0);
+    of_flow_add_OF_VERSION_1_0_populate(flow_add1, 1);
+    of_flow_add_flags_set(flow_add1, 0);
+
+    flow_add2 = of_flow_add_new(OF_VERSION_1_0);
+    of_flow_add_OF_VERSION_1_0_populate(flow_add2, 2);
+    of_flow_add_flags_set(flow_add2, 0);
+
+    TEST_INDIGO_OK(ft_add(ft, 1, flow_add1, &entry1));
+    TEST_INDIGO_OK(ft_add(ft, 2, flow_add2, &entry2));
+
+    state = (struct iter_task_state) { .ft = ft, .finished = -1, .entries_seen = 0 };
+    ft_spawn_iter_task(ft, NULL, iter_task_cb, &state, IND_SOC_DEFAULT_PRIORITY);
+    TEST_ASSERT(state.finished == -1);
+    TEST_ASSERT(state.entries_seen == 0);
+    TEST_ASSERT(ft->status.current_count == 2);
+    while (state.finished != 1) {
+        ind_soc_select_and_run(0);
+    }
+    TEST_ASSERT(state.finished == 1);
+    TEST_ASSERT(state.entries_seen == 2);
+    TEST_ASSERT(ft->status.current_count == 0);
+
+    ft_destroy(ft);
+    of_object_delete(flow_add1);
+    of_object_delete(flow_add2);
+
+    return TEST_PASS;
+}
+
+struct ft_read_thread_state {
+    ft_instance_t ft;
+    int stop;
+    int passes;
+    int errors;
+};
+
+/* Check that an entry seen by a reader is intact */
+static void
+ft_read_check(void *cookie, ft_entry_t *entry)
+{
+    struct ft_read_thread_state *state = cookie;
+    of_object_t *effects = ft_read_effects(entry);
+
+    if (effects == NULL || effects->version != OF_VERSION_1_0 ||
+        entry->match.version != OF_VERSION_1_0) {
+        state->errors++;
+    }
+}
+
+static void *
+ft_read_thread(void *arg)
+{
+    struct ft_read_thread_state *state = arg;
+    ft_read_t read;
+
+    while (!__atomic_load_n(&state->stop, __ATOMIC_ACQUIRE)) {
+        if (ft_read_lock(state->ft, &read) < 0) {
+            state->errors++;
+            break;
+        }
+        ft_read_iter(state->ft, NULL, ft_read_check, state);
+        ft_read_unlock(state->ft, &read);
+        __atomic_add_fetch(&state->passes, 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+static int
+test_ft_read(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    of_flow_add_t *flow_add;
+    ft_entry_t *entry;
+    ft_entry_t *entries[64];
+    indigo_flow_id_t id;
+    ft_read_t read, reads[FT_READERS_MAX];
+    struct ft_read_thread_state state;
+    pthread_t thread;
+    int i;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    of_flow_add_OF_VERSION_1_0_populate(flow_add, 1);
+    of_flow_add_flags_set(flow_add, 0);
+
+    TEST_INDIGO_OK(ft_flow_id_alloc(ft, &id));
+    TEST_INDIGO_OK(ft_add(ft, id, flow_add, &entry));
+    TEST_INDIGO_OK(ft_add(ft, TEST_KEY(0), flow_add, NULL));
+
+    /* Deleted entries stay valid until the reader leaves */
+    TEST_INDIGO_OK(ft_read_lock(ft, &read));
+    TEST_ASSERT(ft_read_lookup(ft, id) == entry);
+    TEST_ASSERT(ft_read_lookup(ft, TEST_KEY(0)) != NULL);
+    TEST_ASSERT(ft_read_lookup(ft, TEST_KEY(1)) == NULL);
+    ft_delete(ft, entry);
+    TEST_ASSERT(ft_read_lookup(ft, id) == NULL);
+    TEST_ASSERT(entry->id == id);
+    TEST_ASSERT(ft->deferred_count - ft->deferred_head == 1);
+    ft_read_unlock(ft, &read);
+    TEST_ASSERT(ft->deferred_count - ft->deferred_head == 1);
+    ft_read_reclaim(ft);
+    TEST_ASSERT(ft->deferred_count == 0);
+
+    /* Without readers, frees are immediate */
+    entry = ft_lookup(ft, TEST_KEY(0));
+    TEST_INDIGO_OK(ft_entry_modify_effects(ft, entry, flow_add));
+    ft_delete(ft, entry);
+    TEST_ASSERT(ft->deferred_count == 0);
+
+    for (i = 0; i < FT_READERS_MAX; i++) {
+        TEST_INDIGO_OK(ft_read_lock(ft, &reads[i]));
+    }
+    TEST_ASSERT(ft_read_lock(ft, &read) == INDIGO_ERROR_RESOURCE);
+    for (i = 0; i < FT_READERS_MAX; i++) {
+        ft_read_unlock(ft, &reads[i]);
+    }
+
+    /* Churn the table, growing the slot array, under a reader thread */
+    state = (struct ft_read_thread_state) { .ft = ft };
+    TEST_ASSERT(pthread_create(&thread, NULL, ft_read_thread, &state) == 0);
+    while (__atomic_load_n(&state.passes, __ATOMIC_ACQUIRE) == 0) {
+        usleep(100);
+    }
+    for (i = 0; i < FT_FLOW_ID_SLOTS_INIT * 4; i++) {
+        int idx = i % 64;
+        if (i >= 64) {
+            if (i % 3 == 0) {
+                TEST_INDIGO_OK(ft_entry_modify_effects(ft, entries[idx],
+                                                       flow_add));
+            }
+            ft_delete(ft, entries[idx]);
+        }
+        TEST_INDIGO_OK(ft_flow_id_alloc(ft, &id));
+        TEST_INDIGO_OK(ft_add(ft, id, flow_add, &entries[idx]));
+        /* Keep the slot array growing */
+        TEST_INDIGO_OK(ft_flow_id_alloc(ft, &id));
+    }
+    __atomic_store_n(&state.stop, 1, __ATOMIC_RELEASE);
+    TEST_ASSERT(pthread_join(thread, NULL) == 0);
+    TEST_ASSERT(state.errors == 0);
+    TEST_ASSERT(ft->flow_id_slot_count > FT_FLOW_ID_SLOTS_INIT);
+
+    for (i = 0; i < 64; i++) {
+        ft_delete(ft, entries[i]);
+    }
+    TEST_ASSERT(ft->deferred_count == 0);
+
+    of_object_delete(flow_add);
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
+/* A match on a varying subset of fields, many of them overlapping */
+static void
+ft_match_query_gen(int idx, of_match_t *match)
+{
+    memset(match, 0, sizeof(*match));
+    match->version = OF_VERSION_1_3;
+    if (idx & 1) {
+        match->fields.in_port = 1 + idx % 3;
+        match->masks.in_port = 0xffffffff;
+    }
+    if (idx & 2) {
+        match->fields.eth_type = 0x0800;
+        match->masks.eth_type = 0xffff;
+        match->fields.ipv4_dst = 0x0a000000 | (idx % 5) << 8 | idx % 7;
+        match->masks.ipv4_dst = (idx & 4) ? 0xffffff00 : 0xffffffff;
+    }
+    if (idx & 8) {
+        match->fields.vlan_vid = 0x1000 | idx % 4;
+        match->masks.vlan_vid = (idx & 16) ? 0x1000 : 0x1fff;
+    }
+    if (idx & 32) {
+        match->fields.eth_dst.addr[5] = idx % 3;
+        memset(&match->masks.eth_dst, 0xff, sizeof(match->masks.eth_dst));
+    }
+    if (idx & 64) {
+        match->fields.metadata = idx % 6;
+        match->masks.metadata = 0xff;
+    }
+    /* Field bits outside the mask are ignored */
+    match->fields.tcp_dst = idx;
+}
+
+struct ft_match_query_count {
+    of_meta_match_t *query;
+    int count;
+    int errors;
+};
+
+static void
+ft_match_query_check(void *cookie, ft_entry_t *entry)
+{
+    struct ft_match_query_count *state = cookie;
+
+    state->count++;
+    if (!ft_entry_meta_match(state->query, entry)) {
+        state->errors++;
+    }
+}
+
+/*
+ * Iterators and ft_read_iter compare against a flat query; check they
+ * select exactly the entries ft_entry_meta_match does
+ */
+static int
+test_ft_match_query(void)
+{
+    ft_instance_t ft;
+    ft_config_t config = {
+        1024, /* strict_match buckets */
+        1024, /* flow_id buckets */
+    };
+    static const of_match_mode_t modes[] = {
+        OF_MATCH_NON_STRICT, OF_MATCH_STRICT, OF_MATCH_OVERLAP,
+    };
+    struct ft_match_query_count state;
+    of_flow_add_t *flow_add;
+    of_meta_match_t query;
+    of_match_t match;
+    ft_iterator_t iter;
+    ft_entry_t *entry;
+    ft_read_t read;
+    int found[3] = { 0 };
+    int expected, count;
+    int idx, mode;
+
+    ft = ft_create(&config);
+    TEST_ASSERT(ft != NULL);
+
+    for (idx = 0; idx < 128; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_3);
+        TEST_ASSERT(flow_add != NULL);
+        ft_match_query_gen(idx, &match);
+        TEST_OK(of_flow_add_match_set(flow_add, &match));
+        of_flow_add_priority_set(flow_add, idx);
+        TEST_INDIGO_OK(ft_add(ft, TEST_KEY(idx), flow_add, NULL));
+        of_object_delete(flow_add);
+    }
+
+    for (idx = 0; idx < 128; idx += 3) {
+        for (mode = 0; mode < 3; mode++) {
+            INDIGO_MEM_SET(&query, 0, sizeof(query));
+            ft_match_query_gen(idx, &query.match);
+            query.mode = modes[mode];
+            query.table_id = TABLE_ID_ANY;
+            query.out_port = OF_PORT_DEST_WILDCARD;
+
+            expected = count_matching(ft, &query);
+            found[mode] += expected;
+
+            count = 0;
+            ft_iterator_init(&iter, ft, &query);
+            while ((entry = ft_iterator_next(&iter)) != NULL) {
+                TEST_ASSERT(ft_entry_meta_match(&query, entry));
+                count++;
+            }
+            ft_iterator_cleanup(&iter);
+            TEST_ASSERT(count == expected);
+
+            state = (struct ft_match_query_count) { .query = &query };
+            TEST_INDIGO_OK(ft_read_lock(ft, &read));
+            ft_read_iter(ft, &query, ft_match_query_check, &state);
+            ft_read_unlock(ft, &read);
+            TEST_ASSERT(state.count == expected);
+            TEST_ASSERT(state.errors == 0);
+        }
+    }
+
+    /* Each query selects at least the entry it was generated from */
+    TEST_ASSERT(found[0] > 43 && found[1] >= 43 && found[2] > found[0]);
+
+    ft_destroy(ft);
+
+    return TEST_PASS;
+}
+
+static int
+test_hello(void)
+{
+    of_hello_t *hello;
+
+    hello = of_hello_new(OF_VERSION_1_0);
+    indigo_core_receive_controller_message(0, hello);
 
     return TEST_PASS;
 }
@@ -969,11 +2013,25 @@ static int
 test_packet_out(void)
 {
     of_packet_out_t *pkt_out;
+    int batches = fwd_packet_out_batches;
+    int idx;
 
     pkt_out = of_packet_out_new(OF_VERSION_1_0);
     /* Could add params, but core doesn't do anything with them */
     indigo_core_receive_controller_message(0, pkt_out);
 
+    /* Consecutive packet-outs are sent together before the next message */
+    fwd_packet_outs = 0;
+    for (idx = 1; idx < 4; idx++) {
+        pkt_out = of_packet_out_new(OF_VERSION_1_0);
+        indigo_core_receive_controller_message(0, pkt_out);
+    }
+    TEST_ASSERT(fwd_packet_out_batches == batches);
+
+    indigo_core_receive_controller_message(0, of_hello_new(OF_VERSION_1_0));
+    TEST_ASSERT(fwd_packet_out_batches == batches + 1);
+    TEST_ASSERT(fwd_packet_outs == 4);
+
     return TEST_PASS;
 }
 
@@ -1093,9 +2151,243 @@ test_simple_add_del(void)
     return TEST_PASS;
 }
 
-/* Add n flows, delete one by one */
+/* Add n flows without barriers in between; they are programmed in batches */
 int
-test_exact_add_del(void)
+test_flow_batch(void)
+{
+    of_flow_add_t *flow_add;
+    ft_status_t *status;
+    int idx;
+    int commits = fwd_batch_commits;
+
+    status = FT_STATUS(ind_core_ft);
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        handle_message(flow_add);
+    }
+
+    /* Only full batches have been committed so far */
+    TEST_ASSERT(fwd_batch_commits - commits ==
+                TEST_FLOW_COUNT / OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX);
+    TEST_ASSERT(outstanding_op_cnt ==
+                TEST_FLOW_COUNT % OFSTATEMANAGER_CONFIG_FLOW_BATCH_MAX);
+
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(fwd_batch_ops == 0);
+    CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
+
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    TEST_ASSERT(status->current_count == 0);
+
+    return TEST_PASS;
+}
+
+/* Creates completed later by forwarding hold the request until done */
+int
+test_flow_async(void)
+{
+    of_flow_add_t *flow_add;
+    ft_status_t *status;
+
+    status = FT_STATUS(ind_core_ft);
+    fwd_async_enabled = 1;
+
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    TEST_ASSERT(flow_add != NULL);
+    TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, 1) != 0);
+    handle_message(of_object_dup(flow_add));
+    TEST_ASSERT(outstanding_op_cnt == 1);
+    TEST_ASSERT(status->current_count == 1);
+
+    indigo_core_flow_create_done(fwd_async_flow_id, INDIGO_ERROR_NONE, 0);
+    TEST_ASSERT(outstanding_op_cnt == 0);
+    TEST_ASSERT(status->current_count == 1);
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+
+    /* A failed completion removes the entry */
+    handle_message(flow_add);
+    TEST_ASSERT(outstanding_op_cnt == 1);
+    indigo_core_flow_create_done(fwd_async_flow_id, INDIGO_ERROR_RESOURCE, 0);
+    TEST_ASSERT(outstanding_op_cnt == 0);
+    TEST_ASSERT(status->current_count == 0);
+
+    fwd_async_enabled = 0;
+
+    return TEST_PASS;
+}
+
+static void
+bundle_ctrl_send(uint32_t bundle_id, uint16_t ctrl_type)
+{
+    of_object_t *ctrl = of_bundle_ctrl_msg_new(OF_VERSION_1_4);
+    of_bundle_ctrl_msg_bundle_id_set(ctrl, bundle_id);
+    of_bundle_ctrl_msg_bundle_ctrl_type_set(ctrl, ctrl_type);
+    handle_message(ctrl);
+}
+
+static void
+bundle_add_send(uint32_t bundle_id, of_flow_add_t *msg)
+{
+    of_object_t *add = of_bundle_add_msg_new(OF_VERSION_1_4);
+    of_octets_t data;
+    uint32_t xid;
+
+    /* The enclosed message must carry the bundle_add xid */
+    of_bundle_add_msg_xid_get(add, &xid);
+    of_flow_add_xid_set(msg, xid);
+    of_bundle_add_msg_bundle_id_set(add, bundle_id);
+    data.data = OF_OBJECT_BUFFER_INDEX(msg, 0);
+    data.bytes = msg->length;
+    of_bundle_add_msg_data_set(add, &data);
+    of_object_delete(msg);
+    handle_message(add);
+}
+
+/* Flow-mods in a bundle are applied only when it is committed */
+int
+test_bundle(void)
+{
+    ft_status_t *status;
+    of_object_t *ctrl;
+    int replies = controller_message_counters[OF_BUNDLE_CTRL_MSG];
+
+    status = FT_STATUS(ind_core_ft);
+
+    bundle_ctrl_send(1, 0 /* OPEN_REQUEST */);
+    bundle_add_send(1, of_flow_add_new(OF_VERSION_1_4));
+    TEST_ASSERT(outstanding_op_cnt == 0);
+    TEST_ASSERT(status->current_count == 0);
+
+    bundle_ctrl_send(1, 4 /* COMMIT_REQUEST */);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(status->current_count == 1);
+    TEST_ASSERT(controller_message_counters[OF_BUNDLE_CTRL_MSG] ==
+                replies + 2);
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+
+    /* The bundle is gone once committed */
+    bundle_ctrl_send(1, 4 /* COMMIT_REQUEST */);
+    TEST_ASSERT(controller_message_counters[OF_BUNDLE_CTRL_MSG] ==
+                replies + 2);
+
+    /* Discarded bundles are never applied */
+    bundle_add_send(2, of_flow_add_new(OF_VERSION_1_4));
+    bundle_ctrl_send(2, 6 /* DISCARD_REQUEST */);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(status->current_count == 0);
+    TEST_ASSERT(controller_message_counters[OF_BUNDLE_CTRL_MSG] ==
+                replies + 3);
+
+    /* Atomic bundles are refused, since they cannot be rolled back */
+    ctrl = of_bundle_ctrl_msg_new(OF_VERSION_1_4);
+    of_bundle_ctrl_msg_bundle_id_set(ctrl, 3);
+    of_bundle_ctrl_msg_bundle_ctrl_type_set(ctrl, 0 /* OPEN_REQUEST */);
+    of_bundle_ctrl_msg_flags_set(ctrl, 1 /* OFPBF_ATOMIC */);
+    handle_message(ctrl);
+    bundle_ctrl_send(3, 4 /* COMMIT_REQUEST */);
+    TEST_ASSERT(controller_message_counters[OF_BUNDLE_CTRL_MSG] ==
+                replies + 3);
+
+    return TEST_PASS;
+}
+
+static void
+flow_monitor_send(uint32_t monitor_id, uint8_t command, uint16_t flags)
+{
+    of_flow_monitor_request_t *req;
+    of_match_t match;
+
+    req = of_flow_monitor_request_new(OF_VERSION_1_4);
+    memset(&match, 0, sizeof(match));
+    of_flow_monitor_request_match_set(req, &match);
+    of_flow_monitor_request_monitor_id_set(req, monitor_id);
+    of_flow_monitor_request_command_set(req, command);
+    of_flow_monitor_request_monitor_flags_set(req, flags);
+    of_flow_monitor_request_table_id_set(req, TABLE_ID_ANY);
+    of_flow_monitor_request_out_port_set(req, OF_PORT_DEST_WILDCARD);
+    handle_message(req);
+}
+
+/* A flow monitor reports adds and removes as flow updates */
+int
+test_flow_monitor(void)
+{
+    int replies = controller_message_counters[OF_FLOW_MONITOR_REPLY];
+    int events[8];
+
+    INDIGO_MEM_COPY(events, flow_monitor_events, sizeof(events));
+
+    flow_monitor_send(1, 0 /* ADD */, 0x26 /* ADD | REMOVED | NO_ABBREV */);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(controller_message_counters[OF_FLOW_MONITOR_REPLY] ==
+                replies + 1);
+
+    /* The add and the remove are sent together at the end of the pass */
+    handle_message(of_flow_add_new(OF_VERSION_1_4));
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    ind_soc_select_and_run(0);
+    TEST_ASSERT(controller_message_counters[OF_FLOW_MONITOR_REPLY] ==
+                replies + 2);
+    TEST_ASSERT(flow_monitor_events[1 /* ADDED */] == events[1] + 1);
+    TEST_ASSERT(flow_monitor_events[2 /* REMOVED */] == events[2] + 1);
+
+    /* Without NO_ABBREV our own flow-mods are abbreviated */
+    flow_monitor_send(1, 1 /* MODIFY */, 0x6 /* ADD | REMOVED */);
+    handle_message(of_flow_add_new(OF_VERSION_1_4));
+    TEST_INDIGO_OK(do_barrier());
+    ind_soc_select_and_run(0);
+    TEST_ASSERT(flow_monitor_events[4 /* ABBREV */] == events[4] + 1);
+    TEST_ASSERT(flow_monitor_events[1 /* ADDED */] == events[1] + 1);
+
+    /* INITIAL reports the flows already there in the reply */
+    flow_monitor_send(2, 0 /* ADD */, 0x1 /* INITIAL */);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(flow_monitor_events[0 /* INITIAL */] == events[0] + 1);
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    ind_soc_select_and_run(0);
+    TEST_ASSERT(flow_monitor_events[2 /* REMOVED */] == events[2] + 2);
+
+    /* Updates are dropped while output is blocked, then resumed */
+    cxn_output_blocked = 1;
+    handle_message(of_flow_add_new(OF_VERSION_1_4));
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(flow_monitor_events[5 /* PAUSED */] == events[5] + 1);
+    TEST_ASSERT(cxn_output_ready != NULL);
+    cxn_output_blocked = 0;
+    cxn_output_ready(cxn_output_ready_cookie);
+    cxn_output_ready = NULL;
+    TEST_ASSERT(flow_monitor_events[6 /* RESUMED */] == events[6] + 1);
+    TEST_ASSERT(flow_monitor_events[4 /* ABBREV */] == events[4] + 1);
+
+    /* ONLY_OWN is refused */
+    replies = controller_message_counters[OF_FLOW_MONITOR_REPLY];
+    flow_monitor_send(3, 0 /* ADD */, 0x42 /* ADD | ONLY_OWN */);
+    TEST_ASSERT(controller_message_counters[OF_FLOW_MONITOR_REPLY] ==
+                replies);
+
+    /* Deleted monitors report nothing */
+    flow_monitor_send(1, 2 /* DELETE */, 0);
+    flow_monitor_send(2, 2 /* DELETE */, 0);
+    TEST_ASSERT(controller_message_counters[OF_FLOW_MONITOR_REPLY] ==
+                replies + 2);
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    handle_message(of_flow_add_new(OF_VERSION_1_4));
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    ind_soc_select_and_run(0);
+    TEST_ASSERT(controller_message_counters[OF_FLOW_MONITOR_REPLY] ==
+                replies + 2);
+
+    return TEST_PASS;
+}
+
+/* Add n flows, delete one by one */
+int
+test_exact_add_del(void)
 {
     of_flow_add_t *flow_add_keep[TEST_FLOW_COUNT];
     of_flow_add_t *flow_add;
@@ -1132,109 +2424,1100 @@ test_exact_add_del(void)
         CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT - (idx + 1));
         of_flow_add_delete(flow_add_keep[idx]);
     }
-    TEST_ASSERT(status->current_count == 0);
+    TEST_ASSERT(status->current_count == 0);
+
+    return TEST_PASS;
+}
+
+/* Add n flows, delete one by one */
+int
+test_modify(void)
+{
+    of_flow_add_t *flow_add_keep[TEST_FLOW_COUNT];
+    of_flow_add_t *flow_add;
+    of_flow_modify_t *flow_mod;
+    ft_status_t *status;
+    int idx;
+    of_match_t match;
+    uint16_t prio;
+
+    status = FT_STATUS(ind_core_ft);
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        flow_add_keep[idx] = of_object_dup(flow_add);
+        handle_message(flow_add);
+        TEST_INDIGO_OK(do_barrier());
+        CHECK_FLOW_COUNT(status, idx + 1);
+    }
+
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        INDIGO_MEM_CLEAR(&match, sizeof(match));
+        /* Match the source mac addr which should be diff for each entry */
+        TEST_OK(of_flow_add_match_get(flow_add_keep[idx], &match));
+        of_flow_add_priority_get(flow_add_keep[idx], &prio);
+        flow_mod = of_flow_modify_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_mod != NULL);
+        of_flow_modify_out_port_set(flow_mod, OF_PORT_DEST_WILDCARD);
+        of_flow_modify_priority_set(flow_mod, prio);
+        TEST_OK(of_flow_modify_match_set(flow_mod, &match));
+        handle_message(flow_mod);
+        TEST_OK(do_barrier());
+        CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
+        of_flow_add_delete(flow_add_keep[idx]);
+    }
+    CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
+    /* Delete all the entries */
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    TEST_ASSERT(status->current_count == 0);
+
+    return TEST_PASS;
+}
+
+/* Add n flows, delete one by one */
+int
+test_modify_strict(void)
+{
+    of_flow_add_t *flow_add_keep[TEST_FLOW_COUNT];
+    of_flow_add_t *flow_add;
+    of_flow_modify_strict_t *flow_mod;
+    ft_status_t *status;
+    int idx;
+    of_match_t match;
+    uint16_t prio;
+
+    status = FT_STATUS(ind_core_ft);
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        flow_add_keep[idx] = of_object_dup(flow_add);
+        handle_message(flow_add);
+        TEST_INDIGO_OK(do_barrier());
+        CHECK_FLOW_COUNT(status, idx + 1);
+    }
+
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        INDIGO_MEM_CLEAR(&match, sizeof(match));
+        /* Match the source mac addr which should be diff for each entry */
+        TEST_OK(of_flow_add_match_get(flow_add_keep[idx], &match));
+        of_flow_add_priority_get(flow_add_keep[idx], &prio);
+        flow_mod = of_flow_modify_strict_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_mod != NULL);
+        of_flow_modify_strict_out_port_set(flow_mod, OF_PORT_DEST_WILDCARD);
+        of_flow_modify_strict_priority_set(flow_mod, prio);
+        TEST_OK(of_flow_modify_strict_match_set(flow_mod, &match));
+        handle_message(flow_mod);
+        TEST_INDIGO_OK(do_barrier());
+        CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
+        of_flow_add_delete(flow_add_keep[idx]);
+    }
+    CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
+
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    TEST_ASSERT(status->current_count == 0);
+
+    return TEST_PASS;
+}
+
+/* Return the only flow in the table */
+static ft_entry_t *
+only_entry(ft_instance_t ft)
+{
+    ft_entry_t *entry, *found = NULL;
+    list_links_t *cur, *next;
+
+    FT_ITER(ft, entry, cur, next) {
+        assert(found == NULL);
+        found = entry;
+    }
+
+    return found;
+}
+
+/* Re-adding a flow keeps it, and modifies it if only the effects changed */
+static int
+test_flow_readd(void)
+{
+    of_flow_add_t *flow_add, *flow_add_keep;
+    of_list_action_t *actions;
+    ft_status_t *status = FT_STATUS(ind_core_ft);
+    ind_core_driver_stats_t create_stats, modify_stats;
+    ft_entry_t *entry;
+    indigo_flow_id_t flow_id;
+    indigo_time_t before;
+    uint64_t readds = status->readds;
+
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    TEST_ASSERT(flow_add != NULL);
+    TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, 0) != 0);
+    of_flow_add_flags_set(flow_add, 0);
+    of_flow_add_idle_timeout_set(flow_add, 0);
+    of_flow_add_hard_timeout_set(flow_add, 60);
+    flow_add_keep = of_object_dup(flow_add);
+    handle_message(flow_add);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT((entry = only_entry(ind_core_ft)) != NULL);
+    flow_id = entry->id;
+
+    /* Identical: nothing reaches Forwarding */
+    ind_core_driver_stats_clear();
+    handle_message(of_object_dup(flow_add_keep));
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT((entry = only_entry(ind_core_ft)) != NULL);
+    TEST_ASSERT(entry->id == flow_id);
+    TEST_ASSERT(status->readds == readds + 1);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_create,
+                              &create_stats);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_modify,
+                              &modify_stats);
+    TEST_ASSERT(create_stats.calls == 0 && modify_stats.calls == 0);
+
+    /* New effects: modified in place */
+    flow_add = of_object_dup(flow_add_keep);
+    actions = of_list_action_new(OF_VERSION_1_0);
+    TEST_OK(of_flow_add_actions_set(flow_add, actions));
+    of_object_delete(actions);
+    handle_message(flow_add);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT((entry = only_entry(ind_core_ft)) != NULL);
+    TEST_ASSERT(entry->id == flow_id);
+    TEST_ASSERT(entry->effects.actions->length == 0);
+    TEST_ASSERT(status->readds == readds + 2);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_create,
+                              &create_stats);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_modify,
+                              &modify_stats);
+    TEST_ASSERT(create_stats.calls == 0 && modify_stats.calls == 1);
+
+    /* Re-added later: the hard timeout is re-armed */
+    entry->insert_time -= 5000;
+    entry->last_counter_change -= 5000;
+    before = INDIGO_CURRENT_TIME;
+    handle_message(of_object_dup(flow_add_keep));
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT((entry = only_entry(ind_core_ft)) != NULL);
+    TEST_ASSERT(entry->id == flow_id);
+    TEST_ASSERT(status->readds == readds + 3);
+    TEST_ASSERT(entry->insert_time >= before);
+    TEST_ASSERT(entry->last_counter_change >= before);
+    TEST_ASSERT(entry->expiration_time == entry->insert_time + 60 * 1000);
+
+    /* New cookie: replaced */
+    flow_add = of_object_dup(flow_add_keep);
+    of_flow_add_cookie_set(flow_add, entry->cookie + 1);
+    handle_message(flow_add);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT((entry = only_entry(ind_core_ft)) != NULL);
+    TEST_ASSERT(status->readds == readds + 3);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_create,
+                              &create_stats);
+    TEST_ASSERT(create_stats.calls == 1);
+
+    of_object_delete(flow_add_keep);
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    TEST_ASSERT(status->current_count == 0);
+
+    return TEST_PASS;
+}
+
+
+/* Return the flow with the given cookie, or NULL */
+static ft_entry_t *
+cookie_entry(ft_instance_t ft, uint64_t cookie)
+{
+    ft_entry_t *entry;
+    list_links_t *cur, *next;
+
+    FT_ITER(ft, entry, cur, next) {
+        if (entry->cookie == cookie) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Add a flow with the given cookie and timeouts; return its entry */
+static ft_entry_t *
+expiration_flow_add(int idx, uint16_t idle_timeout, uint16_t hard_timeout)
+{
+    of_flow_add_t *flow_add;
+
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    assert(flow_add != NULL);
+    assert(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+    of_flow_add_flags_set(flow_add, 0);
+    of_flow_add_cookie_set(flow_add, idx);
+    of_flow_add_idle_timeout_set(flow_add, idle_timeout);
+    of_flow_add_hard_timeout_set(flow_add, hard_timeout);
+    handle_message(flow_add);
+    do_barrier();
+
+    return cookie_entry(ind_core_ft, idx);
+}
+
+/* Move an entry's times back and relink it in the expiration wheel */
+static void
+expiration_rewind(ft_entry_t *entry, indigo_time_t delta)
+{
+    ind_core_expiration_remove(entry);
+    entry->insert_time -= delta;
+    entry->last_counter_change -= delta;
+    ind_core_expiration_add(entry);
+}
+
+/*
+ * Wait out the current wheel tick so its slot is visited, then start the
+ * expiration task and let it finish
+ */
+static void
+expiration_run(void)
+{
+    int i;
+
+    usleep(200 * 1000);
+    ind_core_expiration_timer(NULL);
+    for (i = 0; i < 4; i++) {
+        ind_soc_select_and_run(0);
+    }
+}
+
+/*
+ * Flows past their timeouts are expired from the timer wheel; a flow whose
+ * slot comes round before its timeout is kept and relinked
+ */
+static int
+test_flow_expiration(void)
+{
+    ft_status_t *status = FT_STATUS(ind_core_ft);
+    ft_entry_t *hard, *idle, *live, *far;
+    indigo_time_t far_expiration;
+
+    hard = expiration_flow_add(1, 0, 1);
+    idle = expiration_flow_add(2, 1, 0);
+    live = expiration_flow_add(3, 0, 60);
+    TEST_ASSERT(hard != NULL && idle != NULL && live != NULL);
+    TEST_ASSERT(status->current_count == 3);
+    TEST_ASSERT(hard->expiration_time == hard->insert_time + 1000);
+    TEST_ASSERT(idle->expiration_time == idle->last_counter_change + 1000);
+
+    /* Nothing is due yet */
+    expiration_run();
+    TEST_ASSERT(status->current_count == 3);
+
+    /* Hard and idle timeouts that have passed */
+    expiration_rewind(hard, 2000);
+    expiration_rewind(idle, 2000);
+    expiration_run();
+    TEST_ASSERT(cookie_entry(ind_core_ft, 1) == NULL);
+    TEST_ASSERT(cookie_entry(ind_core_ft, 2) == NULL);
+    TEST_ASSERT(cookie_entry(ind_core_ft, 3) == live);
+    TEST_ASSERT(status->current_count == 1);
+
+    /*
+     * A timeout longer than a revolution, rewound so it shares the slot
+     * of one of the next few ticks
+     */
+    far = expiration_flow_add(4, 0, 600);
+    TEST_ASSERT(far != NULL);
+    expiration_rewind(far, 600 * 1000 - 4096 * 100 - 150);
+    far_expiration = far->expiration_time;
+    usleep(200 * 1000);
+    expiration_run();
+    TEST_ASSERT(cookie_entry(ind_core_ft, 4) == far);
+    TEST_ASSERT(far->expiration_time == far_expiration);
+    TEST_ASSERT(status->current_count == 2);
+
+    /* It is still linked and expires once due */
+    expiration_rewind(far, 4096 * 100);
+    expiration_run();
+    TEST_ASSERT(cookie_entry(ind_core_ft, 4) == NULL);
+    TEST_ASSERT(cookie_entry(ind_core_ft, 3) == live);
+
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    TEST_ASSERT(status->current_count == 0);
+
+    return TEST_PASS;
+}
+
+
+int
+test_flow_stats(void)
+{
+    return TEST_PASS;
+}
+
+/* Send a flow stats request for all flows; return the number of entries */
+static int
+flow_stats_poll(uint16_t flags)
+{
+    of_flow_stats_request_t *req;
+    of_match_t match;
+
+    req = of_flow_stats_request_new(OF_VERSION_1_0);
+    if (req == NULL) {
+        return -1;
+    }
+    memset(&match, 0, sizeof(match));
+    if (of_flow_stats_request_match_set(req, &match) < 0) {
+        of_object_delete(req);
+        return -1;
+    }
+    of_flow_stats_request_table_id_set(req, TABLE_ID_ANY);
+    of_flow_stats_request_out_port_set(req, OF_PORT_DEST_WILDCARD);
+    of_flow_stats_request_flags_set(req, flags);
+
+    flow_stats_reply_entries = 0;
+    handle_message(req);
+    if (do_barrier() != INDIGO_ERROR_NONE) {
+        return -1;
+    }
+
+    /* Keep the next request from starting in the same millisecond */
+    usleep(2000);
+
+    return flow_stats_reply_entries;
+}
+
+/* Delta flow stats report only the flows whose counters changed */
+int
+test_flow_stats_delta(void)
+{
+    of_flow_add_t *flow_add;
+    int idx;
+
+    fwd_flow_packets = 0;
+    for (idx = 0; idx < 4; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        handle_message(flow_add);
+    }
+    TEST_INDIGO_OK(do_barrier());
+    usleep(2000);
+
+    /* The first delta poll reports everything */
+    TEST_ASSERT(flow_stats_poll(INDIGO_CORE_FLOW_STATS_REQ_BSN_DELTA) == 4);
+
+    /* Nothing changed */
+    TEST_ASSERT(flow_stats_poll(INDIGO_CORE_FLOW_STATS_REQ_BSN_DELTA) == 0);
+    TEST_ASSERT(flow_stats_poll(0) == 4);
+
+    /* Every counter changed */
+    fwd_flow_packets = 10;
+    TEST_ASSERT(flow_stats_poll(INDIGO_CORE_FLOW_STATS_REQ_BSN_DELTA) == 4);
+
+    fwd_flow_packets = 0;
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+
+    return TEST_PASS;
+}
+
+/* Paginated flow stats walk the table a page per request */
+static int
+test_flow_stats_page(void)
+{
+    uint16_t page = INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE |
+        (2 << INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_SHIFT_SHIFT);
+    of_flow_add_t *flow_add;
+    int idx;
+
+    for (idx = 0; idx < 10; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        handle_message(flow_add);
+    }
+    TEST_INDIGO_OK(do_barrier());
+
+    TEST_ASSERT(flow_stats_poll(page) == 4);
+    TEST_ASSERT(flow_stats_reply_flags &
+                INDIGO_CORE_FLOW_STATS_REPLY_BSN_PAGE_MORE);
+    TEST_ASSERT(flow_stats_poll(page) == 4);
+    TEST_ASSERT(flow_stats_reply_flags &
+                INDIGO_CORE_FLOW_STATS_REPLY_BSN_PAGE_MORE);
+    TEST_ASSERT(flow_stats_poll(page) == 2);
+    TEST_ASSERT(flow_stats_reply_flags == 0);
+
+    /* The next request starts a new walk */
+    TEST_ASSERT(flow_stats_poll(page) == 4);
+    TEST_ASSERT(flow_stats_poll(
+        page | INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_RESTART) == 4);
+
+    /* Flows deleted mid-walk are skipped */
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    TEST_ASSERT(flow_stats_poll(page) == 0);
+    TEST_ASSERT(flow_stats_reply_flags == 0);
+
+    return TEST_PASS;
+}
+
+/* Flow and aggregate stats read the counters of many flows per call */
+static int
+test_flow_stats_bulk(void)
+{
+    of_aggregate_stats_request_t *req;
+    of_flow_add_t *flow_add;
+    ind_core_driver_stats_t stats;
+    of_match_t match;
+    int batches = (TEST_FLOW_COUNT + OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX
+                   - 1) / OFSTATEMANAGER_CONFIG_FLOW_STATS_BATCH_MAX;
+    int idx;
+
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        handle_message(flow_add);
+    }
+    TEST_INDIGO_OK(do_barrier());
+    fwd_flow_packets = 3;
+
+    ind_core_driver_stats_clear();
+    TEST_ASSERT(flow_stats_poll(0) == TEST_FLOW_COUNT);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_stats_bulk_get,
+                              &stats);
+    TEST_ASSERT(stats.calls == batches);
+
+    ind_core_driver_stats_clear();
+    req = of_aggregate_stats_request_new(OF_VERSION_1_0);
+    TEST_ASSERT(req != NULL);
+    memset(&match, 0, sizeof(match));
+    TEST_OK(of_aggregate_stats_request_match_set(req, &match));
+    of_aggregate_stats_request_table_id_set(req, TABLE_ID_ANY);
+    of_aggregate_stats_request_out_port_set(req, OF_PORT_DEST_WILDCARD);
+    aggregate_stats_reply_flows = 0;
+    aggregate_stats_reply_packets = 0;
+    handle_message(req);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(aggregate_stats_reply_flows == TEST_FLOW_COUNT);
+    TEST_ASSERT(aggregate_stats_reply_packets == 3 * TEST_FLOW_COUNT);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_stats_bulk_get,
+                              &stats);
+    TEST_ASSERT(stats.calls == batches);
+
+    fwd_flow_packets = 0;
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+
+    return TEST_PASS;
+}
+
+static int ft_show_count;
+
+static void
+ft_show_done(void *cookie, int count)
+{
+    ft_show_count = count;
+}
+
+/* Run ind_core_ft_show_start to completion; return the flows written */
+static int
+ft_show_run(const ind_core_ft_filter_t *filter)
+{
+    ft_show_count = -1;
+    if (ind_core_ft_show_start(&aim_pvs_stdout, filter, false,
+                               ft_show_done, NULL) < 0) {
+        return -1;
+    }
+    while (ft_show_count < 0) {
+        ind_soc_select_and_run(0);
+    }
+    return ft_show_count;
+}
+
+/* The background flow dump writes the flows matching its filter */
+int
+test_ft_show_start(void)
+{
+    of_flow_add_t *flow_add;
+    ind_core_ft_filter_t filter;
+    int idx;
+
+    for (idx = 0; idx < 4; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        of_flow_add_cookie_set(flow_add, idx);
+        handle_message(flow_add);
+    }
+    TEST_INDIGO_OK(do_barrier());
+
+    TEST_ASSERT(ft_show_run(NULL) == 4);
+
+    ind_core_ft_filter_init(&filter);
+    TEST_ASSERT(ft_show_run(&filter) == 4);
+
+    filter.cookie = 2;
+    filter.cookie_mask = 0xffffffffffffffffULL;
+    TEST_ASSERT(ft_show_run(&filter) == 1);
+
+    ind_core_ft_filter_init(&filter);
+    filter.table_id = 1;
+    TEST_ASSERT(ft_show_run(&filter) == 0);
+
+    filter.table_id = TABLE_ID_ANY;
+    TEST_ASSERT(ind_core_ft_show_start(&aim_pvs_stdout, &filter, false,
+                                       NULL, NULL) == INDIGO_ERROR_PARAM);
+
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+
+    return TEST_PASS;
+}
+
+/* Replies encoded by the flow stats workers match the inline ones */
+int
+test_flow_stats_workers(void)
+{
+    of_flow_add_t *flow_add;
+    int replies;
+    int idx;
+
+    /* Enough flows for several batches and replies */
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        handle_message(flow_add);
+    }
+    TEST_INDIGO_OK(do_barrier());
+
+    TEST_ASSERT(ind_core_flow_stats_workers_enable_set(-1) ==
+                INDIGO_ERROR_PARAM);
+
+    replies = controller_message_counters[OF_FLOW_STATS_REPLY];
+    TEST_ASSERT(flow_stats_poll(0) == TEST_FLOW_COUNT);
+    replies = controller_message_counters[OF_FLOW_STATS_REPLY] - replies;
+    TEST_ASSERT(replies > 1);
+
+    TEST_INDIGO_OK(ind_core_flow_stats_workers_enable_set(2));
+    TEST_ASSERT(ind_core_flow_stats_workers_enabled());
+    controller_message_counters[OF_FLOW_STATS_REPLY] = 0;
+    TEST_ASSERT(flow_stats_poll(0) == TEST_FLOW_COUNT);
+    TEST_ASSERT(controller_message_counters[OF_FLOW_STATS_REPLY] == replies);
+
+    /* Several requests in flight at once */
+    flow_stats_reply_entries = 0;
+    for (idx = 0; idx < 3; idx++) {
+        of_flow_stats_request_t *req = of_flow_stats_request_new(OF_VERSION_1_0);
+        of_match_t match;
+        TEST_ASSERT(req != NULL);
+        memset(&match, 0, sizeof(match));
+        TEST_OK(of_flow_stats_request_match_set(req, &match));
+        of_flow_stats_request_table_id_set(req, TABLE_ID_ANY);
+        of_flow_stats_request_out_port_set(req, OF_PORT_DEST_WILDCARD);
+        handle_message(req);
+    }
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(flow_stats_reply_entries == 3 * TEST_FLOW_COUNT);
+
+    /* Stopped again, replies are encoded inline */
+    TEST_INDIGO_OK(ind_core_flow_stats_workers_enable_set(0));
+    TEST_ASSERT(!ind_core_flow_stats_workers_enabled());
+    TEST_ASSERT(flow_stats_poll(0) == TEST_FLOW_COUNT);
+
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+
+    return TEST_PASS;
+}
+
+/* Flows come back from a checkpoint under their old IDs */
+int
+test_flow_checkpoint(void)
+{
+    char path[] = "/tmp/flow_checkpoint_XXXXXX";
+    indigo_flow_id_t ids[TEST_FLOW_COUNT + 1];
+    of_flow_add_t *flow_add;
+    ft_entry_t *entry;
+    list_links_t *cur, *next;
+    int count = 0;
+    int fd;
+    int idx;
+
+    fd = mkstemp(path);
+    TEST_ASSERT(fd >= 0);
+    close(fd);
+
+    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
+        flow_add = of_flow_add_new(OF_VERSION_1_0);
+        TEST_ASSERT(flow_add != NULL);
+        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
+        of_flow_add_flags_set(flow_add, 0);
+        handle_message(flow_add);
+    }
+    TEST_INDIGO_OK(do_barrier());
+
+    TEST_INDIGO_OK(indigo_core_flow_checkpoint_start(path));
+
+    /* Appended after the initial flows */
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    TEST_ASSERT(flow_add != NULL);
+    TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, TEST_FLOW_COUNT) != 0);
+    of_flow_add_flags_set(flow_add, 0);
+    handle_message(flow_add);
+    TEST_INDIGO_OK(do_barrier());
+
+    entry = FT_ENTRY_CONTAINER(ind_core_ft->all_list.links.next, table);
+    ind_core_flow_entry_delete(entry, INDIGO_FLOW_REMOVED_DELETE, NULL);
+
+    FT_ITER(ind_core_ft, entry, cur, next) {
+        ids[count++] = entry->id;
+    }
+    TEST_ASSERT(count == TEST_FLOW_COUNT);
+
+    indigo_core_flow_checkpoint_stop();
+
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+    CHECK_FLOW_COUNT(&ind_core_ft->status, 0);
+
+    fwd_restore_calls = 0;
+    fwd_restore_end_calls = 0;
+    TEST_INDIGO_OK(indigo_core_flow_checkpoint_restore(path));
+    CHECK_FLOW_COUNT(&ind_core_ft->status, count);
+    TEST_ASSERT(fwd_restore_calls == count);
+    TEST_ASSERT(fwd_restore_end_calls == 1);
+    for (idx = 0; idx < count; idx++) {
+        TEST_ASSERT(ft_lookup(ind_core_ft, ids[idx]) != NULL);
+    }
+
+    TEST_ASSERT(indigo_core_flow_checkpoint_restore(path) ==
+                INDIGO_ERROR_EXISTS);
+
+    /* New flows do not reuse the restored IDs */
+    flow_add = of_flow_add_new(OF_VERSION_1_0);
+    TEST_ASSERT(flow_add != NULL);
+    TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, TEST_FLOW_COUNT + 1) != 0);
+    of_flow_add_flags_set(flow_add, 0);
+    handle_message(flow_add);
+    TEST_INDIGO_OK(do_barrier());
+    CHECK_FLOW_COUNT(&ind_core_ft->status, count + 1);
+    for (idx = 0; idx < count; idx++) {
+        TEST_ASSERT(ft_lookup(ind_core_ft, ids[idx]) != NULL);
+    }
+
+    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
+
+    unlink(path);
+    TEST_ASSERT(indigo_core_flow_checkpoint_restore(path) ==
+                INDIGO_ERROR_NOT_FOUND);
+
+    return TEST_PASS;
+}
+
+/* Add a flow whose actions refer to group_id, or to no group if 0 */
+static int
+group_flow_add(uint16_t priority, uint32_t group_id)
+{
+    of_flow_add_t *flow_add;
+    of_list_instruction_t *instructions;
+    of_instruction_apply_actions_t *apply;
+    of_list_action_t actions;
+    of_action_group_t *action;
+
+    flow_add = of_flow_add_new(OF_VERSION_1_3);
+    TEST_ASSERT(flow_add != NULL);
+    of_flow_add_priority_set(flow_add, priority);
+
+    instructions = of_list_instruction_new(OF_VERSION_1_3);
+    TEST_ASSERT(instructions != NULL);
+    if (group_id != 0) {
+        apply = of_instruction_apply_actions_new(OF_VERSION_1_3);
+        TEST_ASSERT(apply != NULL);
+        of_instruction_apply_actions_actions_bind(apply, &actions);
+        action = of_action_group_new(OF_VERSION_1_3);
+        TEST_ASSERT(action != NULL);
+        of_action_group_group_id_set(action, group_id);
+        TEST_OK(of_list_append(&actions, action));
+        of_object_delete(action);
+        TEST_OK(of_list_append(instructions, apply));
+        of_object_delete(apply);
+    }
+    TEST_OK(of_flow_add_instructions_set(flow_add, instructions));
+    of_object_delete(instructions);
+
+    handle_message(flow_add);
+
+    return TEST_PASS;
+}
+
+/* Send a flow stats request for the flows referring to a group */
+static int
+group_flow_stats_poll(uint32_t group_id)
+{
+    of_flow_stats_request_t *req;
+    of_match_t match;
+
+    req = of_flow_stats_request_new(OF_VERSION_1_3);
+    if (req == NULL) {
+        return -1;
+    }
+    memset(&match, 0, sizeof(match));
+    if (of_flow_stats_request_match_set(req, &match) < 0) {
+        of_object_delete(req);
+        return -1;
+    }
+    of_flow_stats_request_table_id_set(req, TABLE_ID_ANY);
+    of_flow_stats_request_out_port_set(req, OF_PORT_DEST_WILDCARD);
+    of_flow_stats_request_out_group_set(req, group_id);
+
+    flow_stats_reply_entries = 0;
+    handle_message(req);
+    if (do_barrier() != INDIGO_ERROR_NONE) {
+        return -1;
+    }
 
-    return TEST_PASS;
+    return flow_stats_reply_entries;
 }
 
-/* Add n flows, delete one by one */
+/* Deleting a group deletes the flows referring to it */
 int
-test_modify(void)
+test_group_delete(void)
 {
-    of_flow_add_t *flow_add_keep[TEST_FLOW_COUNT];
-    of_flow_add_t *flow_add;
-    of_flow_modify_t *flow_mod;
+    of_group_add_t *group_add;
+    of_group_delete_t *group_del;
     ft_status_t *status;
-    int idx;
-    of_match_t match;
-    uint16_t prio;
+    uint32_t id;
 
     status = FT_STATUS(ind_core_ft);
-    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
-        flow_add = of_flow_add_new(OF_VERSION_1_0);
-        TEST_ASSERT(flow_add != NULL);
-        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
-        of_flow_add_flags_set(flow_add, 0);
-        flow_add_keep[idx] = of_object_dup(flow_add);
-        handle_message(flow_add);
-        TEST_INDIGO_OK(do_barrier());
-        CHECK_FLOW_COUNT(status, idx + 1);
-    }
 
-    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
-        INDIGO_MEM_CLEAR(&match, sizeof(match));
-        /* Match the source mac addr which should be diff for each entry */
-        TEST_OK(of_flow_add_match_get(flow_add_keep[idx], &match));
-        of_flow_add_priority_get(flow_add_keep[idx], &prio);
-        flow_mod = of_flow_modify_new(OF_VERSION_1_0);
-        TEST_ASSERT(flow_mod != NULL);
-        of_flow_modify_out_port_set(flow_mod, OF_PORT_DEST_WILDCARD);
-        of_flow_modify_priority_set(flow_mod, prio);
-        TEST_OK(of_flow_modify_match_set(flow_mod, &match));
-        handle_message(flow_mod);
-        TEST_OK(do_barrier());
-        CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
-        of_flow_add_delete(flow_add_keep[idx]);
+    for (id = 1; id <= 2; id++) {
+        group_add = of_group_add_new(OF_VERSION_1_3);
+        TEST_ASSERT(group_add != NULL);
+        of_group_add_group_id_set(group_add, id);
+        of_group_add_group_type_set(group_add, OF_GROUP_TYPE_SELECT);
+        handle_message(group_add);
     }
-    CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
-    /* Delete all the entries */
+
+    TEST_ASSERT(group_flow_add(1, 1) == TEST_PASS);
+    TEST_ASSERT(group_flow_add(2, 1) == TEST_PASS);
+    TEST_ASSERT(group_flow_add(3, 2) == TEST_PASS);
+    TEST_ASSERT(group_flow_add(4, 0) == TEST_PASS);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(status->current_count == 4);
+
+    TEST_ASSERT(group_flow_stats_poll(1) == 2);
+    TEST_ASSERT(group_flow_stats_poll(2) == 1);
+    TEST_ASSERT(group_flow_stats_poll(OF_GROUP_ANY) == 4);
+
+    group_del = of_group_delete_new(OF_VERSION_1_3);
+    TEST_ASSERT(group_del != NULL);
+    of_group_delete_group_id_set(group_del, 1);
+    handle_message(group_del);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(status->current_count == 2);
+    TEST_ASSERT(group_flow_stats_poll(1) == 0);
+
+    group_del = of_group_delete_new(OF_VERSION_1_3);
+    TEST_ASSERT(group_del != NULL);
+    of_group_delete_group_id_set(group_del, OF_GROUP_ALL);
+    handle_message(group_del);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(status->current_count == 1);
+
     TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
-    TEST_ASSERT(status->current_count == 0);
 
     return TEST_PASS;
 }
 
-/* Add n flows, delete one by one */
+/* Group stats and group desc replies are built by a task */
 int
-test_modify_strict(void)
+test_group_stats(void)
 {
-    of_flow_add_t *flow_add_keep[TEST_FLOW_COUNT];
-    of_flow_add_t *flow_add;
-    of_flow_modify_strict_t *flow_mod;
-    ft_status_t *status;
-    int idx;
-    of_match_t match;
-    uint16_t prio;
+    of_group_add_t *group_add;
+    of_group_stats_request_t *stats_req;
+    of_group_desc_stats_request_t *desc_req;
+    of_group_delete_t *group_del;
+    int stats_replies = controller_message_counters[OF_GROUP_STATS_REPLY];
+    int desc_replies = controller_message_counters[OF_GROUP_DESC_STATS_REPLY];
+    uint32_t id;
+
+    for (id = 1; id <= 100; id++) {
+        group_add = of_group_add_new(OF_VERSION_1_3);
+        TEST_ASSERT(group_add != NULL);
+        of_group_add_group_id_set(group_add, id);
+        of_group_add_group_type_set(group_add, OF_GROUP_TYPE_SELECT);
+        handle_message(group_add);
+    }
+    TEST_INDIGO_OK(do_barrier());
 
-    status = FT_STATUS(ind_core_ft);
-    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
-        flow_add = of_flow_add_new(OF_VERSION_1_0);
-        TEST_ASSERT(flow_add != NULL);
-        TEST_ASSERT(of_flow_add_OF_VERSION_1_0_populate(flow_add, idx) != 0);
-        of_flow_add_flags_set(flow_add, 0);
-        flow_add_keep[idx] = of_object_dup(flow_add);
-        handle_message(flow_add);
-        TEST_INDIGO_OK(do_barrier());
-        CHECK_FLOW_COUNT(status, idx + 1);
+    fwd_group_stats_entries = 0;
+    stats_req = of_group_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(stats_req != NULL);
+    of_group_stats_request_group_id_set(stats_req, OF_GROUP_ALL);
+    handle_message(stats_req);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(fwd_group_stats_entries == 100);
+    TEST_ASSERT(controller_message_counters[OF_GROUP_STATS_REPLY] ==
+                stats_replies + 1);
+
+    /* A single group */
+    fwd_group_stats_entries = 0;
+    stats_req = of_group_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(stats_req != NULL);
+    of_group_stats_request_group_id_set(stats_req, 7);
+    handle_message(stats_req);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(fwd_group_stats_entries == 1);
+
+    desc_req = of_group_desc_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(desc_req != NULL);
+    handle_message(desc_req);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(controller_message_counters[OF_GROUP_DESC_STATS_REPLY] ==
+                desc_replies + 1);
+
+    group_del = of_group_delete_new(OF_VERSION_1_3);
+    TEST_ASSERT(group_del != NULL);
+    of_group_delete_group_id_set(group_del, OF_GROUP_ALL);
+    handle_message(group_del);
+    TEST_INDIGO_OK(do_barrier());
+
+    return TEST_PASS;
+}
+
+int
+test_counter_cache(void)
+{
+    of_table_stats_request_t *table_req;
+    of_group_add_t *group_add;
+    of_group_modify_t *group_mod;
+    of_group_stats_request_t *stats_req;
+    of_group_delete_t *group_del;
+    indigo_fi_vlan_stats_t vlan_stats[4];
+    uint16_t vlan_vids[4];
+    int table_replies = controller_message_counters[OF_TABLE_STATS_REPLY];
+    int i;
+
+    TEST_INDIGO_OK(ind_core_counter_cache_enable_set(60000));
+
+    /* A second table stats request is answered from the cache */
+    fwd_table_stats_calls = 0;
+    for (i = 0; i < 2; i++) {
+        table_req = of_table_stats_request_new(OF_VERSION_1_3);
+        TEST_ASSERT(table_req != NULL);
+        handle_message(table_req);
     }
+    TEST_ASSERT(fwd_table_stats_calls == 1);
+    TEST_ASSERT(controller_message_counters[OF_TABLE_STATS_REPLY] ==
+                table_replies + 2);
+
+    /* A single VLAN is read once */
+    fwd_vlan_stats_calls = 0;
+    ind_core_vlan_stats_get(10, &vlan_stats[0]);
+    ind_core_vlan_stats_get(10, &vlan_stats[0]);
+    TEST_ASSERT(fwd_vlan_stats_calls == 1);
+    TEST_ASSERT(vlan_stats[0].rx_packets == 10);
+
+    /* Listing the VLANs reads each once and refreshes single lookups */
+    fwd_vlan_stats_calls = 0;
+    TEST_ASSERT(ind_core_vlan_stats_bulk_get(1, vlan_vids, vlan_stats, 4) == 4);
+    TEST_ASSERT(vlan_vids[0] == 1 && vlan_vids[3] == 4);
+    TEST_ASSERT(vlan_stats[3].rx_packets == 4);
+    TEST_ASSERT(ind_core_vlan_stats_bulk_get(4093, vlan_vids, vlan_stats, 4) == 3);
+    TEST_ASSERT(vlan_vids[2] == 4095);
+    ind_core_vlan_stats_get(20, &vlan_stats[0]);
+    TEST_ASSERT(vlan_stats[0].rx_packets == 20);
+    TEST_ASSERT(fwd_vlan_stats_calls == 4095);
+
+    /* Group stats are cached until the group is modified */
+    group_add = of_group_add_new(OF_VERSION_1_3);
+    TEST_ASSERT(group_add != NULL);
+    of_group_add_group_id_set(group_add, 1);
+    of_group_add_group_type_set(group_add, OF_GROUP_TYPE_SELECT);
+    handle_message(group_add);
+    TEST_INDIGO_OK(do_barrier());
 
-    for (idx = 0; idx < TEST_FLOW_COUNT; idx++) {
-        INDIGO_MEM_CLEAR(&match, sizeof(match));
-        /* Match the source mac addr which should be diff for each entry */
-        TEST_OK(of_flow_add_match_get(flow_add_keep[idx], &match));
-        of_flow_add_priority_get(flow_add_keep[idx], &prio);
-        flow_mod = of_flow_modify_strict_new(OF_VERSION_1_0);
-        TEST_ASSERT(flow_mod != NULL);
-        of_flow_modify_strict_out_port_set(flow_mod, OF_PORT_DEST_WILDCARD);
-        of_flow_modify_strict_priority_set(flow_mod, prio);
-        TEST_OK(of_flow_modify_strict_match_set(flow_mod, &match));
-        handle_message(flow_mod);
+    fwd_group_stats_entries = 0;
+    for (i = 0; i < 2; i++) {
+        stats_req = of_group_stats_request_new(OF_VERSION_1_3);
+        TEST_ASSERT(stats_req != NULL);
+        of_group_stats_request_group_id_set(stats_req, 1);
+        handle_message(stats_req);
         TEST_INDIGO_OK(do_barrier());
-        CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
-        of_flow_add_delete(flow_add_keep[idx]);
     }
-    CHECK_FLOW_COUNT(status, TEST_FLOW_COUNT);
+    TEST_ASSERT(fwd_group_stats_entries == 1);
 
-    TEST_ASSERT(delete_all_entries(ind_core_ft) == TEST_PASS);
-    TEST_ASSERT(status->current_count == 0);
+    group_mod = of_group_modify_new(OF_VERSION_1_3);
+    TEST_ASSERT(group_mod != NULL);
+    of_group_modify_group_id_set(group_mod, 1);
+    of_group_modify_group_type_set(group_mod, OF_GROUP_TYPE_SELECT);
+    handle_message(group_mod);
+    TEST_INDIGO_OK(do_barrier());
+
+    stats_req = of_group_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(stats_req != NULL);
+    of_group_stats_request_group_id_set(stats_req, 1);
+    handle_message(stats_req);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(fwd_group_stats_entries == 2);
+
+    /* Disabled, every request reads Forwarding again */
+    TEST_INDIGO_OK(ind_core_counter_cache_enable_set(0));
+    fwd_table_stats_calls = 0;
+    fwd_vlan_stats_calls = 0;
+    table_req = of_table_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(table_req != NULL);
+    handle_message(table_req);
+    ind_core_vlan_stats_get(10, &vlan_stats[0]);
+    TEST_ASSERT(fwd_table_stats_calls == 1);
+    TEST_ASSERT(fwd_vlan_stats_calls == 1);
+
+    group_del = of_group_delete_new(OF_VERSION_1_3);
+    TEST_ASSERT(group_del != NULL);
+    of_group_delete_group_id_set(group_del, OF_GROUP_ALL);
+    handle_message(group_del);
+    TEST_INDIGO_OK(do_barrier());
 
     return TEST_PASS;
 }
 
+/* Entries and order of the BSN counter stats replies sent */
+static int counter_stats_replies;
+static int counter_stats_entries;
+static int counter_stats_more; /* Replies flagged REPLY_MORE */
+static uint32_t counter_stats_last_id;
+static int counter_stats_errors;
 
-int
-test_flow_stats(void)
+static void
+counter_stats_reply_hook(of_object_t *obj)
+{
+    of_object_t list, entry;
+    uint16_t flags;
+    int rv, loop_rv;
+
+    if (obj->object_id == OF_BSN_VLAN_COUNTER_STATS_REPLY) {
+        of_list_uint64_t values;
+        of_uint64_t value;
+        uint64_t rx_packets = 0;
+        uint16_t vlan_vid;
+        int idx;
+
+        of_bsn_vlan_counter_stats_reply_flags_get(obj, &flags);
+        of_bsn_vlan_counter_stats_reply_entries_bind(obj, &list);
+        OF_LIST_BSN_VLAN_COUNTER_STATS_ENTRY_ITER(&list, &entry, rv) {
+            of_bsn_vlan_counter_stats_entry_vlan_vid_get(&entry, &vlan_vid);
+            of_bsn_vlan_counter_stats_entry_values_bind(&entry, &values);
+            idx = 0;
+            OF_LIST_UINT64_ITER(&values, &value, loop_rv) {
+                if (idx++ == 1) {
+                    of_uint64_value_get(&value, &rx_packets);
+                }
+            }
+            /* Ascending, with the rx_packets of indigo_fwd_vlan_stats_get */
+            if (vlan_vid != counter_stats_last_id + 1 || rx_packets != vlan_vid) {
+                counter_stats_errors++;
+            }
+            counter_stats_last_id = vlan_vid;
+            counter_stats_entries++;
+        }
+    } else if (obj->object_id == OF_BSN_PORT_COUNTER_STATS_REPLY) {
+        of_port_no_t port_no;
+
+        of_bsn_port_counter_stats_reply_flags_get(obj, &flags);
+        of_bsn_port_counter_stats_reply_entries_bind(obj, &list);
+        OF_LIST_BSN_PORT_COUNTER_STATS_ENTRY_ITER(&list, &entry, rv) {
+            of_bsn_port_counter_stats_entry_port_no_get(&entry, &port_no);
+            /* In test_ports order */
+            if (port_no != test_ports[counter_stats_entries].of_port) {
+                counter_stats_errors++;
+            }
+            counter_stats_entries++;
+        }
+    } else {
+        return;
+    }
+
+    counter_stats_replies++;
+    if (flags & OF_STATS_REPLY_FLAG_REPLY_MORE) {
+        counter_stats_more++;
+    }
+}
+
+static void
+counter_stats_reset(void)
+{
+    counter_stats_replies = 0;
+    counter_stats_entries = 0;
+    counter_stats_more = 0;
+    counter_stats_last_id = 0;
+    counter_stats_errors = 0;
+}
+
+/* VLAN_ALL and port ALL counters are read in batches by a task */
+static int
+test_bsn_counter_stats(void)
 {
+    of_bsn_vlan_counter_stats_request_t *vlan_req;
+    of_bsn_port_counter_stats_request_t *port_req;
+    int i;
+
+    controller_message_hook = counter_stats_reply_hook;
+
+    /* Every VLAN, split over several replies */
+    counter_stats_reset();
+    fwd_vlan_stats_calls = 0;
+    vlan_req = of_bsn_vlan_counter_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(vlan_req != NULL);
+    of_bsn_vlan_counter_stats_request_vlan_vid_set(vlan_req, 0xffff);
+    handle_message(vlan_req);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(fwd_vlan_stats_calls == 4095);
+    TEST_ASSERT(counter_stats_entries == 4095);
+    TEST_ASSERT(counter_stats_errors == 0);
+    TEST_ASSERT(counter_stats_replies > 1);
+    TEST_ASSERT(counter_stats_more == counter_stats_replies - 1);
+
+    /* The task waits while the connection's output is blocked */
+    counter_stats_reset();
+    cxn_output_blocked = 1;
+    cxn_output_ready = NULL;
+    vlan_req = of_bsn_vlan_counter_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(vlan_req != NULL);
+    of_bsn_vlan_counter_stats_request_vlan_vid_set(vlan_req, 0xffff);
+    handle_message(vlan_req);
+    for (i = 0; i < 10 && cxn_output_ready == NULL; i++) {
+        ind_soc_select_and_run(0);
+    }
+    TEST_ASSERT(cxn_output_ready != NULL);
+    TEST_ASSERT(counter_stats_replies == 0);
+    cxn_output_blocked = 0;
+    cxn_output_ready(cxn_output_ready_cookie);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(counter_stats_entries == 4095);
+    TEST_ASSERT(counter_stats_errors == 0);
+
+    /* A single VLAN is answered at once */
+    counter_stats_reset();
+    counter_stats_last_id = 9;
+    vlan_req = of_bsn_vlan_counter_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(vlan_req != NULL);
+    of_bsn_vlan_counter_stats_request_vlan_vid_set(vlan_req, 10);
+    handle_message(vlan_req);
+    TEST_ASSERT(counter_stats_replies == 1);
+    TEST_ASSERT(counter_stats_entries == 1);
+    TEST_ASSERT(counter_stats_errors == 0);
+
+    /* Every port */
+    counter_stats_reset();
+    port_req = of_bsn_port_counter_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(port_req != NULL);
+    of_bsn_port_counter_stats_request_port_no_set(port_req, OF_PORT_DEST_ALL);
+    handle_message(port_req);
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(counter_stats_replies == 1);
+    TEST_ASSERT(counter_stats_entries == 2);
+    TEST_ASSERT(counter_stats_errors == 0);
+
+    controller_message_hook = NULL;
+
     return TEST_PASS;
 }
 
@@ -1316,6 +3599,134 @@ test_packet_in_listeners(void)
     return TEST_PASS;
 }
 
+/* Build a packet-in with the given ethertype, behind a VLAN tag if tagged */
+static of_packet_in_t *
+filter_packet_in(uint16_t eth_type, int tagged, uint8_t reason)
+{
+    of_packet_in_t *pkt_in;
+    uint8_t data[64];
+    of_octets_t octets = { .data = data, .bytes = sizeof(data) };
+    int offset = 12;
+
+    memset(data, 0, sizeof(data));
+    if (tagged) {
+        data[offset++] = 0x81;
+        data[offset++] = 0x00;
+        offset += 2;
+    }
+    data[offset++] = eth_type >> 8;
+    data[offset++] = eth_type & 0xff;
+
+    pkt_in = of_packet_in_new(OF_VERSION_1_0);
+    if (pkt_in != NULL) {
+        of_packet_in_reason_set(pkt_in, reason);
+        of_packet_in_in_port_set(pkt_in, 1);
+        if (of_packet_in_data_set(pkt_in, &octets) < 0) {
+            of_object_delete(pkt_in);
+            return NULL;
+        }
+    }
+
+    return pkt_in;
+}
+
+/* Filtered listeners only see matching packet-ins */
+int
+test_packet_in_listener_filters(void)
+{
+    indigo_core_packet_in_filter_t lldp = {
+        .fields = INDIGO_CORE_PACKET_IN_FILTER_ETH_TYPE,
+        .eth_type = 0x88cc,
+    };
+    indigo_core_packet_in_filter_t arp_action = {
+        .fields = INDIGO_CORE_PACKET_IN_FILTER_ETH_TYPE |
+                  INDIGO_CORE_PACKET_IN_FILTER_REASON,
+        .eth_type = 0x0806,
+        .reason = OF_PACKET_IN_REASON_ACTION,
+    };
+    indigo_core_packet_in_filter_t port2 = {
+        .fields = INDIGO_CORE_PACKET_IN_FILTER_IN_PORT,
+        .in_port = 2,
+    };
+
+    TEST_INDIGO_OK(indigo_core_packet_in_listener_register_filtered(
+        (indigo_core_packet_in_listener_f)listener0, &lldp));
+    TEST_INDIGO_OK(indigo_core_packet_in_listener_register_filtered(
+        (indigo_core_packet_in_listener_f)listener1, &arp_action));
+    TEST_INDIGO_OK(indigo_core_packet_in_listener_register_filtered(
+        (indigo_core_packet_in_listener_f)listener2, &port2));
+    TEST_ASSERT(indigo_core_packet_in_listener_register(
+        (indigo_core_packet_in_listener_f)listener0) == INDIGO_ERROR_EXISTS);
+
+    memset(listener_states, 0, sizeof(listener_states));
+
+    TEST_INDIGO_OK(indigo_core_packet_in(
+        filter_packet_in(0x88cc, 0, OF_PACKET_IN_REASON_ACTION)));
+    TEST_INDIGO_OK(indigo_core_packet_in(
+        filter_packet_in(0x88cc, 1, OF_PACKET_IN_REASON_NO_MATCH)));
+    TEST_ASSERT(listener_states[0].count == 2);
+    TEST_ASSERT(listener_states[1].count == 0);
+
+    TEST_INDIGO_OK(indigo_core_packet_in(
+        filter_packet_in(0x0806, 0, OF_PACKET_IN_REASON_NO_MATCH)));
+    TEST_ASSERT(listener_states[1].count == 0);
+    TEST_INDIGO_OK(indigo_core_packet_in(
+        filter_packet_in(0x0806, 1, OF_PACKET_IN_REASON_ACTION)));
+    TEST_ASSERT(listener_states[0].count == 2);
+    TEST_ASSERT(listener_states[1].count == 1);
+    TEST_ASSERT(listener_states[2].count == 0);
+
+    /* Dropped by a filtered listener */
+    listener_states[1].result = INDIGO_CORE_LISTENER_RESULT_DROP;
+    memset(async_message_counters, 0, sizeof(async_message_counters));
+    TEST_INDIGO_OK(indigo_core_packet_in(
+        filter_packet_in(0x0806, 0, OF_PACKET_IN_REASON_ACTION)));
+    TEST_ASSERT(listener_states[1].count == 2);
+    TEST_ASSERT(async_message_counters[OF_PACKET_IN] == 0);
+
+    indigo_core_packet_in_listener_unregister(
+        (indigo_core_packet_in_listener_f)listener0);
+    indigo_core_packet_in_listener_unregister(
+        (indigo_core_packet_in_listener_f)listener1);
+    indigo_core_packet_in_listener_unregister(
+        (indigo_core_packet_in_listener_f)listener2);
+
+    TEST_INDIGO_OK(indigo_core_packet_in(
+        filter_packet_in(0x0806, 0, OF_PACKET_IN_REASON_ACTION)));
+    TEST_ASSERT(listener_states[1].count == 2);
+
+    return TEST_PASS;
+}
+
+/* A burst of packet-ins goes through the listeners one by one */
+int
+test_packet_in_batch(void)
+{
+    indigo_core_packet_in_filter_t arp = {
+        .fields = INDIGO_CORE_PACKET_IN_FILTER_ETH_TYPE,
+        .eth_type = 0x0806,
+    };
+    of_packet_in_t *packet_ins[3];
+
+    TEST_INDIGO_OK(indigo_core_packet_in_listener_register_filtered(
+        (indigo_core_packet_in_listener_f)listener0, &arp));
+    memset(listener_states, 0, sizeof(listener_states));
+    listener_states[0].result = INDIGO_CORE_LISTENER_RESULT_DROP;
+    memset(async_message_counters, 0, sizeof(async_message_counters));
+
+    packet_ins[0] = filter_packet_in(0x88cc, 0, OF_PACKET_IN_REASON_ACTION);
+    packet_ins[1] = filter_packet_in(0x0806, 0, OF_PACKET_IN_REASON_ACTION);
+    packet_ins[2] = filter_packet_in(0x88cc, 0, OF_PACKET_IN_REASON_ACTION);
+    TEST_INDIGO_OK(indigo_core_packet_in_batch(packet_ins, 3));
+    TEST_ASSERT(listener_states[0].count == 1);
+    TEST_ASSERT(async_message_counters[OF_PACKET_IN] == 2);
+
+    indigo_core_packet_in_listener_unregister(
+        (indigo_core_packet_in_listener_f)listener0);
+
+    return TEST_PASS;
+}
+
 int
 test_port_status_listeners(void)
 {
@@ -1366,6 +3777,91 @@ test_port_status_listeners(void)
     return TEST_PASS;
 }
 
+static int port_status_batches;
+static int port_status_batch_entries;
+static uint8_t port_status_batch_reasons[4];
+
+static void
+port_status_batch_listener(of_port_status_t **port_statuses,
+                           int num_port_statuses)
+{
+    int i;
+
+    port_status_batches++;
+    for (i = 0; i < num_port_statuses && i < 4; i++) {
+        of_port_status_reason_get(port_statuses[i],
+                                  &port_status_batch_reasons[i]);
+    }
+    port_status_batch_entries += num_port_statuses;
+}
+
+static of_port_status_t *
+make_port_status(of_port_no_t port_no, uint8_t reason)
+{
+    of_port_status_t *port_status;
+    of_port_desc_t *desc;
+
+    port_status = of_port_status_new(OF_VERSION_1_3);
+    AIM_TRUE_OR_DIE(port_status != NULL);
+    of_port_status_reason_set(port_status, reason);
+
+    desc = of_port_desc_new(OF_VERSION_1_3);
+    AIM_TRUE_OR_DIE(desc != NULL);
+    of_port_desc_port_no_set(desc, port_no);
+    AIM_TRUE_OR_DIE(of_port_status_desc_set(port_status, desc) == 0);
+    of_object_delete(desc);
+
+    return port_status;
+}
+
+int
+test_port_status_coalesce(void)
+{
+    memset(async_message_counters, 0, sizeof(async_message_counters));
+    port_status_batches = 0;
+    port_status_batch_entries = 0;
+
+    TEST_INDIGO_OK(indigo_core_port_status_batch_listener_register(
+        port_status_batch_listener));
+    TEST_INDIGO_OK(ind_core_port_status_enable_set(1000, 0));
+
+    indigo_core_port_status_update(make_port_status(1, OF_PORT_CHANGE_REASON_ADD));
+    indigo_core_port_status_update(make_port_status(1, OF_PORT_CHANGE_REASON_MODIFY));
+    indigo_core_port_status_update(make_port_status(1, OF_PORT_CHANGE_REASON_MODIFY));
+    indigo_core_port_status_update(make_port_status(2, OF_PORT_CHANGE_REASON_MODIFY));
+    /* Cancels out */
+    indigo_core_port_status_update(make_port_status(3, OF_PORT_CHANGE_REASON_ADD));
+    indigo_core_port_status_update(make_port_status(3, OF_PORT_CHANGE_REASON_DELETE));
+    TEST_ASSERT(async_message_counters[OF_PORT_STATUS] == 0);
+    TEST_ASSERT(port_status_batches == 0);
+
+    /* Stopping coalescing delivers the held updates */
+    TEST_INDIGO_OK(ind_core_port_status_enable_set(0, 0));
+    TEST_ASSERT(async_message_counters[OF_PORT_STATUS] == 2);
+    TEST_ASSERT(port_status_batches == 1);
+    TEST_ASSERT(port_status_batch_entries == 2);
+    TEST_ASSERT(port_status_batch_reasons[0] == OF_PORT_CHANGE_REASON_ADD);
+    TEST_ASSERT(port_status_batch_reasons[1] == OF_PORT_CHANGE_REASON_MODIFY);
+
+    /* Held updates for a suppressed port are delivered on stop too */
+    TEST_INDIGO_OK(ind_core_port_status_enable_set(1000, 60000));
+    indigo_core_port_status_update(make_port_status(4, OF_PORT_CHANGE_REASON_MODIFY));
+    indigo_core_port_status_update(make_port_status(4, OF_PORT_CHANGE_REASON_MODIFY));
+    indigo_core_port_status_update(make_port_status(4, OF_PORT_CHANGE_REASON_MODIFY));
+    indigo_core_port_status_update(make_port_status(4, OF_PORT_CHANGE_REASON_MODIFY));
+    TEST_INDIGO_OK(ind_core_port_status_enable_set(0, 0));
+    TEST_ASSERT(async_message_counters[OF_PORT_STATUS] == 3);
+
+    indigo_core_port_status_batch_listener_unregister(port_status_batch_listener);
+
+    /* Without coalescing updates are delivered immediately */
+    indigo_core_port_status_update(make_port_status(1, OF_PORT_CHANGE_REASON_MODIFY));
+    TEST_ASSERT(async_message_counters[OF_PORT_STATUS] == 4);
+    TEST_ASSERT(port_status_batches == 2);
+
+    return TEST_PASS;
+}
+
 int
 test_message_listeners(void)
 {
@@ -1416,6 +3912,137 @@ test_message_listeners(void)
     return TEST_PASS;
 }
 
+static int table_mod_handled;
+
+static void
+table_mod_handler(of_object_t *obj, indigo_cxn_id_t cxn_id)
+{
+    table_mod_handled++;
+    of_object_delete(obj);
+}
+
+/* Listeners and handlers registered for one message type */
+int
+test_message_type_dispatch(void)
+{
+    memset(controller_message_counters, 0, sizeof(controller_message_counters));
+    memset(listener_states, 0, sizeof(listener_states));
+
+    TEST_INDIGO_OK(indigo_core_message_type_listener_register(
+        OF_FEATURES_REQUEST, (indigo_core_message_listener_f)listener0));
+    TEST_ASSERT(indigo_core_message_type_listener_register(
+        OF_FEATURES_REQUEST, (indigo_core_message_listener_f)listener0) ==
+        INDIGO_ERROR_EXISTS);
+    TEST_INDIGO_OK(indigo_core_message_handler_register(
+        OF_TABLE_MOD, table_mod_handler));
+    TEST_ASSERT(indigo_core_message_handler_register(
+        OF_TABLE_MOD, table_mod_handler) == INDIGO_ERROR_EXISTS);
+
+    /* The listener only sees its message type */
+    handle_message(of_features_request_new(OF_VERSION_1_3));
+    handle_message(of_table_mod_new(OF_VERSION_1_3));
+    TEST_INDIGO_OK(do_barrier());
+    TEST_ASSERT(listener_states[0].count == 1);
+    TEST_ASSERT(controller_message_counters[OF_FEATURES_REPLY] == 1);
+    TEST_ASSERT(table_mod_handled == 1);
+
+    /* Dropped before the default handler */
+    listener_states[0].result = INDIGO_CORE_LISTENER_RESULT_DROP;
+    handle_message(of_features_request_new(OF_VERSION_1_3));
+    TEST_ASSERT(listener_states[0].count == 2);
+    TEST_ASSERT(controller_message_counters[OF_FEATURES_REPLY] == 1);
+
+    indigo_core_message_type_listener_unregister(
+        OF_FEATURES_REQUEST, (indigo_core_message_listener_f)listener0);
+    indigo_core_message_handler_unregister(OF_TABLE_MOD, table_mod_handler);
+
+    handle_message(of_features_request_new(OF_VERSION_1_3));
+    handle_message(of_table_mod_new(OF_VERSION_1_3));
+    TEST_ASSERT(listener_states[0].count == 2);
+    TEST_ASSERT(controller_message_counters[OF_FEATURES_REPLY] == 2);
+    TEST_ASSERT(table_mod_handled == 1);
+
+    return TEST_PASS;
+}
+
+/* Forwarding and port manager calls are counted and timed */
+static int
+test_driver_stats(void)
+{
+    ind_core_driver_stats_t stats;
+
+    ind_core_driver_stats_clear();
+
+    handle_message(of_features_request_new(OF_VERSION_1_3));
+
+    ind_core_driver_stats_get(
+        IND_CORE_DRIVER_indigo_fwd_forwarding_features_get, &stats);
+    TEST_ASSERT(stats.calls == 1);
+    TEST_ASSERT(stats.errors == 0);
+    TEST_ASSERT(stats.us.count == 1);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_port_features_get,
+                              &stats);
+    TEST_ASSERT(stats.calls == 1);
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_create, &stats);
+    TEST_ASSERT(stats.calls == 0);
+
+    ind_core_driver_stats_clear();
+    ind_core_driver_stats_get(
+        IND_CORE_DRIVER_indigo_fwd_forwarding_features_get, &stats);
+    TEST_ASSERT(stats.calls == 0);
+    TEST_ASSERT(stats.us.count == 0);
+
+    return TEST_PASS;
+}
+
+static int
+test_port_stats(void)
+{
+    of_port_stats_request_t *req;
+    of_queue_stats_request_t *queue_req;
+    int replies = controller_message_counters[OF_PORT_STATS_REPLY];
+    int queue_replies = controller_message_counters[OF_QUEUE_STATS_REPLY];
+    int bulk_calls = port_stats_bulk_calls;
+
+    /* Two controllers polling all ports share one snapshot */
+    req = of_port_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(req != NULL);
+    of_port_stats_request_port_no_set(req, OF_PORT_DEST_WILDCARD);
+    handle_message(req);
+
+    req = of_port_stats_request_new(OF_VERSION_1_0);
+    TEST_ASSERT(req != NULL);
+    of_port_stats_request_port_no_set(req, OF_PORT_DEST_NONE);
+    handle_message(req);
+
+    /* A single port */
+    req = of_port_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(req != NULL);
+    of_port_stats_request_port_no_set(req, 1);
+    handle_message(req);
+
+    TEST_ASSERT(port_stats_bulk_calls == bulk_calls + 1);
+    TEST_ASSERT(controller_message_counters[OF_PORT_STATS_REPLY] ==
+                replies + 3);
+
+    /* An unknown port gets an error */
+    req = of_port_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(req != NULL);
+    of_port_stats_request_port_no_set(req, 99);
+    handle_message(req);
+    TEST_ASSERT(controller_message_counters[OF_PORT_STATS_REPLY] ==
+                replies + 3);
+
+    /* No bulk queue stats, so these go to indigo_port_queue_stats_get */
+    queue_req = of_queue_stats_request_new(OF_VERSION_1_3);
+    TEST_ASSERT(queue_req != NULL);
+    handle_message(queue_req);
+    TEST_ASSERT(controller_message_counters[OF_QUEUE_STATS_REPLY] ==
+                queue_replies + 1);
+
+    return TEST_PASS;
+}
+
 int
 aim_main(int argc, char* argv[])
 {
@@ -1426,14 +4053,24 @@ aim_main(int argc, char* argv[])
     ind_soc_enable_set(1);
 
     RUN_TEST(ft_hash);
+    RUN_TEST(ft_strict_match_hash);
+    RUN_TEST(ft_resize);
     RUN_TEST(ft_iterator);
+    RUN_TEST(ft_cookie_index);
+    RUN_TEST(ft_flow_id);
+    RUN_TEST(ft_checksum);
+    RUN_TEST(ft_stats_cache);
+    RUN_TEST(ft_eviction);
     RUN_TEST(ft_iter_task);
+    RUN_TEST(ft_read);
+    RUN_TEST(ft_match_query);
 
     /* Init Core */
     MEMSET(&core, 0, sizeof(core));
     core.expire_flows = 1;
     core.stats_check_ms = 1000;
     core.max_flowtable_entries = 1024;
+    core.port_stats_cache_ms = 1000;
 
     TRY(ind_core_init(&core));
     TRY(ind_core_enable_set(1));
@@ -1447,10 +4084,39 @@ aim_main(int argc, char* argv[])
     RUN_TEST(exact_add_del);
     RUN_TEST(modify);
     RUN_TEST(modify_strict);
+    RUN_TEST(flow_readd);
+    RUN_TEST(flow_expiration);
+
+    /* Again with Forwarding batching flow creates and modifies */
+    fwd_batch_enabled = 1;
+    RUN_TEST(flow_batch);
+    RUN_TEST(simple_add_del);
+    RUN_TEST(modify);
+    RUN_TEST(modify_strict);
+    fwd_batch_enabled = 0;
+    RUN_TEST(flow_async);
+    RUN_TEST(bundle);
+    RUN_TEST(flow_monitor);
+    RUN_TEST(flow_stats_delta);
+    RUN_TEST(flow_stats_page);
+    RUN_TEST(flow_stats_bulk);
+    RUN_TEST(flow_stats_workers);
+    RUN_TEST(ft_show_start);
+    RUN_TEST(flow_checkpoint);
+    RUN_TEST(group_delete);
+    RUN_TEST(group_stats);
+    RUN_TEST(counter_cache);
+    RUN_TEST(bsn_counter_stats);
+    RUN_TEST(port_stats);
 
     RUN_TEST(packet_in_listeners);
+    RUN_TEST(packet_in_listener_filters);
+    RUN_TEST(packet_in_batch);
     RUN_TEST(port_status_listeners);
+    RUN_TEST(port_status_coalesce);
     RUN_TEST(message_listeners);
+    RUN_TEST(message_type_dispatch);
+    RUN_TEST(driver_stats);
 
     if (test_gentable() != TEST_PASS) {
         return 1;
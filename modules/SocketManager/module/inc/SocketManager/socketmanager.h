@@ -37,6 +37,9 @@
 #include "socketmanager_config.h"
 
 #include <indigo/error.h>
+#include <indigo/time.h>
+#include <AIM/aim_list.h>
+#include <AIM/aim_pvs.h>
 #include <stdint.h>
 #include <limits.h>
 
@@ -46,6 +49,8 @@
 
 /*
  * Priorities are signed integers. Higher priority events are handled first.
+ * Up to 64 distinct priorities can be in use at once; beyond that an event
+ * shares the level of the nearest priority in use.
  */
 #define IND_SOC_DEFAULT_PRIORITY 0
 #define IND_SOC_HIGHEST_PRIORITY INT_MAX
@@ -68,6 +73,15 @@ typedef enum ind_soc_run_status_e {
 
 } ind_soc_run_status_t;
 
+/**
+ * Event loop instance
+ *
+ * Each loop has its own sockets, timers and tasks, and is run by one
+ * thread at a time. The socket, timer and task functions below operate on
+ * the calling thread's current loop; see ind_soc_loop_current_set.
+ */
+typedef struct ind_soc_loop_s ind_soc_loop_t;
+
 
 /**
  * Callback for socket ready
@@ -214,7 +228,7 @@ typedef void  (*ind_soc_timer_callback_f)(void *cookie);
  * milliseconds in the future.
  *
  * If no timer exists with the given callback and cookie then it will
- * be created.
+ * be created. There is no limit on the number of timers.
  */
 
 indigo_error_t ind_soc_timer_event_register_with_priority(
@@ -253,6 +267,92 @@ indigo_error_t ind_soc_timer_event_unregister(
     ind_soc_timer_callback_f callback,
     void *cookie);
 
+/**
+ * Timer handle
+ *
+ * Returned by ind_soc_timer_event_register_with_handle. A handle becomes
+ * stale once its timer is unregistered or, for IND_SOC_TIMER_IMMEDIATE
+ * timers, once it fires; operations on a stale handle return
+ * INDIGO_ERROR_NOT_FOUND.
+ */
+typedef uint64_t ind_soc_timer_handle_t;
+
+/** Never returned for a registered timer */
+#define IND_SOC_TIMER_HANDLE_INVALID 0
+
+/**
+ * Register a timer event and return a handle to it
+ *
+ * @param callback Timer callback function
+ * @param cookie Opaque data passed to callback
+ * @param repeat_time_ms Minimum time (ms) between timer callbacks,
+ *                       or IND_SOC_TIMER_IMMEDIATE
+ * @param priority Priority when handling events
+ * @param handle Output handle (may be NULL)
+ *
+ * Behaves like ind_soc_timer_event_register_with_priority. The handle
+ * can be used to rearm or cancel the timer without a lookup.
+ */
+
+indigo_error_t ind_soc_timer_event_register_with_handle(
+    ind_soc_timer_callback_f callback,
+    void *cookie,
+    int repeat_time_ms,
+    int priority,
+    ind_soc_timer_handle_t *handle);
+
+/**
+ * Register a timer event with a period in microseconds
+ *
+ * @param callback Timer callback function
+ * @param cookie Opaque data passed to callback
+ * @param repeat_time_us Minimum time (us) between timer callbacks,
+ *                       or IND_SOC_TIMER_IMMEDIATE
+ * @param priority Priority when handling events
+ * @param handle Output handle (may be NULL)
+ *
+ * Behaves like ind_soc_timer_event_register_with_handle, for periods
+ * below a millisecond. Deadlines are measured on the loop clock, so the
+ * precision is limited by how long other callbacks run.
+ */
+
+indigo_error_t ind_soc_timer_event_register_us(
+    ind_soc_timer_callback_f callback,
+    void *cookie,
+    int64_t repeat_time_us,
+    int priority,
+    ind_soc_timer_handle_t *handle);
+
+/**
+ * Reset a timer to run repeat_time_ms milliseconds in the future
+ *
+ * @param handle Handle from ind_soc_timer_event_register_with_handle
+ * @param repeat_time_ms New period, or IND_SOC_TIMER_IMMEDIATE
+ */
+
+indigo_error_t ind_soc_timer_event_rearm(
+    ind_soc_timer_handle_t handle,
+    int repeat_time_ms);
+
+/**
+ * Reset a timer to run repeat_time_us microseconds in the future
+ *
+ * @param handle Handle from ind_soc_timer_event_register_with_handle
+ * @param repeat_time_us New period, or IND_SOC_TIMER_IMMEDIATE
+ */
+
+indigo_error_t ind_soc_timer_event_rearm_us(
+    ind_soc_timer_handle_t handle,
+    int64_t repeat_time_us);
+
+/**
+ * Unregister a timer event by handle
+ *
+ * @param handle Handle from ind_soc_timer_event_register_with_handle
+ */
+
+indigo_error_t ind_soc_timer_event_cancel(ind_soc_timer_handle_t handle);
+
 /****************************************************************
  * Task functions
  ****************************************************************/
@@ -284,9 +384,152 @@ indigo_error_t ind_soc_task_register(
     ind_soc_task_callback_f callback,
     void *cookie, int priority);
 
+/**
+ * Task header
+ *
+ * ind_soc_task_register takes its task header from a per-loop pool.
+ * Callers that already allocate state for a task can embed a header in
+ * that state and start it with ind_soc_task_start, so spawning the task
+ * needs no allocation at all.
+ *
+ * The fields are private to SocketManager.
+ */
+
+typedef struct ind_soc_task_s {
+    list_links_t links;
+    ind_soc_task_callback_f callback;
+    void *cookie;
+    int priority;
+    struct priority_level_s *level;
+    uint64_t ready_us;
+    int flags;
+} ind_soc_task_t;
+
+/**
+ * Start a task using a caller-owned header
+ *
+ * @param task Task header, usually embedded in the cookie's structure
+ * @param callback Task callback function
+ * @param cookie Opaque data passed to callback
+ * @param priority Priority level
+ *
+ * Behaves like ind_soc_task_register. The header must stay valid and
+ * must not be started again until the callback returns
+ * IND_SOC_TASK_FINISHED. SocketManager does not touch the header once
+ * the callback has run for the last time, so the callback may free the
+ * structure containing it before returning IND_SOC_TASK_FINISHED.
+ */
+
+indigo_error_t ind_soc_task_start(
+    ind_soc_task_t *task,
+    ind_soc_task_callback_f callback,
+    void *cookie, int priority);
+
+/**
+ * Post a task from any thread
+ *
+ * @param callback Task callback function
+ * @param cookie Opaque data passed to callback
+ * @param priority Priority level
+ *
+ * Unlike ind_soc_task_register, this may be called from threads other
+ * than the one running the event loop. The task is queued without taking
+ * a lock and registered by the event loop when it next wakes; it then runs
+ * like any other task. Posts made while the loop has not yet woken share
+ * one wakeup, so producers can batch work cheaply.
+ *
+ * A task that finishes on its first run is a one-shot callback into the
+ * event loop; use it to register timers or sockets from another thread.
+ *
+ * Must not race with ind_soc_init or ind_soc_finish. Tasks posted but not
+ * yet run when the socket manager shuts down are discarded.
+ */
+
+indigo_error_t ind_soc_task_post(
+    ind_soc_task_callback_f callback,
+    void *cookie, int priority);
+
+/**
+ * Post a task to a given loop from any thread
+ *
+ * Same as ind_soc_task_post, but the task runs on the given loop rather
+ * than on the calling thread's current loop.
+ */
+
+indigo_error_t ind_soc_loop_task_post(
+    ind_soc_loop_t *loop,
+    ind_soc_task_callback_f callback,
+    void *cookie, int priority);
+
+
+/****************************************************************
+ * Pass end callbacks
+ ****************************************************************/
+
+/**
+ * Callback run at the end of each event loop pass
+ */
+typedef void (*ind_soc_pass_end_callback_f)(void *cookie);
+
+/* Maximum number of pass end callbacks per loop */
+#define IND_SOC_PASS_END_CALLBACKS_MAX 8
+
+/**
+ * Register a callback to run at the end of every event loop pass
+ *
+ * @param callback The function to call
+ * @param cookie Opaque data passed to callback
+ *
+ * A pass is one wait followed by the sockets, timers and tasks it made
+ * ready. The callbacks run after them on every pass. This suits work that
+ * should be batched over everything a pass did, such as flushing output
+ * queued by several callbacks.
+ *
+ * Registering the same callback and cookie again has no effect.
+ */
+
+indigo_error_t ind_soc_pass_end_register(
+    ind_soc_pass_end_callback_f callback,
+    void *cookie);
+
+/**
+ * Unregister a pass end callback
+ *
+ * @param callback The function passed to ind_soc_pass_end_register
+ * @param cookie The cookie passed to ind_soc_pass_end_register
+ */
+
+indigo_error_t ind_soc_pass_end_unregister(
+    ind_soc_pass_end_callback_f callback,
+    void *cookie);
+
+
+/**
+ * Event notification backend
+ *
+ * Selects the system call used to wait for socket events. The poll backend
+ * scans every registered socket on each iteration; the epoll and io_uring
+ * backends only return the sockets that are ready.
+ */
+typedef enum ind_soc_backend_e {
+    /** poll(2). Default. */
+    IND_SOC_BACKEND_POLL,
+    /** epoll(7), Linux only. */
+    IND_SOC_BACKEND_EPOLL,
+    /**
+     * io_uring(7) poll requests, Linux 5.11 or later. Readiness changes
+     * for all sockets are submitted in the same system call as the wait.
+     * Falls back to poll if unavailable.
+     */
+    IND_SOC_BACKEND_IO_URING,
+
+    /** Count. */
+    IND_SOC_BACKEND_COUNT
+} ind_soc_backend_t;
 
 typedef struct ind_soc_config_s {
     uint32_t flags; /* Ignored */
+    ind_soc_backend_t backend;
 } ind_soc_config_t;
 
 /****************************************************************
@@ -302,6 +545,9 @@ typedef struct ind_soc_config_s {
  *
  * The socket manager does not require any routines from other
  * modules.
+ *
+ * A NULL config selects the defaults. If the requested backend is not
+ * available the poll backend is used instead.
  */
 
 extern indigo_error_t ind_soc_init(ind_soc_config_t *config);
@@ -353,6 +599,29 @@ extern void ind_soc_run_status_set(ind_soc_run_status_t status);
 
 int ind_soc_should_yield(void);
 
+/**
+ * Current time on the event loop clock
+ *
+ * Within a SocketManager callback this returns the time cached when the
+ * loop last woke up or the previous callback finished, without reading
+ * the clock. Hot paths that only need the time to within a timeslice
+ * (timeouts, expirations, timestamps) should prefer it to
+ * INDIGO_CURRENT_TIME. Outside the event loop the clock is read.
+ *
+ * The clock is INDIGO_CURRENT_TIME_us, or INDIGO_CURRENT_TIME_COARSE_us
+ * if SOCKETMANAGER_CONFIG_COARSE_CLOCK is set.
+ */
+
+indigo_time_t ind_soc_loop_now(void);
+
+/**
+ * Current time on the event loop clock in microseconds
+ *
+ * See ind_soc_loop_now.
+ */
+
+indigo_time_us_t ind_soc_loop_now_us(void);
+
 
 /**
  * Enable the socket manager
@@ -372,5 +641,152 @@ extern indigo_error_t ind_soc_enable_get(int *enable);
 
 extern indigo_error_t ind_soc_finish(void);
 
+/****************************************************************
+ * Event loop instances
+ *
+ * ind_soc_init sets up the default loop, which is used by every thread
+ * that has not selected another one. Additional loops let sockets, timers
+ * and tasks be spread over several threads:
+ *
+ *     ind_soc_loop_create(&config, &loop);
+ *     ... in the new thread ...
+ *     ind_soc_loop_current_set(loop);
+ *     ind_soc_socket_register(...);
+ *     while (!done) ind_soc_select_and_run(-1);
+ *
+ * Other threads hand work to a loop with ind_soc_loop_task_post, for
+ * example a task that sets the run status to IND_SOC_RUN_STATUS_EXIT.
+ ****************************************************************/
+
+/**
+ * Create an event loop
+ * @param config Configuration for the loop, or NULL for defaults
+ * @param loop Set to the new loop on success
+ */
+
+extern indigo_error_t ind_soc_loop_create(ind_soc_config_t *config,
+                                          ind_soc_loop_t **loop);
+
+/**
+ * Destroy an event loop created by ind_soc_loop_create
+ *
+ * The loop must not be running. Its sockets are unregistered but not
+ * closed, and pending timers and tasks are discarded.
+ */
+
+extern void ind_soc_loop_destroy(ind_soc_loop_t *loop);
+
+/**
+ * Return the default loop set up by ind_soc_init
+ */
+
+extern ind_soc_loop_t *ind_soc_loop_default(void);
+
+/**
+ * Select the loop used by the calling thread
+ *
+ * @param loop The loop, or NULL for the default loop
+ */
+
+extern void ind_soc_loop_current_set(ind_soc_loop_t *loop);
+
+/**
+ * Return the loop used by the calling thread
+ */
+
+extern ind_soc_loop_t *ind_soc_loop_current(void);
+
+/****************************************************************
+ * Statistics
+ *
+ * Each loop records how long callbacks run and how long ready work
+ * waits before its callback is invoked. Durations are in microseconds
+ * and kept in power of two histograms: bucket 0 counts samples under
+ * 1 us, bucket i counts samples in [2^(i-1), 2^i) and the last bucket
+ * counts everything larger.
+ ****************************************************************/
+
+#define IND_SOC_HISTOGRAM_BUCKETS 24
+
+typedef struct ind_soc_histogram_s {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t buckets[IND_SOC_HISTOGRAM_BUCKETS];
+} ind_soc_histogram_t;
+
+/**
+ * Record a duration in a histogram
+ *
+ * Also usable by other modules for their own durations.
+ */
+
+extern void ind_soc_histogram_add(ind_soc_histogram_t *hist, uint64_t us);
+
+/**
+ * Print a histogram's count, average, maximum and nonempty buckets
+ */
+
+extern void ind_soc_histogram_show(aim_pvs_t *pvs, const char *name,
+                                   ind_soc_histogram_t *hist);
+
+/**
+ * Estimate a percentile of a histogram, in microseconds
+ * @param percent 0 to 100
+ *
+ * Returns the upper bound of the bucket holding the sample at that
+ * rank, capped at the maximum, or 0 if the histogram is empty.
+ */
+
+extern uint64_t ind_soc_histogram_percentile(const ind_soc_histogram_t *hist,
+                                             int percent);
+
+typedef enum ind_soc_callback_type_e {
+    IND_SOC_CALLBACK_TYPE_SOCKET,
+    IND_SOC_CALLBACK_TYPE_TIMER,
+    IND_SOC_CALLBACK_TYPE_TASK,
+    IND_SOC_CALLBACK_TYPE_COUNT,
+} ind_soc_callback_type_t;
+
+typedef struct ind_soc_callback_info_s {
+    ind_soc_callback_type_t type;
+    void *callback;
+    void *cookie;
+    int priority;
+    uint64_t duration_us;
+} ind_soc_callback_info_t;
+
+/* Priorities beyond this many distinct values are not tracked */
+#define IND_SOC_PRIORITY_STATS_MAX 64
+
+typedef struct ind_soc_priority_stats_s {
+    int priority;
+    ind_soc_histogram_t queue_delay; /* Ready until callback start */
+} ind_soc_priority_stats_t;
+
+typedef struct ind_soc_stats_s {
+    uint64_t iterations;
+    /* Callbacks that ran for at least SOCKETMANAGER_CONFIG_TIMESLICE_MS */
+    uint64_t timeslice_overruns;
+    ind_soc_histogram_t callback_duration[IND_SOC_CALLBACK_TYPE_COUNT];
+    ind_soc_callback_info_t slowest_callback;
+    int num_priorities;
+    ind_soc_priority_stats_t priorities[IND_SOC_PRIORITY_STATS_MAX];
+} ind_soc_stats_t;
+
+/**
+ * Copy the statistics of the current loop
+ *
+ * Priorities are sorted from highest to lowest.
+ */
+
+extern void ind_soc_stats_get(ind_soc_stats_t *stats);
+
+/**
+ * Reset the statistics of the current loop
+ */
+
+extern void ind_soc_stats_clear(void);
+
 #endif /* __SOCKETMANAGER_H__ */
 /* @} */
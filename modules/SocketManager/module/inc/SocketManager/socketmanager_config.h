@@ -118,6 +118,26 @@
 #define SOCKETMANAGER_CONFIG_TIMESLICE_MS 10
 #endif
 
+/**
+ * SOCKETMANAGER_CONFIG_COARSE_CLOCK
+ *
+ * Read the event loop clock with CLOCK_MONOTONIC_COARSE. */
+
+
+#ifndef SOCKETMANAGER_CONFIG_COARSE_CLOCK
+#define SOCKETMANAGER_CONFIG_COARSE_CLOCK 0
+#endif
+
+/**
+ * SOCKETMANAGER_CONFIG_INCLUDE_IO_URING
+ *
+ * Include the io_uring event backend (Linux 5.11 or later at runtime). */
+
+
+#ifndef SOCKETMANAGER_CONFIG_INCLUDE_IO_URING
+#define SOCKETMANAGER_CONFIG_INCLUDE_IO_URING 1
+#endif
+
 
 
 /**
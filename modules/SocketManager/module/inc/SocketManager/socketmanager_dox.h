@@ -29,7 +29,11 @@
  * file descriptors are ready for input or output. Periodic timers are also
  * supported.
  *
- * This module uses the select system call.
+ * This module uses the poll system call, or epoll when selected with the
+ * backend field of ind_soc_config_t.
+ *
+ * Several independent event loops can be created with ind_soc_loop_create,
+ * each run by its own thread.
  */
 
 #endif /* __SOCKETMANAGER_DOX_H__ */
@@ -21,7 +21,14 @@
  *
  * Implementation of SocketManager functionality
  *
- * Uses the socket ID as an index.
+ * Registered sockets are kept in dense arrays, with a table indexed by
+ * socket descriptor giving each socket's position. Both grow on demand, so
+ * any descriptor the process can open may be registered.
+ *
+ * Socket events are collected with poll(2), epoll(7) or io_uring(7) poll
+ * requests, selected by the backend in ind_soc_config_t. Either way the
+ * backend produces a list of ready sockets and only that list is walked
+ * when dispatching callbacks.
  *
  * SocketManager implements a fixed priority scheduler. Higher priority events
  * (timer or socket) are processed before lower priority events. Events with
@@ -29,22 +36,40 @@
  * loop processes one priority level before polling for potential new high
  * priority events.
  *
- * @todo Make the max socket ID supported a parameter to the module
- * @todo Make the max timer events supported a parameter to the module
+ * Each distinct priority in use has a priority level holding its ready
+ * sockets, due timers and tasks. Bitmaps record which levels have ready work,
+ * so picking the priority to run and dispatching its callbacks cost time
+ * proportional to the ready work rather than to everything registered.
+ *
+ * Timers are kept in a binary min-heap ordered by deadline, so finding the
+ * next expiration is O(1) and only due timers are visited when running
+ * callbacks. There is no limit on the number of timers. Timers can be looked
+ * up either by (callback, cookie) or by the handle returned at registration.
+ * Deadlines are kept in microseconds so periods below 1 ms can be honoured.
+ *
+ * Each loop caches the current time ("loop now"), refreshed when the wait
+ * returns and when each callback finishes. Scheduling decisions and
+ * callbacks that call ind_soc_loop_now use the cached value instead of
+ * reading the clock again.
+ *
+ * All of this state lives in an event loop instance (ind_soc_loop_t). The
+ * default loop is set up by ind_soc_init; more can be created so that
+ * sockets, timers and tasks are spread over several threads. The public
+ * functions operate on the calling thread's current loop, which falls back
+ * to the default loop. Other threads hand work to a loop with
+ * ind_soc_loop_task_post, which uses a lock-free queue and an eventfd wakeup.
  *
  * @todo Consider supporting both periodic and single events.  Currently
  * periodic events are supported with a special one-shot, immediate
  * operation.  Other than for one-shot events, events are responsible for
  * unregistering.
  *
- * For scheduling one-time events, the call should return an index.  The
- * "cancel" call should require both the index as well as the callback and
- * cookie pointers.
- *
  * See header file for detailed function documentation.
  *
  *****************************************************************************/
 
+#define _GNU_SOURCE /* ppoll */
+
 #include "socketmanager_log.h"
 #include "socketmanager_int.h"
 
@@ -57,13 +82,35 @@
 #include <AIM/aim_list.h>
 
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
-
-static void before_callback(void);
-static void after_callback(void);
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+struct priority_level_s;
+static indigo_time_us_t soc_time_us(void);
+static ind_soc_priority_stats_t *priority_stats_get(ind_soc_loop_t *loop,
+                                                    int priority);
+static void task_pool_reset(ind_soc_loop_t *loop);
+static void before_callback(ind_soc_loop_t *loop,
+                            struct priority_level_s *level,
+                            uint64_t ready_us);
+static uint64_t after_callback(ind_soc_loop_t *loop,
+                               struct priority_level_s *level,
+                               ind_soc_callback_type_t type,
+                               void *callback, void *cookie);
 
 static int init_done = 0;
 static int module_enabled = 0;
@@ -75,502 +122,2462 @@ static int module_enabled = 0;
 #define LOG_VERBOSE AIM_LOG_VERBOSE
 #define LOG_TRACE AIM_LOG_TRACE
 
-#define INVALID_SOCKET_ID -1
+/*
+ * Priority level
+ *
+ * Levels are kept sorted by descending priority in priority_levels. Bit i of
+ * each ready bitmap refers to priority_levels[i], so the lowest set bit is
+ * the highest priority with work of that kind.
+ *
+ * Levels are reference counted by the sockets, timers and tasks using them.
+ * Unused levels are freed at the top of the event loop, or when the table is
+ * full. The level whose callbacks are running is never freed.
+ */
+#define PRIORITY_LEVEL_MAX 64
+
+typedef struct priority_level_s {
+    int priority;
+    int index; /* Position in priority_levels */
+    int refcount;
+    int ready_socket_head; /* Chained through ready_socket_t.next */
+    int ready_socket_tail;
+    int ready_timer_head; /* Chained through timer_event_t.ready_next */
+    int ready_timer_tail;
+    list_head_t tasks;
+    ind_soc_priority_stats_t *stats; /* NULL if not tracked */
+} priority_level_t;
+
+#define LEVEL_BIT(level) ((uint64_t)1 << (level)->index)
+
+/* Initial number of socket slots; the socket arrays double when full */
+#define SOCKET_INITIAL_SLOTS 64
 
-/* Maximum simultaneous sockets to support */
-#define SOCKET_COUNT_MAX 1024
 typedef struct soc_map_s {
-    short socket_id;
-    uint16_t pollfd_index;
+    int socket_id;
     int priority;
+    priority_level_t *level;
     ind_soc_socket_ready_callback_f callback;
     void *cookie;
+    uint64_t ready_us; /* When the socket became ready, 0 if not ready */
+    uint64_t ready_iteration; /* Last iteration it was reported ready */
+    /* io_uring backend: the armed poll request, if uring_events != 0 */
+    uint32_t uring_gen;
+    short uring_events;
+    short uring_queued; /* In uring_arm */
 } soc_map_t;
 
-/* Indexed by socket descriptor */
-static soc_map_t soc_map[SOCKET_COUNT_MAX];
-
-/* Dense array passed to poll(2) */
-static struct pollfd pollfds[SOCKET_COUNT_MAX];
-static int num_pollfds = 0;
-
-#define IS_ACTIVE_SOCKET_ID(_id) (soc_map[_id].socket_id == (_id))
-#define IS_LEGAL_SOCKET_ID(_id) (((_id) >= 0) && ((_id) < SOCKET_COUNT_MAX))
-#define POLLFD_INDEX(_id) soc_map[(_id)].pollfd_index
+/*
+ * Sockets reported ready by the last wait, filled in by the backend.
+ * revents uses the poll(2) flags for all backends.
+ */
+typedef struct ready_socket_s {
+    int socket_id;
+    short revents;
+    int next; /* Next ready socket at the same priority level, or -1 */
+} ready_socket_t;
 
 /*
  * Timer event structure
- * Lookup is (callback, cookie)
+ * Lookup is (callback, cookie) or handle
+ *
+ * Timers are stored in a growable slot array. A slot is free when its
+ * callback is NULL; free slots are chained through 'next'. Active slots are
+ * chained through 'next' in their (callback, cookie) hash bucket.
+ *
+ * A pending timer is in the heap. Once due it is moved to the ready queue
+ * of its priority level (heap_index == -1) until its callback runs.
  */
 typedef struct timer_event_s {
     ind_soc_timer_callback_f callback;
     void *cookie;
-    int repeat_time_ms;
+    int64_t repeat_time_us;
     int priority;
-    indigo_time_t last_call;
+    priority_level_t *level;
+    indigo_time_us_t last_call;
+    indigo_time_us_t deadline; /* last_call + repeat_time_us */
+    uint32_t generation; /* Incremented when the slot is freed */
+    int heap_index;
+    int next;
+    int ready_prev;
+    int ready_next;
 } timer_event_t;
 
-/* Change to 48 for now */
-#define TIMER_EVENT_MAX 48
-static timer_event_t timer_event[TIMER_EVENT_MAX];
-
-#define TIMER_EVENT_VALID(idx) (timer_event[idx].callback != NULL)
-
-#define FOREACH_TIMER_EVENT(idx)                        \
-    for ((idx) = 0; (idx) < TIMER_EVENT_MAX; (idx)++)   \
-        if (TIMER_EVENT_VALID(idx))
+#define TIMER_EVENT_INITIAL_SLOTS 64
 
 /*
- * Task structure
+ * Tasks are ind_soc_task_t headers (see socketmanager.h), either embedded
+ * in caller state by ind_soc_task_start or taken from the loop's task pool
+ * by ind_soc_task_register. Pool tasks are carved out of chunks that are
+ * only freed with the loop.
  */
-typedef struct ind_soc_task_s {
-    list_links_t links; /* global tasks */
+#define TASK_F_POOLED 0x1
+
+#define TASK_POOL_CHUNK_TASKS 64
+
+typedef struct task_chunk_s {
+    struct task_chunk_s *next;
+    ind_soc_task_t tasks[TASK_POOL_CHUNK_TASKS];
+} task_chunk_t;
+
+/* Node in a loop's cross-thread post queue */
+typedef struct post_node_s {
+    struct post_node_s *next;
     ind_soc_task_callback_f callback;
     void *cookie;
     int priority;
-} ind_soc_task_t;
+} post_node_t;
+
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+/* Submission and completion rings shared with the kernel */
+typedef struct soc_uring_s {
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring; /* Same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP */
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned to_submit; /* Queued since the last io_uring_enter */
+} soc_uring_t;
+#endif
 
-/* Sorted in descending priority order */
-static list_head_t tasks;
+/*
+ * Event loop instance
+ *
+ * Everything but the post queue is only touched by the thread running the
+ * loop.
+ */
+struct ind_soc_loop_s {
+    ind_soc_backend_t backend;
+    ind_soc_run_status_t run_status;
 
+    /* Only used by the epoll backend */
+    int epoll_fd;
 
-/* Return index for timer; -1 if not found.  Use only with valid callback */
-static int
-timer_event_find(ind_soc_timer_callback_f callback, void *cookie)
-{
-    int idx;
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+    /* Only used by the io_uring backend */
+    soc_uring_t uring;
+    int *uring_arm; /* Sockets whose poll request must be (re)submitted */
+    int uring_arm_count;
+    int uring_arm_size;
+    uint32_t uring_next_gen;
+#endif
 
-    FOREACH_TIMER_EVENT(idx) {
-        if ((timer_event[idx].callback == callback) &&
-                (timer_event[idx].cookie == cookie)) {
-            return idx;
-        }
+    priority_level_t *priority_levels[PRIORITY_LEVEL_MAX];
+    int num_priority_levels;
+
+    /* Level being processed by the event loop, if any */
+    priority_level_t *current_level;
+
+    uint64_t ready_socket_levels;
+    uint64_t ready_timer_levels;
+    uint64_t ready_task_levels;
+
+    /*
+     * Registered sockets are stored densely: sockets[i] and pollfds[i]
+     * describe the same socket. pollfds[i].events holds the events
+     * (POLLIN/POLLOUT) requested by the client for every backend, and the
+     * array is passed to poll(2) directly by the poll backend.
+     *
+     * soc_index maps a socket descriptor to its index in the dense arrays,
+     * or -1 if the descriptor is not registered. It grows to cover the
+     * largest descriptor seen.
+     *
+     * epoll_events and ready_sockets also have socket_slots entries.
+     */
+    soc_map_t *sockets;
+    struct pollfd *pollfds;
+    int num_sockets;
+    int socket_slots;
+
+    int *soc_index;
+    int soc_index_size;
+
+    struct epoll_event *epoll_events;
+    ready_socket_t *ready_sockets;
+    int num_ready_sockets;
+
+    timer_event_t *timer_event;
+    int timer_event_slots;
+    int timer_event_count;
+    int timer_event_free_head;
+
+    /* Min-heap of slot indices ordered by deadline */
+    int *timer_heap;
+    int timer_heap_count;
+
+    /* Hash buckets of slot indices keyed on (callback, cookie). Power of 2. */
+    int *timer_hash;
+    int timer_hash_size;
+
+    /* Number of registered tasks */
+    int num_tasks;
+
+    /* Task pool, see task_pool_alloc */
+    task_chunk_t *task_chunks;
+    list_head_t task_free;
+
+    /* Cached clock, see soc_loop_now */
+    indigo_time_us_t now_us;
+    int running; /* Nesting depth of ind_soc_select_and_run */
+
+    /* Time the current callback started */
+    indigo_time_us_t callback_start_us;
+
+    /* Incremented by every wait; ready sockets are stamped with it */
+    uint64_t iteration;
+
+    /* Priorities are never removed from stats, so levels can point in */
+    ind_soc_stats_t stats;
+
+    /* Cross-thread post queue, see ind_soc_loop_task_post */
+    post_node_t post_stub;
+    post_node_t *post_head; /* Producers push here */
+    post_node_t *post_tail; /* Event loop pops here */
+    int post_wakeup_pending;
+    int post_event_fd;
+
+    /* See ind_soc_pass_end_register; unused slots have a NULL callback */
+    struct {
+        ind_soc_pass_end_callback_f callback;
+        void *cookie;
+    } pass_end[IND_SOC_PASS_END_CALLBACKS_MAX];
+    int pass_end_count; /* Slots used, including unregistered holes */
+};
+
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+#define SOC_LOOP_URING_INITIALIZER .uring = { .fd = -1 },
+#else
+#define SOC_LOOP_URING_INITIALIZER
+#endif
+
+#define SOC_LOOP_INITIALIZER(_loop) {                 \
+        .backend = IND_SOC_BACKEND_POLL,              \
+        .epoll_fd = -1,                               \
+        SOC_LOOP_URING_INITIALIZER                    \
+        .timer_event_free_head = -1,                  \
+        .task_free = { { &(_loop).task_free.links,    \
+                         &(_loop).task_free.links } }, \
+        .post_head = &(_loop).post_stub,              \
+        .post_tail = &(_loop).post_stub,              \
+        .post_event_fd = -1,                          \
     }
 
-    return -1;
+/* Loop set up by ind_soc_init and used by threads with no current loop */
+static ind_soc_loop_t default_loop = SOC_LOOP_INITIALIZER(default_loop);
+
+/* Loop bound to the calling thread by ind_soc_loop_current_set */
+static __thread ind_soc_loop_t *thread_loop;
+
+static inline ind_soc_loop_t *
+soc_loop_current(void)
+{
+    return thread_loop != NULL ? thread_loop : &default_loop;
 }
 
-/* Return index of first free timer slot */
-static int
-timer_event_free_slot(void)
+/* Read the clock and refresh the loop's cached time */
+static inline indigo_time_us_t
+soc_loop_clock(ind_soc_loop_t *loop)
 {
-    int idx;
+    return loop->now_us = soc_time_us();
+}
 
-    for (idx = 0; idx < TIMER_EVENT_MAX; idx++) {
-        if (timer_event[idx].callback == NULL) {
-            return idx;
-        }
-    }
+/*
+ * Current time for scheduling. While the loop is running this is the
+ * cached time, otherwise the clock is read.
+ */
+static inline indigo_time_us_t
+soc_loop_now(ind_soc_loop_t *loop)
+{
+    return loop->running > 0 ? loop->now_us : soc_loop_clock(loop);
+}
 
-    return -1;
+#define IS_LEGAL_SOCKET_ID(_id) ((_id) >= 0)
+#define IS_ACTIVE_SOCKET_ID(_loop, _id) \
+    (((_id) < (_loop)->soc_index_size) && ((_loop)->soc_index[_id] >= 0))
+#define SOC_MAP(_loop, _id) (&(_loop)->sockets[(_loop)->soc_index[_id]])
+#define SOC_POLLFD(_loop, _id) (&(_loop)->pollfds[(_loop)->soc_index[_id]])
+
+#define TIMER_HEAP_PARENT(i) (((i) - 1) / 2)
+#define TIMER_HEAP_LEFT(i) (2 * (i) + 1)
+#define TIMER_HEAP_TOP(_loop, now) ((_loop)->timer_heap_count > 0 && \
+        (_loop)->timer_event[(_loop)->timer_heap[0]].deadline <= (now))
+
+/* Handles are (generation << 32) | (slot + 1) so that 0 is never valid */
+#define TIMER_HANDLE(_loop, idx) \
+    (((uint64_t)(_loop)->timer_event[idx].generation << 32) | \
+     (uint32_t)((idx) + 1))
+#define TIMER_HANDLE_IDX(handle) ((int)(uint32_t)(handle) - 1)
+#define TIMER_HANDLE_GENERATION(handle) ((uint32_t)((handle) >> 32))
+
+
+/****************************************************************
+ * Priority levels
+ ****************************************************************/
+
+/* Insert a zero bit at position pos, shifting higher bits up */
+static uint64_t
+bitmap_insert(uint64_t bitmap, int pos)
+{
+    uint64_t low = bitmap & (((uint64_t)1 << pos) - 1);
+    return low | ((bitmap & ~low) << 1);
+}
+
+/* Remove the bit at position pos, shifting higher bits down */
+static uint64_t
+bitmap_remove(uint64_t bitmap, int pos)
+{
+    uint64_t low = bitmap & (((uint64_t)1 << pos) - 1);
+    return low | ((bitmap >> 1) & ~(((uint64_t)1 << pos) - 1));
 }
 
+/* Renumber levels starting at position pos */
 static void
-soc_mgr_init(void)
+priority_levels_reindex(ind_soc_loop_t *loop, int pos)
 {
-    int idx;
-    for (idx = 0; idx < SOCKET_COUNT_MAX; idx++) {
-        soc_map[idx].socket_id = INVALID_SOCKET_ID;
+    for (; pos < loop->num_priority_levels; pos++) {
+        loop->priority_levels[pos]->index = pos;
     }
+}
 
-    for (idx = 0; idx < TIMER_EVENT_MAX; idx++) {
-        timer_event[idx].callback = NULL;
-    }
+/* Free levels that are no longer referenced */
+static void
+priority_levels_gc(ind_soc_loop_t *loop)
+{
+    int pos = 0;
 
-    list_init(&tasks);
-}
+    while (pos < loop->num_priority_levels) {
+        priority_level_t *level = loop->priority_levels[pos];
+        if (level->refcount > 0 || level == loop->current_level) {
+            pos++;
+            continue;
+        }
 
+        INDIGO_ASSERT(list_empty(&level->tasks));
+        INDIGO_ASSERT(level->ready_timer_head < 0);
 
-indigo_error_t
-ind_soc_socket_register_with_priority(int socket_id,
-                                      ind_soc_socket_ready_callback_f callback,
-                                      void *cookie,
-                                      int priority)
+        loop->ready_socket_levels =
+            bitmap_remove(loop->ready_socket_levels, pos);
+        loop->ready_timer_levels =
+            bitmap_remove(loop->ready_timer_levels, pos);
+        loop->ready_task_levels =
+            bitmap_remove(loop->ready_task_levels, pos);
+
+        memmove(&loop->priority_levels[pos], &loop->priority_levels[pos + 1],
+                sizeof(loop->priority_levels[0]) *
+                (loop->num_priority_levels - pos - 1));
+        loop->num_priority_levels--;
+        priority_levels_reindex(loop, pos);
+
+        aim_free(level);
+    }
+}
+
+/*
+ * Find the level for a priority. Returns its position, or -1 if there is no
+ * such level, in which case *insert_pos is where it belongs.
+ */
+static int
+priority_level_find(ind_soc_loop_t *loop, int priority, int *insert_pos)
 {
-    struct pollfd *pfd;
+    int pos;
 
-    LOG_VERBOSE("Register socket %d", socket_id);
-    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
-        LOG_ERROR("Socket ID out of range: id %d", socket_id);
-        return INDIGO_ERROR_PARAM;
+    for (pos = 0; pos < loop->num_priority_levels; pos++) {
+        if (loop->priority_levels[pos]->priority == priority) {
+            return pos;
+        }
+        if (loop->priority_levels[pos]->priority < priority) {
+            break;
+        }
     }
 
-    if (callback == NULL) {
-        LOG_ERROR("No callback specified");
-        return INDIGO_ERROR_PARAM;
+    *insert_pos = pos;
+    return -1;
+}
+
+/*
+ * Of the levels either side of insert position pos, return the one whose
+ * priority is nearest. The table must not be empty.
+ */
+static priority_level_t *
+priority_level_nearest(ind_soc_loop_t *loop, int priority, int pos)
+{
+    priority_level_t *higher, *lower;
+
+    if (pos == 0) {
+        return loop->priority_levels[0];
+    }
+    if (pos == loop->num_priority_levels) {
+        return loop->priority_levels[pos - 1];
     }
 
-    if (IS_ACTIVE_SOCKET_ID(socket_id)) {
-        LOG_INFO("Socket %d exists", socket_id);
-        return INDIGO_ERROR_EXISTS;
+    higher = loop->priority_levels[pos - 1];
+    lower = loop->priority_levels[pos];
+    if ((int64_t)higher->priority - priority <=
+        (int64_t)priority - lower->priority) {
+        return higher;
     }
+    return lower;
+}
+
+/*
+ * Take a reference on the level for a priority, creating it if needed.
+ *
+ * If PRIORITY_LEVEL_MAX distinct priorities are already in use, the
+ * nearest existing level is shared instead, so registration never fails
+ * for lack of levels.
+ */
+static priority_level_t *
+priority_level_ref(ind_soc_loop_t *loop, int priority)
+{
+    priority_level_t *level;
+    int found, pos = 0;
 
-    INDIGO_ASSERT(soc_map[socket_id].socket_id == INVALID_SOCKET_ID);
-    soc_map[socket_id].socket_id = socket_id;
-    soc_map[socket_id].pollfd_index = num_pollfds;
-    soc_map[socket_id].callback = callback;
-    soc_map[socket_id].cookie = cookie;
-    soc_map[socket_id].priority = priority;
+    if ((found = priority_level_find(loop, priority, &pos)) >= 0) {
+        loop->priority_levels[found]->refcount++;
+        return loop->priority_levels[found];
+    }
 
-    INDIGO_ASSERT(num_pollfds < SOCKET_COUNT_MAX);
-    pfd = &pollfds[num_pollfds++];
-    pfd->fd = socket_id;
-    pfd->events = POLLIN;
-    pfd->revents = 0;
+    if (loop->num_priority_levels >= PRIORITY_LEVEL_MAX) {
+        priority_levels_gc(loop);
+        (void) priority_level_find(loop, priority, &pos);
+        if (loop->num_priority_levels >= PRIORITY_LEVEL_MAX) {
+            level = priority_level_nearest(loop, priority, pos);
+            LOG_WARN("Too many distinct priorities (max %d); "
+                     "priority %d shares the level of priority %d",
+                     PRIORITY_LEVEL_MAX, priority, level->priority);
+            level->refcount++;
+            return level;
+        }
+    }
 
-    return INDIGO_ERROR_NONE;
+    level = aim_zmalloc(sizeof(*level));
+    level->priority = priority;
+    level->refcount = 1;
+    level->ready_socket_head = level->ready_socket_tail = -1;
+    level->ready_timer_head = level->ready_timer_tail = -1;
+    list_init(&level->tasks);
+    level->stats = priority_stats_get(loop, priority);
+
+    memmove(&loop->priority_levels[pos + 1], &loop->priority_levels[pos],
+            sizeof(loop->priority_levels[0]) *
+            (loop->num_priority_levels - pos));
+    loop->priority_levels[pos] = level;
+    loop->num_priority_levels++;
+    priority_levels_reindex(loop, pos);
+
+    loop->ready_socket_levels = bitmap_insert(loop->ready_socket_levels, pos);
+    loop->ready_timer_levels = bitmap_insert(loop->ready_timer_levels, pos);
+    loop->ready_task_levels = bitmap_insert(loop->ready_task_levels, pos);
+
+    return level;
 }
 
-indigo_error_t
-ind_soc_socket_register(int socket_id,
-                        ind_soc_socket_ready_callback_f callback,
-                        void *cookie)
+static void
+priority_level_unref(priority_level_t *level)
 {
-    return ind_soc_socket_register_with_priority(
-        socket_id, callback, cookie, IND_SOC_DEFAULT_PRIORITY);
+    INDIGO_ASSERT(level->refcount > 0);
+    level->refcount--;
 }
 
-indigo_error_t
-ind_soc_data_out_ready(int socket_id)
+/* Return the highest priority level with any ready work, or NULL */
+static priority_level_t *
+priority_level_highest_ready(ind_soc_loop_t *loop)
 {
-    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
-        LOG_ERROR("data_out_ready: Socket ID out of range: id %d", socket_id);
-        return INDIGO_ERROR_PARAM;
-    }
+    uint64_t bitmap = loop->ready_socket_levels | loop->ready_timer_levels |
+        loop->ready_task_levels;
 
-    if (!IS_ACTIVE_SOCKET_ID(socket_id)) {
-        LOG_INFO("data_out_ready: Socket %d not registered", socket_id);
-        return INDIGO_ERROR_PARAM;
+    if (bitmap == 0) {
+        return NULL;
     }
 
-    pollfds[POLLFD_INDEX(socket_id)].events |= POLLOUT;
-
-    return INDIGO_ERROR_NONE;
+    return loop->priority_levels[__builtin_ctzll(bitmap)];
 }
 
-indigo_error_t
-ind_soc_data_out_clear(int socket_id)
+static void
+priority_levels_reset(ind_soc_loop_t *loop)
 {
-    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
-        LOG_ERROR("data_out_clear: Socket ID out of range: id %d", socket_id);
-        return INDIGO_ERROR_PARAM;
-    }
+    int pos;
 
-    if (!IS_ACTIVE_SOCKET_ID(socket_id)) {
-        LOG_INFO("data_out_clear: Socket %d not registered", socket_id);
-        return INDIGO_ERROR_PARAM;
+    for (pos = 0; pos < loop->num_priority_levels; pos++) {
+        priority_level_t *level = loop->priority_levels[pos];
+        /* Pool tasks are freed with their chunks */
+        aim_free(level);
     }
 
-    pollfds[POLLFD_INDEX(socket_id)].events &= ~POLLOUT;
+    loop->num_priority_levels = 0;
+    loop->num_tasks = 0;
+    loop->current_level = NULL;
+    loop->ready_socket_levels = 0;
+    loop->ready_timer_levels = 0;
+    loop->ready_task_levels = 0;
+}
 
-    return INDIGO_ERROR_NONE;
+
+/****************************************************************
+ * Timer storage
+ ****************************************************************/
+
+static uint32_t
+timer_hash_bucket(ind_soc_loop_t *loop,
+                  ind_soc_timer_callback_f callback, void *cookie)
+{
+    uint64_t h = (uint64_t)(uintptr_t)callback * 0x9e3779b97f4a7c15ULL;
+    h ^= (uint64_t)(uintptr_t)cookie + (h >> 29);
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return (uint32_t)(h >> 32) & (loop->timer_hash_size - 1);
 }
 
-indigo_error_t
-ind_soc_data_in_pause(int socket_id)
+/* Return index for timer; -1 if not found */
+static int
+timer_event_find(ind_soc_loop_t *loop,
+                 ind_soc_timer_callback_f callback, void *cookie)
 {
-    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
-        LOG_ERROR("data_in_pause: Socket ID out of range: id %d", socket_id);
-        return INDIGO_ERROR_PARAM;
-    }
+    int idx;
 
-    if (!IS_ACTIVE_SOCKET_ID(socket_id)) {
-        LOG_INFO("data_in_pause: Socket %d not registered", socket_id);
-        return INDIGO_ERROR_PARAM;
+    if (loop->timer_hash_size == 0 || callback == NULL) {
+        return -1;
     }
 
-    pollfds[POLLFD_INDEX(socket_id)].events &= ~POLLIN;
+    idx = loop->timer_hash[timer_hash_bucket(loop, callback, cookie)];
+    while (idx >= 0) {
+        if ((loop->timer_event[idx].callback == callback) &&
+                (loop->timer_event[idx].cookie == cookie)) {
+            return idx;
+        }
+        idx = loop->timer_event[idx].next;
+    }
 
-    return INDIGO_ERROR_NONE;
+    return -1;
 }
 
-indigo_error_t
-ind_soc_data_in_resume(int socket_id)
+/* Return slot index for a handle; -1 if it is stale or invalid */
+static int
+timer_event_from_handle(ind_soc_loop_t *loop, ind_soc_timer_handle_t handle)
 {
-    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
-        LOG_ERROR("data_in_resume: Socket ID out of range: id %d", socket_id);
-        return INDIGO_ERROR_PARAM;
-    }
+    int idx = TIMER_HANDLE_IDX(handle);
 
-    if (!IS_ACTIVE_SOCKET_ID(socket_id)) {
-        LOG_INFO("data_in_resume: Socket %d not registered", socket_id);
-        return INDIGO_ERROR_PARAM;
+    if (idx < 0 || idx >= loop->timer_event_slots ||
+            loop->timer_event[idx].callback == NULL ||
+            loop->timer_event[idx].generation !=
+                TIMER_HANDLE_GENERATION(handle)) {
+        return -1;
     }
 
-    pollfds[POLLFD_INDEX(socket_id)].events |= POLLIN;
-
-    return INDIGO_ERROR_NONE;
+    return idx;
 }
 
-/*
- * Unregister a socket for processing by the socket manager
- */
-
-indigo_error_t
-ind_soc_socket_unregister(int socket_id)
+static void
+timer_hash_insert(ind_soc_loop_t *loop, int idx)
 {
-    LOG_VERBOSE("Unregister socket %d", socket_id);
+    uint32_t bucket = timer_hash_bucket(loop, loop->timer_event[idx].callback,
+                                        loop->timer_event[idx].cookie);
+    loop->timer_event[idx].next = loop->timer_hash[bucket];
+    loop->timer_hash[bucket] = idx;
+}
 
-    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
-        LOG_INFO("unregister: Socket ID out of range: id %d", socket_id);
-        return INDIGO_ERROR_PARAM;
+static void
+timer_hash_remove(ind_soc_loop_t *loop, int idx)
+{
+    int *cur = &loop->timer_hash[
+        timer_hash_bucket(loop, loop->timer_event[idx].callback,
+                          loop->timer_event[idx].cookie)];
+    while (*cur != idx) {
+        INDIGO_ASSERT(*cur >= 0);
+        cur = &loop->timer_event[*cur].next;
     }
+    *cur = loop->timer_event[idx].next;
+}
 
-    if (!IS_ACTIVE_SOCKET_ID(socket_id)) {
-        LOG_INFO("socket_unregister: Socket %d not registered", socket_id);
-        return INDIGO_ERROR_PARAM;
-    }
+/* Grow the hash table so the load factor stays at most 1 */
+static void
+timer_hash_grow(ind_soc_loop_t *loop)
+{
+    int idx;
 
-    /*
-     * Need to maintain the dense property of the pollfds array.
-     * Move the element at the end to the index being freed.
-     */
-    INDIGO_ASSERT(num_pollfds > 0);
-    if (num_pollfds > 1) {
-        int dst_index = POLLFD_INDEX(socket_id);
-        struct pollfd *src_pfd = &pollfds[num_pollfds-1];
-        struct pollfd *dst_pfd = &pollfds[dst_index];
-        if (src_pfd != dst_pfd) {
-            soc_map[src_pfd->fd].pollfd_index = dst_index;
-            *dst_pfd = *src_pfd;
+    aim_free(loop->timer_hash);
+    loop->timer_hash_size = loop->timer_hash_size ?
+        loop->timer_hash_size * 2 : TIMER_EVENT_INITIAL_SLOTS;
+    loop->timer_hash =
+        aim_malloc(sizeof(*loop->timer_hash) * loop->timer_hash_size);
+    memset(loop->timer_hash, 0xff,
+           sizeof(*loop->timer_hash) * loop->timer_hash_size);
+
+    for (idx = 0; idx < loop->timer_event_slots; idx++) {
+        if (loop->timer_event[idx].callback != NULL) {
+            timer_hash_insert(loop, idx);
         }
     }
+}
 
-    num_pollfds--;
-
-    memset(&soc_map[socket_id], 0, sizeof(soc_map_t));
-    soc_map[socket_id].socket_id = INVALID_SOCKET_ID;
+/* Double the number of timer slots */
+static void
+timer_event_grow(ind_soc_loop_t *loop)
+{
+    int old_slots = loop->timer_event_slots;
+    int idx;
 
-    return INDIGO_ERROR_NONE;
+    loop->timer_event_slots =
+        old_slots ? old_slots * 2 : TIMER_EVENT_INITIAL_SLOTS;
+    loop->timer_event = aim_realloc(loop->timer_event,
+        sizeof(*loop->timer_event) * loop->timer_event_slots);
+    loop->timer_heap = aim_realloc(loop->timer_heap,
+        sizeof(*loop->timer_heap) * loop->timer_event_slots);
+
+    /* Push the new slots onto the free list, lowest index first */
+    for (idx = loop->timer_event_slots - 1; idx >= old_slots; idx--) {
+        memset(&loop->timer_event[idx], 0, sizeof(loop->timer_event[idx]));
+        loop->timer_event[idx].heap_index = -1;
+        loop->timer_event[idx].next = loop->timer_event_free_head;
+        loop->timer_event_free_head = idx;
+    }
 }
 
+/* Append a due timer to its level's ready queue */
+static void
+timer_ready_push(ind_soc_loop_t *loop, int idx)
+{
+    priority_level_t *level = loop->timer_event[idx].level;
 
-static ind_soc_run_status_t ind_soc_run_status__;
+    loop->timer_event[idx].ready_next = -1;
+    loop->timer_event[idx].ready_prev = level->ready_timer_tail;
+    if (level->ready_timer_tail >= 0) {
+        loop->timer_event[level->ready_timer_tail].ready_next = idx;
+    } else {
+        level->ready_timer_head = idx;
+    }
+    level->ready_timer_tail = idx;
+    loop->ready_timer_levels |= LEVEL_BIT(level);
+}
 
-void
-ind_soc_run_status_set(ind_soc_run_status_t s)
+/* Remove a timer from its level's ready queue */
+static void
+timer_ready_remove(ind_soc_loop_t *loop, int idx)
 {
-    if(s < IND_SOC_RUN_STATUS_COUNT) {
-        ind_soc_run_status__ = s;
+    priority_level_t *level = loop->timer_event[idx].level;
+    int prev = loop->timer_event[idx].ready_prev;
+    int next = loop->timer_event[idx].ready_next;
+
+    if (prev >= 0) {
+        loop->timer_event[prev].ready_next = next;
+    } else {
+        level->ready_timer_head = next;
+    }
+    if (next >= 0) {
+        loop->timer_event[next].ready_prev = prev;
+    } else {
+        level->ready_timer_tail = prev;
+    }
+    if (level->ready_timer_head < 0) {
+        loop->ready_timer_levels &= ~LEVEL_BIT(level);
     }
 }
 
+static void
+timer_heap_swap(ind_soc_loop_t *loop, int a, int b)
+{
+    int tmp = loop->timer_heap[a];
+    loop->timer_heap[a] = loop->timer_heap[b];
+    loop->timer_heap[b] = tmp;
+    loop->timer_event[loop->timer_heap[a]].heap_index = a;
+    loop->timer_event[loop->timer_heap[b]].heap_index = b;
+}
 
-/*
- * Return the time in ms until the next timer fires, or -1 if no timers
- * are active.
- */
-static int
-find_next_timer_expiration(indigo_time_t now)
+static void
+timer_heap_sift_up(ind_soc_loop_t *loop, int i)
 {
-    int idx;
-    int next_ms = -1, elapsed, tmp_ms;
-    FOREACH_TIMER_EVENT(idx) {
-        elapsed = INDIGO_TIME_DIFF_ms(timer_event[idx].last_call, now);
-        tmp_ms = timer_event[idx].repeat_time_ms - elapsed; /* Time to next */
-        if (next_ms == -1 || tmp_ms < next_ms) {
-            next_ms = tmp_ms > 0 ? tmp_ms : 0;
+    while (i > 0) {
+        int parent = TIMER_HEAP_PARENT(i);
+        if (loop->timer_event[loop->timer_heap[parent]].deadline <=
+                loop->timer_event[loop->timer_heap[i]].deadline) {
+            break;
         }
+        timer_heap_swap(loop, i, parent);
+        i = parent;
     }
-    return next_ms;
 }
 
-/*
- * Run callbacks for timer events.
- */
 static void
-process_timers(int priority)
+timer_heap_sift_down(ind_soc_loop_t *loop, int i)
+{
+    while (1) {
+        int child = TIMER_HEAP_LEFT(i);
+        if (child >= loop->timer_heap_count) {
+            break;
+        }
+        if (child + 1 < loop->timer_heap_count &&
+                loop->timer_event[loop->timer_heap[child + 1]].deadline <
+                loop->timer_event[loop->timer_heap[child]].deadline) {
+            child++;
+        }
+        if (loop->timer_event[loop->timer_heap[i]].deadline <=
+                loop->timer_event[loop->timer_heap[child]].deadline) {
+            break;
+        }
+        timer_heap_swap(loop, i, child);
+        i = child;
+    }
+}
+
+/* Restore the heap property after a timer's deadline changed */
+static void
+timer_heap_update(ind_soc_loop_t *loop, int idx)
+{
+    timer_heap_sift_up(loop, loop->timer_event[idx].heap_index);
+    timer_heap_sift_down(loop, loop->timer_event[idx].heap_index);
+}
+
+static void
+timer_heap_insert(ind_soc_loop_t *loop, int idx)
+{
+    loop->timer_event[idx].heap_index = loop->timer_heap_count;
+    loop->timer_heap[loop->timer_heap_count++] = idx;
+    timer_heap_sift_up(loop, loop->timer_event[idx].heap_index);
+}
+
+static void
+timer_heap_remove(ind_soc_loop_t *loop, int idx)
+{
+    int heap_index = loop->timer_event[idx].heap_index;
+    int last = loop->timer_heap_count - 1;
+
+    INDIGO_ASSERT(heap_index >= 0 && heap_index < loop->timer_heap_count);
+    if (heap_index != last) {
+        timer_heap_swap(loop, heap_index, last);
+    }
+    loop->timer_heap_count--;
+    if (heap_index != last) {
+        timer_heap_update(loop, loop->timer_heap[heap_index]);
+    }
+    loop->timer_event[idx].heap_index = -1;
+}
+
+/*
+ * Set the deadline from last_call and repeat_time_us. A timer waiting in
+ * a ready queue goes back into the heap.
+ */
+static void
+timer_event_schedule(ind_soc_loop_t *loop, int idx, indigo_time_us_t now)
+{
+    loop->timer_event[idx].last_call = now;
+    loop->timer_event[idx].deadline =
+        now + loop->timer_event[idx].repeat_time_us;
+    if (loop->timer_event[idx].heap_index < 0) {
+        timer_ready_remove(loop, idx);
+        timer_heap_insert(loop, idx);
+    } else {
+        timer_heap_update(loop, idx);
+    }
+}
+
+/* Move every due timer from the heap to its level's ready queue */
+static void
+timer_promote_due(ind_soc_loop_t *loop, indigo_time_us_t now)
+{
+    while (TIMER_HEAP_TOP(loop, now)) {
+        int idx = loop->timer_heap[0];
+        timer_heap_remove(loop, idx);
+        timer_ready_push(loop, idx);
+    }
+}
+
+/* Allocate a slot and insert it into the heap and hash. Returns -1 on error. */
+static int
+timer_event_alloc(ind_soc_loop_t *loop,
+                  ind_soc_timer_callback_f callback, void *cookie,
+                  int64_t repeat_time_us, int priority)
+{
+    int idx;
+    indigo_time_us_t now = soc_loop_now(loop);
+    priority_level_t *level;
+
+    level = priority_level_ref(loop, priority);
+
+    if (loop->timer_event_free_head < 0) {
+        timer_event_grow(loop);
+    }
+    if (loop->timer_event_count >= loop->timer_hash_size) {
+        timer_hash_grow(loop);
+    }
+
+    idx = loop->timer_event_free_head;
+    loop->timer_event_free_head = loop->timer_event[idx].next;
+
+    loop->timer_event[idx].callback = callback;
+    loop->timer_event[idx].cookie = cookie;
+    loop->timer_event[idx].repeat_time_us = repeat_time_us;
+    loop->timer_event[idx].priority = priority;
+    loop->timer_event[idx].level = level;
+    loop->timer_event[idx].last_call = now;
+    loop->timer_event[idx].deadline = now + repeat_time_us;
+
+    timer_hash_insert(loop, idx);
+    timer_heap_insert(loop, idx);
+    loop->timer_event_count++;
+
+    return idx;
+}
+
+/*
+ * Remove a timer from the heap or ready queue and the hash, and return its
+ * slot to the free list
+ */
+static void
+timer_event_free(ind_soc_loop_t *loop, int idx)
+{
+    if (loop->timer_event[idx].heap_index >= 0) {
+        timer_heap_remove(loop, idx);
+    } else {
+        timer_ready_remove(loop, idx);
+    }
+
+    timer_hash_remove(loop, idx);
+    priority_level_unref(loop->timer_event[idx].level);
+    loop->timer_event_count--;
+
+    loop->timer_event[idx].callback = NULL;
+    loop->timer_event[idx].cookie = NULL;
+    loop->timer_event[idx].level = NULL;
+    loop->timer_event[idx].generation++;
+    loop->timer_event[idx].next = loop->timer_event_free_head;
+    loop->timer_event_free_head = idx;
+}
+
+/* Release all timer storage */
+static void
+timer_event_reset(ind_soc_loop_t *loop)
+{
+    aim_free(loop->timer_event);
+    aim_free(loop->timer_heap);
+    aim_free(loop->timer_hash);
+    loop->timer_event = NULL;
+    loop->timer_heap = NULL;
+    loop->timer_hash = NULL;
+    loop->timer_event_slots = 0;
+    loop->timer_event_count = 0;
+    loop->timer_heap_count = 0;
+    loop->timer_event_free_head = -1;
+    loop->timer_hash_size = 0;
+}
+
+/* Double the dense socket arrays */
+static void
+sockets_grow(ind_soc_loop_t *loop)
+{
+    int slots = loop->socket_slots ?
+        loop->socket_slots * 2 : SOCKET_INITIAL_SLOTS;
+
+    loop->sockets = aim_realloc(loop->sockets,
+                                sizeof(*loop->sockets) * slots);
+    loop->pollfds = aim_realloc(loop->pollfds,
+                                sizeof(*loop->pollfds) * slots);
+    loop->epoll_events = aim_realloc(loop->epoll_events,
+                                     sizeof(*loop->epoll_events) * slots);
+    loop->ready_sockets = aim_realloc(loop->ready_sockets,
+                                      sizeof(*loop->ready_sockets) * slots);
+    loop->socket_slots = slots;
+}
+
+/* Grow the descriptor index so it covers socket_id */
+static void
+soc_index_grow(ind_soc_loop_t *loop, int socket_id)
+{
+    int old_size = loop->soc_index_size;
+    int idx;
+
+    if (loop->soc_index_size == 0) {
+        loop->soc_index_size = SOCKET_INITIAL_SLOTS;
+    }
+    while (loop->soc_index_size <= socket_id) {
+        loop->soc_index_size *= 2;
+    }
+
+    loop->soc_index = aim_realloc(
+        loop->soc_index, sizeof(*loop->soc_index) * loop->soc_index_size);
+    for (idx = old_size; idx < loop->soc_index_size; idx++) {
+        loop->soc_index[idx] = -1;
+    }
+}
+
+static void
+sockets_reset(ind_soc_loop_t *loop)
+{
+    aim_free(loop->sockets);
+    aim_free(loop->pollfds);
+    aim_free(loop->epoll_events);
+    aim_free(loop->ready_sockets);
+    aim_free(loop->soc_index);
+    loop->sockets = NULL;
+    loop->pollfds = NULL;
+    loop->epoll_events = NULL;
+    loop->ready_sockets = NULL;
+    loop->soc_index = NULL;
+    loop->num_sockets = 0;
+    loop->socket_slots = 0;
+    loop->soc_index_size = 0;
+}
+
+static void
+soc_mgr_init(ind_soc_loop_t *loop)
+{
+    sockets_reset(loop);
+    loop->num_ready_sockets = 0;
+
+    timer_event_reset(loop);
+    priority_levels_reset(loop);
+    task_pool_reset(loop);
+    memset(&loop->stats, 0, sizeof(loop->stats));
+    memset(loop->pass_end, 0, sizeof(loop->pass_end));
+    loop->pass_end_count = 0;
+}
+
+/****************************************************************
+ * Backends
+ *
+ * Each backend tracks the events requested for every registered socket
+ * and, after waiting, fills in ready_sockets with the sockets that have
+ * pending events.
+ ****************************************************************/
+
+static uint32_t
+poll_to_epoll_events(short events)
+{
+    return ((events & POLLIN) ? EPOLLIN : 0) |
+        ((events & POLLOUT) ? EPOLLOUT : 0);
+}
+
+static short
+epoll_to_poll_events(uint32_t events)
+{
+    return ((events & EPOLLIN) ? POLLIN : 0) |
+        ((events & EPOLLOUT) ? POLLOUT : 0) |
+        ((events & EPOLLERR) ? POLLERR : 0) |
+        ((events & EPOLLHUP) ? POLLHUP : 0);
+}
+
+static indigo_error_t
+epoll_ctl_socket(ind_soc_loop_t *loop, int op, int socket_id, short events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = poll_to_epoll_events(events);
+    ev.data.fd = socket_id;
+
+    if (epoll_ctl(loop->epoll_fd, op, socket_id, &ev) < 0) {
+        LOG_ERROR("epoll_ctl(%d) failed for socket %d: %s",
+                  op, socket_id, strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+/*
+ * io_uring backend
+ *
+ * Readiness is collected with one-shot IORING_OP_POLL_ADD requests. A
+ * socket's request is (re)submitted after it completes or when the
+ * requested events change, and all of those submissions go to the kernel
+ * in the same io_uring_enter call that waits for completions, so an
+ * iteration costs one system call however many sockets were ready.
+ * Re-arming after every completion keeps the level-triggered behaviour of
+ * the other backends: a socket left unserviced completes again at once.
+ *
+ * user_data holds the descriptor and a generation number that is bumped
+ * for every submission, so completions of removed or replaced requests
+ * are recognised and dropped.
+ */
+
+#define URING_ENTRIES 256
+#define URING_USER_DATA(_fd, _gen) (((uint64_t)(_gen) << 32) | (uint32_t)(_fd))
+#define URING_USER_DATA_IGNORE UINT64_MAX /* POLL_REMOVE completions */
+
+static void
+uring_unmap(soc_uring_t *uring)
+{
+    if (uring->sq_ring != NULL) {
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    }
+    if (uring->cq_ring != NULL && uring->cq_ring != uring->sq_ring) {
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+    if (uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->fd >= 0) {
+        close(uring->fd);
+    }
+    memset(uring, 0, sizeof(*uring));
+    uring->fd = -1;
+}
+
+static indigo_error_t
+uring_setup(soc_uring_t *uring)
+{
+    struct io_uring_params params;
+    void *ptr;
+
+    memset(&params, 0, sizeof(params));
+    uring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (uring->fd < 0) {
+        LOG_WARN("io_uring_setup failed: %s", strerror(errno));
+        return INDIGO_ERROR_NOT_SUPPORTED;
+    }
+    (void) fcntl(uring->fd, F_SETFD, FD_CLOEXEC);
+
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        LOG_WARN("io_uring lacks IORING_FEAT_EXT_ARG");
+        uring_unmap(uring);
+        return INDIGO_ERROR_NOT_SUPPORTED;
+    }
+
+    uring->sq_ring_size = params.sq_off.array +
+        params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_ring_size > uring->sq_ring_size) {
+            uring->sq_ring_size = uring->cq_ring_size;
+        }
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    ptr = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        goto mmap_failed;
+    }
+    uring->sq_ring = ptr;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ring = uring->sq_ring;
+    } else {
+        ptr = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) {
+            goto mmap_failed;
+        }
+        uring->cq_ring = ptr;
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        goto mmap_failed;
+    }
+    uring->sqes = ptr;
+
+    uring->sq_head = (unsigned *)((char *)uring->sq_ring + params.sq_off.head);
+    uring->sq_tail = (unsigned *)((char *)uring->sq_ring + params.sq_off.tail);
+    uring->sq_mask = (unsigned *)((char *)uring->sq_ring + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *)((char *)uring->sq_ring + params.sq_off.array);
+    uring->cq_head = (unsigned *)((char *)uring->cq_ring + params.cq_off.head);
+    uring->cq_tail = (unsigned *)((char *)uring->cq_ring + params.cq_off.tail);
+    uring->cq_mask = (unsigned *)((char *)uring->cq_ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)((char *)uring->cq_ring + params.cq_off.cqes);
+    uring->sq_entries = params.sq_entries;
+    uring->to_submit = 0;
+
+    return INDIGO_ERROR_NONE;
+
+mmap_failed:
+    LOG_WARN("io_uring mmap failed: %s", strerror(errno));
+    uring_unmap(uring);
+    return INDIGO_ERROR_NOT_SUPPORTED;
+}
+
+/*
+ * Submit queued entries, optionally waiting for a completion for up to
+ * tsp (NULL waits indefinitely). Returns 0 on success or a timeout, -1
+ * with errno set otherwise.
+ */
+static int
+uring_enter(soc_uring_t *uring, int wait, struct timespec *tsp)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec kts;
+    unsigned flags = 0;
+    int rv;
+
+    memset(&arg, 0, sizeof(arg));
+    if (wait) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (tsp != NULL) {
+            kts.tv_sec = tsp->tv_sec;
+            kts.tv_nsec = tsp->tv_nsec;
+            arg.ts = (uint64_t)(uintptr_t)&kts;
+        }
+    }
+
+    rv = syscall(__NR_io_uring_enter, uring->fd, uring->to_submit,
+                 wait ? 1 : 0, flags, wait ? &arg : NULL,
+                 wait ? sizeof(arg) : 0);
+    if (rv >= 0) {
+        uring->to_submit -= rv < (int)uring->to_submit ? rv : uring->to_submit;
+        return 0;
+    }
+
+    return errno == ETIME ? 0 : -1;
+}
+
+/* Get a submission entry, flushing the ring if it is full */
+static struct io_uring_sqe *
+uring_sqe_get(soc_uring_t *uring)
+{
+    unsigned tail = *uring->sq_tail;
+    unsigned idx;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >=
+            uring->sq_entries) {
+        if (uring_enter(uring, 0, NULL) < 0) {
+            LOG_ERROR("io_uring_enter failed: %s", strerror(errno));
+            return NULL;
+        }
+    }
+
+    idx = tail & *uring->sq_mask;
+    sqe = &uring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sq_array[idx] = idx;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->to_submit++;
+
+    return sqe;
+}
+
+/* Queue a socket to have its poll request (re)submitted before the wait */
+static void
+uring_queue_arm(ind_soc_loop_t *loop, soc_map_t *soc)
+{
+    if (soc->uring_queued) {
+        return;
+    }
+
+    if (loop->uring_arm_count == loop->uring_arm_size) {
+        loop->uring_arm_size = loop->uring_arm_size ?
+            loop->uring_arm_size * 2 : SOCKET_INITIAL_SLOTS;
+        loop->uring_arm = aim_realloc(
+            loop->uring_arm, sizeof(*loop->uring_arm) * loop->uring_arm_size);
+    }
+
+    loop->uring_arm[loop->uring_arm_count++] = soc->socket_id;
+    soc->uring_queued = 1;
+}
+
+static void
+uring_poll_remove(ind_soc_loop_t *loop, soc_map_t *soc)
+{
+    struct io_uring_sqe *sqe;
+
+    if (soc->uring_events == 0) {
+        return;
+    }
+
+    if ((sqe = uring_sqe_get(&loop->uring)) != NULL) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = URING_USER_DATA(soc->socket_id, soc->uring_gen);
+        sqe->user_data = URING_USER_DATA_IGNORE;
+    }
+    soc->uring_events = 0;
+}
+
+/* Bring the kernel's poll requests in line with the requested events */
+static void
+uring_arm_sockets(ind_soc_loop_t *loop)
+{
+    int idx;
+
+    for (idx = 0; idx < loop->uring_arm_count; idx++) {
+        int socket_id = loop->uring_arm[idx];
+        struct io_uring_sqe *sqe;
+        soc_map_t *soc;
+        short events;
+
+        if (!IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+            continue;
+        }
+
+        soc = SOC_MAP(loop, socket_id);
+        soc->uring_queued = 0;
+        events = SOC_POLLFD(loop, socket_id)->events;
+        if (soc->uring_events == events) {
+            continue;
+        }
+
+        uring_poll_remove(loop, soc);
+        if (events == 0) {
+            continue;
+        }
+
+        if ((sqe = uring_sqe_get(&loop->uring)) == NULL) {
+            continue;
+        }
+        soc->uring_gen = ++loop->uring_next_gen;
+        soc->uring_events = events;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = socket_id;
+        sqe->poll32_events = events;
+        sqe->user_data = URING_USER_DATA(socket_id, soc->uring_gen);
+    }
+
+    loop->uring_arm_count = 0;
+}
+
+/* Move completed poll requests to ready_sockets */
+static int
+uring_reap(ind_soc_loop_t *loop)
+{
+    soc_uring_t *uring = &loop->uring;
+    unsigned head = *uring->cq_head;
+    unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+        int socket_id = (int)(uint32_t)cqe->user_data;
+        uint32_t gen = (uint32_t)(cqe->user_data >> 32);
+        soc_map_t *soc;
+
+        if (cqe->user_data == URING_USER_DATA_IGNORE ||
+                !IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+            continue;
+        }
+
+        soc = SOC_MAP(loop, socket_id);
+        if (soc->uring_events == 0 || soc->uring_gen != gen) {
+            /* Completion of a request that has since been replaced */
+            continue;
+        }
+        soc->uring_events = 0;
+
+        if (cqe->res < 0) {
+            /* Not re-armed until the requested events change */
+            LOG_ERROR("io_uring poll failed for socket %d: %s",
+                      socket_id, strerror(-cqe->res));
+            continue;
+        }
+
+        uring_queue_arm(loop, soc);
+        loop->ready_sockets[loop->num_ready_sockets].socket_id = socket_id;
+        loop->ready_sockets[loop->num_ready_sockets].revents =
+            (short)cqe->res;
+        loop->num_ready_sockets++;
+    }
+
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+    return loop->num_ready_sockets;
+}
+
+static int
+uring_wait(ind_soc_loop_t *loop, struct timespec *tsp)
+{
+    int wait = tsp == NULL || tsp->tv_sec > 0 || tsp->tv_nsec > 0;
+
+    uring_arm_sockets(loop);
+
+    /* Completions left over from before do not need a wait */
+    if (*loop->uring.cq_head !=
+            __atomic_load_n(loop->uring.cq_tail, __ATOMIC_ACQUIRE)) {
+        wait = 0;
+    }
+
+    if ((wait || loop->uring.to_submit > 0) &&
+            uring_enter(&loop->uring, wait, tsp) < 0) {
+        return -1;
+    }
+
+    return uring_reap(loop);
+}
+#endif /* SOCKETMANAGER_CONFIG_INCLUDE_IO_URING */
+
+/* The poll backend reads the pollfds array directly */
+static indigo_error_t
+backend_socket_add(ind_soc_loop_t *loop, int socket_id, short events)
+{
+    if (loop->backend == IND_SOC_BACKEND_EPOLL) {
+        return epoll_ctl_socket(loop, EPOLL_CTL_ADD, socket_id, events);
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+backend_socket_remove(ind_soc_loop_t *loop, int socket_id)
+{
+    if (loop->backend == IND_SOC_BACKEND_EPOLL) {
+        /* The kernel removes closed fds on its own */
+        (void) epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, socket_id, NULL);
+    }
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+    if (loop->backend == IND_SOC_BACKEND_IO_URING) {
+        uring_poll_remove(loop, SOC_MAP(loop, socket_id));
+    }
+#endif
+}
+
+/* Change the events requested for a registered socket */
+static indigo_error_t
+soc_events_set(ind_soc_loop_t *loop, int socket_id, short events)
+{
+    struct pollfd *pfd = SOC_POLLFD(loop, socket_id);
+
+    if (pfd->events == events) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    if (loop->backend == IND_SOC_BACKEND_EPOLL) {
+        indigo_error_t rv =
+            epoll_ctl_socket(loop, EPOLL_CTL_MOD, socket_id, events);
+        if (rv < 0) {
+            return rv;
+        }
+    }
+
+    pfd->events = events;
+
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+    if (loop->backend == IND_SOC_BACKEND_IO_URING) {
+        uring_queue_arm(loop, SOC_MAP(loop, socket_id));
+    }
+#endif
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Discard the ready sockets queued at a level */
+static void
+ready_sockets_clear(ind_soc_loop_t *loop, priority_level_t *level)
+{
+    level->ready_socket_head = level->ready_socket_tail = -1;
+    loop->ready_socket_levels &= ~LEVEL_BIT(level);
+}
+
+/* Queue each ready socket on its priority level */
+static void
+ready_sockets_enqueue(ind_soc_loop_t *loop)
+{
+    int idx;
+
+    for (idx = 0; idx < loop->num_ready_sockets; idx++) {
+        ready_socket_t *ready = &loop->ready_sockets[idx];
+        priority_level_t *level;
+        soc_map_t *soc;
+
+        ready->next = -1;
+        if (!IS_ACTIVE_SOCKET_ID(loop, ready->socket_id)) {
+            continue;
+        }
+
+        soc = SOC_MAP(loop, ready->socket_id);
+        if ((level = soc->level) == NULL) {
+            /* Internal sockets are serviced as soon as the wait returns */
+            soc->callback(ready->socket_id, soc->cookie, 1, 0, 0);
+            continue;
+        }
+
+        /* Keep the original time for sockets left ready by the last wait */
+        if (soc->ready_us == 0 ||
+                soc->ready_iteration + 1 != loop->iteration) {
+            soc->ready_us = loop->now_us;
+        }
+        soc->ready_iteration = loop->iteration;
+
+        if (level->ready_socket_tail >= 0) {
+            loop->ready_sockets[level->ready_socket_tail].next = idx;
+        } else {
+            level->ready_socket_head = idx;
+        }
+        level->ready_socket_tail = idx;
+        loop->ready_socket_levels |= LEVEL_BIT(level);
+    }
+}
+
+/*
+ * Wait up to timeout_us (-1 for no limit) for socket events and queue the
+ * ready sockets on their priority levels. Returns the number of ready
+ * sockets, or -1 with errno set.
+ *
+ * poll waits with ppoll so the timeout keeps its microsecond resolution.
+ * epoll_wait only takes milliseconds, so a timeout with a sub-millisecond
+ * part first waits on the epoll fd itself with ppoll.
+ */
+static int
+backend_wait(ind_soc_loop_t *loop, int64_t timeout_us)
+{
+    struct timespec ts, *tsp = NULL;
+    int rv, idx;
+
+    if (timeout_us >= 0) {
+        ts.tv_sec = timeout_us / 1000000;
+        ts.tv_nsec = (timeout_us % 1000000) * 1000;
+        tsp = &ts;
+    }
+
+    loop->iteration++;
+    loop->stats.iterations++;
+
+    /* Sockets not serviced last iteration will be reported again */
+    while (loop->ready_socket_levels != 0) {
+        int pos = __builtin_ctzll(loop->ready_socket_levels);
+        ready_sockets_clear(loop, loop->priority_levels[pos]);
+    }
+    loop->num_ready_sockets = 0;
+
+    if (loop->backend == IND_SOC_BACKEND_EPOLL) {
+        int timeout_ms = timeout_us < 0 ? -1 : (int)(timeout_us / 1000);
+
+        LOG_TRACE("epoll_wait on %d fds, timeout %" PRId64 " us",
+                  loop->num_sockets, timeout_us);
+        rv = 0;
+        if (timeout_us > 0 && timeout_us % 1000 != 0) {
+            struct pollfd pfd = { .fd = loop->epoll_fd, .events = POLLIN };
+            rv = ppoll(&pfd, 1, tsp, NULL);
+            timeout_ms = 0;
+        }
+        if (rv >= 0) {
+            rv = epoll_wait(loop->epoll_fd, loop->epoll_events,
+                            loop->num_sockets > 0 ? loop->num_sockets : 1,
+                            timeout_ms);
+        }
+        LOG_TRACE("epoll_wait returned %d", rv);
+
+        for (idx = 0; idx < rv; idx++) {
+            ready_socket_t *ready =
+                &loop->ready_sockets[loop->num_ready_sockets++];
+            ready->socket_id = loop->epoll_events[idx].data.fd;
+            ready->revents =
+                epoll_to_poll_events(loop->epoll_events[idx].events);
+        }
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+    } else if (loop->backend == IND_SOC_BACKEND_IO_URING) {
+        LOG_TRACE("io_uring wait on %d fds, timeout %" PRId64 " us",
+                  loop->num_sockets, timeout_us);
+        rv = uring_wait(loop, tsp);
+        LOG_TRACE("io_uring wait returned %d", rv);
+#endif
+    } else {
+        LOG_TRACE("polling %d fds, timeout %" PRId64 " us",
+                  loop->num_sockets, timeout_us);
+        rv = ppoll(loop->pollfds, loop->num_sockets, tsp, NULL);
+        LOG_TRACE("poll returned %d", rv);
+
+        for (idx = 0; idx < loop->num_sockets &&
+                 loop->num_ready_sockets < rv; idx++) {
+            if (loop->pollfds[idx].revents != 0) {
+                ready_socket_t *ready =
+                    &loop->ready_sockets[loop->num_ready_sockets++];
+                ready->socket_id = loop->pollfds[idx].fd;
+                ready->revents = loop->pollfds[idx].revents;
+            }
+        }
+    }
+
+    soc_loop_clock(loop);
+    ready_sockets_enqueue(loop);
+
+    return rv;
+}
+
+static const char *const backend_names[IND_SOC_BACKEND_COUNT] = {
+    "poll",
+    "epoll",
+    "io_uring",
+};
+
+static void
+backend_finish(ind_soc_loop_t *loop)
+{
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+    uring_unmap(&loop->uring);
+    aim_free(loop->uring_arm);
+    loop->uring_arm = NULL;
+    loop->uring_arm_count = loop->uring_arm_size = 0;
+#endif
+    loop->backend = IND_SOC_BACKEND_POLL;
+}
+
+static indigo_error_t
+backend_init(ind_soc_loop_t *loop, ind_soc_backend_t requested)
+{
+    backend_finish(loop);
+
+    if (requested == IND_SOC_BACKEND_EPOLL) {
+        if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            LOG_WARN("epoll_create1 failed, falling back to poll: %s",
+                     strerror(errno));
+        } else {
+            loop->backend = IND_SOC_BACKEND_EPOLL;
+        }
+    } else if (requested == IND_SOC_BACKEND_IO_URING) {
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+        if (uring_setup(&loop->uring) < 0) {
+            LOG_WARN("io_uring unavailable, falling back to poll");
+        } else {
+            loop->backend = IND_SOC_BACKEND_IO_URING;
+        }
+#else
+        LOG_WARN("io_uring support not compiled in, falling back to poll");
+#endif
+    } else if (requested != IND_SOC_BACKEND_POLL) {
+        LOG_ERROR("Invalid socket manager backend %d", requested);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    LOG_INFO("Using %s backend", backend_names[loop->backend]);
+
+    return INDIGO_ERROR_NONE;
+}
+
+/****************************************************************
+ * Socket registration
+ ****************************************************************/
+
+/*
+ * Add a socket to the dense arrays and the backend. A NULL level marks an
+ * internal socket, whose callback runs directly from the wait rather than
+ * being queued on a priority level.
+ */
+static indigo_error_t
+socket_add(ind_soc_loop_t *loop, int socket_id,
+           ind_soc_socket_ready_callback_f callback,
+           void *cookie, int priority, priority_level_t *level)
+{
+    indigo_error_t rv;
+    soc_map_t *soc;
+    struct pollfd *pfd;
+
+    if ((rv = backend_socket_add(loop, socket_id, POLLIN)) < 0) {
+        return rv;
+    }
+
+    if (socket_id >= loop->soc_index_size) {
+        soc_index_grow(loop, socket_id);
+    }
+
+    if (loop->num_sockets == loop->socket_slots) {
+        sockets_grow(loop);
+    }
+
+    soc = &loop->sockets[loop->num_sockets];
+    soc->socket_id = socket_id;
+    soc->callback = callback;
+    soc->cookie = cookie;
+    soc->priority = priority;
+    soc->level = level;
+    soc->ready_us = 0;
+    soc->ready_iteration = 0;
+    soc->uring_gen = 0;
+    soc->uring_events = 0;
+    soc->uring_queued = 0;
+
+    pfd = &loop->pollfds[loop->num_sockets];
+    pfd->fd = socket_id;
+    pfd->events = POLLIN;
+    pfd->revents = 0;
+
+    loop->soc_index[socket_id] = loop->num_sockets++;
+
+#if SOCKETMANAGER_CONFIG_INCLUDE_IO_URING == 1
+    if (loop->backend == IND_SOC_BACKEND_IO_URING) {
+        uring_queue_arm(loop, soc);
+    }
+#endif
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_soc_socket_register_with_priority(int socket_id,
+                                      ind_soc_socket_ready_callback_f callback,
+                                      void *cookie,
+                                      int priority)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+    indigo_error_t rv;
+    priority_level_t *level;
+
+    LOG_VERBOSE("Register socket %d", socket_id);
+    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
+        LOG_ERROR("Socket ID out of range: id %d", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (callback == NULL) {
+        LOG_ERROR("No callback specified");
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+        LOG_INFO("Socket %d exists", socket_id);
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    level = priority_level_ref(loop, priority);
+
+    rv = socket_add(loop, socket_id, callback, cookie, priority, level);
+    if (rv < 0) {
+        priority_level_unref(level);
+        return rv;
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_soc_socket_register(int socket_id,
+                        ind_soc_socket_ready_callback_f callback,
+                        void *cookie)
+{
+    return ind_soc_socket_register_with_priority(
+        socket_id, callback, cookie, IND_SOC_DEFAULT_PRIORITY);
+}
+
+indigo_error_t
+ind_soc_data_out_ready(int socket_id)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+
+    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
+        LOG_ERROR("data_out_ready: Socket ID out of range: id %d", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (!IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+        LOG_INFO("data_out_ready: Socket %d not registered", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    return soc_events_set(loop, socket_id,
+                          SOC_POLLFD(loop, socket_id)->events | POLLOUT);
+}
+
+indigo_error_t
+ind_soc_data_out_clear(int socket_id)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+
+    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
+        LOG_ERROR("data_out_clear: Socket ID out of range: id %d", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (!IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+        LOG_INFO("data_out_clear: Socket %d not registered", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    return soc_events_set(loop, socket_id,
+                          SOC_POLLFD(loop, socket_id)->events & ~POLLOUT);
+}
+
+indigo_error_t
+ind_soc_data_in_pause(int socket_id)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+
+    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
+        LOG_ERROR("data_in_pause: Socket ID out of range: id %d", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (!IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+        LOG_INFO("data_in_pause: Socket %d not registered", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    return soc_events_set(loop, socket_id,
+                          SOC_POLLFD(loop, socket_id)->events & ~POLLIN);
+}
+
+indigo_error_t
+ind_soc_data_in_resume(int socket_id)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+
+    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
+        LOG_ERROR("data_in_resume: Socket ID out of range: id %d", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (!IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+        LOG_INFO("data_in_resume: Socket %d not registered", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    return soc_events_set(loop, socket_id,
+                          SOC_POLLFD(loop, socket_id)->events | POLLIN);
+}
+
+/*
+ * Unregister a socket for processing by the socket manager
+ */
+
+indigo_error_t
+ind_soc_socket_unregister(int socket_id)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+    int idx, last;
+
+    LOG_VERBOSE("Unregister socket %d", socket_id);
+
+    if (!IS_LEGAL_SOCKET_ID(socket_id)) {
+        LOG_INFO("unregister: Socket ID out of range: id %d", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (!IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+        LOG_INFO("socket_unregister: Socket %d not registered", socket_id);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    backend_socket_remove(loop, socket_id);
+    if (SOC_MAP(loop, socket_id)->level != NULL) {
+        priority_level_unref(SOC_MAP(loop, socket_id)->level);
+    }
+
+    /*
+     * Need to maintain the dense property of the socket arrays.
+     * Move the element at the end to the index being freed.
+     */
+    idx = loop->soc_index[socket_id];
+    last = --loop->num_sockets;
+    if (idx != last) {
+        loop->sockets[idx] = loop->sockets[last];
+        loop->pollfds[idx] = loop->pollfds[last];
+        loop->soc_index[loop->sockets[idx].socket_id] = idx;
+    }
+    loop->soc_index[socket_id] = -1;
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+ind_soc_run_status_set(ind_soc_run_status_t s)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+
+    if(s < IND_SOC_RUN_STATUS_COUNT) {
+        loop->run_status = s;
+    }
+}
+
+
+/*
+ * Return the time in us until the next timer fires, or -1 if no timers
+ * are active.
+ */
+static int64_t
+find_next_timer_expiration(ind_soc_loop_t *loop, indigo_time_us_t now)
+{
+    int64_t tmp_us;
+
+    if (loop->ready_timer_levels != 0) {
+        return 0;
+    }
+
+    if (loop->timer_heap_count == 0) {
+        return -1;
+    }
+
+    tmp_us = INDIGO_TIME_DIFF_us(
+        now, loop->timer_event[loop->timer_heap[0]].deadline);
+    return tmp_us > 0 ? tmp_us : 0;
+}
+
+/*
+ * Run callbacks for the due timers at a priority level.
+ */
+static void
+process_timers(ind_soc_loop_t *loop, priority_level_t *level)
+{
+    ind_soc_timer_callback_f callback;
+    void *cookie;
+    indigo_time_us_t ready_us;
+    int idx;
+
+    /*
+     * Callbacks may register, reset or unregister timers. Reset or new
+     * timers go into the heap, so each due timer runs at most once here.
+     */
+    while ((idx = level->ready_timer_head) >= 0) {
+        if(loop->run_status == IND_SOC_RUN_STATUS_EXIT) {
+            break;
+        }
+
+        /* The callback may change its registration, so need to track
+         * current value if this is one-shot.
+         */
+
+        callback = loop->timer_event[idx].callback;
+        cookie = loop->timer_event[idx].cookie;
+        ready_us = loop->timer_event[idx].deadline;
+        if (loop->timer_event[idx].repeat_time_us == IND_SOC_TIMER_IMMEDIATE) {
+            /* De-register one-shot immediate timers */
+            timer_event_free(loop, idx);
+        } else {
+            /* Measured from when this callback starts */
+            timer_event_schedule(loop, idx, loop->now_us);
+        }
+
+        before_callback(loop, level, ready_us);
+        callback(cookie);
+        after_callback(loop, level, IND_SOC_CALLBACK_TYPE_TIMER,
+                       (void *)callback, cookie);
+    }
+}
+
+indigo_error_t
+ind_soc_timer_event_register_us(
+    ind_soc_timer_callback_f callback, void *cookie,
+    int64_t repeat_time_us, int priority,
+    ind_soc_timer_handle_t *handle)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+    int idx;
+
+    if (callback == NULL) {
+        LOG_ERROR("Null callback for timer register");
+        return INDIGO_ERROR_PARAM;
+    }
+    if (repeat_time_us < 0) {
+        LOG_ERROR("Invalid repeat time for timer register: %" PRId64 " us",
+                  repeat_time_us);
+        return INDIGO_ERROR_PARAM;
+    }
+    /* Allow re-registering which resets the timer */
+    if ((idx = timer_event_find(loop, callback, cookie)) >= 0) {
+        LOG_TRACE("Resetting event timer for %p to %" PRId64 " us",
+                  callback, repeat_time_us);
+        loop->timer_event[idx].repeat_time_us = repeat_time_us;
+        timer_event_schedule(loop, idx, soc_loop_now(loop));
+    } else {
+        idx = timer_event_alloc(loop, callback, cookie,
+                                repeat_time_us, priority);
+        if (idx < 0) {
+            return INDIGO_ERROR_RESOURCE;
+        }
+    }
+
+    if (handle != NULL) {
+        *handle = TIMER_HANDLE(loop, idx);
+    }
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_soc_timer_event_register_with_handle(
+    ind_soc_timer_callback_f callback, void *cookie,
+    int repeat_time_ms, int priority,
+    ind_soc_timer_handle_t *handle)
+{
+    if (repeat_time_ms < 0) {
+        LOG_ERROR("Invalid repeat time for timer register: %d", repeat_time_ms);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    return ind_soc_timer_event_register_us(
+        callback, cookie, (int64_t)repeat_time_ms * 1000, priority, handle);
+}
+
+indigo_error_t
+ind_soc_timer_event_register_with_priority(
+    ind_soc_timer_callback_f callback, void *cookie,
+    int repeat_time_ms, int priority)
+{
+    return ind_soc_timer_event_register_with_handle(
+        callback, cookie, repeat_time_ms, priority, NULL);
+}
+
+indigo_error_t
+ind_soc_timer_event_register(
+    ind_soc_timer_callback_f callback, void *cookie,
+    int repeat_time_ms)
+{
+    return ind_soc_timer_event_register_with_priority(
+        callback, cookie, repeat_time_ms, IND_SOC_DEFAULT_PRIORITY);
+}
+
+indigo_error_t
+ind_soc_timer_event_unregister(ind_soc_timer_callback_f callback, void *cookie)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+    int idx;
+
+    if ((idx = timer_event_find(loop, callback, cookie)) < 0) {
+        LOG_TRACE("Timer event %p, %p not found for unregister",
+                  callback, cookie);
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    timer_event_free(loop, idx);
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_soc_timer_event_rearm_us(ind_soc_timer_handle_t handle,
+                             int64_t repeat_time_us)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+    int idx;
+
+    if (repeat_time_us < 0) {
+        LOG_ERROR("Invalid repeat time for timer rearm: %" PRId64 " us",
+                  repeat_time_us);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if ((idx = timer_event_from_handle(loop, handle)) < 0) {
+        LOG_TRACE("Timer handle %" PRIx64 " not found for rearm", handle);
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    loop->timer_event[idx].repeat_time_us = repeat_time_us;
+    timer_event_schedule(loop, idx, soc_loop_now(loop));
+
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_soc_timer_event_rearm(ind_soc_timer_handle_t handle, int repeat_time_ms)
+{
+    if (repeat_time_ms < 0) {
+        LOG_ERROR("Invalid repeat time for timer rearm: %d", repeat_time_ms);
+        return INDIGO_ERROR_PARAM;
+    }
+
+    return ind_soc_timer_event_rearm_us(handle,
+                                        (int64_t)repeat_time_ms * 1000);
+}
+
+indigo_error_t
+ind_soc_timer_event_cancel(ind_soc_timer_handle_t handle)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+    int idx;
+
+    if ((idx = timer_event_from_handle(loop, handle)) < 0) {
+        LOG_TRACE("Timer handle %" PRIx64 " not found for cancel", handle);
+        return INDIGO_ERROR_NOT_FOUND;
+    }
+
+    timer_event_free(loop, idx);
+
+    return INDIGO_ERROR_NONE;
+}
+
+/*
+ * Find the next timeout based on the next timer event and the timeout passed
+ * to the original run call
+ * @param start The time when select_and_run was called
+ * @param current The current time
+ * @param run_for_us The run_for_ms passed to select_and_run, in us
+ * @param next_event_us The us until the next timer event
+ * @returns timeout in microseconds, or -1 if no timeout
+ */
+
+static int64_t
+calculate_next_timeout(indigo_time_us_t start, indigo_time_us_t current,
+                       int64_t run_for_us, int64_t next_event_us)
+{
+    int64_t min_val;
+    int64_t remaining_us;
+
+    /* Take min of positive values of next_event_us and run_for_us */
+
+    /* If neither is positive, return -1 (no timeout) */
+    if ((run_for_us < 0) && (next_event_us < 0)) {
+        return -1;
+    }
+
+    if (run_for_us >= 0) {
+        remaining_us = run_for_us - INDIGO_TIME_DIFF_us(start, current);
+        if (remaining_us < 0) {
+            remaining_us = 0;
+        }
+        if (next_event_us >= 0) {
+            min_val = remaining_us < next_event_us ? remaining_us : next_event_us;
+        } else {
+            min_val = remaining_us;
+        }
+    } else { /* next_event_us must be >= 0 */
+        min_val = next_event_us;
+    }
+
+    return min_val;
+}
+
+
+/****************************************************************
+ * Tasks
+ ****************************************************************/
+
+static ind_soc_task_t *
+task_pool_alloc(ind_soc_loop_t *loop)
+{
+    if (list_empty(&loop->task_free)) {
+        task_chunk_t *chunk = indigo_mem_tag_alloc(INDIGO_MEM_TAG_TASK,
+                                                   sizeof(*chunk));
+        int i;
+
+        AIM_TRUE_OR_DIE(chunk != NULL);
+
+        chunk->next = loop->task_chunks;
+        loop->task_chunks = chunk;
+        for (i = 0; i < TASK_POOL_CHUNK_TASKS; i++) {
+            list_push(&loop->task_free, &chunk->tasks[i].links);
+        }
+    }
+
+    return container_of(list_pop(&loop->task_free), links, ind_soc_task_t);
+}
+
+static void
+task_pool_free(ind_soc_loop_t *loop, ind_soc_task_t *task)
+{
+    /* Reused most recently freed first, while still in cache */
+    list_insert_after(&loop->task_free.links, &task->links);
+}
+
+static void
+task_pool_reset(ind_soc_loop_t *loop)
+{
+    while (loop->task_chunks != NULL) {
+        task_chunk_t *chunk = loop->task_chunks;
+        loop->task_chunks = chunk->next;
+        indigo_mem_tag_free(INDIGO_MEM_TAG_TASK, chunk, sizeof(*chunk));
+    }
+
+    list_init(&loop->task_free);
+}
+
+static indigo_error_t
+task_enqueue(ind_soc_loop_t *loop, ind_soc_task_t *task,
+             ind_soc_task_callback_f callback, void *cookie, int priority)
+{
+    priority_level_t *level;
+
+    level = priority_level_ref(loop, priority);
+
+    task->callback = callback;
+    task->cookie = cookie;
+    task->priority = priority;
+    task->level = level;
+    task->ready_us = soc_loop_now(loop);
+
+    /* Tasks at the same priority run in registration order */
+    list_push(&level->tasks, &task->links);
+    loop->ready_task_levels |= LEVEL_BIT(level);
+    loop->num_tasks++;
+
+    return INDIGO_ERROR_NONE;
+}
+
+static indigo_error_t
+task_add(ind_soc_loop_t *loop, ind_soc_task_callback_f callback,
+         void *cookie, int priority)
+{
+    indigo_error_t rv;
+    ind_soc_task_t *task = task_pool_alloc(loop);
+
+    task->flags = TASK_F_POOLED;
+    if ((rv = task_enqueue(loop, task, callback, cookie, priority)) < 0) {
+        task_pool_free(loop, task);
+    }
+
+    return rv;
+}
+
+indigo_error_t
+ind_soc_task_start(ind_soc_task_t *task, ind_soc_task_callback_f callback,
+                   void *cookie, int priority)
+{
+    if (task == NULL || callback == NULL) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    task->flags = 0;
+    return task_enqueue(soc_loop_current(), task, callback, cookie,
+                        priority);
+}
+
+indigo_error_t
+ind_soc_task_register(ind_soc_task_callback_f callback,
+                      void *cookie, int priority)
+{
+    return task_add(soc_loop_current(), callback, cookie, priority);
+}
+
+
+/****************************************************************
+ * Cross-thread task submission
+ *
+ * ind_soc_loop_task_post may be called from any thread. Posted tasks are
+ * pushed onto an intrusive multi-producer, single-consumer queue (Vyukov's
+ * algorithm) without taking a lock. Only the producer that finds no wakeup
+ * pending writes the eventfd, so a burst of posts costs the loop a single
+ * wakeup. The eventfd is an internal socket: the loop drains the queue into
+ * the task lists as soon as the wait returns, before picking the priority
+ * level to run.
+ ****************************************************************/
+
+static void
+post_queue_push(ind_soc_loop_t *loop, post_node_t *node)
+{
+    post_node_t *prev;
+
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&loop->post_head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns NULL when the queue is empty or a producer is midway through a
+ * push. In the latter case that producer's wakeup causes another drain.
+ */
+static post_node_t *
+post_queue_pop(ind_soc_loop_t *loop)
+{
+    post_node_t *tail = loop->post_tail;
+    post_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &loop->post_stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        loop->post_tail = tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL) {
+        loop->post_tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&loop->post_head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    /* tail is the last node; put the stub behind it so it can be popped */
+    post_queue_push(loop, &loop->post_stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        loop->post_tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static void
+post_queue_ready(int socket_id, void *cookie,
+                 int read_ready, int write_ready, int error_seen)
+{
+    ind_soc_loop_t *loop = cookie;
+    post_node_t *node;
+    uint64_t count;
+
+    if (read(socket_id, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Failed to read post queue eventfd: %s", strerror(errno));
+    }
+
+    /* Producers posting from here on will signal again */
+    (void) __atomic_exchange_n(&loop->post_wakeup_pending, 0, __ATOMIC_ACQ_REL);
+
+    while ((node = post_queue_pop(loop)) != NULL) {
+        if (task_add(loop, node->callback, node->cookie,
+                     node->priority) < 0) {
+            LOG_ERROR("Failed to register posted task");
+        }
+        aim_free(node);
+    }
+}
+
+static indigo_error_t
+post_queue_init(ind_soc_loop_t *loop)
+{
+    indigo_error_t rv;
+    int fd;
+
+    if ((fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        LOG_ERROR("Failed to create post queue eventfd: %s", strerror(errno));
+        return INDIGO_ERROR_UNKNOWN;
+    }
+
+    if ((rv = socket_add(loop, fd, post_queue_ready, loop, 0, NULL)) < 0) {
+        close(fd);
+        return rv;
+    }
+
+    loop->post_wakeup_pending = 0;
+    __atomic_store_n(&loop->post_event_fd, fd, __ATOMIC_RELEASE);
+
+    return INDIGO_ERROR_NONE;
+}
+
+/* Discards tasks that were posted but not yet drained */
+static void
+post_queue_finish(ind_soc_loop_t *loop)
 {
-    int idx;
-    indigo_time_t now;
-    int elapsed, tmp_ms;
-    ind_soc_timer_callback_f callback;
+    post_node_t *node;
 
-    now = INDIGO_CURRENT_TIME;
+    if (loop->post_event_fd < 0) {
+        return;
+    }
 
-    FOREACH_TIMER_EVENT(idx) {
-        if(ind_soc_run_status__ == IND_SOC_RUN_STATUS_EXIT) {
-            break;
-        }
+    close(loop->post_event_fd);
+    __atomic_store_n(&loop->post_event_fd, -1, __ATOMIC_RELEASE);
 
-        if (timer_event[idx].priority != priority) {
-            continue;
-        }
+    while ((node = post_queue_pop(loop)) != NULL) {
+        aim_free(node);
+    }
+    loop->post_stub.next = NULL;
+    loop->post_head = loop->post_tail = &loop->post_stub;
+}
 
-        elapsed = INDIGO_TIME_DIFF_ms(timer_event[idx].last_call, now);
-        tmp_ms = timer_event[idx].repeat_time_ms - elapsed; /* Time to next */
-        if (tmp_ms <= 0) {
-            timer_event[idx].last_call = now;
+indigo_error_t
+ind_soc_loop_task_post(ind_soc_loop_t *loop,
+                       ind_soc_task_callback_f callback,
+                       void *cookie, int priority)
+{
+    post_node_t *node;
+    int event_fd = __atomic_load_n(&loop->post_event_fd, __ATOMIC_ACQUIRE);
 
-            /* The callback may change its registration, so need to track
-             * current value if this is one-shot.
-             */
+    if (event_fd < 0) {
+        return INDIGO_ERROR_INIT;
+    }
 
-            callback = timer_event[idx].callback;
-            if (timer_event[idx].repeat_time_ms == IND_SOC_TIMER_IMMEDIATE) {
-                /* De-register one-shot immediate timers */
-                timer_event[idx].callback = NULL;
-            }
+    if (callback == NULL) {
+        return INDIGO_ERROR_PARAM;
+    }
 
-            before_callback();
-            callback(timer_event[idx].cookie);
-            after_callback();
+    node = aim_malloc(sizeof(*node));
+    node->callback = callback;
+    node->cookie = cookie;
+    node->priority = priority;
+    post_queue_push(loop, node);
+
+    if (!__atomic_exchange_n(&loop->post_wakeup_pending, 1, __ATOMIC_ACQ_REL)) {
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0) {
+            LOG_ERROR("Failed to write post queue eventfd: %s",
+                      strerror(errno));
+            return INDIGO_ERROR_UNKNOWN;
         }
     }
+
+    return INDIGO_ERROR_NONE;
 }
 
+
 indigo_error_t
-ind_soc_timer_event_register_with_priority(
-    ind_soc_timer_callback_f callback, void *cookie,
-    int repeat_time_ms, int priority)
+ind_soc_task_post(ind_soc_task_callback_f callback,
+                  void *cookie, int priority)
 {
-    int idx;
+    return ind_soc_loop_task_post(soc_loop_current(), callback, cookie,
+                                  priority);
+}
+
+
+/****************************************************************
+ * Pass end callbacks
+ ****************************************************************/
+
+indigo_error_t
+ind_soc_pass_end_register(ind_soc_pass_end_callback_f callback, void *cookie)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+    int i, slot = -1;
 
     if (callback == NULL) {
-        LOG_ERROR("Null callback for timer register");
-        return INDIGO_ERROR_PARAM;
-    }
-    if (repeat_time_ms < 0) {
-        LOG_ERROR("Invalid repeat time for timer register: %d", repeat_time_ms);
         return INDIGO_ERROR_PARAM;
     }
-    /* Allow re-registering which resets the timer */
-    if ((idx = timer_event_find(callback, cookie)) >= 0) {
-        LOG_TRACE("Resetting event timer for %p to %d", callback, repeat_time_ms);
-        timer_event[idx].repeat_time_ms = repeat_time_ms;
-        timer_event[idx].last_call = INDIGO_CURRENT_TIME;
-        return INDIGO_ERROR_NONE;
+
+    for (i = 0; i < loop->pass_end_count; i++) {
+        if (loop->pass_end[i].callback == callback &&
+            loop->pass_end[i].cookie == cookie) {
+            return INDIGO_ERROR_NONE;
+        }
+        if (slot < 0 && loop->pass_end[i].callback == NULL) {
+            slot = i;
+        }
     }
-    if ((idx = timer_event_free_slot()) < 0) {
-        LOG_ERROR("No space for timer event %p, %p", callback, cookie);
-        return INDIGO_ERROR_RESOURCE;
+
+    if (slot < 0) {
+        if (loop->pass_end_count == IND_SOC_PASS_END_CALLBACKS_MAX) {
+            LOG_ERROR("Too many pass end callbacks");
+            return INDIGO_ERROR_RESOURCE;
+        }
+        slot = loop->pass_end_count++;
     }
 
-    timer_event[idx].repeat_time_ms = repeat_time_ms;
-    timer_event[idx].callback = callback;
-    timer_event[idx].cookie = cookie;
-    timer_event[idx].last_call = INDIGO_CURRENT_TIME;
-    timer_event[idx].priority = priority;
+    loop->pass_end[slot].callback = callback;
+    loop->pass_end[slot].cookie = cookie;
 
     return INDIGO_ERROR_NONE;
 }
 
 indigo_error_t
-ind_soc_timer_event_register(
-    ind_soc_timer_callback_f callback, void *cookie,
-    int repeat_time_ms)
+ind_soc_pass_end_unregister(ind_soc_pass_end_callback_f callback,
+                            void *cookie)
 {
-    return ind_soc_timer_event_register_with_priority(
-        callback, cookie, repeat_time_ms, IND_SOC_DEFAULT_PRIORITY);
+    ind_soc_loop_t *loop = soc_loop_current();
+    int i;
+
+    for (i = 0; i < loop->pass_end_count; i++) {
+        if (loop->pass_end[i].callback == callback &&
+            loop->pass_end[i].cookie == cookie) {
+            /* Leave a hole for reuse; the callbacks may be running */
+            loop->pass_end[i].callback = NULL;
+            loop->pass_end[i].cookie = NULL;
+            return INDIGO_ERROR_NONE;
+        }
+    }
+
+    return INDIGO_ERROR_NOT_FOUND;
 }
 
-indigo_error_t
-ind_soc_timer_event_unregister(ind_soc_timer_callback_f callback, void *cookie)
+/* Run the pass end callbacks */
+static void
+process_pass_end(ind_soc_loop_t *loop)
 {
-    int idx;
+    int i;
 
-    if ((idx = timer_event_find(callback, cookie)) < 0) {
-        LOG_TRACE("Timer event %p, %p not found for unregister",
-                  callback, cookie);
-        return INDIGO_ERROR_NOT_FOUND;
+    for (i = 0; i < loop->pass_end_count; i++) {
+        if (loop->pass_end[i].callback != NULL) {
+            loop->pass_end[i].callback(loop->pass_end[i].cookie);
+        }
     }
-
-    timer_event[idx].callback = NULL;
-
-    return INDIGO_ERROR_NONE;
 }
 
-/*
- * Find the next timeout based on the next timer event and the timeout passed
- * to the original run call
- * @param start The time when select_and_run was called
- * @param current The current time
- * @param passed_ms The run_for_ms passed to select_and_run
- * @param next_event_ms The ms until the next timer event
- * @returns timeout in milliseconds, or -1 if no timeout
- */
 
-static int
-calculate_next_timeout(indigo_time_t start, indigo_time_t current,
-                       int run_for_ms, int next_event_ms)
-{
-    int min_val;
-    int remaining_ms;
+/****************************************************************
+ * Event loop instances
+ ****************************************************************/
 
-    /* Take min of positive values of next_event_ms and run_for_ms */
+/* Set up the backend and post queue of an empty loop */
+static indigo_error_t
+soc_loop_init(ind_soc_loop_t *loop, ind_soc_config_t *config)
+{
+    indigo_error_t rv;
 
-    /* If neither is positive, return -1 (no timeout) */
-    if ((run_for_ms < 0) && (next_event_ms < 0)) {
-        return -1;
+    rv = backend_init(loop, config ? config->backend : IND_SOC_BACKEND_POLL);
+    if (rv < 0) {
+        return rv;
     }
 
-    if (run_for_ms >= 0) {
-        remaining_ms = run_for_ms - INDIGO_TIME_DIFF_ms(start, current);
-        if (remaining_ms < 0) {
-            remaining_ms = 0;
-        }
-        if (next_event_ms >= 0) {
-            min_val = remaining_ms < next_event_ms ? run_for_ms : next_event_ms;
-        } else {
-            min_val = remaining_ms;
-        }
-    } else { /* next_event_ms must be >= 0 */
-        min_val = next_event_ms;
+    rv = post_queue_init(loop);
+    if (rv < 0) {
+        backend_finish(loop);
+        return rv;
     }
 
-    return min_val;
+    return INDIGO_ERROR_NONE;
 }
 
+/* Release everything owned by a loop, leaving it empty */
+static void
+soc_loop_finish(ind_soc_loop_t *loop)
+{
+    post_queue_finish(loop);
+    soc_mgr_init(loop);
+    backend_finish(loop);
+}
 
 indigo_error_t
-ind_soc_task_register(ind_soc_task_callback_f callback,
-                      void *cookie, int priority)
+ind_soc_loop_create(ind_soc_config_t *config, ind_soc_loop_t **loop_p)
 {
-    list_links_t *cur;
+    indigo_error_t rv;
+    ind_soc_loop_t *loop;
 
-    ind_soc_task_t *task = INDIGO_MEM_ALLOC(sizeof(*task));
-    if (task == NULL) {
-        return INDIGO_ERROR_RESOURCE;
+    if (loop_p == NULL) {
+        return INDIGO_ERROR_PARAM;
     }
 
-    task->callback = callback;
-    task->cookie = cookie;
-    task->priority = priority;
+    loop = aim_malloc(sizeof(*loop));
+    *loop = (ind_soc_loop_t)SOC_LOOP_INITIALIZER(*loop);
 
-    /* Maintain descending priority order */
-    LIST_FOREACH(&tasks, cur) {
-        ind_soc_task_t *cur_task = container_of(cur, links, ind_soc_task_t);
-        if (cur_task->priority <= priority) {
-            break;
-        }
+    if ((rv = soc_loop_init(loop, config)) < 0) {
+        aim_free(loop);
+        return rv;
     }
 
-    /*
-     * If we're inserting the new lowest priority task then cur will be left
-     * pointing to the list head. Otherwise it points to the first task with
-     * lower priority. In both cases we insert the new task before cur.
-     */
-    list_insert_before(cur, &task->links);
+    *loop_p = loop;
 
     return INDIGO_ERROR_NONE;
 }
 
+void
+ind_soc_loop_destroy(ind_soc_loop_t *loop)
+{
+    if (loop == NULL) {
+        return;
+    }
+
+    INDIGO_ASSERT(loop != &default_loop);
+
+    if (thread_loop == loop) {
+        thread_loop = NULL;
+    }
+
+    soc_loop_finish(loop);
+    aim_free(loop);
+}
+
+ind_soc_loop_t *
+ind_soc_loop_default(void)
+{
+    return &default_loop;
+}
+
+void
+ind_soc_loop_current_set(ind_soc_loop_t *loop)
+{
+    thread_loop = loop;
+}
+
+ind_soc_loop_t *
+ind_soc_loop_current(void)
+{
+    return soc_loop_current();
+}
+
 
 indigo_error_t
 ind_soc_init(ind_soc_config_t *config)
 {
+    indigo_error_t rv;
+
     LOG_INFO("Initializing socket manager");
 
+    soc_loop_finish(&default_loop);
+
+    rv = soc_loop_init(&default_loop, config);
+    if (rv < 0) {
+        return rv;
+    }
+
     ind_cfg_register(&ind_soc_cfg_ops);
 
-    soc_mgr_init();
     init_done = 1;
-    (void)config;
 
     return INDIGO_ERROR_NONE;
 }
 
-
 indigo_error_t
 ind_soc_enable_set(int enable)
 {
@@ -607,135 +2614,370 @@ indigo_error_t
 ind_soc_finish(void)
 {
     LOG_INFO("Shutting down socket manager");
-    soc_mgr_init();
+    soc_loop_finish(&default_loop);
     init_done = 0;
 
     return INDIGO_ERROR_NONE;
 }
 
-/* Time since the current callback started */
-static indigo_time_t callback_start_time;
+/****************************************************************
+ * Statistics
+ *
+ * Every callback is bracketed by before_callback and after_callback,
+ * which record how long it waited after becoming ready and how long it
+ * ran. Histograms use power of two microsecond buckets, so recording a
+ * sample is a handful of instructions.
+ ****************************************************************/
 
-static void
-before_callback(void)
+/* Read the event loop clock */
+static indigo_time_us_t
+soc_time_us(void)
 {
-    callback_start_time = INDIGO_CURRENT_TIME;
+#if SOCKETMANAGER_CONFIG_COARSE_CLOCK == 1
+    return INDIGO_CURRENT_TIME_COARSE_us;
+#else
+    return INDIGO_CURRENT_TIME_us;
+#endif
+}
+
+void
+ind_soc_histogram_add(ind_soc_histogram_t *hist, uint64_t us)
+{
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+
+    if (bucket >= IND_SOC_HISTOGRAM_BUCKETS) {
+        bucket = IND_SOC_HISTOGRAM_BUCKETS - 1;
+    }
+
+    hist->count++;
+    hist->total_us += us;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+    hist->buckets[bucket]++;
+}
+
+/* Find or add the stats entry for a priority; NULL if the table is full */
+static ind_soc_priority_stats_t *
+priority_stats_get(ind_soc_loop_t *loop, int priority)
+{
+    ind_soc_stats_t *stats = &loop->stats;
+    int idx;
+
+    for (idx = 0; idx < stats->num_priorities; idx++) {
+        if (stats->priorities[idx].priority == priority) {
+            return &stats->priorities[idx];
+        }
+    }
+
+    if (stats->num_priorities >= IND_SOC_PRIORITY_STATS_MAX) {
+        return NULL;
+    }
+
+    idx = stats->num_priorities++;
+    memset(&stats->priorities[idx], 0, sizeof(stats->priorities[idx]));
+    stats->priorities[idx].priority = priority;
+    return &stats->priorities[idx];
 }
 
 static void
-after_callback(void)
+before_callback(ind_soc_loop_t *loop, priority_level_t *level,
+                uint64_t ready_us)
+{
+    /* The previous callback or the wait just refreshed the loop clock */
+    indigo_time_us_t now_us = loop->now_us;
+
+    loop->callback_start_us = now_us;
+
+    if (level->stats != NULL && ready_us != 0) {
+        ind_soc_histogram_add(&level->stats->queue_delay,
+                      now_us > ready_us ? now_us - ready_us : 0);
+    }
+}
+
+/* Returns the time the callback finished */
+static uint64_t
+after_callback(ind_soc_loop_t *loop, priority_level_t *level,
+               ind_soc_callback_type_t type, void *callback, void *cookie)
+{
+    ind_soc_stats_t *stats = &loop->stats;
+    indigo_time_us_t now_us = soc_loop_clock(loop);
+    uint64_t elapsed_us = now_us - loop->callback_start_us;
+
+    ind_soc_histogram_add(&stats->callback_duration[type], elapsed_us);
+
+    if (elapsed_us >= SOCKETMANAGER_CONFIG_TIMESLICE_MS * 1000ULL) {
+        stats->timeslice_overruns++;
+    }
+
+    if (elapsed_us > stats->slowest_callback.duration_us) {
+        stats->slowest_callback.type = type;
+        stats->slowest_callback.callback = callback;
+        stats->slowest_callback.cookie = cookie;
+        stats->slowest_callback.priority = level->priority;
+        stats->slowest_callback.duration_us = elapsed_us;
+    }
+
+    if (elapsed_us >= SOCKETMANAGER_CONFIG_TIMESLICE_MS * 2000ULL) {
+        LOG_VERBOSE("Callback %p exceeded 2x timeslice (ran for %d ms, timeslice is %d ms)",
+                    callback, (int)(elapsed_us / 1000),
+                    SOCKETMANAGER_CONFIG_TIMESLICE_MS);
+    }
+
+    return now_us;
+}
+
+static int
+priority_stats_compare(const void *a, const void *b)
+{
+    const ind_soc_priority_stats_t *pa = a, *pb = b;
+    return (pa->priority < pb->priority) - (pa->priority > pb->priority);
+}
+
+void
+ind_soc_stats_get(ind_soc_stats_t *stats)
+{
+    ind_soc_loop_t *loop = soc_loop_current();
+
+    *stats = loop->stats;
+    qsort(stats->priorities, stats->num_priorities,
+          sizeof(stats->priorities[0]), priority_stats_compare);
+}
+
+void
+ind_soc_stats_clear(void)
+{
+    ind_soc_stats_t *stats = &soc_loop_current()->stats;
+    int idx;
+
+    /* Keep the priority entries, levels point at them */
+    stats->iterations = 0;
+    stats->timeslice_overruns = 0;
+    memset(stats->callback_duration, 0, sizeof(stats->callback_duration));
+    memset(&stats->slowest_callback, 0, sizeof(stats->slowest_callback));
+    for (idx = 0; idx < stats->num_priorities; idx++) {
+        memset(&stats->priorities[idx].queue_delay, 0,
+               sizeof(stats->priorities[idx].queue_delay));
+    }
+}
+
+static const char *const callback_type_names[IND_SOC_CALLBACK_TYPE_COUNT] = {
+    "socket",
+    "timer",
+    "task",
+};
+
+void
+ind_soc_histogram_show(aim_pvs_t *pvs, const char *name, ind_soc_histogram_t *hist)
+{
+    int idx;
+
+    aim_printf(pvs, "    %s: count %"PRIu64", avg %"PRIu64" us, max %"PRIu64" us\n",
+               name, hist->count,
+               hist->count ? hist->total_us / hist->count : 0,
+               hist->max_us);
+
+    for (idx = 0; idx < IND_SOC_HISTOGRAM_BUCKETS; idx++) {
+        if (hist->buckets[idx] == 0) {
+            continue;
+        }
+        if (idx == 0) {
+            aim_printf(pvs, "        < 1 us: %"PRIu64"\n",
+                       hist->buckets[idx]);
+        } else if (idx == IND_SOC_HISTOGRAM_BUCKETS - 1) {
+            aim_printf(pvs, "        >= %"PRIu64" us: %"PRIu64"\n",
+                       (uint64_t)1 << (idx - 1), hist->buckets[idx]);
+        } else {
+            aim_printf(pvs, "        %"PRIu64"-%"PRIu64" us: %"PRIu64"\n",
+                       (uint64_t)1 << (idx - 1), ((uint64_t)1 << idx) - 1,
+                       hist->buckets[idx]);
+        }
+    }
+}
+
+uint64_t
+ind_soc_histogram_percentile(const ind_soc_histogram_t *hist, int percent)
 {
-    indigo_time_t elapsed =
-        INDIGO_TIME_DIFF_ms(callback_start_time, INDIGO_CURRENT_TIME);
-    if (elapsed >= SOCKETMANAGER_CONFIG_TIMESLICE_MS * 2) {
-        LOG_VERBOSE("Callback exceeded 2x timeslice (ran for %d ms, timeslice is %d ms)",
-                    (int)elapsed, SOCKETMANAGER_CONFIG_TIMESLICE_MS);
+    uint64_t rank, seen = 0, upper;
+    int idx;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    rank = (hist->count * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (idx = 0; idx < IND_SOC_HISTOGRAM_BUCKETS - 1; idx++) {
+        seen += hist->buckets[idx];
+        if (seen >= rank) {
+            upper = idx == 0 ? 0 : ((uint64_t)1 << idx) - 1;
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+
+    return hist->max_us;
+}
+
+void
+ind_soc_stats_show(aim_pvs_t *pvs)
+{
+    ind_soc_stats_t *stats = aim_malloc(sizeof(*stats));
+    char name[32];
+    int idx;
+
+    ind_soc_stats_get(stats);
+
+    aim_printf(pvs, "Event loop statistics\n");
+    aim_printf(pvs, "    Iterations: %"PRIu64"\n", stats->iterations);
+    aim_printf(pvs, "    Timeslice overruns (>= %d ms): %"PRIu64"\n",
+               SOCKETMANAGER_CONFIG_TIMESLICE_MS, stats->timeslice_overruns);
+    if (stats->slowest_callback.callback != NULL) {
+        aim_printf(pvs, "    Slowest callback: %s %p cookie %p priority %d, %"PRIu64" us\n",
+                   callback_type_names[stats->slowest_callback.type],
+                   stats->slowest_callback.callback,
+                   stats->slowest_callback.cookie,
+                   stats->slowest_callback.priority,
+                   stats->slowest_callback.duration_us);
+    }
+
+    aim_printf(pvs, "Callback duration\n");
+    for (idx = 0; idx < IND_SOC_CALLBACK_TYPE_COUNT; idx++) {
+        ind_soc_histogram_show(pvs, callback_type_names[idx],
+                       &stats->callback_duration[idx]);
+    }
+
+    aim_printf(pvs, "Queueing delay by priority\n");
+    for (idx = 0; idx < stats->num_priorities; idx++) {
+        snprintf(name, sizeof(name), "priority %d",
+                 stats->priorities[idx].priority);
+        ind_soc_histogram_show(pvs, name, &stats->priorities[idx].queue_delay);
     }
+
+    aim_free(stats);
+}
+
+indigo_time_t
+ind_soc_loop_now(void)
+{
+    return INDIGO_TIME_us_TO_ms(soc_loop_now(soc_loop_current()));
+}
+
+indigo_time_us_t
+ind_soc_loop_now_us(void)
+{
+    return soc_loop_now(soc_loop_current());
 }
 
 int
 ind_soc_should_yield(void)
 {
-    indigo_time_t elapsed =
-        INDIGO_TIME_DIFF_ms(callback_start_time, INDIGO_CURRENT_TIME);
-    return elapsed >= SOCKETMANAGER_CONFIG_TIMESLICE_MS;
+    ind_soc_loop_t *loop = soc_loop_current();
+    return soc_time_us() - loop->callback_start_us >=
+        SOCKETMANAGER_CONFIG_TIMESLICE_MS * 1000ULL;
 }
 
 /*
- * Run callbacks for each ready socket.
+ * Run callbacks for each ready socket at a priority level.
  */
 static void
-process_sockets(int priority)
+process_sockets(ind_soc_loop_t *loop, priority_level_t *level)
 {
     int i;
-    for (i = 0; i < num_pollfds; i++) {
-        struct pollfd *pfd = &pollfds[i];
+    for (i = level->ready_socket_head; i >= 0;
+             i = loop->ready_sockets[i].next) {
+        ready_socket_t *ready = &loop->ready_sockets[i];
+        int socket_id = ready->socket_id;
         int read_ready, write_ready, error_seen;
+        soc_map_t *soc;
 
-        if (ind_soc_run_status__ == IND_SOC_RUN_STATUS_EXIT) {
+        if (loop->run_status == IND_SOC_RUN_STATUS_EXIT) {
             break;
         }
 
-        if (soc_map[pfd->fd].priority != priority) {
+        /* An earlier callback may have unregistered this socket */
+        if (!IS_ACTIVE_SOCKET_ID(loop, socket_id)) {
+            continue;
+        }
+
+        soc = SOC_MAP(loop, socket_id);
+        if (soc->level != level) {
             continue;
         }
 
-        read_ready = (pfd->revents & POLLIN) != 0;
-        write_ready = (pfd->revents & POLLOUT) != 0;
-        error_seen = (pfd->revents & POLLERR) != 0;
+        read_ready = (ready->revents & POLLIN) != 0;
+        write_ready = (ready->revents & POLLOUT) != 0;
+        error_seen = (ready->revents & POLLERR) != 0;
         if (read_ready || write_ready || error_seen) {
-            before_callback();
-            soc_map[pfd->fd].callback(pfd->fd, soc_map[pfd->fd].cookie,
-                    read_ready, write_ready, error_seen);
-            after_callback();
+            ind_soc_socket_ready_callback_f callback = soc->callback;
+            void *cookie = soc->cookie;
+
+            before_callback(loop, level, soc->ready_us);
+            soc->ready_us = 0;
+            callback(socket_id, cookie, read_ready, write_ready, error_seen);
+            after_callback(loop, level, IND_SOC_CALLBACK_TYPE_SOCKET,
+                           (void *)callback, cookie);
         }
     }
 }
 
 /*
- * Run callbacks for each task.
+ * Run callbacks for each task at a priority level.
  */
 static void
-process_tasks(int priority)
+process_tasks(ind_soc_loop_t *loop, priority_level_t *level)
 {
     struct list_links *cur, *next;
-    LIST_FOREACH_SAFE(&tasks, cur, next) {
+    LIST_FOREACH_SAFE(&level->tasks, cur, next) {
         ind_soc_task_t *task = container_of(cur, links, ind_soc_task_t);
-        if (task->priority < priority) {
-            break;
-        }
-        before_callback();
-        if (task->callback(task->cookie) == IND_SOC_TASK_FINISHED) {
-            list_remove(&task->links);
-            INDIGO_MEM_FREE(task);
+        ind_soc_task_callback_f callback = task->callback;
+        void *cookie = task->cookie;
+        struct list_links *prev = cur->prev;
+        int pooled = task->flags & TASK_F_POOLED;
+        ind_soc_task_status_t status;
+        uint64_t end_us;
+
+        /*
+         * An embedded task may be freed by its callback before it returns
+         * IND_SOC_TASK_FINISHED, so unlink it first. Only tasks after it
+         * can be added meanwhile, so prev is still its predecessor.
+         */
+        list_remove(&task->links);
+
+        before_callback(loop, level, task->ready_us);
+        status = callback(cookie);
+        end_us = after_callback(loop, level, IND_SOC_CALLBACK_TYPE_TASK,
+                                (void *)callback, cookie);
+
+        if (status == IND_SOC_TASK_FINISHED) {
+            priority_level_unref(level);
+            loop->num_tasks--;
+            if (pooled) {
+                task_pool_free(loop, task);
+            }
+        } else {
+            list_insert_after(prev, &task->links);
+            task->ready_us = end_us;
         }
-        after_callback();
+    }
+
+    if (list_empty(&level->tasks)) {
+        loop->ready_task_levels &= ~LEVEL_BIT(level);
     }
 }
 
 /*
  * This function returns the priority level the event loop should process
- * on the current iteration. It assumes poll() has been called on the global
- * pollfds array.
+ * on the current iteration, or NULL if nothing is ready. It assumes
+ * backend_wait() has filled in the ready socket queues.
  */
-static int
-find_highest_ready_priority(void)
+static priority_level_t *
+find_highest_ready_priority(ind_soc_loop_t *loop)
 {
-    int idx;
-    indigo_time_t now;
-    int elapsed, tmp_ms;
-    int priority = INT_MIN;
-
-    now = INDIGO_CURRENT_TIME;
-
-    for (idx = 0; idx < num_pollfds; idx++) {
-        struct pollfd *pfd = &pollfds[idx];
-
-        if (pfd->revents == 0) {
-            continue;
-        }
-
-        priority = aim_imax(priority, soc_map[pfd->fd].priority);
-    }
-
-    FOREACH_TIMER_EVENT(idx) {
-        if (timer_event[idx].priority <= priority) {
-            continue;
-        }
-
-        elapsed = INDIGO_TIME_DIFF_ms(timer_event[idx].last_call, now);
-        tmp_ms = timer_event[idx].repeat_time_ms - elapsed; /* Time to next */
-        if (tmp_ms <= 0) {
-            priority = timer_event[idx].priority;
-        }
-    }
-
-    if (!list_empty(&tasks)) {
-        ind_soc_task_t *task = container_of(tasks.links.next, links, ind_soc_task_t);
-        priority = aim_imax(priority, task->priority);
-    }
-
-    return priority;
+    timer_promote_due(loop, loop->now_us);
+    return priority_level_highest_ready(loop);
 }
 
 /*
@@ -747,50 +2989,65 @@ find_highest_ready_priority(void)
 int
 ind_soc_select_and_run(int run_for_ms)
 {
+    ind_soc_loop_t *loop = soc_loop_current();
     int rv;
-    indigo_time_t start, current;
-    int elapsed;
-    int next_timer_ms, timeout_ms;
-    int priority;
+    indigo_time_us_t start, current;
+    int64_t run_for_us = run_for_ms < 0 ? -1 : (int64_t)run_for_ms * 1000;
+    int64_t next_timer_us, timeout_us;
+    priority_level_t *level;
+    indigo_error_t result = INDIGO_ERROR_NONE;
 
     ind_soc_run_status_set(IND_SOC_RUN_STATUS_OK);
 
-    current = start = INDIGO_CURRENT_TIME;
+    current = start = soc_loop_clock(loop);
+    loop->running++;
 
     do {
-        if (list_empty(&tasks)) {
-            next_timer_ms = find_next_timer_expiration(current);
+        priority_levels_gc(loop);
+
+        if (loop->num_tasks == 0) {
+            next_timer_us = find_next_timer_expiration(loop, current);
         } else {
             /* Do not sleep if a task is ready */
-            next_timer_ms = 0;
+            next_timer_us = 0;
         }
 
-        timeout_ms = calculate_next_timeout(start, current,
-                                            run_for_ms, next_timer_ms);
+        timeout_us = calculate_next_timeout(start, current,
+                                            run_for_us, next_timer_us);
 
-        LOG_TRACE("polling %d fds, timeout %d ms", num_pollfds, timeout_ms);
-        rv = poll(pollfds, num_pollfds, timeout_ms);
-        LOG_TRACE("poll returned %d", rv);
+        rv = backend_wait(loop, timeout_us);
 
         if (rv < 0 && errno != EINTR) {
             LOG_ERROR("Error in poll: %s", strerror(errno));
-            return INDIGO_ERROR_UNKNOWN;
+            result = INDIGO_ERROR_UNKNOWN;
+            break;
         }
 
-        priority = find_highest_ready_priority();
-        LOG_TRACE("processing priority %d", priority);
+        level = find_highest_ready_priority(loop);
+        if (level != NULL) {
+            LOG_TRACE("processing priority %d", level->priority);
 
-        process_sockets(priority);
-        process_timers(priority);
-        process_tasks(priority);
+            loop->current_level = level;
+            process_sockets(loop, level);
+            ready_sockets_clear(loop, level);
+            process_timers(loop, level);
+            process_tasks(loop, level);
+            loop->current_level = NULL;
+        }
 
-        if (ind_soc_run_status__ == IND_SOC_RUN_STATUS_EXIT) {
-            return INDIGO_ERROR_NONE;
+        process_pass_end(loop);
+
+        if (loop->run_status == IND_SOC_RUN_STATUS_EXIT) {
+            break;
         }
 
-        current = INDIGO_CURRENT_TIME;
-        elapsed = INDIGO_TIME_DIFF_ms(start, current);
-    } while ((run_for_ms < 0) || ((run_for_ms > 0) && (elapsed < run_for_ms)));
+        /* Refreshed by the wait and after every callback */
+        current = loop->now_us;
+    } while ((run_for_us < 0) ||
+             ((run_for_us > 0) &&
+              (INDIGO_TIME_DIFF_us(start, current) < run_for_us)));
 
-    return INDIGO_ERROR_NONE;
+    loop->running--;
+
+    return result;
 }
@@ -78,6 +78,16 @@ socketmanager_config_settings_t socketmanager_config_settings[] =
     { __socketmanager_config_STRINGIFY_NAME(SOCKETMANAGER_CONFIG_TIMESLICE_MS), __socketmanager_config_STRINGIFY_VALUE(SOCKETMANAGER_CONFIG_TIMESLICE_MS) },
 #else
 { SOCKETMANAGER_CONFIG_TIMESLICE_MS(__socketmanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef SOCKETMANAGER_CONFIG_COARSE_CLOCK
+    { __socketmanager_config_STRINGIFY_NAME(SOCKETMANAGER_CONFIG_COARSE_CLOCK), __socketmanager_config_STRINGIFY_VALUE(SOCKETMANAGER_CONFIG_COARSE_CLOCK) },
+#else
+{ SOCKETMANAGER_CONFIG_COARSE_CLOCK(__socketmanager_config_STRINGIFY_NAME), "__undefined__" },
+#endif
+#ifdef SOCKETMANAGER_CONFIG_INCLUDE_IO_URING
+    { __socketmanager_config_STRINGIFY_NAME(SOCKETMANAGER_CONFIG_INCLUDE_IO_URING), __socketmanager_config_STRINGIFY_VALUE(SOCKETMANAGER_CONFIG_INCLUDE_IO_URING) },
+#else
+{ SOCKETMANAGER_CONFIG_INCLUDE_IO_URING(__socketmanager_config_STRINGIFY_NAME), "__undefined__" },
 #endif
     { NULL, NULL }
 };
@@ -144,7 +154,13 @@ ind_soc_cfg_commit(void)
     }
 }
 
+static const char * const cfg_paths[] = {
+    "logging.connection",
+    NULL
+};
+
 const struct ind_cfg_ops ind_soc_cfg_ops = {
     .stage = ind_soc_cfg_stage,
     .commit = ind_soc_cfg_commit,
+    .paths = cfg_paths,
 };
@@ -36,4 +36,7 @@
 
 extern const struct ind_cfg_ops ind_soc_cfg_ops;
 
+/* Print the statistics of the current loop */
+extern void ind_soc_stats_show(aim_pvs_t *pvs);
+
 #endif /* __SOCKETMANAGER_INT_H__ */
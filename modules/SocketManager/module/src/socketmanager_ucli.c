@@ -33,6 +33,8 @@
 #include <uCli/ucli.h>
 #include <uCli/ucli_argparse.h>
 #include <uCli/ucli_handler_macros.h>
+#include <string.h>
+#include "socketmanager_int.h"
 
 
 
@@ -58,6 +60,29 @@ socketmanager_ucli_ucli__foo__(ucli_context_t* uc)
     return UCLI_STATUS_OK;
 }
 
+static ucli_status_t
+socketmanager_ucli_ucli__stats__(ucli_context_t *uc)
+{
+    char *str;
+
+    UCLI_COMMAND_INFO(uc,
+                      "stats", -1,
+                      "$summary#Show event loop stats, or clear them.");
+    if (uc->pargs->count == 1) {
+        UCLI_ARGPARSE_OR_RETURN(uc, "s", &str);
+        if (strcmp(str, "clear")) {
+            return UCLI_STATUS_E_ARG;
+        }
+        ind_soc_stats_clear();
+        return UCLI_STATUS_OK;
+    } else if (uc->pargs->count > 1) {
+        return UCLI_STATUS_E_ARG;
+    }
+
+    ind_soc_stats_show(&uc->pvs);
+
+    return UCLI_STATUS_OK;
+}
 
 /* <auto.ucli.handlers.start> */
 /******************************************************************************
@@ -70,6 +95,7 @@ static ucli_command_handler_f socketmanager_ucli_ucli_handlers__[] =
 {
     socketmanager_ucli_ucli__config__,
     socketmanager_ucli_ucli__foo__,
+    socketmanager_ucli_ucli__stats__,
     NULL
 };
 /******************************************************************************/
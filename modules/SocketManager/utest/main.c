@@ -30,14 +30,18 @@
 
 #include <SocketManager/socketmanager.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <indigo/assert.h>
 #include <indigo/time.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -275,6 +279,158 @@ test_socket_mgmt(void)
     close(fds[1]);
 }
 
+/* Counts read events without consuming the data */
+static void
+socket_callback_peek(
+    int socket_id,
+    void *cookie,
+    int read_ready,
+    int write_ready,
+    int error_seen)
+{
+    struct sock_counters *counters = cookie;
+
+    INDIGO_ASSERT(!error_seen);
+    if (read_ready) {
+        counters->read++;
+    }
+    if (write_ready) {
+        counters->write++;
+    }
+}
+
+/*
+ * Test that readiness is level triggered, and that events requested
+ * before a socket was re-registered are not delivered to its new callback
+ */
+static void
+test_socket_rearm(void)
+{
+    int fds[2];
+    struct sock_counters counters[2];
+    char buf;
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        abort();
+    }
+
+    memset(counters, 0, sizeof(counters));
+    INDIGO_ASSERT(ind_soc_socket_register(fds[1], socket_callback_peek, &counters[0]) == 0);
+
+    /* Unread data is reported again on every iteration */
+    INDIGO_ASSERT(write(fds[0], "x", 1) == 1);
+    for (i = 0; i < 3; i++) {
+        ind_soc_select_and_run(0);
+        INDIGO_ASSERT(counters[0].read == i + 1);
+    }
+
+    /* Draining the socket stops the events */
+    INDIGO_ASSERT(read(fds[1], &buf, 1) == 1);
+    ind_soc_select_and_run(0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counters[0].read == 4);
+
+    /* Changing the requested events replaces the pending request */
+    INDIGO_ASSERT(ind_soc_data_out_ready(fds[1]) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counters[0].write == 1);
+    INDIGO_ASSERT(ind_soc_data_out_clear(fds[1]) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counters[0].write == 1);
+    INDIGO_ASSERT(counters[0].read == 4);
+
+    /* Re-register with another cookie while a request is outstanding */
+    INDIGO_ASSERT(ind_soc_socket_unregister(fds[1]) == 0);
+    INDIGO_ASSERT(ind_soc_socket_register(fds[1], socket_callback_peek, &counters[1]) == 0);
+    INDIGO_ASSERT(write(fds[0], "x", 1) == 1);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counters[0].read == 4);
+    INDIGO_ASSERT(counters[1].read == 1);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counters[1].read == 2);
+
+    /* No events after unregistering with data still pending */
+    INDIGO_ASSERT(ind_soc_socket_unregister(fds[1]) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counters[1].read == 2);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* Test more sockets than the initial map size, and a large descriptor */
+#define MANY_SOCKET_PAIRS 100
+#define HIGH_SOCKET_ID 4096
+
+static void
+test_many_sockets(void)
+{
+    int fds[MANY_SOCKET_PAIRS][2];
+    struct sock_counters counters[MANY_SOCKET_PAIRS];
+    struct rlimit rl;
+    int i, high_fd;
+
+    for (i = 0; i < MANY_SOCKET_PAIRS; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) < 0) {
+            perror("socketpair");
+            abort();
+        }
+    }
+
+    /* Move one reader above the old 1024 limit if the rlimit allows it */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur <= HIGH_SOCKET_ID &&
+            rl.rlim_max > HIGH_SOCKET_ID) {
+        rl.rlim_cur = HIGH_SOCKET_ID + 1;
+        (void) setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if ((high_fd = fcntl(fds[0][1], F_DUPFD, HIGH_SOCKET_ID)) >= 0) {
+        close(fds[0][1]);
+        fds[0][1] = high_fd;
+    } else {
+        printf("Skipping high socket ID test: %s\n", strerror(errno));
+    }
+
+    for (i = 0; i < MANY_SOCKET_PAIRS; i++) {
+        INDIGO_ASSERT(ind_soc_socket_register(fds[i][1], socket_callback,
+                                              &counters[i]) == 0);
+    }
+
+    /* Every reader sees its byte */
+    for (i = 0; i < MANY_SOCKET_PAIRS; i++) {
+        INDIGO_ASSERT(write(fds[i][0], "x", 1) == 1);
+    }
+    memset(counters, 0, sizeof(counters));
+    ind_soc_select_and_run(0);
+    for (i = 0; i < MANY_SOCKET_PAIRS; i++) {
+        INDIGO_ASSERT(counters[i].read == 1);
+        INDIGO_ASSERT(counters[i].write == 0);
+    }
+
+    /* Unregister every other reader; the rest must still be dispatched */
+    for (i = 0; i < MANY_SOCKET_PAIRS; i += 2) {
+        INDIGO_ASSERT(ind_soc_socket_unregister(fds[i][1]) == 0);
+    }
+    for (i = 0; i < MANY_SOCKET_PAIRS; i++) {
+        INDIGO_ASSERT(write(fds[i][0], "x", 1) == 1);
+    }
+    memset(counters, 0, sizeof(counters));
+    ind_soc_select_and_run(0);
+    for (i = 0; i < MANY_SOCKET_PAIRS; i++) {
+        INDIGO_ASSERT(counters[i].read == (i % 2));
+    }
+
+    for (i = 1; i < MANY_SOCKET_PAIRS; i += 2) {
+        INDIGO_ASSERT(ind_soc_socket_unregister(fds[i][1]) == 0);
+    }
+
+    for (i = 0; i < MANY_SOCKET_PAIRS; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
 
 static void
 timer_callback(void *cookie)
@@ -349,6 +505,48 @@ test_immediate_timer(void)
     INDIGO_ASSERT(ind_soc_timer_event_unregister(timer_callback, &count) < 0);
 }
 
+/* Checks that the loop clock does not move within a callback */
+static void
+timer_callback_loop_now(void *cookie)
+{
+    int *count_ptr = cookie;
+    indigo_time_us_t now = ind_soc_loop_now_us();
+    INDIGO_ASSERT(ind_soc_loop_now_us() == now);
+    INDIGO_ASSERT(ind_soc_loop_now() == INDIGO_TIME_us_TO_ms(now));
+    (*count_ptr)++;
+}
+
+static void
+test_timer_us(void)
+{
+    ind_soc_timer_handle_t handle;
+    indigo_time_us_t start;
+    int count = 0;
+
+    /* Outside the loop the clock is read */
+    INDIGO_ASSERT(ind_soc_loop_now() - INDIGO_CURRENT_TIME <= 1 ||
+                  INDIGO_CURRENT_TIME - ind_soc_loop_now() <= 1);
+
+    INDIGO_ASSERT(ind_soc_timer_event_register_us(
+        timer_callback_loop_now, &count, -1, 0, NULL) == INDIGO_ERROR_PARAM);
+
+    /* A 250 us timer fires several times per millisecond */
+    start = INDIGO_CURRENT_TIME_us;
+    INDIGO_ASSERT(ind_soc_timer_event_register_us(
+        timer_callback_loop_now, &count, 250, 0, &handle) == 0);
+    ind_soc_select_and_run(20);
+    INDIGO_ASSERT(INDIGO_CURRENT_TIME_us - start >= 20000);
+    INDIGO_ASSERT(count > 20 && count <= 80);
+
+    /* Rearming with a longer period slows it down */
+    count = 0;
+    INDIGO_ASSERT(ind_soc_timer_event_rearm_us(handle, 5000) == 0);
+    ind_soc_select_and_run(20);
+    INDIGO_ASSERT(count >= 2 && count <= 4);
+
+    INDIGO_ASSERT(ind_soc_timer_event_cancel(handle) == 0);
+}
+
 static void
 test_timer_mgmt(void)
 {
@@ -374,28 +572,94 @@ test_timer_mgmt(void)
 
     /* Should be able to register and unregister a bunch of timers */
     {
-        int i, j;
-
-        for (i = 0; 1; i++) {
-            indigo_error_t err = ind_soc_timer_event_register(
-                timer_callback, (void *)(uintptr_t)i, 100);
-            if (err < 0) {
-                INDIGO_ASSERT(err == INDIGO_ERROR_RESOURCE);
-                break;
-            }
+        int i;
+
+        for (i = 0; i < 10000; i++) {
+            INDIGO_ASSERT(ind_soc_timer_event_register(
+                timer_callback, (void *)(uintptr_t)i, 100 + i % 7) == 0);
         }
 
-        for (j = 0; 1; j++) {
-            indigo_error_t err = ind_soc_timer_event_unregister(
-                timer_callback, (void *)(uintptr_t)j);
-            if (err < 0) {
-                INDIGO_ASSERT(err == INDIGO_ERROR_NOT_FOUND);
-                break;
-            }
+        /* Unregister in a different order than registration */
+        for (i = 0; i < 10000; i += 2) {
+            INDIGO_ASSERT(ind_soc_timer_event_unregister(
+                timer_callback, (void *)(uintptr_t)i) == 0);
         }
+        for (i = 1; i < 10000; i += 2) {
+            INDIGO_ASSERT(ind_soc_timer_event_unregister(
+                timer_callback, (void *)(uintptr_t)i) == 0);
+        }
+
+        INDIGO_ASSERT(ind_soc_timer_event_unregister(
+            timer_callback, (void *)(uintptr_t)0) == INDIGO_ERROR_NOT_FOUND);
+    }
+}
+
+static void
+test_timer_handle(void)
+{
+    ind_soc_timer_handle_t handle, handle2;
+    int count = 0, count2 = 0;
+
+    INDIGO_ASSERT(ind_soc_timer_event_register_with_handle(
+        timer_callback, &count, 50, IND_SOC_DEFAULT_PRIORITY, &handle) == 0);
+    INDIGO_ASSERT(handle != IND_SOC_TIMER_HANDLE_INVALID);
+
+    /* Re-registering returns the same handle */
+    INDIGO_ASSERT(ind_soc_timer_event_register_with_handle(
+        timer_callback, &count, 50, IND_SOC_DEFAULT_PRIORITY, &handle2) == 0);
+    INDIGO_ASSERT(handle == handle2);
+
+    /* Rearming pushes the deadline out */
+    ind_soc_select_and_run(30);
+    INDIGO_ASSERT(ind_soc_timer_event_rearm(handle, 50) == 0);
+    ind_soc_select_and_run(30);
+    INDIGO_ASSERT(count == 0);
+    ind_soc_select_and_run(40);
+    INDIGO_ASSERT(count == 1);
+
+    /* Cancel by handle, then the handle is stale */
+    INDIGO_ASSERT(ind_soc_timer_event_cancel(handle) == 0);
+    INDIGO_ASSERT(ind_soc_timer_event_cancel(handle) == INDIGO_ERROR_NOT_FOUND);
+    INDIGO_ASSERT(ind_soc_timer_event_rearm(handle, 10) == INDIGO_ERROR_NOT_FOUND);
+    INDIGO_ASSERT(ind_soc_timer_event_unregister(timer_callback, &count) < 0);
+
+    /* A reused slot does not validate the old handle */
+    INDIGO_ASSERT(ind_soc_timer_event_register_with_handle(
+        timer_callback, &count2, 1000, IND_SOC_DEFAULT_PRIORITY, &handle2) == 0);
+    INDIGO_ASSERT(handle2 != handle);
+    INDIGO_ASSERT(ind_soc_timer_event_cancel(handle) == INDIGO_ERROR_NOT_FOUND);
+    INDIGO_ASSERT(ind_soc_timer_event_cancel(handle2) == 0);
+
+    /* Immediate timers invalidate their handle after firing */
+    count = 0;
+    INDIGO_ASSERT(ind_soc_timer_event_register_with_handle(
+        timer_callback, &count, IND_SOC_TIMER_IMMEDIATE,
+        IND_SOC_DEFAULT_PRIORITY, &handle) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(count == 1);
+    INDIGO_ASSERT(ind_soc_timer_event_cancel(handle) == INDIGO_ERROR_NOT_FOUND);
+}
+
+/* Many timers with staggered periods should all fire on schedule */
+static void
+test_many_timers(void)
+{
+    static int counts[1000];
+    int i;
 
-        INDIGO_ASSERT(i == j);
-        INDIGO_ASSERT(i >= 16);
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < 1000; i++) {
+        INDIGO_ASSERT(ind_soc_timer_event_register(
+            timer_callback, &counts[i], 100 + (i % 4) * 100) == 0);
+    }
+
+    ind_soc_select_and_run(450);
+
+    for (i = 0; i < 1000; i++) {
+        int expected = 4 / (1 + i % 4);
+        INDIGO_ASSERT(counts[i] == expected);
+        INDIGO_ASSERT(ind_soc_timer_event_unregister(
+            timer_callback, &counts[i]) == 0);
     }
 }
 
@@ -440,6 +704,68 @@ task_callback_long(void *cookie)
     return IND_SOC_TASK_FINISHED;
 }
 
+/* Pooled task interleaved with embedded ones, runs twice */
+static ind_soc_task_status_t
+task_callback_embedded_pooled(void *cookie)
+{
+    int *order = cookie;
+    static int runs = 0;
+    *order = *order * 10 + 5;
+    if (++runs < 2) {
+        return IND_SOC_TASK_CONTINUE;
+    }
+    runs = 0;
+    return IND_SOC_TASK_FINISHED;
+}
+
+/* Task state with an embedded header, freed by the task itself */
+struct embedded_task {
+    ind_soc_task_t task;
+    int runs;
+    int *order;
+};
+
+static ind_soc_task_status_t
+task_callback_embedded(void *cookie)
+{
+    struct embedded_task *state = cookie;
+    *state->order = *state->order * 10 + state->runs;
+    if (--state->runs > 0) {
+        return IND_SOC_TASK_CONTINUE;
+    }
+    free(state);
+    return IND_SOC_TASK_FINISHED;
+}
+
+static void
+test_task_embedded(void)
+{
+    struct embedded_task *a = malloc(sizeof(*a));
+    struct embedded_task *b = malloc(sizeof(*b));
+    int order = 0;
+
+    INDIGO_ASSERT(ind_soc_task_start(NULL, task_callback_embedded, a, 0) ==
+                  INDIGO_ERROR_PARAM);
+
+    /* Embedded tasks keep their order while some of them finish */
+    a->runs = 1;
+    a->order = &order;
+    b->runs = 3;
+    b->order = &order;
+    INDIGO_ASSERT(ind_soc_task_start(&a->task, task_callback_embedded, a, 0) == 0);
+    INDIGO_ASSERT(ind_soc_task_register(task_callback_embedded_pooled, &order, 0) == 0);
+    INDIGO_ASSERT(ind_soc_task_start(&b->task, task_callback_embedded, b, 0) == 0);
+
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(order == 153);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(order == 15352);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(order == 153521);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(order == 153521);
+}
+
 static void
 test_task(void)
 {
@@ -504,6 +830,150 @@ test_task(void)
     INDIGO_ASSERT(counters[0] == 100);
 }
 
+#define POST_THREADS 4
+#define POSTS_PER_THREAD 10000
+
+static int posted_task_count;
+
+static ind_soc_task_status_t
+task_callback_posted(void *cookie)
+{
+    posted_task_count++;
+    return IND_SOC_TASK_FINISHED;
+}
+
+static void *
+post_thread_main(void *arg)
+{
+    int i;
+    for (i = 0; i < POSTS_PER_THREAD; i++) {
+        INDIGO_ASSERT(ind_soc_task_post(task_callback_posted, NULL, 0) == 0);
+    }
+    return NULL;
+}
+
+static void
+test_task_post(void)
+{
+    pthread_t threads[POST_THREADS];
+    indigo_time_t start_time;
+    int i;
+
+    INDIGO_ASSERT(ind_soc_task_post(NULL, NULL, 0) == INDIGO_ERROR_PARAM);
+
+    /* A task posted from the loop thread runs once the loop wakes */
+    posted_task_count = 0;
+    INDIGO_ASSERT(ind_soc_task_post(task_callback_posted, NULL, 0) == 0);
+    INDIGO_ASSERT(posted_task_count == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(posted_task_count == 1);
+
+    /* Tasks posted concurrently from other threads all run exactly once */
+    posted_task_count = 0;
+    for (i = 0; i < POST_THREADS; i++) {
+        INDIGO_ASSERT(pthread_create(&threads[i], NULL,
+                                     post_thread_main, NULL) == 0);
+    }
+
+    start_time = INDIGO_CURRENT_TIME;
+    while (posted_task_count < POST_THREADS * POSTS_PER_THREAD) {
+        INDIGO_ASSERT(INDIGO_TIME_DIFF_ms(start_time, INDIGO_CURRENT_TIME) < 10000);
+        ind_soc_select_and_run(10);
+    }
+
+    for (i = 0; i < POST_THREADS; i++) {
+        INDIGO_ASSERT(pthread_join(threads[i], NULL) == 0);
+    }
+
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(posted_task_count == POST_THREADS * POSTS_PER_THREAD);
+}
+
+struct loop_thread_state {
+    ind_soc_loop_t *loop;
+    pthread_t thread;
+    int fds[2];
+    struct sock_counters counters;
+    int timer_count;
+};
+
+static ind_soc_task_status_t
+task_callback_exit(void *cookie)
+{
+    ind_soc_run_status_set(IND_SOC_RUN_STATUS_EXIT);
+    return IND_SOC_TASK_FINISHED;
+}
+
+static void *
+loop_thread_main(void *arg)
+{
+    struct loop_thread_state *state = arg;
+
+    ind_soc_loop_current_set(state->loop);
+    INDIGO_ASSERT(ind_soc_loop_current() == state->loop);
+
+    INDIGO_ASSERT(ind_soc_socket_register(state->fds[1], socket_callback,
+                                          &state->counters) == 0);
+    INDIGO_ASSERT(ind_soc_timer_event_register(timer_callback,
+                                               &state->timer_count, 10) == 0);
+
+    /* Runs until the exit task posted by the main thread */
+    ind_soc_select_and_run(-1);
+
+    INDIGO_ASSERT(ind_soc_socket_unregister(state->fds[1]) == 0);
+    INDIGO_ASSERT(ind_soc_timer_event_unregister(timer_callback,
+                                                 &state->timer_count) == 0);
+    return NULL;
+}
+
+/* Test independent event loops running in their own threads */
+static void
+test_loops(void)
+{
+    struct loop_thread_state states[3];
+    ind_soc_config_t config = { 0 };
+    int i;
+
+    INDIGO_ASSERT(ind_soc_loop_create(NULL, NULL) == INDIGO_ERROR_PARAM);
+    INDIGO_ASSERT(ind_soc_loop_current() == ind_soc_loop_default());
+
+    memset(states, 0, sizeof(states));
+    for (i = 0; i < 3; i++) {
+        struct loop_thread_state *state = &states[i];
+        config.backend = i;
+        INDIGO_ASSERT(ind_soc_loop_create(&config, &state->loop) == 0);
+        INDIGO_ASSERT(state->loop != ind_soc_loop_default());
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, state->fds) < 0) {
+            perror("socketpair");
+            abort();
+        }
+        INDIGO_ASSERT(write(state->fds[0], "x", 1) == 1);
+        INDIGO_ASSERT(pthread_create(&state->thread, NULL,
+                                     loop_thread_main, state) == 0);
+    }
+
+    /* Let each loop service its own socket and timer */
+    usleep(100 * 1000);
+
+    /* The sockets are not registered with the default loop */
+    INDIGO_ASSERT(ind_soc_socket_unregister(states[0].fds[1]) < 0);
+    INDIGO_ASSERT(ind_soc_socket_unregister(states[1].fds[1]) < 0);
+    INDIGO_ASSERT(ind_soc_socket_unregister(states[2].fds[1]) < 0);
+
+    for (i = 0; i < 3; i++) {
+        struct loop_thread_state *state = &states[i];
+        INDIGO_ASSERT(ind_soc_loop_task_post(state->loop, task_callback_exit,
+                                             NULL, 0) == 0);
+        INDIGO_ASSERT(pthread_join(state->thread, NULL) == 0);
+        INDIGO_ASSERT(state->counters.read == 1);
+        INDIGO_ASSERT(state->timer_count > 0);
+
+        ind_soc_loop_destroy(state->loop);
+        close(state->fds[0]);
+        close(state->fds[1]);
+    }
+}
+
 static void
 test_priority(void)
 {
@@ -641,20 +1111,297 @@ test_priority(void)
     }
 }
 
-int
-main(int argc, char* argv[])
+static ind_soc_task_status_t
+task_callback_order(void *cookie)
+{
+    int *order = cookie;
+    order[0] = order[1]++;
+    return IND_SOC_TASK_FINISHED;
+}
+
+/* Test scheduling across many distinct priority levels */
+static void
+test_priority_levels(void)
+{
+    int orders[64][2];
+    int extra[2];
+    int seq[2] = { 0, 0 };
+    int i, round;
+
+    /* Tasks run strictly in priority order, one level per iteration */
+    for (i = 0; i < 10; i++) {
+        orders[i][1] = 0;
+        INDIGO_ASSERT(ind_soc_task_register(
+            task_callback_order, seq, (i * 37) % 10 - 5) == 0);
+    }
+    for (i = 0; i < 10; i++) {
+        seq[0] = -1;
+        ind_soc_select_and_run(0);
+        INDIGO_ASSERT(seq[0] == i);
+    }
+
+    /* Levels are reclaimed once unused, so many distinct priorities can be
+     * used over time */
+    for (round = 0; round < 4; round++) {
+        for (i = 0; i < 64; i++) {
+            orders[i][0] = -1;
+            orders[i][1] = 0;
+            INDIGO_ASSERT(ind_soc_task_register(
+                task_callback_order, orders[i], round * 64 + i) == 0);
+        }
+
+        /* Another distinct priority shares the nearest level, here the
+         * lowest */
+        extra[0] = -1;
+        extra[1] = 0;
+        INDIGO_ASSERT(ind_soc_task_register(
+            task_callback_order, extra, -1000) == 0);
+        INDIGO_ASSERT(ind_soc_timer_event_register_with_priority(
+            timer_callback, orders[0], 0, -1000) == 0);
+        INDIGO_ASSERT(ind_soc_timer_event_unregister(
+            timer_callback, orders[0]) == 0);
+
+        for (i = 63; i >= 0; i--) {
+            ind_soc_select_and_run(0);
+            INDIGO_ASSERT(orders[i][0] == 0);
+            INDIGO_ASSERT(extra[0] == (i == 0 ? 0 : -1));
+        }
+        ind_soc_select_and_run(0);
+    }
+}
+
+/* Sleeps past the timeslice to be counted as an overrun */
+static ind_soc_task_status_t
+task_callback_slow(void *cookie)
+{
+    usleep((SOCKETMANAGER_CONFIG_TIMESLICE_MS + 2) * 1000);
+    return IND_SOC_TASK_FINISHED;
+}
+
+static void
+test_stats(void)
 {
-    ind_soc_config_t config = {0};
+    ind_soc_stats_t *stats = malloc(sizeof(*stats));
+    struct sock_counters counters;
+    int fds[2];
+    int count = 0;
+    int i;
+
+    ind_soc_stats_clear();
+    ind_soc_stats_get(stats);
+    INDIGO_ASSERT(stats->iterations == 0);
+    INDIGO_ASSERT(stats->timeslice_overruns == 0);
+    INDIGO_ASSERT(stats->slowest_callback.callback == NULL);
+
+    /* A slow task overruns the timeslice and is the slowest callback */
+    INDIGO_ASSERT(ind_soc_task_register(task_callback_slow, NULL, 3) == 0);
+    ind_soc_select_and_run(0);
+    ind_soc_stats_get(stats);
+    INDIGO_ASSERT(stats->iterations == 1);
+    INDIGO_ASSERT(stats->timeslice_overruns == 1);
+    INDIGO_ASSERT(stats->callback_duration[IND_SOC_CALLBACK_TYPE_TASK].count == 1);
+    INDIGO_ASSERT(stats->slowest_callback.type == IND_SOC_CALLBACK_TYPE_TASK);
+    INDIGO_ASSERT(stats->slowest_callback.callback == (void *)task_callback_slow);
+    INDIGO_ASSERT(stats->slowest_callback.priority == 3);
+    INDIGO_ASSERT(stats->slowest_callback.duration_us >=
+                  SOCKETMANAGER_CONFIG_TIMESLICE_MS * 1000);
+
+    /* Socket callbacks record their queueing delay by priority */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        abort();
+    }
+    INDIGO_ASSERT(write(fds[1], "x", 1) == 1);
+    memset(&counters, 0, sizeof(counters));
+    INDIGO_ASSERT(ind_soc_socket_register_with_priority(
+        fds[0], socket_callback, &counters, 5) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counters.read == 1);
+    INDIGO_ASSERT(ind_soc_socket_unregister(fds[0]) == 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    /* Timer callbacks are counted separately */
+    INDIGO_ASSERT(ind_soc_timer_event_register(
+        timer_callback, &count, IND_SOC_TIMER_IMMEDIATE) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(count == 1);
+
+    ind_soc_stats_get(stats);
+    INDIGO_ASSERT(stats->callback_duration[IND_SOC_CALLBACK_TYPE_SOCKET].count == 1);
+    INDIGO_ASSERT(stats->callback_duration[IND_SOC_CALLBACK_TYPE_TIMER].count == 1);
+    for (i = 0; i < stats->num_priorities; i++) {
+        if (stats->priorities[i].priority == 5) {
+            break;
+        }
+        /* Sorted from highest to lowest */
+        INDIGO_ASSERT(i == 0 || stats->priorities[i].priority <
+                      stats->priorities[i - 1].priority);
+    }
+    INDIGO_ASSERT(i < stats->num_priorities);
+    INDIGO_ASSERT(stats->priorities[i].queue_delay.count == 1);
+
+    /* Clearing keeps nothing but the priority list */
+    ind_soc_stats_clear();
+    ind_soc_stats_get(stats);
+    INDIGO_ASSERT(stats->timeslice_overruns == 0);
+    INDIGO_ASSERT(stats->callback_duration[IND_SOC_CALLBACK_TYPE_TASK].count == 0);
+    for (i = 0; i < stats->num_priorities; i++) {
+        INDIGO_ASSERT(stats->priorities[i].queue_delay.count == 0);
+    }
+
+    free(stats);
+}
+
+static void
+test_histogram_percentile(void)
+{
+    ind_soc_histogram_t hist;
+    int i;
+
+    memset(&hist, 0, sizeof(hist));
+    INDIGO_ASSERT(ind_soc_histogram_percentile(&hist, 50) == 0);
+
+    /* 90 samples of 3 us, 10 of 100 us */
+    for (i = 0; i < 90; i++) {
+        ind_soc_histogram_add(&hist, 3);
+    }
+    for (i = 0; i < 10; i++) {
+        ind_soc_histogram_add(&hist, 100);
+    }
+
+    INDIGO_ASSERT(ind_soc_histogram_percentile(&hist, 0) == 3);
+    INDIGO_ASSERT(ind_soc_histogram_percentile(&hist, 50) == 3);
+    INDIGO_ASSERT(ind_soc_histogram_percentile(&hist, 90) == 3);
+    INDIGO_ASSERT(ind_soc_histogram_percentile(&hist, 99) == 100);
+    INDIGO_ASSERT(ind_soc_histogram_percentile(&hist, 100) == 100);
+
+    /* The last bucket reports the maximum */
+    ind_soc_histogram_add(&hist, (uint64_t)1 << 40);
+    INDIGO_ASSERT(ind_soc_histogram_percentile(&hist, 100) == (uint64_t)1 << 40);
+}
+
+/* Pass end callbacks see the work done earlier in the same pass */
+struct pass_end_state {
+    int timer_count;
+    int seen_count;
+    int pass_count;
+};
+
+static void
+pass_end_timer_callback(void *cookie)
+{
+    struct pass_end_state *state = cookie;
+    state->timer_count++;
+}
+
+static void
+pass_end_callback(void *cookie)
+{
+    struct pass_end_state *state = cookie;
+    state->pass_count++;
+    state->seen_count = state->timer_count;
+}
+
+static void
+pass_end_callback_unregister(void *cookie)
+{
+    int *count_ptr = cookie;
+    (*count_ptr)++;
+    INDIGO_ASSERT(ind_soc_pass_end_unregister(
+        pass_end_callback_unregister, cookie) == 0);
+}
 
-    printf("Init returned %d\n", ind_soc_init(&config));
+static void
+test_pass_end(void)
+{
+    struct pass_end_state state = { 0 };
+    int counts[IND_SOC_PASS_END_CALLBACKS_MAX + 1] = { 0 };
+    int i;
 
-    test_timer_mgmt();
-    test_periodic_timer();
-    test_immediate_timer();
-    test_socket();
-    test_socket_mgmt();
-    test_task();
-    test_priority();
+    INDIGO_ASSERT(ind_soc_pass_end_register(NULL, NULL) == INDIGO_ERROR_PARAM);
+    INDIGO_ASSERT(ind_soc_pass_end_unregister(
+        pass_end_callback, &state) == INDIGO_ERROR_NOT_FOUND);
+
+    /* Registering twice runs the callback once per pass */
+    INDIGO_ASSERT(ind_soc_pass_end_register(pass_end_callback, &state) == 0);
+    INDIGO_ASSERT(ind_soc_pass_end_register(pass_end_callback, &state) == 0);
+    INDIGO_ASSERT(ind_soc_timer_event_register(
+        pass_end_timer_callback, &state, IND_SOC_TIMER_IMMEDIATE) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(state.timer_count == 1);
+    INDIGO_ASSERT(state.seen_count == 1);
+    INDIGO_ASSERT(state.pass_count == 1);
+
+    /* Runs after every timed pass */
+    INDIGO_ASSERT(ind_soc_timer_event_register(
+        pass_end_timer_callback, &state, 10) == 0);
+    ind_soc_select_and_run(100);
+    INDIGO_ASSERT(state.timer_count >= 9);
+    INDIGO_ASSERT(state.seen_count == state.timer_count);
+    INDIGO_ASSERT(state.pass_count >= state.timer_count);
+    INDIGO_ASSERT(ind_soc_timer_event_unregister(
+        pass_end_timer_callback, &state) == 0);
+
+    INDIGO_ASSERT(ind_soc_pass_end_unregister(pass_end_callback, &state) == 0);
+    state.pass_count = 0;
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(state.pass_count == 0);
+
+    /* A callback may unregister itself, freeing its slot */
+    for (i = 0; i < IND_SOC_PASS_END_CALLBACKS_MAX; i++) {
+        INDIGO_ASSERT(ind_soc_pass_end_register(
+            pass_end_callback_unregister, &counts[i]) == 0);
+    }
+    INDIGO_ASSERT(ind_soc_pass_end_register(
+        pass_end_callback_unregister,
+        &counts[IND_SOC_PASS_END_CALLBACKS_MAX]) == INDIGO_ERROR_RESOURCE);
+    ind_soc_select_and_run(0);
+    ind_soc_select_and_run(0);
+    for (i = 0; i < IND_SOC_PASS_END_CALLBACKS_MAX; i++) {
+        INDIGO_ASSERT(counts[i] == 1);
+    }
+    INDIGO_ASSERT(ind_soc_pass_end_register(
+        pass_end_callback_unregister,
+        &counts[IND_SOC_PASS_END_CALLBACKS_MAX]) == 0);
+    ind_soc_select_and_run(0);
+    INDIGO_ASSERT(counts[IND_SOC_PASS_END_CALLBACKS_MAX] == 1);
+}
+
+int
+main(int argc, char* argv[])
+{
+    ind_soc_backend_t backend;
+
+    for (backend = 0; backend < IND_SOC_BACKEND_COUNT; backend++) {
+        ind_soc_config_t config = {0};
+        config.backend = backend;
+
+        printf("Testing backend %d\n", backend);
+        INDIGO_ASSERT(ind_soc_init(&config) == INDIGO_ERROR_NONE);
+
+        test_timer_mgmt();
+        test_timer_handle();
+        test_many_timers();
+        test_timer_us();
+        test_periodic_timer();
+        test_immediate_timer();
+        test_socket();
+        test_socket_mgmt();
+        test_socket_rearm();
+        test_many_sockets();
+        test_task();
+        test_task_embedded();
+        test_task_post();
+        test_pass_end();
+        test_loops();
+        test_stats();
+        test_histogram_percentile();
+        test_priority();
+        test_priority_levels();
+
+        INDIGO_ASSERT(ind_soc_finish() == INDIGO_ERROR_NONE);
+    }
 
     return 0;
 }
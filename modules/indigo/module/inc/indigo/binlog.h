@@ -0,0 +1,130 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/**
+ * @file
+ * @brief Deferred binary logging for hot paths
+ *
+ * INDIGO_BINLOG(fmt, ...) declares a static log site. Sites are
+ * collected in the indigo_binlog_sites section, which gives each one a
+ * fixed ID, and each has its own enable flag. A disabled site costs one
+ * predicted branch: its arguments are not evaluated. An enabled site
+ * stores its ID, a timestamp and up to INDIGO_BINLOG_ARGS_MAX raw
+ * arguments in a lock-free ring; the format string is only applied
+ * when the ring is read back with indigo_binlog_show.
+ *
+ * Arguments must be integers or pointers. A %s argument is formatted
+ * when the ring is read, so it must point at a string that is never
+ * freed or changed, such as an entry of of_object_id_str.
+ *
+ * Defining INDIGO_BINLOG_DISABLE compiles the sites out entirely.
+ */
+
+#ifndef _INDIGO_BINLOG_H_
+#define _INDIGO_BINLOG_H_
+
+#include <stdint.h>
+
+#define INDIGO_BINLOG_ARGS_MAX 6
+
+typedef struct indigo_binlog_site_s {
+    const char *fmt;
+    const char *file;
+    uint16_t line;
+    uint8_t nargs;
+    volatile uint8_t enabled;
+} indigo_binlog_site_t;
+
+/* Record an enabled site; use INDIGO_BINLOG */
+void indigo_binlog_write(const indigo_binlog_site_t *site,
+                         const uint64_t *args);
+
+#define INDIGO_BINLOG_ARG_(x) ((uint64_t)(uintptr_t)(x))
+
+#define INDIGO_BINLOG_NARGS_(...) \
+    INDIGO_BINLOG_NARGS__(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define INDIGO_BINLOG_NARGS__(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+
+#define INDIGO_BINLOG_MAP0_()
+#define INDIGO_BINLOG_MAP1_(a) INDIGO_BINLOG_ARG_(a)
+#define INDIGO_BINLOG_MAP2_(a, ...) INDIGO_BINLOG_ARG_(a), INDIGO_BINLOG_MAP1_(__VA_ARGS__)
+#define INDIGO_BINLOG_MAP3_(a, ...) INDIGO_BINLOG_ARG_(a), INDIGO_BINLOG_MAP2_(__VA_ARGS__)
+#define INDIGO_BINLOG_MAP4_(a, ...) INDIGO_BINLOG_ARG_(a), INDIGO_BINLOG_MAP3_(__VA_ARGS__)
+#define INDIGO_BINLOG_MAP5_(a, ...) INDIGO_BINLOG_ARG_(a), INDIGO_BINLOG_MAP4_(__VA_ARGS__)
+#define INDIGO_BINLOG_MAP6_(a, ...) INDIGO_BINLOG_ARG_(a), INDIGO_BINLOG_MAP5_(__VA_ARGS__)
+#define INDIGO_BINLOG_MAP_(n, ...) INDIGO_BINLOG_MAP__(n, ##__VA_ARGS__)
+#define INDIGO_BINLOG_MAP__(n, ...) INDIGO_BINLOG_MAP##n##_(__VA_ARGS__)
+
+#if defined(INDIGO_BINLOG_DISABLE)
+
+#define INDIGO_BINLOG(fmt, ...) do { } while (0)
+
+#else
+
+#define INDIGO_BINLOG(fmt, ...)                                         \
+    do {                                                                \
+        static indigo_binlog_site_t _binlog_site                        \
+            __attribute__((section("indigo_binlog_sites"), used,        \
+                           aligned(sizeof(void *)))) = {                \
+            fmt, __FILE__, __LINE__,                                    \
+            INDIGO_BINLOG_NARGS_(__VA_ARGS__), 0 };                     \
+        if (__builtin_expect(_binlog_site.enabled, 0)) {                \
+            const uint64_t _binlog_args[INDIGO_BINLOG_ARGS_MAX + 1] = { \
+                INDIGO_BINLOG_MAP_(INDIGO_BINLOG_NARGS_(__VA_ARGS__),   \
+                                   ##__VA_ARGS__) };                    \
+            indigo_binlog_write(&_binlog_site, _binlog_args);           \
+        }                                                               \
+    } while (0)
+
+#endif /* INDIGO_BINLOG_DISABLE */
+
+/**
+ * Size the record ring
+ * @param records Number of records kept, or 0 to free the ring
+ *
+ * Discards the current records. Sites keep their enable flags; records
+ * from enabled sites are dropped while there is no ring. Not safe while
+ * enabled sites run on other threads.
+ *
+ * Enabling a site allocates a default sized ring if there is none.
+ */
+int indigo_binlog_ring_size_set(int records);
+
+/**
+ * Enable or disable log sites
+ * @param match "all", a site ID, or a substring of the source file name
+ * @param enable 1 to enable
+ * @returns The number of sites changed
+ */
+int indigo_binlog_enable_set(const char *match, int enable);
+
+struct aim_pvs_s;
+
+/**
+ * Format the newest records, oldest first
+ * @param max Number of records to show, or 0 for all held
+ */
+void indigo_binlog_show(struct aim_pvs_s *pvs, int max);
+
+/**
+ * List the log sites with their IDs and enable flags
+ */
+void indigo_binlog_sites_show(struct aim_pvs_s *pvs);
+
+#endif /* _INDIGO_BINLOG_H_ */
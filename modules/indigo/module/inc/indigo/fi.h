@@ -38,7 +38,8 @@
  * @brief Flow removed reasons.
  *
  * See indigo_core_flow_removed.   In addition to the OF flow removed
- * reasons, we add overwrite, resource and unknown.
+ * reasons, we add overwrite, resource and unknown. Eviction is reported
+ * as a delete to controllers older than OpenFlow 1.4.
  */
 
 typedef enum indigo_fi_flow_removed_e {
@@ -49,7 +50,8 @@ typedef enum indigo_fi_flow_removed_e {
     INDIGO_FLOW_REMOVED_GROUP_DELETE = OF_FLOW_REMOVED_REASON_GROUP_DELETE,
     INDIGO_FLOW_REMOVED_OVERWRITE    = 4,
     INDIGO_FLOW_REMOVED_RESOURCE     = 5,
-    INDIGO_FLOW_REMOVED_UNKNOWN      = 6
+    INDIGO_FLOW_REMOVED_UNKNOWN      = 6,
+    INDIGO_FLOW_REMOVED_EVICTION     = 7
 } indigo_fi_flow_removed_t;
 
 /**
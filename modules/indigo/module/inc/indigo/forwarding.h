@@ -58,12 +58,17 @@ extern indigo_error_t indigo_fwd_forwarding_features_get(
 /**
  * @brief Flow create
  * @param of_flow_add The original LOCI request
- * @param [out] table_id Table inserted into
+ * @param [out] table_id Table inserted into; preset to the table the
+ * request names
  *
  * Create a flow for the forwarding engine.
  *
  * Ownership of the flow_add LOXI object is maintained by the
  * caller (OF state manager).
+ *
+ * May return INDIGO_ERROR_PENDING and complete later with
+ * indigo_core_flow_create_done; likewise for modify, delete and the
+ * group add and modify calls.
  */
 
 extern indigo_error_t indigo_fwd_flow_create(
@@ -100,6 +105,105 @@ extern indigo_error_t indigo_fwd_flow_delete(
     indigo_cookie_t flow_id,
     indigo_fi_flow_stats_t *flow_stats);
 
+/**
+ * Batched flow programming
+ *
+ * Optional. Forwarding modules that can write many flows to hardware in
+ * one transaction implement these. The default indigo_fwd_flow_batch_begin
+ * returns INDIGO_ERROR_NOT_SUPPORTED, and the state manager then programs
+ * each flow with the calls above.
+ *
+ * The state manager calls begin, any number of create and modify calls,
+ * and then commit. Other forwarding calls are not made while a batch is
+ * open. The LOXI objects passed in stay valid until commit returns.
+ */
+
+/**
+ * @brief Result of one batched operation
+ * @param status Error code for the operation
+ * @param table_id For creates, the table inserted into; preset to the
+ * table the request names
+ */
+
+typedef struct indigo_fwd_flow_batch_result_s {
+    indigo_error_t status;
+    uint8_t table_id;
+} indigo_fwd_flow_batch_result_t;
+
+/**
+ * @brief Open a flow batch
+ * @returns INDIGO_ERROR_NOT_SUPPORTED if batching is not implemented
+ */
+
+extern indigo_error_t indigo_fwd_flow_batch_begin(void);
+
+/**
+ * @brief Queue a flow create in the open batch
+ * @param flow_id Flow identifier
+ * @param flow_add The original LOCI request
+ *
+ * An error return means the operation was not queued and has failed.
+ */
+
+extern indigo_error_t indigo_fwd_flow_batch_create(
+    indigo_cookie_t flow_id,
+    of_flow_add_t *flow_add);
+
+/**
+ * @brief Queue a flow modify in the open batch
+ * @param flow_id Flow identifier
+ * @param flow_modify The original LOCI message indicating the modification
+ *
+ * An error return means the operation was not queued and has failed.
+ */
+
+extern indigo_error_t indigo_fwd_flow_batch_modify(
+    indigo_cookie_t flow_id,
+    of_flow_modify_t *flow_modify);
+
+/**
+ * @brief Program the queued operations and close the batch
+ * @param [out] results One result per queued operation, in queue order
+ * @param num_results Number of operations queued
+ */
+
+extern void indigo_fwd_flow_batch_commit(
+    indigo_fwd_flow_batch_result_t *results,
+    int num_results);
+
+/**
+ * Flows restored from a checkpoint
+ *
+ * Optional. After a restart, indigo_core_flow_checkpoint_restore adds
+ * the checkpointed flows back to the state manager under their old flow
+ * IDs, passes each to indigo_fwd_flow_restore and then calls
+ * indigo_fwd_flow_restore_end. Forwarding that kept its hardware state
+ * across the restart can adopt each flow by ID without reprogramming it,
+ * and at the end remove any flows it holds that were not restored. The
+ * default indigo_fwd_flow_restore calls indigo_fwd_flow_create and the
+ * default indigo_fwd_flow_restore_end does nothing.
+ */
+
+/**
+ * @brief Adopt or program a restored flow
+ * @param flow_id Flow identifier, as used before the restart
+ * @param flow_add An add equivalent to the flow's current state
+ * @param [out] table_id Table the flow is in
+ *
+ * May return INDIGO_ERROR_PENDING as for indigo_fwd_flow_create.
+ */
+
+extern indigo_error_t indigo_fwd_flow_restore(
+    indigo_cookie_t flow_id,
+    of_flow_add_t *flow_add,
+    uint8_t *table_id);
+
+/**
+ * @brief Every restored flow has been passed to indigo_fwd_flow_restore
+ */
+
+extern void indigo_fwd_flow_restore_end(void);
+
 /**
  * @brief Flow stats
  * @param flow_id The ID of the flow whose stats are to be retrieved
@@ -113,6 +217,24 @@ extern indigo_error_t indigo_fwd_flow_stats_get(
     indigo_cookie_t flow_id,
     indigo_fi_flow_stats_t *flow_stats);
 
+/**
+ * @brief Stats of many flows
+ * @param flow_ids The IDs of the flows whose stats are to be retrieved
+ * @param num_flows Number of flow IDs
+ * @param [out] flow_stats Statistics for each flow, as for
+ * indigo_fwd_flow_stats_get
+ * @param [out] results Error code for each flow
+ *
+ * Optional. The default calls indigo_fwd_flow_stats_get for each flow.
+ * Implementations may read all the counters in one hardware access.
+ */
+
+extern void indigo_fwd_flow_stats_bulk_get(
+    indigo_cookie_t *flow_ids,
+    int num_flows,
+    indigo_fi_flow_stats_t *flow_stats,
+    indigo_error_t *results);
+
 /**
  * @brief Flow hit status
  * @param flow_id The ID of the flow whose hit status is to be retrieved
@@ -125,6 +247,28 @@ extern indigo_error_t indigo_fwd_flow_hit_status_get(
     indigo_cookie_t flow_id,
     bool *hit_status);
 
+/**
+ * @brief Hit status of many flows
+ * @param flow_ids The IDs of the flows whose hit status is to be retrieved
+ * @param num_flows Number of flow IDs
+ * @param [out] hit_bitmap Bit (i % 8) of byte (i / 8) is set if flow_ids[i]
+ * was hit since last time its status was read; cleared by the caller
+ * @param [out] unread_bitmap Bit set in the same way if the status of
+ * flow_ids[i] could not be read; cleared by the caller
+ *
+ * Optional. The default calls indigo_fwd_flow_hit_status_get for each
+ * flow. Implementations may read all the hit bits in one hardware access.
+ *
+ * Flows marked unread are neither refreshed nor expired, and are read
+ * again on the next expiration tick.
+ */
+
+extern indigo_error_t indigo_fwd_flow_hit_status_bulk_get(
+    indigo_cookie_t *flow_ids,
+    int num_flows,
+    uint8_t *hit_bitmap,
+    uint8_t *unread_bitmap);
+
 /**
  * @brief Table stats
  * @param table_stats_request The LOXI request
@@ -154,6 +298,28 @@ void indigo_fwd_vlan_stats_get(
     uint16_t vlan_vid,
     indigo_fi_vlan_stats_t *vlan_stats);
 
+/**
+ * @brief Stats for the configured VLANs
+ * @param start_vid Lowest VLAN ID to report
+ * @param [out] vlan_vids IDs of the VLANs reported, ascending
+ * @param [out] vlan_stats Statistics for each VLAN in vlan_vids
+ * @param max Number of entries in vlan_vids and vlan_stats
+ * @return Number of VLANs reported; less than max once the last VLAN
+ * has been reported
+ *
+ * Optional. The default reports every VLAN ID using
+ * indigo_fwd_vlan_stats_get. Implementations should skip VLANs that are
+ * not configured and may read the counters in one hardware access.
+ *
+ * The counters default to -1 as for indigo_fwd_vlan_stats_get.
+ */
+
+int indigo_fwd_vlan_stats_bulk_get(
+    uint16_t start_vid,
+    uint16_t *vlan_vids,
+    indigo_fi_vlan_stats_t *vlan_stats,
+    int max);
+
 /**
  * @brief Packet out operation
  * @param packet_out The LOXI packet out message
@@ -165,6 +331,24 @@ void indigo_fwd_vlan_stats_get(
 extern indigo_error_t indigo_fwd_packet_out(
     of_packet_out_t *packet_out);
 
+/**
+ * @brief Transmit a run of packet outs
+ * @param packet_outs The LOXI packet out messages, in arrival order
+ * @param num_packet_outs Number of messages
+ *
+ * Optional. The default calls indigo_fwd_packet_out for each message.
+ * Consecutive packet outs from the controller are collected and passed
+ * here together so they can be transmitted in one shot. The messages
+ * are parsed in place, so their data still points into the connection's
+ * receive buffer.
+ *
+ * Ownership of the messages is maintained by the caller (OF state
+ * manager) and they are only valid for the duration of the call.
+ */
+
+void indigo_fwd_packet_out_batch(of_packet_out_t **packet_outs,
+                                 int num_packet_outs);
+
 /**
  * @brief Experimenter (vendor) extension
  * @param experimenter The message from the controller
@@ -225,6 +409,19 @@ void indigo_fwd_group_delete(uint32_t id);
  */
 void indigo_fwd_group_stats_get(uint32_t id, of_group_stats_entry_t *entry);
 
+/**
+ * @brief Retrieve stats for many groups
+ * @param ids Group IDs
+ * @param num_groups Number of group IDs
+ * @param entries One LOCI of_group_stats_entry_t per group, to be filled in
+ * as for indigo_fwd_group_stats_get
+ *
+ * Optional. The default calls indigo_fwd_group_stats_get for each group.
+ * Implementations may read all the counters in one hardware access.
+ */
+void indigo_fwd_group_stats_bulk_get(uint32_t *ids, int num_groups,
+                                     of_group_stats_entry_t **entries);
+
 /**
  * Switch pipeline management
  *
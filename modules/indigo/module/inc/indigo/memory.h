@@ -45,4 +45,139 @@
 
 #endif /* INDIGO_MEM_STDLIB */
 
+/*
+ * Tagged allocations
+ *
+ * Hot, long lived or high churn objects are allocated with
+ * indigo_mem_tag_alloc and returned with indigo_mem_tag_free, giving
+ * the size again. The allocator keeps live bytes and allocation counts
+ * per tag, and blocks up to INDIGO_MEM_POOL_MAX_BYTES are recycled
+ * through per size class free lists. Larger blocks, and pool refills,
+ * come from a backend that defaults to malloc/free and can be replaced
+ * with indigo_mem_backend_set.
+ *
+ * Tagged blocks must only be freed with indigo_mem_tag_free. Memory the
+ * caller obtains some other way can still be accounted to a tag with
+ * indigo_mem_tag_note_alloc/indigo_mem_tag_note_free.
+ *
+ * The untagged INDIGO_MEM_ALLOC/INDIGO_MEM_FREE vectors are unchanged;
+ * their buffers are shared with loci and libc code that frees them
+ * directly.
+ *
+ * A tag can instead be served from its own arena of 2 MB huge pages, see
+ * indigo_mem_tag_huge_pages_set, so that walking many of its objects
+ * takes few TLB entries.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <indigo/error.h>
+
+/* TAG(name, description) */
+#define INDIGO_MEM_TAGS \
+    TAG(FLOW_ENTRY, "flow_entry") \
+    TAG(GENTABLE_ENTRY, "gentable_entry") \
+    TAG(CXN_BUFFER, "cxn_buffer") \
+    TAG(TASK, "task")
+
+typedef enum indigo_mem_tag_e {
+#define TAG(name, description) INDIGO_MEM_TAG_##name,
+    INDIGO_MEM_TAGS
+#undef TAG
+    INDIGO_MEM_TAG_COUNT
+} indigo_mem_tag_t;
+
+/* Largest block served from the size class pools */
+#define INDIGO_MEM_POOL_MAX_BYTES 4096
+
+/* Per tag counters */
+typedef struct indigo_mem_tag_stats_s {
+    uint64_t live_bytes;
+    uint64_t live_objects;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;
+} indigo_mem_tag_stats_t;
+
+/**
+ * Allocator backend
+ *
+ * free is passed the size given to alloc.
+ */
+typedef struct indigo_mem_backend_s {
+    void *(*alloc)(size_t bytes, void *cookie);
+    void (*free)(void *ptr, size_t bytes, void *cookie);
+    void *cookie;
+} indigo_mem_backend_t;
+
+/**
+ * Replace the allocator backend
+ * @param backend The new backend, or NULL for malloc/free
+ *
+ * Pooled blocks are returned to the old backend first. Must not be
+ * called while tagged blocks from the old backend are live.
+ */
+void indigo_mem_backend_set(const indigo_mem_backend_t *backend);
+
+/**
+ * Allocate a tagged block
+ * @param tag Accounting tag
+ * @param bytes Size in bytes
+ * @returns The uninitialized block, or NULL
+ */
+void *indigo_mem_tag_alloc(indigo_mem_tag_t tag, size_t bytes);
+
+/**
+ * Free a tagged block
+ * @param tag Tag given to indigo_mem_tag_alloc
+ * @param ptr The block; NULL is ignored
+ * @param bytes Size given to indigo_mem_tag_alloc
+ */
+void indigo_mem_tag_free(indigo_mem_tag_t tag, void *ptr, size_t bytes);
+
+/**
+ * Serve a tag from a huge page arena
+ * @param tag The tag
+ * @param numa_node Node to prefer for the arena's memory, or -1 to leave
+ * placement to the kernel (the node of the thread touching it first)
+ *
+ * Arena memory is mapped in 2 MB chunks with MAP_HUGETLB, or aligned and
+ * advised for transparent huge pages if no huge pages are reserved.
+ * Blocks are carved from the chunks and recycled per size; chunks are
+ * kept for the life of the process, and blocks larger than
+ * INDIGO_MEM_ARENA_MAX_BYTES get a mapping of their own. Setting a tag
+ * again is a no-op.
+ *
+ * Returns INDIGO_ERROR_EXISTS if the tag already has live blocks.
+ */
+#define INDIGO_MEM_ARENA_MAX_BYTES (512 * 1024)
+
+indigo_error_t indigo_mem_tag_huge_pages_set(indigo_mem_tag_t tag,
+                                             int numa_node);
+
+/**
+ * Account memory allocated outside indigo_mem_tag_alloc
+ */
+void indigo_mem_tag_note_alloc(indigo_mem_tag_t tag, size_t bytes);
+void indigo_mem_tag_note_free(indigo_mem_tag_t tag, size_t bytes);
+
+/**
+ * Read a tag's counters
+ */
+void indigo_mem_tag_stats_get(indigo_mem_tag_t tag,
+                              indigo_mem_tag_stats_t *stats);
+
+/**
+ * Return a tag's name
+ */
+const char *indigo_mem_tag_name(indigo_mem_tag_t tag);
+
+struct aim_pvs_s;
+
+/**
+ * Show per tag usage and the allocation and free rates since the
+ * previous call, followed by size class pool and arena usage
+ */
+void indigo_mem_stats_show(struct aim_pvs_s *pvs);
+
 #endif /* _INDIGO_MEMORY_H_ */
@@ -76,11 +76,15 @@
  *
  * INDIGO_CXN_PROTO_INVALID A marker used to indicate an undefined protocol
  * INDIGO_CXN_PROTO_TCP_OVER_IPV4 Use TCP over IPv4 for the connection
+ * INDIGO_CXN_PROTO_SHM_OVER_UNIX Listen on a Unix socket and exchange
+ *   messages with each client through shared memory; see
+ *   OFConnectionManager/ofconnectionmanager_shm.h
  */
 
 typedef enum indigo_cxn_protocol_e {
     INDIGO_CXN_PROTO_INVALID            = -1,
-    INDIGO_CXN_PROTO_TCP_OVER_IPV4      = 0
+    INDIGO_CXN_PROTO_TCP_OVER_IPV4      = 0,
+    INDIGO_CXN_PROTO_SHM_OVER_UNIX      = 1
 } indigo_cxn_protocol_t;
 
 /**
@@ -109,6 +113,16 @@ typedef struct indigo_cxn_params_tcp_over_ipv4_s {
     uint16_t controller_port;
 } indigo_cxn_params_tcp_over_ipv4_t;
 
+/**
+ * Shared memory over Unix socket parameters
+ *     path Filesystem path of the listening socket
+ */
+#define INDIGO_CXN_UNIX_PATH_LEN 108
+typedef struct indigo_cxn_params_shm_over_unix_s {
+    indigo_cxn_protocol_t protocol;
+    char path[INDIGO_CXN_UNIX_PATH_LEN];
+} indigo_cxn_params_shm_over_unix_t;
+
 /**
  * The super class for connection parameters
  */
@@ -116,6 +130,7 @@ typedef struct indigo_cxn_params_tcp_over_ipv4_s {
 typedef union indigo_cxn_protocol_params_u {
     indigo_cxn_params_header_t header;
     indigo_cxn_params_tcp_over_ipv4_t tcp_over_ipv4;
+    indigo_cxn_params_shm_over_unix_t shm_over_unix;
 } indigo_cxn_protocol_params_t;
 
 /**
@@ -131,6 +146,8 @@ typedef union indigo_cxn_protocol_params_u {
  * set to 0 to disable.
  * @param reset_echo_count For non-local connections, if this number of
  * consecutive echo replies is not received, the connection is closed.
+ * @param num_aux Number of OpenFlow 1.3 auxiliary connections to open to
+ * the same controller once the main connection's handshake completes.
  *
  * For listen connections, the parameters of the original connection
  * instance are copied to the new connections.
@@ -153,8 +170,27 @@ typedef union indigo_cxn_protocol_params_u {
  * Remote connections are usually active connect (non-listen) controller
  * connections that require a handshake to continue processing.  Echo
  * requests may be done on these connections as a keepalive.
+ *
+ * The socket options apply to the connection's sockets, including its
+ * auxiliary connections and those accepted on a listening socket.
  */
 
+/**
+ * Socket options for a connection
+ *
+ * Zero leaves an option alone: TCP_NODELAY set, the system's buffer
+ * sizes, no TCP_NOTSENT_LOWAT or SO_BUSY_POLL, and DSCP 0.
+ */
+
+typedef struct indigo_cxn_socket_params_s {
+    int nagle;                  /* Nonzero leaves TCP_NODELAY clear */
+    int sndbuf;                 /* SO_SNDBUF, bytes */
+    int rcvbuf;                 /* SO_RCVBUF, bytes */
+    int notsent_lowat;          /* TCP_NOTSENT_LOWAT, bytes */
+    int busy_poll_us;           /* SO_BUSY_POLL, microseconds */
+    int dscp;                   /* DSCP marking, 0 to 63 */
+} indigo_cxn_socket_params_t;
+
 typedef struct indigo_cxn_config_params_s {
     of_version_t version;
     int cxn_priority;
@@ -162,6 +198,8 @@ typedef struct indigo_cxn_config_params_s {
     int listen;
     uint32_t periodic_echo_ms;
     uint32_t reset_echo_count;
+    int num_aux;
+    indigo_cxn_socket_params_t socket;
 } indigo_cxn_config_params_t;
 
 /****************************************************************
@@ -212,6 +250,10 @@ typedef enum indigo_cxn_role_e {
  *    bytes_out Number of bytes written in since last connect
  *    messages_in Number of messages received since last connect
  *    messages_out Number of messages sent to controller since last connect
+ *    packet_in_drop Packet-ins dropped because the output queue was full
+ *    flow_removed_drop Flow-removeds dropped because the output queue was full
+ *    packet_in_meter_drop Packet-ins dropped by the packet-in rate limits
+ *    flow_removed_meter_drop Flow-removeds dropped by the rate limit
  */
 
 typedef struct indigo_cxn_status_s {
@@ -227,6 +269,8 @@ typedef struct indigo_cxn_status_s {
     uint64_t messages_out;
     uint64_t packet_in_drop;
     uint64_t flow_removed_drop;
+    uint64_t packet_in_meter_drop;
+    uint64_t flow_removed_meter_drop;
 } indigo_cxn_status_t;
 
 /****************************************************************
@@ -352,6 +396,115 @@ extern void indigo_cxn_send_controller_message(
 
 extern void indigo_cxn_send_async_message(of_object_t *obj);
 
+/**
+ * Send a run of async OpenFlow messages to multiple controller connections
+ *
+ * @param objs The LOCI objects representing the messages
+ * @param num_objs Number of messages
+ *
+ * Each message is filtered and rate limited as if sent with
+ * indigo_cxn_send_async_message. The messages a connection accepts are
+ * written back to back from one buffer, and count as one queued message
+ * against its async queue limits.
+ *
+ * Connection Manager takes responsibility for the objects, not the array.
+ */
+
+extern void indigo_cxn_send_async_messages(of_object_t **objs, int num_objs);
+
+/**
+ * Bytes reserved in front of a pooled packet-in frame for the header
+ */
+
+#define INDIGO_CXN_PACKET_IN_HEADROOM 256
+
+/**
+ * Largest frame a pooled packet-in buffer can hold
+ */
+
+#define INDIGO_CXN_PACKET_IN_FRAME_MAX 1792
+
+/**
+ * Allocate a pooled packet-in frame buffer
+ *
+ * @returns Space for up to INDIGO_CXN_PACKET_IN_FRAME_MAX bytes of frame,
+ * or NULL if the pool is exhausted
+ *
+ * Provided by connection manager, required by forwarding
+ *
+ * The datapath writes the punted frame here and passes it to
+ * indigo_cxn_packet_in_build, which places the packet-in header in the
+ * headroom in front of it. The buffer is returned to the pool once
+ * every connection has written the message, so the frame is neither
+ * copied nor separately allocated. A frame that will not be sent is
+ * released with indigo_cxn_packet_in_frame_free.
+ */
+
+extern uint8_t *indigo_cxn_packet_in_frame_alloc(void);
+
+/**
+ * Release a pooled packet-in frame buffer without sending it
+ */
+
+extern void indigo_cxn_packet_in_frame_free(uint8_t *frame);
+
+/**
+ * Build a packet-in around a pooled frame
+ *
+ * @param header A packet-in with every field but the data set
+ * @param frame A frame from indigo_cxn_packet_in_frame_alloc
+ * @param frame_len Length of the frame
+ * @returns The packet-in, or NULL on error
+ *
+ * The header is copied and stays with the caller, so one header object
+ * can be reused for a stream of packet-ins. The frame belongs to the
+ * returned object, or is released on error. The object is sent with
+ * indigo_core_packet_in or indigo_cxn_send_async_message as usual; its
+ * buffer must not be grown.
+ */
+
+extern of_packet_in_t *indigo_cxn_packet_in_build(of_packet_in_t *header,
+                                                  uint8_t *frame,
+                                                  int frame_len);
+
+/**
+ * Check whether a connection's output queue is backed up
+ *
+ * @param cxn_id The connection
+ * @returns true if the queue is above its high watermark
+ *
+ * Provided by connection manager, required by state manager
+ *
+ * Tasks producing a long series of replies (such as flow stats) should
+ * stop and wait with indigo_cxn_output_wait while this is true, rather
+ * than filling the queue until the connection is dropped.
+ */
+
+extern int indigo_cxn_output_blocked(indigo_cxn_id_t cxn_id);
+
+/**
+ * Callback for indigo_cxn_output_wait
+ */
+
+typedef void (*indigo_cxn_output_ready_f)(void *cookie);
+
+/**
+ * Wait for a connection's output queue to drain
+ *
+ * @param cxn_id The connection
+ * @param callback Called once the queue is below its low watermark
+ * @param cookie Opaque value passed to callback
+ * @returns INDIGO_ERROR_NOT_FOUND if the connection is not blocked
+ *
+ * The callback is also made if the connection closes while blocked,
+ * so a waiter always gets to finish and clean up.
+ */
+
+extern indigo_error_t indigo_cxn_output_wait(
+    indigo_cxn_id_t cxn_id,
+    indigo_cxn_output_ready_f callback,
+    void *cookie);
+
 /**
  * Send an error message to a controller connection
  *
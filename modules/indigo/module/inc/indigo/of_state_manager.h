@@ -74,6 +74,23 @@ typedef enum indigo_core_disconnected_e {
 
 extern indigo_error_t indigo_core_packet_in(of_packet_in_t *packet_in);
 
+/**
+ * Handle a burst of packet ins from the forwarding module
+ * @param packet_ins Array of packet in objects
+ * @param num_packet_ins Number of packet ins
+ *
+ * Each packet in is passed to the listeners as by indigo_core_packet_in,
+ * and the ones not dropped are sent to the controllers with one call to
+ * indigo_cxn_send_async_messages per INDIGO_CORE_PACKET_IN_BATCH_MAX.
+ *
+ * The state manager takes responsibility for the objects, not the array
+ */
+
+#define INDIGO_CORE_PACKET_IN_BATCH_MAX 64
+
+extern indigo_error_t indigo_core_packet_in_batch(of_packet_in_t **packet_ins,
+                                                  int num_packet_ins);
+
 
 /****************************************************************
  * Controller message handling by the state manager
@@ -94,6 +111,52 @@ extern void indigo_core_receive_controller_message(
     indigo_cxn_id_t cxn,
     of_object_t *obj);
 
+/**
+ * BSN delta flow stats
+ *
+ * A flow stats request with this bit set in its flags is answered with
+ * only the matching flows whose packet or byte counts changed since the
+ * same connection's previous delta request started. The first delta
+ * request on a connection gets every matching flow.
+ */
+
+#define INDIGO_CORE_FLOW_STATS_REQ_BSN_DELTA 0x8000
+
+/**
+ * BSN paginated flow stats
+ *
+ * A flow stats request with INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE set is
+ * answered with at most 2^n of the matching flows, n being the value in
+ * the PAGE_SHIFT bits, or OFSTATEMANAGER_CONFIG_FLOW_STATS_PAGE_SIZE
+ * flows if n is zero. The last reply of a full page has
+ * INDIGO_CORE_FLOW_STATS_REPLY_BSN_PAGE_MORE set in its flags, and
+ * repeating the request returns the next page; the walk is over once a
+ * page comes back without it. The switch keeps
+ * the position for each connection, so one walk per connection is in
+ * progress at a time: a request with a different filter, or with
+ * INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_RESTART set, starts a new walk.
+ */
+
+#define INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE 0x4000
+#define INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_RESTART 0x2000
+#define INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_SHIFT_MASK 0x1f00
+#define INDIGO_CORE_FLOW_STATS_REQ_BSN_PAGE_SHIFT_SHIFT 8
+#define INDIGO_CORE_FLOW_STATS_REPLY_BSN_PAGE_MORE 0x4000
+
+/**
+ * BSN gentable checksum tree depth
+ *
+ * A nonzero depth in these bits of a gentable bucket stats request's
+ * flags asks for the checksums of the 2^depth equal slices of the
+ * checksum space instead of the buckets. A depth at or below the bucket
+ * level returns the buckets. The controller can compare slices depth by
+ * depth and then fetch the entries of mismatched buckets with a checksum
+ * mask.
+ */
+
+#define INDIGO_CORE_GENTABLE_BUCKET_STATS_REQ_BSN_DEPTH_MASK 0x1f00
+#define INDIGO_CORE_GENTABLE_BUCKET_STATS_REQ_BSN_DEPTH_SHIFT 8
+
 
 /****************************************************************
  * Configuration Interface functions provided by the state manager
@@ -155,6 +218,74 @@ extern void indigo_core_flow_removed(
     indigo_fi_flow_removed_t reason,
     indigo_fi_flow_stats_t *stats);
 
+/****************************************************************
+ * Asynchronous forwarding operation completion
+ *
+ * indigo_fwd_flow_create, indigo_fwd_flow_modify, indigo_fwd_flow_delete,
+ * indigo_fwd_group_add and indigo_fwd_group_modify may return
+ * INDIGO_ERROR_PENDING instead of waiting for the hardware, as may a flow
+ * batch result. Forwarding then reports the outcome with the matching
+ * call below, from the event loop thread. Operations on the same flow
+ * or group must complete in the order they were made.
+ *
+ * The state manager holds the request until then, so barriers wait for
+ * the completion, and errors are sent to the controller when it arrives.
+ ****************************************************************/
+
+/**
+ * @brief Complete a pending flow create
+ * @param flow_id Flow identifier
+ * @param result Outcome of the create
+ * @param table_id Table inserted into
+ */
+
+extern void indigo_core_flow_create_done(
+    indigo_cookie_t flow_id,
+    indigo_error_t result,
+    uint8_t table_id);
+
+/**
+ * @brief Complete a pending flow modify
+ * @param flow_id Flow identifier
+ * @param result Outcome of the modify
+ */
+
+extern void indigo_core_flow_modify_done(
+    indigo_cookie_t flow_id,
+    indigo_error_t result);
+
+/**
+ * @brief Complete a pending flow delete
+ * @param flow_id Flow identifier
+ * @param result Outcome of the delete
+ * @param flow_stats Final statistics for the flow
+ */
+
+extern void indigo_core_flow_delete_done(
+    indigo_cookie_t flow_id,
+    indigo_error_t result,
+    indigo_fi_flow_stats_t *flow_stats);
+
+/**
+ * @brief Complete a pending group add
+ * @param id Group ID
+ * @param result Outcome of the add
+ */
+
+extern void indigo_core_group_add_done(
+    uint32_t id,
+    indigo_error_t result);
+
+/**
+ * @brief Complete a pending group modify
+ * @param id Group ID
+ * @param result Outcome of the modify
+ */
+
+extern void indigo_core_group_modify_done(
+    uint32_t id,
+    indigo_error_t result);
+
 /****************************************************************
  * Asynchronous connection manager notification, disconnection mode
  ****************************************************************/
@@ -261,6 +392,49 @@ typedef struct indigo_core_gentable_ops {
      * @param stats Stats list to be filled in
      */
     void (*get_stats)(void *table_priv, void *entry_priv, of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *stats);
+
+    /**
+     * @brief Open a batch (optional)
+     * @param table_priv Table private data
+     *
+     * The add, modify and del calls made until commit belong to the batch,
+     * and the table may defer programming them until commit. They must
+     * still return whether the operation is accepted. No get_stats calls
+     * are made while a batch is open.
+     *
+     * Set both begin and commit, or neither.
+     */
+    void (*begin)(void *table_priv);
+
+    /**
+     * @brief Program the operations made since begin (optional)
+     * @param table_priv Table private data
+     */
+    void (*commit)(void *table_priv);
+
+    /**
+     * @brief Get stats for several entries (optional)
+     * @param table_priv Table private data
+     * @param num_entries Number of entries
+     * @param entry_privs Entry private data of each entry
+     * @param keys Key of each entry
+     * @param stats Stats list to be filled in for each entry
+     *
+     * If set, used instead of get_stats for entry stats requests so the
+     * counters of a group of entries can be read in one hardware access.
+     */
+    void (*get_stats_batch)(void *table_priv, int num_entries, void **entry_privs, of_list_bsn_tlv_t **keys, of_list_bsn_tlv_t **stats);
+
+    /**
+     * @brief Delete all entries (optional)
+     * @param table_priv Table private data
+     *
+     * If set, used instead of one del call per entry when the controller
+     * clears the whole table and when the table is unregistered. On error
+     * nothing may have been deleted, and the entries are then deleted
+     * individually.
+     */
+    indigo_error_t (*clear)(void *table_priv);
 } indigo_core_gentable_ops_t;
 
 /*
@@ -286,6 +460,22 @@ indigo_core_gentable_register(
     uint32_t buckets_size,
     indigo_core_gentable_t **gentable);
 
+/*
+ * @brief Store a gentable's entries compactly
+ * @param gentable Handle from indigo_core_gentable_register.
+ * @param compact Whether to store keys and values inline.
+ *
+ * A compact gentable keeps each entry's key and value bytes in the same
+ * allocation as the entry. The key and value lists passed to the ops are
+ * then only valid for the duration of the call. Should be called before
+ * any entries are added; entries already restored from a checkpoint are
+ * converted.
+ */
+
+void
+indigo_core_gentable_compact_set(indigo_core_gentable_t *gentable,
+                                 bool compact);
+
 /*
  * @brief Unregister a gentable
  * @param gentable
@@ -294,6 +484,147 @@ indigo_core_gentable_register(
 void
 indigo_core_gentable_unregister(indigo_core_gentable_t *gentable);
 
+/*
+ * @brief Add a secondary index to a gentable
+ * @param gentable Handle from indigo_core_gentable_register.
+ * @param tlv_type LOCI object id of the TLV to index, e.g. OF_BSN_TLV_VLAN_VID.
+ * @returns INDIGO_ERROR_RESOURCE if the table has
+ *          OFSTATEMANAGER_CONFIG_GENTABLE_MAX_INDEXES indexes already.
+ *
+ * Entries are indexed by the first TLV of this type in their key, or else
+ * their value. Entries with no such TLV are not indexed.
+ */
+
+indigo_error_t
+indigo_core_gentable_index_add(indigo_core_gentable_t *gentable,
+                               of_object_id_t tlv_type);
+
+/*
+ * @brief Callback for indigo_core_gentable_index_iter
+ * @param cookie Opaque value passed to indigo_core_gentable_index_iter
+ * @param key Entry key
+ * @param value Entry value
+ * @param entry_priv Entry private data
+ *
+ * Must not change the gentable.
+ */
+
+typedef void (*indigo_core_gentable_index_iter_f)(
+    void *cookie, of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *value,
+    void *entry_priv);
+
+/*
+ * @brief Call a function for each entry with a given TLV
+ * @param gentable Handle from indigo_core_gentable_register.
+ * @param tlv TLV to match, byte for byte. Its type selects the index.
+ * @param callback Called for each matching entry.
+ * @param cookie Passed to callback.
+ * @returns INDIGO_ERROR_NOT_FOUND if the TLV type is not indexed.
+ */
+
+indigo_error_t
+indigo_core_gentable_index_iter(indigo_core_gentable_t *gentable,
+                                of_object_t *tlv,
+                                indigo_core_gentable_index_iter_f callback,
+                                void *cookie);
+
+/*
+ * @brief Save every registered gentable to a checkpoint file
+ * @param path File to write. Replaced atomically.
+ *
+ * The file holds each entry's key, value and checksum.
+ */
+
+indigo_error_t
+indigo_core_gentable_checkpoint_save(const char *path);
+
+/*
+ * @brief Map a checkpoint file for restoring gentables
+ * @param path File written by indigo_core_gentable_checkpoint_save.
+ * @returns INDIGO_ERROR_NOT_FOUND if the file does not exist.
+ *
+ * Each gentable registered afterwards with a name found in the
+ * checkpoint gets the checkpointed entries through its add op before
+ * indigo_core_gentable_register returns. Call before registering any
+ * gentables.
+ */
+
+indigo_error_t
+indigo_core_gentable_checkpoint_load(const char *path);
+
+/*
+ * @brief Unmap the loaded checkpoint
+ *
+ * Call once all gentables that may be restored are registered.
+ */
+
+void
+indigo_core_gentable_checkpoint_release(void);
+
+/*
+ * @brief Keep a flowtable checkpoint file up to date
+ * @param path File to write. Replaced atomically by each full rewrite.
+ *
+ * Writes every flow to the file now and then appends each later flow
+ * add, modify and delete, flushed at the end of each event loop pass.
+ * The file is rewritten from the flowtable once the appended changes
+ * outgrow it. Each flow is saved with its ID, match, priority, cookie,
+ * timeouts, flags, table, age and effects.
+ */
+
+indigo_error_t
+indigo_core_flow_checkpoint_start(const char *path);
+
+/*
+ * @brief Stop updating the flowtable checkpoint
+ *
+ * The file is flushed and left in place for the next restore.
+ */
+
+void
+indigo_core_flow_checkpoint_stop(void);
+
+/*
+ * @brief Restore the flowtable from a checkpoint file
+ * @param path File written by indigo_core_flow_checkpoint_start.
+ * @returns INDIGO_ERROR_NOT_FOUND if the file does not exist, or
+ *          INDIGO_ERROR_EXISTS if the flowtable is not empty.
+ *
+ * Adds the checkpointed flows under their old flow IDs and hands each to
+ * indigo_fwd_flow_restore instead of indigo_fwd_flow_create, so
+ * Forwarding can keep flows it still has programmed. Call after
+ * ind_core_init, before connecting to any controller and before
+ * indigo_core_flow_checkpoint_start. A record cut short at the end of
+ * the file, as left by a crash, is ignored.
+ */
+
+indigo_error_t
+indigo_core_flow_checkpoint_restore(const char *path);
+
+/*
+ * Flow eviction factors, with the values of the OpenFlow 1.4 eviction
+ * property flags
+ */
+#define INDIGO_CORE_EVICTION_OTHER      0x1  /* Least recently hit */
+#define INDIGO_CORE_EVICTION_IMPORTANCE 0x2  /* Lowest flow_mod importance */
+#define INDIGO_CORE_EVICTION_LIFETIME   0x4  /* Soonest hard timeout */
+
+/*
+ * @brief Evict flows from a table instead of failing adds when it is full
+ * @param table_id The table
+ * @param flags INDIGO_CORE_EVICTION_* factors to order the flows by;
+ *        importance is compared first, then lifetime, and recent hits
+ *        break any remaining ties. 0 disables eviction.
+ *
+ * When Forwarding fails a flow add with INDIGO_ERROR_TABLE_FULL, the
+ * first flow in this order is deleted with reason
+ * INDIGO_FLOW_REMOVED_EVICTION and the add is retried once. Controllers
+ * using OpenFlow 1.4 can also enable eviction with a table_mod.
+ */
+
+indigo_error_t
+indigo_core_table_eviction_set(uint8_t table_id, uint32_t flags);
+
 
 /**
  * Listener interfaces
@@ -319,6 +650,34 @@ typedef indigo_core_listener_result_t (*indigo_core_packet_in_listener_f)(of_pac
 indigo_error_t indigo_core_packet_in_listener_register(indigo_core_packet_in_listener_f fn);
 void indigo_core_packet_in_listener_unregister(indigo_core_packet_in_listener_f fn);
 
+/**
+ * Packet-in listener filter
+ *
+ * A filtered listener is only called for packet-ins that match every
+ * field named in 'fields'. Listeners filtering on eth_type are looked up
+ * by the packet's ethertype (after any VLAN tags), so they cost nothing
+ * for other packet-ins. table_id is never set in OpenFlow 1.0 packet-ins.
+ *
+ * indigo_core_packet_in_listener_unregister removes filtered listeners
+ * too.
+ */
+#define INDIGO_CORE_PACKET_IN_FILTER_ETH_TYPE (1 << 0)
+#define INDIGO_CORE_PACKET_IN_FILTER_REASON   (1 << 1)
+#define INDIGO_CORE_PACKET_IN_FILTER_IN_PORT  (1 << 2)
+#define INDIGO_CORE_PACKET_IN_FILTER_TABLE_ID (1 << 3)
+
+typedef struct indigo_core_packet_in_filter_s {
+    uint32_t fields;        /* INDIGO_CORE_PACKET_IN_FILTER_* */
+    uint16_t eth_type;
+    uint8_t reason;
+    uint8_t table_id;
+    of_port_no_t in_port;
+} indigo_core_packet_in_filter_t;
+
+indigo_error_t indigo_core_packet_in_listener_register_filtered(
+    indigo_core_packet_in_listener_f fn,
+    const indigo_core_packet_in_filter_t *filter);
+
 /**
  * Port status listener registration
  */
@@ -326,6 +685,17 @@ typedef indigo_core_listener_result_t (*indigo_core_port_status_listener_f)(of_p
 indigo_error_t indigo_core_port_status_listener_register(indigo_core_port_status_listener_f fn);
 void indigo_core_port_status_listener_unregister(indigo_core_port_status_listener_f fn);
 
+/**
+ * Port status batch listener registration
+ *
+ * Called with each group of port status updates delivered together (see
+ * ind_core_config_t.port_status_coalesce_ms), before the port status
+ * listeners. Batch listeners can't drop updates and don't own them.
+ */
+typedef void (*indigo_core_port_status_batch_listener_f)(of_port_status_t **port_statuses, int num_port_statuses);
+indigo_error_t indigo_core_port_status_batch_listener_register(indigo_core_port_status_batch_listener_f fn);
+void indigo_core_port_status_batch_listener_unregister(indigo_core_port_status_batch_listener_f fn);
+
 /**
  * Message listener registration
  */
@@ -333,5 +703,25 @@ typedef indigo_core_listener_result_t (*indigo_core_message_listener_f)(indigo_c
 indigo_error_t indigo_core_message_listener_register(indigo_core_message_listener_f fn);
 void indigo_core_message_listener_unregister(indigo_core_message_listener_f fn);
 
+/**
+ * Listener registration for one message type
+ *
+ * These run after the general message listeners, and only for messages
+ * with the given object id.
+ */
+indigo_error_t indigo_core_message_type_listener_register(of_object_id_t object_id, indigo_core_message_listener_f fn);
+void indigo_core_message_type_listener_unregister(of_object_id_t object_id, indigo_core_message_listener_f fn);
+
+/**
+ * Message handler registration
+ *
+ * A registered handler replaces OFStateManager's default handler for the
+ * message type and takes ownership of the message. Only one handler may
+ * be registered per type; unregistering restores the default.
+ */
+typedef void (*indigo_core_message_handler_f)(of_object_t *msg, indigo_cxn_id_t cxn_id);
+indigo_error_t indigo_core_message_handler_register(of_object_id_t object_id, indigo_core_message_handler_f fn);
+void indigo_core_message_handler_unregister(of_object_id_t object_id, indigo_core_message_handler_f fn);
+
 #endif /* _INDIGO_OF_STATE_MANAGER_H_ */
 /** @} */
@@ -173,6 +173,47 @@ extern indigo_error_t indigo_port_stats_get(
     of_port_stats_request_t *port_stats_request,
     of_port_stats_reply_t **port_stats_reply);
 
+/**
+ * @brief OpenFlow port statistics counters
+ *
+ * Should be set to -1 if not supported.
+ */
+
+typedef struct indigo_port_stats_s {
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t rx_dropped;
+    uint64_t tx_dropped;
+    uint64_t rx_errors;
+    uint64_t tx_errors;
+    uint64_t rx_frame_err;
+    uint64_t rx_over_err;
+    uint64_t rx_crc_err;
+    uint64_t collisions;
+    uint32_t duration_sec;
+    uint32_t duration_nsec;
+} indigo_port_stats_t;
+
+/**
+ * @brief OpenFlow port stats for several ports
+ * @param port_nos The OpenFlow port numbers
+ * @param [out] port_stats Statistics for each port in port_nos
+ * @param num_ports Number of ports
+ * @return INDIGO_ERROR_NOT_SUPPORTED to have port stats requests
+ * passed to indigo_port_stats_get instead
+ *
+ * Optional. Used by the state manager to read all ports at once into a
+ * snapshot shared by every connection (see
+ * ind_core_config_t.port_stats_cache_ms).
+ */
+
+indigo_error_t indigo_port_stats_bulk_get(
+    of_port_no_t *port_nos,
+    indigo_port_stats_t *port_stats,
+    int num_ports);
+
 /**
  * @brief Process an extended port stats request
  * @param port_no The OpenFlow port number
@@ -188,6 +229,21 @@ void indigo_port_extended_stats_get(
     of_port_no_t port_no,
     indigo_fi_port_stats_t *port_stats);
 
+/**
+ * @brief Extended stats for several ports
+ * @param port_nos The OpenFlow port numbers
+ * @param [out] port_stats Statistics for each port in port_nos
+ * @param num_ports Number of ports
+ *
+ * Optional. The default calls indigo_port_extended_stats_get for each
+ * port. Implementations may read the counters in one hardware access.
+ */
+
+void indigo_port_extended_stats_bulk_get(
+    of_port_no_t *port_nos,
+    indigo_fi_port_stats_t *port_stats,
+    int num_ports);
+
 /**
  * @brief Process an OF queue config request
  * @param queue_config_request The LOXI request message
@@ -217,6 +273,39 @@ extern indigo_error_t indigo_port_queue_stats_get(
     of_queue_stats_request_t *queue_stats_request,
     of_queue_stats_reply_t **queue_stats_reply);
 
+/**
+ * @brief Queue statistics counters
+ *
+ * Should be set to -1 if not supported.
+ */
+
+typedef struct indigo_port_queue_stats_s {
+    of_port_no_t port_no;
+    uint32_t queue_id;
+    uint64_t tx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_errors;
+    uint32_t duration_sec;
+    uint32_t duration_nsec;
+} indigo_port_queue_stats_t;
+
+/**
+ * @brief Stats for every queue on every port
+ * @param [out] queue_stats Receives one entry per queue
+ * @param [in,out] num_queues Size of queue_stats; set to the number of
+ * queues
+ * @return INDIGO_ERROR_RESOURCE if queue_stats is too small, with
+ * num_queues set to the size needed; INDIGO_ERROR_NOT_SUPPORTED to
+ * have queue stats requests passed to indigo_port_queue_stats_get
+ * instead
+ *
+ * Optional, like indigo_port_stats_bulk_get.
+ */
+
+indigo_error_t indigo_port_queue_stats_bulk_get(
+    indigo_port_queue_stats_t *queue_stats,
+    int *num_queues);
+
 
 /**
  * @brief Experimenter (vendor) extension
@@ -26,6 +26,11 @@
  * indigo_time_t:  Typedef of struct for time
  * INDIGO_CURRENT_TIME: Return current time of type indigo_time_t
  * INDIGO_TIME_DIFF_ms(earlier, later): Difference in milliseconds in times
+ *
+ * indigo_time_us_t: Microsecond time, on the same clock as indigo_time_t
+ * INDIGO_CURRENT_TIME_us: Return current time of type indigo_time_us_t
+ * INDIGO_CURRENT_TIME_COARSE_us: Cheaper, lower resolution current time
+ * INDIGO_TIME_DIFF_us(earlier, later): Difference in microseconds in times
  */
 
 #ifndef _INDIGO_TIME_H_
@@ -68,6 +73,43 @@ typedef uint64_t indigo_time_t;
  */
 #define INDIGO_TIME_DIFF_ms(earlier, later) ((int) ((later) - (earlier)))
 
+/**
+ * Microsecond time type
+ *
+ * Counts microseconds on the same clock as indigo_time_t, so that
+ * INDIGO_TIME_us_TO_ms of a microsecond time compares with indigo_time_t
+ * values.
+ */
+typedef uint64_t indigo_time_us_t;
+
+/**
+ * Get the current timestamp in microseconds
+ */
+#define INDIGO_CURRENT_TIME_us indigo_current_time_us()
+
+/**
+ * Get the current timestamp in microseconds, cheaply
+ *
+ * Uses CLOCK_MONOTONIC_COARSE where available, which avoids reading the
+ * hardware clock but only advances once per kernel tick (typically 1 to
+ * 4 ms).
+ */
+#define INDIGO_CURRENT_TIME_COARSE_us indigo_current_time_coarse_us()
+
+/**
+ * Time difference in microseconds
+ *
+ * @param earlier The earlier, start time
+ * @param later The later, end time
+ * @returns A signed 64 bit count of microseconds from earlier to later
+ */
+#define INDIGO_TIME_DIFF_us(earlier, later) ((int64_t) ((later) - (earlier)))
+
+/**
+ * Convert a microsecond time to an indigo_time_t
+ */
+#define INDIGO_TIME_us_TO_ms(t) ((indigo_time_t) ((t) / 1000))
+
 /****************************************************************
  * Linux implementation mechanisms for the above abstractions
  *
@@ -83,6 +125,24 @@ indigo_current_time(void) {
     clock_gettime(CLOCK_MONOTONIC, &tp);
     return (uint64_t)(tp.tv_sec) * 1000 + (uint64_t)(tp.tv_nsec / (1000*1000));
 }
+
+static inline indigo_time_us_t
+indigo_current_time_us(void) {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t)(tp.tv_sec) * 1000000 + (uint64_t)(tp.tv_nsec / 1000);
+}
+
+static inline indigo_time_us_t
+indigo_current_time_coarse_us(void) {
+#ifdef CLOCK_MONOTONIC_COARSE
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &tp);
+    return (uint64_t)(tp.tv_sec) * 1000000 + (uint64_t)(tp.tv_nsec / 1000);
+#else
+    return indigo_current_time_us();
+#endif
+}
 #else
 /* This was the previous behavior -- still supported until verified on other platforms */
 static inline indigo_time_t
@@ -91,6 +151,16 @@ indigo_current_time(void) {
     gettimeofday(&timeval, NULL);
     return (uint64_t)(timeval.tv_sec) * 1000 + (uint64_t)(timeval.tv_usec) / 1000;
 }
+
+static inline indigo_time_us_t
+indigo_current_time_us(void) {
+    struct timeval timeval;
+    gettimeofday(&timeval, NULL);
+    return (uint64_t)(timeval.tv_sec) * 1000000 + (uint64_t)(timeval.tv_usec);
+}
+
+/* No coarse variant of the wall clock */
+#define indigo_current_time_coarse_us indigo_current_time_us
 #endif
 
 /* Printing time to a string */
@@ -146,6 +216,11 @@ indigo_time_str(indigo_time_t itime, char *buf, int len) {
 typedef uint64_t indigo_time_t;
 #define INDIGO_CURRENT_TIME (0)
 #define INDIGO_TIME_DIFF_ms(_a,_b) (0)
+typedef uint64_t indigo_time_us_t;
+#define INDIGO_CURRENT_TIME_us (0)
+#define INDIGO_CURRENT_TIME_COARSE_us (0)
+#define INDIGO_TIME_DIFF_us(_a,_b) (0)
+#define INDIGO_TIME_us_TO_ms(_t) (0)
 #endif
 
 #endif /* _INDIGO_TIME_H_ */
@@ -0,0 +1,318 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/******************************************************************************
+ *
+ *  /module/src/binlog.c
+ *
+ *  Deferred binary log ring and formatting
+ *
+ *****************************************************************************/
+
+#include <AIM/aim.h>
+#include <indigo/indigo.h>
+#include <indigo/binlog.h>
+#include "indigo_int.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Bounds of the site section, provided by the linker */
+extern indigo_binlog_site_t __start_indigo_binlog_sites[] __attribute__((weak));
+extern indigo_binlog_site_t __stop_indigo_binlog_sites[] __attribute__((weak));
+
+#define SITES_BEGIN __start_indigo_binlog_sites
+#define SITES_END __stop_indigo_binlog_sites
+
+/* Records kept until resized with indigo_binlog_ring_size_set */
+#define DEFAULT_RING_RECORDS 16384
+
+typedef struct binlog_record_s {
+    /* Index + 1 once written, 0 while a writer owns the record */
+    volatile uint64_t seq;
+    indigo_time_us_t time_us;
+    uint32_t site_id;
+    uint64_t args[INDIGO_BINLOG_ARGS_MAX];
+} binlog_record_t;
+
+static binlog_record_t *ring;
+static uint32_t ring_records;
+static volatile uint64_t ring_head;
+static uint64_t dropped;
+
+static inline int
+sites_count(void)
+{
+    if (SITES_BEGIN == NULL) {
+        return 0;
+    }
+    return SITES_END - SITES_BEGIN;
+}
+
+void
+indigo_binlog_write(const indigo_binlog_site_t *site, const uint64_t *args)
+{
+    binlog_record_t *rec;
+    uint64_t idx;
+
+    if (ring == NULL) {
+        __sync_fetch_and_add(&dropped, 1);
+        return;
+    }
+
+    idx = __sync_fetch_and_add(&ring_head, 1);
+    rec = &ring[idx % ring_records];
+
+    rec->seq = 0;
+    __sync_synchronize();
+
+    rec->time_us = INDIGO_CURRENT_TIME_us;
+    rec->site_id = site - SITES_BEGIN;
+    INDIGO_MEM_COPY(rec->args, args, sizeof(rec->args[0]) * site->nargs);
+
+    __sync_synchronize();
+    rec->seq = idx + 1;
+}
+
+int
+indigo_binlog_ring_size_set(int records)
+{
+    binlog_record_t *new_ring = NULL;
+
+    if (records < 0) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if (records > 0) {
+        new_ring = INDIGO_MEM_ALLOC(records * sizeof(*new_ring));
+        if (new_ring == NULL) {
+            return INDIGO_ERROR_RESOURCE;
+        }
+        INDIGO_MEM_CLEAR(new_ring, records * sizeof(*new_ring));
+    }
+
+    INDIGO_MEM_FREE(ring);
+    ring_head = 0;
+    ring_records = records;
+    ring = new_ring;
+
+    return INDIGO_ERROR_NONE;
+}
+
+int
+indigo_binlog_enable_set(const char *match, int enable)
+{
+    int count = sites_count();
+    int all = !strcmp(match, "all");
+    char *end;
+    long id;
+    int i, changed = 0;
+
+    if (enable && ring == NULL && indigo_binlog_ring_size_set(
+            DEFAULT_RING_RECORDS) < 0) {
+        return 0;
+    }
+
+    id = strtol(match, &end, 10);
+    if (*match != '\0' && *end == '\0') {
+        if (id < 0 || id >= count) {
+            return 0;
+        }
+        SITES_BEGIN[id].enabled = !!enable;
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (all || strstr(SITES_BEGIN[i].file, match) != NULL) {
+            SITES_BEGIN[i].enabled = !!enable;
+            changed++;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * Append a record's message to buf, applying each conversion to the
+ * matching raw argument
+ */
+static void
+record_format(char *buf, int size, const indigo_binlog_site_t *site,
+              const uint64_t *args)
+{
+    const char *p = site->fmt;
+    int len = 0;
+    int argi = 0;
+
+#define APPEND(...) do {                                                \
+        if (len < size) {                                               \
+            int _n = snprintf(buf + len, size - len, __VA_ARGS__);      \
+            len += _n > 0 ? _n : 0;                                     \
+        }                                                               \
+    } while (0)
+
+    while (*p != '\0' && len < size - 1) {
+        char spec[32];
+        const char *start;
+        uint64_t arg;
+        int lng = 0, spec_len;
+
+        if (*p != '%') {
+            buf[len++] = *p++;
+            continue;
+        }
+
+        if (p[1] == '%') {
+            buf[len++] = '%';
+            p += 2;
+            continue;
+        }
+
+        start = p++;
+        p += strspn(p, "-+ #0");
+        p += strspn(p, "0123456789");
+        if (*p == '.') {
+            p++;
+            p += strspn(p, "0123456789");
+        }
+        while (*p != '\0' && strchr("hljzt", *p) != NULL) {
+            if (*p == 'l' || *p == 'j' || *p == 'z' || *p == 't') {
+                lng++;
+            }
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        spec_len = p - start + 1;
+        if (spec_len >= (int)sizeof(spec) || argi >= site->nargs) {
+            APPEND("?");
+            p++;
+            continue;
+        }
+        INDIGO_MEM_COPY(spec, start, spec_len);
+        spec[spec_len] = '\0';
+        arg = args[argi++];
+
+        switch (*p) {
+        case 'd': case 'i':
+            /* Re-issue with the widest length modifier */
+            if (lng == 0) {
+                APPEND(spec, (int)arg);
+            } else {
+                snprintf(spec + (strcspn(spec, "hljzt")), sizeof(spec) -
+                         strcspn(spec, "hljzt"), "lld");
+                APPEND(spec, (long long)arg);
+            }
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            if (lng == 0) {
+                APPEND(spec, (unsigned)arg);
+            } else {
+                char conv = *p;
+                snprintf(spec + (strcspn(spec, "hljzt")), sizeof(spec) -
+                         strcspn(spec, "hljzt"), "ll%c", conv);
+                APPEND(spec, (unsigned long long)arg);
+            }
+            break;
+        case 'c':
+            APPEND(spec, (int)arg);
+            break;
+        case 'p':
+            APPEND(spec, (void *)(uintptr_t)arg);
+            break;
+        case 's':
+            APPEND(spec, arg ? (const char *)(uintptr_t)arg : "(null)");
+            break;
+        default:
+            APPEND("?");
+            break;
+        }
+        p++;
+    }
+
+#undef APPEND
+
+    if (len >= size) {
+        len = size - 1;
+    }
+    buf[len] = '\0';
+}
+
+void
+indigo_binlog_show(aim_pvs_t *pvs, int max)
+{
+    binlog_record_t rec;
+    uint64_t head = ring_head;
+    uint64_t idx;
+    char buf[512];
+    int count = sites_count();
+
+    if (ring == NULL) {
+        aim_printf(pvs, "No binlog ring\n");
+        return;
+    }
+
+    idx = head > ring_records ? head - ring_records : 0;
+    if (max > 0 && head - idx > (uint64_t)max) {
+        idx = head - max;
+    }
+
+    for (; idx < head; idx++) {
+        binlog_record_t *slot = &ring[idx % ring_records];
+        const indigo_binlog_site_t *site;
+
+        if (slot->seq != idx + 1) {
+            continue;
+        }
+        __sync_synchronize();
+        rec = *slot;
+        __sync_synchronize();
+        if (slot->seq != idx + 1 || rec.site_id >= (uint32_t)count) {
+            continue;
+        }
+
+        site = &SITES_BEGIN[rec.site_id];
+        record_format(buf, sizeof(buf), site, rec.args);
+        aim_printf(pvs, "%"PRIu64".%06"PRIu64" %s:%u: %s\n",
+                   rec.time_us / 1000000, rec.time_us % 1000000,
+                   site->file, site->line, buf);
+    }
+
+    if (dropped > 0) {
+        aim_printf(pvs, "%"PRIu64" records dropped without a ring\n", dropped);
+    }
+}
+
+void
+indigo_binlog_sites_show(aim_pvs_t *pvs)
+{
+    int count = sites_count();
+    int i;
+
+    for (i = 0; i < count; i++) {
+        const indigo_binlog_site_t *site = &SITES_BEGIN[i];
+        aim_printf(pvs, "%4d %s %s:%u \"%s\"\n", i,
+                   site->enabled ? "on " : "off", site->file, site->line,
+                   site->fmt);
+    }
+}
@@ -0,0 +1,549 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/******************************************************************************
+ *
+ *  /module/src/memory.c
+ *
+ *  Tagged allocator with size class pools
+ *
+ *****************************************************************************/
+
+#include <AIM/aim.h>
+#include <indigo/indigo.h>
+#include "indigo_int.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Smallest size class; classes double up to INDIGO_MEM_POOL_MAX_BYTES */
+#define POOL_MIN_BYTES 32
+#define POOL_CLASSES 8
+
+/* Free blocks kept per class, in bytes */
+#define POOL_MAX_FREE_BYTES (256 * 1024)
+
+#if (POOL_MIN_BYTES << (POOL_CLASSES - 1)) != INDIGO_MEM_POOL_MAX_BYTES
+#error "Size classes must end at INDIGO_MEM_POOL_MAX_BYTES"
+#endif
+
+struct pool_block {
+    struct pool_block *next;
+};
+
+struct pool {
+    pthread_mutex_t lock;
+    struct pool_block *free;
+    uint32_t free_count;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static struct pool pools[POOL_CLASSES];
+static pthread_once_t pools_once = PTHREAD_ONCE_INIT;
+
+static indigo_mem_tag_stats_t tag_stats[INDIGO_MEM_TAG_COUNT];
+
+static const char *tag_names[INDIGO_MEM_TAG_COUNT] = {
+#define TAG(name, description) description,
+    INDIGO_MEM_TAGS
+#undef TAG
+};
+
+/* Counters at the previous indigo_mem_stats_show, for rates */
+static indigo_mem_tag_stats_t shown_stats[INDIGO_MEM_TAG_COUNT];
+static indigo_time_t shown_time;
+
+static void *
+stdlib_alloc(size_t bytes, void *cookie)
+{
+    return malloc(bytes);
+}
+
+static void
+stdlib_free(void *ptr, size_t bytes, void *cookie)
+{
+    free(ptr);
+}
+
+static indigo_mem_backend_t backend = { stdlib_alloc, stdlib_free, NULL };
+
+/*
+ * Huge page arenas
+ *
+ * Sizes are rounded to 64 bytes up to 4 KB and to 4 KB above that, and
+ * each rounded size has its own free list.
+ */
+#define ARENA_CHUNK_BYTES (2 * 1024 * 1024)
+#define ARENA_SMALL_STEP 64
+#define ARENA_LARGE_STEP 4096
+#define ARENA_BINS (ARENA_LARGE_STEP / ARENA_SMALL_STEP + \
+                    INDIGO_MEM_ARENA_MAX_BYTES / ARENA_LARGE_STEP - 1)
+
+/* MPOL_PREFERRED from numaif.h, to avoid depending on libnuma */
+#define ARENA_MPOL_PREFERRED 1
+#define ARENA_MAX_NUMA_NODES 1024
+
+struct arena {
+    pthread_mutex_t lock;
+    int numa_node;
+    uint8_t *cur;               /* Uncarved part of the newest chunk */
+    size_t cur_left;
+    struct pool_block *bins[ARENA_BINS];
+    uint64_t hugetlb_chunks;    /* Mapped from reserved huge pages */
+    uint64_t thp_chunks;        /* Advised for transparent huge pages */
+    uint64_t bind_failures;
+};
+
+/* Set before the tag has live blocks, and never cleared */
+static struct arena *tag_arenas[INDIGO_MEM_TAG_COUNT];
+
+static inline size_t
+arena_round(size_t bytes)
+{
+    size_t step = bytes <= ARENA_LARGE_STEP ? ARENA_SMALL_STEP :
+        ARENA_LARGE_STEP;
+
+    if (bytes == 0) {
+        bytes = 1;
+    }
+    return (bytes + step - 1) & ~(step - 1);
+}
+
+static inline int
+arena_bin(size_t rounded)
+{
+    if (rounded <= ARENA_LARGE_STEP) {
+        return rounded / ARENA_SMALL_STEP - 1;
+    }
+    return ARENA_LARGE_STEP / ARENA_SMALL_STEP - 1 +
+        rounded / ARENA_LARGE_STEP - 1;
+}
+
+static void
+arena_bind(struct arena *arena, void *ptr, size_t bytes)
+{
+    unsigned long mask[ARENA_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    int bits = 8 * sizeof(unsigned long);
+    int node = arena->numa_node;
+
+    if (node < 0) {
+        return;
+    }
+
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] |= 1UL << (node % bits);
+    if (syscall(SYS_mbind, ptr, bytes, ARENA_MPOL_PREFERRED, mask,
+                (unsigned long)ARENA_MAX_NUMA_NODES, 0) < 0) {
+        arena->bind_failures++;
+    }
+}
+
+/* Map a multiple of the chunk size, on huge page boundaries */
+static void *
+arena_map(struct arena *arena, size_t bytes)
+{
+    uint8_t *raw, *ptr;
+    size_t len;
+
+    ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+        arena->hugetlb_chunks += bytes / ARENA_CHUNK_BYTES;
+    } else {
+        /* Over-map so the range can be trimmed to 2 MB alignment */
+        len = bytes + ARENA_CHUNK_BYTES;
+        raw = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            return NULL;
+        }
+        ptr = (uint8_t *)(((uintptr_t)raw + ARENA_CHUNK_BYTES - 1) &
+                          ~(uintptr_t)(ARENA_CHUNK_BYTES - 1));
+        if (ptr > raw) {
+            munmap(raw, ptr - raw);
+        }
+        if (raw + len > ptr + bytes) {
+            munmap(ptr + bytes, raw + len - (ptr + bytes));
+        }
+#ifdef MADV_HUGEPAGE
+        (void)madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+        arena->thp_chunks += bytes / ARENA_CHUNK_BYTES;
+    }
+
+    /* Before first touch, so the pages are placed on the node */
+    arena_bind(arena, ptr, bytes);
+
+    return ptr;
+}
+
+static inline size_t
+arena_map_bytes(size_t bytes)
+{
+    return (bytes + ARENA_CHUNK_BYTES - 1) & ~(size_t)(ARENA_CHUNK_BYTES - 1);
+}
+
+static void *
+arena_alloc(struct arena *arena, size_t bytes)
+{
+    size_t rounded = arena_round(bytes);
+    struct pool_block **bin;
+    void *ptr = NULL;
+
+    pthread_mutex_lock(&arena->lock);
+
+    if (bytes > INDIGO_MEM_ARENA_MAX_BYTES) {
+        ptr = arena_map(arena, arena_map_bytes(bytes));
+    } else if (*(bin = &arena->bins[arena_bin(rounded)]) != NULL) {
+        ptr = *bin;
+        *bin = (*bin)->next;
+    } else {
+        /* The rest of a chunk too small for this block is not used */
+        if (arena->cur_left < rounded) {
+            if ((arena->cur = arena_map(arena, ARENA_CHUNK_BYTES)) == NULL) {
+                arena->cur_left = 0;
+            } else {
+                arena->cur_left = ARENA_CHUNK_BYTES;
+            }
+        }
+        if (arena->cur_left >= rounded) {
+            ptr = arena->cur;
+            arena->cur += rounded;
+            arena->cur_left -= rounded;
+        }
+    }
+
+    pthread_mutex_unlock(&arena->lock);
+
+    return ptr;
+}
+
+static void
+arena_free(struct arena *arena, void *ptr, size_t bytes)
+{
+    struct pool_block *block = ptr;
+    struct pool_block **bin;
+
+    if (bytes > INDIGO_MEM_ARENA_MAX_BYTES) {
+        munmap(ptr, arena_map_bytes(bytes));
+        return;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    bin = &arena->bins[arena_bin(arena_round(bytes))];
+    block->next = *bin;
+    *bin = block;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+static void
+pools_init(void)
+{
+    int i;
+
+    for (i = 0; i < POOL_CLASSES; i++) {
+        pthread_mutex_init(&pools[i].lock, NULL);
+    }
+}
+
+static inline int
+pool_class(size_t bytes)
+{
+    int cls = 0;
+    size_t class_bytes = POOL_MIN_BYTES;
+
+    while (class_bytes < bytes) {
+        class_bytes <<= 1;
+        cls++;
+    }
+
+    return cls;
+}
+
+static inline size_t
+pool_class_bytes(int cls)
+{
+    return (size_t)POOL_MIN_BYTES << cls;
+}
+
+static void
+tag_count(indigo_mem_tag_t tag, size_t bytes, int alloc)
+{
+    indigo_mem_tag_stats_t *stats = &tag_stats[tag];
+
+    if (alloc) {
+        __sync_fetch_and_add(&stats->live_bytes, bytes);
+        __sync_fetch_and_add(&stats->live_objects, 1);
+        __sync_fetch_and_add(&stats->allocs, 1);
+    } else {
+        __sync_fetch_and_sub(&stats->live_bytes, bytes);
+        __sync_fetch_and_sub(&stats->live_objects, 1);
+        __sync_fetch_and_add(&stats->frees, 1);
+    }
+}
+
+void *
+indigo_mem_tag_alloc(indigo_mem_tag_t tag, size_t bytes)
+{
+    struct arena *arena;
+    struct pool *pool;
+    void *ptr;
+    int cls;
+
+    INDIGO_ASSERT(tag < INDIGO_MEM_TAG_COUNT);
+
+    if ((arena = tag_arenas[tag]) != NULL) {
+        ptr = arena_alloc(arena, bytes);
+    } else if (bytes > INDIGO_MEM_POOL_MAX_BYTES) {
+        ptr = backend.alloc(bytes, backend.cookie);
+    } else {
+        pthread_once(&pools_once, pools_init);
+        cls = pool_class(bytes);
+        pool = &pools[cls];
+
+        pthread_mutex_lock(&pool->lock);
+        if ((ptr = pool->free) != NULL) {
+            pool->free = pool->free->next;
+            pool->free_count--;
+            pool->hits++;
+        } else {
+            pool->misses++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (ptr == NULL) {
+            ptr = backend.alloc(pool_class_bytes(cls), backend.cookie);
+        }
+    }
+
+    if (ptr == NULL) {
+        __sync_fetch_and_add(&tag_stats[tag].failures, 1);
+        return NULL;
+    }
+
+    tag_count(tag, bytes, 1);
+
+    return ptr;
+}
+
+void
+indigo_mem_tag_free(indigo_mem_tag_t tag, void *ptr, size_t bytes)
+{
+    struct pool_block *block = ptr;
+    struct pool *pool;
+    int cls;
+
+    INDIGO_ASSERT(tag < INDIGO_MEM_TAG_COUNT);
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    tag_count(tag, bytes, 0);
+
+    if (tag_arenas[tag] != NULL) {
+        arena_free(tag_arenas[tag], ptr, bytes);
+        return;
+    }
+
+    if (bytes > INDIGO_MEM_POOL_MAX_BYTES) {
+        backend.free(ptr, bytes, backend.cookie);
+        return;
+    }
+
+    cls = pool_class(bytes);
+    pool = &pools[cls];
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_count < POOL_MAX_FREE_BYTES / pool_class_bytes(cls)) {
+        block->next = pool->free;
+        pool->free = block;
+        pool->free_count++;
+        block = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (block != NULL) {
+        backend.free(block, pool_class_bytes(cls), backend.cookie);
+    }
+}
+
+indigo_error_t
+indigo_mem_tag_huge_pages_set(indigo_mem_tag_t tag, int numa_node)
+{
+    struct arena *arena;
+
+    INDIGO_ASSERT(tag < INDIGO_MEM_TAG_COUNT);
+
+    if (tag_arenas[tag] != NULL) {
+        return INDIGO_ERROR_NONE;
+    }
+
+    /* Blocks already handed out came from the pools or the backend */
+    if (tag_stats[tag].live_objects != 0) {
+        return INDIGO_ERROR_EXISTS;
+    }
+
+    if (numa_node >= ARENA_MAX_NUMA_NODES) {
+        return INDIGO_ERROR_PARAM;
+    }
+
+    if ((arena = calloc(1, sizeof(*arena))) == NULL) {
+        return INDIGO_ERROR_RESOURCE;
+    }
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->numa_node = numa_node;
+
+    tag_arenas[tag] = arena;
+
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_mem_tag_note_alloc(indigo_mem_tag_t tag, size_t bytes)
+{
+    INDIGO_ASSERT(tag < INDIGO_MEM_TAG_COUNT);
+    tag_count(tag, bytes, 1);
+}
+
+void
+indigo_mem_tag_note_free(indigo_mem_tag_t tag, size_t bytes)
+{
+    INDIGO_ASSERT(tag < INDIGO_MEM_TAG_COUNT);
+    tag_count(tag, bytes, 0);
+}
+
+void
+indigo_mem_backend_set(const indigo_mem_backend_t *new_backend)
+{
+    struct pool_block *block;
+    int i;
+
+    pthread_once(&pools_once, pools_init);
+
+    for (i = 0; i < POOL_CLASSES; i++) {
+        pthread_mutex_lock(&pools[i].lock);
+        while ((block = pools[i].free) != NULL) {
+            pools[i].free = block->next;
+            backend.free(block, pool_class_bytes(i), backend.cookie);
+        }
+        pools[i].free_count = 0;
+        pthread_mutex_unlock(&pools[i].lock);
+    }
+
+    if (new_backend != NULL) {
+        backend = *new_backend;
+    } else {
+        backend.alloc = stdlib_alloc;
+        backend.free = stdlib_free;
+        backend.cookie = NULL;
+    }
+}
+
+void
+indigo_mem_tag_stats_get(indigo_mem_tag_t tag, indigo_mem_tag_stats_t *stats)
+{
+    INDIGO_ASSERT(tag < INDIGO_MEM_TAG_COUNT);
+    *stats = tag_stats[tag];
+}
+
+const char *
+indigo_mem_tag_name(indigo_mem_tag_t tag)
+{
+    if (tag >= INDIGO_MEM_TAG_COUNT) {
+        return "unknown";
+    }
+    return tag_names[tag];
+}
+
+void
+indigo_mem_stats_show(aim_pvs_t *pvs)
+{
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+    indigo_time_t elapsed = now - shown_time;
+    indigo_mem_tag_stats_t stats;
+    int i;
+
+    aim_printf(pvs, "%-16s %12s %10s %12s %12s %8s %10s %10s\n",
+               "tag", "live_bytes", "live_objs", "allocs", "frees",
+               "failures", "allocs/s", "frees/s");
+
+    for (i = 0; i < INDIGO_MEM_TAG_COUNT; i++) {
+        uint64_t alloc_rate = 0, free_rate = 0;
+
+        indigo_mem_tag_stats_get(i, &stats);
+        if (shown_time != 0 && elapsed > 0) {
+            alloc_rate = (stats.allocs - shown_stats[i].allocs) * 1000 / elapsed;
+            free_rate = (stats.frees - shown_stats[i].frees) * 1000 / elapsed;
+        }
+
+        aim_printf(pvs, "%-16s %12"PRIu64" %10"PRIu64" %12"PRIu64" %12"PRIu64
+                   " %8"PRIu64" %10"PRIu64" %10"PRIu64"\n",
+                   tag_names[i], stats.live_bytes, stats.live_objects,
+                   stats.allocs, stats.frees, stats.failures,
+                   alloc_rate, free_rate);
+        shown_stats[i] = stats;
+    }
+
+    shown_time = now;
+
+    pthread_once(&pools_once, pools_init);
+
+    aim_printf(pvs, "\n%-16s %10s %12s %12s\n",
+               "pool", "free", "hits", "misses");
+
+    for (i = 0; i < POOL_CLASSES; i++) {
+        struct pool *pool = &pools[i];
+        uint32_t free_count;
+        uint64_t hits, misses;
+
+        pthread_mutex_lock(&pool->lock);
+        free_count = pool->free_count;
+        hits = pool->hits;
+        misses = pool->misses;
+        pthread_mutex_unlock(&pool->lock);
+
+        aim_printf(pvs, "%-16zu %10u %12"PRIu64" %12"PRIu64"\n",
+                   pool_class_bytes(i), free_count, hits, misses);
+    }
+
+    for (i = 0; i < INDIGO_MEM_TAG_COUNT; i++) {
+        struct arena *arena = tag_arenas[i];
+        uint64_t hugetlb, thp, bind_failures;
+
+        if (arena == NULL) {
+            continue;
+        }
+
+        pthread_mutex_lock(&arena->lock);
+        hugetlb = arena->hugetlb_chunks;
+        thp = arena->thp_chunks;
+        bind_failures = arena->bind_failures;
+        pthread_mutex_unlock(&arena->lock);
+
+        aim_printf(pvs, "\narena %s: node %d, %"PRIu64" hugetlb chunks, "
+                   "%"PRIu64" thp chunks, %"PRIu64" bind failures\n",
+                   tag_names[i], arena->numa_node, hugetlb, thp,
+                   bind_failures);
+    }
+}
@@ -26,6 +26,7 @@
 
 #include <indigo/error.h>
 #include <indigo/memory.h>
+#include <indigo/binlog.h>
 #include <indigo/types.h>
 #include <indigo/time.h>
 #include <indigo/assert.h>
@@ -34,6 +35,8 @@
 #include <indigo/of_state_manager.h>
 #include <indigo/forwarding.h>
 #include <indigo/port_manager.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define AIM_LOG_MODULE_NAME indigo
 #include <AIM/aim_log.h>
@@ -48,10 +51,154 @@ AIM_LOG_STRUCT_DEFINE(
                       0x0   /* Initial custom flags */
                       );
 
+static int backend_allocs;
+
+static void *
+test_backend_alloc(size_t bytes, void *cookie)
+{
+    backend_allocs++;
+    return malloc(bytes);
+}
+
+static void
+test_backend_free(void *ptr, size_t bytes, void *cookie)
+{
+    free(ptr);
+}
+
+static void
+test_mem_tags(void)
+{
+    indigo_mem_backend_t backend = { test_backend_alloc, test_backend_free, NULL };
+    indigo_mem_tag_stats_t stats;
+    void *a, *b, *big;
+
+    indigo_mem_backend_set(&backend);
+
+    a = indigo_mem_tag_alloc(INDIGO_MEM_TAG_TASK, 100);
+    big = indigo_mem_tag_alloc(INDIGO_MEM_TAG_TASK, INDIGO_MEM_POOL_MAX_BYTES + 1);
+    INDIGO_ASSERT(a != NULL && big != NULL);
+    INDIGO_ASSERT(backend_allocs == 2);
+
+    indigo_mem_tag_stats_get(INDIGO_MEM_TAG_TASK, &stats);
+    INDIGO_ASSERT(stats.live_bytes == 100 + INDIGO_MEM_POOL_MAX_BYTES + 1);
+    INDIGO_ASSERT(stats.live_objects == 2);
+    INDIGO_ASSERT(stats.allocs == 2);
+
+    /* Same size class comes back from the pool */
+    indigo_mem_tag_free(INDIGO_MEM_TAG_TASK, a, 100);
+    b = indigo_mem_tag_alloc(INDIGO_MEM_TAG_FLOW_ENTRY, 120);
+    INDIGO_ASSERT(b == a);
+    INDIGO_ASSERT(backend_allocs == 2);
+
+    indigo_mem_tag_free(INDIGO_MEM_TAG_FLOW_ENTRY, b, 120);
+    indigo_mem_tag_free(INDIGO_MEM_TAG_TASK, big, INDIGO_MEM_POOL_MAX_BYTES + 1);
+
+    indigo_mem_tag_stats_get(INDIGO_MEM_TAG_TASK, &stats);
+    INDIGO_ASSERT(stats.live_bytes == 0 && stats.live_objects == 0);
+    INDIGO_ASSERT(stats.frees == 2);
+    indigo_mem_tag_stats_get(INDIGO_MEM_TAG_FLOW_ENTRY, &stats);
+    INDIGO_ASSERT(stats.allocs == 1 && stats.frees == 1);
+
+    indigo_mem_tag_note_alloc(INDIGO_MEM_TAG_CXN_BUFFER, 64);
+    indigo_mem_tag_stats_get(INDIGO_MEM_TAG_CXN_BUFFER, &stats);
+    INDIGO_ASSERT(stats.live_bytes == 64);
+    indigo_mem_tag_note_free(INDIGO_MEM_TAG_CXN_BUFFER, 64);
+
+    INDIGO_ASSERT(!strcmp(indigo_mem_tag_name(INDIGO_MEM_TAG_GENTABLE_ENTRY),
+                          "gentable_entry"));
+
+    indigo_mem_stats_show(&aim_pvs_stdout);
+
+    indigo_mem_backend_set(NULL);
+}
+
+static void
+test_mem_huge_pages(void)
+{
+    indigo_mem_tag_t tag = INDIGO_MEM_TAG_GENTABLE_ENTRY;
+    indigo_mem_tag_stats_t stats;
+    indigo_error_t rv;
+    void *a, *b, *c, *big;
+
+    /* Not while blocks from the pools are live */
+    a = indigo_mem_tag_alloc(tag, 100);
+    rv = indigo_mem_tag_huge_pages_set(tag, -1);
+    INDIGO_ASSERT(rv == INDIGO_ERROR_EXISTS);
+    indigo_mem_tag_free(tag, a, 100);
+
+    rv = indigo_mem_tag_huge_pages_set(tag, -1);
+    INDIGO_ASSERT(rv == INDIGO_ERROR_NONE);
+    rv = indigo_mem_tag_huge_pages_set(tag, -1);
+    INDIGO_ASSERT(rv == INDIGO_ERROR_NONE);
+
+    a = indigo_mem_tag_alloc(tag, 100);
+    b = indigo_mem_tag_alloc(tag, 5000);
+    big = indigo_mem_tag_alloc(tag, INDIGO_MEM_ARENA_MAX_BYTES + 1);
+    INDIGO_ASSERT(a != NULL && b != NULL && big != NULL);
+    INDIGO_ASSERT(((uintptr_t)a & 63) == 0 && ((uintptr_t)b & 63) == 0);
+    memset(a, 0xaa, 100);
+    memset(b, 0xbb, 5000);
+    memset(big, 0xcc, INDIGO_MEM_ARENA_MAX_BYTES + 1);
+
+    /* Blocks rounding to the same size are recycled */
+    indigo_mem_tag_free(tag, a, 100);
+    c = indigo_mem_tag_alloc(tag, 128);
+    INDIGO_ASSERT(c == a);
+    indigo_mem_tag_free(tag, c, 128);
+    indigo_mem_tag_free(tag, b, 5000);
+    c = indigo_mem_tag_alloc(tag, 8000);
+    INDIGO_ASSERT(c == b);
+    indigo_mem_tag_free(tag, c, 8000);
+    indigo_mem_tag_free(tag, big, INDIGO_MEM_ARENA_MAX_BYTES + 1);
+
+    indigo_mem_tag_stats_get(tag, &stats);
+    INDIGO_ASSERT(stats.live_bytes == 0 && stats.live_objects == 0);
+
+    indigo_mem_stats_show(&aim_pvs_stdout);
+}
+
+static int binlog_evaluated;
+
+static int
+binlog_arg(void)
+{
+    return ++binlog_evaluated;
+}
+
+static void
+binlog_sites(void)
+{
+    INDIGO_BINLOG("test %d of %s", binlog_arg(), "binlog");
+    INDIGO_BINLOG("no arguments");
+}
+
+static void
+test_binlog(void)
+{
+    /* Disabled sites do not evaluate their arguments */
+    binlog_sites();
+    INDIGO_ASSERT(binlog_evaluated == 0);
+
+    INDIGO_ASSERT(indigo_binlog_enable_set("utest/main.c", 1) == 2);
+    binlog_sites();
+    binlog_sites();
+    INDIGO_ASSERT(binlog_evaluated == 2);
+
+    indigo_binlog_sites_show(&aim_pvs_stdout);
+    indigo_binlog_show(&aim_pvs_stdout, 3);
+
+    INDIGO_ASSERT(indigo_binlog_enable_set("all", 0) == 2);
+    INDIGO_ASSERT(indigo_binlog_ring_size_set(0) == INDIGO_ERROR_NONE);
+}
+
 int
 main(int argc, char* argv[])
 {
     INDIGO_ASSERT(1==1);
+    test_mem_tags();
+    test_mem_huge_pages();
+    test_binlog();
     AIM_LOG_INFO("Okay.");
     return 0;
 }
@@ -0,0 +1,1032 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/******************************************************************************
+ *
+ *  /targets/benchmarks/OFConnectionManager/main.c
+ *
+ *  Controller session replay
+ *
+ *  Reads the controller to switch messages of a recorded session from a
+ *  pcap, such as one written from the trace ring by
+ *  ind_cxn_trace_ring_export, and replays them to a switch over TCP as
+ *  one or more controllers. Messages are sent at their recorded spacing
+ *  divided by a speedup factor, or as fast as the switch reads them.
+ *  Echo requests from the switch are answered so it keeps the sessions
+ *  up. Replies are matched to requests by xid; a barrier sent after the
+ *  last message marks when the switch has processed the whole session.
+ *
+ *  At the end the harness prints, per message type, how many were sent,
+ *  answered and refused with an error, the reply latency percentiles,
+ *  and the throughput of each session.
+ *
+ *****************************************************************************/
+
+#include <AIM/aim.h>
+#include <loci/loci.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define OF_HEADER_LENGTH 8
+#define OFPT_ERROR 1
+#define OFPT_ECHO_REQUEST 2
+#define OFPT_ECHO_REPLY 3
+#define OFPT_BARRIER_REQUEST(version) \
+    ((version) == OF_VERSION_1_0 ? 18 : 20)
+#define OFPT_STATS_REPLY(version) \
+    ((version) == OF_VERSION_1_0 ? 17 : 19)
+#define STATS_REPLY_FLAGS_OFFSET 10
+#define STATS_REPLY_FLAG_MORE 0x1
+
+/* Xid of the closing barrier; recorded sessions are unlikely to use it */
+#define REPLAY_BARRIER_XID 0xfffffff0
+
+#define REPLAY_READ_BUFFER_BYTES (1 << 17)
+#define REPLAY_SESSIONS_MAX 64
+#define REPLAY_FILES_MAX 16
+#define REPLAY_STREAMS_MAX 64
+
+/****************************************************************
+ * Recorded sessions
+ ****************************************************************/
+
+typedef struct replay_msg_s {
+    uint64_t time_us;           /* Since the first message */
+    uint8_t *data;
+    int len;
+    of_object_id_t object_id;
+} replay_msg_t;
+
+typedef struct replay_recording_s {
+    const char *filename;
+    replay_msg_t *msgs;
+    int count;
+} replay_recording_t;
+
+/* pcap file and record headers */
+struct pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+};
+
+struct pcap_rec_header {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+
+static int replay_controller_port;  /* 0 means 6633 or 6653 */
+static int replay_stream;           /* Which controller stream to use */
+
+static inline uint16_t
+get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t
+get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void
+put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline uint32_t
+swap32(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+static int
+is_controller_port(uint16_t port)
+{
+    if (replay_controller_port != 0) {
+        return port == replay_controller_port;
+    }
+    return port == 6633 || port == 6653;
+}
+
+static void
+recording_append(replay_recording_t *rec, int *size,
+                 const uint8_t *data, int len, uint64_t time_us)
+{
+    replay_msg_t *msg;
+
+    if (rec->count == *size) {
+        *size = *size ? *size * 2 : 1024;
+        rec->msgs = realloc(rec->msgs, *size * sizeof(*rec->msgs));
+        AIM_TRUE_OR_DIE(rec->msgs != NULL);
+    }
+
+    msg = &rec->msgs[rec->count++];
+    msg->time_us = time_us;
+    msg->len = len;
+    msg->data = malloc(len);
+    AIM_TRUE_OR_DIE(msg->data != NULL);
+    memcpy(msg->data, data, len);
+    msg->object_id = of_message_to_object_id((of_message_t)msg->data, len);
+}
+
+/**
+ * Load the controller to switch messages of one TCP stream
+ *
+ * Streams are numbered in the order their first packet from the
+ * controller port appears; the replay_stream'th is loaded. Its payloads
+ * are reassembled in sequence order, so messages may span packets;
+ * retransmitted data is skipped. Each message is stamped with the time
+ * of the packet that completes it.
+ */
+static int
+recording_load(replay_recording_t *rec)
+{
+    struct pcap_file_header fh;
+    struct pcap_rec_header rh;
+    struct {
+        uint32_t src, dst;
+        uint16_t sport, dport;
+    } streams[REPLAY_STREAMS_MAX];
+    uint8_t *frame = NULL, *stream = NULL;
+    uint32_t next_seq = 0;
+    uint64_t first_us = 0;
+    int num_streams = 0, have_stream = 0;
+    int stream_len = 0, stream_size = 0, size = 0;
+    int swapped, ns;
+    FILE *f;
+
+    if ((f = fopen(rec->filename, "r")) == NULL) {
+        fprintf(stderr, "%s: %s\n", rec->filename, strerror(errno));
+        return -1;
+    }
+
+    if (fread(&fh, sizeof(fh), 1, f) != 1) {
+        fprintf(stderr, "%s: not a pcap file\n", rec->filename);
+        fclose(f);
+        return -1;
+    }
+
+    swapped = fh.magic == swap32(PCAP_MAGIC_US) ||
+        fh.magic == swap32(PCAP_MAGIC_NS);
+    if (swapped) {
+        fh.magic = swap32(fh.magic);
+        fh.snaplen = swap32(fh.snaplen);
+        fh.network = swap32(fh.network);
+    }
+    if ((fh.magic != PCAP_MAGIC_US && fh.magic != PCAP_MAGIC_NS) ||
+        fh.network != PCAP_LINKTYPE_ETHERNET) {
+        fprintf(stderr, "%s: not an Ethernet pcap file\n", rec->filename);
+        fclose(f);
+        return -1;
+    }
+    ns = fh.magic == PCAP_MAGIC_NS;
+
+    frame = malloc(fh.snaplen);
+    AIM_TRUE_OR_DIE(frame != NULL);
+
+    while (fread(&rh, sizeof(rh), 1, f) == 1) {
+        const uint8_t *ip, *tcp, *payload;
+        uint16_t ethertype, sport, dport;
+        uint32_t src, dst, seq;
+        uint64_t time_us;
+        int ihl, payload_len, off, i;
+
+        if (swapped) {
+            rh.ts_sec = swap32(rh.ts_sec);
+            rh.ts_usec = swap32(rh.ts_usec);
+            rh.incl_len = swap32(rh.incl_len);
+        }
+        if (rh.incl_len > fh.snaplen ||
+            fread(frame, 1, rh.incl_len, f) != rh.incl_len) {
+            break;
+        }
+        time_us = (uint64_t)rh.ts_sec * 1000000 +
+            (ns ? rh.ts_usec / 1000 : rh.ts_usec);
+
+        /* Ethernet, optionally 802.1Q tagged, then IPv4 and TCP */
+        if (rh.incl_len < 14) {
+            continue;
+        }
+        off = 12;
+        ethertype = get16(frame + off);
+        if (ethertype == 0x8100 && rh.incl_len >= 18) {
+            off += 4;
+            ethertype = get16(frame + off);
+        }
+        ip = frame + off + 2;
+        if (ethertype != 0x0800 || ip + 20 > frame + rh.incl_len ||
+            ip[9] != 6) {
+            continue;
+        }
+        ihl = (ip[0] & 0xf) * 4;
+        tcp = ip + ihl;
+        if (tcp + 20 > frame + rh.incl_len) {
+            continue;
+        }
+        payload = tcp + (tcp[12] >> 4) * 4;
+        payload_len = (ip + get16(ip + 2)) - payload;
+        if (payload + payload_len > frame + rh.incl_len) {
+            payload_len = frame + rh.incl_len - payload;
+        }
+        if (payload_len <= 0) {
+            continue;
+        }
+
+        src = get32(ip + 12);
+        dst = get32(ip + 16);
+        sport = get16(tcp);
+        dport = get16(tcp + 2);
+        seq = get32(tcp + 4);
+
+        if (!is_controller_port(sport)) {
+            continue;
+        }
+
+        for (i = 0; i < num_streams; i++) {
+            if (streams[i].src == src && streams[i].dst == dst &&
+                streams[i].sport == sport && streams[i].dport == dport) {
+                break;
+            }
+        }
+        if (i == num_streams) {
+            if (num_streams == REPLAY_STREAMS_MAX) {
+                continue;
+            }
+            streams[i].src = src;
+            streams[i].dst = dst;
+            streams[i].sport = sport;
+            streams[i].dport = dport;
+            num_streams++;
+        }
+        if (i != replay_stream) {
+            continue;
+        }
+
+        if (!have_stream) {
+            have_stream = 1;
+            next_seq = seq;
+            first_us = time_us;
+        }
+
+        if ((int32_t)(seq - next_seq) < 0) {
+            /* Retransmission; take only the new bytes */
+            int skip = next_seq - seq;
+            if (skip >= payload_len) {
+                continue;
+            }
+            payload += skip;
+            payload_len -= skip;
+        } else if (seq != next_seq) {
+            fprintf(stderr, "%s: %u bytes missing from the stream, "
+                    "dropping a partial message\n",
+                    rec->filename, seq - next_seq);
+            stream_len = 0;
+        }
+        next_seq = seq + payload_len;
+
+        if (stream_len + payload_len > stream_size) {
+            stream_size = (stream_len + payload_len) * 2;
+            stream = realloc(stream, stream_size);
+            AIM_TRUE_OR_DIE(stream != NULL);
+        }
+        memcpy(stream + stream_len, payload, payload_len);
+        stream_len += payload_len;
+
+        /* Split off complete messages */
+        off = 0;
+        while (stream_len - off >= OF_HEADER_LENGTH) {
+            int len = get16(stream + off + 2);
+            if (len < OF_HEADER_LENGTH) {
+                fprintf(stderr, "%s: bad message length %d, dropping the "
+                        "rest of the stream buffer\n", rec->filename, len);
+                off = stream_len;
+                break;
+            }
+            if (stream_len - off < len) {
+                break;
+            }
+            recording_append(rec, &size, stream + off, len,
+                             time_us - first_us);
+            off += len;
+        }
+        memmove(stream, stream + off, stream_len - off);
+        stream_len -= off;
+    }
+
+    free(stream);
+    free(frame);
+    fclose(f);
+
+    if (rec->count == 0) {
+        fprintf(stderr, "%s: no controller messages found\n", rec->filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+/****************************************************************
+ * Statistics
+ ****************************************************************/
+
+typedef struct replay_type_stats_s {
+    uint64_t sent;
+    uint64_t replies;
+    uint64_t errors;
+    uint64_t *latency_us;       /* One per reply or error */
+    int latency_count;
+    int latency_size;
+} replay_type_stats_t;
+
+static replay_type_stats_t type_stats[OF_MESSAGE_OBJECT_COUNT];
+static uint64_t async_in;       /* Switch messages that are not replies */
+
+static void
+type_latency_add(of_object_id_t object_id, uint64_t us)
+{
+    replay_type_stats_t *stats = &type_stats[object_id];
+
+    if (stats->latency_count == stats->latency_size) {
+        stats->latency_size = stats->latency_size ?
+            stats->latency_size * 2 : 256;
+        stats->latency_us = realloc(stats->latency_us,
+                                    stats->latency_size * sizeof(uint64_t));
+        AIM_TRUE_OR_DIE(stats->latency_us != NULL);
+    }
+    stats->latency_us[stats->latency_count++] = us;
+}
+
+static int
+latency_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t
+latency_percentile(const uint64_t *sorted, int count, int percent)
+{
+    int rank = ((int64_t)count * percent + 99) / 100;
+    return sorted[rank < 1 ? 0 : rank - 1];
+}
+
+/****************************************************************
+ * Sessions
+ ****************************************************************/
+
+/* A request waiting for its reply */
+typedef struct replay_pending_s {
+    uint32_t xid;
+    int msg;                    /* Index in the recording */
+    uint64_t sent_ns;
+} replay_pending_t;
+
+typedef struct replay_session_s {
+    int id;
+    int fd;
+    const replay_recording_t *rec;
+    of_version_t version;
+
+    int next;                   /* Next message to send */
+    int offset;                 /* Bytes of it already written */
+    uint64_t start_ns;
+    uint64_t sent_bytes;
+
+    /* Requests by xid; the newest of two with the same xid wins */
+    replay_pending_t *pending;
+    uint32_t pending_mask;
+
+    /* Echo reply waiting for a message boundary */
+    uint8_t *reply;
+    int reply_len;
+    int reply_offset;
+
+    uint8_t barrier[OF_HEADER_LENGTH];
+    int barrier_offset;         /* -1 until the last message is sent */
+    uint64_t done_ns;
+
+    uint8_t *rbuf;
+    int rlen;
+} replay_session_t;
+
+static replay_session_t sessions[REPLAY_SESSIONS_MAX];
+static int num_sessions = 1;
+static double replay_speed = 1.0;   /* 0 means as fast as possible */
+static int replay_wait_ms = 5000;
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static replay_pending_t *
+pending_slot(replay_session_t *s, uint32_t xid)
+{
+    return &s->pending[(xid * 2654435761u) & s->pending_mask];
+}
+
+static void
+session_setup(replay_session_t *s, int id, int fd,
+              const replay_recording_t *rec)
+{
+    uint32_t slots = 1;
+    int one = 1;
+
+    while (slots < (uint32_t)rec->count * 2) {
+        slots <<= 1;
+    }
+
+    s->id = id;
+    s->fd = fd;
+    s->rec = rec;
+    s->version = of_message_version_get((of_message_t)rec->msgs[0].data);
+    s->pending = calloc(slots, sizeof(*s->pending));
+    s->pending_mask = slots - 1;
+    s->rbuf = malloc(REPLAY_READ_BUFFER_BYTES);
+    AIM_TRUE_OR_DIE(s->pending != NULL && s->rbuf != NULL);
+    s->barrier_offset = -1;
+
+    s->barrier[0] = s->version;
+    s->barrier[1] = OFPT_BARRIER_REQUEST(s->version);
+    s->barrier[2] = 0;
+    s->barrier[3] = OF_HEADER_LENGTH;
+    put32(s->barrier + 4, REPLAY_BARRIER_XID);
+
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    AIM_TRUE_OR_DIE(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+}
+
+/* Time the next message is due, on the now_ns clock */
+static uint64_t
+session_due_ns(const replay_session_t *s)
+{
+    if (replay_speed == 0 || s->next >= s->rec->count) {
+        return 0;
+    }
+    return s->start_ns +
+        (uint64_t)(s->rec->msgs[s->next].time_us * 1000 / replay_speed);
+}
+
+/**
+ * Write the rest of a buffer
+ * @returns 1 if blocked on the socket, 0 once all of it is written
+ */
+static int
+session_write(replay_session_t *s, const uint8_t *data, int len, int *offset)
+{
+    ssize_t rv;
+
+    while (*offset < len) {
+        rv = write(s->fd, data + *offset, len - *offset);
+        if (rv < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            AIM_DIE("session %d: write failed: %s", s->id, strerror(errno));
+        }
+        *offset += rv;
+        s->sent_bytes += rv;
+    }
+
+    return 0;
+}
+
+/**
+ * Write any echo reply, then due messages, until the socket is full
+ * @returns 1 if blocked on the socket
+ */
+static int
+session_send(replay_session_t *s, uint64_t now)
+{
+    const replay_recording_t *rec = s->rec;
+
+    if (s->reply_len > 0) {
+        if (session_write(s, s->reply, s->reply_len, &s->reply_offset)) {
+            return 1;
+        }
+        s->reply_len = s->reply_offset = 0;
+    }
+
+    while (s->next < rec->count) {
+        const replay_msg_t *msg = &rec->msgs[s->next];
+
+        if (s->offset == 0) {
+            uint32_t xid;
+            replay_pending_t *p;
+
+            if (session_due_ns(s) > now) {
+                return 0;
+            }
+
+            xid = of_message_xid_get((of_message_t)msg->data);
+            p = pending_slot(s, xid);
+            p->xid = xid;
+            p->msg = s->next;
+            p->sent_ns = now;
+            type_stats[msg->object_id].sent++;
+        }
+
+        if (session_write(s, msg->data, msg->len, &s->offset)) {
+            return 1;
+        }
+        s->offset = 0;
+        s->next++;
+
+        if (s->reply_len > 0) {
+            /* An echo request arrived while this message was written */
+            return session_send(s, now);
+        }
+    }
+
+    if (s->barrier_offset < 0) {
+        s->barrier_offset = 0;
+    }
+
+    return session_write(s, s->barrier, OF_HEADER_LENGTH,
+                         &s->barrier_offset);
+}
+
+/* Queue the reply to an echo request for the next message boundary */
+static void
+session_echo_reply(replay_session_t *s, const uint8_t *data, int len)
+{
+    if (s->reply_len > 0) {
+        /* The switch sends another if this one goes unanswered */
+        return;
+    }
+
+    s->reply = realloc(s->reply, len);
+    AIM_TRUE_OR_DIE(s->reply != NULL);
+    memcpy(s->reply, data, len);
+    s->reply[1] = OFPT_ECHO_REPLY;
+    s->reply_len = len;
+    s->reply_offset = 0;
+}
+
+static void
+session_message(replay_session_t *s, uint8_t *data, int len, uint64_t now)
+{
+    of_message_t msg = (of_message_t)data;
+    uint8_t type = of_message_type_get(msg);
+    uint32_t xid = of_message_xid_get(msg);
+    replay_pending_t *p;
+
+    if (type == OFPT_ECHO_REQUEST) {
+        session_echo_reply(s, data, len);
+        return;
+    }
+
+    if (xid == REPLAY_BARRIER_XID && s->barrier_offset >= 0 &&
+        type != OFPT_ERROR) {
+        s->done_ns = now;
+        return;
+    }
+
+    if (type == OFPT_STATS_REPLY(s->version) &&
+        len >= STATS_REPLY_FLAGS_OFFSET + 2 &&
+        (data[STATS_REPLY_FLAGS_OFFSET + 1] & STATS_REPLY_FLAG_MORE)) {
+        return;
+    }
+
+    p = pending_slot(s, xid);
+    if (p->sent_ns == 0 || p->xid != xid) {
+        async_in++;
+        return;
+    }
+
+    if (type == OFPT_ERROR) {
+        type_stats[s->rec->msgs[p->msg].object_id].errors++;
+    } else {
+        type_stats[s->rec->msgs[p->msg].object_id].replies++;
+    }
+    type_latency_add(s->rec->msgs[p->msg].object_id,
+                     (now - p->sent_ns) / 1000);
+    p->sent_ns = 0;
+}
+
+/**
+ * Read and handle switch messages
+ * @returns -1 if the switch closed the connection
+ */
+static int
+session_receive(replay_session_t *s, uint64_t now)
+{
+    ssize_t rv;
+    int off;
+
+    rv = read(s->fd, s->rbuf + s->rlen, REPLAY_READ_BUFFER_BYTES - s->rlen);
+    if (rv == 0) {
+        return -1;
+    }
+    if (rv < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return -1;
+    }
+    s->rlen += rv;
+
+    off = 0;
+    while (s->rlen - off >= OF_HEADER_LENGTH) {
+        int len = get16(s->rbuf + off + 2);
+        if (len < OF_HEADER_LENGTH) {
+            return -1;
+        }
+        if (s->rlen - off < len) {
+            break;
+        }
+        session_message(s, s->rbuf + off, len, now);
+        off += len;
+    }
+    memmove(s->rbuf, s->rbuf + off, s->rlen - off);
+    s->rlen -= off;
+
+    return 0;
+}
+
+static int
+session_finished(const replay_session_t *s)
+{
+    return s->fd < 0 || s->done_ns != 0;
+}
+
+/* Run every session until its closing barrier is answered */
+static void
+sessions_run(void)
+{
+    struct pollfd pfds[REPLAY_SESSIONS_MAX];
+    int blocked[REPLAY_SESSIONS_MAX] = { 0 };
+    uint64_t now = now_ns(), deadline = 0;
+    int i;
+
+    for (i = 0; i < num_sessions; i++) {
+        sessions[i].start_ns = now;
+    }
+
+    for (;;) {
+        uint64_t next_due = UINT64_MAX;
+        int running = 0, timeout_ms;
+
+        now = now_ns();
+        for (i = 0; i < num_sessions; i++) {
+            replay_session_t *s = &sessions[i];
+            uint64_t due;
+
+            pfds[i].fd = -1;
+            if (session_finished(s)) {
+                continue;
+            }
+            running++;
+
+            if (!blocked[i]) {
+                blocked[i] = session_send(s, now);
+            }
+
+            due = session_due_ns(s);
+            if (!blocked[i] && due != 0 && due < next_due) {
+                next_due = due;
+            }
+
+            pfds[i].fd = s->fd;
+            pfds[i].events = POLLIN | (blocked[i] ? POLLOUT : 0);
+            pfds[i].revents = 0;
+        }
+
+        if (running == 0) {
+            break;
+        }
+
+        /* Once everything is sent, wait a bounded time for the barriers */
+        if (deadline == 0) {
+            int all_sent = 1;
+            for (i = 0; i < num_sessions; i++) {
+                if (!session_finished(&sessions[i]) &&
+                    sessions[i].barrier_offset < OF_HEADER_LENGTH) {
+                    all_sent = 0;
+                }
+            }
+            if (all_sent) {
+                deadline = now + replay_wait_ms * 1000000ULL;
+            }
+        } else if (now >= deadline) {
+            fprintf(stderr, "Gave up waiting for barrier replies\n");
+            break;
+        }
+
+        if (next_due == UINT64_MAX) {
+            timeout_ms = 100;
+        } else {
+            timeout_ms = next_due > now ? (next_due - now) / 1000000 : 0;
+        }
+
+        if (poll(pfds, num_sessions, timeout_ms) < 0 && errno != EINTR) {
+            AIM_DIE("poll failed: %s", strerror(errno));
+        }
+
+        now = now_ns();
+        for (i = 0; i < num_sessions; i++) {
+            replay_session_t *s = &sessions[i];
+
+            if (pfds[i].fd < 0) {
+                continue;
+            }
+            if (pfds[i].revents & POLLOUT) {
+                blocked[i] = 0;
+            }
+            if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                session_receive(s, now) < 0) {
+                fprintf(stderr, "session %d: switch closed the connection "
+                        "after %d of %d messages\n",
+                        s->id, s->next, s->rec->count);
+                close(s->fd);
+                s->fd = -1;
+            }
+        }
+    }
+}
+
+/****************************************************************
+ * Connections
+ ****************************************************************/
+
+/* Connect to a switch listening for controllers */
+static int
+replay_connect(const char *target)
+{
+    char host[256];
+    const char *port = "6653";
+    const char *colon = strrchr(target, ':');
+    struct addrinfo hints, *res, *ai;
+    int fd = -1;
+
+    if (colon != NULL) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - target), target);
+        port = colon + 1;
+    } else {
+        snprintf(host, sizeof(host), "%s", target);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        fprintf(stderr, "Could not resolve %s\n", target);
+        return -1;
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        fprintf(stderr, "Could not connect to %s: %s\n",
+                target, strerror(errno));
+    }
+    return fd;
+}
+
+/* Accept connections from a switch configured with this controller */
+static int
+replay_listener(int port)
+{
+    struct sockaddr_in addr;
+    int fd, one = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    AIM_TRUE_OR_DIE(fd >= 0);
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, REPLAY_SESSIONS_MAX) < 0) {
+        fprintf(stderr, "Could not listen on port %d: %s\n",
+                port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/****************************************************************
+ * Main
+ ****************************************************************/
+
+static void
+report(void)
+{
+    uint64_t total_sent = 0, total_bytes = 0;
+    int i;
+
+    printf("%-32s %9s %9s %7s %9s %9s %9s %9s\n", "type", "sent",
+           "replies", "errors", "p50_us", "p90_us", "p99_us", "max_us");
+    for (i = 0; i < OF_MESSAGE_OBJECT_COUNT; i++) {
+        replay_type_stats_t *stats = &type_stats[i];
+        int n = stats->latency_count;
+
+        if (stats->sent == 0) {
+            continue;
+        }
+        printf("%-32s %9"PRIu64" %9"PRIu64" %7"PRIu64,
+               of_object_id_str[i], stats->sent, stats->replies,
+               stats->errors);
+        if (n > 0) {
+            qsort(stats->latency_us, n, sizeof(uint64_t), latency_compare);
+            printf(" %9"PRIu64" %9"PRIu64" %9"PRIu64" %9"PRIu64,
+                   latency_percentile(stats->latency_us, n, 50),
+                   latency_percentile(stats->latency_us, n, 90),
+                   latency_percentile(stats->latency_us, n, 99),
+                   stats->latency_us[n - 1]);
+        }
+        printf("\n");
+    }
+    printf("unsolicited messages from the switch: %"PRIu64"\n", async_in);
+
+    for (i = 0; i < num_sessions; i++) {
+        replay_session_t *s = &sessions[i];
+        uint64_t end = s->done_ns ? s->done_ns : now_ns();
+        double secs = (end - s->start_ns) / 1e9;
+
+        total_sent += s->next;
+        total_bytes += s->sent_bytes;
+        printf("session %d (%s): %d/%d messages, %.3f s, %.0f msgs/sec, "
+               "%.1f MB/s%s\n",
+               s->id, s->rec->filename, s->next, s->rec->count, secs,
+               secs > 0 ? s->next / secs : 0.0,
+               secs > 0 ? s->sent_bytes / secs / 1e6 : 0.0,
+               s->done_ns ? "" : " (not completed)");
+    }
+    printf("total: %"PRIu64" messages, %"PRIu64" bytes\n",
+           total_sent, total_bytes);
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s (-c host[:port] | -l port) [-n sessions] "
+            "[-x speed]\n"
+            "       [-p controller_port] [-s stream] [-w wait_ms] "
+            "file.pcap...\n"
+            "  -c  connect to a switch listening for controllers\n"
+            "  -l  accept connections from the switch on this port\n"
+            "  -n  concurrent sessions, each replaying a file in turn "
+            "(default 1)\n"
+            "  -x  speedup over the recorded pace, 0 for as fast as "
+            "possible (default 1)\n"
+            "  -p  controller TCP port in the recording "
+            "(default 6633 or 6653)\n"
+            "  -s  which controller stream in each file to replay "
+            "(default 0)\n"
+            "  -w  time to wait for the final barrier replies "
+            "(default %d ms)\n"
+            "A trace ring pcap comes from ind_cxn_trace_ring_export.\n",
+            prog, replay_wait_ms);
+}
+
+int
+main(int argc, char *argv[])
+{
+    replay_recording_t recordings[REPLAY_FILES_MAX];
+    const char *target = NULL;
+    int listen_port = 0, listen_fd = -1;
+    int num_recordings, c, i;
+
+    while ((c = getopt(argc, argv, "c:l:n:x:p:s:w:h")) != -1) {
+        switch (c) {
+        case 'c':
+            target = optarg;
+            break;
+        case 'l':
+            listen_port = atoi(optarg);
+            break;
+        case 'n':
+            num_sessions = atoi(optarg);
+            break;
+        case 'x':
+            replay_speed = atof(optarg);
+            break;
+        case 'p':
+            replay_controller_port = atoi(optarg);
+            break;
+        case 's':
+            replay_stream = atoi(optarg);
+            break;
+        case 'w':
+            replay_wait_ms = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    num_recordings = argc - optind;
+    if ((target == NULL) == (listen_port == 0) || num_recordings < 1 ||
+        num_recordings > REPLAY_FILES_MAX || num_sessions < 1 ||
+        num_sessions > REPLAY_SESSIONS_MAX || replay_speed < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(recordings, 0, sizeof(recordings));
+    for (i = 0; i < num_recordings; i++) {
+        recordings[i].filename = argv[optind + i];
+        if (recording_load(&recordings[i]) < 0) {
+            return 1;
+        }
+        printf("%s: %d messages over %.3f s\n", recordings[i].filename,
+               recordings[i].count,
+               recordings[i].msgs[recordings[i].count - 1].time_us / 1e6);
+    }
+
+    if (listen_port != 0 && (listen_fd = replay_listener(listen_port)) < 0) {
+        return 1;
+    }
+
+    for (i = 0; i < num_sessions; i++) {
+        int fd;
+
+        if (target != NULL) {
+            fd = replay_connect(target);
+        } else {
+            fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) {
+                fprintf(stderr, "accept failed: %s\n", strerror(errno));
+            }
+        }
+        if (fd < 0) {
+            return 1;
+        }
+        session_setup(&sessions[i], i, fd,
+                      &recordings[i % num_recordings]);
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+
+    sessions_run();
+    report();
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/**
+ * @file
+ * @brief Shared by the flow-mod (main.c), gentable (gentable.c),
+ * expiration (expire.c) and match scan (match.c) benchmarks
+ */
+
+#ifndef _OFSTATEMANAGER_BENCH_H_
+#define _OFSTATEMANAGER_BENCH_H_
+
+#include <indigo/types.h>
+#include <loci/loci.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Keys and values are one name TLV: 4 byte header, then the entry index */
+#define GENTABLE_BENCH_MIN_SIZE 8
+#define GENTABLE_BENCH_MAX_SIZE 32768
+
+typedef struct gentable_bench_config_s {
+    int entries;
+    int rounds;
+    int key_size;       /* Bytes of TLVs in each key */
+    int value_size;     /* Bytes of TLVs in each value */
+    int buckets_size;   /* Checksum buckets */
+} gentable_bench_config_t;
+
+/**
+ * Run the gentable benchmark on an initialized state manager
+ * @returns -1 if a phase left the table with the wrong entries
+ */
+int gentable_bench_run(const gentable_bench_config_t *config);
+
+/* Flow expiration timer period with -e, the expiration wheel's tick */
+#define EXPIRE_BENCH_CHECK_MS 100
+
+typedef struct expire_bench_config_s {
+    int flows;
+    int max_timeout;    /* Seconds */
+    int max_hits;       /* Hit status reads a flow is hit for */
+} expire_bench_config_t;
+
+/**
+ * Run the flow expiration benchmark on a state manager that expires flows
+ * @returns -1 if flows were left unexpired
+ */
+int expire_bench_run(const expire_bench_config_t *config);
+
+typedef struct match_bench_config_s {
+    int flows;
+    int queries;        /* Distinct queries per match mode */
+    int rounds;
+} match_bench_config_t;
+
+/**
+ * Run the flowtable match scan benchmark on an initialized state manager
+ * @returns -1 if the scalar and flat comparisons selected different entries
+ */
+int match_bench_run(const match_bench_config_t *config);
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Error replies sent so far */
+extern int bench_errors;
+
+/* Called by the forwarding stubs when set */
+extern void (*bench_flow_create_hook)(indigo_cookie_t flow_id,
+                                      of_flow_add_t *flow_add);
+extern void (*bench_flow_delete_hook)(indigo_cookie_t flow_id);
+extern bool (*bench_hit_status_hook)(indigo_cookie_t flow_id);
+
+/**
+ * Build the flow_mod of type object_id for flow idx, with cookie idx
+ * and the -m match shape
+ */
+of_object_t *bench_message(of_object_id_t object_id, int idx);
+
+/* Latency of the last message handled with each index */
+extern uint32_t *latency_ns;
+
+/**
+ * Pass a message with index idx to the state manager
+ *
+ * Its latency is recorded in latency_ns[idx] when it is released.
+ * idx must be less than the -n count.
+ */
+void handle_message(of_object_t *obj, int idx);
+
+/**
+ * Run the event loop until every handled message is released
+ */
+void do_barrier(void);
+
+/* qsort comparator for uint32_t samples */
+int latency_compare(const void *a, const void *b);
+
+uint32_t latency_percentile(const uint32_t *sorted, int count, int percent);
+
+/**
+ * Sort samples and print a result line for them, without a newline
+ */
+void latency_report(const char *name, uint32_t *samples, int count,
+                    uint64_t elapsed);
+
+/**
+ * Bytes allocated from the heap
+ */
+size_t heap_in_use(void);
+
+#endif /* _OFSTATEMANAGER_BENCH_H_ */
@@ -0,0 +1,332 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/******************************************************************************
+ *
+ *  /targets/benchmarks/OFStateManager/expire.c
+ *
+ *  OFStateManager flow expiration benchmark
+ *
+ *  Fills the flowtable with flows cycling through idle timeouts, hard
+ *  timeouts and both, then runs the event loop until every flow has
+ *  expired. The forwarding stub reports an idle flow hit for its first
+ *  few hit status reads, idx % (-H + 1) of them, so flows are refreshed
+ *  a varying number of times before going idle.
+ *
+ *  Reports the insert cost, the CPU the expiration task and timer take
+ *  per second, the flows per bulk hit status read, and how late flows
+ *  expire: the time indigo_fwd_flow_delete is called minus the time the
+ *  flow was due, the earlier of its hard timeout after insertion and its
+ *  idle timeout after its last hit.
+ *
+ *****************************************************************************/
+#define AIM_LOG_MODULE_NAME ofstatemanager_bench
+#include <AIM/aim_log.h>
+
+#include <SocketManager/socketmanager.h>
+#include <indigo/indigo.h>
+#include <indigo/time.h>
+#include <loci/loci.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <ft.h>
+#include "ofstatemanager_decs.h"
+#include "driver_stats.h"
+#include "bench.h"
+
+/* Beyond the longest a flow can live, before giving up */
+#define EXPIRE_SLACK_MS 2000
+
+static const expire_bench_config_t *config;
+
+/* Flow state mirroring the expiration engine's, by cookie */
+typedef struct expire_flow_s {
+    indigo_time_t insert_ms;
+    indigo_time_t active_ms;    /* Insertion or last hit */
+    uint16_t idle_timeout;
+    uint16_t hard_timeout;
+    int hits_left;
+    bool live;
+} expire_flow_t;
+
+static expire_flow_t *flows;
+static int flows_live;
+static int hit_reads;
+static int early;
+
+/* Expiry lateness in milliseconds */
+static uint32_t *idle_late_ms, *hard_late_ms;
+static int idle_late_count, hard_late_count;
+
+/* Forwarding is called before the entry leaves the flowtable */
+static expire_flow_t *
+expire_flow(indigo_cookie_t flow_id)
+{
+    ft_entry_t *entry = ft_lookup(ind_core_ft, flow_id);
+
+    AIM_TRUE_OR_DIE(entry != NULL && entry->cookie < config->flows);
+    return &flows[entry->cookie];
+}
+
+/****************************************************************
+ * Forwarding hooks
+ ****************************************************************/
+
+static void
+expire_flow_created(indigo_cookie_t flow_id, of_flow_add_t *flow_add)
+{
+    expire_flow_t *flow;
+    uint64_t cookie;
+
+    of_flow_add_cookie_get(flow_add, &cookie);
+    AIM_TRUE_OR_DIE(cookie < config->flows);
+    flow = &flows[cookie];
+    of_flow_add_idle_timeout_get(flow_add, &flow->idle_timeout);
+    of_flow_add_hard_timeout_get(flow_add, &flow->hard_timeout);
+    flow->insert_ms = flow->active_ms = INDIGO_CURRENT_TIME;
+    flow->hits_left = flow->idle_timeout ? cookie % (config->max_hits + 1) : 0;
+    flow->live = true;
+    flows_live++;
+}
+
+static void
+expire_flow_deleted(indigo_cookie_t flow_id)
+{
+    expire_flow_t *flow = expire_flow(flow_id);
+    indigo_time_t now = INDIGO_CURRENT_TIME;
+    indigo_time_t idle_at = -1, hard_at = -1, due;
+    uint32_t late;
+
+    if (!flow->live) {
+        return;
+    }
+    flow->live = false;
+    flows_live--;
+
+    if (flow->hard_timeout) {
+        hard_at = flow->insert_ms + flow->hard_timeout * 1000;
+    }
+    if (flow->idle_timeout) {
+        idle_at = flow->active_ms + flow->idle_timeout * 1000;
+    }
+    due = hard_at <= idle_at ? hard_at : idle_at;
+
+    if (now < due) {
+        early++;
+        late = 0;
+    } else {
+        late = now - due;
+    }
+
+    if (hard_at <= idle_at) {
+        hard_late_ms[hard_late_count++] = late;
+    } else {
+        idle_late_ms[idle_late_count++] = late;
+    }
+}
+
+static bool
+expire_hit_status(indigo_cookie_t flow_id)
+{
+    expire_flow_t *flow = expire_flow(flow_id);
+
+    hit_reads++;
+    if (flow->hits_left == 0) {
+        return false;
+    }
+
+    /* As the expiration engine does when it sees the hit */
+    flow->hits_left--;
+    flow->active_ms = ind_soc_loop_now();
+    return true;
+}
+
+/****************************************************************
+ * Measurement
+ ****************************************************************/
+
+/*
+ * Idle only, hard only, or both with the hard timeout later, so hits
+ * can refresh every kind with an idle timeout
+ */
+static of_object_t *
+expire_flow_add(int idx)
+{
+    of_object_t *obj = bench_message(OF_FLOW_ADD, idx);
+    int timeout = 1 + idx % config->max_timeout;
+    uint16_t idle = 0, hard = 0;
+
+    switch (idx % 3) {
+    case 0:
+        idle = timeout;
+        break;
+    case 1:
+        hard = timeout;
+        break;
+    case 2:
+        idle = timeout;
+        hard = timeout + 1 + (idx / 3) % config->max_timeout;
+        if (hard < idle) {
+            hard = 0xffff;
+        }
+        break;
+    }
+
+    of_flow_add_idle_timeout_set(obj, idle);
+    of_flow_add_hard_timeout_set(obj, hard);
+    return obj;
+}
+
+static void
+lateness_print(const char *name, uint32_t *samples, int count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    qsort(samples, count, sizeof(*samples), latency_compare);
+    printf("%-14s %9d flows  late p50 %5u ms  p90 %5u ms  p99 %5u ms  "
+           "max %5u ms\n",
+           name, count,
+           latency_percentile(samples, count, 50),
+           latency_percentile(samples, count, 90),
+           latency_percentile(samples, count, 99),
+           samples[count - 1]);
+}
+
+static uint64_t
+cpu_us(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+int
+expire_bench_run(const expire_bench_config_t *_config)
+{
+    ind_soc_stats_t soc_stats;
+    ind_core_driver_stats_t hit_stats;
+    const ind_soc_histogram_t *task_hist, *timer_hist;
+    of_object_t **msgs;
+    uint32_t *sorted;
+    uint64_t start, elapsed, cpu_start;
+    int longest_ms, idx, rv = 0;
+
+    config = _config;
+
+    flows = calloc(config->flows, sizeof(*flows));
+    idle_late_ms = calloc(config->flows, sizeof(*idle_late_ms));
+    hard_late_ms = calloc(config->flows, sizeof(*hard_late_ms));
+    msgs = calloc(config->flows, sizeof(*msgs));
+    sorted = calloc(config->flows, sizeof(*sorted));
+    AIM_TRUE_OR_DIE(flows != NULL && idle_late_ms != NULL &&
+                    hard_late_ms != NULL && msgs != NULL && sorted != NULL);
+
+    bench_flow_create_hook = expire_flow_created;
+    bench_flow_delete_hook = expire_flow_deleted;
+    bench_hit_status_hook = expire_hit_status;
+
+    printf("%d flows, timeouts up to %d s, up to %d hits, "
+           "expiration timer %d ms\n",
+           config->flows, config->max_timeout, config->max_hits,
+           EXPIRE_BENCH_CHECK_MS);
+
+    /* Insert cost */
+    for (idx = 0; idx < config->flows; idx++) {
+        msgs[idx] = expire_flow_add(idx);
+    }
+
+    start = now_ns();
+    for (idx = 0; idx < config->flows; idx++) {
+        handle_message(msgs[idx], idx);
+    }
+    do_barrier();
+    elapsed = now_ns() - start;
+
+    memcpy(sorted, latency_ns, config->flows * sizeof(*sorted));
+    latency_report("add", sorted, config->flows, elapsed);
+    printf("\n");
+
+    /* A flow lives at most max_hits + 1 idle timeouts, or a hard timeout */
+    longest_ms = config->max_timeout * 1000 *
+        (config->max_hits + 1 > 2 ? config->max_hits + 1 : 2);
+
+    ind_soc_stats_clear();
+    ind_core_driver_stats_clear();
+    cpu_start = cpu_us();
+    start = now_ns();
+    while (flows_live > 0 &&
+           now_ns() - start < (longest_ms + EXPIRE_SLACK_MS) * 1000000ULL) {
+        ind_soc_select_and_run(10);
+    }
+    elapsed = now_ns() - start;
+
+    ind_soc_stats_get(&soc_stats);
+    task_hist = &soc_stats.callback_duration[IND_SOC_CALLBACK_TYPE_TASK];
+    timer_hist = &soc_stats.callback_duration[IND_SOC_CALLBACK_TYPE_TIMER];
+    printf("expiration     %9.1f s  task %7.1f ms/sec  timer %5.1f ms/sec  "
+           "process %7.1f ms/sec  task runs %"PRIu64"  max %"PRIu64" us\n",
+           elapsed / 1e9,
+           task_hist->total_us * 1e6 / elapsed,
+           timer_hist->total_us * 1e6 / elapsed,
+           (cpu_us() - cpu_start) * 1e6 / elapsed,
+           task_hist->count, task_hist->max_us);
+
+    ind_core_driver_stats_get(IND_CORE_DRIVER_indigo_fwd_flow_hit_status_bulk_get,
+                              &hit_stats);
+    printf("hit status     %9d reads  %8"PRIu64" bulk calls  "
+           "%7.1f flows/call  p99 %"PRIu64" us\n",
+           hit_reads, hit_stats.calls,
+           hit_stats.calls ? (double)hit_reads / hit_stats.calls : 0.0,
+           ind_soc_histogram_percentile(&hit_stats.us, 99));
+
+    lateness_print("idle timeout", idle_late_ms, idle_late_count);
+    lateness_print("hard timeout", hard_late_ms, hard_late_count);
+
+    if (early > 0) {
+        AIM_LOG_ERROR("%d flows expired before they were due", early);
+        rv = -1;
+    }
+    if (flows_live > 0) {
+        AIM_LOG_ERROR("%d flows did not expire within %d ms",
+                      flows_live, longest_ms + EXPIRE_SLACK_MS);
+        rv = -1;
+    }
+
+    bench_flow_create_hook = NULL;
+    bench_flow_delete_hook = NULL;
+    bench_hit_status_hook = NULL;
+
+    free(sorted);
+    free(msgs);
+    free(hard_late_ms);
+    free(idle_late_ms);
+    free(flows);
+
+    return rv;
+}
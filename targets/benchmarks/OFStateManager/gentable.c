@@ -0,0 +1,496 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/******************************************************************************
+ *
+ *  /targets/benchmarks/OFStateManager/gentable.c
+ *
+ *  OFStateManager gentable scalability benchmark
+ *
+ *  Registers a gentable whose ops only count calls, then adds, modifies
+ *  and deletes every entry with bsn_gentable_entry_add and _delete
+ *  messages, reporting ops/sec and per-op latency like the flow-mod
+ *  phases. Between the modify and delete phases it times bucket stats
+ *  requests and full entry desc stats and entry stats requests, the
+ *  latter two being the iterator tasks a controller resync runs. While
+ *  each iteration runs a 1 ms timer measures how late other loop work is
+ *  run, compared to an idle loop. The add phase reports memory per
+ *  entry.
+ *
+ *****************************************************************************/
+#define AIM_LOG_MODULE_NAME ofstatemanager_bench
+#include <AIM/aim_log.h>
+
+#include <SocketManager/socketmanager.h>
+#include <indigo/indigo.h>
+#include <indigo/memory.h>
+#include <indigo/of_state_manager.h>
+#include <loci/loci.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+/* The core registers its "test" gentable first */
+#define BENCH_TABLE_ID 1
+
+/* Messages built at a time, to bound memory with millions of entries */
+#define BENCH_CHUNK 4096
+
+#define BENCH_BUCKET_STATS_REQUESTS 100
+
+#define BENCH_TIMER_PERIOD_MS 1
+#define BENCH_IDLE_MS 200
+
+static const gentable_bench_config_t *config;
+
+/* Table ops only count calls */
+static struct {
+    int adds;
+    int modifies;
+    int deletes;
+    int stats;
+} counts;
+
+/****************************************************************
+ * Table operations
+ ****************************************************************/
+
+static indigo_error_t
+bench_gentable_add(void *table_priv, of_list_bsn_tlv_t *key,
+                   of_list_bsn_tlv_t *value, void **entry_priv)
+{
+    counts.adds++;
+    *entry_priv = NULL;
+    return INDIGO_ERROR_NONE;
+}
+
+static indigo_error_t
+bench_gentable_modify(void *table_priv, void *entry_priv,
+                      of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *value)
+{
+    counts.modifies++;
+    return INDIGO_ERROR_NONE;
+}
+
+static indigo_error_t
+bench_gentable_delete(void *table_priv, void *entry_priv,
+                      of_list_bsn_tlv_t *key)
+{
+    counts.deletes++;
+    return INDIGO_ERROR_NONE;
+}
+
+static void
+bench_gentable_get_stats(void *table_priv, void *entry_priv,
+                         of_list_bsn_tlv_t *key, of_list_bsn_tlv_t *stats)
+{
+    counts.stats++;
+}
+
+static const indigo_core_gentable_ops_t bench_gentable_ops = {
+    .add = bench_gentable_add,
+    .modify = bench_gentable_modify,
+    .del = bench_gentable_delete,
+    .get_stats = bench_gentable_get_stats,
+};
+
+/****************************************************************
+ * Message generation
+ ****************************************************************/
+
+static uint8_t tlv_buf[GENTABLE_BENCH_MAX_SIZE];
+
+static inline uint64_t
+mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/*
+ * A TLV list of size bytes: one name TLV holding idx, then gen if there
+ * is room, padded with zeroes
+ */
+static of_list_bsn_tlv_t *
+bench_tlvs(int size, int idx, uint32_t gen)
+{
+    of_list_bsn_tlv_t *list;
+    of_object_t *tlv;
+    of_octets_t octets;
+
+    octets.data = tlv_buf;
+    octets.bytes = size - 4;
+    memset(tlv_buf, 0, octets.bytes);
+    put32(tlv_buf, idx);
+    if (octets.bytes >= 8) {
+        put32(tlv_buf + 4, gen);
+    }
+
+    list = of_list_bsn_tlv_new(OF_VERSION_1_3);
+    tlv = of_bsn_tlv_name_new(OF_VERSION_1_3);
+    AIM_TRUE_OR_DIE(list != NULL && tlv != NULL);
+    AIM_TRUE_OR_DIE(of_bsn_tlv_name_value_set(tlv, &octets) == 0);
+    AIM_TRUE_OR_DIE(of_list_append(list, tlv) == 0);
+    of_object_delete(tlv);
+
+    return list;
+}
+
+/* Entries spread evenly over the checksum buckets */
+static of_checksum_128_t
+bench_checksum(int idx, uint32_t gen)
+{
+    of_checksum_128_t checksum;
+
+    checksum.hi = mix64(((uint64_t)gen << 32) | (uint32_t)idx);
+    checksum.lo = mix64(checksum.hi);
+    return checksum;
+}
+
+/* Add entry idx with value and checksum generation gen */
+static of_object_t *
+bench_entry_add(int idx, uint32_t gen)
+{
+    of_object_t *obj = of_bsn_gentable_entry_add_new(OF_VERSION_1_3);
+    of_list_bsn_tlv_t *list;
+
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_bsn_gentable_entry_add_xid_set(obj, idx);
+    of_bsn_gentable_entry_add_table_id_set(obj, BENCH_TABLE_ID);
+    of_bsn_gentable_entry_add_checksum_set(obj, bench_checksum(idx, gen));
+
+    list = bench_tlvs(config->key_size, idx, 0);
+    AIM_TRUE_OR_DIE(of_bsn_gentable_entry_add_key_set(obj, list) == 0);
+    of_object_delete(list);
+
+    list = bench_tlvs(config->value_size, idx, gen);
+    AIM_TRUE_OR_DIE(of_bsn_gentable_entry_add_value_set(obj, list) == 0);
+    of_object_delete(list);
+
+    return obj;
+}
+
+static of_object_t *
+bench_entry_delete(int idx, uint32_t gen)
+{
+    of_object_t *obj = of_bsn_gentable_entry_delete_new(OF_VERSION_1_3);
+    of_list_bsn_tlv_t *list;
+
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_bsn_gentable_entry_delete_xid_set(obj, idx);
+    of_bsn_gentable_entry_delete_table_id_set(obj, BENCH_TABLE_ID);
+
+    list = bench_tlvs(config->key_size, idx, 0);
+    AIM_TRUE_OR_DIE(of_bsn_gentable_entry_delete_key_set(obj, list) == 0);
+    of_object_delete(list);
+
+    return obj;
+}
+
+/****************************************************************
+ * Entry phases
+ ****************************************************************/
+
+typedef struct bench_phase_s {
+    const char *name;
+    of_object_t *(*build)(int idx, uint32_t gen);
+    int *count;         /* Table op each message should cause */
+} bench_phase_t;
+
+static const bench_phase_t bench_phases[] = {
+    { "add",    bench_entry_add,    &counts.adds },
+    { "modify", bench_entry_add,    &counts.modifies },
+    { "delete", bench_entry_delete, &counts.deletes },
+};
+
+#define PHASE_ADD    (&bench_phases[0])
+#define PHASE_MODIFY (&bench_phases[1])
+#define PHASE_DELETE (&bench_phases[2])
+
+/**
+ * Send every entry's message and print the results
+ *
+ * Messages are built a chunk at a time outside the timed region.
+ */
+static int
+bench_phase_run(const bench_phase_t *phase, uint32_t gen)
+{
+    of_object_t *msgs[BENCH_CHUNK];
+    uint32_t *sorted;
+    uint64_t start, elapsed = 0;
+    int ops_before = *phase->count, errors = bench_errors;
+    int base, count, i;
+
+    sorted = calloc(config->entries, sizeof(*sorted));
+    AIM_TRUE_OR_DIE(sorted != NULL);
+
+    for (base = 0; base < config->entries; base += count) {
+        count = config->entries - base;
+        if (count > BENCH_CHUNK) {
+            count = BENCH_CHUNK;
+        }
+
+        for (i = 0; i < count; i++) {
+            msgs[i] = phase->build(base + i, gen);
+        }
+
+        start = now_ns();
+        for (i = 0; i < count; i++) {
+            handle_message(msgs[i], base + i);
+        }
+        do_barrier();
+        elapsed += now_ns() - start;
+    }
+
+    memcpy(sorted, latency_ns, config->entries * sizeof(*sorted));
+    latency_report(phase->name, sorted, config->entries, elapsed);
+    if (bench_errors != errors) {
+        printf("  %d errors", bench_errors - errors);
+    }
+    printf("\n");
+
+    free(sorted);
+
+    if (*phase->count - ops_before != config->entries) {
+        AIM_LOG_ERROR("%s: %d table ops, expected %d", phase->name,
+                      *phase->count - ops_before, config->entries);
+        return -1;
+    }
+
+    return 0;
+}
+
+/****************************************************************
+ * Stats requests
+ ****************************************************************/
+
+static void
+bucket_stats_run(void)
+{
+    uint32_t samples[BENCH_BUCKET_STATS_REQUESTS];
+    uint64_t start = now_ns();
+    of_object_t *obj;
+    int i;
+
+    for (i = 0; i < BENCH_BUCKET_STATS_REQUESTS; i++) {
+        obj = of_bsn_gentable_bucket_stats_request_new(OF_VERSION_1_3);
+        AIM_TRUE_OR_DIE(obj != NULL);
+        of_bsn_gentable_bucket_stats_request_xid_set(obj, i);
+        of_bsn_gentable_bucket_stats_request_table_id_set(obj, BENCH_TABLE_ID);
+        handle_message(obj, i);
+        do_barrier();
+        samples[i] = latency_ns[i];
+    }
+
+    latency_report("bucket_stats", samples, BENCH_BUCKET_STATS_REQUESTS,
+                   now_ns() - start);
+    printf("  %d buckets\n", config->buckets_size);
+}
+
+/* Lateness in microseconds of each run of the interference timer */
+static uint32_t *timer_late_us;
+static int timer_late_count;
+static int timer_late_alloc;
+static uint64_t timer_due_ns;
+
+static void
+timer_fired(void *cookie)
+{
+    uint64_t now = now_ns();
+
+    if (timer_late_count == timer_late_alloc) {
+        timer_late_alloc = timer_late_alloc ? timer_late_alloc * 2 : 1024;
+        timer_late_us = realloc(timer_late_us,
+                                timer_late_alloc * sizeof(*timer_late_us));
+        AIM_TRUE_OR_DIE(timer_late_us != NULL);
+    }
+
+    timer_late_us[timer_late_count++] =
+        now > timer_due_ns ? (now - timer_due_ns) / 1000 : 0;
+    timer_due_ns = now + BENCH_TIMER_PERIOD_MS * 1000000ULL;
+}
+
+static void
+timer_start(void)
+{
+    timer_late_count = 0;
+    timer_due_ns = now_ns() + BENCH_TIMER_PERIOD_MS * 1000000ULL;
+    AIM_TRUE_OR_DIE(ind_soc_timer_event_register_with_priority(
+                        timer_fired, NULL, BENCH_TIMER_PERIOD_MS,
+                        IND_SOC_DEFAULT_PRIORITY) == INDIGO_ERROR_NONE);
+}
+
+static void
+timer_stop(const char *name)
+{
+    ind_soc_timer_event_unregister(timer_fired, NULL);
+
+    if (timer_late_count == 0) {
+        printf("  %s: timer never ran\n", name);
+        return;
+    }
+
+    qsort(timer_late_us, timer_late_count, sizeof(*timer_late_us),
+          latency_compare);
+    printf("  %s: timer late p50 %u us  p99 %u us  max %u us  (%d runs)\n",
+           name,
+           latency_percentile(timer_late_us, timer_late_count, 50),
+           latency_percentile(timer_late_us, timer_late_count, 99),
+           timer_late_us[timer_late_count - 1], timer_late_count);
+}
+
+static void
+idle_run(void)
+{
+    uint64_t end = now_ns() + BENCH_IDLE_MS * 1000000ULL;
+
+    timer_start();
+    while (now_ns() < end) {
+        ind_soc_select_and_run(0);
+    }
+    timer_stop("idle");
+}
+
+/*
+ * Run one iterator task over every entry, timing it until the request is
+ * released after the last reply
+ */
+static void
+iter_run(const char *name, of_object_t *obj)
+{
+    uint64_t start, elapsed;
+
+    timer_start();
+    start = now_ns();
+    handle_message(obj, 0);
+    do_barrier();
+    elapsed = now_ns() - start;
+
+    printf("%-14s %9d entries %9.1f ms  %12.0f entries/sec\n",
+           name, config->entries, elapsed / 1e6,
+           elapsed ? (double)config->entries * 1e9 / elapsed : 0.0);
+    timer_stop(name);
+}
+
+static void
+resync_run(void)
+{
+    of_checksum_128_t zero = { 0, 0 };
+    of_object_t *obj;
+    int stats_before = counts.stats;
+
+    idle_run();
+
+    obj = of_bsn_gentable_entry_desc_stats_request_new(OF_VERSION_1_3);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_bsn_gentable_entry_desc_stats_request_table_id_set(obj, BENCH_TABLE_ID);
+    of_bsn_gentable_entry_desc_stats_request_checksum_set(obj, zero);
+    of_bsn_gentable_entry_desc_stats_request_checksum_mask_set(obj, zero);
+    iter_run("desc_stats", obj);
+
+    obj = of_bsn_gentable_entry_stats_request_new(OF_VERSION_1_3);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_bsn_gentable_entry_stats_request_table_id_set(obj, BENCH_TABLE_ID);
+    of_bsn_gentable_entry_stats_request_checksum_set(obj, zero);
+    of_bsn_gentable_entry_stats_request_checksum_mask_set(obj, zero);
+    iter_run("entry_stats", obj);
+
+    if (counts.stats - stats_before != config->entries) {
+        AIM_LOG_WARN("entry_stats: %d get_stats calls, expected %d",
+                     counts.stats - stats_before, config->entries);
+    }
+}
+
+/****************************************************************
+ * Driver
+ ****************************************************************/
+
+int
+gentable_bench_run(const gentable_bench_config_t *_config)
+{
+    indigo_core_gentable_t *gentable;
+    indigo_mem_tag_stats_t tag_stats;
+    of_table_name_t name = "bench";
+    size_t heap_before;
+    int round, rv = 0;
+
+    config = _config;
+
+    indigo_core_gentable_register(name, &bench_gentable_ops, NULL,
+                                  config->entries, config->buckets_size,
+                                  &gentable);
+
+    printf("%d gentable entries, %d byte keys, %d byte values, "
+           "%d checksum buckets\n",
+           config->entries, config->key_size, config->value_size,
+           config->buckets_size);
+
+    for (round = 0; round < config->rounds && rv == 0; round++) {
+        if (config->rounds > 1) {
+            printf("round %d\n", round + 1);
+        }
+
+        heap_before = heap_in_use();
+        if (bench_phase_run(PHASE_ADD, 0) < 0) {
+            rv = -1;
+            break;
+        }
+        indigo_mem_tag_stats_get(INDIGO_MEM_TAG_GENTABLE_ENTRY, &tag_stats);
+        printf("memory per entry: %.1f bytes gentable entries, "
+               "%.1f bytes heap\n",
+               (double)tag_stats.live_bytes / config->entries,
+               ((double)heap_in_use() - heap_before) / config->entries);
+
+        if (bench_phase_run(PHASE_MODIFY, 1) < 0) {
+            rv = -1;
+            break;
+        }
+
+        bucket_stats_run();
+        resync_run();
+
+        if (bench_phase_run(PHASE_DELETE, 1) < 0) {
+            rv = -1;
+        }
+    }
+
+    indigo_core_gentable_unregister(gentable);
+    free(timer_late_us);
+    timer_late_us = NULL;
+    timer_late_alloc = 0;
+
+    return rv;
+}
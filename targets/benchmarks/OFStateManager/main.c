@@ -0,0 +1,906 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/******************************************************************************
+ *
+ *  /targets/benchmarks/OFStateManager/main.c
+ *
+ *  OFStateManager flow-mod throughput benchmark
+ *
+ *  Fills the flowtable through indigo_core_receive_controller_message,
+ *  then modifies and deletes every flow, against forwarding and port
+ *  manager stubs that do nothing. Each phase reports ops/sec, per-op
+ *  latency percentiles measured from submission until the message is
+ *  released, and the add phase reports memory per flow.
+ *
+ *  With -g it runs the gentable benchmark in gentable.c instead, with
+ *  -e the flow expiration benchmark in expire.c, and with -s the
+ *  flowtable match scan benchmark in match.c.
+ *
+ *****************************************************************************/
+#define AIM_LOG_MODULE_NAME ofstatemanager_bench
+#include <AIM/aim_log.h>
+
+#include <OFStateManager/ofstatemanager.h>
+#include <OFStateManager/ofstatemanager_config.h>
+#include <SocketManager/socketmanager.h>
+#include <indigo/indigo.h>
+#include <indigo/memory.h>
+#include <indigo/of_connection_manager.h>
+#include <indigo/of_state_manager.h>
+#include <indigo/forwarding.h>
+#include <indigo/port_manager.h>
+#include <loci/loci.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include <ft.h>
+#include "ofstatemanager_decs.h"
+#include "bench.h"
+
+AIM_LOG_STRUCT_DEFINE(
+                      AIM_LOG_OPTIONS_DEFAULT,
+                      AIM_LOG_BITS_DEFAULT,
+                      NULL, /* Custom log map */
+                      0
+                      );
+
+/****************************************************************
+ * Settings
+ ****************************************************************/
+
+typedef enum bench_shape_e {
+    BENCH_SHAPE_EXACT,      /* in_port, IPv4 addresses, protocol, port */
+    BENCH_SHAPE_L2,         /* eth_dst only */
+    BENCH_SHAPE_PREFIX,     /* IPv4 destination /24 */
+} bench_shape_t;
+
+static const char *bench_shape_names[] = { "exact", "l2", "prefix" };
+
+static int bench_flows = 10000;
+static int bench_rounds = 1;
+static bench_shape_t bench_shape = BENCH_SHAPE_EXACT;
+static int bench_priorities = 1;
+static int bench_check_overlap;
+static int bench_batch;
+static int bench_barrier_every;
+static int bench_gentable;
+static int bench_expire;
+static int bench_match_scan;
+static match_bench_config_t match_config = {
+    .queries = 128,
+};
+static expire_bench_config_t expire_config = {
+    .max_timeout = 5,
+    .max_hits = 2,
+};
+static gentable_bench_config_t gentable_config = {
+    .key_size = 16,
+    .value_size = 32,
+    .buckets_size = 65536,
+};
+
+#define BENCH_BASE_PRIORITY 1000
+
+#define ARRAY_SIZE(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/****************************************************************
+ * Stubs
+ ****************************************************************/
+
+static int fwd_batch_ops;
+int bench_errors;
+
+void (*bench_flow_create_hook)(indigo_cookie_t flow_id, of_flow_add_t *flow_add);
+void (*bench_flow_delete_hook)(indigo_cookie_t flow_id);
+bool (*bench_hit_status_hook)(indigo_cookie_t flow_id);
+
+indigo_error_t
+indigo_fwd_flow_create(indigo_cookie_t flow_id,
+                       of_flow_add_t *flow_add,
+                       uint8_t *table_id)
+{
+    if (bench_flow_create_hook) {
+        bench_flow_create_hook(flow_id, flow_add);
+    }
+    *table_id = 0;
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_flow_modify(indigo_cookie_t flow_id,
+                       of_flow_modify_t *flow_modify)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_flow_delete(indigo_cookie_t flow_id,
+                       indigo_fi_flow_stats_t *flow_stats)
+{
+    if (bench_flow_delete_hook) {
+        bench_flow_delete_hook(flow_id);
+    }
+    memset(flow_stats, 0, sizeof(*flow_stats));
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_flow_batch_begin(void)
+{
+    return bench_batch ? INDIGO_ERROR_NONE : INDIGO_ERROR_NOT_SUPPORTED;
+}
+
+indigo_error_t
+indigo_fwd_flow_batch_create(indigo_cookie_t flow_id,
+                             of_flow_add_t *flow_add)
+{
+    if (bench_flow_create_hook) {
+        bench_flow_create_hook(flow_id, flow_add);
+    }
+    fwd_batch_ops++;
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_flow_batch_modify(indigo_cookie_t flow_id,
+                             of_flow_modify_t *flow_modify)
+{
+    fwd_batch_ops++;
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_fwd_flow_batch_commit(indigo_fwd_flow_batch_result_t *results,
+                             int num_results)
+{
+    int i;
+
+    for (i = 0; i < num_results; i++) {
+        results[i].status = INDIGO_ERROR_NONE;
+        results[i].table_id = 0;
+    }
+    fwd_batch_ops = 0;
+}
+
+indigo_error_t
+indigo_fwd_flow_stats_get(indigo_cookie_t flow_id,
+                          indigo_fi_flow_stats_t *flow_stats)
+{
+    memset(flow_stats, 0, sizeof(*flow_stats));
+    flow_stats->flow_id = flow_id;
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_flow_hit_status_get(indigo_cookie_t flow_id,
+                               bool *is_hit)
+{
+    *is_hit = bench_hit_status_hook ? bench_hit_status_hook(flow_id) : 0;
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_table_stats_get(of_table_stats_request_t *request,
+                           of_table_stats_reply_t **reply)
+{
+    *reply = of_table_stats_reply_new(request->version);
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_packet_out(of_packet_out_t *of_packet_out)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_fwd_packet_out_batch(of_packet_out_t **packet_outs,
+                            int num_packet_outs)
+{
+}
+
+indigo_error_t
+indigo_fwd_forwarding_features_get(of_features_reply_t *features)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_experimenter(of_experimenter_t *experimenter,
+                        indigo_cxn_id_t cxn_id)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_expiration_enable_set(int is_enabled)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_expiration_enable_get(int *is_enabled)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_group_add(uint32_t id, uint8_t group_type, of_list_bucket_t *buckets)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_fwd_group_modify(uint32_t id, of_list_bucket_t *buckets)
+{
+    return INDIGO_ERROR_NOT_SUPPORTED;
+}
+
+void
+indigo_fwd_group_delete(uint32_t id)
+{
+}
+
+void
+indigo_fwd_group_stats_get(uint32_t id, of_group_stats_entry_t *entry)
+{
+}
+
+void
+indigo_fwd_pipeline_get(of_desc_str_t pipeline)
+{
+    strcpy(pipeline, "bench");
+}
+
+indigo_error_t
+indigo_fwd_pipeline_set(of_desc_str_t pipeline)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_fwd_pipeline_stats_get(of_desc_str_t **pipeline, int *num_pipelines)
+{
+    *num_pipelines = 0;
+}
+
+indigo_error_t
+indigo_port_features_get(of_features_reply_t *features)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_port_desc_stats_get(of_port_desc_stats_reply_t *port_desc_stats_reply)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_port_modify(of_port_mod_t *port_mod)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_port_stats_get(of_port_stats_request_t *request,
+                      of_port_stats_reply_t **reply_ptr)
+{
+    *reply_ptr = of_port_stats_reply_new(request->version);
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_port_queue_config_get(of_queue_get_config_request_t *request,
+                             of_queue_get_config_reply_t **reply_ptr)
+{
+    *reply_ptr = of_queue_get_config_reply_new(request->version);
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_port_queue_stats_get(of_queue_stats_request_t *request,
+                            of_queue_stats_reply_t **reply_ptr)
+{
+    *reply_ptr = of_queue_stats_reply_new(request->version);
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_port_experimenter(of_experimenter_t *experimenter,
+                         indigo_cxn_id_t cxn_id)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_port_interface_list(indigo_port_info_t **list)
+{
+    *list = NULL;
+    return INDIGO_ERROR_NONE;
+}
+
+void
+indigo_port_interface_list_destroy(indigo_port_info_t *list)
+{
+}
+
+void
+ind_cxn_reset(indigo_cxn_id_t cxn_id)
+{
+}
+
+void
+indigo_cxn_send_error_reply(indigo_cxn_id_t cxn_id, of_object_t *orig,
+                            uint16_t type, uint16_t code)
+{
+    bench_errors++;
+}
+
+void
+indigo_cxn_send_controller_message(indigo_cxn_id_t cxn_id, of_object_t *obj)
+{
+    of_object_delete(obj);
+}
+
+void
+indigo_cxn_send_async_message(of_object_t *obj)
+{
+    of_object_delete(obj);
+}
+
+void
+indigo_cxn_send_async_messages(of_object_t **objs, int num_objs)
+{
+    int i;
+
+    for (i = 0; i < num_objs; i++) {
+        of_object_delete(objs[i]);
+    }
+}
+
+indigo_error_t
+indigo_cxn_status_change_register(indigo_cxn_status_change_f handler,
+                                  void *cookie)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+indigo_cxn_status_change_unregister(indigo_cxn_status_change_f handler,
+                                    void *cookie)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+int
+indigo_cxn_output_blocked(indigo_cxn_id_t cxn_id)
+{
+    return 0;
+}
+
+indigo_error_t
+indigo_cxn_output_wait(indigo_cxn_id_t cxn_id,
+                       indigo_cxn_output_ready_f callback, void *cookie)
+{
+    return INDIGO_ERROR_NOT_FOUND;
+}
+
+indigo_error_t
+indigo_cxn_get_async_version(of_version_t *ver)
+{
+    *ver = OF_VERSION_1_0;
+    return INDIGO_ERROR_NONE;
+}
+
+indigo_error_t
+ind_cxn_message_track_setup(indigo_cxn_id_t cxn_id, of_object_t *obj)
+{
+    return INDIGO_ERROR_NONE;
+}
+
+/****************************************************************
+ * Message generation
+ ****************************************************************/
+
+/* Match of flow idx; distinct flows never overlap */
+static void
+bench_match(int idx, of_match_t *match)
+{
+    memset(match, 0, sizeof(*match));
+
+    switch (bench_shape) {
+    case BENCH_SHAPE_EXACT:
+        match->fields.in_port = 1 + (idx & 0x3f);
+        match->masks.in_port = 0xffffffff;
+        match->fields.eth_type = 0x0800;
+        match->masks.eth_type = 0xffff;
+        match->fields.ipv4_src = 0x0a000000 | (idx >> 6);
+        match->masks.ipv4_src = 0xffffffff;
+        match->fields.ipv4_dst = 0x0b000000 | (idx & 0xffffff);
+        match->masks.ipv4_dst = 0xffffffff;
+        match->fields.ip_proto = 6;
+        match->masks.ip_proto = 0xff;
+        match->fields.tcp_dst = idx & 0xffff;
+        match->masks.tcp_dst = 0xffff;
+        break;
+    case BENCH_SHAPE_L2:
+        match->fields.eth_dst.addr[0] = 0x02;
+        match->fields.eth_dst.addr[2] = idx >> 24;
+        match->fields.eth_dst.addr[3] = idx >> 16;
+        match->fields.eth_dst.addr[4] = idx >> 8;
+        match->fields.eth_dst.addr[5] = idx;
+        memset(&match->masks.eth_dst, 0xff, sizeof(match->masks.eth_dst));
+        break;
+    case BENCH_SHAPE_PREFIX:
+        match->fields.eth_type = 0x0800;
+        match->masks.eth_type = 0xffff;
+        match->fields.ipv4_dst = (uint32_t)idx << 8;
+        match->masks.ipv4_dst = 0xffffff00;
+        break;
+    }
+}
+
+static inline uint16_t
+bench_priority(int idx)
+{
+    return BENCH_BASE_PRIORITY + idx % bench_priorities;
+}
+
+/* Build the flow_mod of type object_id for flow idx */
+of_object_t *
+bench_message(of_object_id_t object_id, int idx)
+{
+    of_match_t match;
+    of_object_t *obj = NULL;
+    uint16_t flags = 0;
+
+    bench_match(idx, &match);
+
+    switch (object_id) {
+    case OF_FLOW_ADD:
+        obj = of_flow_add_new(OF_VERSION_1_0);
+        if (bench_check_overlap) {
+            flags = OF_FLOW_MOD_FLAG_CHECK_OVERLAP_BY_VERSION(OF_VERSION_1_0);
+        }
+        of_flow_add_xid_set(obj, idx);
+        of_flow_add_cookie_set(obj, idx);
+        of_flow_add_priority_set(obj, bench_priority(idx));
+        of_flow_add_flags_set(obj, flags);
+        AIM_TRUE_OR_DIE(of_flow_add_match_set(obj, &match) == 0);
+        break;
+    case OF_FLOW_MODIFY:
+        obj = of_flow_modify_new(OF_VERSION_1_0);
+        of_flow_modify_xid_set(obj, idx);
+        of_flow_modify_out_port_set(obj, OF_PORT_DEST_WILDCARD);
+        AIM_TRUE_OR_DIE(of_flow_modify_match_set(obj, &match) == 0);
+        break;
+    case OF_FLOW_MODIFY_STRICT:
+        obj = of_flow_modify_strict_new(OF_VERSION_1_0);
+        of_flow_modify_strict_xid_set(obj, idx);
+        of_flow_modify_strict_cookie_set(obj, idx);
+        of_flow_modify_strict_priority_set(obj, bench_priority(idx));
+        of_flow_modify_strict_out_port_set(obj, OF_PORT_DEST_WILDCARD);
+        AIM_TRUE_OR_DIE(of_flow_modify_strict_match_set(obj, &match) == 0);
+        break;
+    case OF_FLOW_DELETE:
+        obj = of_flow_delete_new(OF_VERSION_1_0);
+        of_flow_delete_xid_set(obj, idx);
+        of_flow_delete_out_port_set(obj, OF_PORT_DEST_WILDCARD);
+        AIM_TRUE_OR_DIE(of_flow_delete_match_set(obj, &match) == 0);
+        break;
+    case OF_FLOW_DELETE_STRICT:
+        obj = of_flow_delete_strict_new(OF_VERSION_1_0);
+        of_flow_delete_strict_xid_set(obj, idx);
+        of_flow_delete_strict_priority_set(obj, bench_priority(idx));
+        of_flow_delete_strict_out_port_set(obj, OF_PORT_DEST_WILDCARD);
+        AIM_TRUE_OR_DIE(of_flow_delete_strict_match_set(obj, &match) == 0);
+        break;
+    default:
+        AIM_DIE("unexpected object %s", of_object_id_str[object_id]);
+    }
+
+    AIM_TRUE_OR_DIE(obj != NULL);
+    return obj;
+}
+
+/****************************************************************
+ * Measurement
+ ****************************************************************/
+
+/*
+ * Submission time and latency of each flow's message in the current
+ * phase. A message is done when the state manager releases it, which
+ * for batched flow_mods is after the batch is committed.
+ */
+static uint64_t *submit_ns;
+uint32_t *latency_ns;
+static int outstanding_op_cnt;
+
+static void
+message_deleted(of_object_t *obj)
+{
+    int idx = (int)(uintptr_t)obj->track_info.delete_cookie;
+
+    latency_ns[idx] = now_ns() - submit_ns[idx];
+    outstanding_op_cnt--;
+}
+
+void
+handle_message(of_object_t *obj, int idx)
+{
+    outstanding_op_cnt++;
+    obj->track_info.delete_cb = message_deleted;
+    obj->track_info.delete_cookie = (void *)(uintptr_t)idx;
+    submit_ns[idx] = now_ns();
+    indigo_core_receive_controller_message(0, obj);
+}
+
+void
+do_barrier(void)
+{
+    while (outstanding_op_cnt > 0) {
+        ind_soc_select_and_run(0);
+    }
+}
+
+int
+latency_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Percentile of a sorted sample, nearest rank */
+uint32_t
+latency_percentile(const uint32_t *sorted, int count, int percent)
+{
+    int rank = ((int64_t)count * percent + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+size_t
+heap_in_use(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return mallinfo().uordblks;
+#endif
+}
+
+void
+latency_report(const char *name, uint32_t *samples, int count,
+               uint64_t elapsed)
+{
+    qsort(samples, count, sizeof(*samples), latency_compare);
+
+    printf("%-14s %9d ops %12.0f ops/sec  p50 %7u ns  p90 %7u ns  "
+           "p99 %7u ns  max %9u ns",
+           name, count,
+           elapsed ? (double)count * 1e9 / elapsed : 0.0,
+           latency_percentile(samples, count, 50),
+           latency_percentile(samples, count, 90),
+           latency_percentile(samples, count, 99),
+           samples[count - 1]);
+}
+
+typedef struct bench_phase_s {
+    const char *name;
+    of_object_id_t object_id;
+    int first;          /* First flow index */
+    int step;           /* Flow index stride */
+    int flow_delta;     /* Change in flowtable size per op */
+} bench_phase_t;
+
+static const bench_phase_t bench_phases[] = {
+    { "add",           OF_FLOW_ADD,           0, 1,  1 },
+    { "modify",        OF_FLOW_MODIFY,        0, 1,  0 },
+    { "modify_strict", OF_FLOW_MODIFY_STRICT, 0, 1,  0 },
+    { "delete_strict", OF_FLOW_DELETE_STRICT, 0, 2, -1 },
+    { "delete",        OF_FLOW_DELETE,        1, 2, -1 },
+};
+
+/**
+ * Run one phase and print its results
+ *
+ * Messages are built before the clock starts so only the state
+ * manager's handling is measured.
+ */
+static int
+bench_phase_run(const bench_phase_t *phase)
+{
+    ft_status_t *status = FT_STATUS(ind_core_ft);
+    int flows_before = status->current_count;
+    of_object_t **msgs;
+    uint32_t *sorted;
+    uint64_t start, elapsed;
+    int count = 0, errors = bench_errors;
+    int idx, i;
+
+    msgs = calloc(bench_flows, sizeof(*msgs));
+    sorted = calloc(bench_flows, sizeof(*sorted));
+    AIM_TRUE_OR_DIE(msgs != NULL && sorted != NULL);
+
+    for (idx = phase->first; idx < bench_flows; idx += phase->step) {
+        msgs[count++] = bench_message(phase->object_id, idx);
+    }
+
+    start = now_ns();
+    for (i = 0, idx = phase->first; i < count; i++, idx += phase->step) {
+        handle_message(msgs[i], idx);
+        if (bench_barrier_every > 0 && (i + 1) % bench_barrier_every == 0) {
+            do_barrier();
+        }
+    }
+    do_barrier();
+    elapsed = now_ns() - start;
+
+    for (i = 0, idx = phase->first; i < count; i++, idx += phase->step) {
+        sorted[i] = latency_ns[idx];
+    }
+    latency_report(phase->name, sorted, count, elapsed);
+    if (bench_errors != errors) {
+        printf("  %d errors", bench_errors - errors);
+    }
+    printf("\n");
+
+    free(sorted);
+    free(msgs);
+
+    if (bench_errors == errors &&
+        status->current_count != flows_before + count * phase->flow_delta) {
+        AIM_LOG_ERROR("%s: flowtable has %d entries, expected %d",
+                      phase->name, status->current_count,
+                      flows_before + count * phase->flow_delta);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n flows] [-r rounds] [-m exact|l2|prefix]\n"
+            "       [-p priorities] [-o] [-b] [-B ops]\n"
+            "       %s -g [-n entries] [-r rounds] [-k bytes] [-v bytes] "
+            "[-u buckets]\n"
+            "       %s -e [-n flows] [-m shape] [-b] [-T seconds] [-H hits]\n"
+            "       %s -s [-n flows] [-r rounds] [-q queries]\n"
+            "  -n  flows or gentable entries in the table (default %d)\n"
+            "  -r  rounds of all phases (default %d)\n"
+            "  -m  match shape (default %s)\n"
+            "  -p  number of distinct priorities flows cycle through "
+            "(default %d)\n"
+            "  -o  set the check overlap flag on flow adds\n"
+            "  -b  let forwarding batch flow adds and modifies\n"
+            "  -B  wait for completion every this many ops (default off)\n"
+            "  -g  benchmark a gentable instead of the flowtable\n"
+            "  -k  gentable key bytes, at least %d (default %d)\n"
+            "  -v  gentable value bytes, at least %d (default %d)\n"
+            "  -u  gentable checksum buckets, a power of 2 (default %d)\n"
+            "  -e  benchmark flow expiration instead of flow-mods\n"
+            "  -T  longest idle or hard timeout in seconds (default %d)\n"
+            "  -H  most hit status reads a flow is hit for (default %d)\n"
+            "  -s  benchmark flowtable match scans instead of flow-mods\n"
+            "  -q  scan queries per match mode (default %d)\n",
+            prog, prog, prog, prog, bench_flows, bench_rounds,
+            bench_shape_names[bench_shape], bench_priorities,
+            GENTABLE_BENCH_MIN_SIZE, gentable_config.key_size,
+            GENTABLE_BENCH_MIN_SIZE, gentable_config.value_size,
+            gentable_config.buckets_size,
+            expire_config.max_timeout, expire_config.max_hits,
+            match_config.queries);
+}
+
+static int
+parse_args(int argc, char *argv[])
+{
+    int c, i;
+
+    while ((c = getopt(argc, argv, "n:r:m:p:obB:gk:v:u:eT:H:sq:h")) != -1) {
+        switch (c) {
+        case 'n':
+            bench_flows = atoi(optarg);
+            break;
+        case 'r':
+            bench_rounds = atoi(optarg);
+            break;
+        case 'm':
+            for (i = 0; i < ARRAY_SIZE(bench_shape_names); i++) {
+                if (!strcmp(optarg, bench_shape_names[i])) {
+                    break;
+                }
+            }
+            if (i == ARRAY_SIZE(bench_shape_names)) {
+                return -1;
+            }
+            bench_shape = i;
+            break;
+        case 'p':
+            bench_priorities = atoi(optarg);
+            break;
+        case 'o':
+            bench_check_overlap = 1;
+            break;
+        case 'b':
+            bench_batch = 1;
+            break;
+        case 'B':
+            bench_barrier_every = atoi(optarg);
+            break;
+        case 'g':
+            bench_gentable = 1;
+            break;
+        case 'k':
+            gentable_config.key_size = atoi(optarg);
+            break;
+        case 'v':
+            gentable_config.value_size = atoi(optarg);
+            break;
+        case 'u':
+            gentable_config.buckets_size = atoi(optarg);
+            break;
+        case 'e':
+            bench_expire = 1;
+            break;
+        case 'T':
+            expire_config.max_timeout = atoi(optarg);
+            break;
+        case 'H':
+            expire_config.max_hits = atoi(optarg);
+            break;
+        case 's':
+            bench_match_scan = 1;
+            break;
+        case 'q':
+            match_config.queries = atoi(optarg);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    /* Flow indexes must stay distinct in every match shape */
+    if (bench_flows < 2 || bench_flows > (1 << 24) ||
+        bench_rounds < 1 || bench_priorities < 1 ||
+        bench_priorities > 0xffff - BENCH_BASE_PRIORITY) {
+        return -1;
+    }
+
+    if (gentable_config.key_size < GENTABLE_BENCH_MIN_SIZE ||
+        gentable_config.value_size < GENTABLE_BENCH_MIN_SIZE ||
+        gentable_config.key_size + gentable_config.value_size >
+        GENTABLE_BENCH_MAX_SIZE ||
+        gentable_config.buckets_size < 1 ||
+        (gentable_config.buckets_size & (gentable_config.buckets_size - 1))) {
+        return -1;
+    }
+
+    if (expire_config.max_timeout < 1 || expire_config.max_timeout > 0xffff ||
+        expire_config.max_hits < 0) {
+        return -1;
+    }
+
+    if (match_config.queries < 1 ||
+        bench_gentable + bench_expire + bench_match_scan > 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+aim_main(int argc, char* argv[])
+{
+    ind_core_config_t core;
+    ind_soc_config_t soc_cfg = { 0 };
+    indigo_mem_tag_stats_t tag_stats;
+    size_t heap_before;
+    int round, i, rv = 0;
+
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    submit_ns = calloc(bench_flows, sizeof(*submit_ns));
+    latency_ns = calloc(bench_flows, sizeof(*latency_ns));
+    AIM_TRUE_OR_DIE(submit_ns != NULL && latency_ns != NULL);
+
+    ind_soc_init(&soc_cfg);
+    ind_soc_enable_set(1);
+
+    memset(&core, 0, sizeof(core));
+    core.expire_flows = bench_expire;
+    core.stats_check_ms = bench_expire ? EXPIRE_BENCH_CHECK_MS : 1000;
+    core.max_flowtable_entries = bench_flows;
+    core.port_stats_cache_ms = 1000;
+
+    AIM_TRUE_OR_DIE(ind_core_init(&core) == INDIGO_ERROR_NONE);
+    AIM_TRUE_OR_DIE(ind_core_enable_set(1) == INDIGO_ERROR_NONE);
+
+    if (bench_gentable) {
+        gentable_config.entries = bench_flows;
+        gentable_config.rounds = bench_rounds;
+        rv = gentable_bench_run(&gentable_config);
+        goto done;
+    }
+
+    if (bench_expire) {
+        expire_config.flows = bench_flows;
+        rv = expire_bench_run(&expire_config);
+        goto done;
+    }
+
+    if (bench_match_scan) {
+        match_config.flows = bench_flows;
+        match_config.rounds = bench_rounds;
+        rv = match_bench_run(&match_config);
+        goto done;
+    }
+
+    printf("%d flows, %s match, %d priorities, overlap check %s, "
+           "batching %s\n",
+           bench_flows, bench_shape_names[bench_shape], bench_priorities,
+           bench_check_overlap ? "on" : "off", bench_batch ? "on" : "off");
+
+    for (round = 0; round < bench_rounds; round++) {
+        if (bench_rounds > 1) {
+            printf("round %d\n", round + 1);
+        }
+
+        for (i = 0; i < ARRAY_SIZE(bench_phases); i++) {
+            heap_before = heap_in_use();
+            if (bench_phase_run(&bench_phases[i]) < 0) {
+                rv = -1;
+                goto done;
+            }
+
+            if (bench_phases[i].object_id == OF_FLOW_ADD) {
+                indigo_mem_tag_stats_get(INDIGO_MEM_TAG_FLOW_ENTRY,
+                                         &tag_stats);
+                printf("memory per flow: %.1f bytes flowtable entries, "
+                       "%.1f bytes heap\n",
+                       (double)tag_stats.live_bytes / bench_flows,
+                       ((double)heap_in_use() - heap_before) / bench_flows);
+            }
+        }
+    }
+
+done:
+    ind_core_enable_set(0);
+    ind_core_finish();
+
+    free(latency_ns);
+    free(submit_ns);
+
+    return rv < 0 ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+
+/******************************************************************************
+ *
+ *  /targets/benchmarks/OFStateManager/match.c
+ *
+ *  OFStateManager flowtable match scan benchmark
+ *
+ *  Fills the flowtable with OpenFlow 1.3 flows on a varying subset of
+ *  fields, many of them overlapping, then scans it with queries of the
+ *  same kind in each match mode. Every query is run twice over the
+ *  whole table: once calling ft_entry_meta_match on each entry, which
+ *  compares the entry's compact match against the of_match_t query, and
+ *  once through ft_read_iter, which builds the flat query once and
+ *  compares each entry against that, as flow stats and flow-mod
+ *  iterators do.
+ *
+ *  Reports nanoseconds per entry for both, and fails if they select
+ *  different entries.
+ *
+ *****************************************************************************/
+#define AIM_LOG_MODULE_NAME ofstatemanager_bench
+#include <AIM/aim_log.h>
+
+#include <indigo/indigo.h>
+#include <loci/loci.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ft.h>
+#include "ofstatemanager_decs.h"
+#include "bench.h"
+
+#define ARRAY_SIZE(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/* Flows sharing a priority are kept distinct by metadata */
+#define MATCH_BENCH_PRIORITIES 1000
+
+static const match_bench_config_t *config;
+
+static const struct {
+    const char *name;
+    of_match_mode_t mode;
+} match_bench_modes[] = {
+    { "non_strict", OF_MATCH_NON_STRICT },
+    { "strict",     OF_MATCH_STRICT },
+    { "overlap",    OF_MATCH_OVERLAP },
+};
+
+/*
+ * A match on a varying subset of fields, with the upper half of
+ * metadata set to seq
+ */
+static void
+match_bench_match(int idx, uint32_t seq, of_match_t *match)
+{
+    memset(match, 0, sizeof(*match));
+    match->version = OF_VERSION_1_3;
+    if (idx & 1) {
+        match->fields.in_port = 1 + idx % 3;
+        match->masks.in_port = 0xffffffff;
+    }
+    if (idx & 2) {
+        match->fields.eth_type = 0x0800;
+        match->masks.eth_type = 0xffff;
+        match->fields.ipv4_dst = 0x0a000000 | (idx % 5) << 8 | idx % 7;
+        match->masks.ipv4_dst = (idx & 4) ? 0xffffff00 : 0xffffffff;
+    }
+    if (idx & 8) {
+        match->fields.vlan_vid = 0x1000 | idx % 4;
+        match->masks.vlan_vid = (idx & 16) ? 0x1000 : 0x1fff;
+    }
+    if (idx & 32) {
+        match->fields.eth_dst.addr[5] = idx % 3;
+        memset(&match->masks.eth_dst, 0xff, sizeof(match->masks.eth_dst));
+    }
+    match->fields.metadata = (uint64_t)seq << 32 | idx % 6;
+    match->masks.metadata = (seq ? 0xffffffff00000000ULL : 0) |
+        ((idx & 64) ? 0xff : 0);
+    /* Field bits outside the mask are ignored */
+    match->fields.tcp_dst = idx;
+}
+
+static of_object_t *
+match_bench_flow_add(int idx)
+{
+    of_object_t *obj = of_flow_add_new(OF_VERSION_1_3);
+    of_match_t match;
+
+    AIM_TRUE_OR_DIE(obj != NULL);
+    match_bench_match(idx, 1 + idx / MATCH_BENCH_PRIORITIES, &match);
+    of_flow_add_xid_set(obj, idx);
+    of_flow_add_cookie_set(obj, idx);
+    of_flow_add_priority_set(obj, 1 + idx % MATCH_BENCH_PRIORITIES);
+    AIM_TRUE_OR_DIE(of_flow_add_match_set(obj, &match) == 0);
+    return obj;
+}
+
+/****************************************************************
+ * Measurement
+ ****************************************************************/
+
+struct match_bench_scan {
+    of_meta_match_t *query;
+    int count;
+};
+
+static void
+match_bench_meta_match(void *cookie, ft_entry_t *entry)
+{
+    struct match_bench_scan *scan = cookie;
+
+    if (ft_entry_meta_match(scan->query, entry)) {
+        scan->count++;
+    }
+}
+
+static void
+match_bench_count(void *cookie, ft_entry_t *entry)
+{
+    struct match_bench_scan *scan = cookie;
+
+    scan->count++;
+}
+
+int
+match_bench_run(const match_bench_config_t *_config)
+{
+    ft_status_t *status = FT_STATUS(ind_core_ft);
+    struct match_bench_scan scan, flat_scan;
+    of_meta_match_t query;
+    ft_read_t read;
+    uint64_t start, scalar_ns, flat_ns;
+    int64_t visited, matched;
+    int mode, round, idx, rv = 0;
+
+    config = _config;
+
+    for (idx = 0; idx < config->flows; idx++) {
+        handle_message(match_bench_flow_add(idx), idx);
+    }
+    do_barrier();
+
+    if (bench_errors > 0 || status->current_count != config->flows) {
+        AIM_LOG_ERROR("flowtable has %d entries after %d adds, %d errors",
+                      status->current_count, config->flows, bench_errors);
+        return -1;
+    }
+
+    printf("%d flows, %d queries, %d rounds\n",
+           config->flows, config->queries, config->rounds);
+
+    AIM_TRUE_OR_DIE(ft_read_lock(ind_core_ft, &read) == INDIGO_ERROR_NONE);
+
+    for (mode = 0; mode < ARRAY_SIZE(match_bench_modes); mode++) {
+        scalar_ns = flat_ns = 0;
+        visited = matched = 0;
+
+        for (round = 0; round < config->rounds; round++) {
+            for (idx = 0; idx < config->queries; idx++) {
+                memset(&query, 0, sizeof(query));
+                match_bench_match(idx, 0, &query.match);
+                query.mode = match_bench_modes[mode].mode;
+                query.table_id = TABLE_ID_ANY;
+                query.out_port = OF_PORT_DEST_WILDCARD;
+
+                scan = (struct match_bench_scan) { .query = &query };
+                start = now_ns();
+                ft_read_iter(ind_core_ft, NULL, match_bench_meta_match, &scan);
+                scalar_ns += now_ns() - start;
+
+                flat_scan = (struct match_bench_scan) { .query = &query };
+                start = now_ns();
+                ft_read_iter(ind_core_ft, &query, match_bench_count,
+                             &flat_scan);
+                flat_ns += now_ns() - start;
+
+                if (scan.count != flat_scan.count) {
+                    AIM_LOG_ERROR("%s query %d: ft_entry_meta_match selects "
+                                  "%d entries, ft_read_iter %d",
+                                  match_bench_modes[mode].name, idx,
+                                  scan.count, flat_scan.count);
+                    rv = -1;
+                }
+
+                visited += status->current_count;
+                matched += scan.count;
+            }
+        }
+
+        printf("%-14s scalar %7.1f ns/entry  flat %7.1f ns/entry  "
+               "%5.1f%% matched\n",
+               match_bench_modes[mode].name,
+               (double)scalar_ns / visited, (double)flat_ns / visited,
+               100.0 * matched / visited);
+    }
+
+    ft_read_unlock(ind_core_ft, &read);
+
+    return rv;
+}
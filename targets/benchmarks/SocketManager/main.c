@@ -0,0 +1,635 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/******************************************************************************
+ *
+ *  /targets/benchmarks/SocketManager/main.c
+ *
+ *  SocketManager event loop benchmarks
+ *
+ *  idle_sockets  Cost of one ind_soc_select_and_run pass with one
+ *                always-readable socket and N idle ones
+ *  timers        Timer lateness with many timers at mixed priorities
+ *                and periods
+ *  yield         How evenly tasks that yield with ind_soc_should_yield
+ *                share the loop, and how long their slices run
+ *  wakeup        Time from another thread writing to a socket, or
+ *                posting a task, until the callback runs
+ *
+ *  Each result is printed as one JSON object per line on stdout, tagged
+ *  with the benchmark and backend, so runs of different backends or
+ *  builds on the same machine can be compared with a script.
+ *
+ *****************************************************************************/
+
+#include <SocketManager/socketmanager_config.h>
+#include <SocketManager/socketmanager.h>
+#include <indigo/indigo.h>
+#include <AIM/aim.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define ARRAY_SIZE(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static const char *backend_names[IND_SOC_BACKEND_COUNT] = {
+    "poll",
+    "epoll",
+    "io_uring",
+};
+
+/* Settings, see usage */
+static int bench_backend = -1;
+static const char *bench_only;
+static const char *bench_idle_counts = "0,64,1024,8192";
+static int bench_passes = 100000;
+static int bench_timers = 1000;
+static int bench_priorities = 4;
+static int bench_tasks = 8;
+static int bench_duration_ms = 1000;
+static int bench_wakeups = 10000;
+static int bench_wakeup_interval_us = 100;
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+sample_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Percentile of sorted samples, nearest rank */
+static uint64_t
+sample_percentile(const uint64_t *sorted, int count, int percent)
+{
+    int rank = ((int64_t)count * percent + 99) / 100;
+    return sorted[rank < 1 ? 0 : rank - 1];
+}
+
+/* Sort samples and print their p50, p90, p99 and max as JSON members */
+static void
+samples_print(const char *unit, uint64_t *samples, int count)
+{
+    if (count == 0) {
+        return;
+    }
+    qsort(samples, count, sizeof(*samples), sample_compare);
+    printf(", \"p50_%s\": %"PRIu64", \"p90_%s\": %"PRIu64
+           ", \"p99_%s\": %"PRIu64", \"max_%s\": %"PRIu64,
+           unit, sample_percentile(samples, count, 50),
+           unit, sample_percentile(samples, count, 90),
+           unit, sample_percentile(samples, count, 99),
+           unit, samples[count - 1]);
+}
+
+static void
+result_begin(const char *bench, ind_soc_backend_t backend)
+{
+    printf("{\"bench\": \"%s\", \"backend\": \"%s\"",
+           bench, backend_names[backend]);
+}
+
+static void
+result_end(void)
+{
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void
+pipe_open(int fds[2])
+{
+    AIM_TRUE_OR_DIE(pipe(fds) == 0);
+    AIM_TRUE_OR_DIE(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+    AIM_TRUE_OR_DIE(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+}
+
+/****************************************************************
+ * idle_sockets
+ ****************************************************************/
+
+static uint64_t active_callbacks;
+static uint64_t idle_callbacks;
+
+static void
+active_ready(int socket_id, void *cookie,
+             int read_ready, int write_ready, int error_seen)
+{
+    /* Never drained, so the socket stays readable */
+    active_callbacks++;
+}
+
+static void
+idle_ready(int socket_id, void *cookie,
+           int read_ready, int write_ready, int error_seen)
+{
+    idle_callbacks++;
+}
+
+static void
+bench_idle_sockets(ind_soc_backend_t backend, int idle)
+{
+    int (*fds)[2] = calloc(idle + 1, sizeof(*fds));
+    uint64_t *samples = calloc(bench_passes, sizeof(*samples));
+    uint64_t start, total;
+    int i;
+
+    AIM_TRUE_OR_DIE(fds != NULL && samples != NULL);
+
+    for (i = 0; i <= idle; i++) {
+        pipe_open(fds[i]);
+        AIM_TRUE_OR_DIE(ind_soc_socket_register(
+            fds[i][0], i == 0 ? active_ready : idle_ready, NULL) == 0);
+    }
+    AIM_TRUE_OR_DIE(write(fds[0][1], "x", 1) == 1);
+
+    /* Let the backend settle its registrations */
+    for (i = 0; i < 100; i++) {
+        ind_soc_select_and_run(0);
+    }
+
+    active_callbacks = idle_callbacks = 0;
+    total = now_ns();
+    for (i = 0; i < bench_passes; i++) {
+        start = now_ns();
+        ind_soc_select_and_run(0);
+        samples[i] = now_ns() - start;
+    }
+    total = now_ns() - total;
+
+    result_begin("idle_sockets", backend);
+    printf(", \"idle_sockets\": %d, \"passes\": %d, \"ns_per_pass\": %.1f"
+           ", \"active_callbacks\": %"PRIu64", \"idle_callbacks\": %"PRIu64,
+           idle, bench_passes, (double)total / bench_passes,
+           active_callbacks, idle_callbacks);
+    samples_print("ns", samples, bench_passes);
+    result_end();
+
+    for (i = 0; i <= idle; i++) {
+        ind_soc_socket_unregister(fds[i][0]);
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+
+    free(samples);
+    free(fds);
+}
+
+/****************************************************************
+ * timers
+ ****************************************************************/
+
+typedef struct bench_timer_s {
+    uint64_t due_ns;
+    int period_ms;
+    int priority;
+} bench_timer_t;
+
+/* Lateness of each firing, split by priority */
+static uint64_t *lateness_samples;
+static int *lateness_counts;
+static int lateness_max;
+
+static void
+timer_fired(void *cookie)
+{
+    bench_timer_t *timer = cookie;
+    uint64_t now = now_ns();
+    int p = timer->priority;
+
+    if (lateness_counts[p] < lateness_max) {
+        lateness_samples[p * lateness_max + lateness_counts[p]++] =
+            now > timer->due_ns ? (now - timer->due_ns) / 1000 : 0;
+    }
+    timer->due_ns = now + timer->period_ms * 1000000ULL;
+}
+
+static void
+bench_timer_run(ind_soc_backend_t backend)
+{
+    bench_timer_t *timers = calloc(bench_timers, sizeof(*timers));
+    ind_soc_stats_t *stats = calloc(1, sizeof(*stats));
+    uint64_t start, end;
+    int i, p;
+
+    /* Periods are at least 1 ms, so every firing fits */
+    lateness_max = ((bench_timers + bench_priorities - 1) / bench_priorities) *
+        (bench_duration_ms + 1);
+    lateness_samples = calloc((size_t)bench_priorities * lateness_max,
+                              sizeof(*lateness_samples));
+    lateness_counts = calloc(bench_priorities, sizeof(*lateness_counts));
+    AIM_TRUE_OR_DIE(timers != NULL && stats != NULL &&
+                    lateness_samples != NULL && lateness_counts != NULL);
+
+    start = now_ns();
+    for (i = 0; i < bench_timers; i++) {
+        timers[i].period_ms = 1 + i % 10;
+        timers[i].priority = i % bench_priorities;
+        timers[i].due_ns = start + timers[i].period_ms * 1000000ULL;
+        AIM_TRUE_OR_DIE(ind_soc_timer_event_register_with_priority(
+            timer_fired, &timers[i], timers[i].period_ms,
+            timers[i].priority) == 0);
+    }
+
+    ind_soc_stats_clear();
+    end = start + bench_duration_ms * 1000000ULL;
+    while (now_ns() < end) {
+        ind_soc_select_and_run(10);
+    }
+    ind_soc_stats_get(stats);
+
+    for (p = 0; p < bench_priorities; p++) {
+        result_begin("timers", backend);
+        printf(", \"timers\": %d, \"priorities\": %d, \"priority\": %d"
+               ", \"passes\": %"PRIu64", \"fired\": %d",
+               bench_timers, bench_priorities, p, stats->iterations,
+               lateness_counts[p]);
+        samples_print("late_us", &lateness_samples[p * lateness_max],
+                      lateness_counts[p]);
+        result_end();
+    }
+
+    for (i = 0; i < bench_timers; i++) {
+        ind_soc_timer_event_unregister(timer_fired, &timers[i]);
+    }
+
+    free(lateness_counts);
+    free(lateness_samples);
+    free(stats);
+    free(timers);
+}
+
+/****************************************************************
+ * yield
+ ****************************************************************/
+
+typedef struct bench_task_s {
+    uint64_t units;
+} bench_task_t;
+
+static volatile int tasks_stop;
+static int tasks_running;
+static uint64_t *slice_samples;
+static int slice_count, slice_max;
+
+/* A small unit of work between yield checks */
+static inline void
+task_work(void)
+{
+    volatile uint32_t x = 0;
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        x += i;
+    }
+}
+
+static ind_soc_task_status_t
+task_run(void *cookie)
+{
+    bench_task_t *task = cookie;
+    uint64_t start = now_ns();
+
+    if (tasks_stop) {
+        tasks_running--;
+        return IND_SOC_TASK_FINISHED;
+    }
+
+    do {
+        task_work();
+        task->units++;
+    } while (!ind_soc_should_yield());
+
+    if (slice_count < slice_max) {
+        slice_samples[slice_count++] = (now_ns() - start) / 1000;
+    }
+
+    return IND_SOC_TASK_CONTINUE;
+}
+
+static void
+bench_yield(ind_soc_backend_t backend)
+{
+    bench_task_t *tasks = calloc(bench_tasks, sizeof(*tasks));
+    uint64_t end, sum = 0, min = UINT64_MAX, max = 0;
+    double sum_sq = 0;
+    int i;
+
+    slice_max = bench_duration_ms * 2 + bench_tasks;
+    slice_samples = calloc(slice_max, sizeof(*slice_samples));
+    AIM_TRUE_OR_DIE(tasks != NULL && slice_samples != NULL);
+    slice_count = 0;
+    tasks_stop = 0;
+
+    for (i = 0; i < bench_tasks; i++) {
+        AIM_TRUE_OR_DIE(ind_soc_task_register(task_run, &tasks[i],
+                                              IND_SOC_DEFAULT_PRIORITY) == 0);
+    }
+    tasks_running = bench_tasks;
+
+    end = now_ns() + bench_duration_ms * 1000000ULL;
+    while (now_ns() < end) {
+        ind_soc_select_and_run(0);
+    }
+    tasks_stop = 1;
+    while (tasks_running > 0) {
+        ind_soc_select_and_run(0);
+    }
+
+    for (i = 0; i < bench_tasks; i++) {
+        sum += tasks[i].units;
+        sum_sq += (double)tasks[i].units * tasks[i].units;
+        min = tasks[i].units < min ? tasks[i].units : min;
+        max = tasks[i].units > max ? tasks[i].units : max;
+    }
+
+    /* Jain's index: 1.0 when every task did the same amount of work */
+    result_begin("yield", backend);
+    printf(", \"tasks\": %d, \"timeslice_ms\": %d, \"units\": %"PRIu64
+           ", \"min_units\": %"PRIu64", \"max_units\": %"PRIu64
+           ", \"fairness\": %.4f, \"slices\": %d",
+           bench_tasks, SOCKETMANAGER_CONFIG_TIMESLICE_MS, sum, min, max,
+           sum_sq > 0 ? (double)sum * sum / (bench_tasks * sum_sq) : 0.0,
+           slice_count);
+    samples_print("slice_us", slice_samples, slice_count);
+    result_end();
+
+    free(slice_samples);
+    free(tasks);
+}
+
+/****************************************************************
+ * wakeup
+ ****************************************************************/
+
+static int wakeup_fds[2];
+static int wakeup_use_task;
+static uint64_t *wakeup_samples;
+static volatile int wakeup_count;
+
+static ind_soc_task_status_t
+wakeup_task(void *cookie)
+{
+    uint64_t sent = (uint64_t)(uintptr_t)cookie;
+    wakeup_samples[wakeup_count] = now_ns() - sent;
+    wakeup_count++;
+    return IND_SOC_TASK_FINISHED;
+}
+
+static void
+wakeup_ready(int socket_id, void *cookie,
+             int read_ready, int write_ready, int error_seen)
+{
+    uint64_t now = now_ns();
+    uint64_t sent;
+
+    while (read(socket_id, &sent, sizeof(sent)) == sizeof(sent)) {
+        if (wakeup_count < bench_wakeups) {
+            wakeup_samples[wakeup_count] = now - sent;
+            wakeup_count++;
+        }
+    }
+}
+
+/* Send one timestamp at a time, waiting for each to arrive */
+static void *
+wakeup_sender(void *arg)
+{
+    ind_soc_loop_t *loop = arg;
+    int i;
+
+    for (i = 0; i < bench_wakeups; i++) {
+        uint64_t sent;
+
+        usleep(bench_wakeup_interval_us);
+        sent = now_ns();
+        if (wakeup_use_task) {
+            AIM_TRUE_OR_DIE(ind_soc_loop_task_post(
+                loop, wakeup_task, (void *)(uintptr_t)sent,
+                IND_SOC_DEFAULT_PRIORITY) == 0);
+        } else {
+            AIM_TRUE_OR_DIE(write(wakeup_fds[1], &sent, sizeof(sent)) ==
+                            sizeof(sent));
+        }
+        while (wakeup_count <= i) {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void
+bench_wakeup(ind_soc_backend_t backend, int use_task)
+{
+    pthread_t thread;
+
+    wakeup_samples = calloc(bench_wakeups, sizeof(*wakeup_samples));
+    AIM_TRUE_OR_DIE(wakeup_samples != NULL);
+    wakeup_count = 0;
+    wakeup_use_task = use_task;
+
+    pipe_open(wakeup_fds);
+    AIM_TRUE_OR_DIE(ind_soc_socket_register(wakeup_fds[0], wakeup_ready,
+                                            NULL) == 0);
+
+    AIM_TRUE_OR_DIE(pthread_create(&thread, NULL, wakeup_sender,
+                                   ind_soc_loop_current()) == 0);
+    while (wakeup_count < bench_wakeups) {
+        ind_soc_select_and_run(100);
+    }
+    AIM_TRUE_OR_DIE(pthread_join(thread, NULL) == 0);
+
+    result_begin("wakeup", backend);
+    printf(", \"source\": \"%s\", \"wakeups\": %d, \"interval_us\": %d",
+           use_task ? "task_post" : "socket", bench_wakeups,
+           bench_wakeup_interval_us);
+    samples_print("ns", wakeup_samples, bench_wakeups);
+    result_end();
+
+    ind_soc_socket_unregister(wakeup_fds[0]);
+    close(wakeup_fds[0]);
+    close(wakeup_fds[1]);
+    free(wakeup_samples);
+}
+
+/****************************************************************
+ * Driver
+ ****************************************************************/
+
+static int
+bench_selected(const char *name)
+{
+    return bench_only == NULL || !strcmp(bench_only, name);
+}
+
+static void
+bench_backend_run(ind_soc_backend_t backend)
+{
+    ind_soc_config_t config = { 0 };
+    const char *p;
+
+    config.backend = backend;
+    AIM_TRUE_OR_DIE(ind_soc_init(&config) == INDIGO_ERROR_NONE);
+    AIM_TRUE_OR_DIE(ind_soc_enable_set(1) == INDIGO_ERROR_NONE);
+
+    if (bench_selected("idle_sockets")) {
+        for (p = bench_idle_counts; p != NULL && *p != '\0'; ) {
+            bench_idle_sockets(backend, atoi(p));
+            p = strchr(p, ',');
+            p = p ? p + 1 : NULL;
+        }
+    }
+
+    if (bench_selected("timers")) {
+        bench_timer_run(backend);
+    }
+
+    if (bench_selected("yield")) {
+        bench_yield(backend);
+    }
+
+    if (bench_selected("wakeup")) {
+        bench_wakeup(backend, 0);
+        bench_wakeup(backend, 1);
+    }
+
+    AIM_TRUE_OR_DIE(ind_soc_finish() == INDIGO_ERROR_NONE);
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-b backend] [-o bench] [-s idle,...] [-n passes]\n"
+            "       [-t timers] [-p priorities] [-k tasks] [-d ms]\n"
+            "       [-w wakeups] [-i interval_us]\n"
+            "  -b  poll, epoll or io_uring (default all)\n"
+            "  -o  only run idle_sockets, timers, yield or wakeup\n"
+            "  -s  idle socket counts (default %s)\n"
+            "  -n  event loop passes per idle socket count (default %d)\n"
+            "  -t  timers (default %d)\n"
+            "  -p  timer priorities (default %d)\n"
+            "  -k  yielding tasks (default %d)\n"
+            "  -d  timer and yield run time in ms (default %d)\n"
+            "  -w  wakeups per source (default %d)\n"
+            "  -i  time between wakeups in us (default %d)\n",
+            prog, bench_idle_counts, bench_passes, bench_timers,
+            bench_priorities, bench_tasks, bench_duration_ms,
+            bench_wakeups, bench_wakeup_interval_us);
+}
+
+static int
+parse_args(int argc, char *argv[])
+{
+    int c, i;
+
+    while ((c = getopt(argc, argv, "b:o:s:n:t:p:k:d:w:i:h")) != -1) {
+        switch (c) {
+        case 'b':
+            for (i = 0; i < ARRAY_SIZE(backend_names); i++) {
+                if (!strcmp(optarg, backend_names[i])) {
+                    break;
+                }
+            }
+            if (i == ARRAY_SIZE(backend_names)) {
+                return -1;
+            }
+            bench_backend = i;
+            break;
+        case 'o':
+            bench_only = optarg;
+            break;
+        case 's':
+            bench_idle_counts = optarg;
+            break;
+        case 'n':
+            bench_passes = atoi(optarg);
+            break;
+        case 't':
+            bench_timers = atoi(optarg);
+            break;
+        case 'p':
+            bench_priorities = atoi(optarg);
+            break;
+        case 'k':
+            bench_tasks = atoi(optarg);
+            break;
+        case 'd':
+            bench_duration_ms = atoi(optarg);
+            break;
+        case 'w':
+            bench_wakeups = atoi(optarg);
+            break;
+        case 'i':
+            bench_wakeup_interval_us = atoi(optarg);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (bench_passes < 1 || bench_timers < 1 || bench_priorities < 1 ||
+        bench_tasks < 1 || bench_duration_ms < 1 || bench_wakeups < 1 ||
+        bench_wakeup_interval_us < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    struct rlimit rl;
+    int backend;
+
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* Each idle socket is a pipe */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    for (backend = 0; backend < IND_SOC_BACKEND_COUNT; backend++) {
+        if (bench_backend < 0 || bench_backend == backend) {
+            bench_backend_run(backend);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,703 @@
+/****************************************************************
+ *
+ *        Copyright 2013, Big Switch Networks, Inc.
+ *
+ * Licensed under the Eclipse Public License, Version 1.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *        http://www.eclipse.org/legal/epl-v10.html
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ * either express or implied. See the License for the specific
+ * language governing permissions and limitations under the
+ * License.
+ *
+ ****************************************************************/
+
+/******************************************************************************
+ *
+ *  /targets/benchmarks/loci/main.c
+ *
+ *  LOCI encode/decode benchmarks
+ *
+ *  Covers the OpenFlow 1.3 messages that make up most of the agent's
+ *  traffic: flow_add with an OXM match and an instruction list,
+ *  flow_stats_reply, packet_in, packet_out, bsn_gentable_entry_add and
+ *  echo_request.
+ *
+ *  encode       Build the message from scratch with the LOCI setters
+ *  decode       of_object_new_from_message on the wire encoding, parsed
+ *               in place the way the connection manager does it
+ *  query        The flow_add accessors flow_mod_setup_query calls
+ *  match_get    of_flow_modify_match_get alone, the costly one of those
+ *  list_append  of_list_append of a cached flow stats entry into a
+ *               reply, the flow stats reply path in OFStateManager
+ *  append_bind  Encoding a flow stats entry in place at the end of a
+ *               reply, the path taken without a cached entry
+ *
+ *  Each operation is timed over -r runs of -n iterations (fewer for
+ *  encoding whole flow stats replies); the fastest and median runs are
+ *  printed as ns per message, or per entry for list_append and
+ *  append_bind, one JSON object per line on stdout.
+ *
+ *****************************************************************************/
+
+#include <AIM/aim.h>
+#include <loci/loci.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ARRAY_SIZE(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+#define BENCH_VERSION OF_VERSION_1_3
+#define BENCH_NO_BUFFER 0xffffffff
+
+/* Settings, see usage */
+static int bench_iterations = 100000;
+static int bench_runs = 5;
+static int bench_entries = 64;
+static int bench_frame_bytes = 128;
+static const char *bench_only_msg;
+static const char *bench_only_op;
+
+/* Results are folded in here so the compiler cannot drop the work */
+static volatile uint64_t bench_sink;
+
+static uint8_t bench_frame[1500];
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+sample_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/****************************************************************
+ * Message generation
+ ****************************************************************/
+
+/* A TCP 5-tuple match on an ingress port, as OXMs in 1.3 */
+static void
+bench_match(int idx, of_match_t *match)
+{
+    memset(match, 0, sizeof(*match));
+    match->fields.in_port = 1 + (idx & 0x3f);
+    match->masks.in_port = 0xffffffff;
+    match->fields.eth_type = 0x0800;
+    match->masks.eth_type = 0xffff;
+    match->fields.ipv4_src = 0x0a000000 | (idx >> 6);
+    match->masks.ipv4_src = 0xffffffff;
+    match->fields.ipv4_dst = 0x0b000000 | (idx & 0xffffff);
+    match->masks.ipv4_dst = 0xffffffff;
+    match->fields.ip_proto = 6;
+    match->masks.ip_proto = 0xff;
+    match->fields.tcp_dst = idx & 0xffff;
+    match->masks.tcp_dst = 0xffff;
+}
+
+/* write_metadata, apply_actions(output, group) and goto_table */
+static of_list_instruction_t *
+bench_instructions(int idx)
+{
+    of_list_instruction_t *instructions;
+    of_instruction_write_metadata_t *write_metadata;
+    of_instruction_apply_actions_t *apply;
+    of_instruction_goto_table_t *goto_table;
+    of_list_action_t actions;
+    of_action_output_t *output;
+    of_action_group_t *group;
+
+    instructions = of_list_instruction_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(instructions != NULL);
+
+    write_metadata = of_instruction_write_metadata_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(write_metadata != NULL);
+    of_instruction_write_metadata_metadata_set(write_metadata, idx);
+    of_instruction_write_metadata_metadata_mask_set(write_metadata, 0xffff);
+    AIM_TRUE_OR_DIE(of_list_append(instructions, write_metadata) == 0);
+    of_object_delete(write_metadata);
+
+    apply = of_instruction_apply_actions_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(apply != NULL);
+    of_instruction_apply_actions_actions_bind(apply, &actions);
+    output = of_action_output_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(output != NULL);
+    of_action_output_port_set(output, 1 + (idx & 0x3f));
+    of_action_output_max_len_set(output, 0);
+    AIM_TRUE_OR_DIE(of_list_append(&actions, output) == 0);
+    of_object_delete(output);
+    group = of_action_group_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(group != NULL);
+    of_action_group_group_id_set(group, idx & 0xff);
+    AIM_TRUE_OR_DIE(of_list_append(&actions, group) == 0);
+    of_object_delete(group);
+    AIM_TRUE_OR_DIE(of_list_append(instructions, apply) == 0);
+    of_object_delete(apply);
+
+    goto_table = of_instruction_goto_table_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(goto_table != NULL);
+    of_instruction_goto_table_table_id_set(goto_table, 1);
+    AIM_TRUE_OR_DIE(of_list_append(instructions, goto_table) == 0);
+    of_object_delete(goto_table);
+
+    return instructions;
+}
+
+static of_object_t *
+flow_add_build(int idx)
+{
+    of_flow_add_t *obj;
+    of_list_instruction_t *instructions;
+    of_match_t match;
+
+    obj = of_flow_add_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_flow_add_xid_set(obj, idx);
+    of_flow_add_cookie_set(obj, idx);
+    of_flow_add_table_id_set(obj, 0);
+    of_flow_add_idle_timeout_set(obj, 60);
+    of_flow_add_priority_set(obj, 1000);
+    of_flow_add_buffer_id_set(obj, BENCH_NO_BUFFER);
+    of_flow_add_out_port_set(obj, OF_PORT_DEST_WILDCARD);
+    of_flow_add_out_group_set(obj, OF_GROUP_ANY);
+
+    bench_match(idx, &match);
+    AIM_TRUE_OR_DIE(of_flow_add_match_set(obj, &match) == 0);
+
+    instructions = bench_instructions(idx);
+    AIM_TRUE_OR_DIE(of_flow_add_instructions_set(obj, instructions) == 0);
+    of_object_delete(instructions);
+
+    return obj;
+}
+
+/* Set a flow stats entry's fields, with its match and instructions */
+static void
+flow_stats_entry_fill(of_flow_stats_entry_t *entry, int idx)
+{
+    of_list_instruction_t *instructions;
+    of_match_t match;
+
+    of_flow_stats_entry_table_id_set(entry, 0);
+    of_flow_stats_entry_duration_sec_set(entry, idx);
+    of_flow_stats_entry_duration_nsec_set(entry, 0);
+    of_flow_stats_entry_priority_set(entry, 1000);
+    of_flow_stats_entry_idle_timeout_set(entry, 60);
+    of_flow_stats_entry_hard_timeout_set(entry, 0);
+    of_flow_stats_entry_cookie_set(entry, idx);
+    of_flow_stats_entry_packet_count_set(entry, idx);
+    of_flow_stats_entry_byte_count_set(entry, (uint64_t)idx * 64);
+
+    bench_match(idx, &match);
+    AIM_TRUE_OR_DIE(of_flow_stats_entry_match_set(entry, &match) == 0);
+
+    instructions = bench_instructions(idx);
+    AIM_TRUE_OR_DIE(of_flow_stats_entry_instructions_set(
+                        entry, instructions) == 0);
+    of_object_delete(instructions);
+}
+
+static of_flow_stats_entry_t *
+flow_stats_entry_build(int idx)
+{
+    of_flow_stats_entry_t *entry;
+
+    entry = of_flow_stats_entry_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(entry != NULL);
+    flow_stats_entry_fill(entry, idx);
+
+    return entry;
+}
+
+/* Die rather than time a short reply */
+static void
+flow_stats_append_check(int rv)
+{
+    if (rv < 0) {
+        AIM_DIE("%d flow stats entries do not fit in a reply, use a "
+                "smaller -e", bench_entries);
+    }
+}
+
+static of_object_t *
+flow_stats_reply_build(int idx)
+{
+    of_flow_stats_reply_t *obj;
+    of_list_flow_stats_entry_t list;
+    of_flow_stats_entry_t *entry;
+    int i;
+
+    obj = of_flow_stats_reply_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_flow_stats_reply_xid_set(obj, idx);
+    of_flow_stats_reply_entries_bind(obj, &list);
+
+    for (i = 0; i < bench_entries; i++) {
+        entry = flow_stats_entry_build(idx + i);
+        flow_stats_append_check(of_list_append(&list, entry));
+        of_object_delete(entry);
+    }
+
+    return obj;
+}
+
+static of_object_t *
+packet_in_build(int idx)
+{
+    of_packet_in_t *obj;
+    of_match_t match;
+    of_octets_t data = { bench_frame, bench_frame_bytes };
+
+    obj = of_packet_in_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_packet_in_xid_set(obj, idx);
+    of_packet_in_buffer_id_set(obj, BENCH_NO_BUFFER);
+    of_packet_in_total_len_set(obj, bench_frame_bytes);
+    of_packet_in_reason_set(obj, OF_PACKET_IN_REASON_ACTION);
+    of_packet_in_table_id_set(obj, 0);
+    of_packet_in_cookie_set(obj, idx);
+
+    memset(&match, 0, sizeof(match));
+    match.fields.in_port = 1 + (idx & 0x3f);
+    match.masks.in_port = 0xffffffff;
+    AIM_TRUE_OR_DIE(of_packet_in_match_set(obj, &match) == 0);
+
+    AIM_TRUE_OR_DIE(of_packet_in_data_set(obj, &data) == 0);
+
+    return obj;
+}
+
+static of_object_t *
+packet_out_build(int idx)
+{
+    of_packet_out_t *obj;
+    of_list_action_t *actions;
+    of_action_output_t *output;
+    of_octets_t data = { bench_frame, bench_frame_bytes };
+
+    obj = of_packet_out_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_packet_out_xid_set(obj, idx);
+    of_packet_out_buffer_id_set(obj, BENCH_NO_BUFFER);
+    of_packet_out_in_port_set(obj, OF_PORT_DEST_CONTROLLER);
+
+    actions = of_list_action_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(actions != NULL);
+    output = of_action_output_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(output != NULL);
+    of_action_output_port_set(output, 1 + (idx & 0x3f));
+    AIM_TRUE_OR_DIE(of_list_append(actions, output) == 0);
+    of_object_delete(output);
+    AIM_TRUE_OR_DIE(of_packet_out_actions_set(obj, actions) == 0);
+    of_object_delete(actions);
+
+    AIM_TRUE_OR_DIE(of_packet_out_data_set(obj, &data) == 0);
+
+    return obj;
+}
+
+static of_object_t *
+gentable_entry_add_build(int idx)
+{
+    of_bsn_gentable_entry_add_t *obj;
+    of_list_bsn_tlv_t *list;
+    of_bsn_tlv_port_t *port;
+    of_bsn_tlv_mac_t *mac;
+    of_mac_addr_t mac_addr = { { 0x02, 0, idx >> 24, idx >> 16,
+                                 idx >> 8, idx } };
+    of_checksum_128_t checksum = { idx, idx };
+
+    obj = of_bsn_gentable_entry_add_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_bsn_gentable_entry_add_xid_set(obj, idx);
+    of_bsn_gentable_entry_add_table_id_set(obj, 1);
+    of_bsn_gentable_entry_add_checksum_set(obj, checksum);
+
+    /* Key is ingress port and source MAC */
+    list = of_list_bsn_tlv_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(list != NULL);
+    port = of_bsn_tlv_port_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(port != NULL);
+    of_bsn_tlv_port_value_set(port, 1 + (idx & 0x3f));
+    AIM_TRUE_OR_DIE(of_list_append(list, port) == 0);
+    of_object_delete(port);
+    mac = of_bsn_tlv_mac_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(mac != NULL);
+    of_bsn_tlv_mac_value_set(mac, mac_addr);
+    AIM_TRUE_OR_DIE(of_list_append(list, mac) == 0);
+    of_object_delete(mac);
+    AIM_TRUE_OR_DIE(of_bsn_gentable_entry_add_key_set(obj, list) == 0);
+    of_object_delete(list);
+
+    /* Value is the MAC to rewrite it to */
+    list = of_list_bsn_tlv_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(list != NULL);
+    mac = of_bsn_tlv_mac_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(mac != NULL);
+    mac_addr.addr[0] = 0x06;
+    of_bsn_tlv_mac_value_set(mac, mac_addr);
+    AIM_TRUE_OR_DIE(of_list_append(list, mac) == 0);
+    of_object_delete(mac);
+    AIM_TRUE_OR_DIE(of_bsn_gentable_entry_add_value_set(obj, list) == 0);
+    of_object_delete(list);
+
+    return obj;
+}
+
+static of_object_t *
+echo_request_build(int idx)
+{
+    of_echo_request_t *obj;
+    of_octets_t data = { bench_frame, 32 };
+
+    obj = of_echo_request_new(BENCH_VERSION);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    of_echo_request_xid_set(obj, idx);
+    AIM_TRUE_OR_DIE(of_echo_request_data_set(obj, &data) == 0);
+
+    return obj;
+}
+
+/****************************************************************
+ * Operations
+ ****************************************************************/
+
+typedef struct bench_msg_s {
+    const char *name;
+    of_object_t *(*build)(int idx);
+    of_object_t *wire;          /* Built once, for decoding */
+} bench_msg_t;
+
+static bench_msg_t bench_msgs[] = {
+    { "flow_add", flow_add_build },
+    { "flow_stats_reply", flow_stats_reply_build },
+    { "packet_in", packet_in_build },
+    { "packet_out", packet_out_build },
+    { "bsn_gentable_entry_add", gentable_entry_add_build },
+    { "echo_request", echo_request_build },
+};
+
+/* The connection manager's read segments are released elsewhere */
+static void
+wire_buffer_keep(void *buf)
+{
+}
+
+/* Parse a message in place, as the connection manager does */
+static inline of_object_t *
+wire_parse(of_object_t *wire)
+{
+    of_object_t *obj;
+
+    obj = of_object_new_from_message(
+        OF_BUFFER_TO_MESSAGE(OF_OBJECT_BUFFER_INDEX(wire, 0)), wire->length);
+    AIM_TRUE_OR_DIE(obj != NULL);
+    OF_OBJECT_TO_WBUF(obj)->free = wire_buffer_keep;
+
+    return obj;
+}
+
+static void
+op_encode(bench_msg_t *msg, int iterations)
+{
+    of_object_t *obj;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        obj = msg->build(i);
+        bench_sink += obj->length;
+        of_object_delete(obj);
+    }
+}
+
+static void
+op_decode(bench_msg_t *msg, int iterations)
+{
+    of_object_t *obj;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        obj = wire_parse(msg->wire);
+        bench_sink += obj->object_id;
+        of_object_delete(obj);
+    }
+}
+
+static void
+op_query(bench_msg_t *msg, int iterations)
+{
+    of_flow_modify_t *obj = wire_parse(msg->wire);
+    struct {
+        uint8_t table_id;
+        of_match_t match;
+        uint16_t priority;
+        of_port_no_t out_port;
+        uint32_t out_group;
+        uint64_t cookie;
+        uint64_t cookie_mask;
+    } query;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        memset(&query, 0, sizeof(query));
+        of_flow_modify_table_id_get(obj, &query.table_id);
+        if (of_flow_modify_match_get(obj, &query.match) < 0) {
+            AIM_DIE("Failed to extract match from flow");
+        }
+        of_flow_add_priority_get(obj, &query.priority);
+        of_flow_add_out_port_get(obj, &query.out_port);
+        of_flow_add_out_group_get(obj, &query.out_group);
+        of_flow_add_cookie_get(obj, &query.cookie);
+        of_flow_add_cookie_mask_get(obj, &query.cookie_mask);
+        bench_sink += query.cookie + query.match.fields.tcp_dst;
+    }
+
+    of_object_delete(obj);
+}
+
+static void
+op_match_get(bench_msg_t *msg, int iterations)
+{
+    of_flow_modify_t *obj = wire_parse(msg->wire);
+    of_match_t match;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        if (of_flow_modify_match_get(obj, &match) < 0) {
+            AIM_DIE("Failed to extract match from flow");
+        }
+        bench_sink += match.fields.tcp_dst;
+    }
+
+    of_object_delete(obj);
+}
+
+/*
+ * As ind_core_flow_stats_entry_append: patch the counters of a cached
+ * entry and append it, starting a new reply every -e entries
+ */
+static void
+op_list_append(bench_msg_t *msg, int iterations)
+{
+    of_flow_stats_entry_t *entry = flow_stats_entry_build(0);
+    of_flow_stats_reply_t *reply = NULL;
+    of_list_flow_stats_entry_t list;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        if (i % bench_entries == 0) {
+            if (reply != NULL) {
+                bench_sink += reply->length;
+                of_object_delete(reply);
+            }
+            reply = of_flow_stats_reply_new(BENCH_VERSION);
+            AIM_TRUE_OR_DIE(reply != NULL);
+            of_flow_stats_reply_entries_bind(reply, &list);
+        }
+        of_flow_stats_entry_duration_sec_set(entry, i);
+        of_flow_stats_entry_packet_count_set(entry, i);
+        of_flow_stats_entry_byte_count_set(entry, (uint64_t)i * 64);
+        flow_stats_append_check(of_list_append(&list, entry));
+    }
+
+    of_object_delete(reply);
+    of_object_delete(entry);
+}
+
+/* As ind_core_flow_stats_snapshot_append, encoding each entry in place */
+static void
+op_append_bind(bench_msg_t *msg, int iterations)
+{
+    of_flow_stats_reply_t *reply = NULL;
+    of_list_flow_stats_entry_t list;
+    of_flow_stats_entry_t entry;
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        if (i % bench_entries == 0) {
+            if (reply != NULL) {
+                bench_sink += reply->length;
+                of_object_delete(reply);
+            }
+            reply = of_flow_stats_reply_new(BENCH_VERSION);
+            AIM_TRUE_OR_DIE(reply != NULL);
+            of_flow_stats_reply_entries_bind(reply, &list);
+        }
+        of_flow_stats_entry_init(&entry, BENCH_VERSION, -1, 1);
+        flow_stats_append_check(
+            of_list_flow_stats_entry_append_bind(&list, &entry));
+        flow_stats_entry_fill(&entry, i);
+    }
+
+    of_object_delete(reply);
+}
+
+typedef struct bench_op_s {
+    const char *name;
+    const char *msg;            /* Only for this message, or all if NULL */
+    const char *per;
+    void (*run)(bench_msg_t *msg, int iterations);
+} bench_op_t;
+
+static const bench_op_t bench_ops[] = {
+    { "encode", NULL, "message", op_encode },
+    { "decode", NULL, "message", op_decode },
+    { "query", "flow_add", "message", op_query },
+    { "match_get", "flow_add", "message", op_match_get },
+    { "list_append", "flow_stats_reply", "entry", op_list_append },
+    { "append_bind", "flow_stats_reply", "entry", op_append_bind },
+};
+
+static void
+bench_run(const bench_op_t *op, bench_msg_t *msg)
+{
+    double *samples = calloc(bench_runs, sizeof(*samples));
+    int iterations = bench_iterations;
+    uint64_t start;
+    int run;
+
+    AIM_TRUE_OR_DIE(samples != NULL);
+
+    /* Building a reply builds every entry in it */
+    if (op->run == op_encode && msg->build == flow_stats_reply_build) {
+        iterations = bench_iterations / bench_entries;
+        iterations = iterations < 1 ? 1 : iterations;
+    }
+
+    /* Warm the allocator and caches */
+    op->run(msg, iterations / 10 + 1);
+
+    for (run = 0; run < bench_runs; run++) {
+        start = now_ns();
+        op->run(msg, iterations);
+        samples[run] = (double)(now_ns() - start) / iterations;
+    }
+    qsort(samples, bench_runs, sizeof(*samples), sample_compare);
+
+    printf("{\"bench\": \"%s\", \"op\": \"%s\", \"of_version\": %d"
+           ", \"bytes\": %d", msg->name, op->name, BENCH_VERSION,
+           msg->wire->length);
+    if (msg->build == flow_stats_reply_build) {
+        printf(", \"entries\": %d", bench_entries);
+    }
+    printf(", \"per\": \"%s\", \"iterations\": %d, \"runs\": %d"
+           ", \"min_ns\": %.1f, \"median_ns\": %.1f}\n",
+           op->per, iterations, bench_runs,
+           samples[0], samples[bench_runs / 2]);
+    fflush(stdout);
+
+    free(samples);
+}
+
+/****************************************************************
+ * Main
+ ****************************************************************/
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n iterations] [-r runs] [-e entries] [-f bytes]\n"
+            "       [-m message] [-o op]\n"
+            "  -n  iterations per run (default %d)\n"
+            "  -r  runs of each operation (default %d)\n"
+            "  -e  entries per flow stats reply (default %d)\n"
+            "  -f  packet_in and packet_out frame bytes (default %d)\n"
+            "  -m  only run flow_add, flow_stats_reply, packet_in,\n"
+            "      packet_out, bsn_gentable_entry_add or echo_request\n"
+            "  -o  only run encode, decode, query, match_get,\n"
+            "      list_append or append_bind\n",
+            prog, bench_iterations, bench_runs, bench_entries,
+            bench_frame_bytes);
+}
+
+static int
+parse_args(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:e:f:m:o:h")) != -1) {
+        switch (c) {
+        case 'n':
+            bench_iterations = atoi(optarg);
+            break;
+        case 'r':
+            bench_runs = atoi(optarg);
+            break;
+        case 'e':
+            bench_entries = atoi(optarg);
+            break;
+        case 'f':
+            bench_frame_bytes = atoi(optarg);
+            break;
+        case 'm':
+            bench_only_msg = optarg;
+            break;
+        case 'o':
+            bench_only_op = optarg;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (bench_iterations < 1 || bench_runs < 1 || bench_entries < 1 ||
+        bench_frame_bytes < 0 || bench_frame_bytes > 1500) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    bench_msg_t *msg;
+    const bench_op_t *op;
+    int i, j;
+
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < (int)sizeof(bench_frame); i++) {
+        bench_frame[i] = i;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(bench_msgs); i++) {
+        msg = &bench_msgs[i];
+        if (bench_only_msg != NULL && strcmp(bench_only_msg, msg->name)) {
+            continue;
+        }
+
+        msg->wire = msg->build(0);
+        for (j = 0; j < ARRAY_SIZE(bench_ops); j++) {
+            op = &bench_ops[j];
+            if ((op->msg != NULL && strcmp(op->msg, msg->name)) ||
+                (bench_only_op != NULL && strcmp(bench_only_op, op->name))) {
+                continue;
+            }
+            bench_run(op, msg);
+        }
+        of_object_delete(msg->wire);
+        msg->wire = NULL;
+    }
+
+    return 0;
+}